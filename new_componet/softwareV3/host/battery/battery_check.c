@@ -0,0 +1,381 @@
+/**
+ * @file battery_check.c
+ * @brief Battery slot demultiplexing and state of charge over a simulated discharge
+ *
+ * Runs the firmware's adc_demux.c and battery_soc.c the way the capture
+ * and battery tasks do (audio_capture.c, battery_monitor.c):
+ *   scan        17 slots, the microphone in 16 and the battery divider in
+ *               the last, at 17 kHz; DMA frames of any length, split by
+ *               channel tag, and the battery sum taken after every frame
+ *   battery     every 5 s, the average battery code since the last period
+ *               to pin millivolts (a linear 12 dB calibration), times the
+ *               divider, into batt_soc_update()
+ * over a discharge of --hours from full to empty. The cell follows the
+ * firmware's own discharge curve at light load, sags a little while
+ * recording, and drops --wifi-mv for --wifi-s every 5 minutes (an upload).
+ *
+ * Demultiplexer checks: the microphone gets every sample in order with no
+ * gap across frames, exactly 16000 a second; the battery sum and count are
+ * exact; results from ADC2 or another channel, and microphone results past
+ * the buffer, are counted as stray and dropped; a trailing partial result
+ * is ignored; no battery slot in the pattern.
+ *
+ * State-of-charge checks: the curve's points, its ends and monotonicity;
+ * the filter's priming, step response at the time constant and stability
+ * at long intervals; no flicker on noise at a step boundary, no climb back
+ * when a load step ends, and a charger still raising it; over the
+ * discharge the percentage never rises and stays within --tolerance of the
+ * true charge, uploads included.
+ *
+ *   battery_check
+ *   battery_check --hours 8 --wifi-mv 200 --seed 2
+ *
+ * Exit status 1 if any check fails, 2 on bad arguments.
+ */
+
+#define _GNU_SOURCE
+#include "adc_demux.h"
+#include "battery_soc.h"
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIC_CH          3           // audio_capture.c: MIC_ADC_CHANNEL
+#define BATT_CH         6           // CONFIG_SALESTAG_BATTERY_ADC_CHANNEL
+#define SCAN_SLOTS      17          // audio_capture.c: ADC_SCAN_SLOTS
+#define SCAN_HZ         17000       // ADC_SCAN_FREQ_HZ
+#define MIC_HZ          16000
+#define FRAME_MAX       1024        // Results in one DMA read, at most
+#define MIC_BUF         1024        // AUDIO_BUFFER_FRAMES-sized buffer, with room
+#define PERIOD_MS       5000        // battery_monitor.c: BATT_PERIOD_MS
+#define DIVIDER_X100    200         // CONFIG_SALESTAG_BATTERY_DIVIDER_X100
+#define FULL_SCALE_MV   3100        // 12 dB attenuation, linear model of adc_cali
+#define REC_SAG_MV      10          // IR drop at the recording current
+#define WIFI_EVERY_S    300
+#define NOISE_CODES     3           // ADC noise, codes RMS
+
+static int s_failures;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        printf("  FAIL %s\n", what);
+        s_failures++;
+    }
+}
+
+static double rnd(void) {
+    return (rand() + 0.5) / ((double)RAND_MAX + 1.0);
+}
+
+static double gauss(void) {
+    return sqrt(-2.0 * log(rnd())) * cos(2.0 * M_PI * rnd());
+}
+
+// One conversion result, ADC_DIGI_OUTPUT_FORMAT_TYPE2
+static void put_result(uint8_t *p, uint8_t unit, uint8_t ch, uint16_t data) {
+    uint32_t w = (uint32_t)(data & 0xFFF) | ((uint32_t)(ch & 0xF) << 13) | ((uint32_t)(unit & 1) << 17);
+    p[0] = (uint8_t)w;
+    p[1] = (uint8_t)(w >> 8);
+    p[2] = (uint8_t)(w >> 16);
+    p[3] = (uint8_t)(w >> 24);
+}
+
+// ---------------------------------------------------------------------------
+// Demultiplexer on its own
+// ---------------------------------------------------------------------------
+
+static void check_demux(void) {
+    adc_demux_t d;
+    uint8_t buf[16 * ADC_DEMUX_RESULT_BYTES];
+    uint16_t mic[16];
+    uint32_t sum, count;
+
+    printf("demultiplexer\n");
+    adc_demux_init(&d, MIC_CH, BATT_CH);
+    check(!adc_demux_take_aux(&d, &sum, &count), "aux taken before any");
+
+    // Every field: the reserved bit and high bits are ignored, data kept whole
+    put_result(buf, 0, MIC_CH, 0xFFF);
+    put_result(buf + 4, 0, BATT_CH, 0x800);
+    put_result(buf + 8, 1, MIC_CH, 0x123);          // ADC2
+    put_result(buf + 12, 0, 9, 0x456);              // Neither channel
+    put_result(buf + 16, 0, MIC_CH, 0x001);
+    buf[17] |= 0x10;                                // Reserved bit 12
+    buf[19] |= 0xF0;                                // Above the unit bit
+    size_t n = adc_demux_split(&d, buf, 5 * ADC_DEMUX_RESULT_BYTES + 3, mic, 16);
+    check(n == 2 && mic[0] == 0xFFF && mic[1] == 0x001, "microphone results");
+    check(d.stray == 2, "ADC2 and a foreign channel counted as stray");
+    check(adc_demux_take_aux(&d, &sum, &count) && sum == 0x800 && count == 1, "aux result");
+    check(!adc_demux_take_aux(&d, &sum, &count), "aux kept after it was taken");
+
+    // Past the buffer: counted, not written
+    adc_demux_init(&d, MIC_CH, BATT_CH);
+    for (int i = 0; i < 8; i++) put_result(buf + 4 * i, 0, MIC_CH, (uint16_t)i);
+    n = adc_demux_split(&d, buf, 8 * ADC_DEMUX_RESULT_BYTES, mic, 5);
+    check(n == 5 && mic[4] == 4 && d.stray == 3, "microphone results past the buffer");
+
+    // No battery slot: its channel is stray like any other
+    adc_demux_init(&d, MIC_CH, ADC_DEMUX_NO_CHANNEL);
+    put_result(buf, 0, BATT_CH, 100);
+    put_result(buf + 4, 0, 15, 100);
+    n = adc_demux_split(&d, buf, 2 * ADC_DEMUX_RESULT_BYTES, mic, 16);
+    check(n == 0 && d.stray == 2 && !adc_demux_take_aux(&d, &sum, &count), "pattern without a battery slot");
+}
+
+// ---------------------------------------------------------------------------
+// State of charge on its own
+// ---------------------------------------------------------------------------
+
+// The firmware's curve points, for the check (battery_soc.c: s_curve)
+static const struct {
+    uint16_t mv;
+    uint8_t pct;
+} kCurve[] = {
+    { 4200, 100 }, { 4150, 95 }, { 4110, 90 }, { 4080, 85 }, { 4020, 80 },
+    { 3980, 75 },  { 3950, 70 }, { 3910, 65 }, { 3870, 60 }, { 3850, 55 },
+    { 3840, 50 },  { 3820, 45 }, { 3800, 40 }, { 3790, 35 }, { 3770, 30 },
+    { 3750, 25 },  { 3730, 20 }, { 3710, 15 }, { 3690, 10 }, { 3610, 5 },
+    { 3300, 0 },
+};
+#define CURVE_POINTS (sizeof(kCurve) / sizeof(kCurve[0]))
+
+// Resting cell voltage for a true charge, from the same curve
+static double cell_mv_at(double pct) {
+    if (pct >= 100) return kCurve[0].mv;
+    for (size_t i = 1; i < CURVE_POINTS; i++) {
+        if (pct >= kCurve[i].pct) {
+            double f = (pct - kCurve[i].pct) / (kCurve[i - 1].pct - kCurve[i].pct);
+            return kCurve[i].mv + f * (kCurve[i - 1].mv - kCurve[i].mv);
+        }
+    }
+    return kCurve[CURVE_POINTS - 1].mv;
+}
+
+static void check_soc(void) {
+    printf("state of charge\n");
+    bool points = true, mono = true;
+    for (size_t i = 0; i < CURVE_POINTS; i++) points &= batt_soc_from_mv(kCurve[i].mv) == kCurve[i].pct;
+    check(points, "curve points");
+    check(batt_soc_from_mv(4350) == 100 && batt_soc_from_mv(3300) == 0 && batt_soc_from_mv(2500) == 0,
+          "curve ends");
+    for (uint16_t mv = 2500; mv < 4400; mv++) mono &= batt_soc_from_mv(mv + 1) >= batt_soc_from_mv(mv);
+    check(mono, "curve not monotonic");
+
+    batt_soc_t s;
+    batt_soc_init(&s);
+    check(batt_soc_update(&s, 3840, 0) == 50 && s.mv == 3840.0f, "first sample primes the filter");
+
+    // Step of 100 mV: 63% after one time constant, in 5 s steps
+    batt_soc_init(&s);
+    batt_soc_update(&s, 3900, 0);
+    for (uint32_t t = 0; t < BATT_SOC_TAU_MS; t += PERIOD_MS) batt_soc_update(&s, 3800, PERIOD_MS);
+    double moved = (3900.0 - s.mv) / 100.0;
+    printf("  step response at tau %.2f (first order 0.63, backward Euler in 5 s steps 0.62)\n", moved);
+    check(moved > 0.58 && moved < 0.66, "step response at the time constant");
+
+    // An interval far past tau lands on the sample, never past it
+    batt_soc_update(&s, 4000, 3600000);
+    check(s.mv > 3950.0f && s.mv <= 4000.0f, "long interval overshoots");
+
+    // Noise of a few mV across a 5% step boundary: no flicker
+    batt_soc_init(&s);
+    batt_soc_update(&s, 3850, 0);
+    int changes = 0;
+    uint8_t last = s.pct;
+    for (int i = 0; i < 2000; i++) {
+        uint8_t p = batt_soc_update(&s, (uint16_t)(3850 + lround(gauss() * 4)), PERIOD_MS);
+        if (p != last) changes++;
+        last = p;
+    }
+    printf("  %d changes over 2000 noisy samples at a step boundary\n", changes);
+    check(changes <= 4, "flicker at a step boundary");
+
+    // An upload's load step: a small dip, and no climb back after it
+    batt_soc_init(&s);
+    batt_soc_update(&s, 3845, 0);
+    uint8_t before = s.pct;
+    for (int i = 0; i < 2; i++) batt_soc_update(&s, 3845 - 150, PERIOD_MS);
+    uint8_t low = s.pct;
+    for (int i = 0; i < 360; i++) batt_soc_update(&s, 3845, PERIOD_MS);
+    printf("  a 10 s 150 mV load step: %u%% -> %u%% -> %u%%\n", before, low, s.pct);
+    check(before - low <= 5 && s.pct == low, "an upload moves the charge or it climbs back");
+
+    // Charging: rises, but only BATT_SOC_RISE_MV above the last change
+    batt_soc_init(&s);
+    batt_soc_update(&s, 3700, 0);
+    bool early = false;
+    for (uint16_t mv = 3700; mv <= 4200; mv++) {
+        float from = s.pct_mv;
+        uint8_t was = s.pct, p = batt_soc_update(&s, mv, 60000);
+        if (p > was && s.mv < from + BATT_SOC_RISE_MV) early = true;
+    }
+    for (int i = 0; i < 60; i++) batt_soc_update(&s, 4200, 60000);
+    check(!early, "a rise before BATT_SOC_RISE_MV");
+    check(s.pct >= 98, "charging does not reach full");
+}
+
+// ---------------------------------------------------------------------------
+// Discharge through the scan
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    double hours;
+    double wifi_mv;
+    double wifi_s;
+    int tolerance;
+} opts_t;
+
+static void run_discharge(const opts_t *o) {
+    adc_demux_t d;
+    batt_soc_t soc;
+    adc_demux_init(&d, MIC_CH, BATT_CH);
+    batt_soc_init(&soc);
+
+    static uint8_t frame[FRAME_MAX * ADC_DEMUX_RESULT_BYTES];
+    static uint16_t mic[MIC_BUF];
+    uint64_t total = (uint64_t)(o->hours * 3600.0 * SCAN_HZ);
+    uint64_t slot = 0;
+    uint32_t next_mic = 0;              // Sequence in the microphone's 12 bits
+    uint64_t mic_got = 0, mic_bad = 0;
+    uint64_t period_sum = 0, period_count = 0;      // battery_monitor_feed_scan()
+    uint64_t truth_sum = 0, truth_count = 0;
+    uint64_t sum_bad = 0;
+    uint32_t elapsed_ms = 0;
+    bool rose = false;
+    int worst = 0, worst_wifi = 0, updates = 0;
+    uint8_t last = 0xFF;
+    double worst_at = 0;
+
+    printf("discharge over %.1f h, uploads of %.0f mV for %.0f s every %d s\n", o->hours, o->wifi_mv, o->wifi_s,
+           WIFI_EVERY_S);
+    printf("  hour  true%%  cell_mv  filtered  reported\n");
+    while (slot < total) {
+        // A DMA read of any length, not aligned to the pattern
+        size_t len = 1 + (size_t)(rnd() * FRAME_MAX);
+        if (len > total - slot) len = (size_t)(total - slot);
+        for (size_t i = 0; i < len; i++, slot++) {
+            if (slot % SCAN_SLOTS == SCAN_SLOTS - 1) {
+                double t_s = (double)slot / SCAN_HZ;
+                double pct = 100.0 * (1.0 - t_s / (o->hours * 3600.0));
+                double mv = cell_mv_at(pct) - REC_SAG_MV;
+                if (fmod(t_s, WIFI_EVERY_S) < o->wifi_s) mv -= o->wifi_mv;
+                double code = mv * 100.0 / DIVIDER_X100 * 4095.0 / FULL_SCALE_MV + gauss() * NOISE_CODES;
+                uint16_t c = code < 0 ? 0 : code > 4095 ? 4095 : (uint16_t)lround(code);
+                truth_sum += c;
+                truth_count++;
+                put_result(frame + 4 * i, 0, BATT_CH, c);
+            } else {
+                put_result(frame + 4 * i, 0, MIC_CH, (uint16_t)(next_mic++ & 0xFFF));
+            }
+        }
+        size_t n = adc_demux_split(&d, frame, len * ADC_DEMUX_RESULT_BYTES, mic, MIC_BUF);
+        for (size_t i = 0; i < n; i++) {
+            if (mic[i] != (uint16_t)(mic_got & 0xFFF)) mic_bad++;
+            mic_got++;
+        }
+        uint32_t sum, count;
+        if (adc_demux_take_aux(&d, &sum, &count)) {
+            period_sum += sum;
+            period_count += count;
+        }
+
+        uint32_t now_ms = (uint32_t)(slot * 1000 / SCAN_HZ);
+        if (now_ms - elapsed_ms < PERIOD_MS && slot < total) continue;
+        // battery_task(): average, calibrate, scale, filter
+        if (period_sum != truth_sum || period_count != truth_count) sum_bad++;
+        if (period_count == 0) continue;
+        uint32_t raw = (uint32_t)((period_sum + period_count / 2) / period_count);
+        uint32_t pin_mv = raw * FULL_SCALE_MV / 4095;
+        uint16_t cell_mv = (uint16_t)(pin_mv * DIVIDER_X100 / 100);
+        uint32_t dt_ms = updates ? now_ms - elapsed_ms : 0;
+        uint8_t pct = batt_soc_update(&soc, cell_mv, dt_ms);
+        elapsed_ms = now_ms;
+        updates++;
+        period_sum = period_count = truth_sum = truth_count = 0;
+
+        double t_s = now_ms / 1000.0;
+        double true_pct = 100.0 * (1.0 - t_s / (o->hours * 3600.0));
+        // After the filter settled from priming, which may have been in an upload
+        bool settled = t_s > 5.0 * BATT_SOC_TAU_MS / 1000.0;
+        if (settled && pct > last) rose = true;
+        last = pct;
+        if (settled) {
+            int err = abs((int)pct - (int)lround(true_pct));
+            if (err > worst) {
+                worst = err;
+                worst_at = true_pct;
+            }
+            if (fmod(t_s, WIFI_EVERY_S) < o->wifi_s + PERIOD_MS / 1000.0 && err > worst_wifi) worst_wifi = err;
+        }
+        if (updates % (int)(o->hours * 3600.0 / PERIOD_MS * 1000.0 / 8.0) == 0) {
+            printf("  %4.1f %6.1f %8u %9.1f %9u\n", t_s / 3600.0, true_pct, cell_mv, soc.mv, pct);
+        }
+    }
+
+    uint64_t expect_mic = total - total / SCAN_SLOTS;
+    printf("  microphone %llu samples (%.0f a second), %llu out of order, stray %lu\n",
+           (unsigned long long)mic_got, mic_got / (o->hours * 3600.0), (unsigned long long)mic_bad,
+           (unsigned long)d.stray);
+    printf("  %d battery updates, %llu with a wrong sum, worst error %d%% (at %.0f%%), %d%% around uploads\n",
+           updates, (unsigned long long)sum_bad, worst, worst_at, worst_wifi);
+    check(mic_got == expect_mic && mic_bad == 0 && d.stray == 0, "microphone samples lost, reordered or stray");
+    check(llabs((long long)(mic_got * 1000 / (uint64_t)(o->hours * 3600.0)) - MIC_HZ * 1000) <= 1000,
+          "microphone rate is not 16 kHz");
+    check(sum_bad == 0, "battery sum or count is not the battery slots'");
+    check(!rose, "reported charge rose while discharging");
+    check(worst <= o->tolerance, "reported charge outside the tolerance");
+    check(last <= 5, "not near empty at the end");
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --hours H            discharge from full to empty (default 6)\n"
+            "  --wifi-mv N          sag during an upload (default 150)\n"
+            "  --wifi-s N           upload length, every 300 s (default 10)\n"
+            "  --tolerance N        reported against true charge, %% (default 10)\n"
+            "  --seed N             (default 1)\n",
+            argv0);
+}
+
+int main(int argc, char **argv) {
+    opts_t o = { .hours = 6.0, .wifi_mv = 150.0, .wifi_s = 10.0, .tolerance = 10 };
+    unsigned seed = 1;
+
+    static const struct option opts[] = {
+        { "hours",     required_argument, 0, 'H' },
+        { "wifi-mv",   required_argument, 0, 'm' },
+        { "wifi-s",    required_argument, 0, 'w' },
+        { "tolerance", required_argument, 0, 't' },
+        { "seed",      required_argument, 0, 's' },
+        { "help",      no_argument,       0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", opts, NULL)) != -1) {
+        switch (opt) {
+        case 'H': o.hours = atof(optarg); break;
+        case 'm': o.wifi_mv = atof(optarg); break;
+        case 'w': o.wifi_s = atof(optarg); break;
+        case 't': o.tolerance = atoi(optarg); break;
+        case 's': seed = (unsigned)atoi(optarg); break;
+        default: usage(argv[0]); return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (o.hours < 0.5 || o.hours > 48 || o.wifi_mv < 0 || o.wifi_mv > 500 || o.wifi_s < 0 ||
+        o.wifi_s >= WIFI_EVERY_S || o.tolerance < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    srand(seed);
+
+    check_demux();
+    check_soc();
+    run_discharge(&o);
+    printf("%s\n", s_failures ? "FAILED" : "ok");
+    return s_failures ? 1 : 0;
+}
@@ -0,0 +1,326 @@
+/**
+ * @file chain_bench.c
+ * @brief Specialized against generic conditioning chain: same samples, cycles per block
+ *
+ * Builds the firmware's capture_chain.c and runs both entry points on the
+ * same synthetic microphone codes, 512-sample blocks as the capture task
+ * hands them over:
+ *   - equality: from a reset (through calibration) and from a preset
+ *     calibration, over --blocks blocks of a tone in noise with loud
+ *     bursts, over random codes across the whole 12-bit range, and in
+ *     500-sample blocks, so that calibration ends on a block edge. Both
+ *     builds must give the same samples and the same final state, and match
+ *     ref_condition(), the chain as audio_capture.c ran it before it moved to
+ *     capture_chain.c
+ *   - timing: each build per block, while calibrating (the first second of a
+ *     capture) and calibrated (the rest), best and median of --reps. Cycles
+ *     are the time-stamp counter on x86 and the monotonic clock scaled to
+ *     --cpu-mhz elsewhere; the host is not the target, so the ratio is what
+ *     carries over. CONFIG_SALESTAG_IRAM_BENCH reports the same two builds on
+ *     the ESP32-S3 (IRB chain_fixed, IRB chain_generic).
+ *
+ *   chain_bench
+ *   chain_bench --blocks 4000 --reps 500
+ *
+ * Exit status 1 if the builds differ in any sample or state.
+ */
+
+#define _GNU_SOURCE
+#include "capture_chain.h"
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define BLOCK     512             // AUDIO_BUFFER_FRAMES
+#define RATE_HZ   16000
+#define BIAS_CODE 1551            // 1.25 V
+
+static int s_failures;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        printf("  FAIL %s\n", what);
+        s_failures++;
+    }
+}
+
+static double rnd(void) {
+    return (rand() + 0.5) / ((double)RAND_MAX + 1.0);
+}
+
+// ---------------------------------------------------------------------------
+// Reference: the per-sample chain as audio_capture.c had it
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    float x1, y1, noise_floor, level, gain, cal_sum, cal_count;
+    uint32_t count;
+    bool calibrated;
+} ref_t;
+
+static void ref_reset(ref_t *r) {
+    memset(r, 0, sizeof(*r));
+    r->noise_floor = 1000.0f;
+    r->gain = 1.0f;
+}
+
+static void ref_condition(ref_t *r, const uint16_t *raw, int16_t *out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        float v = (float)raw[i] * 3.3f / 4096.0f;
+        if (!r->calibrated && r->count < 16000) {
+            r->cal_sum += fabsf(v - 1.25f);
+            r->cal_count += 1.0f;
+            r->count++;
+            if (r->count >= 16000) {
+                r->noise_floor = r->cal_sum / r->cal_count;
+                r->calibrated = true;
+                if (r->noise_floor > 0.1f) {
+                    r->gain = 1.0f / r->noise_floor;
+                    if (r->gain > 3.0f) r->gain = 3.0f;
+                }
+            }
+        }
+        float f = v - r->x1 + 0.995f * r->y1;
+        r->x1 = v;
+        r->y1 = f;
+        float ac = f - 1.25f;
+        if (r->calibrated) {
+            float rel = fabsf(ac) / r->noise_floor;
+            if (rel < 2.0f) {
+                r->gain = fminf(r->gain * 1.001f, 3.0f);
+            } else if (rel > 10.0f) {
+                r->gain = fmaxf(r->gain * 0.999f, 0.5f);
+            }
+            ac = ac * r->gain;
+        }
+        if (fabsf(ac) < 500.0f) ac = ac * 0.1f;
+        float s = ac * (32767.0f / (2.0f / 2.0f * 4096.0f / 3.3f));
+        if (s > 29490.0f) {
+            s = 29490.0f;
+        } else if (s < -29490.0f) {
+            s = -29490.0f;
+        }
+        r->level = 0.95f * r->level + (1.0f - 0.95f) * (s * s);
+        out[i] = (int16_t)s;
+    }
+}
+
+// ---------------------------------------------------------------------------
+
+// Tone in noise around the bias; every 5 s a half-second burst near full swing
+static void make_signal(uint16_t *codes, size_t n, bool random_codes) {
+    for (size_t i = 0; i < n; i++) {
+        if (random_codes) {
+            codes[i] = (uint16_t)(rand() & 0xFFF);
+            continue;
+        }
+        double t = (double)i / RATE_HZ;
+        double amp = fmod(t, 5.0) < 0.5 ? 1400 : 60;
+        double v = BIAS_CODE + amp * sin(2 * M_PI * 310 * t) + 8 * (rnd() - 0.5) * 2;
+        codes[i] = (uint16_t)(v < 0 ? 0 : v > 4095 ? 4095 : v);
+    }
+}
+
+static bool same_state(const capture_chain_t *a, const capture_chain_t *b) {
+    return memcmp(a, b, sizeof(*a)) == 0;
+}
+
+static bool ref_matches(const ref_t *r, const capture_chain_t *c) {
+    return r->x1 == c->dc_x1 && r->y1 == c->dc_y1 && r->noise_floor == c->noise_floor && r->level == c->signal_level &&
+           r->gain == c->gain && r->calibrated == c->calibrated;
+}
+
+// samples codes in blocks of block (at most BLOCK)
+static void check_equal(const uint16_t *codes, size_t samples, size_t block, bool preset, const char *name) {
+    static const capture_chain_params_t params = CAPTURE_CHAIN_PARAMS_DEFAULT;
+    capture_chain_t fixed, generic;
+    ref_t ref;
+    ref_reset(&ref);
+    if (preset) {
+        capture_chain_preset(&fixed, 0.02f, 2.5f);
+        capture_chain_preset(&generic, 0.02f, 2.5f);
+        ref.noise_floor = 0.02f;
+        ref.gain = 2.5f;
+        ref.calibrated = true;
+    } else {
+        capture_chain_reset(&fixed);
+        capture_chain_reset(&generic);
+    }
+    int16_t a[BLOCK], b[BLOCK], r[BLOCK];
+    size_t diff = 0, ref_diff = 0;
+    for (size_t k = 0; k + block <= samples; k += block) {
+        const uint16_t *in = codes + k;
+        capture_chain_run(&fixed, in, a, block);
+        capture_chain_run_generic(&generic, &params, in, b, block);
+        ref_condition(&ref, in, r, block);
+        for (size_t i = 0; i < block; i++) {
+            diff += a[i] != b[i];
+            ref_diff += a[i] != r[i];
+        }
+    }
+    bool state_ok = same_state(&fixed, &generic);
+    bool ref_ok = ref_matches(&ref, &fixed);
+    printf("  %-24s %7zu samples  %zu differ, %zu from the reference, state %s, clipped %lu\n", name,
+           samples / block * block, diff, ref_diff, state_ok && ref_ok ? "same" : "DIFFERENT",
+           (unsigned long)fixed.clip_count);
+    check(diff == 0 && state_ok, "specialized and generic builds differ");
+    check(ref_diff == 0 && ref_ok, "chain differs from the reference");
+}
+
+// ---------------------------------------------------------------------------
+// Timing
+// ---------------------------------------------------------------------------
+
+static double s_cpu_mhz;
+
+static uint64_t cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)((ts.tv_sec * 1e9 + ts.tv_nsec) * s_cpu_mhz / 1000.0);
+#endif
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+typedef struct {
+    uint64_t best;
+    uint64_t median;
+    double ns;
+} timing_t;
+
+static volatile int16_t s_sink;
+
+// One block per rep on a copy of the state, so every rep sees the same phase
+static timing_t time_block(bool generic, const capture_chain_t *start, const uint16_t *in, int reps) {
+    static const capture_chain_params_t params = CAPTURE_CHAIN_PARAMS_DEFAULT;
+    uint64_t *t = malloc(sizeof(uint64_t) * (size_t)reps);
+    int16_t out[BLOCK];
+    double ns_sum = 0;
+    for (int r = 0; r < reps; r++) {
+        capture_chain_t c = *start;
+        double n0 = now_ns();
+        uint64_t c0 = cycles();
+        if (generic) {
+            capture_chain_run_generic(&c, &params, in, out, BLOCK);
+        } else {
+            capture_chain_run(&c, in, out, BLOCK);
+        }
+        t[r] = cycles() - c0;
+        ns_sum += now_ns() - n0;
+        s_sink = out[BLOCK - 1];
+    }
+    qsort(t, (size_t)reps, sizeof(t[0]), cmp_u64);
+    timing_t res = { .best = t[0], .median = t[reps / 2], .ns = ns_sum / reps };
+    free(t);
+    return res;
+}
+
+static void bench(const uint16_t *codes, int reps) {
+    capture_chain_t calibrating, calibrated;
+    capture_chain_reset(&calibrating);
+    capture_chain_reset(&calibrated);
+    int16_t out[BLOCK];
+    // Ten blocks into the calibration, and well past it
+    for (int k = 0; k < 10; k++) capture_chain_run(&calibrating, codes + (size_t)k * BLOCK, out, BLOCK);
+    for (int k = 0; k < 64; k++) capture_chain_run(&calibrated, codes + (size_t)k * BLOCK, out, BLOCK);
+    const uint16_t *in_cal = codes + 10 * BLOCK, *in_run = codes + 64 * BLOCK;
+
+#if defined(__x86_64__) || defined(__i386__)
+    const char *clock = "TSC";
+#else
+    const char *clock = "monotonic clock scaled to --cpu-mhz";
+#endif
+    printf("Cycles per %d-sample block (%s, %d reps)\n", BLOCK, clock, reps);
+    printf("build        phase          best   median   per sample     ns\n");
+    timing_t res[2][2];
+    for (int g = 0; g < 2; g++) {
+        for (int p = 0; p < 2; p++) {
+            res[g][p] = time_block(g, p ? &calibrated : &calibrating, p ? in_run : in_cal, reps);
+            printf("%-11s  %-11s  %7llu  %7llu  %11.2f  %5.0f\n", g ? "generic" : "specialized",
+                   p ? "calibrated" : "calibrating", (unsigned long long)res[g][p].best,
+                   (unsigned long long)res[g][p].median, (double)res[g][p].median / BLOCK, res[g][p].ns);
+        }
+    }
+    printf("generic / specialized: calibrating %.2fx, calibrated %.2fx (medians)\n",
+           (double)res[1][0].median / res[0][0].median, (double)res[1][1].median / res[0][1].median);
+}
+
+// ---------------------------------------------------------------------------
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --blocks N          blocks compared (default 2000, 64 s)\n"
+            "  --reps N            timed runs per build and phase (default 2000)\n"
+            "  --cpu-mhz F         for the cycle count without a TSC (default 3000)\n"
+            "  --seed N            (default 1)\n",
+            argv0);
+}
+
+int main(int argc, char **argv) {
+    int blocks = 2000, reps = 2000;
+    unsigned seed = 1;
+    s_cpu_mhz = 3000;
+
+    static const struct option opts[] = {
+        { "blocks", required_argument, 0, 'b' },
+        { "reps", required_argument, 0, 'r' },
+        { "cpu-mhz", required_argument, 0, 'm' },
+        { "seed", required_argument, 0, 'S' },
+        { "help", no_argument, 0, 'h' },
+        { 0, 0, 0, 0 },
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "h", opts, NULL)) != -1) {
+        switch (c) {
+        case 'b': blocks = atoi(optarg); break;
+        case 'r': reps = atoi(optarg); break;
+        case 'm': s_cpu_mhz = atof(optarg); break;
+        case 'S': seed = (unsigned)strtoul(optarg, NULL, 0); break;
+        default: usage(argv[0]); return c == 'h' ? 0 : 2;
+        }
+    }
+    if (blocks < 64 || reps < 1 || s_cpu_mhz <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    srand(seed);
+
+    uint16_t *codes = malloc(sizeof(uint16_t) * (size_t)blocks * BLOCK);
+    uint16_t *noise = malloc(sizeof(uint16_t) * (size_t)blocks * BLOCK);
+    make_signal(codes, (size_t)blocks * BLOCK, false);
+    make_signal(noise, (size_t)blocks * BLOCK, true);
+
+    printf("Same samples, specialized against generic and the reference\n");
+    size_t samples = (size_t)blocks * BLOCK;
+    check_equal(codes, samples, BLOCK, false, "tone, from a reset");
+    check_equal(codes, samples, BLOCK, true, "tone, from a preset");
+    check_equal(noise, samples, BLOCK, false, "random codes");
+    // 16000 calibration samples end exactly on a block edge
+    check_equal(codes, samples, 500, false, "tone, 500-sample blocks");
+    bench(codes, reps);
+
+    free(codes);
+    free(noise);
+    printf("%s\n", s_failures ? "FAILED" : "ok");
+    return s_failures ? 1 : 0;
+}
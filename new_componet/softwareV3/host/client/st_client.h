@@ -0,0 +1,521 @@
+/**
+ * @file st_client.h
+ * @brief SalesTag transfer protocol client library
+ *
+ * Everything a receiver needs to download recordings from a tag, with no
+ * transport and no allocation: the app owns the BLE (or socket) connection,
+ * passes FILE_DATA and FILE_STATUS notifications in, and sends the bytes
+ * the command encoders produce to FILE_CTRL. Constants, header codecs and
+ * status names come from the firmware's own ft_proto.h, so the library
+ * cannot drift from the device.
+ *
+ * - Commands: st_cmd_*() encode FILE_CTRL writes
+ * - Status: st_status_decode() classifies FILE_STATUS codes
+ * - Reassembly: st_rx_t places data notifications at their file offsets
+ *   through a write callback, reorders what EATT bearers deliver out of
+ *   order, and keeps the byte ranges that never arrived (st_rx_missing)
+ * - Resume: the firmware always streams a file from offset 0, so a second
+ *   pass started with st_rx_begin_fill() writes only the missing ranges
+ * - Pull: st_pull_t asks for blocks itself (st_cmd_pull, READ_BLOCKS),
+ *   keeps a window of requests in flight sized by what arrives, asks
+ *   again for what was lost and skips ranges it already holds
+ * - FEC: st_cmd_fec() turns on repair symbols; ft_fec.c is built into the
+ *   library and ft_fec.h declares the block decoder
+ * - Sync: adv_state.c is built in too; adv_state_decode() reads what a tag
+ *   advertises as un-synced, st_cmd_sync_ack() confirms a stored recording
+ * - CRC: the firmware's crc32c variant, carry-less multiply folding where
+ *   the CPU has it; validates legacy integrity chunks (ble_integrity.h)
+ * - Formats: RAW v1 and SPCH headers, RAW sample blocks, SPCH frames
+ * - Planning: st_link_t estimates what the link delivers, st_plan() picks
+ *   per recording between RAW and the speech variants so a backlog fits
+ *   the connection time there is
+ *
+ * Plain C11 with a C ABI; Swift, Kotlin/JNI and Python ctypes bind to it
+ * directly. All state lives in caller-provided structs; nothing is
+ * thread-safe beyond one st_rx_t per thread.
+ */
+
+#ifndef ST_CLIENT_H
+#define ST_CLIENT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ST_CLIENT_VERSION   1
+
+//==============================================================================
+// Commands (FILE_CTRL writes)
+//==============================================================================
+
+#define ST_CMD_MAX  (1 + 255)   // Longest command: START_WITH_FILENAME
+
+// Each returns the number of bytes written to out (0 if it does not fit or is invalid)
+size_t st_cmd_start(uint8_t *out, size_t cap);
+size_t st_cmd_pause(uint8_t *out, size_t cap);
+size_t st_cmd_resume(uint8_t *out, size_t cap);
+size_t st_cmd_stop(uint8_t *out, size_t cap);
+size_t st_cmd_list(uint8_t *out, size_t cap);
+size_t st_cmd_select(uint8_t *out, size_t cap, uint8_t index);
+// Rejects names the firmware would answer with STAT_BAD_CMD
+size_t st_cmd_start_file(uint8_t *out, size_t cap, const char *filename);
+size_t st_cmd_start_id(uint8_t *out, size_t cap, uint32_t rec_id);
+// Same recording in another encoding (ST_VARIANT_*); the tag keeps the RAW file
+size_t st_cmd_start_id_variant(uint8_t *out, size_t cap, uint32_t rec_id, uint8_t variant);
+size_t st_cmd_profile(uint8_t *out, size_t cap, uint8_t seconds);
+// Erases the card; cluster_kb 0 = firmware default
+size_t st_cmd_format(uint8_t *out, size_t cap, uint8_t cluster_kb);
+// FEC for later transfers on this connection: r repairs per k notifications, r = 0 off
+size_t st_cmd_fec(uint8_t *out, size_t cap, uint8_t k, uint8_t r);
+// Recording rec_id is stored; crc32c over the stored copy (st_crc32c_update from 0xFFFFFFFF)
+size_t st_cmd_sync_ack(uint8_t *out, size_t cap, uint32_t rec_id, uint32_t crc32c);
+// Open rec_id (in variant) for READ_BLOCKS; block bytes per notification, 0 = largest for the MTU
+size_t st_cmd_pull(uint8_t *out, size_t cap, uint32_t rec_id, uint8_t variant, uint8_t block);
+// count (1-64) blocks of the open pull session from block on
+size_t st_cmd_read_blocks(uint8_t *out, size_t cap, uint32_t block, uint8_t count);
+
+//==============================================================================
+// Status (FILE_STATUS notifications)
+//==============================================================================
+
+typedef enum {
+    ST_STATUS_PROGRESS = 0,     // Transfer or operation under way (STARTED, PAUSED, ...)
+    ST_STATUS_DONE,             // Finished successfully (COMPLETE, FORMAT_DONE, ...)
+    ST_STATUS_REFUSED,          // Command not accepted; nothing was sent (BUSY, NO_FILE, ...)
+    ST_STATUS_FAILED,           // Transfer ended early (NOTIFY_FAIL, FILE_READ_FAIL, ...)
+    ST_STATUS_UNKNOWN,
+} st_status_kind_t;
+
+typedef struct {
+    uint8_t code;               // STAT_* from ft_proto.h
+    st_status_kind_t kind;
+    bool ends_transfer;         // No more data follows for the current transfer
+    const char *name;
+} st_status_t;
+
+st_status_t st_status_decode(uint8_t code);
+
+//==============================================================================
+// Reassembly
+//==============================================================================
+
+#define ST_RX_WINDOW      32    // Notifications held while an earlier one is missing
+#define ST_RX_SLOT_BYTES  512   // Largest payload held out of order (ATT value limit)
+#define ST_RX_MAX_RANGES  256   // Missing ranges tracked before st_rx_t gives up
+
+#define ST_SIZE_UNKNOWN   UINT64_MAX
+
+// Receives file bytes at their offset; return non-zero to abort the transfer
+typedef int (*st_write_fn)(void *ctx, uint64_t offset, const uint8_t *data, size_t len);
+
+typedef struct {
+    uint64_t offset;
+    uint64_t len;               // To ST_SIZE_UNKNOWN - offset when the end is unknown
+} st_range_t;
+
+typedef enum {
+    ST_RX_OK = 0,
+    ST_RX_DONE,                 // The eof packet is placed; nothing more is expected
+    ST_RX_BAD_PACKET,           // Shorter than its header or longer than a slot (counted, ignored)
+    ST_RX_WRITE_FAILED,         // The write callback failed
+    ST_RX_RESTART,              // Holes cannot be repaired (more than ST_RX_MAX_RANGES, or the
+                                // payload size changed after a loss); download the file again
+} st_rx_result_t;
+
+typedef struct {
+    uint32_t packets;           // Accepted data notifications
+    uint32_t duplicates;        // Same sequence number held twice
+    uint32_t reordered;         // Arrived ahead of a missing one and were held
+    uint32_t stale;             // Arrived after their slot was placed or declared lost
+    uint32_t lost;              // Declared lost (window overflow or end of pass)
+    uint32_t bad;               // Malformed notifications
+    uint64_t bytes_written;     // Bytes handed to the write callback
+} st_rx_stats_t;
+
+typedef struct {
+    uint32_t seq;               // Unwrapped sequence number
+    uint16_t len;
+    bool eof;
+    bool used;
+    uint8_t data[ST_RX_SLOT_BYTES];
+} st_rx_slot_t;
+
+// Opaque in spirit: use the functions below; the size is public so it can live on the stack
+typedef struct {
+    st_write_fn write;
+    void *ctx;
+    bool fill;                  // Second pass: write only what is in missing[]
+    bool done;
+    bool broken;                // ST_RX_RESTART was returned; sticky
+    bool lost_in_pass;          // Offsets after a loss rely on chunk
+    uint64_t size;              // Known file size or ST_SIZE_UNKNOWN
+    uint32_t next_seq;          // Next sequence number to place (unwrapped)
+    uint32_t high_seq;          // One past the highest sequence number held
+    uint64_t offset;            // File offset of next_seq
+    uint16_t chunk;             // Length of the non-final packets, sizes lost ones
+    st_rx_slot_t slots[ST_RX_WINDOW];
+    st_range_t missing[ST_RX_MAX_RANGES];
+    uint32_t missing_count;
+    st_rx_stats_t stats;
+} st_rx_t;
+
+/**
+ * @brief Start a transfer that writes everything it receives
+ * @param size File size if known (LIST reply, RAW header), else ST_SIZE_UNKNOWN
+ */
+void st_rx_begin(st_rx_t *rx, st_write_fn write, void *ctx, uint64_t size);
+
+/**
+ * @brief Start another pass over the same file that writes only the missing ranges
+ *
+ * Keeps missing[] and the size from the previous pass. Send START (or
+ * START_WITH_FILENAME) again and feed the new notifications.
+ */
+void st_rx_begin_fill(st_rx_t *rx);
+
+// Set the size once it is known (e.g. from the RAW header in the first packet)
+void st_rx_set_size(st_rx_t *rx, uint64_t size);
+
+/**
+ * @brief Feed one FILE_DATA notification (5-byte header + payload)
+ *
+ * Notifications carry a sequence number but no offset. A lost one is
+ * sized by the payload length of its neighbours, which the firmware keeps
+ * constant for a transfer (only the final packet is shorter); if that
+ * ever turns out wrong the result is ST_RX_RESTART. FEC notifications
+ * (after st_cmd_fec) are ST_RX_BAD_PACKET here: decode them with
+ * ft_fec_dec_*() from main/ft_fec.h, which the library includes. Pull
+ * notifications go to st_pull_feed().
+ */
+st_rx_result_t st_rx_feed(st_rx_t *rx, const uint8_t *notif, size_t len);
+
+/**
+ * @brief End the pass (status ended the transfer or the link dropped)
+ *
+ * Places whatever is held, declares the gaps lost and, without an eof
+ * packet, records everything from the last placed byte to the end as
+ * missing.
+ */
+st_rx_result_t st_rx_end(st_rx_t *rx);
+
+// True when the file is complete: eof seen and nothing missing
+bool st_rx_complete(const st_rx_t *rx);
+
+/**
+ * @brief Copy the missing ranges, lowest offset first
+ * @return Total number of missing ranges (may exceed max)
+ */
+size_t st_rx_missing(const st_rx_t *rx, st_range_t *out, size_t max);
+
+//==============================================================================
+// Pull
+//==============================================================================
+
+#define ST_PULL_MAX_REQS   16   // READ_BLOCKS in flight
+#define ST_PULL_MAX_SPANS  256  // Separate block ranges still to ask for
+
+typedef struct {
+    uint8_t window;             // Requests in flight at the start (default 2)
+    uint8_t window_max;         // Most requests in flight (default FT_PULL_QUEUE, what the tag queues)
+    uint8_t count;              // Blocks per request, 1-64 (default 16)
+    double timeout_s;           // Shortest wait before a request counts as lost (default 0.5)
+} st_pull_params_t;
+
+typedef struct {
+    uint32_t requests;          // READ_BLOCKS sent
+    uint32_t blocks;            // Data notifications accepted
+    uint32_t duplicates;        // Blocks that arrived again
+    uint32_t rerequested;       // Blocks asked for more than once
+    uint32_t timeouts;          // Requests given up on
+    uint32_t overruns;          // STAT_PULL_OVERRUN from the tag
+    uint32_t bad;               // Malformed or not pull notifications
+    uint64_t bytes_written;
+} st_pull_stats_t;
+
+typedef struct {
+    uint32_t block;
+    uint8_t count;
+    bool used;
+    uint64_t got;               // Bit i: block + i arrived
+    double sent_s;
+} st_pull_req_t;
+
+typedef struct {
+    uint32_t first;
+    uint32_t count;
+} st_pull_span_t;
+
+typedef struct {
+    st_write_fn write;
+    void *ctx;
+    uint64_t size;              // ST_SIZE_UNKNOWN until a notification tells
+    uint32_t blocks;            // Blocks in the file (UINT32_MAX while the size is unknown)
+    uint16_t block;             // Payload per block
+    st_pull_params_t params;
+    double window;              // Requests allowed in flight (additive increase, halved on loss)
+    double srtt;                // Smoothed request completion time (0 = none yet)
+    double cut_s;               // Last window cut: one per round trip
+    st_pull_req_t reqs[ST_PULL_MAX_REQS];
+    uint8_t inflight;
+    st_pull_span_t todo[ST_PULL_MAX_SPANS];     // Not held and not in flight, ascending
+    uint32_t todo_count;
+    bool failed;                // The write callback failed; sticky
+    st_pull_stats_t stats;
+} st_pull_t;
+
+/**
+ * @brief Start a pull download
+ * @param size  File size if known, else ST_SIZE_UNKNOWN (the tag sends it after STAT_PULL_READY)
+ * @param block Payload per block: the PULL block, or ft_pull_block_max(mtu) for 0
+ * @param params NULL for the defaults
+ */
+void st_pull_begin(st_pull_t *pl, st_write_fn write, void *ctx, uint64_t size, uint16_t block,
+                   const st_pull_params_t *params);
+
+/**
+ * @brief Do not ask for [offset, offset + len): the receiver already holds it
+ *
+ * Only whole blocks inside the range are skipped. Call after st_pull_begin()
+ * with what a previous download stored.
+ */
+void st_pull_skip(st_pull_t *pl, uint64_t offset, uint64_t len);
+
+/**
+ * @brief Next READ_BLOCKS to send, if the window has room
+ *
+ * Call after every notification, status and timer tick; requests that
+ * waited longer than the timeout go back to be asked for again.
+ * @return Bytes written to cmd, 0 if nothing should be sent now
+ */
+size_t st_pull_next(st_pull_t *pl, double now_s, uint8_t *cmd, size_t cap);
+
+/**
+ * @brief Feed one FILE_DATA notification of the pull session
+ * @return ST_RX_DONE once the whole file is written, ST_RX_OK, ST_RX_BAD_PACKET or ST_RX_WRITE_FAILED
+ */
+st_rx_result_t st_pull_feed(st_pull_t *pl, const uint8_t *notif, size_t len, double now_s);
+
+// STAT_PULL_OVERRUN: the tag dropped a request; the window shrinks and the request times out
+void st_pull_overrun(st_pull_t *pl, double now_s);
+
+/**
+ * @brief The session ended (link lost, STOP, idle): what was in flight is asked for again
+ *
+ * Open a new session with st_cmd_pull() and keep calling st_pull_next().
+ */
+void st_pull_relink(st_pull_t *pl);
+
+// True when every block of the file has been written
+bool st_pull_complete(const st_pull_t *pl);
+
+//==============================================================================
+// CRC
+//==============================================================================
+
+/**
+ * @brief Continue the firmware's crc32c (main/crc32c.c) over data
+ *
+ * Same polynomial, bit order and chaining as crc32c_update(); start with
+ * 0xFFFFFFFF for the value crc32c_calculate() returns. Uses carry-less
+ * multiply folding on x86-64 CPUs with PCLMULQDQ, slicing-by-8 elsewhere.
+ */
+uint32_t st_crc32c_update(uint32_t crc, const void *data, size_t len);
+
+// Name of the implementation in use ("pclmul" or "slice8")
+const char *st_crc32c_impl(void);
+
+// Force the portable implementation (benchmarks, cross-checks)
+void st_crc32c_force_portable(bool portable);
+
+// Legacy integrity chunk (main/ble_integrity.h): 16-byte header, payload, CRC32C
+#define ST_CHUNK_HEADER   16
+
+typedef struct {
+    uint16_t proto_ver;
+    uint16_t seq;
+    uint32_t file_id;
+    uint32_t offset;
+    uint16_t payload_len;
+    uint16_t flags;
+    const uint8_t *payload;     // Points into the chunk
+} st_chunk_t;
+
+/**
+ * @brief Decode a legacy integrity chunk and check its CRC
+ * @return false if it is truncated or the CRC does not match
+ */
+bool st_chunk_decode(const uint8_t *buf, size_t len, st_chunk_t *out);
+
+//==============================================================================
+// File formats
+//==============================================================================
+
+#define ST_HEADER_BYTES    32
+#define ST_RAW_SAMPLE      10
+
+typedef enum {
+    ST_FORMAT_UNKNOWN = 0,
+    ST_FORMAT_RAW_V1,           // "RAWA": 10-byte samples (ADC u16, ms u32, count u32)
+    ST_FORMAT_SPCH_V1,          // "SPCH": ADPCM speech frames (main/speech_codec.h)
+} st_format_t;
+
+typedef struct {
+    st_format_t format;
+    uint32_t version;
+    uint32_t sample_rate;       // Of the stored samples
+    uint32_t start_ms;
+    uint32_t end_ms;
+    uint32_t total_samples;     // RAW: samples in the file; SPCH: source samples at 16 kHz
+    uint32_t total_frames;      // SPCH only
+    uint16_t codec;             // SPCH only (speech_codec_mode_t)
+    uint32_t frame_bytes;       // SPCH only: every frame of a file has this size
+    uint64_t expected_size;     // Header plus samples or frames; 0 if not known (open RAW file)
+    uint32_t measured_rate_mhz; // RAW: ADC rate measured on the tag, milli-Hz; 0 = not recorded
+    bool resampled;             // RAW: samples were corrected to exactly sample_rate
+    bool open;                  // RAW: the recording never closed and was not finished at boot
+    bool recovered;             // RAW: finished at boot after a power loss or reset
+} st_file_info_t;
+
+/**
+ * @brief Decode a 32-byte file header
+ * @return false if the magic or version is not recognised
+ */
+bool st_header_decode(const uint8_t *hdr, size_t len, st_file_info_t *out);
+
+typedef struct {
+    uint16_t adc;
+    uint32_t timestamp_ms;
+    uint32_t count;
+} st_raw_sample_t;
+
+// Running checks over RAW v1 samples
+typedef struct {
+    uint32_t samples;
+    uint32_t out_of_range;      // ADC value above 4095
+    uint32_t count_gaps;        // sample_count did not follow its predecessor
+    uint32_t time_backwards;    // timestamp went down
+    bool have_prev;
+    st_raw_sample_t prev;
+} st_raw_check_t;
+
+/**
+ * @brief Decode and check RAW v1 samples
+ * @param data Sample bytes (after the header), a multiple of ST_RAW_SAMPLE
+ * @param out  Decoded samples, or NULL to only check
+ * @return Samples decoded
+ */
+size_t st_raw_decode(st_raw_check_t *chk, const uint8_t *data, size_t len, st_raw_sample_t *out);
+
+// RAW v1 ADC value to signed 16-bit PCM, as the firmware's speech transcoder does
+int16_t st_raw_to_pcm(uint16_t adc);
+
+// SPCH frames decode to at most this many samples each
+#define ST_SPCH_FRAME_SAMPLES  320
+
+typedef struct {
+    uint16_t codec;
+    uint16_t frame_bytes;
+    int16_t predictor;          // ADPCM state carried between frames
+    int8_t step_index;
+} st_spch_decoder_t;
+
+bool st_spch_decoder_init(st_spch_decoder_t *dec, const st_file_info_t *info);
+
+/**
+ * @brief Decode one SPCH frame of info->frame_bytes bytes
+ * @return Samples written to pcm (ST_SPCH_FRAME_SAMPLES max), 0 if malformed
+ */
+size_t st_spch_decode_frame(st_spch_decoder_t *dec, const uint8_t *frame, size_t len, int16_t *pcm);
+
+//==============================================================================
+// Planning
+//==============================================================================
+
+// START_BY_ID variants (FT_VARIANT_*): RAW, or a speech_codec_mode_t
+#define ST_VARIANT_RAW    0
+#define ST_VARIANT_WB4    1
+#define ST_VARIANT_NB4    2
+#define ST_VARIANT_NB2    3
+#define ST_VARIANT_NONE   0xFF    // Not fetched / nothing stored
+
+// "raw", "wb4", "nb4", "nb2" or "none"
+const char *st_variant_name(uint8_t variant);
+
+// Size of a recording of samples 16 kHz samples in a variant, header included
+uint64_t st_variant_size(uint8_t variant, uint64_t samples);
+
+/**
+ * Link throughput, from what the receiver sees. Feed the bytes delivered
+ * in each interval of about a second while a transfer runs (an interval
+ * with none counts too), and the time from each START to its first data.
+ * st_link_rate() is the weighted mean less half its mean deviation: a plan
+ * spans minutes, so a dropout of a few seconds costs its share of the
+ * window, not the whole link.
+ */
+#define ST_LINK_WEIGHT  0.05      // Of the newest sample: about the last 20 s
+
+typedef struct {
+    double rate;                // Bytes/s, weighted mean
+    double dev;                 // Weighted mean absolute deviation
+    double overhead_s;          // Per fetch: START to first data
+    uint32_t samples;
+} st_link_t;
+
+void st_link_init(st_link_t *l, double prior_rate, double prior_overhead_s);
+void st_link_sample(st_link_t *l, uint64_t bytes, double seconds);
+void st_link_overhead(st_link_t *l, double seconds);
+double st_link_rate(const st_link_t *l);
+
+typedef struct {
+    uint32_t id;
+    uint64_t samples;           // Recording length (RAW header, or estimated)
+    uint8_t have;               // Variant the receiver already stored (ST_VARIANT_NONE if none)
+    uint8_t ready;              // Bit v: variant v is on the card, no transcode needed (RAW always is)
+    uint8_t choice;             // Out: variant to fetch now, ST_VARIANT_NONE = not this time
+    double cost_s;              // Out: expected time for that fetch
+} st_plan_file_t;
+
+#define ST_PLAN_RESERVE  0.25     // Of the budget not spent above the floor variant
+
+typedef struct {
+    double budget_s;            // Link time left
+    double rate;                // Bytes/s, st_link_rate()
+    double overhead_s;          // Per fetch, st_link_t.overhead_s
+    double xcode_x;             // On-demand transcoding, audio seconds per second (0 = ready variants only)
+    uint8_t floor;              // Lowest variant worth fetching (ST_VARIANT_NB2 for any)
+} st_plan_params_t;
+
+typedef struct {
+    double need_s;              // Planned fetches
+    double full_s;              // Everything un-stored as RAW, and every upgrade
+    uint32_t fetch;
+    uint32_t reduced;           // Fetched as a speech variant
+    uint32_t upgrades;          // Already stored in a lower variant, fetched again
+    uint32_t deferred;          // Nothing stored and not fetched this time
+} st_plan_result_t;
+
+/**
+ * @brief Choose what to fetch within params->budget_s
+ *
+ * files[] is in priority order (oldest first). First every recording with
+ * nothing stored gets the same variant, the best one they all fit in;
+ * what time is left raises them one variant at a time in priority order,
+ * then re-fetches stored lower variants (upgrades). Anything above the
+ * floor keeps ST_PLAN_RESERVE of the budget spare. If not even the floor
+ * fits them all, the first ones that fit are fetched, each in its quickest
+ * variant, and the rest deferred.
+ *
+ * Plan again after each fetch with the time left and the link's new
+ * estimate, over the recordings not fetched yet.
+ */
+void st_plan(const st_plan_params_t *params, st_plan_file_t *files, size_t n, st_plan_result_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ST_CLIENT_H
@@ -0,0 +1,164 @@
+/**
+ * @file st_cmd.c
+ * @brief FILE_CTRL command encoding and FILE_STATUS decoding (see st_client.h)
+ */
+
+#include "st_client.h"
+#include "ft_proto.h"
+#include "ft_fec.h"
+#include "ft_pull.h"
+#include <string.h>
+
+static size_t put1(uint8_t *out, size_t cap, uint8_t cmd) {
+    if (cap < 1) return 0;
+    out[0] = cmd;
+    return 1;
+}
+
+size_t st_cmd_start(uint8_t *out, size_t cap)  { return put1(out, cap, FILE_TRANSFER_CMD_START); }
+size_t st_cmd_pause(uint8_t *out, size_t cap)  { return put1(out, cap, FILE_TRANSFER_CMD_PAUSE); }
+size_t st_cmd_resume(uint8_t *out, size_t cap) { return put1(out, cap, FILE_TRANSFER_CMD_RESUME); }
+size_t st_cmd_stop(uint8_t *out, size_t cap)   { return put1(out, cap, FILE_TRANSFER_CMD_STOP); }
+size_t st_cmd_list(uint8_t *out, size_t cap)   { return put1(out, cap, FILE_TRANSFER_CMD_LIST_FILES); }
+
+size_t st_cmd_select(uint8_t *out, size_t cap, uint8_t index) {
+    if (cap < 2) return 0;
+    out[0] = FILE_TRANSFER_CMD_SELECT_FILE;
+    out[1] = index;
+    return 2;
+}
+
+size_t st_cmd_start_file(uint8_t *out, size_t cap, const char *filename) {
+    if (!filename || !ft_valid_filename(filename)) return 0;
+    size_t n = strlen(filename);
+    if (cap < 1 + n) return 0;
+    out[0] = FILE_TRANSFER_CMD_START_WITH_FILENAME;
+    memcpy(out + 1, filename, n);
+    return 1 + n;
+}
+
+size_t st_cmd_start_id(uint8_t *out, size_t cap, uint32_t rec_id) {
+    if (cap < 5 || rec_id == 0) return 0;
+    out[0] = FILE_TRANSFER_CMD_START_BY_ID;
+    out[1] = (uint8_t)rec_id;
+    out[2] = (uint8_t)(rec_id >> 8);
+    out[3] = (uint8_t)(rec_id >> 16);
+    out[4] = (uint8_t)(rec_id >> 24);
+    return 5;
+}
+
+size_t st_cmd_start_id_variant(uint8_t *out, size_t cap, uint32_t rec_id, uint8_t variant) {
+    if (variant == ST_VARIANT_RAW) return st_cmd_start_id(out, cap, rec_id);
+    if (cap < 6 || variant > FT_VARIANT_MAX || st_cmd_start_id(out, cap, rec_id) != 5) return 0;
+    out[5] = variant;
+    return 6;
+}
+
+size_t st_cmd_profile(uint8_t *out, size_t cap, uint8_t seconds) {
+    if (cap < 2 || seconds == 0) return 0;
+    out[0] = FILE_TRANSFER_CMD_PROFILE;
+    out[1] = seconds;
+    return 2;
+}
+
+size_t st_cmd_format(uint8_t *out, size_t cap, uint8_t cluster_kb) {
+    if (cap < 5) return 0;
+    if (cluster_kb != 0 && (cluster_kb < 4 || cluster_kb > 64 || (cluster_kb & (cluster_kb - 1)))) {
+        return 0;
+    }
+    out[0] = FILE_TRANSFER_CMD_FORMAT;
+    memcpy(out + 1, "FMT", 3);
+    out[4] = cluster_kb;
+    return 5;
+}
+
+size_t st_cmd_fec(uint8_t *out, size_t cap, uint8_t k, uint8_t r) {
+    if (cap < 3 || k == 0 || k > FT_FEC_MAX_K || r > FT_FEC_MAX_R) return 0;
+    out[0] = FILE_TRANSFER_CMD_SET_FEC;
+    out[1] = k;
+    out[2] = r;
+    return 3;
+}
+
+size_t st_cmd_sync_ack(uint8_t *out, size_t cap, uint32_t rec_id, uint32_t crc32c) {
+    if (cap < 9 || rec_id == 0) return 0;
+    out[0] = FILE_TRANSFER_CMD_SYNC_ACK;
+    for (int i = 0; i < 4; i++) {
+        out[1 + i] = (uint8_t)(rec_id >> (8 * i));
+        out[5 + i] = (uint8_t)(crc32c >> (8 * i));
+    }
+    return 9;
+}
+
+size_t st_cmd_pull(uint8_t *out, size_t cap, uint32_t rec_id, uint8_t variant, uint8_t block) {
+    if (cap < 7 || rec_id == 0 || variant > FT_VARIANT_MAX ||
+        block > FT_PKT_MAX - FILE_TRANSFER_HEADER_SIZE - FT_PULL_HEADER_SIZE) {
+        return 0;
+    }
+    out[0] = FILE_TRANSFER_CMD_PULL;
+    for (int i = 0; i < 4; i++) out[1 + i] = (uint8_t)(rec_id >> (8 * i));
+    out[5] = variant;
+    out[6] = block;
+    return 7;
+}
+
+size_t st_cmd_read_blocks(uint8_t *out, size_t cap, uint32_t block, uint8_t count) {
+    if (cap < 6 || count == 0 || count > FT_PULL_MAX_COUNT) return 0;
+    out[0] = FILE_TRANSFER_CMD_READ_BLOCKS;
+    for (int i = 0; i < 4; i++) out[1 + i] = (uint8_t)(block >> (8 * i));
+    out[5] = count;
+    return 6;
+}
+
+st_status_t st_status_decode(uint8_t code) {
+    st_status_t s = { .code = code, .name = ft_status_name(code) };
+    switch (code) {
+    case STAT_STARTED:
+    case STAT_PAUSED:
+    case STAT_LIST_READY:
+    case STAT_FILE_SELECTED:
+    case STAT_PROFILE_STARTED:
+    case STAT_FORMAT_STARTED:
+    case STAT_TRANSCODING:
+    case STAT_PULL_READY:
+    case STAT_PULL_OVERRUN:
+        s.kind = ST_STATUS_PROGRESS;
+        break;
+    case STAT_COMPLETE:
+    case STAT_PROFILE_READY:
+    case STAT_FORMAT_DONE:
+    case STAT_FEC_SET:
+    case STAT_SYNC_ACKED:
+        s.kind = ST_STATUS_DONE;
+        s.ends_transfer = code == STAT_COMPLETE;
+        break;
+    case STAT_STOPPED_BY_HOST:
+    case STAT_NOTIFY_FAIL:
+    case STAT_FILE_READ_FAIL:
+    case STAT_NO_CONN:
+        s.kind = ST_STATUS_FAILED;
+        s.ends_transfer = true;
+        break;
+    case STAT_FILE_OPEN_FAIL:
+    case STAT_BAD_CMD:
+    case STAT_ALREADY_RUNNING:
+    case STAT_BUSY:
+    case STAT_SUBSCRIPTION_REQUIRED:
+    case STAT_NO_FILE:
+    case STAT_INVALID_INDEX:
+    case STAT_PROFILE_FAIL:
+    case STAT_FEC_UNAVAILABLE:
+    case STAT_SYNC_MISMATCH:
+    case STAT_VARIANT_FAIL:
+        s.kind = ST_STATUS_REFUSED;
+        break;
+    case STAT_FORMAT_FAIL:
+        // Not a transfer, but the card may now be unusable
+        s.kind = ST_STATUS_FAILED;
+        break;
+    default:
+        s.kind = ST_STATUS_UNKNOWN;
+        break;
+    }
+    return s;
+}
@@ -0,0 +1,166 @@
+/**
+ * @file st_crc32c.c
+ * @brief The firmware's crc32c, slicing-by-8 and PCLMULQDQ folding (see st_client.h)
+ *
+ * main/crc32c.c feeds the normal (unreflected) form of the Castagnoli
+ * polynomial, 0x1EDC6F41, to a reflected table generator, so its values
+ * differ from standard CRC32C (0x82F63B78 there) and the SSE4.2 crc32
+ * instruction cannot be used. Both paths here work for
+ * any reflected polynomial and are checked against each other by
+ * st_fetch --bench.
+ */
+
+#include "st_client.h"
+#include <stdatomic.h>
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define ST_HAVE_PCLMUL 1
+#include <immintrin.h>
+#endif
+
+#define POLY 0x1EDC6F41u    // As in main/crc32c.c
+
+static uint32_t s_table[8][256];
+static atomic_flag s_init_claimed = ATOMIC_FLAG_INIT;
+static atomic_bool s_init_done;
+static atomic_bool s_portable;
+
+#if ST_HAVE_PCLMUL
+static uint64_t s_k4[2];    // Fold across 4 lanes (512 bits)
+static uint64_t s_k1[2];    // Fold across 1 lane (128 bits)
+static bool s_has_pclmul;
+
+// x^n mod P, reflected (bit 31 is x^0)
+static uint32_t xpow(uint32_t n) {
+    uint32_t p = 0x80000000u;
+    while (n--) p = (p & 1) ? (p >> 1) ^ POLY : p >> 1;
+    return p;
+}
+
+// Folding a lane forward by F bits multiplies its low half by x^(63+F) and
+// its high half by x^(F-1); the constants sit in bits 32..63 of each operand
+static void fold_consts(uint64_t k[2], uint32_t f) {
+    k[0] = (uint64_t)xpow(63 + f) << 32;
+    k[1] = (uint64_t)xpow(f - 1) << 32;
+}
+#endif
+
+static void init_tables(void) {
+    if (atomic_load_explicit(&s_init_done, memory_order_acquire)) return;
+    if (atomic_flag_test_and_set(&s_init_claimed)) {
+        while (!atomic_load_explicit(&s_init_done, memory_order_acquire)) { }
+        return;
+    }
+
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int j = 0; j < 8; j++) c = (c & 1) ? (c >> 1) ^ POLY : c >> 1;
+        s_table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) {
+            uint32_t c = s_table[t - 1][i];
+            s_table[t][i] = (c >> 8) ^ s_table[0][c & 0xFF];
+        }
+    }
+#if ST_HAVE_PCLMUL
+    fold_consts(s_k4, 512);
+    fold_consts(s_k1, 128);
+    s_has_pclmul = __builtin_cpu_supports("pclmul");
+#endif
+    atomic_store_explicit(&s_init_done, true, memory_order_release);
+}
+
+static inline uint32_t load32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Works on the inverted state, like the loop in crc32c_update()
+static uint32_t slice8(uint32_t c, const uint8_t *p, size_t len) {
+    while (len >= 8) {
+        uint32_t lo = c ^ load32(p);
+        uint32_t hi = load32(p + 4);
+        c = s_table[7][lo & 0xFF] ^ s_table[6][(lo >> 8) & 0xFF] ^
+            s_table[5][(lo >> 16) & 0xFF] ^ s_table[4][lo >> 24] ^
+            s_table[3][hi & 0xFF] ^ s_table[2][(hi >> 8) & 0xFF] ^
+            s_table[1][(hi >> 16) & 0xFF] ^ s_table[0][hi >> 24];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) c = s_table[0][(c ^ *p++) & 0xFF] ^ (c >> 8);
+    return c;
+}
+
+#if ST_HAVE_PCLMUL
+__attribute__((target("pclmul")))
+static inline __m128i fold(__m128i x, __m128i k, const uint8_t *next) {
+    __m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+    __m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+    return _mm_xor_si128(_mm_xor_si128(lo, hi), _mm_loadu_si128((const __m128i *)next));
+}
+
+// len >= 64. Folds 16-byte lanes down to one, then finishes with the table.
+__attribute__((target("pclmul")))
+static uint32_t clmul_fold(uint32_t c, const uint8_t *p, size_t len) {
+    __m128i k4 = _mm_loadu_si128((const __m128i *)s_k4);
+    __m128i k1 = _mm_loadu_si128((const __m128i *)s_k1);
+
+    // The running state is the same as XOR-ing it into the first four bytes
+    __m128i x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)p), _mm_cvtsi32_si128((int)c));
+    __m128i x1 = _mm_loadu_si128((const __m128i *)(p + 16));
+    __m128i x2 = _mm_loadu_si128((const __m128i *)(p + 32));
+    __m128i x3 = _mm_loadu_si128((const __m128i *)(p + 48));
+    p += 64;
+    len -= 64;
+
+    while (len >= 64) {
+        x0 = fold(x0, k4, p);
+        x1 = fold(x1, k4, p + 16);
+        x2 = fold(x2, k4, p + 32);
+        x3 = fold(x3, k4, p + 48);
+        p += 64;
+        len -= 64;
+    }
+
+    uint8_t lane[16];
+    _mm_storeu_si128((__m128i *)lane, x1);
+    x0 = fold(x0, k1, lane);
+    _mm_storeu_si128((__m128i *)lane, x2);
+    x0 = fold(x0, k1, lane);
+    _mm_storeu_si128((__m128i *)lane, x3);
+    x0 = fold(x0, k1, lane);
+    while (len >= 16) {
+        x0 = fold(x0, k1, p);
+        p += 16;
+        len -= 16;
+    }
+
+    _mm_storeu_si128((__m128i *)lane, x0);
+    return slice8(slice8(0, lane, sizeof(lane)), p, len);
+}
+#endif
+
+uint32_t st_crc32c_update(uint32_t crc, const void *data, size_t len) {
+    init_tables();
+    const uint8_t *p = (const uint8_t *)data;
+    uint32_t c = ~crc;
+#if ST_HAVE_PCLMUL
+    if (len >= 64 && s_has_pclmul && !atomic_load_explicit(&s_portable, memory_order_relaxed)) {
+        return ~clmul_fold(c, p, len);
+    }
+#endif
+    return ~slice8(c, p, len);
+}
+
+const char *st_crc32c_impl(void) {
+    init_tables();
+#if ST_HAVE_PCLMUL
+    if (s_has_pclmul && !atomic_load_explicit(&s_portable, memory_order_relaxed)) return "pclmul";
+#endif
+    return "slice8";
+}
+
+void st_crc32c_force_portable(bool portable) {
+    atomic_store_explicit(&s_portable, portable, memory_order_relaxed);
+}
@@ -0,0 +1,705 @@
+/**
+ * @file st_fetch.c
+ * @brief Download a recording with the client library, and benchmark it
+ *
+ * Talks to a tag through the emulator's socket framing (host/emulator,
+ * emu_wire.h), which stands in for GATT. Every pass opens a connection,
+ * starts the transfer and feeds notifications to st_rx_t, which writes
+ * them at their offsets with pwrite; passes after the first write only
+ * the ranges still missing. With --pull the tag only answers READ_BLOCKS:
+ * st_pull_t keeps a window of them in flight, and a new connection asks
+ * for whatever the last one lost. --bench measures the library on its own.
+ */
+
+#define _GNU_SOURCE
+#include "st_client.h"
+#include "emu_wire.h"
+#include "ft_proto.h"
+#include "ft_pull.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// ---------------------------------------------------------------------------
+// Emulator connection
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    int fd;
+    uint8_t buf[EMU_FRAME_MAX];
+    uint8_t op;
+    uint16_t uuid;
+    uint16_t len;
+} link_t;
+
+static int link_open(link_t *l, const char *host, int port) {
+    char service[8];
+    snprintf(service, sizeof(service), "%d", port);
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM }, *res;
+    if (getaddrinfo(host, service, &hints, &res) != 0) return -1;
+    l->fd = -1;
+    for (struct addrinfo *ai = res; ai && l->fd < 0; ai = ai->ai_next) {
+        l->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (l->fd >= 0 && connect(l->fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+            close(l->fd);
+            l->fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    return l->fd >= 0 ? 0 : -1;
+}
+
+static int read_full(int fd, uint8_t *p, size_t n, int timeout_ms) {
+    while (n) {
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int r = poll(&pfd, 1, timeout_ms);
+        if (r <= 0) return -1;
+        ssize_t got = read(fd, p, n);
+        if (got <= 0) return -1;
+        p += got;
+        n -= (size_t)got;
+    }
+    return 0;
+}
+
+// Next frame, or -1 on timeout or disconnect
+static int link_recv(link_t *l, int timeout_ms) {
+    if (read_full(l->fd, l->buf, EMU_FRAME_HDR, timeout_ms) != 0) return -1;
+    l->op = l->buf[0];
+    l->uuid = (uint16_t)(l->buf[1] | (l->buf[2] << 8));
+    l->len = (uint16_t)(l->buf[3] | (l->buf[4] << 8));
+    if (l->len > EMU_FRAME_MAX - EMU_FRAME_HDR) return -1;
+    return read_full(l->fd, l->buf + EMU_FRAME_HDR, l->len, timeout_ms);
+}
+
+static int link_send(link_t *l, uint8_t op, uint16_t uuid, const uint8_t *payload, uint16_t len) {
+    uint8_t frame[EMU_FRAME_MAX];
+    size_t n = emu_frame_encode(frame, op, uuid, payload, len);
+    return write(l->fd, frame, n) == (ssize_t)n ? 0 : -1;
+}
+
+// ---------------------------------------------------------------------------
+// Download
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    const char *host;
+    int port;
+    uint16_t mtu;
+    const char *file;
+    uint32_t rec_id;
+    const char *out;
+    int passes;
+    int timeout_ms;
+    bool pull;
+    st_pull_params_t pull_params;
+    bool quiet;
+} fetch_opts_t;
+
+typedef struct {
+    int fd;
+    uint8_t header[ST_HEADER_BYTES];
+    size_t header_len;
+} sink_t;
+
+static int sink_write(void *ctx, uint64_t offset, const uint8_t *data, size_t len) {
+    sink_t *s = ctx;
+    if (offset < ST_HEADER_BYTES) {
+        size_t n = len < ST_HEADER_BYTES - offset ? len : ST_HEADER_BYTES - (size_t)offset;
+        memcpy(s->header + offset, data, n);
+        if (offset + n > s->header_len) s->header_len = (size_t)(offset + n);
+    }
+    while (len) {
+        ssize_t n = pwrite(s->fd, data, len, (off_t)offset);
+        if (n <= 0) return -1;
+        data += n;
+        offset += (uint64_t)n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static size_t start_cmd(const fetch_opts_t *o, uint8_t *cmd) {
+    if (o->file) return st_cmd_start_file(cmd, ST_CMD_MAX, o->file);
+    if (o->rec_id) return st_cmd_start_id(cmd, ST_CMD_MAX, o->rec_id);
+    return st_cmd_start(cmd, ST_CMD_MAX);
+}
+
+// One connection, one transfer. Returns the status that ended it, or -1 for a lost link.
+static int run_pass(const fetch_opts_t *o, st_rx_t *rx, sink_t *sink, bool *size_known) {
+    link_t l;
+    if (link_open(&l, o->host, o->port) != 0) {
+        fprintf(stderr, "st_fetch: cannot connect to %s:%d\n", o->host, o->port);
+        return -1;
+    }
+
+    uint8_t cmd[ST_CMD_MAX];
+    uint8_t mtu[2] = { (uint8_t)o->mtu, (uint8_t)(o->mtu >> 8) };
+    uint8_t on = 1;
+    size_t cmd_len = start_cmd(o, cmd);
+    if (link_recv(&l, o->timeout_ms) != 0 || l.op != EMU_OP_HELLO ||
+        link_send(&l, EMU_OP_MTU, 0, mtu, 2) != 0 ||
+        link_send(&l, EMU_OP_SUBSCRIBE, BLE_UUID_SALESTAG_FILE_DATA, &on, 1) != 0 ||
+        link_send(&l, EMU_OP_SUBSCRIBE, BLE_UUID_SALESTAG_FILE_STATUS, &on, 1) != 0 ||
+        link_send(&l, EMU_OP_WRITE, BLE_UUID_SALESTAG_FILE_CTRL, cmd, (uint16_t)cmd_len) != 0) {
+        close(l.fd);
+        return -1;
+    }
+
+    int status = -1;
+    while (link_recv(&l, o->timeout_ms) == 0) {
+        if (l.op == EMU_OP_WRITE_RSP && l.len >= 1 && l.buf[EMU_FRAME_HDR] != EMU_ATT_OK) {
+            fprintf(stderr, "st_fetch: FILE_CTRL write rejected (ATT 0x%02x)\n", l.buf[EMU_FRAME_HDR]);
+            break;
+        }
+        if (l.op != EMU_OP_NOTIFY || l.len < 1) continue;
+        const uint8_t *v = l.buf + EMU_FRAME_HDR;
+
+        if (l.uuid == BLE_UUID_SALESTAG_FILE_STATUS) {
+            st_status_t st = st_status_decode(v[0]);
+            if (!o->quiet) fprintf(stderr, "st_fetch: status %s\n", st.name);
+            if (st.ends_transfer || st.kind == ST_STATUS_REFUSED) {
+                status = st.code;
+                break;
+            }
+        } else if (l.uuid == BLE_UUID_SALESTAG_FILE_DATA) {
+            st_rx_result_t r = st_rx_feed(rx, v, l.len);
+            if (r == ST_RX_WRITE_FAILED || r == ST_RX_RESTART) {
+                status = -1;
+                break;
+            }
+            // The header is in the first packet; it tells the size before eof does
+            if (!*size_known && sink->header_len == ST_HEADER_BYTES) {
+                st_file_info_t info;
+                if (st_header_decode(sink->header, sizeof(sink->header), &info) && info.expected_size) {
+                    st_rx_set_size(rx, info.expected_size);
+                }
+                *size_known = true;
+            }
+        }
+    }
+    close(l.fd);
+    return status;
+}
+
+static void report_file(int fd, uint64_t size) {
+    static uint8_t buf[1 << 16];
+    st_file_info_t info;
+    st_raw_check_t chk = {0};
+    uint32_t crc = 0xFFFFFFFFu;
+    bool have_info = false;
+    uint64_t off = 0;
+    size_t carry = 0;
+    while (off < size) {
+        size_t want = sizeof(buf) - carry;
+        if (want > size - off) want = (size_t)(size - off);
+        ssize_t n = pread(fd, buf + carry, want, (off_t)off);
+        if (n <= 0) break;
+        crc = st_crc32c_update(crc, buf + carry, (size_t)n);
+        size_t avail = carry + (size_t)n;
+        size_t start = 0;
+        if (off == 0) {
+            have_info = st_header_decode(buf, avail, &info);
+            start = ST_HEADER_BYTES;
+        }
+        off += (uint64_t)n;
+        if (have_info && info.format == ST_FORMAT_RAW_V1 && avail > start) {
+            size_t used = st_raw_decode(&chk, buf + start, avail - start, NULL) * ST_RAW_SAMPLE;
+            carry = avail - start - used;
+            memmove(buf, buf + start + used, carry);
+        } else {
+            carry = 0;
+        }
+    }
+
+    printf("file: %llu B crc32c=0x%08x", (unsigned long long)size, crc);
+    if (!have_info) {
+        printf(" format=unknown\n");
+    } else if (info.format == ST_FORMAT_RAW_V1) {
+        printf(" format=RAW v1 samples=%u/%u out_of_range=%u count_gaps=%u time_backwards=%u%s\n",
+               chk.samples, info.total_samples, chk.out_of_range, chk.count_gaps, chk.time_backwards,
+               info.recovered ? " recovered" : info.open ? " open" : "");
+    } else {
+        printf(" format=SPCH codec=%u frames=%u\n", info.codec, info.total_frames);
+    }
+}
+
+// Connect, subscribe and read the negotiated MTU; the caller sends the command
+static int pull_connect(const fetch_opts_t *o, link_t *l, uint16_t *mtu) {
+    if (link_open(l, o->host, o->port) != 0) {
+        fprintf(stderr, "st_fetch: cannot connect to %s:%d\n", o->host, o->port);
+        return -1;
+    }
+    uint8_t req[2] = { (uint8_t)o->mtu, (uint8_t)(o->mtu >> 8) };
+    uint8_t on = 1;
+    if (link_recv(l, o->timeout_ms) != 0 || l->op != EMU_OP_HELLO ||
+        link_send(l, EMU_OP_MTU, 0, req, 2) != 0) {
+        close(l->fd);
+        return -1;
+    }
+    while (link_recv(l, o->timeout_ms) == 0) {
+        if (l->op != EMU_OP_MTU || l->len < 2) continue;
+        *mtu = (uint16_t)(l->buf[EMU_FRAME_HDR] | (l->buf[EMU_FRAME_HDR + 1] << 8));
+        if (link_send(l, EMU_OP_SUBSCRIBE, BLE_UUID_SALESTAG_FILE_DATA, &on, 1) != 0 ||
+            link_send(l, EMU_OP_SUBSCRIBE, BLE_UUID_SALESTAG_FILE_STATUS, &on, 1) != 0) {
+            break;
+        }
+        return 0;
+    }
+    close(l->fd);
+    return -1;
+}
+
+// One connection, one pull session: keep READ_BLOCKS in flight until the file is
+// complete, then STOP. Returns the status that ended it, or -1 for a lost link.
+static int run_pull_pass(const fetch_opts_t *o, st_pull_t *pl, uint8_t *block) {
+    link_t l;
+    uint16_t mtu;
+    if (pull_connect(o, &l, &mtu) != 0) return -1;
+    bool first = *block == 0;
+    if (first) *block = (uint8_t)ft_pull_block_max(mtu);
+
+    uint8_t cmd[ST_CMD_MAX];
+    size_t n = st_cmd_pull(cmd, sizeof(cmd), o->rec_id, FT_VARIANT_RAW, *block);
+    if (link_send(&l, EMU_OP_WRITE, BLE_UUID_SALESTAG_FILE_CTRL, cmd, (uint16_t)n) != 0) {
+        close(l.fd);
+        return -1;
+    }
+    if (first) {
+        // The block size is only known now
+        st_pull_begin(pl, pl->write, pl->ctx, ST_SIZE_UNKNOWN, *block, &o->pull_params);
+    }
+
+    int status = -1;
+    bool ready = false, stopping = false;
+    double heard = now_s();
+    for (;;) {
+        while (ready && !stopping && (n = st_pull_next(pl, now_s(), cmd, sizeof(cmd))) > 0) {
+            if (link_send(&l, EMU_OP_WRITE, BLE_UUID_SALESTAG_FILE_CTRL, cmd, (uint16_t)n) != 0) break;
+        }
+        // Short waits, so request timeouts are noticed while the link is quiet
+        struct pollfd pfd = { .fd = l.fd, .events = POLLIN };
+        int r = poll(&pfd, 1, 10);
+        if (r < 0 || (r == 0 && (now_s() - heard) * 1000 > o->timeout_ms)) break;
+        if (r == 0) continue;
+        if (link_recv(&l, o->timeout_ms) != 0) break;
+        heard = now_s();
+        if (l.op == EMU_OP_WRITE_RSP && l.len >= 1 && l.buf[EMU_FRAME_HDR] != EMU_ATT_OK) {
+            fprintf(stderr, "st_fetch: FILE_CTRL write rejected (ATT 0x%02x)\n", l.buf[EMU_FRAME_HDR]);
+            break;
+        }
+        if (l.op != EMU_OP_NOTIFY || l.len < 1) continue;
+        const uint8_t *v = l.buf + EMU_FRAME_HDR;
+
+        if (l.uuid == BLE_UUID_SALESTAG_FILE_STATUS) {
+            st_status_t st = st_status_decode(v[0]);
+            if (!o->quiet && st.code != STAT_PULL_OVERRUN) fprintf(stderr, "st_fetch: status %s\n", st.name);
+            if (st.code == STAT_PULL_READY) ready = true;
+            if (st.code == STAT_PULL_OVERRUN) st_pull_overrun(pl, now_s());
+            if (st.ends_transfer || st.kind == ST_STATUS_REFUSED) {
+                status = st.code;
+                break;
+            }
+        } else if (l.uuid == BLE_UUID_SALESTAG_FILE_DATA && !stopping) {
+            st_rx_result_t res = st_pull_feed(pl, v, l.len, now_s());
+            if (res == ST_RX_WRITE_FAILED) break;
+            if (res == ST_RX_DONE) {
+                // Everything is here: end the session, the tag answers STOPPED_BY_HOST
+                n = st_cmd_stop(cmd, sizeof(cmd));
+                if (link_send(&l, EMU_OP_WRITE, BLE_UUID_SALESTAG_FILE_CTRL, cmd, (uint16_t)n) != 0) break;
+                stopping = true;
+            }
+        }
+    }
+    close(l.fd);
+    st_pull_relink(pl);
+    return status;
+}
+
+static int fetch_pull(const fetch_opts_t *o, sink_t *sink) {
+    static st_pull_t pl;
+    uint8_t block = 0;
+    st_pull_begin(&pl, sink_write, sink, ST_SIZE_UNKNOWN, 0, &o->pull_params);
+
+    double t0 = now_s();
+    int pass = 0;
+    while (pass < o->passes && !st_pull_complete(&pl)) {
+        pass++;
+        int status = run_pull_pass(o, &pl, &block);
+        printf("pass %d: %s, %u requests, %u blocks, %u duplicates, %u re-requested, %u timeouts, "
+               "%u overruns, window %.1f, srtt %.0f ms, %llu B written\n",
+               pass, status >= 0 ? ft_status_name((uint8_t)status) : "link lost",
+               pl.stats.requests, pl.stats.blocks, pl.stats.duplicates, pl.stats.rerequested,
+               pl.stats.timeouts, pl.stats.overruns, pl.window, pl.srtt * 1000,
+               (unsigned long long)pl.stats.bytes_written);
+        if (status >= 0 && st_status_decode((uint8_t)status).kind == ST_STATUS_REFUSED) break;
+    }
+    double dt = now_s() - t0;
+
+    if (!st_pull_complete(&pl)) {
+        printf("incomplete after %d pass%s\n", pass, pass == 1 ? "" : "es");
+        return 1;
+    }
+    if (ftruncate(sink->fd, (off_t)pl.size) != 0) perror("st_fetch: ftruncate");
+    printf("complete: %d pass%s, %.2f s (%.1f KB/s), pull %u B blocks\n", pass, pass == 1 ? "" : "es",
+           dt, pl.size / 1024.0 / dt, block);
+    report_file(sink->fd, pl.size);
+    return 0;
+}
+
+static int fetch(const fetch_opts_t *o) {
+    sink_t sink = { .fd = open(o->out, O_RDWR | O_CREAT | O_TRUNC, 0644) };
+    if (sink.fd < 0) {
+        fprintf(stderr, "st_fetch: %s: %s\n", o->out, strerror(errno));
+        return 1;
+    }
+    if (o->pull) {
+        int rc = fetch_pull(o, &sink);
+        close(sink.fd);
+        return rc;
+    }
+
+    static st_rx_t rx;
+    bool size_known = false;
+    st_rx_begin(&rx, sink_write, &sink, ST_SIZE_UNKNOWN);
+
+    double t0 = now_s();
+    int pass = 0, status = -1;
+    while (pass < o->passes) {
+        if (pass > 0) {
+            // No offset command: the tag sends the whole file again, keep what is missing
+            if (rx.broken) {
+                st_rx_begin(&rx, sink_write, &sink, ST_SIZE_UNKNOWN);
+                size_known = false;
+                sink.header_len = 0;
+            } else {
+                st_rx_begin_fill(&rx);
+            }
+        }
+        pass++;
+        status = run_pass(o, &rx, &sink, &size_known);
+        st_rx_result_t end = st_rx_end(&rx);
+
+        st_range_t holes[4];
+        size_t n = st_rx_missing(&rx, holes, 4);
+        printf("pass %d: %s, %u pkts, %u lost, %u reordered, %u stale, %llu B written, %zu missing ranges%s\n",
+               pass, status >= 0 ? ft_status_name((uint8_t)status) : "link lost",
+               rx.stats.packets, rx.stats.lost, rx.stats.reordered, rx.stats.stale,
+               (unsigned long long)rx.stats.bytes_written, n,
+               end == ST_RX_RESTART ? " (restart)" : "");
+        for (size_t i = 0; i < n && i < 4 && !o->quiet; i++) {
+            if (holes[i].offset + holes[i].len == ST_SIZE_UNKNOWN) {
+                printf("  missing %llu-end\n", (unsigned long long)holes[i].offset);
+            } else {
+                printf("  missing %llu+%llu\n", (unsigned long long)holes[i].offset,
+                       (unsigned long long)holes[i].len);
+            }
+        }
+        if (st_rx_complete(&rx)) break;
+        if (status >= 0 && st_status_decode((uint8_t)status).kind == ST_STATUS_REFUSED) break;
+    }
+    double dt = now_s() - t0;
+
+    int rc = 1;
+    if (st_rx_complete(&rx)) {
+        if (ftruncate(sink.fd, (off_t)rx.size) != 0) perror("st_fetch: ftruncate");
+        printf("complete: %d pass%s, %.2f s (%.1f KB/s)\n", pass, pass == 1 ? "" : "es",
+               dt, rx.size / 1024.0 / dt);
+        report_file(sink.fd, rx.size);
+        rc = 0;
+    } else {
+        printf("incomplete after %d pass%s\n", pass, pass == 1 ? "" : "es");
+    }
+    close(sink.fd);
+    return rc;
+}
+
+// ---------------------------------------------------------------------------
+// Benchmarks
+// ---------------------------------------------------------------------------
+
+#define BENCH_FILE  (16u << 20)
+#define BENCH_CHUNK 195         // ft_payload_budget(247) capped at FT_PKT_MAX
+
+typedef struct {
+    uint8_t *dst;
+} mem_sink_t;
+
+static int mem_write(void *ctx, uint64_t offset, const uint8_t *data, size_t len) {
+    memcpy(((mem_sink_t *)ctx)->dst + offset, data, len);
+    return 0;
+}
+
+static uint64_t s_rng = 0x9E3779B97F4A7C15ull;
+
+static uint32_t rnd(void) {
+    s_rng ^= s_rng << 13;
+    s_rng ^= s_rng >> 7;
+    s_rng ^= s_rng << 17;
+    return (uint32_t)s_rng;
+}
+
+// Notifications for src, optionally with neighbours swapped (EATT) and some dropped
+static size_t build_stream(const uint8_t *src, uint8_t *pkts, uint32_t *order, double swap, double drop) {
+    size_t count = (BENCH_FILE + BENCH_CHUNK - 1) / BENCH_CHUNK;
+    for (size_t i = 0; i < count; i++) {
+        size_t off = i * BENCH_CHUNK;
+        size_t n = BENCH_FILE - off < BENCH_CHUNK ? BENCH_FILE - off : BENCH_CHUNK;
+        uint8_t *p = pkts + i * FT_PKT_MAX;
+        ft_pkt_header_encode(p, (uint16_t)i, (uint16_t)n, i + 1 == count);
+        memcpy(p + FILE_TRANSFER_HEADER_SIZE, src + off, n);
+        order[i] = (uint32_t)i;
+    }
+    for (size_t i = 0; i + 1 < count; i++) {
+        if (rnd() < swap * 4294967296.0) {
+            uint32_t t = order[i];
+            order[i] = order[i + 1];
+            order[i + 1] = t;
+            i++;
+        }
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        // Keep the final packet so the pass knows the size
+        if (order[i] + 1 != count && rnd() < drop * 4294967296.0) continue;
+        order[kept++] = order[i];
+    }
+    return kept;
+}
+
+static double feed_stream(st_rx_t *rx, const uint8_t *pkts, const uint32_t *order, size_t n) {
+    double t0 = now_s();
+    for (size_t i = 0; i < n; i++) {
+        const uint8_t *p = pkts + (size_t)order[i] * FT_PKT_MAX;
+        ft_pkt_header_t h;
+        ft_pkt_header_decode(p, FT_PKT_MAX, &h);
+        st_rx_feed(rx, p, FILE_TRANSFER_HEADER_SIZE + h.len);
+    }
+    st_rx_end(rx);
+    return now_s() - t0;
+}
+
+static int mem_read(void *ctx, uint32_t offset, uint8_t *buf, size_t len) {
+    memcpy(buf, (const uint8_t *)ctx + offset, len);
+    return (int)len;
+}
+
+// A pull download against the tag's own ft_pull_t, in process: one notification per
+// virtual millisecond, some dropped. Returns wall time; *served counts notifications.
+static double pull_stream(st_pull_t *pl, const uint8_t *src, double drop, uint32_t *served) {
+    static uint8_t cache[FT_PULL_CACHE_BYTES];
+    static ft_pull_t tag;
+    uint16_t block = ft_pull_block_max(247);
+    ft_pull_open(&tag, BENCH_FILE, block, cache, mem_read, (void *)src);
+    double t0 = now_s(), vt = 0;
+    uint8_t cmd[ST_CMD_MAX], pkt[FT_PKT_MAX];
+    *served = 0;
+    for (uint16_t seq = 0; !st_pull_complete(pl) && vt < 3600; seq++, vt += 0.001) {
+        size_t n;
+        ft_ctrl_req_t req;
+        while ((n = st_pull_next(pl, vt, cmd, sizeof(cmd))) > 0) {
+            if (ft_ctrl_parse(cmd, n, &req) == FT_PARSE_OK) ft_pull_request(&tag, req.block, req.count);
+        }
+        int len = ft_pull_next(&tag, pkt, seq);
+        if (len <= 0) continue;
+        (*served)++;
+        if (rnd() >= drop * 4294967296.0) st_pull_feed(pl, pkt, (size_t)len, vt);
+    }
+    return now_s() - t0;
+}
+
+static int bench(void) {
+    size_t count = (BENCH_FILE + BENCH_CHUNK - 1) / BENCH_CHUNK;
+    uint8_t *src = malloc(BENCH_FILE);
+    uint8_t *dst = malloc(BENCH_FILE);
+    uint8_t *pkts = malloc(count * FT_PKT_MAX);
+    uint32_t *order = malloc(count * sizeof(*order));
+    st_rx_t *rx = malloc(sizeof(*rx));
+    if (!src || !dst || !pkts || !order || !rx) return 1;
+    for (size_t i = 0; i < BENCH_FILE; i++) src[i] = (uint8_t)rnd();
+    int failures = 0;
+
+    printf("crc32c (%u MB buffer)\n", BENCH_FILE >> 20);
+    uint32_t ref = 0;
+    for (int portable = 1; portable >= 0; portable--) {
+        st_crc32c_force_portable(portable);
+        double best = 1e9;
+        uint32_t crc = 0;
+        for (int r = 0; r < 5; r++) {
+            double t0 = now_s();
+            crc = st_crc32c_update(0xFFFFFFFFu, src, BENCH_FILE);
+            double dt = now_s() - t0;
+            if (dt < best) best = dt;
+        }
+        if (portable) ref = crc;
+        printf("  %-7s %8.0f MB/s  0x%08x%s\n", st_crc32c_impl(), BENCH_FILE / 1048576.0 / best,
+               crc, crc == ref ? "" : "  MISMATCH");
+        failures += crc != ref;
+    }
+    st_crc32c_force_portable(false);
+
+    static const struct { const char *name; double swap, drop; } cases[] = {
+        { "in order",          0.0,  0.0   },
+        { "eatt swaps 5%",     0.05, 0.0   },
+        { "drop 0.1% + fill",  0.0,  0.001 },
+        { "swaps + drop 0.2%", 0.05, 0.002 },
+    };
+    mem_sink_t sink = { .dst = dst };
+    printf("reassembly (%zu notifications of %d B)\n", count, BENCH_CHUNK);
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        memset(dst, 0, BENCH_FILE);
+        size_t n = build_stream(src, pkts, order, cases[c].swap, cases[c].drop);
+        st_rx_begin(rx, mem_write, &sink, ST_SIZE_UNKNOWN);
+        double dt = feed_stream(rx, pkts, order, n);
+        uint32_t lost = rx->stats.lost;
+        int passes = 1;
+        while (!st_rx_complete(rx) && passes < 4 && rx->missing_count > 0) {
+            st_rx_begin_fill(rx);
+            size_t m = build_stream(src, pkts, order, cases[c].swap, 0.0);
+            dt += feed_stream(rx, pkts, order, m);
+            passes++;
+        }
+        bool ok = st_rx_complete(rx) && rx->size == BENCH_FILE && memcmp(src, dst, BENCH_FILE) == 0;
+        failures += !ok;
+        printf("  %-18s %8.0f MB/s %6.2f Mpkt/s  lost=%u passes=%d %s\n", cases[c].name,
+               BENCH_FILE * (double)passes / 1048576.0 / dt, count * (double)passes / 1e6 / dt,
+               lost, passes, ok ? "ok" : "MISMATCH");
+    }
+
+    static const struct { const char *name; double drop, held; } pull_cases[] = {
+        { "pull",               0.0,  0.0 },
+        { "pull drop 1%",       0.01, 0.0 },
+        { "pull, half held",    0.01, 0.5 },
+    };
+    st_pull_t *pl = malloc(sizeof(*pl));
+    if (!pl) return 1;
+    printf("pull (%u B blocks, tag cache and queue in process)\n", ft_pull_block_max(247));
+    for (size_t c = 0; c < sizeof(pull_cases) / sizeof(pull_cases[0]); c++) {
+        memset(dst, 0, BENCH_FILE);
+        st_pull_begin(pl, mem_write, &sink, BENCH_FILE, ft_pull_block_max(247), NULL);
+        // Every other 1 MB already on the phone from an earlier download
+        size_t held = 0;
+        for (size_t off = 0; pull_cases[c].held > 0 && off < BENCH_FILE; off += 2u << 20) {
+            memcpy(dst + off, src + off, 1u << 20);
+            st_pull_skip(pl, off, 1u << 20);
+            held += 1u << 20;
+        }
+        uint32_t served;
+        double dt = pull_stream(pl, src, pull_cases[c].drop, &served);
+        // Blocks straddling a held range's edge are fetched whole
+        bool ok = st_pull_complete(pl) && memcmp(src, dst, BENCH_FILE) == 0;
+        failures += !ok;
+        printf("  %-18s %8.0f MB/s  written=%.2f MB served=%u re-requested=%u timeouts=%u %s\n",
+               pull_cases[c].name, pl->stats.bytes_written / 1048576.0 / dt, pl->stats.bytes_written / 1048576.0,
+               served, pl->stats.rerequested, pl->stats.timeouts, ok ? "ok" : "MISMATCH");
+    }
+    free(pl);
+
+    // RAW v1 decode over the same bytes
+    st_raw_check_t chk = {0};
+    double t0 = now_s();
+    st_raw_decode(&chk, src, BENCH_FILE, NULL);
+    double dt = now_s() - t0;
+    printf("raw decode %8.0f MB/s (%u samples)\n", BENCH_FILE / 1048576.0 / dt, chk.samples);
+
+    free(src);
+    free(dst);
+    free(pkts);
+    free(order);
+    free(rx);
+    return failures ? 1 : 0;
+}
+
+// ---------------------------------------------------------------------------
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [options] -o FILE\n"
+            "       %s --bench\n"
+            "  --host ADDR          emulator address (default 127.0.0.1)\n"
+            "  --port P             tag port (default 47000)\n"
+            "  --mtu M              requested ATT MTU (default 247)\n"
+            "  --file NAME          START_WITH_FILENAME instead of the latest recording\n"
+            "  --id N               START_BY_ID instead of the latest recording\n"
+            "  -o, --out FILE       where to write the download\n"
+            "  --passes N           transfers allowed to fill missing ranges (default 3)\n"
+            "  --pull               ask for blocks with READ_BLOCKS instead of a pushed stream (needs --id)\n"
+            "  --window N           pull: most READ_BLOCKS in flight (default 8, what the tag queues)\n"
+            "  --count N            pull: blocks per READ_BLOCKS, 1-64 (default 16)\n"
+            "  --timeout-ms T       silence that counts as a lost link (default 5000)\n"
+            "  --bench              library micro-benchmarks, no emulator needed\n"
+            "  --quiet              no status or range logs\n",
+            argv0, argv0);
+}
+
+int main(int argc, char **argv) {
+    fetch_opts_t o = {
+        .host = "127.0.0.1", .port = 47000, .mtu = 247, .passes = 3, .timeout_ms = 5000,
+    };
+    bool run_bench = false;
+    static const struct option opts[] = {
+        { "host", required_argument, 0, 'H' },
+        { "port", required_argument, 0, 'p' },
+        { "mtu", required_argument, 0, 'm' },
+        { "file", required_argument, 0, 'f' },
+        { "id", required_argument, 0, 'i' },
+        { "out", required_argument, 0, 'o' },
+        { "passes", required_argument, 0, 'P' },
+        { "timeout-ms", required_argument, 0, 't' },
+        { "pull", no_argument, 0, 'L' },
+        { "window", required_argument, 0, 'w' },
+        { "count", required_argument, 0, 'c' },
+        { "bench", no_argument, 0, 'B' },
+        { "quiet", no_argument, 0, 'q' },
+        { "help", no_argument, 0, 'h' },
+        { 0, 0, 0, 0 },
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "o:qh", opts, NULL)) != -1) {
+        switch (c) {
+        case 'H': o.host = optarg; break;
+        case 'p': o.port = atoi(optarg); break;
+        case 'm': o.mtu = (uint16_t)atoi(optarg); break;
+        case 'f': o.file = optarg; break;
+        case 'i': o.rec_id = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'o': o.out = optarg; break;
+        case 'P': o.passes = atoi(optarg); break;
+        case 't': o.timeout_ms = atoi(optarg); break;
+        case 'L': o.pull = true; break;
+        case 'w': o.pull_params.window_max = (uint8_t)atoi(optarg); break;
+        case 'c': o.pull_params.count = (uint8_t)atoi(optarg); break;
+        case 'B': run_bench = true; break;
+        case 'q': o.quiet = true; break;
+        default: usage(argv[0]); return c == 'h' ? 0 : 2;
+        }
+    }
+    if (run_bench) return bench();
+    if (!o.out || o.passes < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+    uint8_t probe[ST_CMD_MAX];
+    if (start_cmd(&o, probe) == 0) {
+        fprintf(stderr, "st_fetch: invalid --file or --id\n");
+        return 2;
+    }
+    if (o.pull && (o.file || !o.rec_id)) {
+        fprintf(stderr, "st_fetch: --pull needs --id\n");
+        return 2;
+    }
+    return fetch(&o);
+}
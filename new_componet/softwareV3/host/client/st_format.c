@@ -0,0 +1,123 @@
+/**
+ * @file st_format.c
+ * @brief RAW v1 / SPCH file and legacy integrity chunk decoding (see st_client.h)
+ */
+
+#include "st_client.h"
+#include "speech_codec.h"
+#include <string.h>
+
+// main/raw_audio_storage.h
+#define RAW_MAGIC    0x52415741u    // "RAWA"
+#define RAW_VERSION  1
+#define RAW_F_RESAMPLED 0x00000001u
+#define RAW_F_OPEN      0x00000002u
+#define RAW_F_RECOVERED 0x00000004u
+
+static inline uint16_t get16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t get32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+bool st_header_decode(const uint8_t *hdr, size_t len, st_file_info_t *out) {
+    memset(out, 0, sizeof(*out));
+    if (len < ST_HEADER_BYTES) return false;
+    uint32_t magic = get32(hdr);
+    out->version = get32(hdr + 4);
+
+    if (magic == RAW_MAGIC && out->version == RAW_VERSION) {
+        out->format = ST_FORMAT_RAW_V1;
+        out->sample_rate = get32(hdr + 8);
+        out->total_samples = get32(hdr + 12);
+        out->start_ms = get32(hdr + 16);
+        out->end_ms = get32(hdr + 20);
+        out->measured_rate_mhz = get32(hdr + 24);
+        uint32_t flags = get32(hdr + 28);
+        out->resampled = (flags & RAW_F_RESAMPLED) != 0;
+        out->open = (flags & RAW_F_OPEN) != 0;
+        out->recovered = (flags & RAW_F_RECOVERED) != 0;
+        // An open header has no totals yet
+        out->expected_size = out->open ? 0 : ST_HEADER_BYTES + (uint64_t)out->total_samples * ST_RAW_SAMPLE;
+        return true;
+    }
+
+    if (magic == SPEECH_FILE_MAGIC && out->version == SPEECH_FILE_VERSION) {
+        out->codec = get16(hdr + 8);
+        if (!speech_codec_mode_valid(out->codec) || get16(hdr + 10) != SPEECH_FRAME_MS) return false;
+        out->format = ST_FORMAT_SPCH_V1;
+        out->sample_rate = get32(hdr + 12);
+        out->total_frames = get32(hdr + 16);
+        out->total_samples = get32(hdr + 20);
+        out->start_ms = get32(hdr + 24);
+        out->end_ms = get32(hdr + 28);
+        out->frame_bytes = (uint32_t)speech_codec_frame_bytes((speech_codec_mode_t)out->codec);
+        out->expected_size = ST_HEADER_BYTES + (uint64_t)out->total_frames * out->frame_bytes;
+        return true;
+    }
+
+    out->version = 0;
+    return false;
+}
+
+size_t st_raw_decode(st_raw_check_t *chk, const uint8_t *data, size_t len, st_raw_sample_t *out) {
+    size_t n = len / ST_RAW_SAMPLE;
+    for (size_t i = 0; i < n; i++, data += ST_RAW_SAMPLE) {
+        st_raw_sample_t s = {
+            .adc = get16(data),
+            .timestamp_ms = get32(data + 2),
+            .count = get32(data + 6),
+        };
+        if (s.adc > 4095) chk->out_of_range++;
+        if (chk->have_prev) {
+            if (s.count != chk->prev.count + 1) chk->count_gaps++;
+            if (s.timestamp_ms < chk->prev.timestamp_ms) chk->time_backwards++;
+        }
+        chk->prev = s;
+        chk->have_prev = true;
+        chk->samples++;
+        if (out) out[i] = s;
+    }
+    return n;
+}
+
+int16_t st_raw_to_pcm(uint16_t adc) {
+    return speech_codec_adc_to_pcm(adc);
+}
+
+bool st_spch_decoder_init(st_spch_decoder_t *dec, const st_file_info_t *info) {
+    memset(dec, 0, sizeof(*dec));
+    if (info->format != ST_FORMAT_SPCH_V1) return false;
+    dec->codec = info->codec;
+    dec->frame_bytes = (uint16_t)info->frame_bytes;
+    return true;
+}
+
+size_t st_spch_decode_frame(st_spch_decoder_t *dec, const uint8_t *frame, size_t len, int16_t *pcm) {
+    speech_decoder_t d;
+    speech_decoder_init(&d, (speech_codec_mode_t)dec->codec);
+    d.adpcm.predictor = dec->predictor;
+    d.adpcm.step_index = dec->step_index;
+    size_t n = speech_decoder_decode_frame(&d, frame, len, pcm);
+    dec->predictor = d.adpcm.predictor;
+    dec->step_index = d.adpcm.step_index;
+    return n;
+}
+
+bool st_chunk_decode(const uint8_t *buf, size_t len, st_chunk_t *out) {
+    if (len < ST_CHUNK_HEADER + 4) return false;
+    out->proto_ver = get16(buf);
+    out->seq = get16(buf + 2);
+    out->file_id = get32(buf + 4);
+    out->offset = get32(buf + 8);
+    out->payload_len = get16(buf + 12);
+    out->flags = get16(buf + 14);
+    out->payload = buf + ST_CHUNK_HEADER;
+    if (len < ST_CHUNK_HEADER + (size_t)out->payload_len + 4) return false;
+
+    // ble_chunk_calculate_crc() inverts crc32c_update()'s result once more
+    uint32_t crc = ~st_crc32c_update(0xFFFFFFFFu, buf, ST_CHUNK_HEADER + out->payload_len);
+    return crc == get32(buf + ST_CHUNK_HEADER + out->payload_len);
+}
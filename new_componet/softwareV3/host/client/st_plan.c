@@ -0,0 +1,199 @@
+/**
+ * @file st_plan.c
+ * @brief Link throughput estimate and per-recording variant choice (see st_client.h)
+ */
+
+#include "st_client.h"
+#include "ft_proto.h"
+#include "speech_codec.h"
+#include <math.h>
+#include <string.h>
+
+_Static_assert(ST_VARIANT_RAW == FT_VARIANT_RAW && ST_VARIANT_NB2 == FT_VARIANT_MAX, "variants are FT_VARIANT_*");
+_Static_assert(ST_VARIANT_WB4 == SPEECH_CODEC_WB4 && ST_VARIANT_NB4 == SPEECH_CODEC_NB4 &&
+               ST_VARIANT_NB2 == SPEECH_CODEC_NB2, "speech variants are speech_codec_mode_t");
+
+#define RAW_RATE   16000        // Samples per second of a recording
+
+// Lowest fidelity first
+static const uint8_t k_levels[] = { ST_VARIANT_NB2, ST_VARIANT_NB4, ST_VARIANT_WB4, ST_VARIANT_RAW };
+#define LEVELS ((int)(sizeof(k_levels) / sizeof(k_levels[0])))
+
+const char *st_variant_name(uint8_t variant) {
+    switch (variant) {
+    case ST_VARIANT_RAW: return "raw";
+    case ST_VARIANT_WB4: return "wb4";
+    case ST_VARIANT_NB4: return "nb4";
+    case ST_VARIANT_NB2: return "nb2";
+    default:             return "none";
+    }
+}
+
+uint64_t st_variant_size(uint8_t variant, uint64_t samples) {
+    if (variant == ST_VARIANT_RAW) return ST_HEADER_BYTES + samples * ST_RAW_SAMPLE;
+    if (!speech_codec_mode_valid(variant)) return 0;
+    uint64_t frames = (samples + SPEECH_FRAME_SAMPLES_IN - 1) / SPEECH_FRAME_SAMPLES_IN;
+    return ST_HEADER_BYTES + frames * speech_codec_frame_bytes((speech_codec_mode_t)variant);
+}
+
+void st_link_init(st_link_t *l, double prior_rate, double prior_overhead_s) {
+    memset(l, 0, sizeof(*l));
+    l->rate = prior_rate;
+    l->dev = prior_rate / 4;    // Unmeasured: assume it is not that good
+    l->overhead_s = prior_overhead_s;
+}
+
+void st_link_sample(st_link_t *l, uint64_t bytes, double seconds) {
+    if (seconds <= 0) return;
+    double x = (double)bytes / seconds;
+    if (l->samples++ == 0) {
+        l->rate = x;
+        l->dev = x / 4;
+        return;
+    }
+    double d = fabs(x - l->rate);
+    l->rate += ST_LINK_WEIGHT * (x - l->rate);
+    l->dev += ST_LINK_WEIGHT * (d - l->dev);
+}
+
+void st_link_overhead(st_link_t *l, double seconds) {
+    if (seconds < 0) return;
+    l->overhead_s += ST_LINK_WEIGHT * (seconds - l->overhead_s);
+}
+
+double st_link_rate(const st_link_t *l) {
+    double r = l->rate - l->dev / 2;
+    // A link that is all gaps still moves something when it is up
+    return r > l->rate / 4 ? r : l->rate / 4;
+}
+
+static int level_of(uint8_t variant) {
+    for (int i = 0; i < LEVELS; i++) {
+        if (k_levels[i] == variant) return i;
+    }
+    return -1;
+}
+
+// Expected time to fetch f as variant v; INFINITY if the tag cannot produce it
+static double cost(const st_plan_params_t *p, const st_plan_file_t *f, uint8_t v) {
+    double t = p->overhead_s + (double)st_variant_size(v, f->samples) / p->rate;
+    if (v != ST_VARIANT_RAW && !(f->ready & (1u << v))) {
+        if (p->xcode_x <= 0) return INFINITY;
+        t += (double)f->samples / RAW_RATE / p->xcode_x;
+    }
+    return t;
+}
+
+// Best variant of f at or below level (not below the floor), else the cheapest one above
+static uint8_t variant_at(const st_plan_params_t *p, const st_plan_file_t *f, int level, int floor) {
+    for (int i = level; i >= floor; i--) {
+        if (isfinite(cost(p, f, k_levels[i]))) return k_levels[i];
+    }
+    for (int i = level + 1; i < LEVELS; i++) {
+        if (isfinite(cost(p, f, k_levels[i]))) return k_levels[i];
+    }
+    return ST_VARIANT_RAW;
+}
+
+// Quickest variant of f not below the floor (a ready companion can beat a transcode)
+static uint8_t cheapest(const st_plan_params_t *p, const st_plan_file_t *f, int floor) {
+    uint8_t best = ST_VARIANT_RAW;
+    for (int i = floor; i < LEVELS; i++) {
+        if (cost(p, f, k_levels[i]) < cost(p, f, best)) best = k_levels[i];
+    }
+    return best;
+}
+
+void st_plan(const st_plan_params_t *params, st_plan_file_t *files, size_t n, st_plan_result_t *out) {
+    st_plan_params_t p = *params;
+    if (p.rate <= 0) p.rate = 1;
+    int floor = level_of(p.floor);
+    if (floor < 0) floor = 0;
+    memset(out, 0, sizeof(*out));
+
+    for (size_t i = 0; i < n; i++) {
+        files[i].choice = ST_VARIANT_NONE;
+        files[i].cost_s = 0;
+        files[i].ready |= 1u << ST_VARIANT_RAW;
+        if (files[i].have != ST_VARIANT_RAW) out->full_s += cost(&p, &files[i], ST_VARIANT_RAW);
+    }
+
+    // Every new recording at one level: the highest they all fit in. Above
+    // the floor part of the budget is held back in case the link gets worse
+    const double spare = p.budget_s * (1.0 - ST_PLAN_RESERVE);
+    int level = LEVELS - 1;
+    for (; level >= floor; level--) {
+        double need = 0;
+        for (size_t i = 0; i < n; i++) {
+            if (files[i].have == ST_VARIANT_NONE) need += cost(&p, &files[i], variant_at(&p, &files[i], level, floor));
+        }
+        if (need <= (level == floor ? p.budget_s : spare)) break;
+    }
+
+    double left = p.budget_s;
+    if (level < floor) {
+        // Not even the floor for all: as many as fit, in order, each as quick as it gets
+        for (size_t i = 0; i < n; i++) {
+            st_plan_file_t *f = &files[i];
+            if (f->have != ST_VARIANT_NONE) continue;
+            uint8_t v = cheapest(&p, f, floor);
+            double c = cost(&p, f, v);
+            if (c <= left) {
+                f->choice = v;
+                f->cost_s = c;
+                left -= c;
+            }
+        }
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            st_plan_file_t *f = &files[i];
+            if (f->have != ST_VARIANT_NONE) continue;
+            f->choice = variant_at(&p, f, level, floor);
+            f->cost_s = cost(&p, f, f->choice);
+            left -= f->cost_s;
+        }
+        left -= p.budget_s - spare;
+        // One level up at a time, oldest first
+        for (int up = level + 1; up < LEVELS; up++) {
+            for (size_t i = 0; i < n; i++) {
+                st_plan_file_t *f = &files[i];
+                if (f->have != ST_VARIANT_NONE) continue;
+                uint8_t v = variant_at(&p, f, up, floor);
+                if (level_of(v) <= level_of(f->choice)) continue;
+                double c = cost(&p, f, v);
+                if (c - f->cost_s <= left) {
+                    left -= c - f->cost_s;
+                    f->choice = v;
+                    f->cost_s = c;
+                }
+            }
+        }
+        // Then what is stored in a lower variant, as good as it fits
+        for (size_t i = 0; i < n; i++) {
+            st_plan_file_t *f = &files[i];
+            if (f->have == ST_VARIANT_NONE || f->have == ST_VARIANT_RAW) continue;
+            for (int up = LEVELS - 1; up > level_of(f->have) && up >= floor; up--) {
+                uint8_t v = k_levels[up];
+                double c = cost(&p, f, v);
+                if (c <= left) {
+                    left -= c;
+                    f->choice = v;
+                    f->cost_s = c;
+                    break;
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        const st_plan_file_t *f = &files[i];
+        if (f->choice == ST_VARIANT_NONE) {
+            out->deferred += f->have == ST_VARIANT_NONE;
+            continue;
+        }
+        out->need_s += f->cost_s;
+        out->fetch++;
+        out->reduced += f->choice != ST_VARIANT_RAW;
+        out->upgrades += f->have != ST_VARIANT_NONE;
+    }
+}
@@ -0,0 +1,271 @@
+/**
+ * @file st_pull.c
+ * @brief Pull download: READ_BLOCKS window, block placement and re-requests (see st_client.h)
+ */
+
+#include "st_client.h"
+#include "ft_proto.h"
+#include "ft_pull.h"
+#include <string.h>
+
+#define PULL_SRTT_GAIN 0.125
+
+static uint32_t span_end(const st_pull_span_t *s) {
+    return s->first + s->count;
+}
+
+static void span_erase(st_pull_t *pl, uint32_t i) {
+    memmove(&pl->todo[i], &pl->todo[i + 1], (pl->todo_count - i - 1) * sizeof(pl->todo[0]));
+    pl->todo_count--;
+}
+
+// Add [first, first + count) to the ascending todo list, merging neighbours.
+// With no span left the range joins its neighbour across the gap: held
+// blocks are then asked for again, which only costs duplicates.
+static void todo_add(st_pull_t *pl, uint32_t first, uint32_t count) {
+    if (count == 0) return;
+    uint32_t end = first + count;
+    uint32_t i = 0;
+    while (i < pl->todo_count && span_end(&pl->todo[i]) < first) i++;
+    if (i < pl->todo_count && pl->todo[i].first <= end) {
+        st_pull_span_t *s = &pl->todo[i];
+        uint32_t e = end > span_end(s) ? end : span_end(s);
+        if (first < s->first) s->first = first;
+        while (i + 1 < pl->todo_count && pl->todo[i + 1].first <= e) {
+            if (span_end(&pl->todo[i + 1]) > e) e = span_end(&pl->todo[i + 1]);
+            span_erase(pl, i + 1);
+        }
+        s->count = e - s->first;
+        return;
+    }
+    if (pl->todo_count == ST_PULL_MAX_SPANS) {
+        st_pull_span_t *s = &pl->todo[i > 0 ? i - 1 : 0];
+        uint32_t e = end > span_end(s) ? end : span_end(s);
+        if (first < s->first) s->first = first;
+        s->count = e - s->first;
+        return;
+    }
+    memmove(&pl->todo[i + 1], &pl->todo[i], (pl->todo_count - i) * sizeof(pl->todo[0]));
+    pl->todo[i] = (st_pull_span_t){ .first = first, .count = count };
+    pl->todo_count++;
+}
+
+// Take [first, first + count) out of todo; a split with no span left keeps the
+// range, which again only costs a duplicate
+static void todo_remove(st_pull_t *pl, uint32_t first, uint32_t count) {
+    uint32_t end = first + count;
+    for (uint32_t i = 0; i < pl->todo_count && pl->todo[i].first < end; ) {
+        st_pull_span_t *s = &pl->todo[i];
+        uint32_t se = span_end(s);
+        if (se <= first) {
+            i++;
+            continue;
+        }
+        if (s->first >= first && se <= end) {
+            span_erase(pl, i);
+        } else if (s->first >= first) {
+            s->count = se - end;
+            s->first = end;
+            i++;
+        } else if (se <= end) {
+            s->count = first - s->first;
+            i++;
+        } else {
+            if (pl->todo_count == ST_PULL_MAX_SPANS) return;
+            memmove(&pl->todo[i + 1], &pl->todo[i], (pl->todo_count - i) * sizeof(pl->todo[0]));
+            pl->todo_count++;
+            pl->todo[i].count = first - s->first;
+            pl->todo[i + 1] = (st_pull_span_t){ .first = end, .count = se - end };
+            return;
+        }
+    }
+}
+
+static bool todo_has(const st_pull_t *pl, uint32_t block) {
+    for (uint32_t i = 0; i < pl->todo_count && pl->todo[i].first <= block; i++) {
+        if (block < span_end(&pl->todo[i])) return true;
+    }
+    return false;
+}
+
+static bool req_done(const st_pull_req_t *r) {
+    return r->got == (r->count == 64 ? UINT64_MAX : (UINT64_C(1) << r->count) - 1);
+}
+
+static void req_free(st_pull_t *pl, st_pull_req_t *r) {
+    r->used = false;
+    pl->inflight--;
+}
+
+// Blocks of r that never arrived go back to todo
+static uint32_t req_return(st_pull_t *pl, st_pull_req_t *r) {
+    uint32_t lost = 0;
+    for (uint8_t i = 0; i < r->count; ) {
+        if (r->got & (UINT64_C(1) << i)) {
+            i++;
+            continue;
+        }
+        uint8_t j = i;
+        while (j < r->count && !(r->got & (UINT64_C(1) << j))) j++;
+        todo_add(pl, r->block + i, j - i);
+        lost += j - i;
+        i = j;
+    }
+    req_free(pl, r);
+    return lost;
+}
+
+static double rto(const st_pull_t *pl) {
+    return 2 * pl->srtt > pl->params.timeout_s ? 2 * pl->srtt : pl->params.timeout_s;
+}
+
+// Multiplicative decrease, at most once per timeout period
+static void cut_window(st_pull_t *pl, double now_s) {
+    if (now_s - pl->cut_s < rto(pl)) return;
+    pl->cut_s = now_s;
+    pl->window = pl->window / 2 < 1 ? 1 : pl->window / 2;
+}
+
+static void set_size(st_pull_t *pl, uint64_t size) {
+    if (pl->size != ST_SIZE_UNKNOWN) return;
+    pl->size = size;
+    pl->blocks = (uint32_t)((size + pl->block - 1) / pl->block);
+    todo_remove(pl, pl->blocks, UINT32_MAX - pl->blocks);
+    for (int i = 0; i < ST_PULL_MAX_REQS; i++) {
+        st_pull_req_t *r = &pl->reqs[i];
+        if (!r->used) continue;
+        if (r->block >= pl->blocks) {
+            req_free(pl, r);
+        } else if (r->block + r->count > pl->blocks) {
+            r->count = (uint8_t)(pl->blocks - r->block);
+            if (req_done(r)) req_free(pl, r);
+        }
+    }
+}
+
+void st_pull_begin(st_pull_t *pl, st_write_fn write, void *ctx, uint64_t size, uint16_t block,
+                   const st_pull_params_t *params) {
+    memset(pl, 0, sizeof(*pl));
+    pl->write = write;
+    pl->ctx = ctx;
+    pl->block = block ? block : 1;
+    pl->params = (st_pull_params_t){ .window = 2, .window_max = FT_PULL_QUEUE, .count = 16, .timeout_s = 0.5 };
+    if (params) {
+        if (params->window) pl->params.window = params->window;
+        if (params->window_max) pl->params.window_max = params->window_max;
+        if (params->count) pl->params.count = params->count;
+        if (params->timeout_s > 0) pl->params.timeout_s = params->timeout_s;
+    }
+    if (pl->params.window_max > ST_PULL_MAX_REQS) pl->params.window_max = ST_PULL_MAX_REQS;
+    if (pl->params.window > pl->params.window_max) pl->params.window = pl->params.window_max;
+    if (pl->params.count > FT_PULL_MAX_COUNT) pl->params.count = FT_PULL_MAX_COUNT;
+    pl->window = pl->params.window;
+    pl->cut_s = -1e9;
+    pl->size = ST_SIZE_UNKNOWN;
+    pl->blocks = UINT32_MAX;
+    todo_add(pl, 0, UINT32_MAX);
+    if (size != ST_SIZE_UNKNOWN) set_size(pl, size);
+}
+
+void st_pull_skip(st_pull_t *pl, uint64_t offset, uint64_t len) {
+    uint64_t first = (offset + pl->block - 1) / pl->block;
+    uint64_t end = offset + len;
+    uint64_t last = pl->size != ST_SIZE_UNKNOWN && end >= pl->size ? pl->blocks : end / pl->block;
+    if (last > pl->blocks) last = pl->blocks;
+    if (first < last) todo_remove(pl, (uint32_t)first, (uint32_t)(last - first));
+}
+
+size_t st_pull_next(st_pull_t *pl, double now_s, uint8_t *cmd, size_t cap) {
+    for (int i = 0; i < ST_PULL_MAX_REQS; i++) {
+        st_pull_req_t *r = &pl->reqs[i];
+        if (!r->used || now_s - r->sent_s < rto(pl)) continue;
+        pl->stats.timeouts++;
+        pl->stats.rerequested += req_return(pl, r);
+        cut_window(pl, now_s);
+    }
+    if (pl->failed || pl->todo_count == 0 || pl->inflight >= (uint8_t)pl->window) return 0;
+
+    st_pull_req_t *r = NULL;
+    for (int i = 0; i < ST_PULL_MAX_REQS && !r; i++) {
+        if (!pl->reqs[i].used) r = &pl->reqs[i];
+    }
+    st_pull_span_t *s = &pl->todo[0];
+    uint8_t count = s->count < pl->params.count ? (uint8_t)s->count : pl->params.count;
+    size_t n = st_cmd_read_blocks(cmd, cap, s->first, count);
+    if (!r || n == 0) return 0;
+    *r = (st_pull_req_t){ .block = s->first, .count = count, .used = true, .sent_s = now_s };
+    todo_remove(pl, r->block, count);
+    pl->inflight++;
+    pl->stats.requests++;
+    return n;
+}
+
+st_rx_result_t st_pull_feed(st_pull_t *pl, const uint8_t *notif, size_t len, double now_s) {
+    ft_pkt_header_t hdr;
+    if (!ft_pkt_header_decode(notif, len, &hdr) || !hdr.pull || hdr.len < FT_PULL_HEADER_SIZE) {
+        pl->stats.bad++;
+        return ST_RX_BAD_PACKET;
+    }
+    if (pl->failed) return ST_RX_WRITE_FAILED;
+    uint32_t offset = ft_pull_hdr_decode(notif + FILE_TRANSFER_HEADER_SIZE);
+    const uint8_t *data = notif + FILE_TRANSFER_HEADER_SIZE + FT_PULL_HEADER_SIZE;
+    uint16_t n = (uint16_t)(hdr.len - FT_PULL_HEADER_SIZE);
+
+    if (n > 0 && (offset % pl->block != 0 || n > pl->block || (n < pl->block && !hdr.eof))) {
+        pl->stats.bad++;
+        return ST_RX_BAD_PACKET;
+    }
+    if (hdr.eof) set_size(pl, (uint64_t)offset + n);
+    if (n == 0) return st_pull_complete(pl) ? ST_RX_DONE : ST_RX_OK;
+
+    uint32_t b = offset / pl->block;
+    if (b >= pl->blocks) {
+        pl->stats.bad++;
+        return ST_RX_BAD_PACKET;
+    }
+    st_pull_req_t *r = NULL;
+    for (int i = 0; i < ST_PULL_MAX_REQS && !r; i++) {
+        st_pull_req_t *q = &pl->reqs[i];
+        if (q->used && b >= q->block && b < q->block + q->count) r = q;
+    }
+    if (r ? (r->got >> (b - r->block)) & 1 : !todo_has(pl, b)) {
+        pl->stats.duplicates++;
+        return st_pull_complete(pl) ? ST_RX_DONE : ST_RX_OK;
+    }
+
+    if (pl->write(pl->ctx, offset, data, n) != 0) {
+        pl->failed = true;
+        return ST_RX_WRITE_FAILED;
+    }
+    pl->stats.blocks++;
+    pl->stats.bytes_written += n;
+    if (!r) {
+        // Late answer to a request that already timed out
+        todo_remove(pl, b, 1);
+    } else {
+        r->got |= UINT64_C(1) << (b - r->block);
+        if (req_done(r)) {
+            double rtt = now_s - r->sent_s;
+            pl->srtt = pl->srtt == 0 ? rtt : pl->srtt + PULL_SRTT_GAIN * (rtt - pl->srtt);
+            pl->window += 1 / pl->window;
+            if (pl->window > pl->params.window_max) pl->window = pl->params.window_max;
+            req_free(pl, r);
+        }
+    }
+    return st_pull_complete(pl) ? ST_RX_DONE : ST_RX_OK;
+}
+
+void st_pull_overrun(st_pull_t *pl, double now_s) {
+    pl->stats.overruns++;
+    cut_window(pl, now_s);
+}
+
+void st_pull_relink(st_pull_t *pl) {
+    for (int i = 0; i < ST_PULL_MAX_REQS; i++) {
+        if (pl->reqs[i].used) pl->stats.rerequested += req_return(pl, &pl->reqs[i]);
+    }
+}
+
+bool st_pull_complete(const st_pull_t *pl) {
+    return pl->size != ST_SIZE_UNKNOWN && pl->todo_count == 0 && pl->inflight == 0;
+}
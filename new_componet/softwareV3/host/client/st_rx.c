@@ -0,0 +1,261 @@
+/**
+ * @file st_rx.c
+ * @brief Data notification reassembly and missing-range bookkeeping (see st_client.h)
+ */
+
+#include "st_client.h"
+#include "ft_proto.h"
+#include <string.h>
+
+static uint64_t range_end(const st_range_t *r) {
+    return r->offset + r->len;
+}
+
+static void clamp_to_size(st_rx_t *rx) {
+    if (rx->size == ST_SIZE_UNKNOWN) return;
+    for (uint32_t i = 0; i < rx->missing_count; i++) {
+        st_range_t *r = &rx->missing[i];
+        if (r->offset >= rx->size) {
+            rx->missing_count = i;
+            break;
+        }
+        if (range_end(r) > rx->size) r->len = rx->size - r->offset;
+    }
+}
+
+static st_rx_result_t broken(st_rx_t *rx) {
+    rx->broken = true;
+    return ST_RX_RESTART;
+}
+
+// First pass only: offsets grow, so a new hole extends the last one or follows it
+static st_rx_result_t add_missing(st_rx_t *rx, uint64_t offset, uint64_t len) {
+    if (len == 0) return ST_RX_OK;
+    if (rx->missing_count > 0) {
+        st_range_t *last = &rx->missing[rx->missing_count - 1];
+        if (range_end(last) == offset) {
+            last->len += len;
+            return ST_RX_OK;
+        }
+    }
+    if (rx->missing_count == ST_RX_MAX_RANGES) return broken(rx);
+    rx->missing[rx->missing_count++] = (st_range_t){ .offset = offset, .len = len };
+    return ST_RX_OK;
+}
+
+// Fill pass: write the parts of [offset, offset + len) that are still missing
+static st_rx_result_t fill_missing(st_rx_t *rx, uint64_t offset, const uint8_t *data, size_t len) {
+    uint64_t end = offset + len;
+    for (uint32_t i = 0; i < rx->missing_count && rx->missing[i].offset < end; ) {
+        st_range_t *r = &rx->missing[i];
+        uint64_t a = r->offset > offset ? r->offset : offset;
+        uint64_t b = range_end(r) < end ? range_end(r) : end;
+        if (a >= b) {
+            i++;
+            continue;
+        }
+        if (rx->write(rx->ctx, a, data + (a - offset), (size_t)(b - a)) != 0) {
+            return ST_RX_WRITE_FAILED;
+        }
+        rx->stats.bytes_written += b - a;
+
+        if (a == r->offset && b == range_end(r)) {
+            memmove(r, r + 1, (rx->missing_count - i - 1) * sizeof(*r));
+            rx->missing_count--;
+        } else if (a == r->offset) {
+            r->len -= b - r->offset;
+            r->offset = b;
+            i++;
+        } else if (b == range_end(r)) {
+            r->len = a - r->offset;
+            i++;
+        } else {
+            // The write landed inside the hole and split it
+            if (rx->missing_count == ST_RX_MAX_RANGES) return broken(rx);
+            memmove(r + 2, r + 1, (rx->missing_count - i - 1) * sizeof(*r));
+            rx->missing_count++;
+            r[1] = (st_range_t){ .offset = b, .len = range_end(r) - b };
+            r->len = a - r->offset;
+            i += 2;
+        }
+    }
+    return ST_RX_OK;
+}
+
+static st_rx_result_t place(st_rx_t *rx, const uint8_t *data, uint16_t len, bool eof) {
+    if (!eof) {
+        if (rx->chunk != 0 && len != rx->chunk && rx->lost_in_pass) {
+            // Lost packets were sized by the old length, so what follows is misplaced
+            return broken(rx);
+        }
+        rx->chunk = len;
+    }
+
+    st_rx_result_t res = ST_RX_OK;
+    if (rx->fill) {
+        res = fill_missing(rx, rx->offset, data, len);
+    } else if (len > 0) {
+        if (rx->write(rx->ctx, rx->offset, data, len) != 0) return ST_RX_WRITE_FAILED;
+        rx->stats.bytes_written += len;
+    }
+    rx->offset += len;
+    rx->next_seq++;
+    if (eof) {
+        rx->done = true;
+        if (rx->size == ST_SIZE_UNKNOWN) rx->size = rx->offset;
+        clamp_to_size(rx);
+        return res == ST_RX_OK ? ST_RX_DONE : res;
+    }
+    return res;
+}
+
+static st_rx_result_t declare_lost(st_rx_t *rx) {
+    rx->stats.lost++;
+    rx->lost_in_pass = true;
+    uint64_t len = rx->chunk;
+    if (len == 0) {
+        // Nothing to size it by yet: borrow the first held packet's length
+        for (uint32_t s = rx->next_seq + 1; s < rx->high_seq; s++) {
+            st_rx_slot_t *slot = &rx->slots[s % ST_RX_WINDOW];
+            if (slot->used && slot->seq == s && !slot->eof) {
+                len = slot->len;
+                break;
+            }
+        }
+        if (len == 0) return broken(rx);
+        rx->chunk = (uint16_t)len;
+    }
+    st_rx_result_t res = rx->fill ? ST_RX_OK : add_missing(rx, rx->offset, len);
+    rx->offset += len;
+    rx->next_seq++;
+    return res;
+}
+
+// Place held packets that are now in order
+static st_rx_result_t drain(st_rx_t *rx) {
+    st_rx_result_t res = ST_RX_OK;
+    while (res == ST_RX_OK && rx->next_seq < rx->high_seq) {
+        st_rx_slot_t *slot = &rx->slots[rx->next_seq % ST_RX_WINDOW];
+        if (!slot->used || slot->seq != rx->next_seq) break;
+        slot->used = false;
+        res = place(rx, slot->data, slot->len, slot->eof);
+    }
+    return res;
+}
+
+// Advance next_seq to target, placing what is held and declaring the rest lost
+static st_rx_result_t advance(st_rx_t *rx, uint32_t target) {
+    st_rx_result_t res = ST_RX_OK;
+    while (res == ST_RX_OK && rx->next_seq < target) {
+        st_rx_slot_t *slot = &rx->slots[rx->next_seq % ST_RX_WINDOW];
+        if (slot->used && slot->seq == rx->next_seq) {
+            slot->used = false;
+            res = place(rx, slot->data, slot->len, slot->eof);
+        } else {
+            res = declare_lost(rx);
+        }
+    }
+    return res;
+}
+
+static void begin_pass(st_rx_t *rx) {
+    rx->done = false;
+    rx->lost_in_pass = false;
+    rx->next_seq = 0;
+    rx->high_seq = 0;
+    rx->offset = 0;
+    rx->chunk = 0;
+    for (int i = 0; i < ST_RX_WINDOW; i++) rx->slots[i].used = false;
+}
+
+void st_rx_begin(st_rx_t *rx, st_write_fn write, void *ctx, uint64_t size) {
+    memset(rx, 0, sizeof(*rx));
+    rx->write = write;
+    rx->ctx = ctx;
+    rx->size = size;
+    begin_pass(rx);
+}
+
+void st_rx_begin_fill(st_rx_t *rx) {
+    rx->fill = true;
+    rx->broken = false;
+    memset(&rx->stats, 0, sizeof(rx->stats));
+    begin_pass(rx);
+}
+
+void st_rx_set_size(st_rx_t *rx, uint64_t size) {
+    rx->size = size;
+    clamp_to_size(rx);
+}
+
+st_rx_result_t st_rx_feed(st_rx_t *rx, const uint8_t *notif, size_t len) {
+    ft_pkt_header_t hdr;
+    if (!ft_pkt_header_decode(notif, len, &hdr) || hdr.len > ST_RX_SLOT_BYTES || hdr.fec || hdr.pull) {
+        rx->stats.bad++;
+        return ST_RX_BAD_PACKET;
+    }
+    if (rx->broken) return ST_RX_RESTART;
+
+    // Sequence numbers are 16 bits on the air; unwrap around the next expected one
+    int32_t ahead = (int16_t)(hdr.seq - (uint16_t)rx->next_seq);
+    if (rx->done || ahead < 0) {
+        rx->stats.stale++;
+        return rx->done ? ST_RX_DONE : ST_RX_OK;
+    }
+    uint32_t seq = rx->next_seq + (uint32_t)ahead;
+    const uint8_t *payload = notif + FILE_TRANSFER_HEADER_SIZE;
+    rx->stats.packets++;
+
+    st_rx_result_t res = ST_RX_OK;
+    if (seq >= rx->next_seq + ST_RX_WINDOW) {
+        // The oldest hole has waited a full window: give up on it
+        res = advance(rx, seq - ST_RX_WINDOW + 1);
+        if (res == ST_RX_OK) res = drain(rx);
+        if (res == ST_RX_DONE) rx->stats.stale++;
+        if (res != ST_RX_OK) return res;
+    }
+
+    if (seq == rx->next_seq) {
+        res = place(rx, payload, hdr.len, hdr.eof);
+        if (res == ST_RX_OK) res = drain(rx);
+        if (rx->high_seq < rx->next_seq) rx->high_seq = rx->next_seq;
+        return res;
+    }
+
+    st_rx_slot_t *slot = &rx->slots[seq % ST_RX_WINDOW];
+    if (slot->used && slot->seq == seq) {
+        rx->stats.duplicates++;
+        return ST_RX_OK;
+    }
+    slot->used = true;
+    slot->seq = seq;
+    slot->len = hdr.len;
+    slot->eof = hdr.eof;
+    memcpy(slot->data, payload, hdr.len);
+    rx->stats.reordered++;
+    if (seq + 1 > rx->high_seq) rx->high_seq = seq + 1;
+    return ST_RX_OK;
+}
+
+st_rx_result_t st_rx_end(st_rx_t *rx) {
+    if (rx->broken) return ST_RX_RESTART;
+    st_rx_result_t res = advance(rx, rx->high_seq);
+    if (res == ST_RX_DONE) return ST_RX_DONE;
+    if (res != ST_RX_OK) return res;
+    if (rx->done) return ST_RX_DONE;
+
+    // No eof: everything from here to the end is missing
+    if (!rx->fill && rx->size > rx->offset) res = add_missing(rx, rx->offset, rx->size - rx->offset);
+    return res;
+}
+
+bool st_rx_complete(const st_rx_t *rx) {
+    return rx->size != ST_SIZE_UNKNOWN && rx->missing_count == 0 && !rx->broken &&
+           (rx->done || rx->fill);
+}
+
+size_t st_rx_missing(const st_rx_t *rx, st_range_t *out, size_t max) {
+    size_t n = rx->missing_count < max ? rx->missing_count : max;
+    if (n) memcpy(out, rx->missing, n * sizeof(*out));
+    return rx->missing_count;
+}
@@ -0,0 +1,382 @@
+/**
+ * @file codec_bench.c
+ * @brief Speech codec modes: encode speed and segmental SNR
+ *
+ * Builds the firmware's speech_codec.c and runs every mode over the same
+ * 16 kHz speech, from 12-bit microphone codes the way speech_transcode.c
+ * reads a RAW v1 recording (speech_codec_adc_to_pcm()):
+ *   - speed: encoding the whole input, best and median of --reps, as time
+ *     per 20 ms frame and as a multiple of real time. The host is not the
+ *     target; the ratio between modes is what carries over
+ *   - quality: the decoded output against what the mode can carry at
+ *     best, the input for WB4 and the input through an ideal (floating
+ *     point) copy of the half-band decimator for NB4 and NB2. Segmental
+ *     SNR over 20 ms segments, silent segments skipped and each segment
+ *     clamped to -10..35 dB as usual, and the plain SNR over the whole input
+ *
+ * The input is synthetic speech unless --wav gives a recording: voiced
+ * stretches (a glottal pulse train through three formant resonators,
+ * gliding pitch), fricatives (noise through a high resonator) and pauses,
+ * over a low noise floor.
+ *
+ * Checks: every mode's bitrate and encoded size, each frame decodes on
+ * its own the same as in sequence, and each mode's segmental SNR is above
+ * its floor, with more bits giving more SNR.
+ *
+ *   codec_bench
+ *   codec_bench --seconds 120 --reps 50 --seed 4
+ *   codec_bench --wav meeting.wav
+ *
+ * Exit status 1 if any check fails, 2 on bad arguments.
+ */
+
+#define _GNU_SOURCE
+#include "speech_codec.h"
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define RATE_HZ         SPEECH_INPUT_RATE
+#define SEG_QUIET_DB    (-50.0)     // Reference segments below this (dBFS) are silence
+#define SEG_MIN_DB      (-10.0)
+#define SEG_MAX_DB      35.0
+#define MAX_REPS        1000
+
+typedef struct {
+    speech_codec_mode_t mode;
+    double floor_db;            // Lowest segmental SNR on the synthetic input
+} mode_case_t;
+
+static const mode_case_t kModes[] = {
+    { SPEECH_CODEC_WB4, 14.0 },
+    { SPEECH_CODEC_NB4, 15.0 },
+    { SPEECH_CODEC_NB2, 7.5 },
+};
+#define MODES (sizeof(kModes) / sizeof(kModes[0]))
+
+// Same taps as speech_codec.c, for the ideal decimator
+static const double kDecim[SPEECH_DECIM_TAPS] = {
+    -172, 0, 761, 0, -2494, 0, 10083, 16412, 10083, 0, -2494, 0, 761, 0, -172
+};
+
+static int s_failures;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        printf("  FAIL %s\n", what);
+        s_failures++;
+    }
+}
+
+static double rnd(void) {
+    return (rand() + 0.5) / ((double)RAND_MAX + 1.0);
+}
+
+static double gauss(void) {
+    return sqrt(-2.0 * log(rnd())) * cos(2.0 * M_PI * rnd());
+}
+
+// ---------------------------------------------------------------------------
+// Input
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    double a1, a2, gain, y1, y2;
+} reso_t;
+
+static void reso_set(reso_t *r, double hz, double bw) {
+    double rad = exp(-M_PI * bw / RATE_HZ);
+    r->a1 = 2.0 * rad * cos(2.0 * M_PI * hz / RATE_HZ);
+    r->a2 = -rad * rad;
+    r->gain = 1.0 - rad;
+}
+
+static double reso_run(reso_t *r, double x) {
+    double y = r->gain * x + r->a1 * r->y1 + r->a2 * r->y2;
+    r->y2 = r->y1;
+    r->y1 = y;
+    return y;
+}
+
+// Synthetic speech as 12-bit codes, then PCM as the transcoder makes it
+static void make_speech(int16_t *pcm, size_t n) {
+    double *x = malloc(n * sizeof(double));
+    reso_t f[3] = { 0 }, fric = { 0 };
+    size_t i = 0;
+    double peak = 1e-9;
+    while (i < n) {
+        size_t len = (size_t)((0.15 + 0.25 * rnd()) * RATE_HZ);
+        if (len > n - i) len = n - i;
+        double kind = rnd();
+        if (kind < 0.6) {
+            // Voiced: pulse train at a gliding pitch through F1..F3
+            double f0 = 100.0 + 120.0 * rnd(), glide = (rnd() - 0.5) * 60.0;
+            reso_set(&f[0], 300 + 500 * rnd(), 80);
+            reso_set(&f[1], 900 + 1400 * rnd(), 120);
+            reso_set(&f[2], 2500 + 800 * rnd(), 180);
+            double phase = 0;
+            for (size_t k = 0; k < len; k++) {
+                double env = sin(M_PI * (k + 0.5) / len);
+                phase += (f0 + glide * k / len) / RATE_HZ;
+                double pulse = 0;
+                if (phase >= 1.0) {
+                    phase -= 1.0;
+                    pulse = 1.0;
+                }
+                double v = reso_run(&f[0], pulse) * 1.0 + reso_run(&f[1], pulse) * 0.5 + reso_run(&f[2], pulse) * 0.25;
+                x[i + k] = env * v;
+            }
+        } else if (kind < 0.8) {
+            // Fricative: noise around 3-6 kHz
+            reso_set(&fric, 3000 + 3000 * rnd(), 1500);
+            for (size_t k = 0; k < len; k++) {
+                double env = sin(M_PI * (k + 0.5) / len);
+                x[i + k] = env * 0.05 * reso_run(&fric, gauss());
+            }
+        } else {
+            for (size_t k = 0; k < len; k++) x[i + k] = 0;
+        }
+        i += len;
+    }
+    for (i = 0; i < n; i++) {
+        if (fabs(x[i]) > peak) peak = fabs(x[i]);
+    }
+    for (i = 0; i < n; i++) {
+        // Peak at -6 dBFS, noise floor about 60 dB under it
+        double v = x[i] / peak * 0.5 + gauss() * 0.0005;
+        long code = lround(2048.0 + v * 2047.0);
+        if (code < 0) code = 0;
+        if (code > 4095) code = 4095;
+        pcm[i] = speech_codec_adc_to_pcm((uint16_t)code);
+    }
+    free(x);
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// 16 kHz mono 16-bit PCM WAV; returns the sample count, 0 on error
+static size_t read_wav(const char *path, int16_t **out) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror(path);
+        return 0;
+    }
+    uint8_t hdr[12], ch[8];
+    size_t n = 0;
+    bool fmt_ok = false;
+    if (fread(hdr, 1, 12, f) != 12 || memcmp(hdr, "RIFF", 4) || memcmp(hdr + 8, "WAVE", 4)) goto bad;
+    while (fread(ch, 1, 8, f) == 8) {
+        uint32_t len = get_u32(ch + 4);
+        if (!memcmp(ch, "fmt ", 4)) {
+            uint8_t fmt[16];
+            if (len < 16 || fread(fmt, 1, 16, f) != 16) goto bad;
+            fmt_ok = fmt[0] == 1 && fmt[2] == 1 && get_u32(fmt + 4) == RATE_HZ && fmt[14] == 16;
+            fseek(f, (long)(len - 16 + (len & 1)), SEEK_CUR);
+        } else if (!memcmp(ch, "data", 4)) {
+            if (!fmt_ok) break;
+            n = len / 2;
+            *out = malloc(n * sizeof(int16_t) + 1);
+            n = fread(*out, sizeof(int16_t), n, f);
+            fclose(f);
+            return n;
+        } else {
+            fseek(f, (long)(len + (len & 1)), SEEK_CUR);
+        }
+    }
+bad:
+    fprintf(stderr, "%s: not a 16 kHz mono 16-bit PCM WAV\n", path);
+    fclose(f);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Measurement
+// ---------------------------------------------------------------------------
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static size_t encode_all(speech_codec_mode_t mode, const int16_t *pcm, size_t frames, uint8_t *enc) {
+    speech_encoder_t e;
+    speech_encoder_init(&e, mode);
+    size_t bytes = 0;
+    for (size_t i = 0; i < frames; i++) {
+        bytes += speech_encoder_encode_frame(&e, pcm + i * SPEECH_FRAME_SAMPLES_IN, enc + bytes);
+    }
+    return bytes;
+}
+
+// What a mode can carry at best: the input, or its ideal decimation
+static void make_reference(speech_codec_mode_t mode, const int16_t *pcm, size_t n, double *ref) {
+    if (mode == SPEECH_CODEC_WB4) {
+        for (size_t i = 0; i < n; i++) ref[i] = pcm[i];
+        return;
+    }
+    // speech_codec.c centres output o of a frame on input 2o - 6 (14 samples of history)
+    for (size_t o = 0; o < n / 2; o++) {
+        double acc = 0;
+        long c = (long)(2 * o) - 6;
+        for (int k = 0; k < SPEECH_DECIM_TAPS; k++) {
+            long j = c + k - SPEECH_DECIM_TAPS / 2;
+            if (j >= 0 && (size_t)j < n) acc += kDecim[k] * pcm[j];
+        }
+        ref[o] = acc / 32768.0;
+    }
+}
+
+typedef struct {
+    double seg_snr;
+    double snr;
+    size_t segments;            // Not silent
+} quality_t;
+
+static quality_t measure(const double *ref, const int16_t *out, size_t n, size_t seg) {
+    quality_t q = { 0 };
+    double sig = 0, err = 0, quiet = pow(10.0, SEG_QUIET_DB / 10.0) * 32768.0 * 32768.0;
+    for (size_t s = 0; s + seg <= n; s += seg) {
+        double es = 0, ee = 0;
+        for (size_t i = s; i < s + seg; i++) {
+            double d = out[i] - ref[i];
+            es += ref[i] * ref[i];
+            ee += d * d;
+        }
+        sig += es;
+        err += ee;
+        if (es / seg < quiet) continue;
+        double db = 10.0 * log10(es / (ee + 1e-9));
+        if (db < SEG_MIN_DB) db = SEG_MIN_DB;
+        if (db > SEG_MAX_DB) db = SEG_MAX_DB;
+        q.seg_snr += db;
+        q.segments++;
+    }
+    if (q.segments) q.seg_snr /= q.segments;
+    q.snr = 10.0 * log10(sig / (err + 1e-9));
+    return q;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --seconds N         synthetic speech length (default 60)\n"
+            "  --wav FILE          16 kHz mono 16-bit PCM WAV instead (no SNR floors)\n"
+            "  --reps N            encode timing runs (default 20)\n"
+            "  --seed N            (default 1)\n",
+            argv0);
+}
+
+int main(int argc, char **argv) {
+    double seconds = 60.0;
+    const char *wav = NULL;
+    int reps = 20;
+    unsigned seed = 1;
+
+    static const struct option opts[] = {
+        { "seconds", required_argument, 0, 't' },
+        { "wav",     required_argument, 0, 'w' },
+        { "reps",    required_argument, 0, 'r' },
+        { "seed",    required_argument, 0, 's' },
+        { "help",    no_argument,       0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", opts, NULL)) != -1) {
+        switch (opt) {
+        case 't': seconds = atof(optarg); break;
+        case 'w': wav = optarg; break;
+        case 'r': reps = atoi(optarg); break;
+        case 's': seed = (unsigned)atoi(optarg); break;
+        default: usage(argv[0]); return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (seconds < 1 || seconds > 3600 || reps < 1 || reps > MAX_REPS) {
+        usage(argv[0]);
+        return 2;
+    }
+    srand(seed);
+
+    int16_t *pcm = NULL;
+    size_t n;
+    if (wav) {
+        n = read_wav(wav, &pcm);
+        if (n < SPEECH_FRAME_SAMPLES_IN) return 2;
+    } else {
+        n = (size_t)(seconds * RATE_HZ);
+        pcm = malloc(n * sizeof(int16_t));
+        make_speech(pcm, n);
+    }
+    size_t frames = n / SPEECH_FRAME_SAMPLES_IN;
+    n = frames * SPEECH_FRAME_SAMPLES_IN;
+
+    uint8_t *enc = malloc(frames * SPEECH_FRAME_MAX_BYTES);
+    int16_t *out = malloc(n * sizeof(int16_t));
+    int16_t *alone = malloc(SPEECH_FRAME_SAMPLES_IN * sizeof(int16_t));
+    double *ref = malloc(n * sizeof(double));
+    double t[MAX_REPS];
+
+    printf("%s, %.1f s, %zu frames, %d reps\n", wav ? wav : "synthetic speech", (double)n / RATE_HZ, frames, reps);
+    printf("mode   kbps  bytes/frame   us/frame best   median  x realtime  segSNR dB  SNR dB\n");
+    double last_seg = 1e9;
+    for (unsigned m = 0; m < MODES; m++) {
+        speech_codec_mode_t mode = kModes[m].mode;
+        size_t fb = speech_codec_frame_bytes(mode);
+        size_t bytes = 0;
+        for (int r = 0; r < reps; r++) {
+            double t0 = now_ns();
+            bytes = encode_all(mode, pcm, frames, enc);
+            t[r] = (now_ns() - t0) / frames;
+        }
+        qsort(t, (size_t)reps, sizeof(double), cmp_double);
+        check(bytes == frames * fb, "encoded size is not frames * frame bytes");
+        check(speech_codec_bitrate(mode) == fb * 8 * 1000 / SPEECH_FRAME_MS, "bitrate");
+
+        // Decode in sequence, and every frame with a fresh decoder
+        speech_decoder_t dec;
+        speech_decoder_init(&dec, mode);
+        size_t per = mode == SPEECH_CODEC_WB4 ? SPEECH_FRAME_SAMPLES_IN : SPEECH_FRAME_SAMPLES_IN / 2;
+        size_t got = 0, differ = 0;
+        for (size_t i = 0; i < frames; i++) {
+            got += speech_decoder_decode_frame(&dec, enc + i * fb, fb, out + i * per);
+            speech_decoder_t fresh;
+            speech_decoder_init(&fresh, mode);
+            speech_decoder_decode_frame(&fresh, enc + i * fb, fb, alone);
+            if (memcmp(alone, out + i * per, per * sizeof(int16_t))) differ++;
+        }
+        check(got == frames * per, "decoded sample count");
+        check(differ == 0, "a frame decodes differently on its own");
+
+        make_reference(mode, pcm, n, ref);
+        quality_t q = measure(ref, out, frames * per, per);
+        printf("%-4s %6.1f %12zu %15.2f %8.2f %11.0f %10.1f %7.1f\n", speech_codec_mode_name(mode),
+               speech_codec_bitrate(mode) / 1000.0, fb, t[0] / 1000.0, t[reps / 2] / 1000.0,
+               SPEECH_FRAME_MS * 1e6 / t[reps / 2], q.seg_snr, q.snr);
+        if (!wav) {
+            check(q.seg_snr >= kModes[m].floor_db, "segmental SNR under the mode's floor");
+            // NB4 against WB4 is a different reference, so only the bit depth is ordered
+            if (mode == SPEECH_CODEC_NB2) check(q.seg_snr < last_seg, "NB2 not under NB4");
+        }
+        last_seg = q.seg_snr;
+    }
+
+    free(pcm);
+    free(enc);
+    free(out);
+    free(alone);
+    free(ref);
+    printf("%s\n", s_failures ? "FAILED" : "ok");
+    return s_failures ? 1 : 0;
+}
@@ -0,0 +1,316 @@
+/**
+ * @file credit_sim.c
+ * @brief Check the notification credit window and the worker's wake-up protocol
+ *
+ * Runs the firmware's xfer_credit.c on a millisecond timeline that models
+ * file_xfer_task() and the NimBLE host:
+ *   - the worker takes a credit before every data notification, one every
+ *     --pace-ms (0: as fast as credits allow, like a pull session), and
+ *     waits on the semaphore for FT_CREDIT_WAIT_MS when none is free; five
+ *     timeouts in a row reclaim every credit (wait_data_credit())
+ *   - every --interval-ms the link completes up to --pdus notifications
+ *     (in any order: credits are interchangeable, so only the count
+ *     matters), and a completion is lost with probability --loss
+ *   - a completion returns the credit (BLE_GAP_EVENT_NOTIFY_TX)
+ * Each case runs twice. "wake" is main.c: a binary semaphore given only
+ * when xfer_credit_give() reports a waiting worker, and a take right after
+ * the wake. "always" is the protocol before it: a counting semaphore
+ * (XFER_MAX_INFLIGHT) given on every completion, and the worker going back
+ * round its loop after a wake. Tokens given while the worker was busy pile
+ * up, and each wakes it later with no credit to take (an empty wake: one
+ * more trip round the loop, with its seek and read).
+ *
+ * Checks, besides the window sizing and take/give/reset on their own:
+ *   - never more notifications in flight than the window
+ *   - every credit accounted for: taken = completed + reclaimed + in flight
+ *   - "wake" never leaves the worker blocked while a credit is free and no
+ *     wake-up is on its way, and has no more empty wakes than timeouts
+ *
+ *   credit_sim
+ *   credit_sim --bearers 1,4 --loss 0.05 --pace-ms 4 --seconds 120
+ *
+ * Exit status 1 if any check fails, 2 on bad arguments.
+ */
+
+#define _GNU_SOURCE
+#include "xfer_credit.h"
+#include "ft_proto.h"
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_CASES 8
+
+typedef enum { POLICY_WAKE, POLICY_ALWAYS } policy_t;
+
+static const char *const kPolicyName[] = { "wake", "always" };
+
+typedef struct {
+    unsigned bearers;
+    unsigned credits;
+    double loss;
+    unsigned interval_ms;
+    unsigned pdus;
+    unsigned pace_ms;
+    unsigned payload;
+    unsigned seconds;
+    unsigned seed;
+} sim_cfg_t;
+
+typedef struct {
+    uint8_t window;
+    uint8_t max_inflight;
+    uint64_t sent;
+    uint64_t completed;
+    uint64_t lost;
+    uint64_t reclaimed;         // Credits given back by reclaims
+    uint32_t reclaims;
+    uint32_t waits;             // Takes that found the window full
+    uint32_t empty_wakes;       // Wakes with no credit to take
+    uint32_t timeouts;
+    uint32_t stalled_ms;        // Blocked with a credit free and no wake-up coming
+    bool balanced;
+} sim_result_t;
+
+static int s_failures;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        printf("  FAIL %s\n", what);
+        s_failures++;
+    }
+}
+
+static int parse_list(const char *s, double *out, int max) {
+    int n = 0;
+    char *copy = strdup(s), *save = NULL;
+    for (char *tok = strtok_r(copy, ",", &save); tok && n < max; tok = strtok_r(NULL, ",", &save)) {
+        out[n++] = atof(tok);
+    }
+    free(copy);
+    return n;
+}
+
+static double rnd(void) {
+    return (rand() + 0.5) / ((double)RAND_MAX + 1.0);
+}
+
+// The window on its own: sizing, take/give/reset and who gets woken
+static void check_window(void) {
+    check(xfer_credit_bearers(0, 4, true) == 1, "EATT disabled: legacy");
+    check(xfer_credit_bearers(3, 0, true) == 1, "no CoC channels: legacy");
+    check(xfer_credit_bearers(3, 4, false) == 1, "peer without EATT: legacy");
+    check(xfer_credit_bearers(1, 4, true) == 1, "one EATT channel");
+    check(xfer_credit_bearers(3, 2, true) == 2, "bearers limited by CoC channels");
+    check(xfer_credit_bearers(8, 8, true) == XFER_MAX_BEARERS, "bearers limited to XFER_MAX_BEARERS");
+
+    xfer_credit_t c;
+    xfer_credit_init(&c, 1, 3);
+    check(c.window == 3, "legacy window: credits per bearer");
+    xfer_credit_init(&c, 3, 3);
+    check(c.window == 9, "three bearers: three times the credits");
+    xfer_credit_init(&c, 4, 16);
+    check(c.window == XFER_MAX_INFLIGHT, "window limited to XFER_MAX_INFLIGHT");
+    xfer_credit_init(&c, 0, 0);
+    check(c.window == 1, "zero bearers and credits: a window of one");
+
+    xfer_credit_init(&c, 1, 2);
+    check(!xfer_credit_give(&c), "give with nothing in flight");
+    check(xfer_credit_inflight(&c) == 0, "give with nothing in flight leaves nothing in flight");
+    check(xfer_credit_take(&c) && xfer_credit_take(&c), "take the window");
+    check(!xfer_credit_give(&c), "give while the sender is not waiting wakes nobody");
+    check(xfer_credit_take(&c) && !xfer_credit_take(&c) && c.waiting, "full window: sender waiting");
+    check(xfer_credit_give(&c) && !c.waiting, "give while the sender waits wakes it");
+    check(!xfer_credit_give(&c), "a second give wakes nobody");
+    check(xfer_credit_take(&c) && xfer_credit_take(&c) && !xfer_credit_take(&c), "take the window again");
+    xfer_credit_reset(&c);
+    check(xfer_credit_inflight(&c) == 0 && !c.waiting, "reset frees every credit and clears the waiter");
+    check(c.taken == 5, "credits taken counted");
+}
+
+typedef enum { W_READY, W_WAITING, W_DELAY } worker_state_t;
+
+static sim_result_t run(const sim_cfg_t *cfg, policy_t policy) {
+    sim_result_t r = {0};
+    srand(cfg->seed);
+
+    xfer_credit_t c;
+    xfer_credit_init(&c, (uint8_t)cfg->bearers, (uint8_t)cfg->credits);
+    r.window = c.window;
+
+    unsigned pending = 0;       // Completions the link still owes (not lost)
+    unsigned lost_held = 0;     // Lost completions still holding a credit
+    unsigned tokens = 0;        // Semaphore count
+    unsigned sem_max = policy == POLICY_WAKE ? 1 : XFER_MAX_INFLIGHT;
+
+    worker_state_t state = W_READY;
+    uint64_t until = 0;         // W_WAITING: timeout, W_DELAY: end of sleep
+    uint64_t next_send = 0;
+    int timeouts = 0;
+
+    uint64_t end_ms = (uint64_t)cfg->seconds * 1000;
+    for (uint64_t t = 0; t < end_ms; t++) {
+        // Connection event: completions of notifications in flight
+        if (t % cfg->interval_ms == 0) {
+            for (unsigned k = 0; k < cfg->pdus && pending > 0; k++) {
+                pending--;
+                r.completed++;
+                bool wake = xfer_credit_give(&c);
+                if ((policy == POLICY_ALWAYS || wake) && tokens < sem_max) tokens++;
+            }
+        }
+
+        // Worker: wait_data_credit() and the send after it
+        for (int steps = 0; steps < 64; steps++) {
+            if (state == W_DELAY) {
+                if (t < until) break;
+                state = W_READY;
+            }
+            if (state == W_WAITING) {
+                if (tokens > 0) {
+                    tokens--;
+                    if (policy == POLICY_WAKE && xfer_credit_take(&c)) {
+                        timeouts = 0;
+                        goto send;
+                    }
+                    if (policy == POLICY_WAKE || xfer_credit_inflight(&c) >= c.window) r.empty_wakes++;
+                    state = W_READY;    // Back round the caller's loop
+                    continue;
+                }
+                if (t >= until) {
+                    r.timeouts++;
+                    if (++timeouts >= FT_CREDIT_RECLAIM_TIMEOUTS) {
+                        r.reclaims++;
+                        r.reclaimed += xfer_credit_inflight(&c);
+                        lost_held = 0;
+                        pending = 0;
+                        xfer_credit_reset(&c);
+                        timeouts = 0;
+                    }
+                    state = W_DELAY;
+                    until = t + 10;
+                    continue;
+                }
+                // Blocked: a free credit must have a wake-up on its way
+                if (xfer_credit_inflight(&c) < c.window && tokens == 0) r.stalled_ms++;
+                break;
+            }
+            // W_READY
+            if (t < next_send) break;
+            if (!xfer_credit_take(&c)) {
+                r.waits++;
+                state = W_WAITING;
+                until = t + FT_CREDIT_WAIT_MS;
+                continue;
+            }
+            timeouts = 0;
+send:
+            state = W_READY;
+            r.sent++;
+            if (rnd() < cfg->loss) {
+                r.lost++;
+                lost_held++;
+            } else {
+                pending++;
+            }
+            if (xfer_credit_inflight(&c) > r.max_inflight) r.max_inflight = xfer_credit_inflight(&c);
+            if (cfg->pace_ms) {
+                next_send = t + cfg->pace_ms;
+                break;
+            }
+        }
+    }
+    r.balanced = r.sent == r.completed + r.reclaimed + xfer_credit_inflight(&c) &&
+                 xfer_credit_inflight(&c) == pending + lost_held;
+    return r;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --bearers LIST       ATT bearers per case (default 1,2,4)\n"
+            "  --credits N          credits per bearer (default 3, firmware value)\n"
+            "  --loss LIST          lost NOTIFY_TX probability per case (default 0,0.01)\n"
+            "  --interval-ms N      connection interval (default 15)\n"
+            "  --pdus N             notifications completed per connection event (default 6)\n"
+            "  --pace-ms N          worker delay between sends, 0 = none (default 0)\n"
+            "  --payload N          bytes per notification, for KB/s (default 244)\n"
+            "  --seconds N          simulated time per case (default 60)\n"
+            "  --seed N             (default 1)\n",
+            argv0);
+}
+
+int main(int argc, char **argv) {
+    sim_cfg_t cfg = {
+        .credits = 3, .interval_ms = 15, .pdus = 6, .pace_ms = 0,
+        .payload = 244, .seconds = 60, .seed = 1,
+    };
+    double bearers[MAX_CASES] = { 1, 2, 4 }, losses[MAX_CASES] = { 0, 0.01 };
+    int nb = 3, nl = 2;
+
+    static const struct option opts[] = {
+        { "bearers",     required_argument, 0, 'b' },
+        { "credits",     required_argument, 0, 'c' },
+        { "loss",        required_argument, 0, 'l' },
+        { "interval-ms", required_argument, 0, 'i' },
+        { "pdus",        required_argument, 0, 'p' },
+        { "pace-ms",     required_argument, 0, 'P' },
+        { "payload",     required_argument, 0, 'y' },
+        { "seconds",     required_argument, 0, 's' },
+        { "seed",        required_argument, 0, 'S' },
+        { "help",        no_argument,       0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", opts, NULL)) != -1) {
+        switch (opt) {
+        case 'b': nb = parse_list(optarg, bearers, MAX_CASES); break;
+        case 'c': cfg.credits = (unsigned)atoi(optarg); break;
+        case 'l': nl = parse_list(optarg, losses, MAX_CASES); break;
+        case 'i': cfg.interval_ms = (unsigned)atoi(optarg); break;
+        case 'p': cfg.pdus = (unsigned)atoi(optarg); break;
+        case 'P': cfg.pace_ms = (unsigned)atoi(optarg); break;
+        case 'y': cfg.payload = (unsigned)atoi(optarg); break;
+        case 's': cfg.seconds = (unsigned)atoi(optarg); break;
+        case 'S': cfg.seed = (unsigned)atoi(optarg); break;
+        default: usage(argv[0]); return opt == 'h' ? 0 : 2;
+        }
+    }
+    bool bad = nb < 1 || nl < 1 || cfg.credits < 1 || cfg.credits > 255 || cfg.interval_ms < 1 ||
+               cfg.pdus < 1 || cfg.seconds < 1 || cfg.payload < 1;
+    for (int i = 0; i < nb; i++) bad |= bearers[i] < 1 || bearers[i] > XFER_MAX_BEARERS;
+    for (int i = 0; i < nl; i++) bad |= losses[i] < 0 || losses[i] >= 1;
+    if (bad) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    check_window();
+
+    printf("%u credits per bearer, %u ms interval, %u completions per event, pace %u ms, %u s per case\n",
+           cfg.credits, cfg.interval_ms, cfg.pdus, cfg.pace_ms, cfg.seconds);
+    printf("bearers  loss policy  window  max  KB/s    waits  empty  timeouts  reclaims\n");
+    for (int b = 0; b < nb; b++) {
+        for (int l = 0; l < nl; l++) {
+            cfg.bearers = (unsigned)bearers[b];
+            cfg.loss = losses[l];
+            for (int p = POLICY_WAKE; p <= POLICY_ALWAYS; p++) {
+                sim_result_t r = run(&cfg, (policy_t)p);
+                double kbs = (double)r.sent * cfg.payload / 1024.0 / cfg.seconds;
+                printf("%7u %5.3f %-7s %6u %4u %6.1f %8u %6u %9u %9u\n", cfg.bearers, cfg.loss, kPolicyName[p],
+                       r.window, r.max_inflight, kbs, r.waits, r.empty_wakes, r.timeouts, r.reclaims);
+                check(r.max_inflight <= r.window, "more notifications in flight than the window");
+                check(r.balanced, "credits not accounted for");
+                if (p == POLICY_WAKE) {
+                    check(r.stalled_ms == 0, "worker blocked with a credit free");
+                    check(r.empty_wakes <= r.timeouts, "empty wakes without a timeout");
+                }
+            }
+        }
+    }
+    printf("%s\n", s_failures ? "FAILED" : "ok");
+    return s_failures ? 1 : 0;
+}
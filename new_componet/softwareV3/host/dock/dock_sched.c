@@ -0,0 +1,128 @@
+/**
+ * @file dock_sched.c
+ * @brief Dock connection order (see dock_sched.h)
+ */
+
+#include "dock_sched.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define BACKOFF_BASE_MS 1000
+#define BACKOFF_MAX_MS  30000
+
+void dock_sched_init(dock_sched_t *s, uint8_t min_battery, uint32_t stale_ms, uint32_t max_failures) {
+    memset(s, 0, sizeof(*s));
+    s->min_battery = min_battery;
+    s->stale_ms = stale_ms;
+    s->max_failures = max_failures;
+}
+
+void dock_sched_free(dock_sched_t *s) {
+    free(s->tags);
+    memset(s, 0, sizeof(*s));
+}
+
+dock_tag_t *dock_sched_seen(dock_sched_t *s, uint32_t id, uint32_t addr, uint16_t port,
+                            const adv_state_t *adv, uint64_t now_ms) {
+    dock_tag_t *t = NULL;
+    for (size_t i = 0; i < s->count && !t; i++) {
+        if (s->tags[i].id == id) t = &s->tags[i];
+    }
+    if (!t) {
+        if (s->count == s->cap) {
+            size_t cap = s->cap ? s->cap * 2 : 64;
+            dock_tag_t *tags = realloc(s->tags, cap * sizeof(*tags));
+            if (!tags) return NULL;
+            s->tags = tags;
+            s->cap = cap;
+        }
+        t = &s->tags[s->count++];
+        memset(t, 0, sizeof(*t));
+        t->id = id;
+    }
+    // A tag advertises only while nobody is connected, so this is after any session
+    t->addr = addr;
+    t->port = port;
+    t->adv = *adv;
+    t->seen_ms = now_ms;
+    return t;
+}
+
+static bool fresh(const dock_sched_t *s, const dock_tag_t *t, uint64_t now_ms) {
+    return t->seen_ms != 0 && now_ms - t->seen_ms <= s->stale_ms;
+}
+
+static bool has_work(const dock_tag_t *t) {
+    return t->adv.version >= ADV_STATE_VERSION && t->adv.pending_count > 0 &&
+           !(t->adv.flags & (ADV_STATE_F_NO_CARD | ADV_STATE_F_SYNC_UNKNOWN));
+}
+
+static bool deferred(const dock_sched_t *s, const dock_tag_t *t) {
+    return t->adv.battery_pct != ADV_STATE_BATTERY_UNKNOWN && t->adv.battery_pct < s->min_battery;
+}
+
+static bool given_up(const dock_sched_t *s, const dock_tag_t *t) {
+    return s->max_failures > 0 && t->failures >= s->max_failures;
+}
+
+// Larger pending first, then lower battery (unknown sorts as full)
+static bool before(const dock_tag_t *a, const dock_tag_t *b) {
+    if (a->adv.pending_kb != b->adv.pending_kb) return a->adv.pending_kb > b->adv.pending_kb;
+    return a->adv.battery_pct < b->adv.battery_pct;
+}
+
+dock_tag_t *dock_sched_pick(const dock_sched_t *s, uint64_t now_ms) {
+    dock_tag_t *best = NULL;
+    for (size_t i = 0; i < s->count; i++) {
+        dock_tag_t *t = &s->tags[i];
+        if (t->active || !fresh(s, t, now_ms) || !has_work(t) || deferred(s, t) || given_up(s, t)) continue;
+        if (now_ms < t->retry_at_ms) continue;
+        if (!best || before(t, best)) best = t;
+    }
+    return best;
+}
+
+void dock_sched_begin(dock_tag_t *t) {
+    t->active = true;
+}
+
+void dock_sched_end(dock_tag_t *t, bool ok, uint64_t now_ms) {
+    t->active = false;
+    t->ended_ms = now_ms;
+    t->seen_ms = 0;
+    if (ok) {
+        t->failures = 0;
+        t->retry_at_ms = 0;
+        return;
+    }
+    t->failures++;
+    uint32_t shift = t->failures - 1 < 5 ? t->failures - 1 : 5;
+    uint64_t backoff = (uint64_t)BACKOFF_BASE_MS << shift;
+    t->retry_at_ms = now_ms + (backoff < BACKOFF_MAX_MS ? backoff : BACKOFF_MAX_MS);
+}
+
+void dock_sched_fleet(const dock_sched_t *s, uint64_t now_ms, dock_fleet_t *out) {
+    memset(out, 0, sizeof(*out));
+    out->tags = (uint32_t)s->count;
+    for (size_t i = 0; i < s->count; i++) {
+        const dock_tag_t *t = &s->tags[i];
+        out->active += t->active;
+        out->given_up += given_up(s, t);
+        if (t->active || !fresh(s, t, now_ms) || !has_work(t)) continue;
+        out->pending++;
+        out->deferred += deferred(s, t);
+        out->pending_kb += t->adv.pending_kb;
+    }
+}
+
+bool dock_sched_idle(const dock_sched_t *s, uint64_t now_ms) {
+    for (size_t i = 0; i < s->count; i++) {
+        const dock_tag_t *t = &s->tags[i];
+        if (t->active) return false;
+        if (given_up(s, t)) continue;
+        // Not heard since its session: wait for what it has left
+        if (t->seen_ms == 0 && now_ms - t->ended_ms <= s->stale_ms) return false;
+        if (fresh(s, t, now_ms) && has_work(t) && !deferred(s, t)) return false;
+    }
+    return true;
+}
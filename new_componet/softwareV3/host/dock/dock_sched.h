@@ -0,0 +1,96 @@
+/**
+ * @file dock_sched.h
+ * @brief Which tag the dock connects to next
+ *
+ * Every tag the scanner hears goes into a table with its last advertised
+ * sync state (main/adv_state.h). The dock has a handful of links and opens
+ * one at a time, so the order matters:
+ *
+ * - A tag below the battery floor is deferred: a long transfer would drain
+ *   it, and docked it charges while it waits.
+ * - Otherwise the tag with the most un-synced KB goes first (longest job
+ *   first keeps the last link from finishing long after the others), and of
+ *   two equal ones the emptier battery.
+ * - A failed session backs off exponentially; after max_failures the tag is
+ *   left alone until the dock restarts.
+ * - After a session the tag's old advertisement is void: it is picked again
+ *   only once it advertises what is still left.
+ */
+
+#ifndef DOCK_SCHED_H
+#define DOCK_SCHED_H
+
+#include "adv_state.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    uint32_t id;
+    uint32_t addr;              // Where the advertisement came from (IPv4, network order)
+    uint16_t port;
+    adv_state_t adv;
+    uint64_t seen_ms;           // Last advertisement, 0 = none since the last session
+    uint64_t ended_ms;          // End of the last session
+    uint64_t retry_at_ms;       // Backoff after a failure
+    uint32_t failures;          // Consecutive failed sessions
+    bool active;
+
+    uint64_t bytes;             // Stored for this tag
+    uint32_t stored;            // Recordings stored
+    uint32_t acked;             // Recordings the tag confirmed
+} dock_tag_t;
+
+typedef struct {
+    dock_tag_t *tags;
+    size_t count;
+    size_t cap;
+    uint8_t min_battery;        // Defer below this (percent); unknown battery is not deferred
+    uint32_t stale_ms;          // Advertisement this old: tag gone or connected elsewhere
+    uint32_t max_failures;
+} dock_sched_t;
+
+// Fleet view for logs and metrics
+typedef struct {
+    uint32_t tags;              // Heard at least once
+    uint32_t active;
+    uint32_t pending;           // Fresh advertisement with un-synced recordings
+    uint32_t deferred;          // ... of which below the battery floor
+    uint32_t given_up;
+    uint64_t pending_kb;
+} dock_fleet_t;
+
+void dock_sched_init(dock_sched_t *s, uint8_t min_battery, uint32_t stale_ms, uint32_t max_failures);
+
+void dock_sched_free(dock_sched_t *s);
+
+/**
+ * @brief Record an advertisement
+ * @return The tag's entry, NULL if the table could not grow
+ */
+dock_tag_t *dock_sched_seen(dock_sched_t *s, uint32_t id, uint32_t addr, uint16_t port,
+                            const adv_state_t *adv, uint64_t now_ms);
+
+/**
+ * @brief The tag to connect to next
+ * @return NULL if none is due
+ */
+dock_tag_t *dock_sched_pick(const dock_sched_t *s, uint64_t now_ms);
+
+// A session with t starts
+void dock_sched_begin(dock_tag_t *t);
+
+// The session ended; ok is false if it has to be retried
+void dock_sched_end(dock_tag_t *t, bool ok, uint64_t now_ms);
+
+void dock_sched_fleet(const dock_sched_t *s, uint64_t now_ms, dock_fleet_t *out);
+
+/**
+ * @brief Nothing to do: no session, and no tag that will want one
+ *
+ * Deferred and given-up tags do not count; a tag that has not advertised
+ * since its session counts until stale_ms later.
+ */
+bool dock_sched_idle(const dock_sched_t *s, uint64_t now_ms);
+
+#endif // DOCK_SCHED_H
@@ -0,0 +1,1035 @@
+/**
+ * @file st_dockd.c
+ * @brief Dock daemon: sync every tag in range into an ingest directory
+ *
+ * Listens for advertisements (here the emulator's UDP stand-in, emu_wire.h),
+ * keeps each tag's advertised sync state (main/adv_state.h) and keeps up to
+ * --max-links connections busy, opening one at a time as a BLE controller
+ * does, in the order dock_sched.h picks. A session fetches the advertised
+ * un-synced IDs in ascending order with START_BY_ID through the client
+ * library's st_rx_t, writes each into <ingest>/tag-<id>/r<id>.raw.part,
+ * reads it back to check the RAW header and compute the CRC-32C, renames it
+ * into place, logs it in <ingest>/manifest.tsv and sends SYNC_ACK with that
+ * CRC. The tag compares the CRC with its card before it stops advertising
+ * the recording. The next START_BY_ID goes out with the SYNC_ACK, so the tag
+ * is never idle waiting for the dock. A recording already in the ingest
+ * directory (a dock restart, a lost acknowledgement) is acknowledged without
+ * fetching it again.
+ *
+ * With --window-s a session has that long: before each fetch st_plan()
+ * picks RAW or a speech variant for every recording still to come, from
+ * the session's measured throughput and the time left. A variant is stored
+ * as r<id>.<variant>.spc and not acknowledged, so the tag keeps the
+ * recording pending and a later session fetches it as RAW when there is
+ * time (the variant is then deleted).
+ *
+ *   st_dockd --ingest /srv/salestag --max-links 8 --metrics /var/lib/node_exporter/salestag.prom
+ *   st_dockd --ingest /tmp/ingest --once            # exit when nothing is left to sync
+ *   st_dockd --ingest /tmp/ingest --window-s 600    # a phone with ten minutes of link
+ */
+
+#define _GNU_SOURCE
+#include "dock_sched.h"
+#include "st_client.h"
+#include "emu_wire.h"
+#include "ft_proto.h"
+#include "rec_id.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ACK_MAX          8          // SYNC_ACKs awaiting their status per session
+#define START_RETRY_MS   20         // STAT_ALREADY_RUNNING: the last transfer is still winding down
+#define TICK_MS          50
+#define METER_MS         1000       // Throughput sample interval (st_link_sample)
+#define RAW_RATE         16000
+
+typedef enum {
+    SS_FREE = 0,
+    SS_CONNECTING,
+    SS_HELLO,                       // Waiting for the tag's HELLO
+    SS_RUNNING,
+} sess_state_t;
+
+typedef struct {
+    sess_state_t state;
+    int fd;
+    size_t tag;                     // Index into the scheduler's table
+    uint64_t start_ms;
+    uint64_t last_rx_ms;
+    uint8_t rx[EMU_FRAME_MAX];
+    size_t rx_len;
+
+    uint32_t next_id;               // Next ID to consider
+    uint32_t last_id;               // Newest ID the tag advertised
+
+    // Current fetch
+    uint32_t cur_id;                // REC_ID_NONE when idle
+    uint8_t variant;                // ST_VARIANT_* asked for
+    uint8_t have;                   // What was stored before (ST_VARIANT_NONE)
+    bool started;                   // STAT_STARTED seen for this pass
+    bool restart;                   // st_rx_t gave up: next pass is a full one
+    int pass;
+    uint64_t resend_at_ms;          // START to send again after STAT_ALREADY_RUNNING
+    int part_fd;
+    char part[512];
+    uint8_t header[ST_HEADER_BYTES];
+    size_t header_len;
+    bool size_known;
+    st_rx_t rx_state;
+
+    // Acknowledgements in flight, oldest first
+    uint32_t acks[ACK_MAX];
+    int nacks;
+
+    // Planning (--window-s)
+    st_link_t link;
+    uint64_t start_sent_ms;
+    bool first_data;                // Data seen since the last START
+    bool transcoding;               // STAT_TRANSCODING seen, STARTED not yet
+    bool transcoded;                // ... for this START
+    uint64_t quiet_until_ms;        // No timeout before this while the tag transcodes
+    uint64_t meter_ms;
+    uint64_t meter_bytes;
+    uint64_t est_samples;           // Per recording: advertised average, then what headers said
+    uint64_t seen_samples;
+    uint32_t seen_files;
+    bool planned;                   // First plan logged
+    uint32_t fetched;
+    uint32_t skipped;               // Left for a later session by the plan
+
+    bool failed;
+    uint64_t bytes;
+} session_t;
+
+typedef struct {
+    const char *ingest;
+    int max_links;
+    uint16_t mtu;
+    int passes;
+    uint32_t timeout_ms;
+    double window_s;                // Link time per session, 0 = unlimited (RAW only)
+    uint8_t companion;              // Variant the tags keep on the card (ST_VARIANT_NONE = none)
+    double xcode_x;                 // Tags' on-demand transcoding speed
+    bool quiet;
+} dock_opts_t;
+
+typedef struct {
+    uint64_t bytes;                 // Stored and verified
+    uint64_t stored;
+    uint64_t reduced;               // ... of which speech variants (not acknowledged)
+    uint64_t upgraded;              // RAW fetched over a stored variant
+    uint64_t acked;
+    uint64_t mismatched;            // Tag disagreed with our CRC
+    uint64_t verify_failed;         // Read-back or header check failed
+    uint64_t sessions;
+    uint64_t sessions_failed;
+} dock_totals_t;
+
+static volatile sig_atomic_t s_stop = 0;
+static dock_opts_t s_opt;
+static dock_sched_t s_sched;
+static dock_totals_t s_tot;
+static FILE *s_manifest;
+static st_link_t s_link;            // Last session's estimate, the next one's prior
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000ULL + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void on_signal(int sig) {
+    (void)sig;
+    s_stop = 1;
+}
+
+static dock_tag_t *sess_tag(const session_t *s) {
+    return &s_sched.tags[s->tag];
+}
+
+static void logf_tag(const session_t *s, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void logf_tag(const session_t *s, const char *fmt, ...) {
+    if (s_opt.quiet) return;
+    va_list ap;
+    va_start(ap, fmt);
+    printf("[tag-%04u] ", (unsigned)sess_tag(s)->id);
+    vprintf(fmt, ap);
+    putchar('\n');
+    va_end(ap);
+}
+
+// ---------------------------------------------------------------------------
+// Ingest directory
+// ---------------------------------------------------------------------------
+
+static void tag_dir(uint32_t tag, char *out, size_t cap) {
+    snprintf(out, cap, "%s/tag-%04u", s_opt.ingest, (unsigned)tag);
+}
+
+static void rec_path(uint32_t tag, uint32_t id, const char *suffix, char *out, size_t cap) {
+    char dir[448];
+    char name[REC_ID_NAME_LEN];
+    tag_dir(tag, dir, sizeof(dir));
+    rec_id_format(id, name, sizeof(name));
+    snprintf(out, cap, "%s/%s%s", dir, name, suffix);
+}
+
+// r<id>.raw, or r<id>.<variant>.spc for a speech variant
+static void variant_path(uint32_t tag, uint32_t id, uint8_t variant, const char *suffix, char *out, size_t cap) {
+    if (variant == ST_VARIANT_RAW) {
+        rec_path(tag, id, suffix, out, cap);
+        return;
+    }
+    char dir[448];
+    char name[REC_ID_NAME_LEN];
+    tag_dir(tag, dir, sizeof(dir));
+    rec_id_format(id, name, sizeof(name));
+    snprintf(out, cap, "%s/%.*s.%s.spc%s", dir, (int)strlen(name) - 4, name, st_variant_name(variant), suffix);
+}
+
+// Best speech variant of id stored, ST_VARIANT_NONE if none
+static uint8_t stored_variant(uint32_t tag, uint32_t id) {
+    static const uint8_t best_first[] = { ST_VARIANT_WB4, ST_VARIANT_NB4, ST_VARIANT_NB2 };
+    char path[512];
+    for (size_t i = 0; i < sizeof(best_first); i++) {
+        variant_path(tag, id, best_first[i], "", path, sizeof(path));
+        if (access(path, F_OK) == 0) return best_first[i];
+    }
+    return ST_VARIANT_NONE;
+}
+
+// Speech variants of id other than keep (ST_VARIANT_RAW: all of them) are superseded
+static void drop_variants(uint32_t tag, uint32_t id, uint8_t keep) {
+    char path[512];
+    for (uint8_t v = ST_VARIANT_WB4; v <= ST_VARIANT_NB2; v++) {
+        if (v == keep) continue;
+        variant_path(tag, id, v, "", path, sizeof(path));
+        unlink(path);
+    }
+}
+
+static int sync_dir(const char *dir) {
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return -1;
+    int r = fsync(fd);
+    close(fd);
+    return r;
+}
+
+typedef struct {
+    uint64_t size;
+    uint32_t crc;
+    bool raw;                       // RAW v1 header found
+    uint8_t variant;                // ST_VARIANT_* from the header, ST_VARIANT_NONE if neither format
+    uint32_t samples;               // Recording length the header gives
+    uint32_t count_gaps;
+} verify_t;
+
+/**
+ * Read a stored file back: CRC-32C over every byte and, for RAW v1 and
+ * SPCH, the header's size against the file; for RAW v1 sample counter
+ * continuity too.
+ */
+static bool verify_file(int fd, verify_t *v) {
+    static uint8_t buf[1 << 16];
+    st_file_info_t info;
+    st_raw_check_t chk = { 0 };
+    memset(v, 0, sizeof(*v));
+    v->crc = 0xFFFFFFFFu;
+    v->variant = ST_VARIANT_NONE;
+    bool have_info = false;
+    size_t carry = 0;
+    for (;;) {
+        ssize_t n = pread(fd, buf + carry, sizeof(buf) - carry, (off_t)v->size);
+        if (n < 0) return false;
+        if (n == 0) break;
+        v->crc = st_crc32c_update(v->crc, buf + carry, (size_t)n);
+        size_t avail = carry + (size_t)n;
+        size_t start = 0;
+        if (v->size == 0) {
+            have_info = st_header_decode(buf, avail, &info);
+            start = ST_HEADER_BYTES;
+        }
+        v->size += (uint64_t)n;
+        if (have_info && info.format == ST_FORMAT_RAW_V1 && avail > start) {
+            size_t used = st_raw_decode(&chk, buf + start, avail - start, NULL) * ST_RAW_SAMPLE;
+            carry = avail - start - used;
+            memmove(buf, buf + start + used, carry);
+        } else {
+            carry = 0;
+        }
+    }
+    if (v->size == 0) return false;
+    if (have_info) {
+        v->raw = info.format == ST_FORMAT_RAW_V1;
+        v->variant = v->raw ? ST_VARIANT_RAW : (uint8_t)info.codec;
+        v->samples = info.total_samples;
+        v->count_gaps = chk.count_gaps;
+        // A truncated or padded file has the wrong size for its header
+        if (info.expected_size != v->size) return false;
+    }
+    return true;
+}
+
+static void manifest_add(uint32_t tag, uint32_t id, const verify_t *v) {
+    if (!s_manifest) return;
+    fprintf(s_manifest, "%lld\t%u\t%u\t%llu\t%08x\t%s\t%u\n", (long long)time(NULL), (unsigned)tag,
+            (unsigned)id, (unsigned long long)v->size, v->crc,
+            v->variant != ST_VARIANT_NONE ? st_variant_name(v->variant) : "other", v->count_gaps);
+    fflush(s_manifest);
+}
+
+// ---------------------------------------------------------------------------
+// Session I/O
+// ---------------------------------------------------------------------------
+
+static bool sess_send(session_t *s, uint8_t op, uint16_t uuid, const uint8_t *payload, uint16_t len) {
+    uint8_t frame[EMU_FRAME_HDR + ST_CMD_MAX];
+    size_t n = emu_frame_encode(frame, op, uuid, payload, len);
+    // A few bytes per command: the socket buffer never fills, a short write is a dead link
+    if (send(s->fd, frame, n, MSG_NOSIGNAL) != (ssize_t)n) {
+        s->failed = true;
+        return false;
+    }
+    return true;
+}
+
+static bool sess_ctrl(session_t *s, const uint8_t *cmd, size_t len) {
+    return len > 0 && sess_send(s, EMU_OP_WRITE, BLE_UUID_SALESTAG_FILE_CTRL, cmd, (uint16_t)len);
+}
+
+static void sess_close(session_t *s, uint64_t now) {
+    if (s->state == SS_FREE) return;
+    if (s->part_fd >= 0) {
+        // The next session starts the recording from its first byte
+        close(s->part_fd);
+        s->part_fd = -1;
+        unlink(s->part);
+    }
+    if (s->fd >= 0) close(s->fd);
+    s->fd = -1;
+
+    // Unconfirmed acknowledgements are repeated next time from the stored files
+    dock_tag_t *t = sess_tag(s);
+    if (s->link.samples) s_link = s->link;
+    bool ok = !s->failed;
+    dock_sched_end(t, ok, now);
+    s_tot.sessions++;
+    s_tot.sessions_failed += !ok;
+    logf_tag(s, "%s after %.1f s, %llu B", ok ? "done" : "failed", (now - s->start_ms) / 1000.0,
+             (unsigned long long)s->bytes);
+    s->state = SS_FREE;
+}
+
+static int part_write(void *ctx, uint64_t offset, const uint8_t *data, size_t len) {
+    session_t *s = ctx;
+    if (offset < ST_HEADER_BYTES) {
+        size_t n = len < ST_HEADER_BYTES - offset ? len : ST_HEADER_BYTES - (size_t)offset;
+        memcpy(s->header + offset, data, n);
+        if (offset + n > s->header_len) s->header_len = (size_t)(offset + n);
+    }
+    while (len) {
+        ssize_t n = pwrite(s->part_fd, data, len, (off_t)offset);
+        if (n <= 0) return -1;
+        data += n;
+        offset += (uint64_t)n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static bool send_start(session_t *s) {
+    uint8_t cmd[ST_CMD_MAX];
+    s->started = false;
+    s->resend_at_ms = 0;
+    s->first_data = false;
+    s->transcoding = false;
+    s->transcoded = false;
+    s->start_sent_ms = now_ms();
+    return sess_ctrl(s, cmd, st_cmd_start_id_variant(cmd, sizeof(cmd), s->cur_id, s->variant));
+}
+
+static bool send_ack(session_t *s, uint32_t id, uint32_t crc) {
+    if (s->nacks == ACK_MAX) return false;
+    uint8_t cmd[ST_CMD_MAX];
+    if (!sess_ctrl(s, cmd, st_cmd_sync_ack(cmd, sizeof(cmd), id, crc))) return false;
+    s->acks[s->nacks++] = id;
+    return true;
+}
+
+static bool begin_fetch(session_t *s, uint32_t id, uint8_t variant, uint8_t have) {
+    char dir[448];
+    tag_dir(sess_tag(s)->id, dir, sizeof(dir));
+    mkdir(dir, 0755);
+    variant_path(sess_tag(s)->id, id, variant, ".part", s->part, sizeof(s->part));
+    s->part_fd = open(s->part, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (s->part_fd < 0) {
+        fprintf(stderr, "st_dockd: cannot create %s: %s\n", s->part, strerror(errno));
+        s->failed = true;
+        return false;
+    }
+    s->cur_id = id;
+    s->variant = variant;
+    s->have = have;
+    s->pass = 1;
+    s->restart = false;
+    s->header_len = 0;
+    s->size_known = false;
+    st_rx_begin(&s->rx_state, part_write, s, ST_SIZE_UNKNOWN);
+    return send_start(s);
+}
+
+/**
+ * What to fetch id as within the session's window: plan everything from id
+ * on that has no RAW copy yet, with the throughput measured so far.
+ */
+static uint8_t plan_next(session_t *s, uint32_t id, uint8_t have, uint64_t now) {
+    if (s_opt.window_s <= 0) return ST_VARIANT_RAW;
+    dock_tag_t *t = sess_tag(s);
+    size_t cap = s->last_id - id + 1, n = 0;
+    st_plan_file_t *files = calloc(cap, sizeof(*files));
+    if (!files) return ST_VARIANT_RAW;
+    uint64_t samples = s->seen_files ? s->seen_samples / s->seen_files : s->est_samples;
+    for (uint32_t i = id; i <= s->last_id; i++) {
+        char path[512];
+        rec_path(t->id, i, "", path, sizeof(path));
+        if (i != id && access(path, F_OK) == 0) continue;
+        st_plan_file_t *f = &files[n++];
+        f->id = i;
+        f->samples = samples;
+        f->have = i == id ? have : stored_variant(t->id, i);
+        f->ready = s_opt.companion != ST_VARIANT_NONE ? (uint8_t)(1u << s_opt.companion) : 0;
+    }
+    st_plan_params_t p = {
+        .budget_s = s_opt.window_s - (now - s->start_ms) / 1000.0,
+        .rate = st_link_rate(&s->link),
+        .overhead_s = s->link.overhead_s,
+        .xcode_x = s_opt.xcode_x,
+        .floor = ST_VARIANT_NB2,
+    };
+    st_plan_result_t r;
+    st_plan(&p, files, n, &r);
+    if (!s->planned) {
+        s->planned = true;
+        logf_tag(s, "plan: %u recording(s), %.0f s as RAW, %.0f s window at %.1f KB/s: %u fetched (%u as speech, "
+                 "%u upgrades), %u deferred, %.0f s", (unsigned)n, r.full_s, p.budget_s, p.rate / 1024.0,
+                 r.fetch, r.reduced, r.upgrades, r.deferred, r.need_s);
+    }
+    uint8_t choice = files[0].choice;
+    free(files);
+    return choice;
+}
+
+/**
+ * Move to the next advertised ID: acknowledge what is already stored, fetch
+ * the first one that is not. Ends the session when nothing is left.
+ */
+static void sess_next(session_t *s, uint64_t now) {
+    while (s->cur_id == REC_ID_NONE && s->next_id <= s->last_id && !s->failed) {
+        if (s->nacks == ACK_MAX) return;  // Continue once statuses come back
+        uint32_t id = s->next_id++;
+        char path[512];
+        rec_path(sess_tag(s)->id, id, "", path, sizeof(path));
+        int fd = open(path, O_RDONLY);
+        if (fd >= 0) {
+            verify_t v;
+            bool ok = verify_file(fd, &v);
+            close(fd);
+            if (ok) {
+                logf_tag(s, "r%07u already stored, acknowledging", (unsigned)id);
+                send_ack(s, id, v.crc);
+                continue;
+            }
+            unlink(path);  // Damaged: fetch again
+        }
+        uint8_t have = stored_variant(sess_tag(s)->id, id);
+        uint8_t v = plan_next(s, id, have, now);
+        if (v == ST_VARIANT_NONE) {
+            s->skipped++;
+            continue;
+        }
+        begin_fetch(s, id, v, have);
+    }
+    if (!s->failed && s->cur_id == REC_ID_NONE && s->next_id > s->last_id && s->skipped && !s->fetched) {
+        // Not even the smallest variant of anything fits: back off like a failure
+        logf_tag(s, "nothing fits the window");
+        s->failed = true;
+    }
+    if (s->failed) {
+        sess_close(s, now);
+    } else if (s->cur_id == REC_ID_NONE && s->next_id > s->last_id && s->nacks == 0) {
+        sess_close(s, now);
+    }
+}
+
+// The pass ended (status or lost link): complete, another pass, or give up
+static void end_pass(session_t *s, uint64_t now) {
+    st_rx_result_t r = st_rx_end(&s->rx_state);
+    if (r == ST_RX_RESTART) s->restart = true;
+
+    if (!s->restart && st_rx_complete(&s->rx_state)) {
+        dock_tag_t *t = sess_tag(s);
+        verify_t v;
+        char final[512];
+        variant_path(t->id, s->cur_id, s->variant, "", final, sizeof(final));
+        bool ok = fsync(s->part_fd) == 0 && verify_file(s->part_fd, &v) && v.variant == s->variant;
+        close(s->part_fd);
+        s->part_fd = -1;
+        if (!ok) {
+            // Do not acknowledge it: the tag keeps the recording for another try
+            fprintf(stderr, "st_dockd: tag-%04u r%07u failed verification\n", (unsigned)t->id, (unsigned)s->cur_id);
+            unlink(s->part);
+            s_tot.verify_failed++;
+            s->failed = true;
+            sess_close(s, now);
+            return;
+        }
+        char dir[448];
+        tag_dir(t->id, dir, sizeof(dir));
+        if (rename(s->part, final) != 0 || sync_dir(dir) != 0) {
+            fprintf(stderr, "st_dockd: cannot store %s: %s\n", final, strerror(errno));
+            s->failed = true;
+            sess_close(s, now);
+            return;
+        }
+        manifest_add(t->id, s->cur_id, &v);
+        drop_variants(t->id, s->cur_id, s->variant);
+        t->bytes += v.size;
+        t->stored++;
+        s->bytes += v.size;
+        s->fetched++;
+        s->seen_samples += v.samples;
+        s->seen_files++;
+        s_tot.bytes += v.size;
+        s_tot.stored++;
+        s_tot.reduced += s->variant != ST_VARIANT_RAW;
+        s_tot.upgraded += s->variant == ST_VARIANT_RAW && s->have != ST_VARIANT_NONE;
+        logf_tag(s, "r%07u stored as %s, %llu B crc32c=%08x pass %d%s", (unsigned)s->cur_id,
+                 st_variant_name(s->variant), (unsigned long long)v.size, v.crc, s->pass,
+                 v.count_gaps ? " (sample counter gaps)" : "");
+        uint32_t id = s->cur_id;
+        s->cur_id = REC_ID_NONE;
+        // A speech copy is not the recording: the tag keeps it pending for a RAW fetch later
+        if (s->variant == ST_VARIANT_RAW) send_ack(s, id, v.crc);
+        sess_next(s, now);  // The next START follows the acknowledgement
+        return;
+    }
+
+    if (s->pass >= s_opt.passes) {
+        logf_tag(s, "r%07u incomplete after %d passes", (unsigned)s->cur_id, s->pass);
+        s->failed = true;
+        sess_close(s, now);
+        return;
+    }
+    s->pass++;
+    if (s->restart) {
+        s->restart = false;
+        s->header_len = 0;
+        s->size_known = false;
+        ftruncate(s->part_fd, 0);
+        st_rx_begin(&s->rx_state, part_write, s, ST_SIZE_UNKNOWN);
+    } else {
+        st_rx_begin_fill(&s->rx_state);
+    }
+    send_start(s);
+}
+
+// Statuses for an acknowledgement come back in order, ahead of the next transfer's
+static bool is_ack_status(const session_t *s, uint8_t code) {
+    if (s->nacks == 0) return false;
+    switch (code) {
+    case STAT_SYNC_ACKED:
+    case STAT_SYNC_MISMATCH:
+        return true;
+    case STAT_FILE_READ_FAIL:
+    case STAT_NO_FILE:
+        // Also what a START can answer; before STARTED, the queue order says it is the ack's
+        return s->cur_id == REC_ID_NONE || !s->started;
+    default:
+        return false;
+    }
+}
+
+static void on_ack_status(session_t *s, uint8_t code, uint64_t now) {
+    uint32_t id = s->acks[0];
+    memmove(s->acks, s->acks + 1, (size_t)(--s->nacks) * sizeof(s->acks[0]));
+    dock_tag_t *t = sess_tag(s);
+    if (code == STAT_SYNC_ACKED) {
+        t->acked++;
+        s_tot.acked++;
+    } else if (code == STAT_SYNC_MISMATCH) {
+        // The tag's card disagrees with our copy: drop ours, it is fetched again next session
+        char path[512];
+        rec_path(t->id, id, "", path, sizeof(path));
+        unlink(path);
+        s_tot.mismatched++;
+        fprintf(stderr, "st_dockd: tag-%04u r%07u CRC mismatch reported by the tag\n", (unsigned)t->id, (unsigned)id);
+        s->failed = true;
+    } else {
+        logf_tag(s, "r%07u acknowledgement not recorded (%s)", (unsigned)id, ft_status_name(code));
+    }
+    sess_next(s, now);
+}
+
+static void on_status(session_t *s, uint8_t code, uint64_t now) {
+    if (is_ack_status(s, code)) {
+        on_ack_status(s, code, now);
+        return;
+    }
+    if (s->cur_id == REC_ID_NONE) return;
+
+    st_status_t st = st_status_decode(code);
+    if (code == STAT_STARTED) {
+        s->started = true;
+        s->transcoding = false;
+        s->meter_ms = now;
+        s->meter_bytes = 0;
+    } else if (code == STAT_TRANSCODING) {
+        // Nothing arrives until the tag has encoded the whole recording
+        double xcode_ms = s_opt.xcode_x > 0 ? s->est_samples * 1000.0 / RAW_RATE / s_opt.xcode_x : 0;
+        s->transcoding = true;
+        s->transcoded = true;
+        s->quiet_until_ms = now + (uint64_t)(2 * xcode_ms);
+    } else if (code == STAT_ALREADY_RUNNING) {
+        s->resend_at_ms = now + START_RETRY_MS;
+    } else if (code == STAT_NO_FILE) {
+        // A gap in the IDs (reboot) or deleted on the tag
+        close(s->part_fd);
+        s->part_fd = -1;
+        unlink(s->part);
+        s->cur_id = REC_ID_NONE;
+        sess_next(s, now);
+    } else if (st.ends_transfer) {
+        end_pass(s, now);
+    } else if (st.kind == ST_STATUS_REFUSED) {
+        // Busy (recording, Wi-Fi upload) or worse: try again later
+        logf_tag(s, "r%07u refused: %s", (unsigned)s->cur_id, st.name);
+        s->failed = true;
+        sess_close(s, now);
+    }
+}
+
+static void on_data(session_t *s, const uint8_t *v, uint16_t len, uint64_t now) {
+    if (s->cur_id == REC_ID_NONE || s->restart) return;
+    if (!s->first_data) {
+        // START to first data is the per-fetch cost; a transcode is planned for separately
+        s->first_data = true;
+        if (!s->transcoded) st_link_overhead(&s->link, (now - s->start_sent_ms) / 1000.0);
+    }
+    if (len > FILE_TRANSFER_HEADER_SIZE) s->meter_bytes += len - FILE_TRANSFER_HEADER_SIZE;
+    st_rx_result_t r = st_rx_feed(&s->rx_state, v, len);
+    if (r == ST_RX_WRITE_FAILED) {
+        s->failed = true;
+    } else if (r == ST_RX_RESTART) {
+        s->restart = true;  // Drain this pass, then fetch it whole again
+    } else if (!s->size_known && s->header_len == ST_HEADER_BYTES) {
+        // The header is in the first packet; it tells the size before eof does
+        st_file_info_t info;
+        if (st_header_decode(s->header, sizeof(s->header), &info) && info.expected_size) {
+            st_rx_set_size(&s->rx_state, info.expected_size);
+        }
+        s->size_known = true;
+    }
+}
+
+static void on_frame(session_t *s, uint8_t op, uint16_t uuid, const uint8_t *v, uint16_t len, uint64_t now) {
+    if (op == EMU_OP_HELLO && s->state == SS_HELLO) {
+        uint8_t mtu[2] = { (uint8_t)s_opt.mtu, (uint8_t)(s_opt.mtu >> 8) };
+        uint8_t on = 1;
+        s->state = SS_RUNNING;
+        if (sess_send(s, EMU_OP_MTU, 0, mtu, 2) &&
+            sess_send(s, EMU_OP_SUBSCRIBE, BLE_UUID_SALESTAG_FILE_DATA, &on, 1) &&
+            sess_send(s, EMU_OP_SUBSCRIBE, BLE_UUID_SALESTAG_FILE_STATUS, &on, 1)) {
+            sess_next(s, now);
+        }
+    } else if (op == EMU_OP_WRITE_RSP && len >= 1 && v[0] != EMU_ATT_OK) {
+        fprintf(stderr, "st_dockd: FILE_CTRL write rejected (ATT 0x%02x)\n", v[0]);
+        s->failed = true;
+    } else if (op == EMU_OP_NOTIFY && len >= 1 && s->state == SS_RUNNING) {
+        if (uuid == BLE_UUID_SALESTAG_FILE_STATUS) {
+            on_status(s, v[0], now);
+        } else if (uuid == BLE_UUID_SALESTAG_FILE_DATA) {
+            on_data(s, v, len, now);
+        }
+    }
+}
+
+static void sess_read(session_t *s, uint64_t now) {
+    ssize_t n = recv(s->fd, s->rx + s->rx_len, sizeof(s->rx) - s->rx_len, 0);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        // Link lost
+        s->failed = true;
+        sess_close(s, now);
+        return;
+    }
+    if (n < 0) return;
+    s->rx_len += (size_t)n;
+    s->last_rx_ms = now;
+
+    size_t pos = 0;
+    while (s->state != SS_FREE && s->rx_len - pos >= EMU_FRAME_HDR) {
+        const uint8_t *f = s->rx + pos;
+        uint16_t len = (uint16_t)(f[3] | (f[4] << 8));
+        if (EMU_FRAME_HDR + (size_t)len > sizeof(s->rx)) {
+            s->failed = true;
+            break;
+        }
+        if (s->rx_len - pos < EMU_FRAME_HDR + (size_t)len) break;
+        on_frame(s, f[0], (uint16_t)(f[1] | (f[2] << 8)), f + EMU_FRAME_HDR, len, now);
+        pos += EMU_FRAME_HDR + len;
+    }
+    if (s->state == SS_FREE) return;
+    memmove(s->rx, s->rx + pos, s->rx_len - pos);
+    s->rx_len -= pos;
+    if (s->failed) sess_close(s, now);
+}
+
+static bool sess_open(session_t *s, dock_tag_t *t, uint64_t now) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) return false;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct sockaddr_in sa = { .sin_family = AF_INET, .sin_port = htons(t->port), .sin_addr.s_addr = t->addr };
+    if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0 && errno != EINPROGRESS) {
+        close(fd);
+        return false;
+    }
+    memset(s, 0, sizeof(*s));
+    s->fd = fd;
+    s->part_fd = -1;
+    s->state = SS_CONNECTING;
+    s->tag = (size_t)(t - s_sched.tags);
+    s->start_ms = now;
+    s->last_rx_ms = now;
+    s->next_id = t->adv.first_pending_id;
+    s->last_id = t->adv.latest_id;
+    s->link = s_link;
+    uint64_t avg = t->adv.pending_count ? (uint64_t)t->adv.pending_kb * 1024 / t->adv.pending_count : 0;
+    s->est_samples = avg > ST_HEADER_BYTES ? (avg - ST_HEADER_BYTES) / ST_RAW_SAMPLE : 0;
+    dock_sched_begin(t);
+    logf_tag(s, "connecting: %u un-synced (%u KB), IDs %u-%u, battery %u%%", t->adv.pending_count,
+             (unsigned)t->adv.pending_kb, (unsigned)s->next_id, (unsigned)s->last_id, t->adv.battery_pct);
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Scanner and metrics
+// ---------------------------------------------------------------------------
+
+static int open_scanner(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in sa = { .sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void scan(int fd, uint64_t now) {
+    uint8_t buf[EMU_ADV_MAX];
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+    ssize_t n;
+    while ((n = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr *)&from, &from_len)) > 0) {
+        from_len = sizeof(from);
+        adv_state_t adv;
+        if (n < EMU_ADV_HDR || !adv_state_decode(buf + EMU_ADV_HDR, (size_t)n - EMU_ADV_HDR, &adv)) continue;
+        uint32_t id = (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+        uint16_t port = (uint16_t)(buf[4] | (buf[5] << 8));
+        dock_sched_seen(&s_sched, id, from.sin_addr.s_addr, port, &adv, now);
+    }
+}
+
+typedef struct {
+    uint64_t t0_ms;
+    uint64_t last_ms;
+    uint64_t last_bytes;
+    double rate;                    // Bytes/s over the last interval
+} rate_t;
+
+static void report(rate_t *r, const session_t *sess, uint64_t now, const char *metrics) {
+    if (now > r->last_ms) {
+        r->rate = (s_tot.bytes - r->last_bytes) * 1000.0 / (double)(now - r->last_ms);
+    }
+    r->last_ms = now;
+    r->last_bytes = s_tot.bytes;
+    double elapsed = (now - r->t0_ms) / 1000.0;
+    double avg = elapsed > 0 ? s_tot.bytes / elapsed : 0.0;
+
+    int links = 0;
+    for (int i = 0; i < s_opt.max_links; i++) links += sess[i].state != SS_FREE;
+    dock_fleet_t f;
+    dock_sched_fleet(&s_sched, now, &f);
+
+    printf("t=%.1fs tags=%u pending=%u (%llu KB) deferred=%u links=%d/%d stored=%llu acked=%llu "
+           "%.1f KB/s (avg %.1f) failed=%llu mismatched=%llu\n",
+           elapsed, f.tags, f.pending, (unsigned long long)f.pending_kb, f.deferred, links, s_opt.max_links,
+           (unsigned long long)s_tot.stored, (unsigned long long)s_tot.acked, r->rate / 1024.0, avg / 1024.0,
+           (unsigned long long)s_tot.sessions_failed, (unsigned long long)s_tot.mismatched);
+    fflush(stdout);
+
+    if (!metrics) return;
+    // Prometheus textfile: written aside and renamed so a scrape never sees half a file
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", metrics);
+    FILE *m = fopen(tmp, "w");
+    if (!m) return;
+    fprintf(m,
+            "# HELP salestag_dock_tags Tags heard since the dock started\n"
+            "# TYPE salestag_dock_tags gauge\nsalestag_dock_tags %u\n"
+            "# HELP salestag_dock_tags_pending Tags advertising un-synced recordings\n"
+            "# TYPE salestag_dock_tags_pending gauge\nsalestag_dock_tags_pending %u\n"
+            "# HELP salestag_dock_tags_deferred Pending tags below the battery floor\n"
+            "# TYPE salestag_dock_tags_deferred gauge\nsalestag_dock_tags_deferred %u\n"
+            "# HELP salestag_dock_pending_bytes Un-synced bytes advertised by idle tags\n"
+            "# TYPE salestag_dock_pending_bytes gauge\nsalestag_dock_pending_bytes %llu\n"
+            "# HELP salestag_dock_links Open tag connections\n"
+            "# TYPE salestag_dock_links gauge\nsalestag_dock_links %d\n"
+            "# HELP salestag_dock_throughput_bytes_per_second Stored bytes per second, last interval\n"
+            "# TYPE salestag_dock_throughput_bytes_per_second gauge\nsalestag_dock_throughput_bytes_per_second %.0f\n"
+            "# HELP salestag_dock_bytes_total Verified bytes stored\n"
+            "# TYPE salestag_dock_bytes_total counter\nsalestag_dock_bytes_total %llu\n"
+            "# HELP salestag_dock_recordings_total Recordings stored and acknowledged\n"
+            "# TYPE salestag_dock_recordings_total counter\n"
+            "salestag_dock_recordings_total{stage=\"stored\"} %llu\n"
+            "salestag_dock_recordings_total{stage=\"speech\"} %llu\n"
+            "salestag_dock_recordings_total{stage=\"upgraded\"} %llu\n"
+            "salestag_dock_recordings_total{stage=\"acked\"} %llu\n"
+            "# HELP salestag_dock_errors_total Sessions and recordings that failed\n"
+            "# TYPE salestag_dock_errors_total counter\n"
+            "salestag_dock_errors_total{kind=\"session\"} %llu\n"
+            "salestag_dock_errors_total{kind=\"verify\"} %llu\n"
+            "salestag_dock_errors_total{kind=\"crc_mismatch\"} %llu\n",
+            f.tags, f.pending, f.deferred, (unsigned long long)f.pending_kb * 1024, links, r->rate,
+            (unsigned long long)s_tot.bytes, (unsigned long long)s_tot.stored, (unsigned long long)s_tot.reduced,
+            (unsigned long long)s_tot.upgraded, (unsigned long long)s_tot.acked,
+            (unsigned long long)s_tot.sessions_failed, (unsigned long long)s_tot.verify_failed,
+            (unsigned long long)s_tot.mismatched);
+    if (fclose(m) == 0) rename(tmp, metrics);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s --ingest DIR [options]\n"
+            "  --ingest DIR         where recordings go: DIR/tag-<id>/r<id>.raw, DIR/manifest.tsv\n"
+            "  --adv-port P         UDP port advertisements arrive on (default 46999)\n"
+            "  --max-links N        concurrent tag connections, the controller's limit (default 8)\n"
+            "  --min-battery PCT    leave tags below this charging (default 15)\n"
+            "  --mtu M              ATT MTU to request (default 247)\n"
+            "  --passes N           transfer passes per recording before the session fails (default 5)\n"
+            "  --timeout-ms T       drop a link silent this long (default 5000)\n"
+            "  --stale-ms T         forget an advertisement this old (default 3000)\n"
+            "  --max-failures N     failed sessions before a tag is left alone (default 5, 0 = never)\n"
+            "  --window-s S         link time per session; fetch speech variants to fit it (default 0 = no limit)\n"
+            "  --companion V        variant tags keep on the card: wb4, nb4, nb2 or none (default nb2)\n"
+            "  --xcode-x X          tags' on-demand transcoding, audio seconds per second (default 10)\n"
+            "  --prior-kbs K        throughput assumed before the first measurement (default 40)\n"
+            "  --stats-s S          print throughput every S seconds (default 5)\n"
+            "  --metrics FILE       also write Prometheus textfile metrics there\n"
+            "  --once               exit once no tag has anything left to sync\n"
+            "  --quiet              no per-tag logs\n",
+            argv0);
+}
+
+int main(int argc, char **argv) {
+    int adv_port = 46999;
+    int min_battery = 15;
+    int stale_ms = 3000;
+    int max_failures = 5;
+    double stats_s = 5.0;
+    const char *metrics = NULL;
+    bool once = false;
+    double prior_kbs = 40.0;
+    s_opt = (dock_opts_t){ .max_links = 8, .mtu = 247, .passes = 5, .timeout_ms = 5000,
+                           .companion = ST_VARIANT_NB2, .xcode_x = 10.0 };
+
+    static const struct option opts[] = {
+        { "ingest", required_argument, 0, 'd' },
+        { "adv-port", required_argument, 0, 'a' },
+        { "max-links", required_argument, 0, 'n' },
+        { "min-battery", required_argument, 0, 'b' },
+        { "mtu", required_argument, 0, 'm' },
+        { "passes", required_argument, 0, 'p' },
+        { "timeout-ms", required_argument, 0, 't' },
+        { "stale-ms", required_argument, 0, 's' },
+        { "max-failures", required_argument, 0, 'f' },
+        { "window-s", required_argument, 0, 'w' },
+        { "companion", required_argument, 0, 'C' },
+        { "xcode-x", required_argument, 0, 'X' },
+        { "prior-kbs", required_argument, 0, 'P' },
+        { "stats-s", required_argument, 0, 'S' },
+        { "metrics", required_argument, 0, 'M' },
+        { "once", no_argument, 0, 'o' },
+        { "quiet", no_argument, 0, 'q' },
+        { "help", no_argument, 0, 'h' },
+        { 0, 0, 0, 0 },
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "d:n:qh", opts, NULL)) != -1) {
+        switch (c) {
+        case 'd': s_opt.ingest = optarg; break;
+        case 'a': adv_port = atoi(optarg); break;
+        case 'n': s_opt.max_links = atoi(optarg); break;
+        case 'b': min_battery = atoi(optarg); break;
+        case 'm': s_opt.mtu = (uint16_t)atoi(optarg); break;
+        case 'p': s_opt.passes = atoi(optarg); break;
+        case 't': s_opt.timeout_ms = (uint32_t)atoi(optarg); break;
+        case 's': stale_ms = atoi(optarg); break;
+        case 'f': max_failures = atoi(optarg); break;
+        case 'w': s_opt.window_s = atof(optarg); break;
+        case 'C':
+            s_opt.companion = !strcmp(optarg, "none") ? ST_VARIANT_NONE : 0;
+            for (uint8_t v = ST_VARIANT_WB4; v <= ST_VARIANT_NB2; v++) {
+                if (!strcmp(optarg, st_variant_name(v))) s_opt.companion = v;
+            }
+            break;
+        case 'X': s_opt.xcode_x = atof(optarg); break;
+        case 'P': prior_kbs = atof(optarg); break;
+        case 'S': stats_s = atof(optarg); break;
+        case 'M': metrics = optarg; break;
+        case 'o': once = true; break;
+        case 'q': s_opt.quiet = true; break;
+        default: usage(argv[0]); return c == 'h' ? 0 : 2;
+        }
+    }
+    if (!s_opt.ingest || adv_port < 1 || adv_port > 65535 || s_opt.max_links < 1 || min_battery < 0 ||
+        min_battery > 100 || s_opt.mtu < 23 || s_opt.passes < 1 || s_opt.timeout_ms < 100 || stale_ms < 100 ||
+        max_failures < 0 || s_opt.window_s < 0 || s_opt.companion == ST_VARIANT_RAW || s_opt.xcode_x < 0 ||
+        prior_kbs <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (mkdir(s_opt.ingest, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "st_dockd: cannot create %s: %s\n", s_opt.ingest, strerror(errno));
+        return 1;
+    }
+    char path[512];
+    snprintf(path, sizeof(path), "%s/manifest.tsv", s_opt.ingest);
+    s_manifest = fopen(path, "a");
+    int scan_fd = open_scanner((uint16_t)adv_port);
+    session_t *sess = calloc((size_t)s_opt.max_links, sizeof(*sess));
+    struct pollfd *pfds = calloc((size_t)s_opt.max_links + 1, sizeof(*pfds));
+    if (!s_manifest || scan_fd < 0 || !sess || !pfds) {
+        fprintf(stderr, "st_dockd: setup failed: %s\n", strerror(errno));
+        return 1;
+    }
+    dock_sched_init(&s_sched, (uint8_t)min_battery, (uint32_t)stale_ms, (uint32_t)max_failures);
+    st_link_init(&s_link, prior_kbs * 1024.0, 0.1);
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    printf("st_dockd: scanning udp 127.0.0.1:%d, %d links, ingest %s\n", adv_port, s_opt.max_links, s_opt.ingest);
+    fflush(stdout);
+
+    const uint64_t t0 = now_ms();
+    rate_t rate = { .t0_ms = t0, .last_ms = t0 };
+    uint64_t next_stats = t0 + (uint64_t)(stats_s * 1000.0);
+
+    while (!s_stop) {
+        pfds[0] = (struct pollfd){ .fd = scan_fd, .events = POLLIN };
+        for (int i = 0; i < s_opt.max_links; i++) {
+            session_t *s = &sess[i];
+            short ev = s->state == SS_CONNECTING ? POLLOUT : POLLIN;
+            pfds[1 + i] = (struct pollfd){ .fd = s->state == SS_FREE ? -1 : s->fd, .events = ev };
+        }
+        if (poll(pfds, (nfds_t)s_opt.max_links + 1, TICK_MS) < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+
+        uint64_t now = now_ms();
+        if (pfds[0].revents & POLLIN) scan(scan_fd, now);
+
+        bool connecting = false;
+        for (int i = 0; i < s_opt.max_links; i++) {
+            session_t *s = &sess[i];
+            if (s->state == SS_FREE) continue;
+            short rev = pfds[1 + i].revents;
+            if (s->state == SS_CONNECTING && rev) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err) {
+                    logf_tag(s, "connect failed: %s", strerror(err));
+                    s->failed = true;
+                    sess_close(s, now);
+                    continue;
+                }
+                s->state = SS_HELLO;
+                s->last_rx_ms = now;
+            } else if (rev & (POLLIN | POLLERR | POLLHUP)) {
+                sess_read(s, now);
+                if (s->state == SS_FREE) continue;
+            }
+            if (s->resend_at_ms && now >= s->resend_at_ms) send_start(s);
+            if (s->cur_id != REC_ID_NONE && s->started && now - s->meter_ms >= METER_MS) {
+                st_link_sample(&s->link, s->meter_bytes, (now - s->meter_ms) / 1000.0);
+                s->meter_ms = now;
+                s->meter_bytes = 0;
+            }
+            if (s->failed || (now - s->last_rx_ms > s_opt.timeout_ms && now > s->quiet_until_ms)) {
+                if (!s->failed) logf_tag(s, "timed out");
+                s->failed = true;
+                sess_close(s, now);
+                continue;
+            }
+            connecting |= s->state == SS_CONNECTING || s->state == SS_HELLO;
+        }
+
+        // One connection is set up at a time, as the controller creates one at a time
+        if (!connecting) {
+            for (int i = 0; i < s_opt.max_links; i++) {
+                if (sess[i].state != SS_FREE) continue;
+                dock_tag_t *t = dock_sched_pick(&s_sched, now);
+                if (t && !sess_open(&sess[i], t, now)) dock_sched_end(t, false, now);
+                break;
+            }
+        }
+
+        if (stats_s > 0 && now >= next_stats) {
+            report(&rate, sess, now, metrics);
+            next_stats += (uint64_t)(stats_s * 1000.0);
+        }
+        if (once && now - t0 > (uint64_t)stale_ms && dock_sched_idle(&s_sched, now)) break;
+    }
+
+    for (int i = 0; i < s_opt.max_links; i++) sess_close(&sess[i], now_ms());
+    uint64_t end = now_ms();
+    report(&rate, sess, end, metrics);
+    double elapsed = (end - t0) / 1000.0;
+    printf("st_dockd: %llu recording(s) (%llu as speech, %llu upgraded), %llu B in %.1f s (%.1f KB/s), "
+           "%llu acknowledged, %llu verify failure(s), %llu CRC mismatch(es), %llu of %llu session(s) failed\n",
+           (unsigned long long)s_tot.stored, (unsigned long long)s_tot.reduced, (unsigned long long)s_tot.upgraded,
+           (unsigned long long)s_tot.bytes, elapsed,
+           elapsed > 0 ? s_tot.bytes / 1024.0 / elapsed : 0.0, (unsigned long long)s_tot.acked,
+           (unsigned long long)s_tot.verify_failed, (unsigned long long)s_tot.mismatched,
+           (unsigned long long)s_tot.sessions_failed, (unsigned long long)s_tot.sessions);
+
+    fclose(s_manifest);
+    close(scan_fd);
+    free(pfds);
+    free(sess);
+    dock_sched_free(&s_sched);
+    return s_tot.verify_failed || s_tot.mismatched ? 1 : 0;
+}
@@ -0,0 +1,71 @@
+/**
+ * @file emu_alloc.c
+ * @brief --wrap targets that count heap allocations (see emu_alloc.h)
+ */
+
+#include "emu_alloc.h"
+#include <stdatomic.h>
+#include <stddef.h>
+#include <string.h>
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *p, size_t size);
+void __real_free(void *p);
+
+void *__wrap_malloc(size_t size);
+void *__wrap_calloc(size_t n, size_t size);
+void *__wrap_realloc(void *p, size_t size);
+void __wrap_free(void *p);
+char *__wrap_strdup(const char *s);
+
+static atomic_uint_fast64_t s_allocs;
+static atomic_uint_fast64_t s_bytes;
+static uint64_t s_mark_allocs;
+static uint64_t s_mark_bytes;
+
+static void count(size_t bytes) {
+    atomic_fetch_add_explicit(&s_allocs, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s_bytes, bytes, memory_order_relaxed);
+}
+
+void *__wrap_malloc(size_t size) {
+    count(size);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+    count(n * size);
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size) {
+    // Shrinking or freeing in place is not a new allocation
+    if (!p || size > 0) count(size);
+    return __real_realloc(p, size);
+}
+
+void __wrap_free(void *p) {
+    __real_free(p);
+}
+
+// Routed through the counter rather than libc's strdup, which allocates internally
+char *__wrap_strdup(const char *s) {
+    size_t n = strlen(s) + 1;
+    char *d = __wrap_malloc(n);
+    if (d) memcpy(d, s, n);
+    return d;
+}
+
+void emu_alloc_mark(void) {
+    s_mark_allocs = atomic_load(&s_allocs);
+    s_mark_bytes = atomic_load(&s_bytes);
+}
+
+uint64_t emu_alloc_since_mark(void) {
+    return atomic_load(&s_allocs) - s_mark_allocs;
+}
+
+uint64_t emu_alloc_bytes_since_mark(void) {
+    return atomic_load(&s_bytes) - s_mark_bytes;
+}
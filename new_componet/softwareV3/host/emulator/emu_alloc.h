@@ -0,0 +1,26 @@
+/**
+ * @file emu_alloc.h
+ * @brief Heap allocation counter for the emulator build
+ *
+ * The Makefile links with -Wl,--wrap for malloc, calloc, realloc, free and
+ * strdup, so every call from the emulator and the firmware modules it
+ * compiles lands here first. Allocations made inside libc itself are not
+ * seen. The firmware allocates everything at boot (main/mem_plan.h); the
+ * emulator marks the end of its setup and reports what happened after it.
+ */
+
+#ifndef EMU_ALLOC_H
+#define EMU_ALLOC_H
+
+#include <stdint.h>
+
+// Start counting from here; allocations before the mark are setup
+void emu_alloc_mark(void);
+
+// Allocations (malloc, calloc, realloc, strdup) since the mark
+uint64_t emu_alloc_since_mark(void);
+
+// Bytes requested by those allocations
+uint64_t emu_alloc_bytes_since_mark(void);
+
+#endif // EMU_ALLOC_H
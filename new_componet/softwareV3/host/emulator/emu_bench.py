@@ -0,0 +1,142 @@
+#!/usr/bin/env python3
+"""
+SalesTag emulator benchmark client
+Downloads the latest recording from many virtual tags at once (salestag_emu)
+and reports per-tag and fleet throughput, sequence gaps and integrity errors.
+"""
+
+import argparse
+import asyncio
+import struct
+import time
+
+# emu_wire.h
+OP_HELLO, OP_MTU, OP_SUBSCRIBE, OP_WRITE, OP_WRITE_RSP, OP_READ, OP_READ_RSP, OP_NOTIFY = range(8)
+
+# ft_proto.h
+UUID_FILE_CTRL = 0x1241
+UUID_FILE_DATA = 0x1242
+UUID_FILE_STATUS = 0x1243
+UUID_AUTO_SELECT_LIST = 0x1245
+CMD_START = 0x01
+STAT_STARTED = 0x01
+STAT_COMPLETE = 0x02
+STATUS_NAMES = {
+    0x01: "STARTED", 0x02: "COMPLETE", 0x03: "STOPPED_BY_HOST", 0x10: "FILE_OPEN_FAIL",
+    0x11: "NOTIFY_FAIL", 0x13: "FILE_READ_FAIL", 0x20: "BAD_CMD", 0x21: "ALREADY_RUNNING",
+    0x22: "BUSY", 0x23: "NO_CONN", 0x30: "PAUSED", 0x40: "SUBSCRIPTION_REQUIRED",
+    0x50: "NO_FILE", 0x60: "LIST_READY", 0x61: "FILE_SELECTED", 0x62: "INVALID_INDEX",
+}
+
+RAW_HEADER = 32
+RAW_SAMPLE = 10
+
+
+def frame(op, uuid=0, payload=b""):
+    return struct.pack("<BHH", op, uuid, len(payload)) + payload
+
+
+async def read_frame(reader):
+    hdr = await reader.readexactly(5)
+    op, uuid, length = struct.unpack("<BHH", hdr)
+    payload = await reader.readexactly(length) if length else b""
+    return op, uuid, payload
+
+
+def check_raw(data):
+    """Count RAW v1 samples whose sample_count does not follow its predecessor."""
+    if len(data) < RAW_HEADER or data[:4] != b"AWAR":
+        return 1
+    errors = 0
+    prev = None
+    for off in range(RAW_HEADER, len(data) - RAW_SAMPLE + 1, RAW_SAMPLE):
+        mic, _ts, count = struct.unpack_from("<HII", data, off)
+        if mic > 4095 or (prev is not None and count != prev + 1):
+            errors += 1
+        prev = count
+    return errors
+
+
+async def download(host, port, mtu, timeout):
+    result = {"port": port, "status": None, "bytes": 0, "gaps": 0, "errors": 0, "seconds": 0.0}
+    try:
+        reader, writer = await asyncio.wait_for(asyncio.open_connection(host, port), timeout)
+    except (OSError, asyncio.TimeoutError) as e:
+        result["status"] = f"connect failed: {e}"
+        return result
+
+    try:
+        op, _, _ = await asyncio.wait_for(read_frame(reader), timeout)
+        writer.write(frame(OP_MTU, 0, struct.pack("<H", mtu)))
+        writer.write(frame(OP_SUBSCRIBE, UUID_FILE_DATA, b"\x01"))
+        writer.write(frame(OP_SUBSCRIBE, UUID_FILE_STATUS, b"\x01"))
+        writer.write(frame(OP_WRITE, UUID_FILE_CTRL, bytes([CMD_START])))
+        await writer.drain()
+
+        data = bytearray()
+        expected_seq = 0
+        t0 = None
+        while True:
+            op, uuid, payload = await asyncio.wait_for(read_frame(reader), timeout)
+            if op != OP_NOTIFY:
+                continue
+            if uuid == UUID_FILE_STATUS:
+                code = payload[0]
+                if code == STAT_STARTED:
+                    t0 = time.monotonic()
+                    continue
+                result["status"] = STATUS_NAMES.get(code, f"0x{code:02x}")
+                break
+            if uuid == UUID_FILE_DATA and len(payload) >= 5:
+                seq, length, _eof = struct.unpack_from("<HHB", payload)
+                if seq != expected_seq:
+                    result["gaps"] += (seq - expected_seq) & 0xFFFF
+                expected_seq = (seq + 1) & 0xFFFF
+                data += payload[5:5 + length]
+
+        result["seconds"] = time.monotonic() - (t0 or time.monotonic())
+        result["bytes"] = len(data)
+        result["errors"] = check_raw(bytes(data))
+    except asyncio.TimeoutError:
+        result["status"] = "timeout"
+    except asyncio.IncompleteReadError:
+        result["status"] = "disconnected"
+    finally:
+        writer.close()
+    return result
+
+
+async def main():
+    ap = argparse.ArgumentParser(description=__doc__)
+    ap.add_argument("--host", default="127.0.0.1")
+    ap.add_argument("--port", type=int, default=47000, help="first emulator port")
+    ap.add_argument("--devices", type=int, default=1)
+    ap.add_argument("--concurrency", type=int, default=0, help="parallel downloads (0 = all)")
+    ap.add_argument("--mtu", type=int, default=247)
+    ap.add_argument("--timeout", type=float, default=10.0, help="seconds of silence before giving up")
+    args = ap.parse_args()
+
+    sem = asyncio.Semaphore(args.concurrency or args.devices)
+
+    async def limited(port):
+        async with sem:
+            return await download(args.host, port, args.mtu, args.timeout)
+
+    t0 = time.monotonic()
+    results = await asyncio.gather(*(limited(args.port + i) for i in range(args.devices)))
+    wall = time.monotonic() - t0
+
+    ok = 0
+    total = 0
+    for r in results:
+        rate = r["bytes"] / 1024 / r["seconds"] if r["seconds"] > 0 else 0.0
+        print(f"port {r['port']}: {r['status']} {r['bytes']} B in {r['seconds']:.2f} s "
+              f"({rate:.1f} KB/s) gaps={r['gaps']} errors={r['errors']}")
+        ok += r["status"] == "COMPLETE" and r["gaps"] == 0 and r["errors"] == 0
+        total += r["bytes"]
+    print(f"\n{ok}/{len(results)} clean downloads, {total} B in {wall:.2f} s "
+          f"({total / 1024 / wall:.1f} KB/s aggregate)")
+
+
+if __name__ == "__main__":
+    asyncio.run(main())
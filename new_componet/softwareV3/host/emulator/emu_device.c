@@ -0,0 +1,747 @@
+/**
+ * @file emu_device.c
+ * @brief Virtual SalesTag (see emu_device.h)
+ *
+ * Behaviour follows gatt_svr_chr_access() and file_xfer_task() in main.c:
+ * the same status codes in the same situations, data notifications built
+ * with ft_pkt_header_encode() and paced by xfer_credit credits that come
+ * back on NOTIFY_TX. Pull sessions answer READ_BLOCKS with the firmware's
+ * ft_pull.c. With link.rx_queue set, the phone end is modelled too: its
+ * stack holds that many data notifications until the app takes them at
+ * link.rx_pps, and drops what does not fit.
+ */
+
+#include "emu_device.h"
+#include "emu_wire.h"
+#include "crc32c.h"
+#include "rec_id.h"
+#include <stdio.h>
+#include <string.h>
+
+#define SUB_DATA   0x01
+#define SUB_STATUS 0x02
+
+// Clock for fault_inject recovery times, advanced by emu_device_tick()
+static uint64_t s_now_us;
+
+static uint32_t clock_ms(void) {
+    return (uint32_t)(s_now_us / 1000);
+}
+
+static uint32_t rng_next(emu_device_t *dev) {
+    // xorshift32
+    uint32_t x = dev->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    dev->rng = x;
+    return x;
+}
+
+static bool chance(emu_device_t *dev, double p) {
+    if (p <= 0.0) return false;
+    return (rng_next(dev) / 4294967296.0) < p;
+}
+
+void emu_device_init(emu_device_t *dev, uint32_t id, const emu_link_t *link, const emu_faults_t *faults,
+                     uint8_t recordings, uint32_t seconds) {
+    memset(dev, 0, sizeof(*dev));
+    dev->id = id;
+    dev->link = *link;
+    dev->faults = *faults;
+    dev->rng = 0x9E3779B9U ^ (id * 2654435761U);
+    if (dev->rng == 0) dev->rng = 1;
+    if (recordings > EMU_MAX_RECORDINGS) recordings = EMU_MAX_RECORDINGS;
+    dev->num_recs = recordings;
+    for (uint8_t i = 0; i < recordings; i++) {
+        emu_recording_init(&dev->recs[i], id, i, seconds);
+    }
+    // Spread over 10-100% so docks see both charged and nearly flat tags
+    dev->battery_pct = (uint8_t)(100 - (id * 37) % 91);
+    dev->selected = -1;
+    dev->last_xcode = -1;
+    dev->companion = SPEECH_CODEC_NB2;
+    dev->xcode_x = 10.0;
+    fi_init(&dev->fi, 0, clock_ms);
+}
+
+// Size and bytes of the file being sent: the recording, or its speech variant
+static uint32_t cur_size(const emu_device_t *dev) {
+    return dev->variant != FT_VARIANT_RAW ? dev->var.size : dev->recs[dev->cur].size;
+}
+
+static size_t cur_read(emu_device_t *dev, uint32_t offset, uint8_t *out, size_t len) {
+    if (dev->variant != FT_VARIANT_RAW) return emu_variant_read(&dev->var, offset, out, len);
+    return emu_recording_read(&dev->recs[dev->cur], offset, out, len);
+}
+
+int emu_device_set_scenario(emu_device_t *dev, const char *spec, uint32_t seed) {
+    fi_init(&dev->fi, seed + dev->id, clock_ms);
+    return fi_load(&dev->fi, spec);
+}
+
+static int pull_read(void *ctx, uint32_t offset, uint8_t *buf, size_t len) {
+    return (int)cur_read(ctx, offset, buf, len);
+}
+
+// A notification reaches the phone: straight to the client, or into the phone's queue
+static void deliver(emu_device_t *dev, uint16_t uuid, const uint8_t *data, uint16_t len) {
+    if (dev->link.rx_queue == 0) {
+        dev->send(dev->send_ctx, EMU_OP_NOTIFY, uuid, data, len);
+        return;
+    }
+    // Status notifications are few; they only get lost if the whole model is full
+    uint16_t cap = uuid == BLE_UUID_SALESTAG_FILE_DATA ? dev->link.rx_queue : EMU_RX_MAX;
+    if (dev->rxq_count >= cap) {
+        dev->stats.rx_overflow++;
+        return;
+    }
+    if (dev->rxq_count == 0) dev->rx_drain_us = s_now_us;
+    emu_notif_t *n = &dev->rxq[(dev->rxq_head + dev->rxq_count) % EMU_RX_MAX];
+    n->uuid = uuid;
+    n->len = len;
+    memcpy(n->data, data, len);
+    dev->rxq_count++;
+}
+
+// The app takes rx_pps notifications a second from the phone's queue
+static void rx_drain(emu_device_t *dev, uint64_t now_us) {
+    if (dev->rxq_count == 0 || now_us <= dev->rx_drain_us) return;
+    uint64_t n = (now_us - dev->rx_drain_us) * dev->link.rx_pps / 1000000;
+    if (n == 0) return;
+    dev->rx_drain_us += n * 1000000 / dev->link.rx_pps;
+    for (; n > 0 && dev->rxq_count > 0; n--) {
+        const emu_notif_t *q = &dev->rxq[dev->rxq_head];
+        dev->send(dev->send_ctx, EMU_OP_NOTIFY, q->uuid, q->data, q->len);
+        dev->rxq_head = (uint8_t)((dev->rxq_head + 1) % EMU_RX_MAX);
+        dev->rxq_count--;
+    }
+}
+
+static void send_status(emu_device_t *dev, uint8_t code) {
+    if (!dev->connected || !(dev->cccd_mask & SUB_STATUS)) return;
+    deliver(dev, BLE_UUID_SALESTAG_FILE_STATUS, &code, 1);
+}
+
+static void reset_transfer(emu_device_t *dev) {
+    dev->active = false;
+    dev->paused = false;
+    dev->xcoding = false;
+    dev->txq_head = 0;
+    dev->txq_count = 0;
+    dev->have_credit = false;
+    dev->tries = 0;
+    dev->credit_timeouts = 0;
+    dev->credit_wait_us = 0;
+    dev->pull = false;
+    xfer_credit_reset(&dev->credits);
+}
+
+void emu_device_connect(emu_device_t *dev, emu_send_fn_t send, void *ctx, uint64_t now_us) {
+    dev->connected = true;
+    dev->want_disconnect = false;
+    dev->mtu = 23;
+    dev->cccd_mask = 0;
+    dev->send = send;
+    dev->send_ctx = ctx;
+    dev->selected = -1;
+    dev->stalled_once = false;
+    dev->next_event_us = now_us + dev->link.interval_us;
+    dev->stall_until_us = 0;
+    dev->stats.connections++;
+    dev->rxq_head = 0;
+    dev->rxq_count = 0;
+    xfer_credit_init(&dev->credits, dev->link.bearers, dev->link.credits);
+    reset_transfer(dev);
+
+    uint8_t hello[4 + 2 + 24];
+    int n = snprintf((char *)hello + 6, sizeof(hello) - 6, "SalesTag-Emu-%04u", (unsigned)dev->id);
+    hello[0] = (uint8_t)dev->id;
+    hello[1] = (uint8_t)(dev->id >> 8);
+    hello[2] = (uint8_t)(dev->id >> 16);
+    hello[3] = (uint8_t)(dev->id >> 24);
+    hello[4] = (uint8_t)dev->link.mtu_max;
+    hello[5] = (uint8_t)(dev->link.mtu_max >> 8);
+    send(ctx, EMU_OP_HELLO, 0, hello, (uint16_t)(6 + n));
+}
+
+void emu_device_disconnect(emu_device_t *dev) {
+    if (dev->active) dev->stats.transfers_aborted++;
+    reset_transfer(dev);
+    dev->connected = false;
+    dev->cccd_mask = 0;
+    dev->send = NULL;
+    dev->send_ctx = NULL;
+}
+
+static int latest_recording(const emu_device_t *dev) {
+    int best = -1;
+    for (int i = 0; i < dev->num_recs; i++) {
+        if (best < 0 || dev->recs[i].mtime > dev->recs[best].mtime) best = i;
+    }
+    return best;
+}
+
+// Common checks of file_transfer_start() / file_transfer_select_file()
+static bool can_start(emu_device_t *dev) {
+    if (dev->active || dev->xcoding) {
+        send_status(dev, STAT_ALREADY_RUNNING);
+        return false;
+    }
+    if (dev->faults.busy) {
+        send_status(dev, STAT_BUSY);
+        return false;
+    }
+    if ((dev->cccd_mask & (SUB_DATA | SUB_STATUS)) != (SUB_DATA | SUB_STATUS)) {
+        send_status(dev, STAT_SUBSCRIPTION_REQUIRED);
+        return false;
+    }
+    return true;
+}
+
+static void start_transfer(emu_device_t *dev) {
+    int idx = dev->selected >= 0 ? dev->selected : latest_recording(dev);
+    if (idx < 0 || dev->recs[idx].size == 0) {
+        send_status(dev, STAT_NO_FILE);
+        return;
+    }
+    dev->cur = idx;
+    if (dev->variant != FT_VARIANT_RAW) {
+        emu_variant_init(&dev->var, &dev->recs[idx], (speech_codec_mode_t)dev->variant);
+        dev->stats.variants++;
+    }
+    dev->offset = 0;
+    dev->seq = 0;
+    // The worker starts now, i.e. just after the last connection event
+    dev->next_produce_us = dev->next_event_us - dev->link.interval_us;
+    dev->active = true;
+    dev->paused = false;
+    dev->have_credit = false;
+    dev->tries = 0;
+    dev->credit_timeouts = 0;
+    dev->credit_wait_us = 0;
+    xfer_credit_reset(&dev->credits);
+    if (dev->pull) {
+        ft_pull_open(&dev->pl, cur_size(dev), dev->pull_block, dev->pull_cache, pull_read, dev);
+        dev->pull_last_us = s_now_us;
+        send_status(dev, STAT_PULL_READY);
+        return;
+    }
+    send_status(dev, STAT_STARTED);
+}
+
+// sync_state_ack(): the whole file's crc32c against the dock's
+static uint8_t sync_ack(emu_device_t *dev, uint32_t rec_id, uint32_t crc32c) {
+    if (dev->faults.busy) return STAT_BUSY;
+    if (rec_id > dev->num_recs) return STAT_NO_FILE;
+    const emu_recording_t *rec = &dev->recs[rec_id - 1];
+    uint8_t buf[4096];
+    uint32_t crc = 0xFFFFFFFF;
+    for (uint32_t off = 0; off < rec->size;) {
+        size_t n = emu_recording_read(rec, off, buf, sizeof(buf));
+        if (n == 0) break;
+        crc = crc32c_update(crc, buf, n);
+        off += (uint32_t)n;
+    }
+    if (crc != crc32c) {
+        dev->stats.syncs_mismatched++;
+        return STAT_SYNC_MISMATCH;
+    }
+    dev->synced |= 1u << (rec_id - 1);
+    dev->stats.syncs_acked++;
+    return STAT_SYNC_ACKED;
+}
+
+size_t emu_device_adv(const emu_device_t *dev, uint8_t *out, size_t cap) {
+    // The firmware stops advertising while connected and while recording
+    if (dev->connected || dev->faults.busy) return 0;
+    adv_state_t s = {
+        .battery_pct = dev->battery_pct,
+        .first_pending_id = REC_ID_NONE,
+        .latest_id = dev->num_recs,
+    };
+    uint64_t bytes = 0;
+    for (uint8_t i = 0; i < dev->num_recs; i++) {
+        if (dev->synced & (1u << i)) continue;
+        if (s.first_pending_id == REC_ID_NONE) s.first_pending_id = i + 1u;
+        s.pending_count++;
+        bytes += dev->recs[i].size;
+    }
+    s.pending_kb = (uint32_t)((bytes + 1023) / 1024);
+    return adv_state_encode(&s, out, cap);
+}
+
+static int find_by_path(const emu_device_t *dev, const char *path) {
+    char p[64];
+    for (int i = 0; i < dev->num_recs; i++) {
+        snprintf(p, sizeof(p), "%s/%s", EMU_REC_DIR, dev->recs[i].name);
+        if (strcmp(p, path) == 0) return i;
+    }
+    return -1;
+}
+
+static uint8_t handle_ctrl_write(emu_device_t *dev, const uint8_t *payload, uint16_t len) {
+    ft_ctrl_req_t req;
+    ft_parse_result_t pr = ft_ctrl_parse(payload, len, &req);
+    if (pr == FT_PARSE_BAD_LEN) return EMU_ATT_INVALID_VALUE_LEN;
+    if (pr != FT_PARSE_OK) {
+        send_status(dev, STAT_BAD_CMD);
+        return EMU_ATT_OK;
+    }
+
+    switch (req.cmd) {
+    case FILE_TRANSFER_CMD_START:
+        dev->variant = FT_VARIANT_RAW;
+        dev->pull = false;
+        if (can_start(dev)) start_transfer(dev);
+        break;
+
+    case FILE_TRANSFER_CMD_START_WITH_FILENAME: {
+        if (!can_start(dev)) break;
+        char path[FT_MAX_FILENAME + 32];
+        if (!ft_resolve_path(EMU_REC_DIR, req.filename, path, sizeof(path))) {
+            send_status(dev, STAT_BAD_CMD);
+            break;
+        }
+        int idx = find_by_path(dev, path);
+        if (idx < 0) {
+            send_status(dev, STAT_NO_FILE);
+            break;
+        }
+        dev->selected = idx;
+        dev->variant = FT_VARIANT_RAW;
+        dev->pull = false;
+        start_transfer(dev);
+        break;
+    }
+
+    case FILE_TRANSFER_CMD_START_BY_ID:
+    case FILE_TRANSFER_CMD_PULL: {
+        if (!can_start(dev)) break;
+        // Recording i has ID i + 1
+        if (req.rec_id > dev->num_recs) {
+            send_status(dev, STAT_NO_FILE);
+            break;
+        }
+        dev->pull = req.cmd == FILE_TRANSFER_CMD_PULL;
+        if (dev->pull) {
+            uint16_t block_max = ft_pull_block_max(dev->mtu);
+            dev->pull_block = req.pull_block ? req.pull_block : block_max;
+            if (dev->pull_block > block_max) {
+                dev->pull = false;
+                send_status(dev, STAT_BAD_CMD);
+                break;
+            }
+        }
+        dev->selected = (int)req.rec_id - 1;
+        dev->variant = req.variant;
+        // speech_transcode_variant(): the companion or the last on-demand copy, else transcode first
+        if (req.variant != FT_VARIANT_RAW && req.variant != dev->companion &&
+            !(dev->last_xcode == dev->selected && dev->last_xcode_variant == req.variant)) {
+            double audio_s = (double)dev->recs[dev->selected].samples / EMU_RAW_SAMPLE_RATE;
+            dev->xcoding = true;
+            dev->xcode_until_us = s_now_us + (uint64_t)(audio_s / dev->xcode_x * 1e6);
+            dev->last_xcode = dev->selected;
+            dev->last_xcode_variant = req.variant;
+            dev->stats.transcodes++;
+            send_status(dev, STAT_TRANSCODING);
+            break;
+        }
+        start_transfer(dev);
+        break;
+    }
+
+    case FILE_TRANSFER_CMD_SELECT_FILE: {
+        if (!can_start(dev)) break;
+        if (dev->num_recs == 0) {
+            send_status(dev, STAT_NO_FILE);
+            break;
+        }
+        // Index into the newest-first list
+        if (req.index >= dev->num_recs) {
+            send_status(dev, STAT_INVALID_INDEX);
+            break;
+        }
+        dev->selected = dev->num_recs - 1 - req.index;
+        dev->variant = FT_VARIANT_RAW;
+        dev->pull = false;
+        send_status(dev, STAT_FILE_SELECTED);
+        start_transfer(dev);
+        break;
+    }
+
+    case FILE_TRANSFER_CMD_LIST_FILES:
+        send_status(dev, STAT_LIST_READY);
+        break;
+
+    case FILE_TRANSFER_CMD_PAUSE:
+        if (dev->active) {
+            dev->paused = true;
+            send_status(dev, STAT_PAUSED);
+        }
+        break;
+
+    case FILE_TRANSFER_CMD_RESUME:
+        if (dev->active) dev->paused = false;
+        break;
+
+    case FILE_TRANSFER_CMD_READ_BLOCKS:
+        if (!dev->active || !dev->pull) {
+            send_status(dev, STAT_BAD_CMD);
+            break;
+        }
+        dev->pull_last_us = s_now_us;
+        if (ft_pull_request(&dev->pl, req.block, req.count)) {
+            dev->stats.pull_requests++;
+        } else {
+            dev->stats.pull_overruns++;
+            send_status(dev, STAT_PULL_OVERRUN);
+        }
+        break;
+
+    case FILE_TRANSFER_CMD_STOP:
+        // STOP is how a pull session ends
+        if (dev->active && dev->pull) dev->stats.transfers_ok++;
+        else if (dev->active) dev->stats.transfers_aborted++;
+        reset_transfer(dev);
+        send_status(dev, STAT_STOPPED_BY_HOST);
+        break;
+
+    case FILE_TRANSFER_CMD_PROFILE:
+        // Built without CONFIG_SALESTAG_PROFILER
+        send_status(dev, STAT_PROFILE_FAIL);
+        break;
+
+    case FILE_TRANSFER_CMD_FORMAT:
+        // The emulated card is never reformatted
+        send_status(dev, STAT_FORMAT_FAIL);
+        break;
+
+    case FILE_TRANSFER_CMD_SET_FEC:
+        // Built without CONFIG_SALESTAG_FEC; host/fecsim models FEC links
+        send_status(dev, STAT_FEC_UNAVAILABLE);
+        break;
+
+    case FILE_TRANSFER_CMD_SYNC_ACK:
+        send_status(dev, sync_ack(dev, req.rec_id, req.crc32c));
+        break;
+    }
+    return EMU_ATT_OK;
+}
+
+static void handle_read(emu_device_t *dev, uint16_t uuid) {
+    uint8_t rsp[1 + 128];
+    uint16_t n = 0;
+    rsp[0] = EMU_ATT_OK;
+
+    switch (uuid) {
+    case BLE_UUID_SALESTAG_RECORD_CTRL:
+        rsp[1] = dev->faults.busy ? 1 : 0;
+        n = 1;
+        break;
+
+    case BLE_UUID_SALESTAG_STATUS:
+        // audio_enabled, sd_available, recording, reserved, total_files (u32),
+        // battery_mv (u16, not modelled), battery_pct
+        memset(rsp + 1, 0, 11);
+        rsp[1] = 1;
+        rsp[2] = 1;
+        rsp[3] = dev->faults.busy ? 1 : 0;
+        rsp[5] = dev->num_recs;
+        rsp[11] = dev->battery_pct;
+        n = 11;
+        break;
+
+    case BLE_UUID_SALESTAG_FILE_COUNT:
+        rsp[1] = dev->num_recs;
+        rsp[2] = rsp[3] = rsp[4] = 0;
+        n = 4;
+        break;
+
+    case BLE_UUID_SALESTAG_FILE_LIST:
+        n = (uint16_t)snprintf((char *)rsp + 1, sizeof(rsp) - 1, "Feature temporarily disabled\n");
+        break;
+
+    case BLE_UUID_SALESTAG_AUTO_SELECT_LIST: {
+        int idx = latest_recording(dev);
+        if (idx < 0) {
+            n = (uint16_t)snprintf((char *)rsp + 1, sizeof(rsp) - 1, "No .raw files found\n");
+        } else {
+            n = (uint16_t)snprintf((char *)rsp + 1, sizeof(rsp) - 1, "LATEST:%s:%lu:%lu\n",
+                                   dev->recs[idx].name, (unsigned long)dev->recs[idx].size,
+                                   (unsigned long)dev->num_recs);
+        }
+        break;
+    }
+
+    case BLE_UUID_SALESTAG_FILE_STATUS:
+        rsp[0] = EMU_ATT_READ_NOT_PERMITTED;
+        break;
+
+    default:
+        rsp[0] = EMU_ATT_UNLIKELY;
+        break;
+    }
+    dev->send(dev->send_ctx, EMU_OP_READ_RSP, uuid, rsp, (uint16_t)(1 + n));
+}
+
+void emu_device_on_frame(emu_device_t *dev, uint8_t op, uint16_t uuid, const uint8_t *payload, uint16_t len) {
+    if (!dev->connected) return;
+
+    switch (op) {
+    case EMU_OP_MTU: {
+        uint16_t req = len >= 2 ? (uint16_t)(payload[0] | (payload[1] << 8)) : 23;
+        uint16_t mtu = req < dev->link.mtu_max ? req : dev->link.mtu_max;
+        if (mtu < 23) mtu = 23;
+        dev->mtu = mtu;
+        uint8_t rsp[2] = { (uint8_t)mtu, (uint8_t)(mtu >> 8) };
+        dev->send(dev->send_ctx, EMU_OP_MTU, 0, rsp, 2);
+        break;
+    }
+
+    case EMU_OP_SUBSCRIBE: {
+        uint8_t bit = uuid == BLE_UUID_SALESTAG_FILE_DATA ? SUB_DATA
+                    : uuid == BLE_UUID_SALESTAG_FILE_STATUS ? SUB_STATUS : 0;
+        if (len >= 1 && payload[0]) dev->cccd_mask |= bit;
+        else dev->cccd_mask &= (uint8_t)~bit;
+        break;
+    }
+
+    case EMU_OP_WRITE: {
+        uint8_t att = EMU_ATT_OK;
+        if (uuid == BLE_UUID_SALESTAG_FILE_CTRL) {
+            att = handle_ctrl_write(dev, payload, len);
+        } else if (uuid == BLE_UUID_SALESTAG_RECORD_CTRL) {
+            // BLE recording control is disabled on the tag - accepted and ignored
+            att = len == 1 ? EMU_ATT_OK : EMU_ATT_INVALID_VALUE_LEN;
+        } else if (uuid == BLE_UUID_SALESTAG_FILE_DATA) {
+            att = EMU_ATT_WRITE_NOT_PERMITTED;
+        } else {
+            att = EMU_ATT_UNLIKELY;
+        }
+        // A STOP/START above may have sent status first, as on the tag
+        if (dev->connected) dev->send(dev->send_ctx, EMU_OP_WRITE_RSP, uuid, &att, 1);
+        break;
+    }
+
+    case EMU_OP_READ:
+        handle_read(dev, uuid);
+        break;
+
+    default:
+        break;
+    }
+}
+
+// Give up on the current chunk as the worker does after FT_MAX_RETRIES
+static void abort_chunk(emu_device_t *dev, fi_point_t p, uint8_t status) {
+    fi_lost(&dev->fi, p, cur_size(dev) - dev->offset);
+    if (dev->have_credit) xfer_credit_give(&dev->credits);
+    send_status(dev, status);
+    dev->stats.transfers_aborted++;
+    reset_transfer(dev);
+}
+
+// Wait for a data credit; reclaims credits whose NOTIFY_TX never came
+static bool take_credit(emu_device_t *dev, uint64_t now_us) {
+    if (dev->have_credit) return true;
+    // Reclaimed credits can outrun the controller queue; it holds XFER_MAX_INFLIGHT
+    if (dev->txq_count < XFER_MAX_INFLIGHT && xfer_credit_take(&dev->credits)) {
+        dev->have_credit = true;
+        dev->credit_wait_us = 0;
+        dev->credit_timeouts = 0;
+        // Also closes an episode that ended with a reclaim
+        fi_ok(&dev->fi, FI_NOTIFY_TX_LOST);
+        return true;
+    }
+    if (dev->credit_wait_us == 0) {
+        dev->credit_wait_us = now_us;
+    } else if (now_us - dev->credit_wait_us >= FT_CREDIT_WAIT_MS * 1000ULL) {
+        dev->credit_wait_us = now_us;
+        fi_failed(&dev->fi, FI_NOTIFY_TX_LOST);
+        if (++dev->credit_timeouts >= FT_CREDIT_RECLAIM_TIMEOUTS) {
+            xfer_credit_reset(&dev->credits);
+            dev->credit_timeouts = 0;
+            dev->stats.credits_reclaimed++;
+        }
+    }
+    return false;
+}
+
+// file_xfer_task(): take a credit, read a chunk, hand the notification to the stack
+static void produce(emu_device_t *dev, uint64_t now_us) {
+    const uint32_t size = cur_size(dev);
+
+    while (dev->active && !dev->paused && dev->offset < size) {
+        if (now_us < dev->stall_until_us || now_us < dev->next_produce_us) return;
+        if (dev->faults.stall_at && !dev->stalled_once && dev->offset >= dev->faults.stall_at) {
+            dev->stalled_once = true;
+            dev->stall_until_us = now_us + (uint64_t)dev->faults.stall_ms * 1000;
+            return;
+        }
+        if (dev->faults.notify_fail_at && dev->offset >= dev->faults.notify_fail_at) {
+            send_status(dev, STAT_NOTIFY_FAIL);
+            dev->stats.transfers_aborted++;
+            reset_transfer(dev);
+            return;
+        }
+        if (!dev->have_credit) {
+            if (!take_credit(dev, now_us)) {
+                // Blocked on credits: the worker sends as soon as one comes back
+                dev->next_produce_us = now_us;
+                return;
+            }
+            if (fi_hit(&dev->fi, FI_SD_LATENCY, dev->offset)) {
+                dev->stall_until_us = now_us + (uint64_t)fi_latency_ms(&dev->fi, FI_SD_LATENCY) * 1000;
+                return;
+            }
+        }
+        if (fi_hit(&dev->fi, FI_SD_READ, dev->offset)) {
+            fi_failed(&dev->fi, FI_SD_READ);
+            abort_chunk(dev, FI_SD_READ, STAT_FILE_READ_FAIL);
+            return;
+        }
+        if (fi_hit(&dev->fi, FI_MBUF_ALLOC, dev->offset)) {
+            fi_failed(&dev->fi, FI_MBUF_ALLOC);
+            if (++dev->tries < FT_MAX_RETRIES) {
+                dev->next_produce_us = now_us + ft_mbuf_backoff_ms(dev->tries) * 1000ULL;
+                return;
+            }
+            abort_chunk(dev, FI_MBUF_ALLOC, STAT_NOTIFY_FAIL);
+            return;
+        }
+        fi_point_t rejected = FI_POINT_COUNT;
+        if (fi_hit(&dev->fi, FI_NOTIFY_ECONTROLLER, dev->offset)) {
+            rejected = FI_NOTIFY_ECONTROLLER;
+        } else if (fi_hit(&dev->fi, FI_NOTIFY_EBUSY, dev->offset)) {
+            rejected = FI_NOTIFY_EBUSY;
+        }
+        if (rejected != FI_POINT_COUNT) {
+            fi_failed(&dev->fi, rejected);
+            if (++dev->tries < FT_MAX_RETRIES) {
+                dev->next_produce_us = now_us + 8000;
+                return;
+            }
+            abort_chunk(dev, rejected, STAT_NOTIFY_FAIL);
+            return;
+        }
+        fi_ok(&dev->fi, FI_MBUF_ALLOC);
+        fi_ok(&dev->fi, FI_NOTIFY_ECONTROLLER);
+        fi_ok(&dev->fi, FI_NOTIFY_EBUSY);
+        dev->have_credit = false;
+        dev->tries = 0;
+
+        emu_pdu_t *pdu = &dev->txq[(dev->txq_head + dev->txq_count) % XFER_MAX_INFLIGHT];
+        size_t budget = ft_payload_budget(dev->mtu);
+        size_t n = cur_read(dev, dev->offset, pdu->data + FILE_TRANSFER_HEADER_SIZE, budget);
+        bool eof = dev->offset + n >= size;
+        ft_pkt_header_encode(pdu->data, dev->seq, (uint16_t)n, eof);
+        pdu->len = (uint16_t)(FILE_TRANSFER_HEADER_SIZE + n);
+        dev->txq_count++;
+
+        dev->offset += (uint32_t)n;
+        dev->seq++;
+        dev->next_produce_us += dev->link.pace_us;
+
+        if (fi_hit(&dev->fi, FI_DISCONNECT, dev->offset)) {
+            fi_failed(&dev->fi, FI_DISCONNECT);
+            fi_lost(&dev->fi, FI_DISCONNECT, size - dev->offset);
+            dev->want_disconnect = true;
+            return;
+        }
+    }
+}
+
+// pull_session(): answer queued READ_BLOCKS as fast as credits allow, no pacing
+static void produce_pull(emu_device_t *dev, uint64_t now_us) {
+    while (dev->active && !dev->xcoding && ft_pull_pending(&dev->pl)) {
+        if (!take_credit(dev, now_us)) return;
+        dev->have_credit = false;
+        emu_pdu_t *pdu = &dev->txq[(dev->txq_head + dev->txq_count) % XFER_MAX_INFLIGHT];
+        dev->offset = ft_pull_next_offset(&dev->pl);
+        int n = ft_pull_next(&dev->pl, pdu->data, dev->seq);
+        if (n <= 0) {
+            xfer_credit_give(&dev->credits);
+            if (n < 0) abort_chunk(dev, FI_SD_READ, STAT_FILE_READ_FAIL);
+            return;
+        }
+        pdu->len = (uint16_t)n;
+        dev->txq_count++;
+        dev->seq++;
+    }
+}
+
+// One connection event: the controller sends queued notifications in order
+static void connection_event(emu_device_t *dev, uint64_t now_us) {
+    for (uint8_t sent = 0; sent < dev->link.pdus_per_event; sent++) {
+        // Credits returned earlier in this event can be reused straight away
+        if (dev->pull) {
+            produce_pull(dev, now_us);
+        } else {
+            produce(dev, now_us);
+        }
+        if (dev->txq_count == 0) break;
+
+        if (chance(dev, dev->link.loss)) {
+            // Not acked: retried at the next event, nothing behind it can pass
+            dev->stats.retransmits++;
+            break;
+        }
+
+        emu_pdu_t *pdu = &dev->txq[dev->txq_head];
+        dev->txq_head = (uint8_t)((dev->txq_head + 1) % XFER_MAX_INFLIGHT);
+        dev->txq_count--;
+        // BLE_GAP_EVENT_NOTIFY_TX, unless the completion is injected away
+        if (!fi_hit(&dev->fi, FI_NOTIFY_TX_LOST, 0)) {
+            xfer_credit_give(&dev->credits);
+        }
+
+        if (chance(dev, dev->faults.drop)) {
+            dev->stats.dropped++;
+            continue;
+        }
+        if (pdu->len > FILE_TRANSFER_HEADER_SIZE && chance(dev, dev->faults.corrupt)) {
+            uint32_t r = rng_next(dev);
+            pdu->data[FILE_TRANSFER_HEADER_SIZE + r % (pdu->len - FILE_TRANSFER_HEADER_SIZE)] ^= (uint8_t)(1u << ((r >> 16) & 7));
+            dev->stats.corrupted++;
+        }
+        dev->stats.data_pdus++;
+        dev->stats.data_bytes += (uint64_t)(pdu->len - FILE_TRANSFER_HEADER_SIZE);
+        if (dev->cccd_mask & SUB_DATA) deliver(dev, BLE_UUID_SALESTAG_FILE_DATA, pdu->data, pdu->len);
+    }
+}
+
+bool emu_device_tick(emu_device_t *dev, uint64_t now_us) {
+    if (!dev->connected) return true;
+    s_now_us = now_us;
+
+    while (dev->next_event_us <= now_us) {
+        if (dev->xcoding && dev->next_event_us >= dev->xcode_until_us) {
+            dev->xcoding = false;
+            start_transfer(dev);
+        }
+        rx_drain(dev, dev->next_event_us);
+        connection_event(dev, dev->next_event_us);
+
+        if (dev->pull && dev->active && !dev->xcoding && !ft_pull_pending(&dev->pl) &&
+            dev->next_event_us - dev->pull_last_us > FT_PULL_IDLE_MS * 1000ULL) {
+            // The receiver went quiet: the worker closes the session
+            dev->stats.transfers_aborted++;
+            reset_transfer(dev);
+            send_status(dev, STAT_STOPPED_BY_HOST);
+        }
+        if (!dev->pull && dev->active && dev->txq_count == 0 && dev->offset >= cur_size(dev)) {
+            dev->active = false;
+            dev->stats.transfers_ok++;
+            fi_ok(&dev->fi, FI_DISCONNECT);
+            send_status(dev, STAT_COMPLETE);
+        }
+        if (dev->faults.disconnect_at && dev->active && dev->offset >= dev->faults.disconnect_at) {
+            dev->want_disconnect = true;
+        }
+        dev->next_event_us += dev->link.interval_us;
+        if (dev->want_disconnect) return false;
+    }
+    rx_drain(dev, now_us);
+    return true;
+}
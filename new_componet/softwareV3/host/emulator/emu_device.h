@@ -0,0 +1,178 @@
+/**
+ * @file emu_device.h
+ * @brief One virtual SalesTag: GATT server, transfer worker and link model
+ *
+ * Command parsing, packet framing and the notification credit window are the
+ * firmware's own ft_proto.c and xfer_credit.c; this file only replaces the
+ * NimBLE host, the SD card and the radio.
+ */
+
+#ifndef EMU_DEVICE_H
+#define EMU_DEVICE_H
+
+#include "adv_state.h"
+#include "emu_recording.h"
+#include "fault_inject.h"
+#include "ft_proto.h"
+#include "ft_pull.h"
+#include "xfer_credit.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define EMU_MAX_RECORDINGS 16
+#define EMU_REC_DIR "/sdcard/rec"
+#define EMU_RX_MAX 128          // Notifications the phone model can hold
+
+// Radio link characteristics
+typedef struct {
+    uint16_t mtu_max;          // Largest ATT MTU the tag accepts (CONFIG_BT_NIMBLE_ATT_PREFERRED_MTU)
+    uint32_t interval_us;      // Connection interval
+    uint8_t pdus_per_event;    // Notifications the controller moves per connection event
+    double loss;               // Probability a PDU needs a link-layer retransmission
+    uint8_t credits;           // In-flight notifications per bearer (firmware: 3)
+    uint8_t bearers;           // 1 = legacy ATT, >1 = EATT channels
+    uint32_t pace_us;          // Worker delay between notifications (firmware: 4 ms)
+    uint16_t rx_queue;         // Data notifications the phone holds for the app (0 = no phone model)
+    uint32_t rx_pps;           // Notifications per second the app takes from that queue
+} emu_link_t;
+
+// Faults injected into transfers
+typedef struct {
+    uint32_t disconnect_at;    // Drop the connection after this many data bytes (0 = off)
+    uint32_t stall_at;         // Stop producing data at this byte offset ...
+    uint32_t stall_ms;         // ... for this long
+    uint32_t notify_fail_at;   // Abort with STAT_NOTIFY_FAIL at this byte offset (0 = off)
+    double drop;               // Probability a data notification is lost after its credit returns
+    double corrupt;            // Probability one payload bit is flipped
+    bool busy;                 // Tag is recording: transfer starts get STAT_BUSY
+} emu_faults_t;
+
+typedef struct {
+    uint64_t connections;
+    uint64_t data_bytes;
+    uint64_t data_pdus;
+    uint64_t retransmits;
+    uint64_t dropped;
+    uint64_t corrupted;
+    uint64_t transfers_ok;
+    uint64_t transfers_aborted;
+    uint64_t credits_reclaimed;
+    uint64_t syncs_acked;
+    uint64_t syncs_mismatched;
+    uint64_t variants;          // Transfers of a speech variant
+    uint64_t transcodes;        // ... of which transcoded on demand
+    uint64_t rx_overflow;       // Data notifications the phone's full queue dropped
+    uint64_t pull_requests;     // READ_BLOCKS accepted
+    uint64_t pull_overruns;     // ... and refused with STAT_PULL_OVERRUN
+} emu_stats_t;
+
+// Sends one frame to the connected client
+typedef void (*emu_send_fn_t)(void *ctx, uint8_t op, uint16_t uuid, const uint8_t *payload, uint16_t len);
+
+typedef struct {
+    uint16_t len;
+    uint8_t data[FT_PKT_MAX];
+} emu_pdu_t;
+
+typedef struct {
+    uint16_t uuid;
+    uint16_t len;
+    uint8_t data[FT_PKT_MAX];
+} emu_notif_t;
+
+typedef struct {
+    uint32_t id;
+    emu_link_t link;
+    emu_faults_t faults;
+    emu_recording_t recs[EMU_MAX_RECORDINGS];
+    uint8_t num_recs;
+    uint8_t battery_pct;
+    uint32_t synced;            // Bit i: recording i acknowledged by SYNC_ACK
+    uint8_t companion;          // Variant the background transcoder keeps on the card (0 = none)
+    double xcode_x;             // On-demand transcoding speed, audio seconds per second
+
+    // Connection
+    bool connected;
+    bool want_disconnect;
+    uint16_t mtu;
+    uint8_t cccd_mask;          // bit0 = Data, bit1 = Status (as in main.c)
+    emu_send_fn_t send;
+    void *send_ctx;
+
+    // Transfer worker
+    bool active;
+    bool paused;
+    bool stalled_once;
+    int selected;               // Recording chosen by SELECT_FILE/START_WITH_FILENAME, -1 = latest
+    int cur;
+    uint8_t variant;            // FT_VARIANT_* being sent; var is the file unless RAW
+    emu_variant_t var;
+    bool xcoding;               // START_BY_ID variant being transcoded until xcode_until_us
+    uint64_t xcode_until_us;
+    int last_xcode;             // Recording of the last on-demand copy (SPEECH_VARIANT_PATH), -1 = none
+    uint8_t last_xcode_variant;
+    uint32_t offset;
+    uint16_t seq;
+    xfer_credit_t credits;
+    bool have_credit;           // Credit held for the chunk being sent
+    uint8_t tries;              // mbuf/notify retries of that chunk
+    uint8_t credit_timeouts;    // FT_CREDIT_WAIT_MS periods without a credit
+    uint64_t credit_wait_us;    // Start of the current credit wait (0 = not waiting)
+
+    // Pull session (FILE_TRANSFER_CMD_PULL): blocks are sent when asked for
+    bool pull;
+    uint16_t pull_block;
+    uint64_t pull_last_us;      // Last READ_BLOCKS, for FT_PULL_IDLE_MS
+    ft_pull_t pl;
+    uint8_t pull_cache[FT_PULL_CACHE_BYTES];
+
+    // Notifications handed to the "controller", waiting for a connection event
+    emu_pdu_t txq[XFER_MAX_INFLIGHT];
+    uint8_t txq_head;
+    uint8_t txq_count;
+
+    // Notifications the phone received and the app has not taken yet (link.rx_queue)
+    emu_notif_t rxq[EMU_RX_MAX];
+    uint8_t rxq_head;
+    uint8_t rxq_count;
+    uint64_t rx_drain_us;
+
+    uint64_t next_event_us;
+    uint64_t next_produce_us;
+    uint64_t stall_until_us;
+    uint32_t rng;
+    emu_stats_t stats;
+    fi_ctx_t fi;                // Seeded fault injection, same rules as CONFIG_SALESTAG_FAULT_INJECT
+} emu_device_t;
+
+void emu_device_init(emu_device_t *dev, uint32_t id, const emu_link_t *link, const emu_faults_t *faults,
+                     uint8_t recordings, uint32_t seconds);
+
+/**
+ * @brief Load a fault_inject.h scenario; the device's PRNG is seeded with seed + id
+ * @return Number of rules, or -1 on a syntax error
+ */
+int emu_device_set_scenario(emu_device_t *dev, const char *spec, uint32_t seed);
+
+void emu_device_connect(emu_device_t *dev, emu_send_fn_t send, void *ctx, uint64_t now_us);
+
+void emu_device_disconnect(emu_device_t *dev);
+
+/**
+ * @brief Handle one frame from the client (emu_wire.h)
+ */
+void emu_device_on_frame(emu_device_t *dev, uint8_t op, uint16_t uuid, const uint8_t *payload, uint16_t len);
+
+/**
+ * @brief Manufacturer data the tag advertises (adv_state.h)
+ * @return Bytes written, 0 while it does not advertise (connected or recording)
+ */
+size_t emu_device_adv(const emu_device_t *dev, uint8_t *out, size_t cap);
+
+/**
+ * @brief Run every connection event due at now_us
+ * @return false if the tag wants to drop the connection (fault injection)
+ */
+bool emu_device_tick(emu_device_t *dev, uint64_t now_us);
+
+#endif // EMU_DEVICE_H
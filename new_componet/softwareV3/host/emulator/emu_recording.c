@@ -0,0 +1,152 @@
+/**
+ * @file emu_recording.c
+ * @brief Synthetic RAW v1 recordings (see emu_recording.h)
+ */
+
+#include "emu_recording.h"
+#include "rec_id.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+static inline void put_u32_le(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static inline uint32_t mix32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352dU;
+    x ^= x >> 15;
+    x *= 0x846ca68bU;
+    x ^= x >> 16;
+    return x;
+}
+
+void emu_recording_init(emu_recording_t *rec, uint32_t device_id, uint32_t index, uint32_t seconds) {
+    memset(rec, 0, sizeof(*rec));
+    // Same naming as the tag's recording IDs
+    rec_id_format(index + 1, rec->name, sizeof(rec->name));
+    rec->seed = mix32(device_id * 7919U + index + 1);
+    rec->samples = seconds * EMU_RAW_SAMPLE_RATE;
+    rec->start_ms = 1000 + index * (seconds + 5) * 1000;
+    rec->size = EMU_RAW_HEADER_SIZE + rec->samples * EMU_RAW_SAMPLE_SIZE;
+    rec->mtime = 1700000000U + index * 60;
+}
+
+static uint16_t sample_value(const emu_recording_t *rec, uint32_t i) {
+    // Tone in the speech band plus noise, centred like the MAX9814 output
+    double freq = 150.0 + (double)(rec->seed % 400);
+    double t = (double)i / EMU_RAW_SAMPLE_RATE;
+    int v = 2048 + (int)(600.0 * sin(2.0 * M_PI * freq * t));
+    v += (int)(mix32(rec->seed ^ i) & 0x3F) - 32;
+    if (v < 0) v = 0;
+    if (v > 4095) v = 4095;
+    return (uint16_t)v;
+}
+
+static void fill_header(const emu_recording_t *rec, uint8_t hdr[EMU_RAW_HEADER_SIZE]) {
+    memset(hdr, 0, EMU_RAW_HEADER_SIZE);
+    put_u32_le(hdr + 0,  0x52415741);  // "RAWA"
+    put_u32_le(hdr + 4,  1);
+    put_u32_le(hdr + 8,  EMU_RAW_SAMPLE_RATE);
+    put_u32_le(hdr + 12, rec->samples);
+    put_u32_le(hdr + 16, rec->start_ms);
+    put_u32_le(hdr + 20, rec->start_ms + rec->samples / (EMU_RAW_SAMPLE_RATE / 1000));
+}
+
+static void fill_sample(const emu_recording_t *rec, uint32_t i, uint8_t out[EMU_RAW_SAMPLE_SIZE]) {
+    uint16_t mic = sample_value(rec, i);
+    out[0] = (uint8_t)mic;
+    out[1] = (uint8_t)(mic >> 8);
+    put_u32_le(out + 2, rec->start_ms + i / (EMU_RAW_SAMPLE_RATE / 1000));
+    put_u32_le(out + 6, i);
+}
+
+size_t emu_recording_read(const emu_recording_t *rec, uint32_t offset, uint8_t *out, size_t len) {
+    if (offset >= rec->size) return 0;
+    if (len > rec->size - offset) len = rec->size - offset;
+
+    size_t done = 0;
+    if (offset < EMU_RAW_HEADER_SIZE) {
+        uint8_t hdr[EMU_RAW_HEADER_SIZE];
+        fill_header(rec, hdr);
+        size_t n = EMU_RAW_HEADER_SIZE - offset;
+        if (n > len) n = len;
+        memcpy(out, hdr + offset, n);
+        done = n;
+    }
+
+    while (done < len) {
+        uint32_t pos = offset + (uint32_t)done - EMU_RAW_HEADER_SIZE;
+        uint32_t i = pos / EMU_RAW_SAMPLE_SIZE;
+        uint32_t within = pos % EMU_RAW_SAMPLE_SIZE;
+        uint8_t s[EMU_RAW_SAMPLE_SIZE];
+        fill_sample(rec, i, s);
+        size_t n = EMU_RAW_SAMPLE_SIZE - within;
+        if (n > len - done) n = len - done;
+        memcpy(out + done, s + within, n);
+        done += n;
+    }
+    return done;
+}
+
+void emu_variant_init(emu_variant_t *v, const emu_recording_t *rec, speech_codec_mode_t mode) {
+    memset(v, 0, sizeof(*v));
+    v->rec = rec;
+    v->mode = mode;
+    v->frames = (rec->samples + SPEECH_FRAME_SAMPLES_IN - 1) / SPEECH_FRAME_SAMPLES_IN;
+    v->size = EMU_RAW_HEADER_SIZE + v->frames * (uint32_t)speech_codec_frame_bytes(mode);
+    v->buf_frame = UINT32_MAX;
+    speech_encoder_init(&v->enc, mode);
+}
+
+// Encode frames until buf holds frame k
+static void variant_seek(emu_variant_t *v, uint32_t k) {
+    if (v->buf_frame == k) return;
+    if (k < v->next_frame) {
+        speech_encoder_init(&v->enc, v->mode);
+        v->next_frame = 0;
+    }
+    int16_t pcm[SPEECH_FRAME_SAMPLES_IN];
+    while (v->next_frame <= k) {
+        uint32_t first = v->next_frame * SPEECH_FRAME_SAMPLES_IN;
+        for (uint32_t i = 0; i < SPEECH_FRAME_SAMPLES_IN; i++) {
+            // The final partial frame is padded with silence
+            pcm[i] = first + i < v->rec->samples ? speech_codec_adc_to_pcm(sample_value(v->rec, first + i)) : 0;
+        }
+        speech_encoder_encode_frame(&v->enc, pcm, v->buf);
+        v->buf_frame = v->next_frame++;
+    }
+}
+
+size_t emu_variant_read(emu_variant_t *v, uint32_t offset, uint8_t *out, size_t len) {
+    if (offset >= v->size) return 0;
+    if (len > v->size - offset) len = v->size - offset;
+
+    size_t done = 0;
+    if (offset < EMU_RAW_HEADER_SIZE) {
+        const emu_recording_t *rec = v->rec;
+        uint8_t hdr[EMU_RAW_HEADER_SIZE];
+        speech_file_header_fill(hdr, v->mode, v->frames, rec->samples, rec->start_ms,
+                                rec->start_ms + rec->samples / (EMU_RAW_SAMPLE_RATE / 1000));
+        size_t n = EMU_RAW_HEADER_SIZE - offset;
+        if (n > len) n = len;
+        memcpy(out, hdr + offset, n);
+        done = n;
+    }
+
+    size_t fb = speech_codec_frame_bytes(v->mode);
+    while (done < len) {
+        uint32_t pos = offset + (uint32_t)done - EMU_RAW_HEADER_SIZE;
+        variant_seek(v, (uint32_t)(pos / fb));
+        size_t within = pos % fb;
+        size_t n = fb - within;
+        if (n > len - done) n = len - done;
+        memcpy(out + done, v->buf + within, n);
+        done += n;
+    }
+    return done;
+}
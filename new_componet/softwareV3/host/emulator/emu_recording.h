@@ -0,0 +1,67 @@
+/**
+ * @file emu_recording.h
+ * @brief Synthetic RAW v1 recordings for virtual tags
+ *
+ * Content is a pure function of (seed, offset), so a fleet of hundreds of
+ * tags with long recordings costs no memory and every download can be
+ * verified byte-for-byte by regenerating it.
+ */
+
+#ifndef EMU_RECORDING_H
+#define EMU_RECORDING_H
+
+#include "speech_codec.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#define EMU_RAW_HEADER_SIZE  32
+#define EMU_RAW_SAMPLE_SIZE  10
+#define EMU_RAW_SAMPLE_RATE  16000
+
+typedef struct {
+    char name[32];          // e.g. "r0000001.raw"
+    uint32_t seed;
+    uint32_t samples;
+    uint32_t start_ms;
+    uint32_t size;          // Header + samples, bytes
+    uint32_t mtime;         // Newer recordings have larger mtime
+} emu_recording_t;
+
+/**
+ * @brief Describe a recording of the given length
+ */
+void emu_recording_init(emu_recording_t *rec, uint32_t device_id, uint32_t index, uint32_t seconds);
+
+/**
+ * @brief Produce len bytes of the file starting at offset
+ * @return Bytes produced (short at end of file)
+ */
+size_t emu_recording_read(const emu_recording_t *rec, uint32_t offset, uint8_t *out, size_t len);
+
+// A speech variant of a recording (START_BY_ID with a variant), encoded as it is read
+typedef struct {
+    const emu_recording_t *rec;
+    speech_codec_mode_t mode;
+    uint32_t frames;
+    uint32_t size;              // Header + frames, bytes
+    speech_encoder_t enc;
+    uint32_t next_frame;        // Frame the encoder produces next
+    uint32_t buf_frame;         // Frame held in buf, UINT32_MAX = none
+    uint8_t buf[SPEECH_FRAME_MAX_BYTES];
+} emu_variant_t;
+
+/**
+ * @brief Describe rec encoded as speech_transcode_file() would encode it
+ */
+void emu_variant_init(emu_variant_t *v, const emu_recording_t *rec, speech_codec_mode_t mode);
+
+/**
+ * @brief Produce len bytes of the variant starting at offset
+ *
+ * Frames depend on the encoder state of all earlier ones, so reading is
+ * cheap going forward and starts over from frame 0 going back.
+ * @return Bytes produced (short at end of file)
+ */
+size_t emu_variant_read(emu_variant_t *v, uint32_t offset, uint8_t *out, size_t len);
+
+#endif // EMU_RECORDING_H
@@ -0,0 +1,65 @@
+/**
+ * @file emu_wire.h
+ * @brief Socket framing that stands in for GATT between emulated tags and clients
+ *
+ * Every frame is [op u8][uuid u16 LE][len u16 LE][payload], where uuid is the
+ * 16-bit characteristic UUID from ft_proto.h. One TCP connection is one BLE
+ * connection to one virtual tag.
+ *
+ *   client -> tag   EMU_OP_MTU        payload: requested ATT MTU (u16 LE)
+ *   tag -> client   EMU_OP_MTU        payload: negotiated ATT MTU (u16 LE)
+ *   client -> tag   EMU_OP_SUBSCRIBE  payload: 1 = enable notifications, 0 = disable
+ *   client -> tag   EMU_OP_WRITE      payload: characteristic value
+ *   tag -> client   EMU_OP_WRITE_RSP  payload: ATT error (u8, 0 = success)
+ *   client -> tag   EMU_OP_READ       no payload
+ *   tag -> client   EMU_OP_READ_RSP   payload: ATT error (u8) followed by the value
+ *   tag -> client   EMU_OP_NOTIFY     payload: notification value
+ *   tag -> client   EMU_OP_HELLO      payload: device id (u32 LE), MTU (u16 LE), name
+ *
+ * Advertising (--adv-port) is one UDP datagram per advertising interval from
+ * each tag that is neither connected nor recording, sent to the scanner port
+ * on 127.0.0.1:
+ *
+ *   [device id u32 LE][TCP port u16 LE][manufacturer data, main/adv_state.h]
+ */
+
+#ifndef EMU_WIRE_H
+#define EMU_WIRE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define EMU_OP_HELLO      0x00
+#define EMU_OP_MTU        0x01
+#define EMU_OP_SUBSCRIBE  0x02
+#define EMU_OP_WRITE      0x03
+#define EMU_OP_WRITE_RSP  0x04
+#define EMU_OP_READ       0x05
+#define EMU_OP_READ_RSP   0x06
+#define EMU_OP_NOTIFY     0x07
+
+#define EMU_FRAME_HDR     5
+#define EMU_FRAME_MAX     (EMU_FRAME_HDR + 1024)
+
+#define EMU_ADV_HDR       6
+#define EMU_ADV_MAX       (EMU_ADV_HDR + 31)
+
+// ATT error codes the emulated GATT server can return
+#define EMU_ATT_OK                    0x00
+#define EMU_ATT_READ_NOT_PERMITTED    0x02
+#define EMU_ATT_WRITE_NOT_PERMITTED   0x03
+#define EMU_ATT_INVALID_VALUE_LEN     0x0D
+#define EMU_ATT_UNLIKELY              0x0E
+
+static inline size_t emu_frame_encode(uint8_t *out, uint8_t op, uint16_t uuid,
+                                      const uint8_t *payload, uint16_t len) {
+    out[0] = op;
+    out[1] = (uint8_t)uuid;
+    out[2] = (uint8_t)(uuid >> 8);
+    out[3] = (uint8_t)len;
+    out[4] = (uint8_t)(len >> 8);
+    for (uint16_t i = 0; i < len; i++) out[EMU_FRAME_HDR + i] = payload[i];
+    return EMU_FRAME_HDR + (size_t)len;
+}
+
+#endif // EMU_WIRE_H
@@ -0,0 +1,607 @@
+/**
+ * @file salestag_emu.c
+ * @brief Fleet of virtual SalesTags served over local TCP sockets
+ *
+ * Device i listens on base_port + i; a TCP connection stands in for a BLE
+ * connection and carries the emu_wire.h framing. Everything runs in one
+ * poll() loop so hundreds of devices cost a few hundred file descriptors.
+ *
+ *   salestag_emu --devices 500 --interval-ms 30 --loss 0.02 --fault drop=0.001
+ *   salestag_emu --devices 50 --scenario "notify_ebusy:p=0.02;mbuf_alloc:p=0.01,burst=3" --seed 7
+ *   salestag_emu --devices 40 --adv-port 46999     # advertise to host/dock's scanner
+ *   salestag_emu --rx-queue 32 --rx-pps 400        # a phone that buffers 32 notifications
+ *   salestag_emu --devices 20 --sim 600 --scenario "..." --seed 7   # no sockets, simulated time
+ *
+ * With --sim there are no sockets: each tag gets an in-process downloader
+ * that connects, STARTs, and STARTs again when a transfer ends, and the
+ * fleet runs on a simulated clock from one connection event to the next.
+ * The output then depends only on the options, so a seeded --scenario run
+ * gives the same report every time (make check).
+ */
+
+#include "emu_alloc.h"
+#include "emu_device.h"
+#include "emu_wire.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TX_BUF_MAX       (256 * 1024)
+#define TX_BACKPRESSURE  (64 * 1024)   // Client not draining: hold connection events
+#define SIM_RECONNECT_US 1000000       // --sim: the downloader reconnects a second after a drop
+
+typedef struct {
+    emu_device_t dev;
+    int listen_fd;
+    int fd;
+    uint8_t rx[EMU_FRAME_MAX];
+    size_t rx_len;
+    uint8_t *tx;
+    size_t tx_len;
+    bool tx_overflow;
+
+    // --sim downloader
+    bool restart;               // A transfer ended: START again
+    uint64_t reconnect_us;      // Connect again at this time while disconnected
+    uint16_t next_seq;
+    uint64_t gaps;              // Data notifications missing from the sequence
+} emu_slot_t;
+
+static volatile sig_atomic_t s_stop = 0;
+static bool s_verbose = true;
+
+static uint64_t now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static void on_signal(int sig) {
+    (void)sig;
+    s_stop = 1;
+}
+
+static void slot_send(void *ctx, uint8_t op, uint16_t uuid, const uint8_t *payload, uint16_t len) {
+    emu_slot_t *s = ctx;
+    if (s->tx_len + EMU_FRAME_HDR + len > TX_BUF_MAX) {
+        s->tx_overflow = true;
+        return;
+    }
+    s->tx_len += emu_frame_encode(s->tx + s->tx_len, op, uuid, payload, len);
+}
+
+static void slot_close(emu_slot_t *s) {
+    if (s->fd < 0) return;
+    emu_device_disconnect(&s->dev);
+    close(s->fd);
+    s->fd = -1;
+    s->rx_len = 0;
+    s->tx_len = 0;
+    s->tx_overflow = false;
+    if (s_verbose) printf("[%04u] disconnected\n", (unsigned)s->dev.id);
+}
+
+static bool slot_flush(emu_slot_t *s) {
+    while (s->tx_len > 0) {
+        ssize_t n = send(s->fd, s->tx, s->tx_len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+            if (errno == EINTR) continue;
+            return false;
+        }
+        memmove(s->tx, s->tx + n, s->tx_len - (size_t)n);
+        s->tx_len -= (size_t)n;
+    }
+    return true;
+}
+
+static bool slot_read(emu_slot_t *s) {
+    ssize_t n = recv(s->fd, s->rx + s->rx_len, sizeof(s->rx) - s->rx_len, 0);
+    if (n == 0) return false;
+    if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    s->rx_len += (size_t)n;
+
+    size_t pos = 0;
+    while (s->rx_len - pos >= EMU_FRAME_HDR) {
+        const uint8_t *f = s->rx + pos;
+        uint16_t len = (uint16_t)(f[3] | (f[4] << 8));
+        if (EMU_FRAME_HDR + (size_t)len > sizeof(s->rx)) return false;  // Malformed client
+        if (s->rx_len - pos < EMU_FRAME_HDR + (size_t)len) break;
+        emu_device_on_frame(&s->dev, f[0], (uint16_t)(f[1] | (f[2] << 8)), f + EMU_FRAME_HDR, len);
+        pos += EMU_FRAME_HDR + len;
+    }
+    memmove(s->rx, s->rx + pos, s->rx_len - pos);
+    s->rx_len -= pos;
+    return true;
+}
+
+// Scanner side of the advertising channel (emu_wire.h)
+static int open_advertiser(uint16_t port, struct sockaddr_in *to) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) return -1;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    *to = (struct sockaddr_in){ .sin_family = AF_INET, .sin_port = htons(port),
+                                .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    return fd;
+}
+
+static void slot_advertise(const emu_slot_t *s, int fd, const struct sockaddr_in *to, uint16_t tcp_port) {
+    uint8_t adv[EMU_ADV_MAX];
+    size_t n = emu_device_adv(&s->dev, adv + EMU_ADV_HDR, sizeof(adv) - EMU_ADV_HDR);
+    if (n == 0) return;
+    adv[0] = (uint8_t)s->dev.id;
+    adv[1] = (uint8_t)(s->dev.id >> 8);
+    adv[2] = (uint8_t)(s->dev.id >> 16);
+    adv[3] = (uint8_t)(s->dev.id >> 24);
+    adv[4] = (uint8_t)tcp_port;
+    adv[5] = (uint8_t)(tcp_port >> 8);
+    // A scanner that is not listening just misses advertisements, as over the air
+    sendto(fd, adv, EMU_ADV_HDR + n, 0, (const struct sockaddr *)to, sizeof(*to));
+}
+
+static int open_listener(const char *bind_addr, uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in sa = { .sin_family = AF_INET, .sin_port = htons(port) };
+    if (inet_pton(AF_INET, bind_addr, &sa.sin_addr) != 1 ||
+        bind(fd, (struct sockaddr *)&sa, sizeof(sa)) != 0 || listen(fd, 4) != 0) {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+static void slot_accept(emu_slot_t *s) {
+    int fd = accept(s->listen_fd, NULL, NULL);
+    if (fd < 0) return;
+    if (s->fd >= 0) {
+        // The tag serves one transfer client at a time
+        close(fd);
+        return;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    s->fd = fd;
+    emu_device_connect(&s->dev, slot_send, s, now_us());
+    if (s_verbose) printf("[%04u] connected\n", (unsigned)s->dev.id);
+}
+
+static bool parse_faults(char *spec, emu_faults_t *f) {
+    for (char *tok = strtok(spec, ","); tok; tok = strtok(NULL, ",")) {
+        char *eq = strchr(tok, '=');
+        const char *val = eq ? eq + 1 : "";
+        if (eq) *eq = '\0';
+
+        if (strcmp(tok, "busy") == 0) {
+            f->busy = true;
+        } else if (strcmp(tok, "disconnect") == 0) {
+            f->disconnect_at = (uint32_t)strtoul(val, NULL, 0);
+        } else if (strcmp(tok, "notify-fail") == 0) {
+            f->notify_fail_at = (uint32_t)strtoul(val, NULL, 0);
+        } else if (strcmp(tok, "stall") == 0) {
+            char *colon = NULL;
+            f->stall_at = (uint32_t)strtoul(val, &colon, 0);
+            f->stall_ms = (colon && *colon == ':') ? (uint32_t)strtoul(colon + 1, NULL, 0) : 1000;
+        } else if (strcmp(tok, "drop") == 0) {
+            f->drop = atof(val);
+        } else if (strcmp(tok, "corrupt") == 0) {
+            f->corrupt = atof(val);
+        } else {
+            fprintf(stderr, "unknown fault '%s'\n", tok);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void print_stats(const emu_slot_t *slots, int n, double elapsed_s) {
+    emu_stats_t t = { 0 };
+    int connected = 0, active = 0;
+    for (int i = 0; i < n; i++) {
+        const emu_stats_t *s = &slots[i].dev.stats;
+        t.connections += s->connections;
+        t.data_bytes += s->data_bytes;
+        t.data_pdus += s->data_pdus;
+        t.retransmits += s->retransmits;
+        t.dropped += s->dropped;
+        t.corrupted += s->corrupted;
+        t.transfers_ok += s->transfers_ok;
+        t.transfers_aborted += s->transfers_aborted;
+        t.credits_reclaimed += s->credits_reclaimed;
+        t.syncs_acked += s->syncs_acked;
+        t.syncs_mismatched += s->syncs_mismatched;
+        t.variants += s->variants;
+        t.transcodes += s->transcodes;
+        t.rx_overflow += s->rx_overflow;
+        t.pull_requests += s->pull_requests;
+        t.pull_overruns += s->pull_overruns;
+        connected += slots[i].dev.connected;
+        active += slots[i].dev.active;
+    }
+    printf("t=%.1fs conn=%d active=%d transfers ok=%llu aborted=%llu bytes=%llu (%.1f KB/s) "
+           "pdus=%llu retx=%llu dropped=%llu corrupted=%llu reclaims=%llu synced=%llu mismatched=%llu "
+           "variants=%llu transcoded=%llu rx_overflow=%llu reads=%llu overruns=%llu\n",
+           elapsed_s, connected, active,
+           (unsigned long long)t.transfers_ok, (unsigned long long)t.transfers_aborted,
+           (unsigned long long)t.data_bytes, elapsed_s > 0 ? t.data_bytes / 1024.0 / elapsed_s : 0.0,
+           (unsigned long long)t.data_pdus, (unsigned long long)t.retransmits,
+           (unsigned long long)t.dropped, (unsigned long long)t.corrupted,
+           (unsigned long long)t.credits_reclaimed, (unsigned long long)t.syncs_acked,
+           (unsigned long long)t.syncs_mismatched, (unsigned long long)t.variants,
+           (unsigned long long)t.transcodes, (unsigned long long)t.rx_overflow,
+           (unsigned long long)t.pull_requests, (unsigned long long)t.pull_overruns);
+    fflush(stdout);
+}
+
+// Fleet totals of the injected faults and how the transfer worker recovered
+static void print_fault_report(const emu_slot_t *slots, int n) {
+    static fi_ctx_t total;
+    static char report[FI_POINT_COUNT * 112];
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < n; i++) {
+        fi_stats_accumulate(&total, &slots[i].dev.fi);
+    }
+    if (fi_report(&total, report, sizeof(report)) > 0) {
+        printf("fault injection:\n%s", report);
+    }
+}
+
+// --sim: what the downloader sees of the tag
+static void sim_send(void *ctx, uint8_t op, uint16_t uuid, const uint8_t *payload, uint16_t len) {
+    emu_slot_t *s = ctx;
+    if (op != EMU_OP_NOTIFY || len == 0) return;
+    if (uuid == BLE_UUID_SALESTAG_FILE_STATUS) {
+        if (payload[0] == STAT_STARTED) {
+            s->next_seq = 0;
+        } else {
+            s->restart = true;
+        }
+        return;
+    }
+    ft_pkt_header_t h;
+    if (uuid == BLE_UUID_SALESTAG_FILE_DATA && ft_pkt_header_decode(payload, len, &h)) {
+        s->gaps += (uint16_t)(h.seq - s->next_seq);
+        s->next_seq = (uint16_t)(h.seq + 1);
+    }
+}
+
+static void sim_write(emu_slot_t *s, uint16_t uuid, uint8_t op, uint8_t value) {
+    emu_device_on_frame(&s->dev, op, uuid, &value, 1);
+}
+
+static void sim_connect(emu_slot_t *s, uint64_t now) {
+    emu_device_connect(&s->dev, sim_send, s, now);
+    uint8_t mtu[2] = { (uint8_t)s->dev.link.mtu_max, (uint8_t)(s->dev.link.mtu_max >> 8) };
+    emu_device_on_frame(&s->dev, EMU_OP_MTU, 0, mtu, sizeof(mtu));
+    sim_write(s, BLE_UUID_SALESTAG_FILE_DATA, EMU_OP_SUBSCRIBE, 1);
+    sim_write(s, BLE_UUID_SALESTAG_FILE_STATUS, EMU_OP_SUBSCRIBE, 1);
+    sim_write(s, BLE_UUID_SALESTAG_FILE_CTRL, EMU_OP_WRITE, FILE_TRANSFER_CMD_START);
+    s->restart = false;
+}
+
+// Runs the fleet for end_us of simulated time, one connection event at a time
+static void run_sim(emu_slot_t *slots, int n, uint64_t end_us) {
+    for (int i = 0; i < n; i++) sim_connect(&slots[i], 0);
+    for (;;) {
+        uint64_t now = end_us;
+        for (int i = 0; i < n; i++) {
+            const emu_slot_t *s = &slots[i];
+            uint64_t due = s->dev.connected ? s->dev.next_event_us : s->reconnect_us;
+            if (due < now) now = due;
+        }
+        if (now >= end_us) break;
+
+        for (int i = 0; i < n; i++) {
+            emu_slot_t *s = &slots[i];
+            if (!s->dev.connected) {
+                if (s->reconnect_us <= now) sim_connect(s, now);
+                continue;
+            }
+            if (s->dev.next_event_us > now) continue;
+            if (!emu_device_tick(&s->dev, now)) {
+                emu_device_disconnect(&s->dev);
+                s->reconnect_us = now + SIM_RECONNECT_US;
+                continue;
+            }
+            if (s->restart) {
+                s->restart = false;
+                sim_write(s, BLE_UUID_SALESTAG_FILE_CTRL, EMU_OP_WRITE, FILE_TRANSFER_CMD_START);
+            }
+        }
+    }
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --devices N          virtual tags (default 1)\n"
+            "  --port P             first TCP port, tag i listens on P+i (default 47000)\n"
+            "  --bind ADDR          listen address (default 127.0.0.1)\n"
+            "  --recordings K       recordings per tag (default 3, max %d)\n"
+            "  --seconds S          length of each recording (default 10)\n"
+            "  --mtu M              largest ATT MTU accepted (default 247)\n"
+            "  --interval-ms T      connection interval (default 15)\n"
+            "  --pdus-per-event N   notifications per connection event (default 6)\n"
+            "  --loss P             link-layer retransmission probability (default 0)\n"
+            "  --credits N          in-flight notifications per bearer (default 3)\n"
+            "  --bearers N          ATT bearers, >1 emulates EATT (default 1)\n"
+            "  --pace-ms T          worker delay between notifications (default 4)\n"
+            "  --rx-queue N         phone model: data notifications held for the app, max %d (default 0 = off)\n"
+            "  --rx-pps R           phone model: notifications per second the app takes (default 500)\n"
+            "  --fault SPEC         comma list: busy, disconnect=BYTES, stall=BYTES:MS,\n"
+            "                       notify-fail=BYTES, drop=P, corrupt=P\n"
+            "  --fault-every K      apply --fault and --scenario to every K-th tag only (default 1)\n"
+            "  --scenario SPEC      seeded fault injection rules (fault_inject.h syntax), e.g.\n"
+            "                       \"sd_read:p=0.0005;notify_tx_lost:p=0.001;disconnect:at=200000\"\n"
+            "  --seed N             fault injection seed, tag i uses N+i (default 1)\n"
+            "  --adv-port P         advertise sync state to a scanner on UDP 127.0.0.1:P (default off)\n"
+            "  --adv-ms T           advertising interval (default 100)\n"
+            "  --companion V        speech variant kept on the card: wb4, nb4, nb2 or none (default nb2)\n"
+            "  --xcode-x X          on-demand variant transcoding, audio seconds per second (default 10)\n"
+            "  --stats-s S          print fleet statistics every S seconds (default 5)\n"
+            "  --sim S              no sockets: S simulated seconds, an in-process downloader per tag\n"
+            "  --check-allocs       exit with status 3 if anything was heap-allocated after setup\n"
+            "  --quiet              no per-connection logs\n",
+            argv0, EMU_MAX_RECORDINGS, EMU_RX_MAX - 8);
+}
+
+int main(int argc, char **argv) {
+    int devices = 1;
+    int port = 47000;
+    const char *bind_addr = "127.0.0.1";
+    int recordings = 3;
+    int seconds = 10;
+    int fault_every = 1;
+    double stats_s = 5.0;
+    double sim_s = 0.0;
+    emu_link_t link = {
+        .mtu_max = 247,
+        .interval_us = 15000,
+        .pdus_per_event = 6,
+        .loss = 0.0,
+        .credits = 3,
+        .bearers = 1,
+        .pace_us = 4000,
+        .rx_queue = 0,
+        .rx_pps = 500,
+    };
+    emu_faults_t faults = { 0 };
+    char *fault_spec = NULL;
+    const char *scenario = NULL;
+    uint32_t seed = 1;
+    bool check_allocs = false;
+    int adv_port = 0;
+    double adv_ms = 100.0;
+    int companion = SPEECH_CODEC_NB2;
+    double xcode_x = 10.0;
+
+    static const struct option opts[] = {
+        { "devices", required_argument, 0, 'n' },
+        { "port", required_argument, 0, 'p' },
+        { "bind", required_argument, 0, 'b' },
+        { "recordings", required_argument, 0, 'r' },
+        { "seconds", required_argument, 0, 's' },
+        { "mtu", required_argument, 0, 'm' },
+        { "interval-ms", required_argument, 0, 'i' },
+        { "pdus-per-event", required_argument, 0, 'e' },
+        { "loss", required_argument, 0, 'l' },
+        { "credits", required_argument, 0, 'c' },
+        { "bearers", required_argument, 0, 'B' },
+        { "pace-ms", required_argument, 0, 'P' },
+        { "rx-queue", required_argument, 0, 'Q' },
+        { "rx-pps", required_argument, 0, 'R' },
+        { "fault", required_argument, 0, 'f' },
+        { "fault-every", required_argument, 0, 'F' },
+        { "scenario", required_argument, 0, 'x' },
+        { "seed", required_argument, 0, 'X' },
+        { "adv-port", required_argument, 0, 'a' },
+        { "adv-ms", required_argument, 0, 'I' },
+        { "companion", required_argument, 0, 'C' },
+        { "xcode-x", required_argument, 0, 'Y' },
+        { "stats-s", required_argument, 0, 'S' },
+        { "sim", required_argument, 0, 'Z' },
+        { "check-allocs", no_argument, 0, 'A' },
+        { "quiet", no_argument, 0, 'q' },
+        { "help", no_argument, 0, 'h' },
+        { 0, 0, 0, 0 },
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "n:p:qh", opts, NULL)) != -1) {
+        switch (c) {
+        case 'n': devices = atoi(optarg); break;
+        case 'p': port = atoi(optarg); break;
+        case 'b': bind_addr = optarg; break;
+        case 'r': recordings = atoi(optarg); break;
+        case 's': seconds = atoi(optarg); break;
+        case 'm': link.mtu_max = (uint16_t)atoi(optarg); break;
+        case 'i': link.interval_us = (uint32_t)(atof(optarg) * 1000.0); break;
+        case 'e': link.pdus_per_event = (uint8_t)atoi(optarg); break;
+        case 'l': link.loss = atof(optarg); break;
+        case 'c': link.credits = (uint8_t)atoi(optarg); break;
+        case 'B': link.bearers = (uint8_t)atoi(optarg); break;
+        case 'P': link.pace_us = (uint32_t)(atof(optarg) * 1000.0); break;
+        case 'Q': link.rx_queue = (uint16_t)atoi(optarg); break;
+        case 'R': link.rx_pps = (uint32_t)atoi(optarg); break;
+        case 'f': fault_spec = optarg; break;
+        case 'F': fault_every = atoi(optarg); break;
+        case 'x': scenario = optarg; break;
+        case 'X': seed = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'a': adv_port = atoi(optarg); break;
+        case 'I': adv_ms = atof(optarg); break;
+        case 'C':
+            companion = !strcmp(optarg, "wb4") ? SPEECH_CODEC_WB4 : !strcmp(optarg, "nb4") ? SPEECH_CODEC_NB4
+                      : !strcmp(optarg, "nb2") ? SPEECH_CODEC_NB2 : !strcmp(optarg, "none") ? 0 : -1;
+            break;
+        case 'Y': xcode_x = atof(optarg); break;
+        case 'S': stats_s = atof(optarg); break;
+        case 'Z': sim_s = atof(optarg); break;
+        case 'A': check_allocs = true; break;
+        case 'q': s_verbose = false; break;
+        default: usage(argv[0]); return c == 'h' ? 0 : 2;
+        }
+    }
+
+    if (devices < 1 || port < 1 || port + devices > 65535 || recordings < 0 ||
+        recordings > EMU_MAX_RECORDINGS || seconds < 1 || link.mtu_max < 23 ||
+        link.interval_us < 7500 || link.pdus_per_event < 1 || link.credits < 1 ||
+        link.bearers < 1 || link.rx_queue > EMU_RX_MAX - 8 || link.rx_pps < 1 || fault_every < 1 || adv_port < 0 || adv_port > 65535 || adv_ms < 20 ||
+        companion < 0 || xcode_x <= 0 || sim_s < 0 || (sim_s > 0 && adv_port)) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (fault_spec && !parse_faults(fault_spec, &faults)) return 2;
+
+    emu_slot_t *slots = calloc((size_t)devices, sizeof(*slots));
+    struct pollfd *pfds = calloc((size_t)devices * 2, sizeof(*pfds));
+    if (!slots || !pfds) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    const emu_faults_t no_faults = { 0 };
+    for (int i = 0; i < devices; i++) {
+        emu_slot_t *s = &slots[i];
+        const emu_faults_t *f = (i % fault_every) == 0 ? &faults : &no_faults;
+        emu_device_init(&s->dev, (uint32_t)i, &link, f, (uint8_t)recordings, (uint32_t)seconds);
+        s->dev.companion = (uint8_t)companion;
+        s->dev.xcode_x = xcode_x;
+        if (scenario && (i % fault_every) == 0 && emu_device_set_scenario(&s->dev, scenario, seed) < 0) {
+            fprintf(stderr, "invalid scenario '%s'\n", scenario);
+            return 2;
+        }
+        s->fd = -1;
+        if (sim_s > 0) continue;
+        s->tx = malloc(TX_BUF_MAX);
+        s->listen_fd = open_listener(bind_addr, (uint16_t)(port + i));
+        if (!s->tx || s->listen_fd < 0) {
+            fprintf(stderr, "cannot listen on %s:%d (%s)\n", bind_addr, port + i, strerror(errno));
+            return 1;
+        }
+    }
+
+    if (sim_s > 0) {
+        printf("%d virtual tag(s), %.0f s simulated, mtu=%u interval=%.1fms pdus/event=%u loss=%.3f bearers=%u\n",
+               devices, sim_s, link.mtu_max, link.interval_us / 1000.0, link.pdus_per_event, link.loss,
+               link.bearers);
+        emu_alloc_mark();
+        run_sim(slots, devices, (uint64_t)(sim_s * 1e6));
+        uint64_t gaps = 0;
+        for (int i = 0; i < devices; i++) gaps += slots[i].gaps;
+        print_stats(slots, devices, sim_s);
+        printf("sequence gaps at the downloaders: %llu\n", (unsigned long long)gaps);
+        print_fault_report(slots, devices);
+        uint64_t allocs = emu_alloc_since_mark();
+        printf("heap allocations since start: %llu (%llu bytes)\n", (unsigned long long)allocs,
+               (unsigned long long)emu_alloc_bytes_since_mark());
+        free(pfds);
+        free(slots);
+        return check_allocs && allocs > 0 ? 3 : 0;
+    }
+
+    struct sockaddr_in adv_to;
+    int adv_fd = -1;
+    if (adv_port > 0 && (adv_fd = open_advertiser((uint16_t)adv_port, &adv_to)) < 0) {
+        fprintf(stderr, "cannot open advertising socket (%s)\n", strerror(errno));
+        return 1;
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    printf("%d virtual tag(s) on %s:%d-%d, mtu=%u interval=%.1fms pdus/event=%u loss=%.3f bearers=%u\n",
+           devices, bind_addr, port, port + devices - 1, link.mtu_max, link.interval_us / 1000.0,
+           link.pdus_per_event, link.loss, link.bearers);
+    if (link.rx_queue) printf("phone model: %u notifications queued, app takes %u/s\n", link.rx_queue, link.rx_pps);
+    if (adv_fd >= 0) printf("advertising to udp 127.0.0.1:%d every %.0f ms\n", adv_port, adv_ms);
+    fflush(stdout);
+
+    // Like the firmware, everything a transfer needs exists before the first connection
+    emu_alloc_mark();
+
+    const uint64_t t0 = now_us();
+    uint64_t next_stats = t0 + (uint64_t)(stats_s * 1e6);
+    uint64_t next_adv = t0;
+
+    while (!s_stop) {
+        uint64_t now = now_us();
+        uint64_t deadline = now + 100000;
+        if (adv_fd >= 0 && next_adv < deadline) deadline = next_adv;
+        for (int i = 0; i < devices; i++) {
+            emu_slot_t *s = &slots[i];
+            pfds[2 * i] = (struct pollfd){ .fd = s->listen_fd, .events = POLLIN };
+            pfds[2 * i + 1] = (struct pollfd){ .fd = s->fd, .events = (short)(POLLIN | (s->tx_len ? POLLOUT : 0)) };
+            if (s->fd >= 0 && s->dev.next_event_us < deadline) deadline = s->dev.next_event_us;
+        }
+        int timeout_ms = deadline > now ? (int)((deadline - now + 999) / 1000) : 0;
+
+        if (poll(pfds, (nfds_t)devices * 2, timeout_ms) < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+
+        now = now_us();
+        for (int i = 0; i < devices; i++) {
+            emu_slot_t *s = &slots[i];
+            if (pfds[2 * i].revents & POLLIN) slot_accept(s);
+            if (s->fd < 0) continue;
+
+            short rev = pfds[2 * i + 1].fd == s->fd ? pfds[2 * i + 1].revents : 0;
+            if ((rev & (POLLERR | POLLHUP)) || ((rev & POLLIN) && !slot_read(s))) {
+                slot_close(s);
+                continue;
+            }
+
+            if (s->tx_len > TX_BACKPRESSURE) {
+                // Receiver isn't keeping up: the radio would be idle too
+                s->dev.next_event_us = now + s->dev.link.interval_us;
+            } else if (!emu_device_tick(&s->dev, now)) {
+                slot_flush(s);
+                if (s_verbose) printf("[%04u] fault: dropping connection\n", (unsigned)s->dev.id);
+                slot_close(s);
+                continue;
+            }
+
+            if (s->tx_overflow || !slot_flush(s)) slot_close(s);
+        }
+
+        if (adv_fd >= 0 && now >= next_adv) {
+            for (int i = 0; i < devices; i++) slot_advertise(&slots[i], adv_fd, &adv_to, (uint16_t)(port + i));
+            next_adv = now + (uint64_t)(adv_ms * 1000.0);
+        }
+
+        if (stats_s > 0 && now >= next_stats) {
+            print_stats(slots, devices, (now - t0) / 1e6);
+            next_stats += (uint64_t)(stats_s * 1e6);
+        }
+    }
+
+    print_stats(slots, devices, (now_us() - t0) / 1e6);
+    print_fault_report(slots, devices);
+    uint64_t allocs = emu_alloc_since_mark();
+    printf("heap allocations since start: %llu (%llu bytes)\n", (unsigned long long)allocs,
+           (unsigned long long)emu_alloc_bytes_since_mark());
+    for (int i = 0; i < devices; i++) {
+        slot_close(&slots[i]);
+        close(slots[i].listen_fd);
+        free(slots[i].tx);
+    }
+    if (adv_fd >= 0) close(adv_fd);
+    free(pfds);
+    free(slots);
+    return check_allocs && allocs > 0 ? 3 : 0;
+}
@@ -0,0 +1,197 @@
+/**
+ * @file fat_bench.c
+ * @brief Recording write and seek cost on FAT32 disk images, per cluster size
+ *
+ * For each cluster size the firmware's formatter would consider
+ * (main/fat_plan.c), lays out a sparse FAT32 image of the given card size
+ * and writes one recording into it the way the storage task does: data in
+ * buffer-sized appends, each followed by a sync that updates the FAT chain
+ * (both copies), FSINFO and the directory entry. Then it follows the chain
+ * from the start of the file to its end, as a seek to the resume offset or
+ * a transfer from a late offset does. Every metadata sector is a real
+ * read-modify-write of the image, so the timings include the host's block
+ * layer; --sync adds fdatasync per buffer for a closer model of a card.
+ *
+ *   ./fat_bench --card-gb 16 --rec-mb 256 --image /tmp/fat.img
+ */
+
+#include "fat_plan.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SECTOR          512u
+#define SYNC_BYTES      (512u * 10u)    // RAW_AUDIO_BUFFER_SIZE samples of 10 bytes
+#define FAT_EOC         0x0FFFFFFFu
+
+typedef struct {
+    int fd;
+    const fat_plan_t *p;
+    uint64_t meta_writes;
+    uint64_t meta_reads;
+    uint32_t fat_cached;            // FAT sector in win (UINT32_MAX = none)
+    uint8_t win[SECTOR];
+} image_t;
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void io(ssize_t r, const char *what) {
+    if (r != (ssize_t)SECTOR) {
+        fprintf(stderr, "%s: %s\n", what, r < 0 ? strerror(errno) : "short");
+        exit(1);
+    }
+}
+
+static void sector_read(image_t *im, uint64_t lba, uint8_t *buf) {
+    io(pread(im->fd, buf, SECTOR, (off_t)(lba * SECTOR)), "read");
+    im->meta_reads++;
+}
+
+static void sector_write(image_t *im, uint64_t lba, const uint8_t *buf) {
+    io(pwrite(im->fd, buf, SECTOR, (off_t)(lba * SECTOR)), "write");
+    im->meta_writes++;
+}
+
+// Set FAT entries first..last to a contiguous chain ending in EOC, in both copies
+static void fat_extend(image_t *im, uint32_t first, uint32_t last) {
+    const uint32_t per = SECTOR / 4;
+    for (uint32_t s = first / per; s <= last / per; s++) {
+        uint64_t lba = im->p->reserved_sectors + s;
+        sector_read(im, lba, im->win);
+        uint32_t *e = (uint32_t *)im->win;
+        for (uint32_t c = s * per; c < (s + 1) * per; c++) {
+            if (c < first || c > last) continue;
+            e[c % per] = c == last ? FAT_EOC : c + 1;
+        }
+        sector_write(im, lba, im->win);
+        sector_write(im, lba + im->p->fat_sectors, im->win);
+    }
+}
+
+static uint32_t fat_next(image_t *im, uint32_t c) {
+    const uint32_t per = SECTOR / 4;
+    uint32_t s = c / per;
+    if (s != im->fat_cached) {
+        sector_read(im, im->p->reserved_sectors + s, im->win);
+        im->fat_cached = s;
+    }
+    return ((uint32_t *)im->win)[c % per];
+}
+
+static void run(int fd, uint64_t sectors, uint32_t cluster_kb, uint64_t rec_bytes, bool sync) {
+    fat_plan_t p;
+    if (!fat_plan(sectors, SECTOR, 0, cluster_kb, &p) || p.cluster_bytes != cluster_kb * 1024) {
+        printf("%6u KB  (no FAT32 layout at this cluster size)\n", cluster_kb);
+        return;
+    }
+    if (ftruncate(fd, 0) != 0 || ftruncate(fd, (off_t)(sectors * SECTOR)) != 0) {
+        perror("ftruncate");
+        exit(1);
+    }
+
+    image_t im = { .fd = fd, .p = &p, .fat_cached = UINT32_MAX };
+    static uint8_t data[SYNC_BYTES];
+    memset(data, 0x5A, sizeof(data));
+    uint8_t dir[SECTOR];
+    uint64_t dir_lba = p.data_start;        // Cluster 2 holds the recording directory
+    uint64_t fsinfo_lba = 1;
+    const uint32_t first_cluster = 3;
+
+    // Write: append, then sync the chain, FSINFO and directory entry
+    double t0 = now_s();
+    uint64_t written = 0;
+    uint32_t clusters = 0;
+    while (written < rec_bytes) {
+        uint64_t off = written;
+        uint32_t n = rec_bytes - written < SYNC_BYTES ? (uint32_t)(rec_bytes - written) : SYNC_BYTES;
+        uint64_t pos = (uint64_t)p.data_start * SECTOR + (uint64_t)(first_cluster - 2) * p.cluster_bytes + off;
+        if (pwrite(fd, data, n, (off_t)pos) != (ssize_t)n) {
+            perror("pwrite");
+            exit(1);
+        }
+        written += n;
+
+        uint32_t need = (uint32_t)((written + p.cluster_bytes - 1) / p.cluster_bytes);
+        if (need > clusters) {
+            uint32_t from = clusters ? first_cluster + clusters - 1 : first_cluster;
+            fat_extend(&im, from, first_cluster + need - 1);
+            sector_read(&im, fsinfo_lba, dir);
+            sector_write(&im, fsinfo_lba, dir);
+            clusters = need;
+        }
+        sector_read(&im, dir_lba, dir);
+        memcpy(dir + 28, &written, 4);
+        sector_write(&im, dir_lba, dir);
+        if (sync) fdatasync(fd);
+    }
+    double write_s = now_s() - t0;
+    uint64_t write_meta = im.meta_writes;
+
+    // Seek: follow the chain from the first cluster to the last
+    im.meta_reads = 0;
+    im.fat_cached = UINT32_MAX;
+    t0 = now_s();
+    uint32_t c = first_cluster;
+    uint32_t hops = 0;
+    while (c != FAT_EOC && c >= 2 && c < p.clusters + 2) {
+        c = fat_next(&im, c);
+        hops++;
+    }
+    double seek_s = now_s() - t0;
+
+    printf("%6u KB  %9u %8u %10llu %9llu %10.1f %8u %8llu %9.2f\n",
+           cluster_kb, p.clusters, p.fat_sectors, (unsigned long long)write_meta,
+           (unsigned long long)fat_plan_meta_writes(&p, SECTOR, rec_bytes, SYNC_BYTES),
+           rec_bytes / 1048576.0 / write_s, hops,
+           (unsigned long long)im.meta_reads, seek_s * 1000);
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [--card-gb N] [--rec-mb N] [--image PATH] [--sync]\n", argv0);
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    double card_gb = 16;
+    double rec_mb = 128;
+    const char *image = "fat_bench.img";
+    bool sync = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--card-gb") && i + 1 < argc) card_gb = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--rec-mb") && i + 1 < argc) rec_mb = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--image") && i + 1 < argc) image = argv[++i];
+        else if (!strcmp(argv[i], "--sync")) sync = true;
+        else usage(argv[0]);
+    }
+    uint64_t sectors = (uint64_t)(card_gb * 1e9) / SECTOR;
+    uint64_t rec_bytes = (uint64_t)(rec_mb * 1048576);
+    if (sectors == 0 || rec_bytes == 0 || rec_bytes >= sectors * SECTOR / 2) usage(argv[0]);
+
+    int fd = open(image, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        perror(image);
+        return 1;
+    }
+
+    printf("card %.1f GB, recording %.0f MB, %u-byte syncs%s\n\n", card_gb, rec_mb, SYNC_BYTES,
+           sync ? ", fdatasync per sync" : "");
+    printf("cluster    clusters  fat_sec meta_write  (model)  write_MB/s     hops fat_read   seek_ms\n");
+    for (uint32_t kb = 4; kb <= FAT_PLAN_MAX_CLUSTER_KB; kb *= 2) {
+        run(fd, sectors, kb, rec_bytes, sync);
+    }
+
+    close(fd);
+    unlink(image);
+    return 0;
+}
@@ -0,0 +1,649 @@
+/**
+ * @file fec_sim.c
+ * @brief Goodput of the transfer recovery strategies on a lossy BLE link
+ *
+ * Sends one recording over a model of the link and reports how long it
+ * takes until the receiver has every byte, for three ways of repairing
+ * lost notifications:
+ *
+ * - refetch: what the firmware and st_fetch do today. The tag always
+ *   streams the whole file; the receiver (the client library's st_rx_t)
+ *   asks for it again and fills the holes until nothing is missing.
+ * - nack: selective-repeat ARQ. Every few connection events the receiver
+ *   reports the sequence numbers it is missing, and the sender resends
+ *   them ahead of new data once the report arrives one round trip later.
+ *   The firmware has no such command; this is the usual alternative to FEC.
+ * - fec K/R: the FILE_TRANSFER_CMD_SET_FEC mode with the firmware's encoder
+ *   (main/ft_fec.c). Blocks that still cannot be rebuilt are completed by a
+ *   refetch pass, as a receiver of this protocol has to.
+ *
+ * The link delivers up to --pdus notifications per connection event of
+ * --interval-ms and drops them independently or in bursts (Gilbert-Elliott
+ * with mean burst --burst). --swap exchanges neighbouring notifications of
+ * an event, as EATT bearers do. Every strategy moves real bytes and the
+ * result is compared with the source file.
+ *
+ *   ./fec_sim --size 640032 --loss 0,0.01,0.05,0.1 --burst 3 --fec 16/2,16/4
+ */
+
+#include "ft_fec.h"
+#include "ft_proto.h"
+#include "st_client.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_LOSS        16
+#define MAX_FEC         8
+#define MAX_PASSES      50
+#define NACK_MAX_SEQS   100     // 16-bit sequence numbers in one ATT write
+#define NACK_INFLIGHT   64
+
+typedef struct {
+    uint32_t size;
+    uint16_t payload;           // Data bytes per plain notification
+    double interval_ms;
+    int pdus;                   // Notifications per connection event
+    int rtt_events;             // Command or report to its effect
+    int nack_every;             // Events between NACK reports
+    double burst;               // Mean loss burst length (1 = independent)
+    double swap;                // Probability of swapping two neighbours
+    int runs;
+    uint64_t seed;
+} sim_cfg_t;
+
+typedef struct {
+    double time_s;
+    uint64_t sent;              // Notifications on the air
+    uint32_t rounds;            // Passes (refetch, fec) or reports that arrived (nack)
+    bool finished;              // Receiver has every byte (else gave up after MAX_PASSES)
+    bool ok;                    // and they match the file
+} sim_result_t;
+
+//==============================================================================
+// Link
+//==============================================================================
+
+typedef struct {
+    uint64_t rng;
+    double p;                   // Mean loss
+    double p_gb, p_bg;          // Gilbert-Elliott transitions (bad state drops everything)
+    bool bad;
+    double swap;
+} link_t;
+
+static double rnd(link_t *l) {
+    // xorshift64*
+    l->rng ^= l->rng >> 12;
+    l->rng ^= l->rng << 25;
+    l->rng ^= l->rng >> 27;
+    return (double)((l->rng * 0x2545F4914F6CDD1DULL) >> 11) / (double)(1ULL << 53);
+}
+
+static void link_init(link_t *l, const sim_cfg_t *cfg, double p, uint64_t seed) {
+    memset(l, 0, sizeof(*l));
+    l->rng = seed * 0x9E3779B97F4A7C15ULL + 1;
+    l->p = p;
+    l->swap = cfg->swap;
+    if (cfg->burst > 1.0 && p > 0.0 && p < 1.0) {
+        l->p_bg = 1.0 / cfg->burst;
+        l->p_gb = p * l->p_bg / (1.0 - p);
+    }
+}
+
+static bool link_lost(link_t *l) {
+    if (l->p_bg == 0.0) return rnd(l) < l->p;
+    l->bad = l->bad ? rnd(l) >= l->p_bg : rnd(l) < l->p_gb;
+    return l->bad;
+}
+
+// One connection event's worth of notifications as the receiver sees them
+typedef struct {
+    uint8_t pkt[32][FT_PKT_MAX];
+    uint16_t len[32];
+    int n;
+} event_t;
+
+static void event_deliver(link_t *l, event_t *ev, const uint8_t *pkt, uint16_t len) {
+    if (link_lost(l)) return;
+    memcpy(ev->pkt[ev->n], pkt, len);
+    ev->len[ev->n++] = len;
+}
+
+static void event_shuffle(link_t *l, event_t *ev) {
+    for (int i = 0; i + 1 < ev->n; i++) {
+        if (rnd(l) < l->swap) {
+            uint8_t tmp[FT_PKT_MAX];
+            uint16_t tl = ev->len[i];
+            memcpy(tmp, ev->pkt[i], tl);
+            memcpy(ev->pkt[i], ev->pkt[i + 1], ev->len[i + 1]);
+            ev->len[i] = ev->len[i + 1];
+            memcpy(ev->pkt[i + 1], tmp, tl);
+            ev->len[i + 1] = tl;
+            i++;
+        }
+    }
+}
+
+//==============================================================================
+// refetch: whole-file passes into st_rx_t
+//==============================================================================
+
+static int write_mem(void *ctx, uint64_t offset, const uint8_t *data, size_t len) {
+    memcpy((uint8_t *)ctx + offset, data, len);
+    return 0;
+}
+
+static sim_result_t run_refetch(const sim_cfg_t *cfg, const uint8_t *file, uint8_t *out, link_t *l) {
+    static st_rx_t rx;
+    sim_result_t res = {0};
+    uint32_t count = (cfg->size + cfg->payload - 1) / cfg->payload;
+    uint64_t events = 0;
+    st_rx_begin(&rx, write_mem, out, cfg->size);
+
+    for (res.rounds = 1; res.rounds <= MAX_PASSES; res.rounds++) {
+        events += cfg->rtt_events;
+        for (uint32_t i = 0; i < count; events++) {
+            event_t ev = {0};
+            for (int p = 0; p < cfg->pdus && i < count; p++, i++) {
+                uint8_t pkt[FT_PKT_MAX];
+                uint32_t off = i * cfg->payload;
+                uint16_t n = (uint16_t)(cfg->size - off < cfg->payload ? cfg->size - off : cfg->payload);
+                ft_pkt_header_encode(pkt, (uint16_t)i, n, i + 1 == count);
+                memcpy(pkt + FILE_TRANSFER_HEADER_SIZE, file + off, n);
+                event_deliver(l, &ev, pkt, FILE_TRANSFER_HEADER_SIZE + n);
+                res.sent++;
+            }
+            event_shuffle(l, &ev);
+            for (int p = 0; p < ev.n; p++) st_rx_feed(&rx, ev.pkt[p], ev.len[p]);
+        }
+        st_rx_result_t r = st_rx_end(&rx);
+        if (res.rounds == MAX_PASSES) break;
+        if (st_rx_complete(&rx)) break;
+        if (r == ST_RX_RESTART) {
+            st_rx_begin(&rx, write_mem, out, cfg->size);
+        } else {
+            st_rx_begin_fill(&rx);
+        }
+    }
+    res.time_s = events * cfg->interval_ms / 1000.0;
+    res.finished = st_rx_complete(&rx);
+    res.ok = memcmp(file, out, cfg->size) == 0;
+    return res;
+}
+
+//==============================================================================
+// nack: selective repeat with periodic loss reports
+//==============================================================================
+
+typedef struct {
+    uint64_t arrive;            // Event at which the sender acts on it
+    uint16_t n;
+    uint32_t seq[NACK_MAX_SEQS];
+} nack_t;
+
+static sim_result_t run_nack(const sim_cfg_t *cfg, const uint8_t *file, uint8_t *out, link_t *l) {
+    sim_result_t res = {0};
+    uint32_t count = (cfg->size + cfg->payload - 1) / cfg->payload;
+    bool *got = calloc(count, sizeof(bool));
+    bool *queued = calloc(count, sizeof(bool));
+    int64_t *asked = malloc(count * sizeof(int64_t));
+    uint32_t *resend = malloc(count * sizeof(uint32_t));
+    static nack_t reports[NACK_INFLIGHT];
+    for (uint32_t i = 0; i < count; i++) asked[i] = -1;
+    uint32_t rs_head = 0, rs_tail = 0, rs_len = 0;   // Ring of resends
+    uint32_t next_new = 0, have = 0, high = 0;      // high: one past the highest received
+    uint32_t nreports = 0;
+    uint64_t last_rx_event = 0;
+    uint64_t event = cfg->rtt_events;
+
+    while (have < count && event < 100000000ULL) {
+        // Reports that reached the sender
+        for (uint32_t a = 0; a < nreports;) {
+            if (reports[a].arrive > event) { a++; continue; }
+            for (uint16_t s = 0; s < reports[a].n; s++) {
+                uint32_t q = reports[a].seq[s];
+                if (queued[q]) continue;
+                queued[q] = true;
+                resend[rs_tail] = q;
+                rs_tail = (rs_tail + 1) % count;
+                rs_len++;
+            }
+            res.rounds++;
+            reports[a] = reports[--nreports];
+        }
+
+        event_t ev = {0};
+        for (int p = 0; p < cfg->pdus; p++) {
+            uint32_t i;
+            if (rs_len) {
+                i = resend[rs_head];
+                rs_head = (rs_head + 1) % count;
+                rs_len--;
+                queued[i] = false;
+            } else if (next_new < count) {
+                i = next_new++;
+            } else {
+                break;
+            }
+            uint8_t pkt[FT_PKT_MAX];
+            uint32_t off = i * cfg->payload;
+            uint16_t n = (uint16_t)(cfg->size - off < cfg->payload ? cfg->size - off : cfg->payload);
+            ft_pkt_header_encode(pkt, (uint16_t)i, n, i + 1 == count);
+            memcpy(pkt + FILE_TRANSFER_HEADER_SIZE, file + off, n);
+            event_deliver(l, &ev, pkt, FILE_TRANSFER_HEADER_SIZE + n);
+            res.sent++;
+        }
+        event_shuffle(l, &ev);
+        for (int p = 0; p < ev.n; p++) {
+            // main() keeps files under 65536 notifications, so sequence numbers do not wrap
+            ft_pkt_header_t h;
+            ft_pkt_header_decode(ev.pkt[p], ev.len[p], &h);
+            uint32_t i = h.seq;
+            if (i >= count || got[i]) continue;
+            memcpy(out + i * cfg->payload, ev.pkt[p] + FILE_TRANSFER_HEADER_SIZE, h.len);
+            got[i] = true;
+            have++;
+            if (i + 1 > high) high = i + 1;
+            last_rx_event = event;
+        }
+        event++;
+
+        if (have < count && event % cfg->nack_every == 0 && nreports < NACK_INFLIGHT) {
+            // Gaps below the highest packet; the tail too once the stream went quiet
+            uint32_t end = event - last_rx_event >= (uint64_t)cfg->nack_every ? count : high;
+            nack_t *r = &reports[nreports];
+            r->n = 0;
+            for (uint32_t i = 0; i < end && r->n < NACK_MAX_SEQS; i++) {
+                if (got[i]) continue;
+                if (asked[i] >= 0 && event - (uint64_t)asked[i] < (uint64_t)(2 * cfg->rtt_events + cfg->nack_every)) continue;
+                r->seq[r->n++] = i;
+                asked[i] = (int64_t)event;
+            }
+            // The report is a write on the same lossy link
+            if (r->n && !link_lost(l)) {
+                r->arrive = event + cfg->rtt_events;
+                nreports++;
+            }
+        }
+    }
+    res.time_s = event * cfg->interval_ms / 1000.0;
+    res.finished = have == count;
+    res.ok = memcmp(file, out, cfg->size) == 0;
+    free(got);
+    free(queued);
+    free(asked);
+    free(resend);
+    return res;
+}
+
+//==============================================================================
+// fec: the firmware's encoder, a two-block receiver, refetch for what is left
+//==============================================================================
+
+typedef struct {
+    uint8_t *out;
+    uint32_t size;
+    uint16_t t;
+    uint8_t k;
+    bool *sym;                  // Source symbol present in out
+    bool *done;                 // Block complete in out
+    uint32_t blocks_left;
+    ft_fec_dec_t dec[2];
+    uint8_t *src[2], *rep[2];
+    uint32_t solved;            // Blocks rebuilt from repairs
+} fec_rx_t;
+
+static void fec_rx_block_done(fec_rx_t *rx, ft_fec_dec_t *d) {
+    uint32_t b = d->hdr.block;
+    uint32_t first = b * rx->k;
+    for (uint8_t i = 0; i < d->k; i++) rx->sym[first + i] = true;
+    rx->done[b] = true;
+    rx->blocks_left--;
+    d->active = false;
+}
+
+static void fec_rx_feed(fec_rx_t *rx, const uint8_t *pkt, size_t len) {
+    ft_pkt_header_t ph;
+    ft_fec_hdr_t h;
+    if (!ft_pkt_header_decode(pkt, len, &ph) || !ph.fec || ph.len < FT_FEC_HEADER_SIZE) return;
+    if (!ft_fec_hdr_decode(pkt + FILE_TRANSFER_HEADER_SIZE, &h)) return;
+    const uint8_t *data = pkt + FILE_TRANSFER_HEADER_SIZE + FT_FEC_HEADER_SIZE;
+    uint16_t dlen = (uint16_t)(ph.len - FT_FEC_HEADER_SIZE);
+    if (rx->done[h.block]) return;
+
+    ft_fec_dec_t *d = NULL;
+    for (int s = 0; s < 2; s++) {
+        if (rx->dec[s].active && rx->dec[s].hdr.block == h.block) d = &rx->dec[s];
+    }
+    if (!d) {
+        // Take the idle decoder, or give up on the older block
+        int s = !rx->dec[0].active ? 0 : !rx->dec[1].active ? 1
+              : rx->dec[0].hdr.block < rx->dec[1].hdr.block ? 0 : 1;
+        d = &rx->dec[s];
+        ft_fec_dec_begin(d, &h);
+        // Sources an earlier pass delivered count toward this block
+        uint32_t base = ft_fec_block_offset(&h);
+        for (uint8_t i = 0; i < d->k; i++) {
+            if (!rx->sym[h.block * rx->k + i]) continue;
+            uint32_t off = (uint32_t)i * h.t;
+            ft_fec_hdr_t hi = h;
+            hi.esi = i;
+            ft_fec_dec_add(d, &hi, rx->out + base + off, h.bytes - off < h.t ? h.bytes - off : h.t);
+        }
+    }
+
+    if (h.esi < d->k) {
+        uint32_t idx = h.block * rx->k + h.esi;
+        if (!rx->sym[idx]) {
+            memcpy(rx->out + ft_fec_block_offset(&h) + (uint32_t)h.esi * h.t, data, dlen);
+            rx->sym[idx] = true;
+        }
+    }
+    if (!ft_fec_dec_add(d, &h, data, dlen)) return;
+    if (ft_fec_dec_missing(d) > 0) {
+        if (!ft_fec_dec_solve(d)) return;
+        memcpy(rx->out + ft_fec_block_offset(&h), d->src, h.bytes);
+        rx->solved++;
+    }
+    fec_rx_block_done(rx, d);
+}
+
+static sim_result_t run_fec(const sim_cfg_t *cfg, const uint8_t *file, uint8_t *out, link_t *l, uint8_t k, uint8_t r) {
+    sim_result_t res = {0};
+    uint16_t t = (uint16_t)(cfg->payload - FT_FEC_HEADER_SIZE);
+    uint32_t per_block = (uint32_t)k * t;
+    uint32_t blocks = (cfg->size + per_block - 1) / per_block;
+    fec_rx_t rx = {
+        .out = out, .size = cfg->size, .t = t, .k = k,
+        .sym = calloc((size_t)blocks * k, sizeof(bool)),
+        .done = calloc(blocks, sizeof(bool)),
+        .blocks_left = blocks,
+    };
+    for (int s = 0; s < 2; s++) {
+        rx.src[s] = malloc((size_t)FT_FEC_MAX_K * t);
+        rx.rep[s] = malloc((size_t)FT_FEC_MAX_R * t);
+        ft_fec_dec_init(&rx.dec[s], rx.src[s], rx.rep[s], t);
+    }
+    uint8_t *parity = malloc((size_t)FT_FEC_MAX_R * t);
+    uint64_t events = 0;
+
+    for (res.rounds = 1; res.rounds <= MAX_PASSES && rx.blocks_left; res.rounds++) {
+        ft_fec_enc_t enc;
+        ft_fec_enc_init(&enc, cfg->size, t, k, r, parity);
+        rx.dec[0].active = rx.dec[1].active = false;
+        events += cfg->rtt_events;
+        uint16_t seq = 0;
+        while (!ft_fec_enc_done(&enc)) {
+            event_t ev = {0};
+            for (int p = 0; p < cfg->pdus && !ft_fec_enc_done(&enc); p++) {
+                uint8_t pkt[FT_PKT_MAX];
+                uint8_t *body = pkt + FILE_TRANSFER_HEADER_SIZE + FT_FEC_HEADER_SIZE;
+                ft_fec_hdr_t h;
+                uint32_t off;
+                uint16_t n;
+                if (ft_fec_enc_next(&enc, &h, &off, &n)) {
+                    ft_fec_enc_take_repair(&enc, body);
+                } else {
+                    memcpy(body, file + off, n);
+                    ft_fec_enc_absorb(&enc, body, n);
+                }
+                ft_fec_hdr_encode(pkt + FILE_TRANSFER_HEADER_SIZE, &h);
+                ft_pkt_header_encode(pkt, seq++, (uint16_t)(FT_FEC_HEADER_SIZE + n), ft_fec_enc_done(&enc));
+                ft_pkt_header_set_fec(pkt);
+                event_deliver(l, &ev, pkt, (uint16_t)(FILE_TRANSFER_HEADER_SIZE + FT_FEC_HEADER_SIZE + n));
+                res.sent++;
+            }
+            events++;
+            event_shuffle(l, &ev);
+            for (int p = 0; p < ev.n; p++) fec_rx_feed(&rx, ev.pkt[p], ev.len[p]);
+        }
+    }
+    if (res.rounds > MAX_PASSES) res.rounds = MAX_PASSES;
+    else res.rounds--;
+    res.time_s = events * cfg->interval_ms / 1000.0;
+    res.finished = rx.blocks_left == 0;
+    res.ok = memcmp(file, out, cfg->size) == 0;
+    for (int s = 0; s < 2; s++) {
+        free(rx.src[s]);
+        free(rx.rep[s]);
+    }
+    free(parity);
+    free(rx.sym);
+    free(rx.done);
+    return res;
+}
+
+//==============================================================================
+// Kernel benchmark
+//==============================================================================
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// ft_fec_mul_add() for XOR and a general coefficient, then whole blocks
+static void bench(void) {
+    enum { T = 187, K = 16, R = 4, BYTES = 16 << 20 };
+    uint8_t *a = malloc(BYTES), *b = malloc(BYTES);
+    link_t gen;
+    sim_cfg_t cfg = {0};
+    link_init(&gen, &cfg, 0, 7);
+    for (size_t i = 0; i < BYTES; i++) a[i] = (uint8_t)(rnd(&gen) * 256);
+    memset(b, 0, BYTES);
+    ft_fec_init();
+
+    uint8_t coef[] = { 1, 0x8E };
+    for (int c = 0; c < 2; c++) {
+        double t0 = now_s();
+        for (size_t off = 0; off < BYTES; off += T * 64) {
+            size_t n = BYTES - off < T * 64 ? BYTES - off : T * 64;
+            ft_fec_mul_add(b + off, a + off, coef[c], n);
+        }
+        double dt = now_s() - t0;
+        printf("mul_add c=0x%02x     %8.0f MB/s\n", coef[c], BYTES / dt / 1e6);
+    }
+
+    // Encode the buffer as 16/4 blocks, then rebuild every block with 4 sources lost
+    uint8_t parity[R * T], src[FT_FEC_MAX_K * T], rep[FT_FEC_MAX_R * T];
+    uint32_t size = BYTES / (K * T) * (K * T);
+    ft_fec_enc_t enc;
+    ft_fec_enc_init(&enc, size, T, K, R, parity);
+    double t0 = now_s();
+    while (!ft_fec_enc_done(&enc)) {
+        ft_fec_hdr_t h;
+        uint32_t off;
+        uint16_t n;
+        if (ft_fec_enc_next(&enc, &h, &off, &n)) {
+            ft_fec_enc_take_repair(&enc, b + (size_t)h.block * R * T + (size_t)(h.esi - K) * T);
+        } else {
+            ft_fec_enc_absorb(&enc, a + off, n);
+        }
+    }
+    double enc_dt = now_s() - t0;
+
+    ft_fec_dec_t dec;
+    ft_fec_dec_init(&dec, src, rep, T);
+    uint32_t blocks = size / (K * T), bad = 0;
+    t0 = now_s();
+    for (uint32_t blk = 0; blk < blocks; blk++) {
+        ft_fec_hdr_t h = { .block = (uint16_t)blk, .k = K, .t = T, .bytes = K * T };
+        ft_fec_dec_begin(&dec, &h);
+        for (uint8_t i = 0; i < K + R; i++) {
+            if (i % 4 == blk % 4 && i < K) continue;    // Lose every fourth source
+            h.esi = i;
+            const uint8_t *sym = i < K ? a + (size_t)blk * K * T + (size_t)i * T
+                                       : b + (size_t)blk * R * T + (size_t)(i - K) * T;
+            ft_fec_dec_add(&dec, &h, sym, T);
+        }
+        bad += !ft_fec_dec_solve(&dec) || memcmp(src, a + (size_t)blk * K * T, K * T) != 0;
+    }
+    double dec_dt = now_s() - t0;
+    printf("encode 16/4         %8.0f MB/s\n", size / enc_dt / 1e6);
+    printf("decode 16/4, 4 lost %8.0f MB/s  %s\n", size / dec_dt / 1e6, bad ? "MISMATCH" : "ok");
+    free(a);
+    free(b);
+}
+
+//==============================================================================
+// Table
+//==============================================================================
+
+typedef struct {
+    char name[16];
+    uint8_t k, r;               // r == 0: not FEC
+    int kind;                   // 0 refetch, 1 nack, 2 fec
+} strategy_t;
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [--size BYTES] [--payload BYTES] [--interval-ms MS] [--pdus N]\n"
+            "          [--rtt-events N] [--nack-every N] [--loss P,P,...] [--burst LEN]\n"
+            "          [--swap P] [--fec K/R,K/R,...] [--runs N] [--seed N]\n"
+            "       %s --bench\n", argv0, argv0);
+}
+
+int main(int argc, char **argv) {
+    sim_cfg_t cfg = {
+        .size = 640032,         // 64000 RAW v1 samples, the emulator's default recording
+        .payload = FT_PKT_MAX - FILE_TRANSFER_HEADER_SIZE,
+        .interval_ms = 30.0,
+        .pdus = 6,
+        .rtt_events = 2,
+        .nack_every = 4,
+        .burst = 1.0,
+        .swap = 0.0,
+        .runs = 5,
+        .seed = 1,
+    };
+    double loss[MAX_LOSS] = { 0, 0.005, 0.01, 0.02, 0.05, 0.1, 0.2 };
+    int nloss = 7;
+    strategy_t strat[2 + MAX_FEC] = {
+        { "refetch", 0, 0, 0 },
+        { "nack", 0, 0, 1 },
+        { "fec 16/2", 16, 2, 2 },
+        { "fec 16/4", 16, 4, 2 },
+        { "fec 32/8", 32, 8, 2 },
+    };
+    int nstrat = 5;
+
+    if (argc == 2 && !strcmp(argv[1], "--bench")) {
+        bench();
+        return 0;
+    }
+    for (int i = 1; i < argc; i++) {
+        const char *a = argv[i];
+        const char *v = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!v) { usage(argv[0]); return 2; }
+        i++;
+        if (!strcmp(a, "--size")) cfg.size = (uint32_t)strtoul(v, NULL, 0);
+        else if (!strcmp(a, "--payload")) cfg.payload = (uint16_t)atoi(v);
+        else if (!strcmp(a, "--interval-ms")) cfg.interval_ms = atof(v);
+        else if (!strcmp(a, "--pdus")) cfg.pdus = atoi(v);
+        else if (!strcmp(a, "--rtt-events")) cfg.rtt_events = atoi(v);
+        else if (!strcmp(a, "--nack-every")) cfg.nack_every = atoi(v);
+        else if (!strcmp(a, "--burst")) cfg.burst = atof(v);
+        else if (!strcmp(a, "--swap")) cfg.swap = atof(v);
+        else if (!strcmp(a, "--runs")) cfg.runs = atoi(v);
+        else if (!strcmp(a, "--seed")) cfg.seed = strtoull(v, NULL, 0);
+        else if (!strcmp(a, "--loss")) {
+            nloss = 0;
+            for (char *s = (char *)v; *s && nloss < MAX_LOSS; s++) {
+                loss[nloss++] = strtod(s, &s);
+                if (*s != ',') break;
+            }
+        } else if (!strcmp(a, "--fec")) {
+            nstrat = 2;
+            for (const char *s = v; *s && nstrat < 2 + MAX_FEC;) {
+                unsigned k, r;
+                int used;
+                if (sscanf(s, "%u/%u%n", &k, &r, &used) != 2) { usage(argv[0]); return 2; }
+                strategy_t *st = &strat[nstrat++];
+                *st = (strategy_t){ .k = (uint8_t)k, .r = (uint8_t)r, .kind = 2 };
+                snprintf(st->name, sizeof(st->name), "fec %u/%u", k, r);
+                s += used;
+                if (*s == ',') s++;
+            }
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (cfg.size == 0 || cfg.payload <= FT_FEC_HEADER_SIZE || cfg.payload > FT_PKT_MAX - FILE_TRANSFER_HEADER_SIZE ||
+        cfg.pdus < 1 || cfg.pdus > 32 || cfg.nack_every < 1 || cfg.runs < 1 || cfg.rtt_events < 0 ||
+        (cfg.size + cfg.payload - 1) / cfg.payload > 65536) {
+        usage(argv[0]);
+        return 2;
+    }
+    for (int s = 2; s < nstrat; s++) {
+        uint16_t t = (uint16_t)(cfg.payload - FT_FEC_HEADER_SIZE);
+        if (strat[s].k < 1 || strat[s].k > FT_FEC_MAX_K || strat[s].r < 1 || strat[s].r > FT_FEC_MAX_R ||
+            (cfg.size + (uint32_t)strat[s].k * t - 1) / ((uint32_t)strat[s].k * t) > 65536) {
+            fprintf(stderr, "%s: k must be 1-%d, r 1-%d\n", strat[s].name, FT_FEC_MAX_K, FT_FEC_MAX_R);
+            return 2;
+        }
+    }
+
+    uint8_t *file = malloc(cfg.size);
+    uint8_t *out = malloc(cfg.size);
+    link_t gen;
+    link_init(&gen, &cfg, 0, cfg.seed);
+    for (uint32_t i = 0; i < cfg.size; i++) file[i] = (uint8_t)(rnd(&gen) * 256);
+
+    double raw_kbs = cfg.pdus * cfg.payload / cfg.interval_ms * 1000.0 / 1024.0;
+    printf("%" PRIu32 " B, %u B/notification, %d per %.1f ms event (%.1f KB/s raw), rtt %d events, "
+           "burst %.1f, swap %.2f, %d runs\n\n",
+           cfg.size, cfg.payload, cfg.pdus, cfg.interval_ms, raw_kbs, cfg.rtt_events, cfg.burst, cfg.swap, cfg.runs);
+    printf("goodput KB/s (notifications sent / needed, passes or reports)\n");
+    printf("%6s", "loss");
+    for (int s = 0; s < nstrat; s++) printf("  %-24s", strat[s].name);
+    printf("\n");
+
+    uint32_t needed = (cfg.size + cfg.payload - 1) / cfg.payload;
+    int failures = 0;
+    bool partial = false;
+    for (int li = 0; li < nloss; li++) {
+        printf("%5.1f%%", loss[li] * 100);
+        for (int s = 0; s < nstrat; s++) {
+            double time_s = 0, sent = 0, rounds = 0;
+            int finished = 0;
+            bool ok = true;
+            for (int run = 0; run < cfg.runs; run++) {
+                link_t l;
+                link_init(&l, &cfg, loss[li], cfg.seed + 1000003ULL * (run + 1));
+                memset(out, 0, cfg.size);
+                sim_result_t r = strat[s].kind == 0 ? run_refetch(&cfg, file, out, &l)
+                               : strat[s].kind == 1 ? run_nack(&cfg, file, out, &l)
+                               : run_fec(&cfg, file, out, &l, strat[s].k, strat[s].r);
+                if (!r.finished) continue;
+                time_s += r.time_s;
+                sent += (double)r.sent;
+                rounds += r.rounds;
+                ok &= r.ok;
+                finished++;
+            }
+            char cell[40];
+            if (finished == 0) {
+                snprintf(cell, sizeof(cell), "%7s (gave up)", "-");
+            } else {
+                snprintf(cell, sizeof(cell), "%7.1f (%.2fx, %.1f)%s%s", cfg.size / 1024.0 / (time_s / finished),
+                         sent / finished / needed, rounds / finished,
+                         finished < cfg.runs ? "*" : "", ok ? "" : " CORRUPT");
+            }
+            printf("  %-24s", cell);
+            partial |= finished > 0 && finished < cfg.runs;
+            failures += !ok;
+        }
+        printf("\n");
+    }
+    if (partial) printf("\n* some runs gave up after %d passes; averages cover the others\n", MAX_PASSES);
+    free(file);
+    free(out);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,542 @@
+/**
+ * @file pf_sim.c
+ * @brief Brownout hold-up budget against the journal flush, and recovery of the result
+ *
+ * Timing: the capture task hands the storage task 512-sample blocks every
+ * 32 ms (audio_capture.c), so a recording's buffer boundary sits at a fixed
+ * offset k into each block. A trip lands at a uniform point u of the block
+ * period:
+ *   - after the block's write: k samples sit in the storage buffer
+ *   - during it: the buffer is on its way to the card, k values wait on the
+ *     queue, and the flush waits for the write to end
+ * Each card write is the SPI transfer of its sectors plus a busy time (a
+ * lognormal around --busy-ms, with --stall-pct of them a --stall-ms stall).
+ * A recording buffer also rewrites both FAT copies and the directory entry.
+ * The journal is done at
+ *   ISR and wake-up + ADC halt + rest of a write in progress + two journal writes
+ * and counts if that is within the hold-up time and --wait-ms. Hold-up is
+ * C dV / I when the supply is cut (the rail capacitance carries the load
+ * from the trip to --v-min) or dV / slope when a flat battery sags.
+ * Samples still in the ADC's DMA pool at the trip are lost either way.
+ *
+ * Recovery: --files trips are played out on real files with the firmware's
+ * pf_journal.c. Each writes a RAW file and a journal as the card would hold
+ * them after the trip at --cap-file uF: the journal whole, torn by the power
+ * going mid-write, or not started; now and then the card lost its last sync,
+ * kept a partial sample, or holds a journal from another recording. After
+ * pf_recover() every file must have a closed header whose totals match its
+ * size, samples equal to what was captured, in sequence (one gap where the
+ * card lost a sync under a journal), timestamps in order, and exactly the
+ * expected count. A second pf_recover() must find nothing to do.
+ *
+ *   pf_sim                                  # tables and 300 recovery trials
+ *   pf_sim --cap-uf 1000,4700 --load-ma 120 --stall-pct 5
+ *
+ * Exit status 1 if any recovered file is wrong.
+ */
+
+#define _GNU_SOURCE
+#include "pf_journal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define RATE_HZ        16000
+#define BLOCK          512         // AUDIO_BUFFER_FRAMES, and RAW_AUDIO_BUFFER_SIZE
+#define PERIOD_US      (BLOCK * 1000000.0 / RATE_HZ)
+#define ISR_US         20.0        // Interrupt, task wake-up
+#define HALT_US        60.0        // adc_continuous_stop()
+#define SPI_SECTOR     523         // Bytes on the wire per sector: token, data, CRC, response
+#define SPI_CMD        24          // Command, response and stop token per write
+#define CLUSTER        32768
+#define MAX_CASES      16
+#define SIGMA_BUSY     0.6
+
+typedef struct {
+    int trials;
+    double load_ma;
+    double v_trip, v_min;
+    double spi_mhz;
+    double busy_ms;
+    double stall_pct;
+    double stall_ms;
+    double wait_ms;
+    int files;
+    double cap_file_uf;
+    const char *dir;
+    unsigned seed;
+} sim_opts_t;
+
+typedef struct {
+    double done_us;             // Trip to journal on the card
+    double journal_us;          // The two journal writes
+    double wait_us;             // Rest of the recording write in progress
+    bool mid_write;
+    uint16_t records, queued;
+    uint32_t dma;               // Samples converted but not yet read: lost in any case
+    uint32_t bytes;             // Journal bytes written
+} trip_t;
+
+static double frand(void) {
+    return (rand() + 0.5) / ((double)RAND_MAX + 1.0);
+}
+
+static double gauss(void) {
+    return sqrt(-2.0 * log(frand())) * cos(2.0 * M_PI * frand());
+}
+
+static double busy_us(const sim_opts_t *o) {
+    if (frand() * 100.0 < o->stall_pct) return o->stall_ms * 1000.0 * (0.5 + frand());
+    return o->busy_ms * 1000.0 * exp(SIGMA_BUSY * gauss());
+}
+
+static double write_us(const sim_opts_t *o, uint32_t sectors) {
+    return (sectors * SPI_SECTOR + SPI_CMD) * 8.0 / o->spi_mhz + busy_us(o);
+}
+
+// One recording buffer and its sync: data, both FAT copies, directory entry, FSINFO on a new cluster
+static double buffer_write_us(const sim_opts_t *o) {
+    double t = write_us(o, BLOCK * PF_RAW_SAMPLE_BYTES / PF_JOURNAL_SECTOR) + 3 * write_us(o, 1);
+    if (frand() < (double)BLOCK * PF_RAW_SAMPLE_BYTES / CLUSTER) t += write_us(o, 1);
+    return t;
+}
+
+static void trip(const sim_opts_t *o, uint32_t k, trip_t *t) {
+    memset(t, 0, sizeof(*t));
+    double u = frand() * PERIOD_US;
+    double w = buffer_write_us(o);
+    t->dma = (uint32_t)(u * RATE_HZ / 1e6);
+    t->mid_write = u < w;
+    if (t->mid_write) {
+        t->wait_us = w - u - ISR_US - HALT_US;
+        if (t->wait_us < 0) t->wait_us = 0;
+        t->queued = (uint16_t)k;
+    } else {
+        t->records = (uint16_t)k;
+    }
+    uint32_t head = pf_journal_records_at(t->queued);
+    uint32_t rec = PF_JOURNAL_SPAN((uint32_t)t->records * PF_RAW_SAMPLE_BYTES);
+    t->bytes = head + rec;
+    t->journal_us = write_us(o, head / PF_JOURNAL_SECTOR) + (rec ? write_us(o, rec / PF_JOURNAL_SECTOR) : 0);
+    t->done_us = ISR_US + HALT_US + t->wait_us + t->journal_us;
+}
+
+static bool in_time(const sim_opts_t *o, const trip_t *t, double hold_us) {
+    return t->done_us <= hold_us && t->done_us <= o->wait_ms * 1000.0;
+}
+
+// Samples lost by a trip: everything unsynced without the journal, the DMA pool with it
+static uint32_t lost(const trip_t *t, bool journaled) {
+    if (journaled) return t->dma;
+    return t->dma + t->records + t->queued + (t->mid_write ? BLOCK : 0);
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double pct(const double *sorted, int n, double p) {
+    if (n == 0) return 0;
+    int i = (int)(p / 100.0 * (n - 1) + 0.5);
+    return sorted[i];
+}
+
+static void timing_table(const sim_opts_t *o, trip_t *trips) {
+    double *all = malloc(sizeof(double) * o->trials);
+    double *mid = malloc(sizeof(double) * o->trials);
+    double *calm = malloc(sizeof(double) * o->trials);
+    int n_mid = 0, n_calm = 0;
+    double bytes = 0, max_bytes = 0;
+    for (int i = 0; i < o->trials; i++) {
+        all[i] = trips[i].done_us / 1000.0;
+        if (trips[i].mid_write) {
+            mid[n_mid++] = all[i];
+        } else {
+            calm[n_calm++] = all[i];
+        }
+        bytes += trips[i].bytes;
+        if (trips[i].bytes > max_bytes) max_bytes = trips[i].bytes;
+    }
+    qsort(all, o->trials, sizeof(double), cmp_double);
+    qsort(mid, n_mid, sizeof(double), cmp_double);
+    qsort(calm, n_calm, sizeof(double), cmp_double);
+
+    printf("Trip to journal on the card: %d trips, SPI %.0f MHz, busy %.2f ms median, %.1f%% of writes stall %.0f ms\n",
+           o->trials, o->spi_mhz, o->busy_ms, o->stall_pct, o->stall_ms);
+    printf("journal %.1f KB mean, %.1f KB max\n", bytes / o->trials / 1024.0, max_bytes / 1024.0);
+    printf("%-16s %7s %8s %8s %8s %8s\n", "trip", "share", "p50 ms", "p90 ms", "p99 ms", "max ms");
+    const struct { const char *name; double *v; int n; } rows[] = {
+        { "between writes", calm, n_calm },
+        { "during a write", mid, n_mid },
+        { "all", all, o->trials },
+    };
+    for (int r = 0; r < 3; r++) {
+        printf("%-16s %6.1f%% %8.2f %8.2f %8.2f %8.2f\n", rows[r].name, 100.0 * rows[r].n / o->trials,
+               pct(rows[r].v, rows[r].n, 50), pct(rows[r].v, rows[r].n, 90), pct(rows[r].v, rows[r].n, 99),
+               rows[r].n ? rows[r].v[rows[r].n - 1] : 0);
+    }
+    free(all);
+    free(mid);
+    free(calm);
+}
+
+static void hold_row(const sim_opts_t *o, const trip_t *trips, double label, double hold_us) {
+    int ok = 0;
+    double lost_reset = 0, lost_journal = 0;
+    for (int i = 0; i < o->trials; i++) {
+        bool j = in_time(o, &trips[i], hold_us);
+        ok += j;
+        lost_reset += lost(&trips[i], false);
+        lost_journal += lost(&trips[i], j);
+    }
+    printf("%10g %9.2f %10.1f%% %12.1f %14.1f\n", label, hold_us / 1000.0, 100.0 * ok / o->trials,
+           lost_reset / o->trials / RATE_HZ * 1000.0, lost_journal / o->trials / RATE_HZ * 1000.0);
+}
+
+static double cut_hold_us(const sim_opts_t *o, double cap_uf) {
+    return cap_uf * (o->v_trip - o->v_min) / o->load_ma * 1000.0;
+}
+
+// ---- Recovery trials ----------------------------------------------------
+
+#define SEQ_BAD 97      // Every 97th capture is a corrupt 0xFFFF the firmware stores as 2048
+
+static uint16_t captured(uint32_t i) {
+    return i % SEQ_BAD == 0 ? 0xFFFF : (uint16_t)((i * 37u) % 4096u);
+}
+
+static uint16_t stored(uint32_t i) {
+    return i % SEQ_BAD == 0 ? 2048 : captured(i);
+}
+
+static uint32_t true_ms(uint32_t start_ms, uint32_t i) {
+    return start_ms + (uint32_t)((uint64_t)i * 1000 / RATE_HZ);
+}
+
+static void put16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void record(uint8_t *p, uint32_t start_ms, uint32_t i) {
+    put16(p, stored(i));
+    put32(p + 2, true_ms(start_ms, i));
+    put32(p + 6, i);
+}
+
+typedef struct {
+    int files, journaled, torn, missed, lost_sync, partial, foreign, failed;
+    uint64_t kept, added;
+    uint32_t max_ts_err_ms;
+} rec_stats_t;
+
+static bool write_file(const char *path, const uint8_t *buf, size_t len) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    bool ok = write(fd, buf, len) == (ssize_t)len;
+    return close(fd) == 0 && ok;
+}
+
+static bool fail(rec_stats_t *st, int n, const char *what) {
+    st->failed++;
+    printf("  file %d: %s\n", n, what);
+    return false;
+}
+
+// Check a finished file against the capture; gap = first sequence number after a gap, 0 if none
+static bool verify(rec_stats_t *st, int n, const char *path, uint32_t start_ms, uint32_t expect, uint32_t gap_at,
+                   uint32_t gap, uint32_t trip_ms, uint32_t ts_slack) {
+    int fd = open(path, O_RDONLY);
+    struct stat sb;
+    if (fd < 0 || fstat(fd, &sb) != 0) return fail(st, n, "cannot open");
+    uint8_t *buf = malloc((size_t)sb.st_size + 1);
+    bool ok = read(fd, buf, (size_t)sb.st_size) == sb.st_size;
+    close(fd);
+    if (!ok) {
+        free(buf);
+        return fail(st, n, "short read");
+    }
+
+    const char *err = NULL;
+    uint32_t total = get32(buf + 12), flags = get32(buf + 28);
+    if (get32(buf) != PF_RAW_MAGIC) err = "magic";
+    else if ((flags & PF_RAW_F_OPEN) || !(flags & PF_RAW_F_RECOVERED)) err = "header flags";
+    else if ((uint64_t)sb.st_size != PF_RAW_HEADER_BYTES + (uint64_t)total * PF_RAW_SAMPLE_BYTES) err = "size against header";
+    else if (total != expect) err = "sample count";
+    uint32_t prev_ts = get32(buf + 16);
+    for (uint32_t i = 0; !err && i < total; i++) {
+        const uint8_t *s = buf + PF_RAW_HEADER_BYTES + (size_t)i * PF_RAW_SAMPLE_BYTES;
+        uint32_t seq = i < gap_at ? i : i + gap;
+        uint32_t ts = get32(s + 2);
+        uint32_t want = true_ms(start_ms, seq);
+        if (get32(s + 6) != seq) err = "sequence";
+        else if ((uint16_t)(s[0] | (s[1] << 8)) != stored(seq)) err = "sample value";
+        else if ((int32_t)(ts - prev_ts) < 0) err = "time going back";
+        else if (ts > trip_ms + 1) err = "time after the trip";
+        else {
+            uint32_t e = ts > want ? ts - want : want - ts;
+            if (e > ts_slack) err = "timestamp";
+            if (e > st->max_ts_err_ms) st->max_ts_err_ms = e;
+        }
+        prev_ts = ts;
+    }
+    if (!err && total && get32(buf + 20) != prev_ts) err = "end timestamp";
+    free(buf);
+    return err ? fail(st, n, err) : true;
+}
+
+static bool recovery_trial(const sim_opts_t *o, rec_stats_t *st, int n) {
+    static uint8_t raw[PF_RAW_HEADER_BYTES + 70 * BLOCK * PF_RAW_SAMPLE_BYTES];
+    static uint8_t journal[PF_JOURNAL_FILE_BYTES];
+    static uint8_t staging[PF_JOURNAL_STAGING_BYTES];
+    static uint8_t records[BLOCK * PF_RAW_SAMPLE_BYTES];
+    char raw_path[256], journal_path[256];
+    const char *name = "r000001.raw";
+    snprintf(raw_path, sizeof(raw_path), "%s/%s", o->dir, name);
+    snprintf(journal_path, sizeof(journal_path), "%s/pfjournal.bin", o->dir);
+
+    // A recording of 1..64 blocks plus k, tripped with the timing model
+    uint32_t k = (uint32_t)(frand() * BLOCK);
+    uint32_t blocks = 1 + (uint32_t)(frand() * 64);
+    uint32_t start_ms = 1000 + (uint32_t)(frand() * 100000);
+    trip_t t;
+    trip(o, k, &t);
+    bool journaled = in_time(o, &t, cut_hold_us(o, o->cap_file_uf));
+    // The journal was under way when the power went
+    bool torn = !journaled && t.done_us - t.journal_us < cut_hold_us(o, o->cap_file_uf) &&
+                t.done_us - t.journal_us < o->wait_ms * 1000.0;
+
+    // Synced when the storage task took the marker: the buffer in flight counts only if its write ended
+    uint32_t synced = blocks - (t.mid_write && !journaled && !torn ? 1 : 0);
+    uint32_t captured_n = blocks * BLOCK + k;
+    uint32_t trip_ms = true_ms(start_ms, captured_n - 1) + t.dma * 1000 / RATE_HZ;
+
+    size_t raw_len = PF_RAW_HEADER_BYTES;
+    put32(raw + 0, PF_RAW_MAGIC);
+    put32(raw + 4, 1);
+    put32(raw + 8, RATE_HZ);
+    put32(raw + 12, 0);
+    put32(raw + 16, start_ms);
+    put32(raw + 20, 0);
+    put32(raw + 24, 0);
+    put32(raw + 28, PF_RAW_F_OPEN);
+    for (uint32_t i = 0; i < synced * BLOCK; i++, raw_len += PF_RAW_SAMPLE_BYTES) record(raw + raw_len, start_ms, i);
+    uint32_t committed = (uint32_t)raw_len;
+
+    // What the card did with the last syncs
+    uint32_t on_card = (uint32_t)raw_len;
+    uint32_t gap = 0;
+    uint32_t beyond = captured_n - synced * BLOCK;     // Captured samples past the commit point
+    if (beyond > BLOCK) beyond = BLOCK;
+    double r = frand();
+    if (r < 0.04 && synced > 1) {
+        on_card -= BLOCK * PF_RAW_SAMPLE_BYTES;     // Lost the last sync
+        gap = BLOCK;
+        st->lost_sync++;
+    } else if (r < 0.10 && beyond > 0) {
+        // Kept part of the next buffer in the file size: a torn sync, or the journal's
+        // own tail from a recovery that did not finish
+        uint32_t extra = 1 + (uint32_t)(frand() * (beyond * PF_RAW_SAMPLE_BYTES - 1));
+        for (uint32_t i = 0; i * PF_RAW_SAMPLE_BYTES < extra; i++) record(raw + raw_len + i * PF_RAW_SAMPLE_BYTES, start_ms, synced * BLOCK + i);
+        on_card += extra;
+        st->partial++;
+    }
+    if (!write_file(raw_path, raw, on_card)) return fail(st, n, strerror(errno));
+
+    // The journal as the storage task builds it
+    uint32_t first = synced * BLOCK;        // Sequence number of the first unsynced sample
+    pf_journal_info_t info = {
+        .committed = committed,
+        .records = t.records,
+        .queued = t.queued,
+        .next_seq = first + t.records,
+        .trip_ms = trip_ms,
+        .rate_mhz = 16000123,
+    };
+    bool foreign = frand() < 0.03;
+    strcpy(info.name, foreign ? "r000000.raw" : name);
+    uint16_t *q = (uint16_t *)(staging + PF_JOURNAL_HDR_BYTES);
+    for (uint16_t i = 0; i < t.queued; i++) q[i] = captured(first + i);
+    for (uint16_t i = 0; i < t.records; i++) record(records + i * PF_RAW_SAMPLE_BYTES, start_ms, first + i);
+    size_t head = pf_journal_build(staging, &info, q, records);
+    memset(journal, 0, sizeof(journal));
+    memcpy(journal, staging, head);
+    memcpy(journal + head, records, (size_t)t.records * PF_RAW_SAMPLE_BYTES);
+    size_t jlen = head + PF_JOURNAL_SPAN((size_t)t.records * PF_RAW_SAMPLE_BYTES);
+    if (torn) {
+        // Sectors reach the card in order; the power went before the last one
+        size_t sectors = jlen / PF_JOURNAL_SECTOR;
+        size_t keep = sectors > 1 ? (size_t)(frand() * (sectors - 1)) : 0;
+        memset(journal + keep * PF_JOURNAL_SECTOR, 0, jlen - keep * PF_JOURNAL_SECTOR);
+        st->torn++;
+    } else if (!journaled) {
+        memset(journal, 0, jlen);
+        st->missed++;
+    } else {
+        st->journaled++;
+    }
+    if (!write_file(journal_path, journal, PF_JOURNAL_FILE_BYTES)) return fail(st, n, strerror(errno));
+    if (foreign) st->foreign++;
+
+    // Boot: as power_fail_recover()
+    pf_recover_result_t res;
+    int fd = open(journal_path, O_RDONLY);
+    ssize_t len = fd >= 0 ? read(fd, journal, sizeof(journal)) : -1;
+    if (fd >= 0) close(fd);
+    if (len < 0 || pf_recover(raw_path, journal, (size_t)len, &res) != 1) return fail(st, n, "pf_recover");
+
+    bool applied = journaled && !foreign;
+    if (res.journal != applied) return fail(st, n, "journal applied wrongly");
+    uint32_t kept = (on_card - PF_RAW_HEADER_BYTES) / PF_RAW_SAMPLE_BYTES;
+    if (applied && kept * PF_RAW_SAMPLE_BYTES + PF_RAW_HEADER_BYTES > committed) {
+        kept = (committed - PF_RAW_HEADER_BYTES) / PF_RAW_SAMPLE_BYTES;
+    }
+    uint32_t expect = kept + (applied ? (uint32_t)t.records + t.queued : 0);
+    uint32_t gap_at = applied && gap ? kept : UINT32_MAX;
+    if (!applied) gap = 0;
+    if (!verify(st, n, raw_path, start_ms, expect, gap_at, gap, trip_ms, t.dma * 1000 / RATE_HZ + 2)) return false;
+    st->kept += res.kept;
+    st->added += res.added;
+
+    // A second boot finds nothing to do
+    if (pf_recover(raw_path, journal, (size_t)len, &res) != 0) return fail(st, n, "repeated recovery changed the file");
+    return true;
+}
+
+static int recovery_trials(const sim_opts_t *o) {
+    if (mkdir(o->dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "pf_sim: %s: %s\n", o->dir, strerror(errno));
+        return 1;
+    }
+    rec_stats_t st = { 0 };
+    for (int i = 0; i < o->files; i++) {
+        st.files++;
+        recovery_trial(o, &st, i);
+    }
+    printf("Recovery: %d files at %g uF: %d journaled, %d torn, %d not started; %d lost a sync, "
+           "%d kept a partial buffer, %d with another file's journal\n",
+           st.files, o->cap_file_uf, st.journaled, st.torn, st.missed, st.lost_sync, st.partial, st.foreign);
+    printf("%llu samples kept, %llu from journals, max timestamp error %u ms: %s\n", (unsigned long long)st.kept,
+           (unsigned long long)st.added, st.max_ts_err_ms, st.failed ? "FAIL" : "ok");
+    return st.failed ? 1 : 0;
+}
+
+static int parse_list(const char *s, double *out, int max) {
+    int n = 0;
+    char *copy = strdup(s), *save = NULL;
+    for (char *tok = strtok_r(copy, ",", &save); tok && n < max; tok = strtok_r(NULL, ",", &save)) {
+        out[n++] = atof(tok);
+    }
+    free(copy);
+    return n;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --trials N          trips for the timing tables (default 20000)\n"
+            "  --cap-uf LIST       rail capacitance for a supply cut (default 470,1000,2200,4700,10000)\n"
+            "  --sag-mv-ms LIST    rail slope for a sagging battery (default 20,5,1,0.2)\n"
+            "  --load-ma I         current after the trip, radio off (default 70)\n"
+            "  --v-trip V          brownout threshold (default 2.80)\n"
+            "  --v-min V           lowest voltage the card and chip still work at (default 2.70)\n"
+            "  --spi-mhz F         SD clock (default 10)\n"
+            "  --busy-ms T         median card busy per write (default 0.6)\n"
+            "  --stall-pct P       writes that stall (default 1)\n"
+            "  --stall-ms T        (default 60)\n"
+            "  --wait-ms T         CONFIG_SALESTAG_POWER_FAIL_WAIT_MS (default 50)\n"
+            "  --files N           recovery trials (default 300, 0 = none)\n"
+            "  --cap-file UF       capacitance the recovery trials trip with (default 4700)\n"
+            "  --dir D             for the recovery files (default out)\n"
+            "  --seed N            (default 1)\n",
+            argv0);
+}
+
+int main(int argc, char **argv) {
+    sim_opts_t o = {
+        .trials = 20000, .load_ma = 70, .v_trip = 2.80, .v_min = 2.70, .spi_mhz = 10, .busy_ms = 0.6,
+        .stall_pct = 1, .stall_ms = 60, .wait_ms = 50, .files = 300, .cap_file_uf = 4700, .dir = "out", .seed = 1,
+    };
+    double cap[MAX_CASES], sag[MAX_CASES];
+    int n_cap = parse_list("470,1000,2200,4700,10000", cap, MAX_CASES);
+    int n_sag = parse_list("20,5,1,0.2", sag, MAX_CASES);
+
+    static const struct option opts[] = {
+        { "trials", required_argument, 0, 'n' },
+        { "cap-uf", required_argument, 0, 'c' },
+        { "sag-mv-ms", required_argument, 0, 'g' },
+        { "load-ma", required_argument, 0, 'i' },
+        { "v-trip", required_argument, 0, 't' },
+        { "v-min", required_argument, 0, 'm' },
+        { "spi-mhz", required_argument, 0, 'f' },
+        { "busy-ms", required_argument, 0, 'b' },
+        { "stall-pct", required_argument, 0, 'p' },
+        { "stall-ms", required_argument, 0, 's' },
+        { "wait-ms", required_argument, 0, 'w' },
+        { "files", required_argument, 0, 'F' },
+        { "cap-file", required_argument, 0, 'C' },
+        { "dir", required_argument, 0, 'd' },
+        { "seed", required_argument, 0, 'S' },
+        { "help", no_argument, 0, 'h' },
+        { 0, 0, 0, 0 },
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "h", opts, NULL)) != -1) {
+        switch (c) {
+        case 'n': o.trials = atoi(optarg); break;
+        case 'c': n_cap = parse_list(optarg, cap, MAX_CASES); break;
+        case 'g': n_sag = parse_list(optarg, sag, MAX_CASES); break;
+        case 'i': o.load_ma = atof(optarg); break;
+        case 't': o.v_trip = atof(optarg); break;
+        case 'm': o.v_min = atof(optarg); break;
+        case 'f': o.spi_mhz = atof(optarg); break;
+        case 'b': o.busy_ms = atof(optarg); break;
+        case 'p': o.stall_pct = atof(optarg); break;
+        case 's': o.stall_ms = atof(optarg); break;
+        case 'w': o.wait_ms = atof(optarg); break;
+        case 'F': o.files = atoi(optarg); break;
+        case 'C': o.cap_file_uf = atof(optarg); break;
+        case 'd': o.dir = optarg; break;
+        case 'S': o.seed = (unsigned)strtoul(optarg, NULL, 0); break;
+        default: usage(argv[0]); return c == 'h' ? 0 : 2;
+        }
+    }
+    if (o.trials < 1 || o.load_ma <= 0 || o.v_trip <= o.v_min || o.spi_mhz <= 0 || o.busy_ms <= 0 || o.files < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    srand(o.seed);
+
+    trip_t *trips = malloc(sizeof(trip_t) * o.trials);
+    for (int i = 0; i < o.trials; i++) trip(&o, (uint32_t)(frand() * BLOCK), &trips[i]);
+    timing_table(&o, trips);
+
+    printf("\nSupply cut: %.0f mA from %.2f V to %.2f V      (lost: ms of audio per trip)\n", o.load_ma, o.v_trip, o.v_min);
+    printf("%10s %9s %11s %12s %14s\n", "cap uF", "hold ms", "journaled", "lost, reset", "lost, journal");
+    for (int i = 0; i < n_cap; i++) hold_row(&o, trips, cap[i], cut_hold_us(&o, cap[i]));
+
+    printf("\nBattery sag from %.2f V to %.2f V\n", o.v_trip, o.v_min);
+    printf("%10s %9s %11s %12s %14s\n", "mV/ms", "hold ms", "journaled", "lost, reset", "lost, journal");
+    for (int i = 0; i < n_sag; i++) hold_row(&o, trips, sag[i], (o.v_trip - o.v_min) * 1000.0 / sag[i] * 1000.0);
+    free(trips);
+
+    if (o.files == 0) return 0;
+    printf("\n");
+    return recovery_trials(&o);
+}
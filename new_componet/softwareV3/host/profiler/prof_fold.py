@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+"""
+SalesTag profile symbolizer
+Turns a cpu_profiler report (profile.prf from the card or BLE, or a UART log
+containing the PROF lines) into flamegraph folded stacks:
+
+    core0;storage;raw_audio_storage_add_sample;write 312
+
+Addresses are resolved in one batch with addr2line against the application
+ELF. Feed the output to flamegraph.pl or speedscope.
+"""
+
+import argparse
+import collections
+import hashlib
+import re
+import shutil
+import subprocess
+import sys
+
+ADDR2LINE_CANDIDATES = ("xtensa-esp32s3-elf-addr2line", "xtensa-esp-elf-addr2line", "addr2line")
+
+# Matches after an ESP-IDF log prefix such as "I (12345) cpu_prof: "
+LINE_RE = re.compile(r"PROF (.*)$")
+ANSI_RE = re.compile(r"\x1b\[[0-9;]*m")
+
+
+def parse_report(lines):
+    """Return (meta dict, per-core stats, samples[(core, task, pc, caller, count)])."""
+    meta = {}
+    cores = {}
+    samples = []
+    for raw in lines:
+        m = LINE_RE.search(ANSI_RE.sub("", raw).rstrip())
+        if not m:
+            continue
+        fields = m.group(1).split()
+        if not fields:
+            continue
+        if fields[0] == "v1":
+            meta = dict(f.split("=", 1) for f in fields[1:] if "=" in f)
+            cores.clear()
+            samples.clear()  # a later report in the same log replaces earlier ones
+        elif fields[0] == "core" and len(fields) >= 2:
+            cores[int(fields[1])] = dict(f.split("=", 1) for f in fields[2:] if "=" in f)
+        elif fields[0] == "s" and len(fields) == 6:
+            _, core, task, pc, caller, count = fields
+            samples.append((int(core), task, int(pc, 16), int(caller, 16), int(count)))
+    return meta, cores, samples
+
+
+def find_addr2line(explicit):
+    if explicit:
+        return explicit
+    for name in ADDR2LINE_CANDIDATES:
+        path = shutil.which(name)
+        if path:
+            return path
+    sys.exit("no addr2line found; pass --addr2line")
+
+
+def symbolize(addr2line, elf, addrs):
+    """Map each address to a function name ('0x...' when unknown)."""
+    addrs = sorted(a for a in addrs if a)
+    names = {0: None}
+    if not addrs:
+        return names
+    out = subprocess.run([addr2line, "-f", "-C", "-e", elf] + [hex(a) for a in addrs],
+                         check=True, capture_output=True, text=True).stdout.splitlines()
+    # addr2line prints function and file:line for every address, in order
+    for addr, func in zip(addrs, out[0::2]):
+        names[addr] = func if func and func != "??" else hex(addr)
+    return names
+
+
+def elf_sha_prefix(elf):
+    h = hashlib.sha256()
+    with open(elf, "rb") as f:
+        for block in iter(lambda: f.read(1 << 16), b""):
+            h.update(block)
+    return h.hexdigest()
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("report", nargs="?", default="-", help="profile.prf or UART log (default stdin)")
+    ap.add_argument("--elf", required=True, help="application ELF the report was taken with")
+    ap.add_argument("--addr2line", help="addr2line binary (default: xtensa toolchain, then host)")
+    ap.add_argument("--no-core", action="store_true", help="merge cores instead of a core<N> root frame")
+    ap.add_argument("--no-task", action="store_true", help="omit the task frame")
+    ap.add_argument("--summary", action="store_true", help="print per-core and top-function totals to stderr")
+    ap.add_argument("--top", type=int, default=15, help="functions listed by --summary")
+    args = ap.parse_args()
+
+    src = sys.stdin if args.report == "-" else open(args.report, errors="replace")
+    with src:
+        meta, cores, samples = parse_report(src)
+    if not samples:
+        sys.exit("no PROF sample lines found")
+
+    want = meta.get("elf", "-")
+    if want != "-" and not elf_sha_prefix(args.elf).startswith(want):
+        print(f"warning: report was taken with ELF {want}, {args.elf} differs", file=sys.stderr)
+
+    names = symbolize(find_addr2line(args.addr2line), args.elf,
+                      {s[2] for s in samples} | {s[3] for s in samples})
+
+    folded = collections.Counter()
+    self_time = collections.Counter()
+    for core, task, pc, caller, count in samples:
+        frames = []
+        if not args.no_core:
+            frames.append(f"core{core}")
+        if not args.no_task:
+            frames.append(task)
+        caller_name = names.get(caller)
+        pc_name = names[pc]
+        # A return address inside the same function is a recursion or a stale a0
+        if caller_name and caller_name != pc_name:
+            frames.append(caller_name)
+        frames.append(pc_name)
+        folded[";".join(frames)] += count
+        self_time[(core, pc_name)] += count
+
+    for stack, count in sorted(folded.items()):
+        print(f"{stack} {count}")
+
+    if args.summary:
+        hz = int(meta.get("hz", "0") or 0)
+        print(f"window {meta.get('window_ms', '?')} ms at {hz} Hz", file=sys.stderr)
+        for core in sorted(cores):
+            st = cores[core]
+            print(f"core{core}: {st.get('samples', '?')} samples, {st.get('dropped', '?')} dropped, "
+                  f"{st.get('tasks', '?')} tasks", file=sys.stderr)
+        totals = collections.Counter()
+        for core, task, _pc, _caller, count in samples:
+            totals[core] += count
+        for (core, func), count in self_time.most_common(args.top):
+            share = 100.0 * count / totals[core] if totals[core] else 0.0
+            print(f"  core{core} {share:5.1f}%  {func}", file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
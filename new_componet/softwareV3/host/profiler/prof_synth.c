@@ -0,0 +1,95 @@
+/**
+ * @file prof_synth.c
+ * @brief Synthetic sampling profile for exercising the report pipeline on Linux
+ *
+ * Feeds prof_hist.c the same kind of samples the firmware's timer interrupt
+ * takes, using addresses inside this program's own functions with a known
+ * weight each. The report it prints symbolizes against this binary:
+ *
+ *   ./prof_synth > synth.prf
+ *   python3 prof_fold.py --elf prof_synth synth.prf
+ */
+
+#include "prof_hist.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define SYNTH_SLOTS 512
+#define SYNTH_HZ    997
+
+static volatile unsigned s_sink;
+
+// Stand-ins for firmware hot spots; noinline with a small loop so each has
+// its own symbol spanning the sampled offsets
+#define SYNTH_FN(name, body) \
+    __attribute__((noinline)) void name(void) { for (unsigned i = 0; i < 8; i++) s_sink += i; body; }
+
+SYNTH_FN(synth_adc_isr_copy, )
+SYNTH_FN(synth_sd_write, )
+SYNTH_FN(synth_ble_notify, )
+SYNTH_FN(synth_idle, )
+SYNTH_FN(synth_storage_task, synth_sd_write())
+SYNTH_FN(synth_xfer_task, synth_ble_notify())
+
+typedef struct {
+    int core;
+    const char *task;
+    void (*fn)(void);
+    void (*caller)(void);
+    unsigned weight;        // Relative share of the core's samples
+} synth_site_t;
+
+static const synth_site_t s_sites[] = {
+    { 0, "adc_task",   synth_adc_isr_copy, synth_storage_task, 20 },
+    { 0, "storage",    synth_sd_write,     synth_storage_task, 35 },
+    { 0, "IDLE0",      synth_idle,         NULL,               45 },
+    { 1, "file_xfer",  synth_ble_notify,   synth_xfer_task,    30 },
+    { 1, "nimble host", synth_ble_notify,  NULL,               10 },
+    { 1, "IDLE1",      synth_idle,         NULL,               60 },
+};
+
+static void emit_stdout(void *ctx, const char *line) {
+    (void)ctx;
+    puts(line);
+}
+
+int main(int argc, char **argv) {
+    uint32_t window_ms = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 10000;
+    static prof_entry_t storage[2][SYNTH_SLOTS];
+    prof_hist_t hist[2];
+    unsigned total_weight[2] = { 0, 0 };
+
+    for (int c = 0; c < 2; c++) {
+        prof_hist_init(&hist[c], storage[c], SYNTH_SLOTS);
+    }
+    for (size_t i = 0; i < sizeof(s_sites) / sizeof(s_sites[0]); i++) {
+        total_weight[s_sites[i].core] += s_sites[i].weight;
+    }
+
+    // Deterministic spread of PCs across the first bytes of each function
+    uint32_t rng = 1;
+    uint32_t samples = (uint32_t)((uint64_t)window_ms * SYNTH_HZ / 1000);
+    for (int c = 0; c < 2; c++) {
+        for (uint32_t n = 0; n < samples; n++) {
+            rng = rng * 1664525u + 1013904223u;
+            unsigned pick = (rng >> 8) % total_weight[c];
+            const synth_site_t *site = NULL;
+            for (size_t i = 0; i < sizeof(s_sites) / sizeof(s_sites[0]); i++) {
+                if (s_sites[i].core != c) continue;
+                if (pick < s_sites[i].weight) {
+                    site = &s_sites[i];
+                    break;
+                }
+                pick -= s_sites[i].weight;
+            }
+            uint32_t pc = (uint32_t)(uintptr_t)site->fn + ((rng >> 24) & 3);
+            uint32_t caller = site->caller ? (uint32_t)(uintptr_t)site->caller + 4 : 0;
+            prof_hist_add(&hist[c], pc, caller, prof_hist_task(&hist[c], site->task, site->task));
+        }
+    }
+
+    const prof_meta_t meta = { .hz = SYNTH_HZ, .window_ms = window_ms, .elf_sha = NULL };
+    prof_report(hist, 2, &meta, emit_stdout, NULL);
+    return 0;
+}
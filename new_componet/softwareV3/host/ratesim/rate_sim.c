@@ -0,0 +1,250 @@
+/**
+ * @file rate_sim.c
+ * @brief Sample rate measurement and correction against a simulated clock error
+ *
+ * Runs the firmware's rate_est.c and resampler.c the way the capture task
+ * does (audio_capture.c): an ADC that converts at 16 kHz plus a divider
+ * error delivers 256-sample DMA frames, the task reads each one some time
+ * later (scheduling jitter, occasional stalls that let frames queue up) and
+ * timestamps it with a microsecond clock. The input is a tone in the ADC's
+ * 12-bit codes, converted as the capture path converts it.
+ *
+ * For each clock error the simulation reports, after --hours of audio:
+ *   - the estimate's error
+ *   - drift: how far the output's sample count puts the end of the
+ *     recording from where it really is, against the uncorrected stream
+ *   - tone SNR over the last second, with amplitude and phase fitted
+ *
+ *   rate_sim                              # -3000 .. +3000 ppm, one hour each
+ *   rate_sim --ppm 137 --jitter-ms 8 --stall-every 200
+ *
+ * Exit status 1 if any drift exceeds --max-drift-ms or an SNR is below
+ * --min-snr-db.
+ */
+
+#define _GNU_SOURCE
+#include "rate_est.h"
+#include "resampler.h"
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NOMINAL_HZ   16000
+#define ADC_MID      2048
+#define TONE_CODES   1500.0        // Tone amplitude in ADC codes
+#define MAX_CASES    32
+
+typedef struct {
+    double hours;
+    int block;
+    double jitter_ms;
+    int stall_every;               // Frames between stalls, 0 = none
+    double stall_ms;
+    double tone_hz;
+    unsigned seed;
+    double max_drift_ms;
+    double min_snr_db;
+} sim_opts_t;
+
+typedef struct {
+    double ppm;
+    double est_ppm;                // Estimate at the end
+    double est_err_ppb;
+    double drift_ms;               // Corrected output
+    double raw_drift_ms;           // Samples as captured, read at the nominal rate
+    double snr_db;
+    double ns_per_sample;          // Resampler cost on this host
+    int32_t max_slew_ppm;
+} sim_result_t;
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// The capture task's conversion: 12-bit code to signed, with headroom for the filter
+static int16_t adc_to_pcm(uint16_t v) {
+    return (int16_t)(((int32_t)v - ADC_MID) * 8);
+}
+
+static void run(const sim_opts_t *o, double ppm, sim_result_t *res) {
+    static resampler_t rs;
+    static int16_t in[4096];
+    static int16_t out[RESAMPLER_MAX_OUT(4096)];
+    rate_est_t est;
+
+    resampler_init(&rs);
+    rate_est_init(&est, NOMINAL_HZ);
+    memset(res, 0, sizeof(*res));
+    res->ppm = ppm;
+    srand(o->seed);
+
+    const double fs = NOMINAL_HZ * (1.0 + ppm * 1e-6);
+    const uint64_t total = (uint64_t)(o->hours * 3600.0 * fs) / (uint64_t)o->block * (uint64_t)o->block;
+    const double w_in = 2.0 * M_PI * o->tone_hz / fs;
+    const uint64_t fit_from = (uint64_t)((o->hours * 3600.0 - 1.0) * NOMINAL_HZ);
+
+    // Least-squares fit of the last second to a sin + b cos + c
+    double s_ss = 0, s_cc = 0, s_sc = 0, s_ys = 0, s_yc = 0, s_y = 0, s_s = 0, s_c = 0, s_yy = 0, n_fit = 0;
+    const double w_out = 2.0 * M_PI * o->tone_hz / NOMINAL_HZ;
+
+    const double t0_us = 5e6;       // Capture starts some time after boot
+    double last_read_us = 0;
+    double cpu = 0;
+    uint64_t n = 0, k = 0;
+    int frame = 0;
+    while (n < total) {
+        for (int i = 0; i < o->block; i++, n++) {
+            double v = ADC_MID + TONE_CODES * sin(w_in * (double)n);
+            in[i] = adc_to_pcm((uint16_t)lrint(v));
+        }
+        // Last sample of the frame converted at this time; read no earlier
+        double done_us = t0_us + (double)n / fs * 1e6;
+        double lag_us = o->jitter_ms * 1000.0 * rand() / (double)RAND_MAX;
+        if (o->stall_every > 0 && ++frame % o->stall_every == 0) lag_us += o->stall_ms * 1000.0;
+        double read_us = done_us + lag_us;
+        if (read_us < last_read_us) read_us = last_read_us;   // Queued frames are read back to back
+        last_read_us = read_us;
+
+        if (rate_est_feed(&est, (uint32_t)o->block, (int64_t)read_us) || est.rate_mhz) {
+            resampler_set_rate(&rs, est.rate_mhz ? est.rate_mhz : NOMINAL_HZ * 1000u, NOMINAL_HZ * 1000u);
+            int32_t s = rs.slew_ppm < 0 ? -rs.slew_ppm : rs.slew_ppm;
+            if (s > res->max_slew_ppm) res->max_slew_ppm = s;
+        }
+        double c0 = now_s();
+        size_t got = resampler_process(&rs, in, (size_t)o->block, out);
+        cpu += now_s() - c0;
+
+        for (size_t i = 0; i < got; i++, k++) {
+            if (k < fit_from) continue;
+            double sn = sin(w_out * (double)k), cs = cos(w_out * (double)k), y = out[i];
+            s_ss += sn * sn; s_cc += cs * cs; s_sc += sn * cs;
+            s_ys += y * sn; s_yc += y * cs; s_y += y; s_s += sn; s_c += cs; s_yy += y * y;
+            n_fit += 1;
+        }
+    }
+
+    // 3x3 normal equations for a, b, c
+    double A[3][4] = {
+        { s_ss, s_sc, s_s, s_ys },
+        { s_sc, s_cc, s_c, s_yc },
+        { s_s, s_c, n_fit, s_y },
+    };
+    for (int i = 0; i < 3; i++) {
+        for (int r = i + 1; r < 3; r++) {
+            double f = A[r][i] / A[i][i];
+            for (int c = i; c < 4; c++) A[r][c] -= f * A[i][c];
+        }
+    }
+    double x[3];
+    for (int i = 2; i >= 0; i--) {
+        double s = A[i][3];
+        for (int c = i + 1; c < 3; c++) s -= A[i][c] * x[c];
+        x[i] = s / A[i][i];
+    }
+    double a = x[0], b = x[1], c = x[2];
+    // Residual energy from the sums: sum (y - a s - b c - c0)^2
+    double resid = s_yy - 2 * (a * s_ys + b * s_yc + c * s_y) + a * a * s_ss + b * b * s_cc + c * c * n_fit +
+                   2 * (a * b * s_sc + a * c * s_s + b * c * s_c);
+    double signal = (a * a + b * b) / 2.0 * n_fit;
+    res->snr_db = resid > 0 ? 10.0 * log10(signal / resid) : 200.0;
+
+    double seconds = (double)total / fs;
+    res->est_ppm = rate_est_ppb(&est) / 1000.0;
+    res->est_err_ppb = (est.rate_mhz / 1000.0 - fs) / fs * 1e9;
+    res->drift_ms = ((double)rs.out_total - seconds * NOMINAL_HZ) / NOMINAL_HZ * 1000.0;
+    res->raw_drift_ms = ((double)total - seconds * NOMINAL_HZ) / NOMINAL_HZ * 1000.0;
+    res->ns_per_sample = cpu / (double)rs.out_total * 1e9;
+}
+
+static int parse_list(const char *s, double *out, int max) {
+    int n = 0;
+    char *copy = strdup(s), *save = NULL;
+    for (char *tok = strtok_r(copy, ",", &save); tok && n < max; tok = strtok_r(NULL, ",", &save)) {
+        out[n++] = atof(tok);
+    }
+    free(copy);
+    return n;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --ppm LIST          ADC clock errors to simulate (default -3000,-500,-50,0,50,500,3000)\n"
+            "  --hours H           audio per case (default 1)\n"
+            "  --block N           samples per DMA frame (default 256)\n"
+            "  --jitter-ms T       read delay, uniform 0..T (default 3)\n"
+            "  --stall-every N     every N-th frame is read --stall-ms late (default 500, 0 = never)\n"
+            "  --stall-ms T        (default 40)\n"
+            "  --tone HZ           test tone (default 1000)\n"
+            "  --seed N            (default 1)\n"
+            "  --max-drift-ms T    fail above this (default 2)\n"
+            "  --min-snr-db D      fail below this (default 50)\n",
+            argv0);
+}
+
+int main(int argc, char **argv) {
+    sim_opts_t o = {
+        .hours = 1.0, .block = 256, .jitter_ms = 3.0, .stall_every = 500, .stall_ms = 40.0,
+        .tone_hz = 1000.0, .seed = 1, .max_drift_ms = 2.0, .min_snr_db = 50.0,
+    };
+    double ppm[MAX_CASES];
+    int cases = parse_list("-3000,-500,-50,0,50,500,3000", ppm, MAX_CASES);
+
+    static const struct option opts[] = {
+        { "ppm", required_argument, 0, 'p' },
+        { "hours", required_argument, 0, 'H' },
+        { "block", required_argument, 0, 'b' },
+        { "jitter-ms", required_argument, 0, 'j' },
+        { "stall-every", required_argument, 0, 'e' },
+        { "stall-ms", required_argument, 0, 's' },
+        { "tone", required_argument, 0, 't' },
+        { "seed", required_argument, 0, 'S' },
+        { "max-drift-ms", required_argument, 0, 'd' },
+        { "min-snr-db", required_argument, 0, 'n' },
+        { "help", no_argument, 0, 'h' },
+        { 0, 0, 0, 0 },
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "h", opts, NULL)) != -1) {
+        switch (c) {
+        case 'p': cases = parse_list(optarg, ppm, MAX_CASES); break;
+        case 'H': o.hours = atof(optarg); break;
+        case 'b': o.block = atoi(optarg); break;
+        case 'j': o.jitter_ms = atof(optarg); break;
+        case 'e': o.stall_every = atoi(optarg); break;
+        case 's': o.stall_ms = atof(optarg); break;
+        case 't': o.tone_hz = atof(optarg); break;
+        case 'S': o.seed = (unsigned)strtoul(optarg, NULL, 0); break;
+        case 'd': o.max_drift_ms = atof(optarg); break;
+        case 'n': o.min_snr_db = atof(optarg); break;
+        default: usage(argv[0]); return c == 'h' ? 0 : 2;
+        }
+    }
+    if (cases < 1 || o.hours <= 0 || o.block < 1 || o.block > 4096 || o.jitter_ms < 0 || o.tone_hz <= 0 ||
+        o.tone_hz >= NOMINAL_HZ * RESAMPLER_CUTOFF) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    printf("%.2f h per case, %d-sample frames, read jitter 0-%.1f ms, %.0f ms stall every %d frames, %.0f Hz tone\n",
+           o.hours, o.block, o.jitter_ms, o.stall_ms, o.stall_every, o.tone_hz);
+    printf("%9s %11s %12s %13s %13s %9s %9s %8s\n", "clock ppm", "measured", "error ppb", "raw drift ms",
+           "drift ms", "SNR dB", "max slew", "ns/smp");
+    int failed = 0;
+    for (int i = 0; i < cases; i++) {
+        sim_result_t r;
+        run(&o, ppm[i], &r);
+        bool ok = fabs(r.drift_ms) <= o.max_drift_ms && r.snr_db >= o.min_snr_db;
+        failed += !ok;
+        printf("%9.1f %11.3f %12.1f %13.1f %13.3f %9.1f %9d %8.1f%s\n", r.ppm, r.est_ppm, r.est_err_ppb,
+               r.raw_drift_ms, r.drift_ms, r.snr_db, r.max_slew_ppm, r.ns_per_sample, ok ? "" : "  FAIL");
+        fflush(stdout);
+    }
+    return failed ? 1 : 0;
+}
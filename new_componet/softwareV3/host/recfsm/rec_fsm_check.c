@@ -0,0 +1,327 @@
+/**
+ * @file rec_fsm_check.c
+ * @brief Walk every (state, event) pair of the recording state machine
+ *
+ * The expected transitions are written out below as a table, from the
+ * diagram and rules in rec_fsm.h. Each row is a source state, an event, a
+ * guard on the machine's context, the next state, the actions and what the
+ * event does to the "failed" flag. Pairs with no row must change nothing.
+ *
+ * Starting from rec_fsm_init(), the tool visits every reachable machine
+ * (state, start progress, stop pending, failed). For each one it applies
+ * every event, with the start allowed and with it blocked, to the firmware's
+ * rec_fsm.c. The result must match exactly one row, or none for a pair the
+ * table leaves unchanged. It also checks that:
+ *   - every (state, event) pair is exercised and every row is used
+ *   - every state is reachable, and ARMED is reachable again from every
+ *     machine, so no sequence of events strands the recorder
+ *   - a press always gets an answer: a start, the LED off, a stop or a reject
+ *   - rec_fsm_busy() holds from STARTING through FINALIZING only
+ *   - every state and event has a name
+ *
+ *   rec_fsm_check           # matrix of next states, then ok / FAILED
+ *   rec_fsm_check -v        # every transition applied
+ *
+ * Exit status 1 if any check fails, 2 on bad arguments.
+ */
+
+#define _GNU_SOURCE
+#include "rec_fsm.h"
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#define STARTED_FILE    (1u << 0)   // rec_fsm.c
+#define STARTED_CAPTURE (1u << 1)
+#define STARTED_ALL     (STARTED_FILE | STARTED_CAPTURE)
+#define ACT_START       (REC_ACT_LED_ON | REC_ACT_RADIO_QUIET | REC_ACT_OPEN_FILE | REC_ACT_START_CAPTURE)
+#define ACT_STOP        (REC_ACT_LED_OFF | REC_ACT_STOP_CAPTURE | REC_ACT_DRAIN_CLOSE)
+#define MAX_MACHINES    (REC_STATE_COUNT * 4 * 2 * 2)
+
+typedef enum {
+    G_ANY,
+    G_ALLOWED,          // Nothing else owns the card
+    G_BLOCKED,
+    G_PENDING,          // Pressed again while STARTING
+    G_NOT_PENDING,
+    G_FAILED,           // This recording ends in ERROR
+    G_NOT_FAILED,
+    G_HALF,             // The event leaves the start incomplete
+    G_DONE_RUN,         // The event completes the start, no stop pending
+    G_DONE_STOP,        // The event completes the start, a stop pending
+} guard_t;
+
+typedef enum { F_KEEP, F_CLEAR, F_SET } fail_t;
+
+typedef struct {
+    rec_state_t from;
+    rec_event_t ev;
+    guard_t guard;
+    rec_state_t to;
+    uint32_t actions;
+    fail_t failed;
+} row_t;
+
+static const row_t kTable[] = {
+    { REC_IDLE,       REC_EV_READY,           G_ANY,         REC_ARMED,      0,                                         F_KEEP },
+    { REC_IDLE,       REC_EV_BUTTON,          G_ANY,         REC_IDLE,       REC_ACT_REJECT,                            F_KEEP },
+
+    { REC_ARMED,      REC_EV_NOT_READY,       G_ANY,         REC_IDLE,       0,                                         F_KEEP },
+    { REC_ARMED,      REC_EV_BUTTON,          G_ALLOWED,     REC_STARTING,   ACT_START,                                 F_CLEAR },
+    { REC_ARMED,      REC_EV_BUTTON,          G_BLOCKED,     REC_ARMED,      REC_ACT_REJECT,                            F_KEEP },
+
+    { REC_STARTING,   REC_EV_FILE_OPENED,     G_HALF,        REC_STARTING,   0,                                         F_KEEP },
+    { REC_STARTING,   REC_EV_FILE_OPENED,     G_DONE_RUN,    REC_RECORDING,  0,                                         F_KEEP },
+    { REC_STARTING,   REC_EV_FILE_OPENED,     G_DONE_STOP,   REC_FINALIZING, REC_ACT_STOP_CAPTURE | REC_ACT_DRAIN_CLOSE, F_CLEAR },
+    { REC_STARTING,   REC_EV_CAPTURE_STARTED, G_HALF,        REC_STARTING,   0,                                         F_KEEP },
+    { REC_STARTING,   REC_EV_CAPTURE_STARTED, G_DONE_RUN,    REC_RECORDING,  0,                                         F_KEEP },
+    { REC_STARTING,   REC_EV_CAPTURE_STARTED, G_DONE_STOP,   REC_FINALIZING, REC_ACT_STOP_CAPTURE | REC_ACT_DRAIN_CLOSE, F_CLEAR },
+    { REC_STARTING,   REC_EV_BUTTON,          G_NOT_PENDING, REC_STARTING,   REC_ACT_LED_OFF,                           F_KEEP },
+    { REC_STARTING,   REC_EV_BUTTON,          G_PENDING,     REC_STARTING,   REC_ACT_REJECT,                            F_KEEP },
+    { REC_STARTING,   REC_EV_START_FAILED,    G_ANY,         REC_FINALIZING, ACT_STOP,                                  F_SET },
+    { REC_STARTING,   REC_EV_WRITE_FAILED,    G_ANY,         REC_FINALIZING, ACT_STOP,                                  F_SET },
+    { REC_STARTING,   REC_EV_NOT_READY,       G_ANY,         REC_FINALIZING, ACT_STOP,                                  F_SET },
+
+    { REC_RECORDING,  REC_EV_BUTTON,          G_ANY,         REC_FINALIZING, ACT_STOP,                                  F_CLEAR },
+    { REC_RECORDING,  REC_EV_WRITE_FAILED,    G_ANY,         REC_FINALIZING, ACT_STOP,                                  F_SET },
+    { REC_RECORDING,  REC_EV_NOT_READY,       G_ANY,         REC_FINALIZING, ACT_STOP,                                  F_SET },
+
+    { REC_FINALIZING, REC_EV_FINALIZED,       G_NOT_FAILED,  REC_ARMED,      REC_ACT_RADIO_RESUME | REC_ACT_PUBLISH,    F_KEEP },
+    { REC_FINALIZING, REC_EV_FINALIZED,       G_FAILED,      REC_ERROR,      REC_ACT_RADIO_RESUME | REC_ACT_BACKOFF,    F_KEEP },
+    { REC_FINALIZING, REC_EV_FINALIZE_FAILED, G_ANY,         REC_ERROR,      REC_ACT_RADIO_RESUME | REC_ACT_BACKOFF,    F_KEEP },
+    { REC_FINALIZING, REC_EV_WRITE_FAILED,    G_ANY,         REC_FINALIZING, 0,                                         F_SET },
+    { REC_FINALIZING, REC_EV_NOT_READY,       G_ANY,         REC_FINALIZING, 0,                                         F_SET },
+    { REC_FINALIZING, REC_EV_BUTTON,          G_ANY,         REC_FINALIZING, REC_ACT_REJECT,                            F_KEEP },
+
+    { REC_ERROR,      REC_EV_READY,           G_ANY,         REC_ARMED,      0,                                         F_KEEP },
+    { REC_ERROR,      REC_EV_NOT_READY,       G_ANY,         REC_IDLE,       0,                                         F_KEEP },
+    { REC_ERROR,      REC_EV_BUTTON,          G_ANY,         REC_ERROR,      REC_ACT_REJECT,                            F_KEEP },
+};
+#define TABLE_ROWS (sizeof(kTable) / sizeof(kTable[0]))
+
+static const char *const kActName[] = {
+    "LED_ON", "RADIO_QUIET", "OPEN_FILE", "START_CAPTURE", "LED_OFF", "STOP_CAPTURE",
+    "DRAIN_CLOSE", "RADIO_RESUME", "PUBLISH", "BACKOFF", "REJECT",
+};
+
+static int s_failures;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        printf("  FAIL %s\n", what);
+        s_failures++;
+    }
+}
+
+static bool guard_holds(guard_t g, const rec_fsm_t *f, rec_event_t ev, bool allowed) {
+    unsigned bit = ev == REC_EV_FILE_OPENED ? STARTED_FILE : ev == REC_EV_CAPTURE_STARTED ? STARTED_CAPTURE : 0;
+    bool done = (f->started | bit) == STARTED_ALL;
+    switch (g) {
+    case G_ANY:         return true;
+    case G_ALLOWED:     return allowed;
+    case G_BLOCKED:     return !allowed;
+    case G_PENDING:     return f->stop_pending;
+    case G_NOT_PENDING: return !f->stop_pending;
+    case G_FAILED:      return f->failed;
+    case G_NOT_FAILED:  return !f->failed;
+    case G_HALF:        return !done;
+    case G_DONE_RUN:    return done && !f->stop_pending;
+    case G_DONE_STOP:   return done && f->stop_pending;
+    }
+    return false;
+}
+
+static void format_actions(uint32_t a, char *out, size_t len) {
+    size_t n = 0;
+    out[0] = '\0';
+    for (unsigned b = 0; b < sizeof(kActName) / sizeof(kActName[0]); b++) {
+        if (a & (1u << b)) n += (size_t)snprintf(out + n, n < len ? len - n : 0, "%s%s", n ? "|" : "", kActName[b]);
+    }
+    if (n == 0) snprintf(out, len, "-");
+}
+
+static void format_machine(const rec_fsm_t *f, char *out, size_t len) {
+    snprintf(out, len, "%s%s%s%s%s", rec_fsm_state_name(f->state),
+             f->started & STARTED_FILE ? " file" : "", f->started & STARTED_CAPTURE ? " capture" : "",
+             f->stop_pending ? " stop-pending" : "", f->failed ? " failed" : "");
+}
+
+static bool same_machine(const rec_fsm_t *a, const rec_fsm_t *b) {
+    return a->state == b->state && a->started == b->started &&
+           a->stop_pending == b->stop_pending && a->failed == b->failed;
+}
+
+// Reachable machines, breadth first from rec_fsm_init()
+static rec_fsm_t s_machines[MAX_MACHINES];
+static int s_count;
+
+static int find_machine(const rec_fsm_t *f) {
+    for (int i = 0; i < s_count; i++) {
+        if (same_machine(&s_machines[i], f)) return i;
+    }
+    return -1;
+}
+
+static int add_machine(const rec_fsm_t *f) {
+    int i = find_machine(f);
+    if (i >= 0) return i;
+    if (s_count == MAX_MACHINES) return -1;
+    s_machines[s_count] = *f;
+    return s_count++;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -v, --verbose        print every transition applied\n",
+            argv0);
+}
+
+int main(int argc, char **argv) {
+    bool verbose = false;
+    static const struct option opts[] = {
+        { "verbose", no_argument, 0, 'v' },
+        { "help",    no_argument, 0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "vh", opts, NULL)) != -1) {
+        switch (opt) {
+        case 'v': verbose = true; break;
+        default: usage(argv[0]); return opt == 'h' ? 0 : 2;
+        }
+    }
+
+    // Edges between machines, for the reachability of ARMED
+    static bool edge[MAX_MACHINES][MAX_MACHINES];
+    bool pair_seen[REC_STATE_COUNT][REC_EV_COUNT] = {{false}};
+    // Next state per pair: -1 none seen yet, -2 depends on the context
+    int next[REC_STATE_COUNT][REC_EV_COUNT];
+    memset(next, -1, sizeof(next));
+    unsigned row_used[TABLE_ROWS] = {0};
+    unsigned applied = 0;
+
+    rec_fsm_t init;
+    rec_fsm_init(&init);
+    add_machine(&init);
+    for (int m = 0; m < s_count; m++) {
+        for (int e = 0; e < REC_EV_COUNT; e++) {
+            for (int allowed = 1; allowed >= 0; allowed--) {
+                rec_fsm_t before = s_machines[m], f = before;
+                uint32_t got = rec_fsm_step(&f, (rec_event_t)e, allowed);
+                applied++;
+                pair_seen[before.state][e] = true;
+
+                int match = -1, matches = 0;
+                for (unsigned r = 0; r < TABLE_ROWS; r++) {
+                    if (kTable[r].from == before.state && kTable[r].ev == (rec_event_t)e &&
+                        guard_holds(kTable[r].guard, &before, (rec_event_t)e, allowed)) {
+                        match = (int)r;
+                        matches++;
+                    }
+                }
+                rec_state_t want_to = match >= 0 ? kTable[match].to : before.state;
+                uint32_t want_act = match >= 0 ? kTable[match].actions : 0;
+                fail_t want_fail = match >= 0 ? kTable[match].failed : F_KEEP;
+                bool want_failed = want_fail == F_SET ? true : want_fail == F_CLEAR ? false : before.failed;
+                if (match >= 0) row_used[match]++;
+
+                char from[64], to[64], acts[128];
+                format_machine(&before, from, sizeof(from));
+                format_machine(&f, to, sizeof(to));
+                format_actions(got, acts, sizeof(acts));
+                if (verbose) {
+                    printf("%-34s %-16s %-7s -> %-34s %s\n", from, rec_fsm_event_name((rec_event_t)e),
+                           allowed ? "" : "blocked", to, acts);
+                }
+                if (matches > 1 || f.state != want_to || got != want_act ||
+                    f.failed != want_failed) {
+                    char want[128];
+                    format_actions(want_act, want, sizeof(want));
+                    printf("  %s + %s%s: got %s %s, table says %s%s %s%s\n", from,
+                           rec_fsm_event_name((rec_event_t)e), allowed ? "" : " (blocked)", to, acts,
+                           rec_fsm_state_name(want_to), want_failed ? " failed" : "", want,
+                           matches > 1 ? " (several rows match)" : "");
+                    check(false, "transition differs from the table");
+                }
+                if (e == REC_EV_BUTTON) {
+                    check(got & (REC_ACT_REJECT | REC_ACT_LED_ON | REC_ACT_LED_OFF | REC_ACT_STOP_CAPTURE),
+                          "press with no answer");
+                }
+
+                int n = next[before.state][e];
+                next[before.state][e] = n == -1 || n == (int)f.state ? (int)f.state : -2;
+                int to_idx = add_machine(&f);
+                check(to_idx >= 0, "too many machines");
+                if (to_idx >= 0) edge[m][to_idx] = true;
+            }
+        }
+    }
+
+    // Matrix of next states: '.' unchanged, '*' depends on the context
+    printf("%-11s", "state");
+    for (int e = 0; e < REC_EV_COUNT; e++) printf(" %-5.5s", rec_fsm_event_name((rec_event_t)e));
+    printf("\n");
+    for (int s = 0; s < REC_STATE_COUNT; s++) {
+        printf("%-11s", rec_fsm_state_name((rec_state_t)s));
+        for (int e = 0; e < REC_EV_COUNT; e++) {
+            int n = next[s][e];
+            printf(" %-5.5s", n == -2 ? "*" : n == s ? "." : n >= 0 ? rec_fsm_state_name((rec_state_t)n) : "?");
+        }
+        printf("\n");
+    }
+    printf("%d reachable machines, %u transitions applied, %zu table rows\n", s_count, applied, TABLE_ROWS);
+
+    bool state_seen[REC_STATE_COUNT] = {false};
+    for (int m = 0; m < s_count; m++) state_seen[s_machines[m].state] = true;
+    for (int s = 0; s < REC_STATE_COUNT; s++) {
+        if (!state_seen[s]) printf("  %s never reached\n", rec_fsm_state_name((rec_state_t)s));
+        check(state_seen[s], "unreachable state");
+        for (int e = 0; e < REC_EV_COUNT; e++) {
+            check(pair_seen[s][e], "pair never exercised");
+        }
+    }
+    for (unsigned r = 0; r < TABLE_ROWS; r++) {
+        if (!row_used[r]) {
+            printf("  row %u (%s + %s) never used\n", r, rec_fsm_state_name(kTable[r].from),
+                   rec_fsm_event_name(kTable[r].ev));
+        }
+        check(row_used[r] > 0, "table row never used");
+    }
+
+    // ARMED again from every machine: transitive closure of the edges
+    static bool reach[MAX_MACHINES][MAX_MACHINES];
+    memcpy(reach, edge, sizeof(reach));
+    for (int k = 0; k < s_count; k++) {
+        for (int i = 0; i < s_count; i++) {
+            if (!reach[i][k]) continue;
+            for (int j = 0; j < s_count; j++) reach[i][j] |= reach[k][j];
+        }
+    }
+    for (int i = 0; i < s_count; i++) {
+        bool armed = s_machines[i].state == REC_ARMED;
+        for (int j = 0; j < s_count && !armed; j++) armed = reach[i][j] && s_machines[j].state == REC_ARMED;
+        if (!armed) {
+            char name[64];
+            format_machine(&s_machines[i], name, sizeof(name));
+            printf("  stranded in %s\n", name);
+        }
+        check(armed, "ARMED unreachable");
+    }
+
+    for (int s = 0; s < REC_STATE_COUNT; s++) {
+        check(rec_fsm_busy((rec_state_t)s) == (s == REC_STARTING || s == REC_RECORDING || s == REC_FINALIZING),
+              "rec_fsm_busy");
+        check(strcmp(rec_fsm_state_name((rec_state_t)s), "?") != 0, "state without a name");
+    }
+    for (int e = 0; e < REC_EV_COUNT; e++) {
+        check(strcmp(rec_fsm_event_name((rec_event_t)e), "?") != 0, "event without a name");
+    }
+    check(strcmp(rec_fsm_state_name(REC_STATE_COUNT), "?") == 0, "out-of-range state name");
+    check(strcmp(rec_fsm_event_name(REC_EV_COUNT), "?") == 0, "out-of-range event name");
+
+    printf("%s\n", s_failures ? "FAILED" : "ok");
+    return s_failures ? 1 : 0;
+}
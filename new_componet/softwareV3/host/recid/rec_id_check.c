@@ -0,0 +1,283 @@
+/**
+ * @file rec_id_check.c
+ * @brief Recording IDs across resets: monotonic, never reused, latest always found
+ *
+ * Runs the firmware's rec_id.c (rec_id_next(), rec_id_resume(),
+ * rec_id_latest()) against a simulated NVS value and card, the way
+ * rec_catalog.c and the recording controller use them:
+ *   boot:       rec_id_boot() from NVS, rec_id_resume(), then the latest
+ *               recording from rec_id_latest() (rec_catalog_init/latest)
+ *   recording:  rec_id_next(), create the file, finalize (rec_next_path(),
+ *               the storage task, rec_catalog_finalized())
+ * and resets the device at random points of a recording:
+ *   mid-persist     the reservation write is lost with the reset
+ *   after reserve   the ID is taken, the file not yet created
+ *   after create    the file exists but was never finalized (power_fail.c
+ *                   finishes it at boot)
+ * Without a reset a file can still fail to open (--open-fail), which uses
+ * up its ID, and an NVS write can fail (--nvs-fail) and be carried on
+ * with. "nvs erased" wipes the value at some boots. The directory scan
+ * (the store's fallback) is the card's highest ID; its use is counted.
+ *
+ * After every boot and every finalize it checks:
+ *   - a new ID never has a file on the card (nothing is overwritten)
+ *   - files are created with strictly increasing IDs (monotonic)
+ *   - the catalog's latest recording is the highest ID on the card
+ *   - at most one NVS write per REC_ID_BATCH IDs, plus one per boot
+ * plus the naming round trip and the allocator on its own.
+ *
+ *   rec_id_check
+ *   rec_id_check --recordings 20000 --reset 0.2 --seed 3
+ *
+ * Exit status 1 if any check fails, 2 on bad arguments.
+ */
+
+#define _GNU_SOURCE
+#include "rec_id.h"
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LATEST_PROBE (REC_ID_BATCH * 2)     // rec_catalog.c: REC_LATEST_PROBE
+
+typedef enum { R_NONE, R_PERSIST, R_RESERVED, R_CREATED, R_COUNT } reset_at_t;
+
+typedef struct {
+    const char *name;
+    bool reset[R_COUNT];        // Reset points in play
+    double open_fail;           // File open fails, no reset
+    double nvs_fail;            // NVS write fails, no reset
+    double erase;               // NVS value gone at a boot
+} scenario_t;
+
+static const scenario_t kScenarios[] = {
+    { "clean",          { false },                      0,    0,    0 },
+    { "mid-persist",    { [R_PERSIST] = true },         0,    0,    0 },
+    { "after reserve",  { [R_RESERVED] = true },        0,    0,    0 },
+    { "after create",   { [R_CREATED] = true },         0,    0,    0 },
+    { "mixed",          { false, true, true, true },    0.05, 0,    0 },
+    { "nvs failing",    { false, true, true, true },    0.05, 0.3,  0 },
+    { "nvs erased",     { false, true, true, true },    0.05, 0,    0.2 },
+};
+#define SCENARIOS (sizeof(kScenarios) / sizeof(kScenarios[0]))
+
+typedef struct {
+    uint32_t nvs_end;           // Persisted reservation end (0 = none)
+    uint8_t *card;              // card[id]: a file for id exists
+    uint32_t card_size;
+    uint32_t highest;           // Highest ID with a file
+    uint32_t flash_writes;
+    uint32_t persist_calls;
+    uint32_t scans;             // Directory scans (the fallback)
+    bool resetting;             // A reset hits the NVS write in progress
+    bool nvs_fail_next;
+} sim_t;
+
+typedef struct {
+    uint32_t recordings;
+    uint32_t boots;
+    uint32_t resets;
+    uint32_t flash_writes;
+    uint32_t scans;
+    uint32_t highest;
+    uint32_t overwrites;
+    uint32_t non_monotonic;
+    uint32_t latest_wrong;
+} sim_result_t;
+
+static int s_failures;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        printf("  FAIL %s\n", what);
+        s_failures++;
+    }
+}
+
+static double rnd(void) {
+    return (rand() + 0.5) / ((double)RAND_MAX + 1.0);
+}
+
+static bool sim_persist(void *ctx, uint32_t end) {
+    sim_t *s = ctx;
+    s->persist_calls++;
+    if (s->resetting || s->nvs_fail_next) return false;
+    s->nvs_end = end;
+    s->flash_writes++;
+    return true;
+}
+
+static bool sim_exists(void *ctx, uint32_t id) {
+    sim_t *s = ctx;
+    return id < s->card_size && s->card[id];
+}
+
+static uint32_t sim_highest(void *ctx) {
+    sim_t *s = ctx;
+    s->scans++;
+    return s->highest;
+}
+
+// The allocator on its own, and the file names
+static void check_alloc(void) {
+    rec_id_alloc_t a;
+    rec_id_boot(&a, 0);
+    check(a.next == 1 && rec_id_take(&a) == REC_ID_NONE, "no ID before a reservation");
+    uint32_t end;
+    check(rec_id_need_reserve(&a, &end) && end == 1 + REC_ID_BATCH, "first reservation");
+    rec_id_reserved(&a, end);
+    for (uint32_t i = 1; i <= REC_ID_BATCH; i++) check(rec_id_take(&a) == i, "IDs in order");
+    check(rec_id_take(&a) == REC_ID_NONE && rec_id_need_reserve(&a, &end), "batch used up");
+
+    rec_id_boot(&a, 40);
+    check(a.next == 40, "boot resumes at the persisted end");
+    rec_id_skip_past(&a, 45);
+    check(a.next == 46, "skip past an existing file");
+    rec_id_skip_past(&a, 10);
+    check(a.next == 46, "skip past never goes back");
+
+    rec_id_boot(&a, REC_ID_MAX - 1);
+    check(rec_id_need_reserve(&a, &end) && end == REC_ID_MAX + 1, "reservation clamped to the ID space");
+    rec_id_reserved(&a, end);
+    check(rec_id_take(&a) == REC_ID_MAX - 1 && rec_id_take(&a) == REC_ID_MAX, "last IDs");
+    check(rec_id_take(&a) == REC_ID_NONE, "ID space used up");
+
+    char name[REC_ID_NAME_LEN];
+    check(rec_id_format(42, name, sizeof(name)) && strcmp(name, "r0000042.raw") == 0, "format");
+    check(rec_id_parse(name) == 42, "parse");
+    check(!rec_id_format(REC_ID_NONE, name, sizeof(name)) && !rec_id_format(REC_ID_MAX + 1, name, sizeof(name)),
+          "format out of range");
+    check(!rec_id_format(1, name, REC_ID_NAME_LEN - 1), "format into a short buffer");
+    check(rec_id_parse("rec_001.raw") == REC_ID_NONE && rec_id_parse("r000004x.raw") == REC_ID_NONE &&
+          rec_id_parse("r0000042.wav") == REC_ID_NONE, "other names rejected");
+}
+
+static sim_result_t run(const scenario_t *sc, uint32_t recordings, double reset_p, unsigned seed) {
+    sim_result_t r = {0};
+    srand(seed);
+    sim_t s = {0};
+    s.card_size = recordings * (REC_ID_BATCH + 1) + LATEST_PROBE * 4;
+    s.card = calloc(s.card_size, 1);
+    rec_id_store_t store = { .persist = sim_persist, .exists = sim_exists, .highest = sim_highest, .ctx = &s };
+
+    rec_id_alloc_t a;
+    uint32_t latest = REC_ID_NONE;
+    uint32_t last_created = REC_ID_NONE;
+    bool boot = true;
+    int reset_points = 0;
+    for (int p = 0; p < R_COUNT; p++) reset_points += sc->reset[p];
+
+    while (r.recordings < recordings) {
+        if (boot) {
+            boot = false;
+            r.boots++;
+            if (r.boots > 1 && rnd() < sc->erase) s.nvs_end = 0;
+            rec_id_boot(&a, s.nvs_end);
+            rec_id_resume(&a, &store, LATEST_PROBE);
+            latest = rec_id_latest(&a, &store, LATEST_PROBE);
+            if (latest != s.highest) r.latest_wrong++;
+        }
+
+        // Where this recording is cut short, if at all
+        reset_at_t at = R_NONE;
+        if (reset_points && rnd() < reset_p) {
+            int k = rand() % reset_points;
+            for (int p = 0; p < R_COUNT; p++) {
+                if (sc->reset[p] && k-- == 0) at = (reset_at_t)p;
+            }
+        }
+
+        s.nvs_fail_next = rnd() < sc->nvs_fail;
+        s.resetting = at == R_PERSIST;
+        uint32_t calls = s.persist_calls;
+        uint32_t id = rec_id_next(&a, &store);
+        s.resetting = false;
+        if (at == R_PERSIST && s.persist_calls == calls) at = R_RESERVED;   // No write to cut short
+        check(id != REC_ID_NONE, "ID space used up");
+        if (id == REC_ID_NONE) break;
+        if (sim_exists(&s, id)) r.overwrites++;
+        r.recordings++;
+
+        if (at == R_PERSIST || at == R_RESERVED) {
+            r.resets++;
+            boot = true;
+            continue;
+        }
+        if (rnd() < sc->open_fail) continue;       // START_FAILED: the ID is used up
+
+        s.card[id] = 1;
+        if (id <= last_created) r.non_monotonic++;
+        last_created = id;
+        if (id > s.highest) s.highest = id;
+        if (at == R_CREATED) {
+            r.resets++;
+            boot = true;
+            continue;
+        }
+        if (id > latest) latest = id;                  // rec_catalog_finalized()
+        if (latest != s.highest) r.latest_wrong++;
+    }
+
+    r.flash_writes = s.flash_writes;
+    r.scans = s.scans;
+    r.highest = s.highest;
+    free(s.card);
+    return r;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --recordings N       recordings started per scenario (default 5000)\n"
+            "  --reset P            chance a recording is cut by a reset (default 0.1)\n"
+            "  --seed N             (default 1)\n",
+            argv0);
+}
+
+int main(int argc, char **argv) {
+    uint32_t recordings = 5000;
+    double reset_p = 0.1;
+    unsigned seed = 1;
+
+    static const struct option opts[] = {
+        { "recordings", required_argument, 0, 'n' },
+        { "reset",      required_argument, 0, 'r' },
+        { "seed",       required_argument, 0, 's' },
+        { "help",       no_argument,       0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", opts, NULL)) != -1) {
+        switch (opt) {
+        case 'n': recordings = (uint32_t)atol(optarg); break;
+        case 'r': reset_p = atof(optarg); break;
+        case 's': seed = (unsigned)atoi(optarg); break;
+        default: usage(argv[0]); return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (recordings < 1 || recordings > 200000 || reset_p < 0 || reset_p > 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    check_alloc();
+
+    printf("%lu recordings per scenario, reset chance %.2f, seed %u\n", (unsigned long)recordings, reset_p, seed);
+    printf("scenario        boots  resets  flash  scans  highest  overwrite  non-mono  latest-wrong\n");
+    for (unsigned i = 0; i < SCENARIOS; i++) {
+        const scenario_t *sc = &kScenarios[i];
+        sim_result_t r = run(sc, recordings, reset_p, seed + i);
+        printf("%-14s %6lu %7lu %6lu %6lu %8lu %10lu %9lu %13lu\n", sc->name, (unsigned long)r.boots,
+               (unsigned long)r.resets, (unsigned long)r.flash_writes, (unsigned long)r.scans, (unsigned long)r.highest,
+               (unsigned long)r.overwrites, (unsigned long)r.non_monotonic, (unsigned long)r.latest_wrong);
+        check(r.overwrites == 0, "new ID with a file on the card");
+        check(r.non_monotonic == 0, "file created with a lower ID than the one before");
+        check(r.latest_wrong == 0, "latest recording is not the highest ID on the card");
+        check(r.flash_writes <= r.recordings / REC_ID_BATCH + r.boots + 1, "more NVS writes than one per batch and boot");
+    }
+    printf("%s\n", s_failures ? "FAILED" : "ok");
+    return s_failures ? 1 : 0;
+}
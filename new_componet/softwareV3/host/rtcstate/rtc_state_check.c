@@ -0,0 +1,422 @@
+/**
+ * @file rtc_state_check.c
+ * @brief Deep-sleep retained state: CRC, versioning and accounting across wakes
+ *
+ * Runs the firmware's rtc_state.c the way power_mgr.c and main.c do, with
+ * RTC memory as a byte image that outlives each boot:
+ *   boot     a cold boot (reset, power loss) leaves the image as it was
+ *            or as noise; a deep-sleep wake leaves it as sealed. The block
+ *            is used only if it is a wake and rtc_state_valid(), and then
+ *            rtc_state_on_wake(); otherwise rtc_state_reset()
+ *   awake    power_mgr_restore() reads it back; the device records and
+ *            selects files
+ *   sleep    power_mgr_prepare() writes the fields, rtc_state_on_sleep()
+ *            seals
+ * While asleep the image can have a bit flipped (--flip), and the wall
+ * clock can be set back (--clock-back). Power lost during a seal is a cold
+ * boot, like any other power loss.
+ *
+ * Checks:
+ *   - every wake from an intact image restores exactly what was saved,
+ *     wake and sleep counts, and the awake and asleep totals, so the duty
+ *     cycle and projection match the simulation's own
+ *   - every cold boot and every damaged image starts fresh; noise is never
+ *     taken for a block
+ *   - every single-bit flip of a sealed block and every burst of up to 32
+ *     bits is detected, and a field written after the seal is too
+ *   - another magic, version or size is rejected even with a matching CRC,
+ *     and so is a block sealed by an older layout
+ *   - the layout is the one RTC_STATE_VERSION names: a field that moves
+ *     without a version bump fails here
+ *
+ *   rtc_state_check
+ *   rtc_state_check --cycles 20000 --cold 0.1 --flip 0.05 --seed 3
+ *
+ * Exit status 1 if any check fails, 2 on bad arguments.
+ */
+
+#define _GNU_SOURCE
+#include "rtc_state.h"
+#include "crc32c.h"
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CAPACITY_MAH    1000        // CONFIG_SALESTAG_BATTERY_CAPACITY_MAH
+#define AWAKE_MA        60          // CONFIG_SALESTAG_AWAKE_CURRENT_MA
+#define SLEEP_MA        0.1f        // CONFIG_SALESTAG_SLEEP_CURRENT_UA / 1000
+
+static int s_failures;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        printf("  FAIL %s\n", what);
+        s_failures++;
+    }
+}
+
+static double rnd(void) {
+    return (rand() + 0.5) / ((double)RAND_MAX + 1.0);
+}
+
+// ---------------------------------------------------------------------------
+// Layout
+// ---------------------------------------------------------------------------
+
+// Version 1 as sealed by the firmware; a change here needs RTC_STATE_VERSION bumped
+typedef struct {
+    const char *name;
+    size_t offset, size;
+} field_t;
+
+#define FIELD(f) { #f, offsetof(rtc_state_t, f), sizeof(((rtc_state_t *)0)->f) }
+static const field_t kActual[] = {
+    FIELD(magic), FIELD(version), FIELD(size), FIELD(wake_count), FIELD(recording_count),
+    FIELD(selected_file), FIELD(noise_floor), FIELD(gain), FIELD(calibrated), FIELD(peer_valid),
+    FIELD(peer_addr_type), FIELD(peer_addr), FIELD(awake_ms), FIELD(asleep_ms), FIELD(sleep_entered_ms),
+    FIELD(sleeps), FIELD(crc),
+};
+static const field_t kVersion1[] = {
+    { "magic", 0, 4 },          { "version", 4, 2 },        { "size", 6, 2 },
+    { "wake_count", 8, 4 },     { "recording_count", 12, 4 }, { "selected_file", 16, 64 },
+    { "noise_floor", 80, 4 },   { "gain", 84, 4 },          { "calibrated", 88, 1 },
+    { "peer_valid", 89, 1 },    { "peer_addr_type", 90, 1 }, { "peer_addr", 91, 6 },
+    { "awake_ms", 104, 8 },     { "asleep_ms", 112, 8 },    { "sleep_entered_ms", 120, 8 },
+    { "sleeps", 128, 4 },       { "crc", 132, 4 },
+};
+#define FIELDS (sizeof(kActual) / sizeof(kActual[0]))
+_Static_assert(sizeof(kVersion1) == sizeof(kActual), "one entry per field");
+
+// Version 0: the layout before duty-cycle accounting, sealed the same way
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;
+    uint32_t wake_count;
+    int32_t recording_count;
+    char selected_file[RTC_STATE_NAME_MAX];
+    float noise_floor;
+    float gain;
+    uint8_t calibrated;
+    uint32_t crc;
+} rtc_state_v0_t;
+
+static void check_layout(void) {
+    printf("layout, version %d: %zu bytes, CRC over %zu\n", RTC_STATE_VERSION, sizeof(rtc_state_t),
+           offsetof(rtc_state_t, crc));
+    bool same = RTC_STATE_VERSION == 1 && sizeof(rtc_state_t) == 136;
+    for (size_t i = 0; i < FIELDS; i++) {
+        if (strcmp(kActual[i].name, kVersion1[i].name) || kActual[i].offset != kVersion1[i].offset ||
+            kActual[i].size != kVersion1[i].size) {
+            printf("  %s at %zu (%zu bytes), version 1 has %s at %zu (%zu bytes)\n", kActual[i].name,
+                   kActual[i].offset, kActual[i].size, kVersion1[i].name, kVersion1[i].offset, kVersion1[i].size);
+            same = false;
+        }
+    }
+    if (RTC_STATE_VERSION != 1) printf("  RTC_STATE_VERSION is %d: add its layout here\n", RTC_STATE_VERSION);
+    check(same, "layout is not version 1's: bump RTC_STATE_VERSION and add the new layout");
+}
+
+// ---------------------------------------------------------------------------
+// The block on its own
+// ---------------------------------------------------------------------------
+
+static void sealed_sample(rtc_state_t *s) {
+    rtc_state_reset(s);
+    s->wake_count = 7;
+    s->recording_count = 42;
+    strcpy(s->selected_file, "r0000042.raw");
+    s->noise_floor = 12.5f;
+    s->gain = 3.25f;
+    s->calibrated = 1;
+    s->peer_valid = 1;
+    s->peer_addr_type = 1;
+    memcpy(s->peer_addr, "\x11\x22\x33\x44\x55\x66", 6);
+    rtc_state_on_sleep(s, 1000000, 60000);
+}
+
+static void check_block(void) {
+    rtc_state_t s, t;
+    printf("block\n");
+
+    rtc_state_reset(&s);
+    check(rtc_state_valid(&s) && s.wake_count == 0 && s.sleeps == 0 && s.awake_ms == 0 && !s.selected_file[0],
+          "reset is a fresh, sealed block");
+    check(rtc_state_duty(&s) == 0.0f && rtc_state_project_hours(&s, CAPACITY_MAH, AWAKE_MA, SLEEP_MA) == 0.0f,
+          "no duty cycle or projection before a measurement");
+
+    // Every single-bit flip over the sealed bytes, CRC included
+    sealed_sample(&s);
+    size_t sealed = offsetof(rtc_state_t, crc) + sizeof(s.crc);
+    size_t missed = 0;
+    for (size_t bit = 0; bit < sealed * 8; bit++) {
+        t = s;
+        ((uint8_t *)&t)[bit / 8] ^= (uint8_t)(1u << (bit % 8));
+        if (rtc_state_valid(&t)) missed++;
+    }
+    printf("  %zu single-bit flips, %zu missed\n", sealed * 8, missed);
+    check(missed == 0, "single-bit flip not detected");
+
+    // Bursts of 2..32 bits, random contents
+    missed = 0;
+    size_t bursts = 0;
+    for (unsigned len = 2; len <= 32; len++) {
+        for (size_t start = 0; start + len <= sealed * 8; start += 3) {
+            t = s;
+            uint8_t *b = (uint8_t *)&t;
+            // First and last bit of the burst always flip
+            for (unsigned k = 0; k < len; k++) {
+                if (k == 0 || k == len - 1 || rnd() < 0.5) b[(start + k) / 8] ^= (uint8_t)(1u << ((start + k) % 8));
+            }
+            bursts++;
+            if (rtc_state_valid(&t)) missed++;
+        }
+    }
+    printf("  %zu bursts of up to 32 bits, %zu missed\n", bursts, missed);
+    check(missed == 0, "burst not detected");
+
+    // A field written after the seal
+    t = s;
+    t.recording_count++;
+    check(!rtc_state_valid(&t), "field written after the seal accepted");
+
+    // Header fields are checked on their own, not only through the CRC
+    t = s;
+    t.version = RTC_STATE_VERSION + 1;
+    rtc_state_seal(&t);
+    check(!rtc_state_valid(&t), "another version accepted");
+    t = s;
+    t.size = (uint16_t)(sizeof(t) - 8);
+    rtc_state_seal(&t);
+    check(!rtc_state_valid(&t), "another size accepted");
+    t = s;
+    t.magic ^= 1;
+    rtc_state_seal(&t);
+    check(!rtc_state_valid(&t), "another magic accepted");
+
+    // A block sealed by the version 0 layout, in the same RTC memory
+    rtc_state_v0_t old;
+    memset(&old, 0, sizeof(old));
+    old.magic = RTC_STATE_MAGIC;
+    old.version = 0;
+    old.size = sizeof(old);
+    old.wake_count = 3;
+    old.crc = crc32c_calculate((const uint8_t *)&old, offsetof(rtc_state_v0_t, crc));
+    memset(&t, 0, sizeof(t));
+    memcpy(&t, &old, sizeof(old));
+    check(!rtc_state_valid(&t), "version 0 block accepted");
+    // Even had it kept version 1 (a layout change without a bump), the size tells
+    old.version = RTC_STATE_VERSION;
+    old.crc = crc32c_calculate((const uint8_t *)&old, offsetof(rtc_state_v0_t, crc));
+    memcpy(&t, &old, sizeof(old));
+    check(!rtc_state_valid(&t), "smaller layout at the same version accepted");
+
+    // Clock set back while asleep: no sleep time, still a wake
+    sealed_sample(&s);
+    uint64_t asleep = s.asleep_ms;
+    rtc_state_on_wake(&s, 500000);
+    check(rtc_state_valid(&s) && s.asleep_ms == asleep && s.wake_count == 8 && s.sleep_entered_ms == 0,
+          "clock set back while asleep");
+
+    // Projection: 1% awake at 60 mA, 0.1 mA asleep
+    rtc_state_reset(&s);
+    rtc_state_on_sleep(&s, 1000, 36000);
+    rtc_state_on_wake(&s, 1000 + 3564000);
+    float hours = rtc_state_project_hours(&s, CAPACITY_MAH, AWAKE_MA, SLEEP_MA);
+    float expect = CAPACITY_MAH / (0.01f * AWAKE_MA + 0.99f * SLEEP_MA);
+    printf("  1%% awake: duty %.4f, projected %.1f h (expected %.1f)\n", rtc_state_duty(&s), hours, expect);
+    check(fabsf(rtc_state_duty(&s) - 0.01f) < 1e-6f && fabsf(hours - expect) < 0.01f * expect, "projection");
+}
+
+// ---------------------------------------------------------------------------
+// Boots, wakes and sleeps
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    int cycles;
+    double cold, flip, clock_back;
+} opts_t;
+
+// What the device knew when it went to sleep, kept outside RTC memory
+typedef struct {
+    int32_t recording_count;
+    char selected_file[RTC_STATE_NAME_MAX];
+    float noise_floor, gain;
+    uint8_t calibrated;
+    uint8_t peer_valid, peer_addr_type, peer_addr[6];
+    uint32_t wakes, sleeps;
+    uint64_t awake_ms, asleep_ms;
+} truth_t;
+
+static void run_cycles(const opts_t *o) {
+    static union {
+        rtc_state_t s;
+        uint8_t b[sizeof(rtc_state_t)];
+    } rtc;                      // RTC memory: the image outlives every boot
+    truth_t truth = { 0 };
+    uint64_t wall = 1700000000000ull;
+    uint32_t n_cold = 0, n_wake = 0, n_fresh_wake = 0, n_flip = 0, n_back = 0;
+    uint32_t restored_wrong = 0, damaged_taken = 0, noise_taken = 0, accounts_wrong = 0;
+    bool sealed_now = false;    // The image holds an intact seal from the last sleep
+    bool damaged = false;
+    uint64_t pending_ms = 0;    // The last sleep, counted by the wake that ends it
+
+    for (size_t i = 0; i < sizeof(rtc.b); i++) rtc.b[i] = (uint8_t)rand();
+
+    for (int c = 0; c < o->cycles; c++) {
+        bool cold = c == 0 || rnd() < o->cold;
+        const rtc_state_t *retained = NULL;
+        // power_mgr_boot()
+        if (cold) {
+            n_cold++;
+            // A power loss leaves noise; a reset leaves the image as it was
+            if (rnd() < 0.5) {
+                for (size_t i = 0; i < sizeof(rtc.b); i++) rtc.b[i] = (uint8_t)rand();
+                if (rtc_state_valid(&rtc.s)) noise_taken++;
+            }
+            rtc_state_reset(&rtc.s);
+            truth = (truth_t){ 0 };
+        } else if (rtc_state_valid(&rtc.s)) {
+            if (damaged) damaged_taken++;
+            // A clock set back past the start of the sleep adds no sleep time
+            uint64_t back = 0;
+            if (rnd() < o->clock_back) {
+                n_back++;
+                back = wall - rtc.s.sleep_entered_ms + 1000;
+            } else {
+                truth.asleep_ms += pending_ms;
+            }
+            rtc_state_on_wake(&rtc.s, wall - back);
+            retained = &rtc.s;
+            n_wake++;
+        } else {
+            check(damaged || !sealed_now, "an intact block was rejected");
+            n_fresh_wake++;
+            rtc_state_reset(&rtc.s);
+            truth = (truth_t){ 0 };
+        }
+
+        if (retained) {
+            // power_mgr_restore()
+            const rtc_state_t *r = retained;
+            truth.wakes++;
+            bool same = r->recording_count == truth.recording_count &&
+                        !strcmp(r->selected_file, truth.selected_file) && r->calibrated == truth.calibrated &&
+                        r->noise_floor == truth.noise_floor && r->gain == truth.gain &&
+                        r->peer_valid == truth.peer_valid && r->peer_addr_type == truth.peer_addr_type &&
+                        !memcmp(r->peer_addr, truth.peer_addr, 6);
+            if (!same) restored_wrong++;
+            if (r->wake_count != truth.wakes || r->sleeps != truth.sleeps || r->awake_ms != truth.awake_ms ||
+                r->asleep_ms != truth.asleep_ms) {
+                accounts_wrong++;
+            }
+        }
+
+        // Awake: record, pick a file, maybe calibrate or connect
+        uint64_t awake = 2000 + (uint64_t)(rnd() * 600000);
+        truth.recording_count += (int32_t)(rnd() * 3);
+        if (rnd() < 0.3) snprintf(truth.selected_file, sizeof(truth.selected_file), "r%07d.raw", truth.recording_count);
+        if (rnd() < 0.3) {
+            truth.calibrated = 1;
+            truth.noise_floor = (float)(rnd() * 100.0);
+            truth.gain = (float)(1.0 + rnd() * 7.0);
+        }
+        if (rnd() < 0.2) {
+            truth.peer_valid = 1;
+            truth.peer_addr_type = (uint8_t)(rnd() * 2);
+            for (int k = 0; k < 6; k++) truth.peer_addr[k] = (uint8_t)rand();
+        }
+        wall += awake;
+
+        // power_mgr_prepare(), then rtc_state_on_sleep()
+        rtc_state_t *s = &rtc.s;
+        s->recording_count = truth.recording_count;
+        strcpy(s->selected_file, truth.selected_file);
+        s->calibrated = truth.calibrated;
+        s->noise_floor = truth.calibrated ? truth.noise_floor : 0.0f;
+        s->gain = truth.calibrated ? truth.gain : 1.0f;
+        truth.noise_floor = s->noise_floor;
+        truth.gain = s->gain;
+        s->peer_valid = truth.peer_valid;
+        s->peer_addr_type = truth.peer_addr_type;
+        memcpy(s->peer_addr, truth.peer_addr, 6);
+        rtc_state_on_sleep(s, wall, awake);
+        truth.sleeps++;
+        truth.awake_ms += awake;
+        sealed_now = true;
+        damaged = false;
+
+        // Asleep
+        uint64_t asleep = 60000 + (uint64_t)(rnd() * 7200000);
+        wall += asleep;
+        if (rnd() < o->flip) {
+            n_flip++;
+            size_t bit = (size_t)(rnd() * (offsetof(rtc_state_t, crc) + 4) * 8);
+            rtc.b[bit / 8] ^= (uint8_t)(1u << (bit % 8));
+            damaged = true;
+            sealed_now = false;
+        }
+        pending_ms = asleep;
+    }
+    printf("%d boots: %u cold, %u wakes restored, %u wakes from a damaged block, %u flips, %u clock set back\n",
+           o->cycles, n_cold, n_wake, n_fresh_wake, n_flip, n_back);
+    printf("  restored wrong %u, accounting wrong %u, damaged taken %u, noise taken %u\n", restored_wrong,
+           accounts_wrong, damaged_taken, noise_taken);
+    check(restored_wrong == 0, "a wake restored something other than what was saved");
+    check(accounts_wrong == 0, "wake, sleep or time accounting is off");
+    check(damaged_taken == 0 && noise_taken == 0, "a damaged block or noise was taken for state");
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --cycles N           boots (default 10000)\n"
+            "  --cold P             share of boots that are cold (default 0.05)\n"
+            "  --flip P             a bit flipped while asleep (default 0.02)\n"
+            "  --clock-back P       wall clock set back while asleep (default 0.02)\n"
+            "  --seed N             (default 1)\n",
+            argv0);
+}
+
+int main(int argc, char **argv) {
+    opts_t o = { .cycles = 10000, .cold = 0.05, .flip = 0.02, .clock_back = 0.02 };
+    unsigned seed = 1;
+
+    static const struct option opts[] = {
+        { "cycles",     required_argument, 0, 'n' },
+        { "cold",       required_argument, 0, 'c' },
+        { "flip",       required_argument, 0, 'f' },
+        { "clock-back", required_argument, 0, 'b' },
+        { "seed",       required_argument, 0, 's' },
+        { "help",       no_argument,       0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", opts, NULL)) != -1) {
+        switch (opt) {
+        case 'n': o.cycles = atoi(optarg); break;
+        case 'c': o.cold = atof(optarg); break;
+        case 'f': o.flip = atof(optarg); break;
+        case 'b': o.clock_back = atof(optarg); break;
+        case 's': seed = (unsigned)atoi(optarg); break;
+        default: usage(argv[0]); return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (o.cycles < 1 || o.cold < 0 || o.cold > 1 || o.flip < 0 || o.flip > 1 ||
+        o.clock_back < 0 || o.clock_back > 1) {
+        usage(argv[0]);
+        return 2;
+    }
+    srand(seed);
+
+    check_layout();
+    check_block();
+    run_cycles(&o);
+    printf("%s\n", s_failures ? "FAILED" : "ok");
+    return s_failures ? 1 : 0;
+}
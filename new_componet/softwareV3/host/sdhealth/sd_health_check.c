@@ -0,0 +1,341 @@
+/**
+ * @file sd_health_check.c
+ * @brief SD card health grades and thresholds on synthetic latency traces
+ *
+ * Drives the firmware's sd_health.c the way sd_storage.c does, from a
+ * latency-model disk:
+ *   recording   a 5120-byte buffer written and synced every 32 ms
+ *               (sd_health_write); a failed write is followed by a card
+ *               recovery (sd_health_retry), as in rec_store.c
+ *   every 1 s   the main loop's health tick: free space every 60 s, and a
+ *               one-sector probe when the card is idle and no I/O was seen
+ *               for the probe interval (sd_health_probe_due)
+ * Write latency is a lognormal busy time around the phase's median, with
+ * a share of stalls; a phase can fail writes or probes and fill the card.
+ *
+ * Each scenario is a sequence of phases with the grade expected at the
+ * end of each. Besides the grades it checks:
+ *   - p50/p95/p99 are within their log2 bucket of the exact percentiles
+ *   - no probe while recording; idle probes come once per interval
+ *   - use per hour matches the recording rate while the trend is all recording
+ * and a threshold sweep: cards whose exact p99 is clearly above or below
+ * --slow-ms (a factor of two, the bucket width) are graded by it.
+ *
+ *   sd_health_check
+ *   sd_health_check --slow-ms 100 --probe-s 60 --seed 3
+ *
+ * Exit status 1 if any check fails, 2 on bad arguments.
+ */
+
+#define _GNU_SOURCE
+#include "sd_health.h"
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WRITE_BYTES     5120        // RAW_AUDIO_BUFFER_SIZE * sizeof(raw_audio_sample_t)
+#define WRITE_MS        32          // One buffer of 512 samples at 16 kHz
+#define TICK_MS         1000        // main.c loop
+#define FREE_MS         60000       // sd_storage.c: SD_HEALTH_FREE_MS
+#define LOW_FREE_PCT    5           // sd_storage.c: s_limits
+#define FULL_HOURS      24
+#define SIGMA           0.5
+#define PROBE_US        900
+#define MB              (1024ull * 1024)
+#define GB              (1024 * MB)
+#define MAX_PHASES      6
+
+typedef struct {
+    uint32_t seconds;
+    bool recording;
+    double median_ms;           // Write busy time
+    double stall_pct;           // Share of writes that stall
+    double stall_ms;
+    double fail_p;              // Share of writes that fail
+    bool probe_fail;
+    sd_health_grade_t expect;
+} phase_t;
+
+typedef struct {
+    const char *name;
+    uint64_t free_bytes;        // At the start, of a 32 GB card
+    phase_t phases[MAX_PHASES];
+} scenario_t;
+
+#define OK  SD_HEALTH_OK
+#define DEG SD_HEALTH_DEGRADED
+#define FAIL SD_HEALTH_FAILING
+
+static const scenario_t kScenarios[] = {
+    { "healthy", 28 * GB, {
+        { 600,  true,  8, 0.5, 120, 0,   false, OK },
+        { 1800, false, 0, 0,   0,   0,   false, OK },
+        { 600,  true,  8, 0.5, 120, 0,   false, OK },
+    } },
+    { "slowing", 28 * GB, {
+        { 600,  true,  8, 0.5, 120, 0,   false, OK },
+        { 600,  true,  8, 4,   600, 0,   false, DEG },
+    } },
+    { "write failures", 28 * GB, {
+        { 300,  true,  8, 0.5, 120, 0,   false, OK },
+        { 5,    true,  8, 0,   0,   1,   false, FAIL },
+        { 300,  true,  8, 0.5, 120, 0,   false, DEG },
+    } },
+    { "probe failure", 28 * GB, {
+        { 900,  false, 0, 0,   0,   0,   false, OK },
+        { 900,  false, 0, 0,   0,   0,   true,  FAIL },
+        { 900,  false, 0, 0,   0,   0,   false, DEG },
+    } },
+    { "filling", 1900 * MB, {
+        { 120,  false, 0, 0,   0,   0,   false, OK },
+        { 900,  true,  8, 0.5, 120, 0,   false, DEG },
+        { 1800, false, 0, 0,   0,   0,   false, OK },
+        { 3600, true,  8, 0.5, 120, 0,   false, DEG },
+        { 1800, false, 0, 0,   0,   0,   false, DEG },
+    } },
+};
+#define SCENARIOS (sizeof(kScenarios) / sizeof(kScenarios[0]))
+
+typedef struct {
+    sd_health_t h;
+    sd_health_limits_t limits;
+    uint64_t total;
+    uint64_t free_bytes;
+    uint32_t now;
+    uint32_t last_free;
+    uint32_t probe_ms;
+    uint32_t *lat;              // Every write latency, for the exact percentiles
+    uint32_t lat_n, lat_cap;
+    uint32_t rec_probes;        // Probes while recording
+} sim_t;
+
+static int s_failures;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        printf("  FAIL %s\n", what);
+        s_failures++;
+    }
+}
+
+static double rnd(void) {
+    return (rand() + 0.5) / ((double)RAND_MAX + 1.0);
+}
+
+static double gauss(void) {
+    return sqrt(-2.0 * log(rnd())) * cos(2.0 * M_PI * rnd());
+}
+
+static uint32_t write_latency_us(const phase_t *p) {
+    double ms = p->median_ms * exp(SIGMA * gauss());
+    if (rnd() * 100.0 < p->stall_pct) ms += p->stall_ms * (0.5 + rnd());
+    return (uint32_t)(ms * 1000.0);
+}
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Same rank as sd_health_percentile()
+static uint32_t exact_percentile(sim_t *s, uint32_t pct) {
+    if (s->lat_n == 0) return 0;
+    uint32_t *sorted = malloc(s->lat_n * sizeof(uint32_t));
+    memcpy(sorted, s->lat, s->lat_n * sizeof(uint32_t));
+    qsort(sorted, s->lat_n, sizeof(uint32_t), cmp_u32);
+    uint32_t rank = (uint32_t)(((uint64_t)s->lat_n * pct + 99) / 100);
+    if (rank == 0) rank = 1;
+    uint32_t v = sorted[rank - 1];
+    free(sorted);
+    return v;
+}
+
+// Within the log2 bucket of the exact value
+static bool close_to(uint32_t reported, uint32_t exact) {
+    return (uint64_t)reported * 2 >= exact && reported <= (uint64_t)exact * 2;
+}
+
+static void sim_init(sim_t *s, uint64_t free_bytes, uint32_t slow_ms, uint32_t probe_s) {
+    memset(s, 0, sizeof(*s));
+    sd_health_init(&s->h);
+    s->limits = (sd_health_limits_t){ .slow_us = slow_ms * 1000u, .low_free_pct = LOW_FREE_PCT,
+                                      .full_hours = FULL_HOURS };
+    s->total = 32 * GB;
+    s->free_bytes = free_bytes;
+    s->probe_ms = probe_s * 1000u;
+    s->now = 1;
+}
+
+static void sim_free(sim_t *s) {
+    free(s->lat);
+}
+
+static void note_latency(sim_t *s, uint32_t us) {
+    if (s->lat_n == s->lat_cap) {
+        s->lat_cap = s->lat_cap ? s->lat_cap * 2 : 65536;
+        s->lat = realloc(s->lat, s->lat_cap * sizeof(uint32_t));
+    }
+    s->lat[s->lat_n++] = us;
+}
+
+// Returns the probes made
+static uint32_t run_phase(sim_t *s, const phase_t *p) {
+    uint32_t end = s->now + p->seconds * 1000u;
+    uint32_t next_write = s->now;
+    uint32_t next_tick = s->now;
+    uint32_t probes = 0;
+    while (s->now < end) {
+        if (p->recording && s->now >= next_write) {
+            uint32_t us = write_latency_us(p);
+            bool ok = rnd() >= p->fail_p;
+            sd_health_write(&s->h, WRITE_BYTES, us, ok, s->now);
+            note_latency(s, us);
+            if (ok) {
+                s->free_bytes -= s->free_bytes >= WRITE_BYTES ? WRITE_BYTES : s->free_bytes;
+            } else {
+                sd_health_retry(&s->h);
+            }
+            next_write += WRITE_MS;
+        }
+        if (s->now >= next_tick) {
+            // sd_storage_health_tick(): idle means no recording
+            if (s->now - s->last_free >= FREE_MS || s->last_free == 0) {
+                sd_health_free(&s->h, s->free_bytes, s->now);
+                s->last_free = s->now;
+            }
+            if (!p->recording && sd_health_probe_due(&s->h, s->probe_ms, s->now)) {
+                sd_health_probe(&s->h, PROBE_US, !p->probe_fail, s->now);
+                probes++;
+            }
+            next_tick += TICK_MS;
+        }
+        uint32_t next = p->recording && next_write < next_tick ? next_write : next_tick;
+        s->now = next < end ? next : end;
+    }
+    return probes;
+}
+
+static void run_scenario(const scenario_t *sc, uint32_t slow_ms, uint32_t probe_s) {
+    sim_t s;
+    sim_init(&s, sc->free_bytes, slow_ms, probe_s);
+    printf("%s\n", sc->name);
+    for (int i = 0; i < MAX_PHASES && sc->phases[i].seconds; i++) {
+        const phase_t *p = &sc->phases[i];
+        uint32_t writes = s.h.writes;
+        uint32_t probes = run_phase(&s, p);
+        sd_health_grade_t g = sd_health_grade(&s.h, s.total, &s.limits);
+
+        uint32_t p50 = sd_health_percentile(&s.h, 50);
+        uint32_t p95 = sd_health_percentile(&s.h, 95);
+        uint32_t p99 = sd_health_percentile(&s.h, 99);
+        uint32_t x50 = exact_percentile(&s, 50), x95 = exact_percentile(&s, 95), x99 = exact_percentile(&s, 99);
+        int32_t full_h = sd_health_hours_to_full(&s.h);
+        printf("  %-4s %5lus %7lu %8lu %8lu %8lu %8lu %8lu %8lu %6lu %8llu %6lld %6ld  %-8s %s\n",
+               p->recording ? "rec" : "idle", (unsigned long)p->seconds, (unsigned long)(s.h.writes - writes),
+               (unsigned long)p50, (unsigned long)x50, (unsigned long)p95, (unsigned long)x95,
+               (unsigned long)p99, (unsigned long)x99, (unsigned long)probes,
+               (unsigned long long)(s.free_bytes / (1024 * 1024)),
+               (long long)(sd_health_use_per_hour(&s.h) / (1024 * 1024)), (long)full_h,
+               sd_health_grade_name(g), g == p->expect ? "" : "<- expected");
+
+        check(g == p->expect, "grade at the end of a phase");
+        check(close_to(p50, x50) && close_to(p95, x95) && close_to(p99, x99),
+              "percentile outside the bucket of the exact value");
+        if (p->recording) {
+            check(probes == 0, "probe while recording");
+        } else {
+            // Once per interval since the last write or probe
+            uint32_t n = p->seconds / probe_s;
+            check(probes + 1 >= n && probes <= n + 1, "idle probes not once per interval");
+        }
+        // A trend window (16 samples a minute apart) that is all recording
+        if (p->recording && p->seconds >= FREE_MS / 1000 * (SD_HEALTH_TREND_LEN + 1) && s.free_bytes) {
+            double expect = (double)WRITE_BYTES * 3600000.0 / WRITE_MS;
+            double got = (double)sd_health_use_per_hour(&s.h);
+            check(fabs(got - expect) < expect * 0.05, "use per hour is not the recording rate");
+        }
+        char line[SD_HEALTH_REPORT_LEN];
+        size_t n = sd_health_report(&s.h, s.total, &s.limits, line, sizeof(line));
+        check(n > 0 && n < sizeof(line) - 1 && strncmp(line, "SDH v1 grade=", 13) == 0, "report line");
+    }
+    sim_free(&s);
+}
+
+// Cards of rising p99 (stall share): graded by p99 against slow_ms, outside the bucket uncertainty
+static void sweep(uint32_t slow_ms) {
+    static const double kStallPct[] = { 0, 0.3, 0.6, 1.2, 2, 4, 8 };
+    static const double kStallMs[] = { 50, 150, 400, 1000 };
+    printf("threshold sweep, slow %lu ms\n", (unsigned long)slow_ms);
+    printf("  stall%%  stall_ms  p99_us  exact_us  grade\n");
+    for (unsigned a = 0; a < sizeof(kStallPct) / sizeof(kStallPct[0]); a++) {
+        for (unsigned b = 0; b < sizeof(kStallMs) / sizeof(kStallMs[0]); b++) {
+            sim_t s;
+            sim_init(&s, 28 * GB, slow_ms, 300);
+            phase_t p = { 300, true, 8, kStallPct[a], kStallMs[b], 0, false, OK };
+            run_phase(&s, &p);
+            uint32_t x99 = exact_percentile(&s, 99);
+            sd_health_grade_t g = sd_health_grade(&s.h, s.total, &s.limits);
+            const char *note = "";
+            if (x99 > 2 * slow_ms * 1000u) {
+                check(g == SD_HEALTH_DEGRADED, "slow card graded ok");
+                if (g != SD_HEALTH_DEGRADED) note = "<- expected degraded";
+            } else if (x99 * 2 < slow_ms * 1000u) {
+                check(g == SD_HEALTH_OK, "fast card graded degraded");
+                if (g != SD_HEALTH_OK) note = "<- expected ok";
+            } else {
+                note = "(within a bucket of the limit)";
+            }
+            printf("  %6.1f %9.0f %7lu %9lu  %-8s %s\n", kStallPct[a], kStallMs[b],
+                   (unsigned long)sd_health_percentile(&s.h, 99), (unsigned long)x99, sd_health_grade_name(g), note);
+            sim_free(&s);
+        }
+    }
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --slow-ms N          p99 limit, CONFIG_SALESTAG_SD_SLOW_MS (default 250)\n"
+            "  --probe-s N          idle probe interval, CONFIG_SALESTAG_SD_PROBE_S (default 300)\n"
+            "  --seed N             (default 1)\n",
+            argv0);
+}
+
+int main(int argc, char **argv) {
+    uint32_t slow_ms = 250;
+    uint32_t probe_s = 300;
+    unsigned seed = 1;
+
+    static const struct option opts[] = {
+        { "slow-ms", required_argument, 0, 'l' },
+        { "probe-s", required_argument, 0, 'p' },
+        { "seed",    required_argument, 0, 's' },
+        { "help",    no_argument,       0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", opts, NULL)) != -1) {
+        switch (opt) {
+        case 'l': slow_ms = (uint32_t)atol(optarg); break;
+        case 'p': probe_s = (uint32_t)atol(optarg); break;
+        case 's': seed = (unsigned)atoi(optarg); break;
+        default: usage(argv[0]); return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (slow_ms < 20 || slow_ms > 10000 || probe_s < 10 || probe_s > 86400) {
+        usage(argv[0]);
+        return 2;
+    }
+    srand(seed);
+
+    printf("slow %lu ms, probe every %lu s idle, seed %u\n", (unsigned long)slow_ms, (unsigned long)probe_s, seed);
+    printf("  phase   time  writes   p50_us   exact   p95_us   exact   p99_us   exact probes  free_mb  mb/h full_h  grade\n");
+    for (unsigned i = 0; i < SCENARIOS; i++) run_scenario(&kScenarios[i], slow_ms, probe_s);
+    sweep(slow_ms);
+    printf("%s\n", s_failures ? "FAILED" : "ok");
+    return s_failures ? 1 : 0;
+}
@@ -0,0 +1,526 @@
+/**
+ * @file sd_recov_check.c
+ * @brief Recordings through injected card faults: no sample lost unaccounted or written twice
+ *
+ * Runs the firmware's rec_store.c (the storage task's write path),
+ * spill_ring.c and fault_inject.c against a simulated card and recording
+ * file, with faults injected at the firmware's own points:
+ *   sd_write     a buffer write (flush) fails
+ *   sd_remount   the remount after a power cycle fails
+ * The file mirrors raw_audio_storage.c: a 512-sample buffer written and
+ * synced as a whole, kept when the write fails and across a suspend,
+ * written first on resume. The capture hands over 512-sample blocks every
+ * 32 ms through the 2048-sample queue; the storage task wakes for each
+ * block, and every REC_SERVICE_MS while recovering (rec_ctrl.c). A
+ * recovery is sd_recovery.c's: up to three power cycles of 1 s, 500 ms
+ * apart. A flush takes --write-ms of the task's time.
+ *
+ * Every sample carries the low bits of its sequence number; the file model
+ * keeps the whole number (a spilled sample must match the next one the
+ * ring accepted). Each loss is noted with the samples it hit, so the file
+ * can be checked against what was captured:
+ *   - samples are in capture order and none is written twice
+ *   - every missing sample was noted lost: queue overflow, spill ring
+ *     full, or a recording given up (spill discarded, buffer abandoned,
+ *     rest of the recording discarded), and none of those was written
+ *   - a recording with none of those loses nothing
+ *   - no sample is dropped by a write retry
+ *   - timestamps are not before the capture nor more than 1 s after it
+ * plus the spill ring on its own.
+ *
+ *   sd_recov_check
+ *   sd_recov_check --scenario "sd_write:p=0.001,burst=2;sd_remount:p=0.4" --spill-kb 32
+ *
+ * Exit status 1 if any check fails, 2 on bad arguments.
+ */
+
+#define _GNU_SOURCE
+#include "rec_store.h"
+#include "spill_ring.h"
+#include "fault_inject.h"
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RATE_HZ         16000
+#define BLOCK           512         // AUDIO_BUFFER_FRAMES, RAW_AUDIO_BUFFER_SIZE
+#define BLOCK_MS        32
+#define QUEUE_LEN       2048        // rec_ctrl.c: REC_SAMPLE_QUEUE_LEN
+#define SERVICE_MS      10          // rec_ctrl.c: REC_SERVICE_MS
+#define MAX_RECOVERIES  3           // rec_ctrl.c: REC_MAX_RECOVERIES
+#define ATTEMPTS        3           // sd_recovery.c: SD_RECOVERY_ATTEMPTS
+#define CYCLE_MS        1000        // sd_storage.c: reset wait of a power cycle
+#define RETRY_MS        500         // sd_recovery.c: SD_RECOVERY_RETRY_MS
+#define SAMPLE_BYTES    10          // sizeof(raw_audio_sample_t)
+#define LATE_MS         1000
+
+typedef struct {
+    const char *name;
+    const char *faults;
+} scenario_t;
+
+static const scenario_t kScenarios[] = {
+    { "clean",           "" },
+    { "write errors",    "sd_write:p=0.0005" },
+    { "write bursts",    "sd_write:p=0.0005,burst=4" },
+    { "remount retries", "sd_write:p=0.0005;sd_remount:p=0.5" },
+    { "card gone",       "sd_write:p=0.0005;sd_remount:p=1" },
+};
+#define SCENARIOS (sizeof(kScenarios) / sizeof(kScenarios[0]))
+
+typedef struct {
+    uint32_t recordings;
+    uint32_t recoveries;
+    uint32_t power_cycles;
+    uint32_t given_up;
+    uint32_t spill_peak;
+    uint64_t captured;
+    uint64_t written;
+    uint64_t queue_drops;       // Queue full at a block
+    uint64_t spill_full;        // Spill ring refused
+    uint64_t given_up_lost;     // Spill discarded, buffer abandoned, rest discarded
+    uint64_t retry_drops;       // Dropped by the full-buffer retry
+    uint64_t unaccounted;       // Missing samples no loss explains
+    uint64_t out_of_order;      // Written twice, out of order, or written after being noted lost
+    uint64_t late;
+    uint32_t lossy_clean;       // Recordings that lost samples with no cause
+} sim_result_t;
+
+typedef struct {
+    // Clock and faults
+    uint32_t now;
+    uint32_t cost;              // Task time used in this wake-up
+    uint32_t write_ms;
+    fi_ctx_t fi;
+    // Capture queue, as sequence numbers
+    uint32_t queue[QUEUE_LEN];
+    uint32_t q_head, q_count;
+    uint32_t captured;
+    uint32_t cur_seq;           // Sample being stored
+    uint8_t *lost;              // lost[seq]: a loss took it
+    // File: committed samples and the unwritten buffer
+    uint32_t *file_seq;
+    uint32_t *file_ts;
+    uint32_t file_n;
+    uint32_t buf_seq[BLOCK];
+    uint32_t buf_ts[BLOCK];
+    uint32_t buf_n;
+    bool suspended;
+    // Card recovery
+    uint32_t ready_at;
+    rec_store_card_t result;
+    // Store
+    spill_ring_t spill;
+    rec_store_ops_t ops;
+    rec_store_t store;
+    uint32_t *shadow;           // What the spill ring accepted, in order
+    uint32_t sh_head, sh_count;
+    // Per-recording loss
+    uint32_t queue_drops, spill_full, given_up_lost, retry_drops;
+    bool gave_up;
+    sim_result_t *r;
+} sim_t;
+
+static int s_failures;
+static sim_t *s_clock;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        printf("  FAIL %s\n", what);
+        s_failures++;
+    }
+}
+
+static uint32_t sim_now(void) {
+    return s_clock ? s_clock->now : 0;
+}
+
+// raw_audio_storage.c: flush_sample_buffer()
+static bool flush(sim_t *s) {
+    s->cost += s->write_ms;
+    if (fi_hit(&s->fi, FI_SD_WRITE, 32 + s->file_n * SAMPLE_BYTES)) {
+        fi_failed(&s->fi, FI_SD_WRITE);
+        return false;
+    }
+    fi_ok(&s->fi, FI_SD_WRITE);
+    memcpy(s->file_seq + s->file_n, s->buf_seq, s->buf_n * sizeof(uint32_t));
+    memcpy(s->file_ts + s->file_n, s->buf_ts, s->buf_n * sizeof(uint32_t));
+    s->file_n += s->buf_n;
+    s->buf_n = 0;
+    return true;
+}
+
+// raw_audio_storage_add_sample_at()
+static bool sim_write(void *ctx, uint16_t v, uint32_t ts_ms) {
+    sim_t *s = ctx;
+    uint32_t seq = s->cur_seq;
+    if (s->store.mode == REC_STORE_DRAINING) {
+        check(s->sh_count > 0, "drained more than the spill ring accepted");
+        seq = s->shadow[s->sh_head];
+        s->sh_head = (s->sh_head + 1) % s->spill.cap;
+        s->sh_count--;
+    }
+    check(v == (uint16_t)seq, "spill ring returned a sample out of order");
+    check(!s->suspended, "write to a suspended file");
+    if (s->buf_n >= BLOCK && !flush(s)) {
+        s->retry_drops++;
+        s->lost[seq] = 1;
+        return false;
+    }
+    s->buf_seq[s->buf_n] = seq;
+    s->buf_ts[s->buf_n] = ts_ms;
+    s->buf_n++;
+    return s->buf_n < BLOCK || flush(s);
+}
+
+static void sim_suspend(void *ctx) {
+    sim_t *s = ctx;
+    s->suspended = true;
+}
+
+// sd_recovery.c's task, its outcome decided up front
+static bool sim_recover(void *ctx) {
+    sim_t *s = ctx;
+    uint32_t t = 0;
+    s->r->recoveries++;
+    s->result = REC_STORE_CARD_GONE;
+    for (int attempt = 1; attempt <= ATTEMPTS; attempt++) {
+        s->r->power_cycles++;
+        t += CYCLE_MS;
+        if (!fi_hit(&s->fi, FI_SD_REMOUNT, 0)) {
+            s->result = REC_STORE_CARD_BACK;
+            break;
+        }
+        t += RETRY_MS;
+    }
+    s->ready_at = s->now + t;
+    return true;
+}
+
+static rec_store_card_t sim_card(void *ctx) {
+    sim_t *s = ctx;
+    return s->now < s->ready_at ? REC_STORE_CARD_AWAY : s->result;
+}
+
+// raw_audio_storage_resume(): reopen at the committed size, the kept buffer first
+static bool sim_resume(void *ctx) {
+    sim_t *s = ctx;
+    s->suspended = false;
+    return s->buf_n == 0 || flush(s);
+}
+
+static void sim_lost(void *ctx, rec_store_lost_t why) {
+    sim_t *s = ctx;
+    (void)why;
+    s->gave_up = true;
+    // The spill, cleared
+    for (; s->sh_count; s->sh_count--, s->sh_head = (s->sh_head + 1) % s->spill.cap) {
+        s->lost[s->shadow[s->sh_head]] = 1;
+        s->given_up_lost++;
+    }
+}
+
+static const rec_store_ops_t kOps = {
+    .write = sim_write,
+    .suspend = sim_suspend,
+    .recover = sim_recover,
+    .card = sim_card,
+    .resume = sim_resume,
+    .lost = sim_lost,
+};
+
+static void store_one(sim_t *s, uint32_t seq) {
+    rec_store_mode_t mode = s->store.mode;
+    if (mode == REC_STORE_LOST) {
+        s->given_up_lost++;
+        s->lost[seq] = 1;
+        return;
+    }
+    s->cur_seq = seq;
+    bool ok = rec_store_sample(&s->store, (uint16_t)seq, s->now);
+    if (mode == REC_STORE_RECOVERING || mode == REC_STORE_DRAINING) {
+        if (ok) {
+            s->shadow[(s->sh_head + s->sh_count) % s->spill.cap] = seq;
+            s->sh_count++;
+        } else {
+            s->spill_full++;
+            s->lost[seq] = 1;
+        }
+    }
+}
+
+static bool queue_pop(sim_t *s, uint32_t *seq) {
+    if (s->q_count == 0) return false;
+    *seq = s->queue[s->q_head];
+    s->q_head = (s->q_head + 1) % QUEUE_LEN;
+    s->q_count--;
+    return true;
+}
+
+// One pass of rec_ctrl.c's storage_task loop
+static void task_wake(sim_t *s) {
+    s->cost = 0;
+    bool recovering = rec_store_recovering(&s->store);
+    uint32_t seq;
+    if (queue_pop(s, &seq)) {
+        store_one(s, seq);
+        // Not recovering: one sample per pass, so stop at the first card write
+        while (s->cost == 0 && !recovering && !rec_store_recovering(&s->store) && queue_pop(s, &seq)) {
+            store_one(s, seq);
+        }
+        // While the card is away the queue is emptied into the spill ring before any card work
+        while (recovering && queue_pop(s, &seq)) store_one(s, seq);
+    }
+    if (rec_store_recovering(&s->store)) rec_store_service(&s->store);
+}
+
+// The file against what was captured
+static void verify(sim_t *s, uint32_t t0, sim_result_t *r) {
+    int64_t prev = -1;
+    for (uint32_t i = 0; i <= s->file_n; i++) {
+        int64_t seq = i < s->file_n ? s->file_seq[i] : s->captured;
+        if (seq <= prev || (i < s->file_n && s->lost[seq])) {
+            r->out_of_order++;
+            continue;
+        }
+        for (int64_t m = prev + 1; m < seq; m++) r->unaccounted += !s->lost[m];
+        if (!s->gave_up && s->queue_drops == 0 && s->spill_full == 0 && seq > prev + 1) r->lossy_clean++;
+        prev = seq;
+        if (i == s->file_n) break;
+        uint32_t cap_ms = t0 + (uint32_t)((uint64_t)seq * 1000 / RATE_HZ);
+        if (s->file_ts[i] + 1 < cap_ms || s->file_ts[i] > cap_ms + LATE_MS) r->late++;
+    }
+}
+
+static void run_recording(sim_t *s, uint32_t seconds, sim_result_t *r) {
+    uint32_t t0 = s->now;
+    uint32_t end = t0 + seconds * 1000;
+    s->captured = 0;
+    s->file_n = s->buf_n = 0;
+    s->q_head = s->q_count = 0;
+    s->suspended = false;
+    s->sh_head = s->sh_count = 0;
+    memset(s->lost, 0, (size_t)seconds * RATE_HZ);
+    s->queue_drops = s->spill_full = s->given_up_lost = s->retry_drops = 0;
+    s->gave_up = false;
+    spill_ring_clear(&s->spill);
+    rec_store_open(&s->store);
+
+    uint32_t busy_until = t0;
+    uint32_t last_wake = t0;
+    for (;; s->now++) {
+        bool capturing = s->now < end;
+        if (capturing && (s->now - t0) % BLOCK_MS == BLOCK_MS - 1) {
+            for (int i = 0; i < BLOCK; i++) {
+                uint32_t seq = s->captured++;
+                if (s->q_count == QUEUE_LEN) {
+                    s->queue_drops++;
+                    s->lost[seq] = 1;
+                    continue;
+                }
+                s->queue[(s->q_head + s->q_count) % QUEUE_LEN] = seq;
+                s->q_count++;
+            }
+        }
+        if (!capturing && s->q_count == 0) break;
+        if (s->now < busy_until) continue;
+        bool timed_out = rec_store_recovering(&s->store) && s->now - last_wake >= SERVICE_MS;
+        if (s->q_count == 0 && !timed_out) continue;
+        task_wake(s);
+        last_wake = s->now;
+        busy_until = s->now + s->cost;
+    }
+
+    // rec_ctrl.c: store_close(), then raw_audio_storage_stop_recording()
+    while (rec_store_recovering(&s->store)) {
+        if (s->store.mode == REC_STORE_RECOVERING && s->now < s->ready_at) s->now = s->ready_at;
+        s->cost = 0;
+        rec_store_service(&s->store);
+        s->now += s->cost + 1;
+    }
+    if (s->buf_n && (s->suspended || !flush(s))) {
+        for (uint32_t i = 0; i < s->buf_n; i++) s->lost[s->buf_seq[i]] = 1;
+        s->given_up_lost += s->buf_n;
+    }
+    rec_store_close(&s->store);
+
+    r->recordings++;
+    r->given_up += s->gave_up;
+    r->captured += s->captured;
+    r->written += s->file_n;
+    r->queue_drops += s->queue_drops;
+    r->spill_full += s->spill_full;
+    r->given_up_lost += s->given_up_lost;
+    r->retry_drops += s->retry_drops;
+    verify(s, t0, r);
+    s->now += 1000;
+}
+
+static sim_result_t run(const char *faults, uint32_t recordings, uint32_t seconds, uint32_t spill_kb,
+                        uint32_t write_ms, unsigned seed) {
+    sim_result_t r = {0};
+    sim_t *s = calloc(1, sizeof(*s));
+    s->r = &r;
+    s->write_ms = write_ms;
+    size_t samples = (size_t)seconds * RATE_HZ;
+    s->file_seq = malloc(samples * sizeof(uint32_t));
+    s->file_ts = malloc(samples * sizeof(uint32_t));
+    s->lost = malloc(samples);
+    uint32_t cap = spill_kb * 1024 / sizeof(uint16_t);
+    uint16_t *spill_buf = malloc(cap * sizeof(uint16_t));
+    s->shadow = malloc(cap * sizeof(uint32_t));
+
+    s_clock = s;
+    fi_init(&s->fi, seed, sim_now);
+    if (fi_load(&s->fi, faults) < 0) {
+        printf("  bad scenario: %s\n", faults);
+        s_failures++;
+    }
+    spill_ring_init(&s->spill, spill_buf, cap, RATE_HZ);
+    s->ops = kOps;
+    s->ops.ctx = s;
+    rec_store_init(&s->store, &s->spill, &s->ops, MAX_RECOVERIES, BLOCK);
+    for (uint32_t i = 0; i < recordings; i++) run_recording(s, seconds, &r);
+    r.spill_peak = s->spill.peak;
+    check(s->spill.lost == r.spill_full, "spill ring's lost count disagrees with the refusals");
+
+    s_clock = NULL;
+    free(s->shadow);
+    free(spill_buf);
+    free(s->lost);
+    free(s->file_ts);
+    free(s->file_seq);
+    free(s);
+    return r;
+}
+
+// The ring on its own: order, timestamps, full and wrap-around
+static void check_ring(void) {
+    uint16_t buf[8];
+    spill_ring_t r;
+    spill_ring_init(&r, buf, 8, RATE_HZ);
+    uint16_t v;
+    uint32_t ts;
+    check(!spill_ring_pop(&r, &v, &ts), "pop from an empty ring");
+    for (uint16_t i = 0; i < 8; i++) check(spill_ring_push(&r, i, 100), "push");
+    check(!spill_ring_push(&r, 8, 101) && r.lost == 1, "full ring refuses");
+    for (uint16_t i = 0; i < 5; i++) {
+        check(spill_ring_pop(&r, &v, &ts) && v == i && ts == 100u + i / 16u, "pop in order");
+    }
+    for (uint16_t i = 8; i < 13; i++) check(spill_ring_push(&r, i, 200), "push after wrap");
+    for (uint16_t i = 5; i < 13; i++) check(spill_ring_pop(&r, &v, &ts) && v == i, "order across the wrap");
+    check(r.count == 0 && r.peak == 8, "empty, peak kept");
+    check(spill_ring_push(&r, 1, 300) && spill_ring_pop(&r, &v, &ts) && ts == 300, "new run restarts the clock");
+
+    // Refused samples split the timeline: the next run keeps its own arrival time
+    spill_ring_clear(&r);
+    for (uint16_t i = 0; i < 8; i++) spill_ring_push(&r, i, 400);
+    check(!spill_ring_push(&r, 8, 401), "full ring refuses");
+    spill_ring_pop(&r, &v, &ts);
+    check(spill_ring_push(&r, 9, 900) && r.run_count == 2, "push after a refusal starts a run");
+    for (uint16_t i = 1; i < 8; i++) spill_ring_pop(&r, &v, &ts);
+    check(spill_ring_pop(&r, &v, &ts) && v == 9 && ts == 900, "run after the gap keeps its arrival time");
+
+    // Runs are bounded: past SPILL_RING_RUNS gaps pushes are refused
+    spill_ring_clear(&r);
+    for (uint16_t i = 0; i < 8; i++) spill_ring_push(&r, i, 500);
+    uint32_t runs = 1;
+    for (uint16_t i = 0; i < 6; i++) {
+        spill_ring_push(&r, 100, 600);     // Refused: full
+        spill_ring_pop(&r, &v, &ts);
+        if (spill_ring_push(&r, i, 700 + i)) runs++;
+    }
+    check(runs == SPILL_RING_RUNS && r.run_count == SPILL_RING_RUNS, "runs bounded");
+    uint32_t prev = 0;
+    bool ordered = true;
+    while (spill_ring_pop(&r, &v, &ts)) {
+        ordered = ordered && ts >= prev;
+        prev = ts;
+    }
+    check(ordered && r.run_count == 0, "timestamps in order across runs");
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --recordings N       recordings per scenario (default 10)\n"
+            "  --seconds N          length of each recording (default 60)\n"
+            "  --spill-kb N         spill ring size, CONFIG_SALESTAG_SD_SPILL_KB (default 96)\n"
+            "  --write-ms N         task time per buffer write (default 6)\n"
+            "  --scenario SPEC      fault_inject rules to run instead of the built-in scenarios\n"
+            "  --seed N             (default 1)\n",
+            argv0);
+}
+
+int main(int argc, char **argv) {
+    uint32_t recordings = 10;
+    uint32_t seconds = 60;
+    uint32_t spill_kb = 96;
+    uint32_t write_ms = 6;
+    const char *custom = NULL;
+    unsigned seed = 1;
+
+    static const struct option opts[] = {
+        { "recordings", required_argument, 0, 'n' },
+        { "seconds",    required_argument, 0, 't' },
+        { "spill-kb",   required_argument, 0, 'k' },
+        { "write-ms",   required_argument, 0, 'w' },
+        { "scenario",   required_argument, 0, 'c' },
+        { "seed",       required_argument, 0, 's' },
+        { "help",       no_argument,       0, 'h' },
+        { 0, 0, 0, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", opts, NULL)) != -1) {
+        switch (opt) {
+        case 'n': recordings = (uint32_t)atol(optarg); break;
+        case 't': seconds = (uint32_t)atol(optarg); break;
+        case 'k': spill_kb = (uint32_t)atol(optarg); break;
+        case 'w': write_ms = (uint32_t)atol(optarg); break;
+        case 'c': custom = optarg; break;
+        case 's': seed = (unsigned)atoi(optarg); break;
+        default: usage(argv[0]); return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (recordings < 1 || recordings > 10000 || seconds < 1 || seconds > 3600 || spill_kb < 1 ||
+        spill_kb > 4096 || write_ms > 1000) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (custom) {
+        fi_ctx_t probe;
+        fi_init(&probe, 1, NULL);
+        if (fi_load(&probe, custom) < 0) {
+            fprintf(stderr, "Bad scenario: %s\n", custom);
+            return 2;
+        }
+    }
+
+    check_ring();
+
+    printf("%lu recordings of %lu s per scenario, %lu KB spill, %lu ms writes, seed %u\n",
+           (unsigned long)recordings, (unsigned long)seconds, (unsigned long)spill_kb,
+           (unsigned long)write_ms, seed);
+    printf("scenario         recov  cycles  gave-up  peak     written  queue  spill  given-up  unacc  order  late\n");
+    unsigned count = custom ? 1 : SCENARIOS;
+    for (unsigned i = 0; i < count; i++) {
+        const char *name = custom ? "custom" : kScenarios[i].name;
+        sim_result_t r = run(custom ? custom : kScenarios[i].faults, recordings, seconds, spill_kb, write_ms,
+                             seed + i);
+        printf("%-16s %5lu %7lu %8lu %5lu %11llu %6llu %6llu %9llu %6llu %6llu %5llu\n", name,
+               (unsigned long)r.recoveries, (unsigned long)r.power_cycles, (unsigned long)r.given_up,
+               (unsigned long)r.spill_peak, (unsigned long long)r.written, (unsigned long long)r.queue_drops,
+               (unsigned long long)r.spill_full, (unsigned long long)r.given_up_lost, (unsigned long long)r.unaccounted,
+               (unsigned long long)r.out_of_order, (unsigned long long)r.late);
+        check(r.out_of_order == 0, "sample written twice or out of order");
+        check(r.unaccounted == 0, "samples missing that no loss took");
+        check(r.lossy_clean == 0, "recording lost samples with no overflow or give-up");
+        check(r.retry_drops == 0, "sample dropped by a write retry");
+        check(r.late == 0, "timestamp before the capture or more than 1 s after it");
+    }
+    printf("%s\n", s_failures ? "FAILED" : "ok");
+    return s_failures ? 1 : 0;
+}
@@ -0,0 +1,488 @@
+/**
+ * @file st_telem.c
+ * @brief Decode live telemetry records, and check the record, meter and rate limiter
+ *
+ * Decode: each argument, or each line on stdin, is the manufacturer data of
+ * an advertisement in hex (what a phone scanner app shows; spaces, colons
+ * and a 0x prefix are ignored), starting with the company ID. Records are
+ * printed one per line; anything that is not a SalesTag telemetry record
+ * is reported and skipped.
+ *
+ * Check (--check) runs the firmware's live_telem.c against:
+ *   - round trips: random records through encode and decode, a header-only
+ *     record, and data that must be rejected (company, magic, version,
+ *     length)
+ *   - the meter: a -6 dBFS sine, a full-scale square, silence, a clipping
+ *     block, and speech bursts over a noise floor
+ *   - the rate limiter on a simulated timeline per interval: the task of
+ *     telem_adv.c waking once per interval with --jitter-ms of tick jitter
+ *     and on every recording state change, fed 32 ms capture blocks of
+ *     noise and speech-like bursts while recording. 60 s idle, 140 s of
+ *     recording with a shout, 100 s idle with a battery step.
+ * The timeline must keep every update gap at or above LIVE_TELEM_MIN_GAP,
+ * no gap above the heartbeat plus an interval, show each state change
+ * within an interval, update about once per interval while recording (once
+ * a second below 1 s: the clock's pace) and no more than once per heartbeat
+ * when idle, and carry the shout's clipping flag. The speech share averaged over the meter windows of the
+ * recording must be within 10 points of the bursts' true share.
+ *
+ *   st_telem FFFF54010C030034142D505F0062020200
+ *   st_telem --check --interval-ms 500,1000,2000
+ *
+ * Exit status 1 if any check fails or any input was not a record.
+ */
+
+#define _GNU_SOURCE
+#include "live_telem.h"
+#include "rec_fsm.h"
+#include <ctype.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RATE_HZ      16000
+#define BLOCK        512                 // AUDIO_BUFFER_FRAMES: one 32 ms capture block
+#define BLOCK_MS     32
+#define HEARTBEAT_MS 5000                // telem_adv.c
+#define MAX_CASES    16
+#define SIM_MS       300000
+#define REC_START_MS 60000
+#define REC_STOP_MS  200000
+#define SHOUT_MS     150000
+#define BATT_MS      250000
+#define NOISE_DBFS   -55.0
+#define SPEECH_DBFS  -25.0
+
+static int s_failures;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        printf("  FAIL %s\n", what);
+        s_failures++;
+    }
+}
+
+static int parse_list(const char *s, double *out, int max) {
+    int n = 0;
+    char *copy = strdup(s), *save = NULL;
+    for (char *tok = strtok_r(copy, ",", &save); tok && n < max; tok = strtok_r(NULL, ",", &save)) {
+        out[n++] = atof(tok);
+    }
+    free(copy);
+    return n;
+}
+
+static double rnd(void) {
+    return (rand() + 0.5) / ((double)RAND_MAX + 1.0);
+}
+
+static double gauss(void) {
+    return sqrt(-2.0 * log(rnd())) * cos(2.0 * M_PI * rnd());
+}
+
+static int16_t clip16(double v) {
+    if (v > 32767) return 32767;
+    if (v < -32768) return -32768;
+    return (int16_t)lrint(v);
+}
+
+// ---------------------------------------------------------------------------
+// Decode
+// ---------------------------------------------------------------------------
+
+static size_t parse_hex(const char *s, uint8_t *out, size_t cap, bool *bad) {
+    size_t n = 0;
+    int nibble = -1;
+    *bad = false;
+    if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) s += 2;
+    for (; *s && *s != '\n'; s++) {
+        if (*s == ' ' || *s == ':' || *s == '-' || *s == '\t' || *s == '\r') continue;
+        if (!isxdigit((unsigned char)*s) || n == cap) {
+            *bad = true;
+            return 0;
+        }
+        int v = isdigit((unsigned char)*s) ? *s - '0' : tolower((unsigned char)*s) - 'a' + 10;
+        if (nibble < 0) {
+            nibble = v;
+        } else {
+            out[n++] = (uint8_t)(nibble << 4 | v);
+            nibble = -1;
+        }
+    }
+    *bad = nibble >= 0;
+    return n;
+}
+
+static void level(char *buf, size_t cap, uint8_t code) {
+    if (code == LIVE_TELEM_NO_AUDIO) {
+        snprintf(buf, cap, "-");
+    } else {
+        snprintf(buf, cap, "%.1f", -code / 2.0);
+    }
+}
+
+static void print_header(void) {
+    printf("seq  state       flags               rms dB  peak dB  speech  batt   rec s  free min  pending\n");
+}
+
+static void print_record(const live_telem_t *t, size_t len) {
+    if (len < LIVE_TELEM_LEN) {
+        printf("header only (version %u): the record is in the periodic train\n", t->version);
+        return;
+    }
+    char flags[32] = "";
+    static const char *const names[] = { "nocard", "weak", "clip", "drop", "batt" };
+    for (int i = 0; i < 5; i++) {
+        if (t->flags & (1u << i)) {
+            if (flags[0]) strcat(flags, ",");
+            strcat(flags, names[i]);
+        }
+    }
+    char rms[8], peak[8], batt[8];
+    level(rms, sizeof(rms), t->rms);
+    level(peak, sizeof(peak), t->peak);
+    if (t->battery_pct == LIVE_TELEM_BATTERY_UNKNOWN) {
+        snprintf(batt, sizeof(batt), "-");
+    } else {
+        snprintf(batt, sizeof(batt), "%u%%", t->battery_pct);
+    }
+    printf("%3u  %-10s  %-18s  %6s  %7s  %5u%%  %4s  %6u  %8u  %7u\n", t->seq,
+           rec_fsm_state_name((rec_state_t)t->state), flags[0] ? flags : "-", rms, peak, t->speech_pct, batt,
+           t->rec_s, t->free_min, t->pending);
+}
+
+static bool decode_one(const char *hex, bool *header_done) {
+    uint8_t mfg[64];
+    bool bad;
+    size_t len = parse_hex(hex, mfg, sizeof(mfg), &bad);
+    live_telem_t t;
+    if (bad || !live_telem_decode(mfg, len, &t)) {
+        fprintf(stderr, "not a telemetry record: %s\n", hex);
+        return false;
+    }
+    if (!*header_done && len >= LIVE_TELEM_LEN) {
+        print_header();
+        *header_done = true;
+    }
+    print_record(&t, len);
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Record and meter
+// ---------------------------------------------------------------------------
+
+static bool same(const live_telem_t *a, const live_telem_t *b) {
+    return a->version == b->version && a->seq == b->seq && a->state == b->state && a->flags == b->flags &&
+           a->rms == b->rms && a->peak == b->peak && a->speech_pct == b->speech_pct &&
+           a->battery_pct == b->battery_pct && a->rec_s == b->rec_s && a->free_min == b->free_min &&
+           a->pending == b->pending;
+}
+
+static void check_record(void) {
+    printf("Record\n");
+    int bad = 0;
+    for (int i = 0; i < 1000; i++) {
+        live_telem_t t = {
+            .version = LIVE_TELEM_VERSION, .seq = (uint8_t)rand(), .state = (uint8_t)(rand() % REC_STATE_COUNT),
+            .flags = (uint8_t)(rand() & 0x1F), .rms = (uint8_t)rand(), .peak = (uint8_t)rand(),
+            .speech_pct = (uint8_t)(rand() % 101), .battery_pct = (uint8_t)rand(), .rec_s = (uint16_t)rand(),
+            .free_min = (uint16_t)rand(), .pending = (uint16_t)rand(),
+        };
+        uint8_t buf[LIVE_TELEM_LEN];
+        live_telem_t back;
+        if (live_telem_encode(&t, buf, sizeof(buf)) != LIVE_TELEM_LEN || !live_telem_decode(buf, sizeof(buf), &back) ||
+            !same(&t, &back)) {
+            bad++;
+        }
+    }
+    printf("  1000 round trips, %d wrong\n", bad);
+    check(bad == 0, "round trip");
+
+    live_telem_t t = { .seq = 7, .rms = 20 }, back;
+    uint8_t buf[LIVE_TELEM_LEN];
+    check(live_telem_encode(&t, buf, LIVE_TELEM_LEN - 1) == 0, "encode into a short buffer");
+    live_telem_encode(&t, buf, sizeof(buf));
+    check(live_telem_decode(buf, LIVE_TELEM_HDR_LEN, &back) && back.version == LIVE_TELEM_VERSION && back.seq == 0,
+          "header-only record");
+    check(!live_telem_decode(buf, LIVE_TELEM_HDR_LEN - 1, &back), "short data rejected");
+    static const int corrupt[] = { 0, 1, 2 };
+    for (size_t i = 0; i < sizeof(corrupt) / sizeof(corrupt[0]); i++) {
+        uint8_t c[LIVE_TELEM_LEN];
+        memcpy(c, buf, sizeof(c));
+        c[corrupt[i]] ^= 0x01;
+        check(!live_telem_decode(c, sizeof(c), &back), "company or magic rejected");
+    }
+    buf[3] = 0;
+    check(!live_telem_decode(buf, sizeof(buf), &back), "version 0 rejected");
+    printf("  header-only and rejects: ok\n");
+}
+
+static void feed(live_telem_meter_t *m, const int16_t *pcm, size_t n) {
+    for (size_t i = 0; i < n; i += BLOCK) {
+        size_t k = n - i < BLOCK ? n - i : BLOCK;
+        uint32_t peak;
+        uint32_t mean_sq = live_telem_block_power(pcm + i, k, &peak);
+        live_telem_meter_add(m, mean_sq, peak, k);
+    }
+}
+
+static void check_meter(void) {
+    printf("Meter\n");
+    static int16_t pcm[RATE_HZ];
+    live_telem_meter_t m;
+    live_telem_t t;
+
+    live_telem_meter_init(&m);
+    memset(&t, 0, sizeof(t));
+    live_telem_meter_take(&m, &t);
+    check(t.rms == LIVE_TELEM_NO_AUDIO && t.peak == LIVE_TELEM_NO_AUDIO, "no blocks: no audio");
+
+    for (int i = 0; i < RATE_HZ; i++) pcm[i] = clip16(16384 * sin(2 * M_PI * 1000.0 * i / RATE_HZ));
+    feed(&m, pcm, RATE_HZ);
+    live_telem_meter_take(&m, &t);
+    printf("  -6 dBFS sine: rms %.1f dB, peak %.1f dB\n", -t.rms / 2.0, -t.peak / 2.0);
+    check(abs(t.rms - 18) <= 1 && abs(t.peak - 12) <= 1, "sine level (-9.0 dB rms, -6.0 dB peak)");
+    check(!(t.flags & LIVE_TELEM_F_CLIPPING), "sine is not clipping");
+
+    for (int i = 0; i < RATE_HZ; i++) pcm[i] = (i / 8) & 1 ? 32767 : -32767;
+    feed(&m, pcm, RATE_HZ);
+    live_telem_meter_take(&m, &t);
+    check(t.rms == 0 && (t.flags & LIVE_TELEM_F_CLIPPING), "full-scale square: 0 dB, clipping");
+    feed(&m, pcm, 0);
+    live_telem_meter_take(&m, &t);
+    check(!(t.flags & LIVE_TELEM_F_CLIPPING), "clipping clears with the window");
+
+    memset(pcm, 0, sizeof(pcm));
+    feed(&m, pcm, RATE_HZ);
+    live_telem_meter_take(&m, &t);
+    check(t.rms == 254 && t.peak == 254 && t.speech_pct == 0, "silence");
+
+    // Noise floor, then 1 s of tone bursts 30 dB over it, then noise again
+    live_telem_meter_init(&m);
+    double noise = 32768 * pow(10, NOISE_DBFS / 20);
+    uint8_t pct[3];
+    for (int w = 0; w < 3; w++) {
+        for (int i = 0; i < RATE_HZ; i++) {
+            double v = noise * gauss();
+            if (w == 1) v += 2000 * sin(2 * M_PI * 220.0 * i / RATE_HZ);
+            pcm[i] = clip16(v);
+        }
+        feed(&m, pcm, RATE_HZ);
+        live_telem_meter_take(&m, &t);
+        pct[w] = t.speech_pct;
+    }
+    printf("  speech share: noise %u%%, bursts %u%%, noise again %u%%\n", pct[0], pct[1], pct[2]);
+    check(pct[0] <= 5 && pct[1] >= 90 && pct[2] <= 5, "speech detection over a noise floor");
+}
+
+// ---------------------------------------------------------------------------
+// Rate limiter timeline
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    int interval_ms;
+    int updates_rec, updates_idle;
+    int min_gap, max_gap;
+    int max_latency;
+    bool clip_seen;
+    double speech_true, speech_seen;
+} timeline_t;
+
+// Phrases of 2.5 s with 150 ms syllables and 80 ms gaps, 1.5 s pauses between
+static bool speaking(int ms) {
+    int p = ms % 4000;
+    return p < 2500 && p % 230 < 150;
+}
+
+static rec_state_t state_at(int ms) {
+    if (ms < REC_START_MS) return REC_ARMED;
+    if (ms < REC_START_MS + 300) return REC_STARTING;
+    if (ms < REC_STOP_MS) return REC_RECORDING;
+    if (ms < REC_STOP_MS + 400) return REC_FINALIZING;
+    return REC_ARMED;
+}
+
+static void run_timeline(timeline_t *r, int jitter_ms) {
+    live_telem_meter_t m;
+    live_telem_rate_t rate;
+    live_telem_meter_init(&m);
+    live_telem_rate_init(&rate, (uint32_t)r->interval_ms, HEARTBEAT_MS);
+    double noise = 32768 * pow(10, NOISE_DBFS / 20);
+    double speech = 32768 * pow(10, SPEECH_DBFS / 20) * sqrt(2.0);
+
+    int next = r->interval_ms;                      // The task's next tick
+    int wake = next + (jitter_ms ? rand() % (2 * jitter_ms + 1) - jitter_ms : 0);
+    int last_sent = -1;
+    rec_state_t shown = REC_ARMED;
+    int change_at = -1;
+    int speech_blocks = 0, blocks = 0;
+    double speech_sum = 0;
+    int speech_n = 0;
+    r->min_gap = SIM_MS;
+    r->max_gap = 0;
+    r->max_latency = 0;
+    r->updates_rec = r->updates_idle = 0;
+    r->clip_seen = false;
+    int16_t pcm[BLOCK];
+
+    for (int ms = 0; ms < SIM_MS; ms++) {
+        rec_state_t st = state_at(ms);
+        bool kicked = ms > 0 && st != state_at(ms - 1);     // rec_radio_quiet() and the FSM
+        if (kicked) change_at = ms;
+
+        // Capture runs from the start until the file is finalized
+        if (st == REC_RECORDING && ms % BLOCK_MS == 0) {
+            bool on = speaking(ms);
+            bool shout = ms >= SHOUT_MS && ms < SHOUT_MS + 300;
+            for (int i = 0; i < BLOCK; i++) {
+                double v = noise * gauss();
+                if (shout) {
+                    v += 31000 * sin(2 * M_PI * 300.0 * i / RATE_HZ);
+                } else if (on) {
+                    v += speech * sin(2 * M_PI * 180.0 * (ms * 16 + i) / RATE_HZ);
+                }
+                pcm[i] = clip16(v);
+            }
+            feed(&m, pcm, BLOCK);
+            blocks++;
+            speech_blocks += on;
+        }
+
+        bool tick = ms >= wake;
+        if (!tick && !kicked) continue;
+        if (tick) {
+            next += r->interval_ms;
+            wake = next + (jitter_ms ? rand() % (2 * jitter_ms + 1) - jitter_ms : 0);
+        }
+
+        live_telem_t t = { .battery_pct = ms < BATT_MS ? 80 : 79, .free_min = 600,
+                           .pending = ms < REC_STOP_MS + 400 ? 2 : 3 };
+        live_telem_meter_take(&m, &t);
+        if (st == REC_RECORDING && t.rms != LIVE_TELEM_NO_AUDIO) {
+            speech_sum += t.speech_pct;
+            speech_n++;
+        }
+        t.state = (uint8_t)st;
+        if (st == REC_RECORDING) t.rec_s = (uint16_t)((ms - REC_START_MS) / 1000);
+        if (!live_telem_rate_due(&rate, &t, (uint32_t)ms)) continue;
+        live_telem_rate_sent(&rate, &t, (uint32_t)ms);
+
+        if (last_sent >= 0) {
+            int gap = ms - last_sent;
+            if (gap < r->min_gap) r->min_gap = gap;
+            if (gap > r->max_gap) r->max_gap = gap;
+        }
+        last_sent = ms;
+        if (st == REC_RECORDING || st == REC_STARTING) {
+            r->updates_rec++;
+        } else if (st == REC_ARMED) {
+            r->updates_idle++;
+        }
+        if (t.flags & LIVE_TELEM_F_CLIPPING) r->clip_seen = true;
+        if (t.state != shown) {
+            if (change_at >= 0 && ms - change_at > r->max_latency) r->max_latency = ms - change_at;
+            shown = (rec_state_t)t.state;
+        }
+    }
+    r->speech_true = blocks ? 100.0 * speech_blocks / blocks : 0;
+    r->speech_seen = speech_n ? speech_sum / speech_n : 0;
+}
+
+static void check_rate(const double *intervals, int n, int jitter_ms) {
+    printf("Rate limit: heartbeat %d ms, tick jitter +-%d ms, %d s recording of %d s\n", HEARTBEAT_MS, jitter_ms,
+           (REC_STOP_MS - REC_START_MS) / 1000, SIM_MS / 1000);
+    printf("interval ms   rec Hz  idle Hz  min gap  max gap  state lag  speech true  seen  clip\n");
+    double rec_s = (REC_STOP_MS - REC_START_MS) / 1000.0;
+    double idle_s = (SIM_MS - (REC_STOP_MS - REC_START_MS)) / 1000.0;
+    for (int i = 0; i < n; i++) {
+        timeline_t r = { .interval_ms = (int)intervals[i] };
+        run_timeline(&r, jitter_ms);
+        double rec_hz = r.updates_rec / rec_s, idle_hz = r.updates_idle / idle_s;
+        printf("%11d  %7.2f  %7.2f  %7d  %7d  %9d  %10.0f%%  %3.0f%%  %4s\n", r.interval_ms, rec_hz, idle_hz,
+               r.min_gap, r.max_gap, r.max_latency, r.speech_true, r.speech_seen, r.clip_seen ? "yes" : "no");
+        check(r.min_gap >= (int)LIVE_TELEM_MIN_GAP(r.interval_ms), "update gap below the minimum");
+        check(r.max_gap <= HEARTBEAT_MS + r.interval_ms, "update gap above heartbeat plus an interval");
+        check(r.max_latency <= r.interval_ms + jitter_ms, "state change shown later than an interval");
+        // The recording clock moves every second: an update per interval, or per second.
+        // A jittered tick now and then lands in the same second as the last one.
+        double want_hz = r.interval_ms < 1000 ? 1.0 : 1000.0 / r.interval_ms;
+        check(rec_hz >= 0.85 * want_hz && rec_hz <= 1000.0 / LIVE_TELEM_MIN_GAP(r.interval_ms),
+              "recording updates off the interval");
+        check(idle_hz <= 1000.0 / (HEARTBEAT_MS - r.interval_ms) + 0.02, "idle updates above one per heartbeat");
+        check(r.clip_seen, "clipping not shown");
+        check(fabs(r.speech_true - r.speech_seen) <= 10, "speech share off by more than 10 points");
+    }
+}
+
+// ---------------------------------------------------------------------------
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [options] [HEX...]\n"
+            "  HEX                 manufacturer data to decode (default: lines on stdin)\n"
+            "  --check             check the record, the meter and the rate limiter instead\n"
+            "  --interval-ms LIST  CONFIG_SALESTAG_TELEMETRY_INTERVAL_MS for the timeline (default 500,1000,2000)\n"
+            "  --jitter-ms T       task tick jitter (default 10)\n"
+            "  --seed N            (default 1)\n",
+            argv0);
+}
+
+int main(int argc, char **argv) {
+    bool run_check = false;
+    int jitter_ms = 10;
+    unsigned seed = 1;
+    double intervals[MAX_CASES];
+    int n_intervals = parse_list("500,1000,2000", intervals, MAX_CASES);
+
+    static const struct option opts[] = {
+        { "check", no_argument, 0, 'c' },
+        { "interval-ms", required_argument, 0, 'i' },
+        { "jitter-ms", required_argument, 0, 'j' },
+        { "seed", required_argument, 0, 'S' },
+        { "help", no_argument, 0, 'h' },
+        { 0, 0, 0, 0 },
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "h", opts, NULL)) != -1) {
+        switch (c) {
+        case 'c': run_check = true; break;
+        case 'i': n_intervals = parse_list(optarg, intervals, MAX_CASES); break;
+        case 'j': jitter_ms = atoi(optarg); break;
+        case 'S': seed = (unsigned)strtoul(optarg, NULL, 0); break;
+        default: usage(argv[0]); return c == 'h' ? 0 : 2;
+        }
+    }
+    for (int i = 0; i < n_intervals; i++) {
+        if (intervals[i] < 100 || intervals[i] >= HEARTBEAT_MS) n_intervals = 0;
+    }
+    if (n_intervals == 0 || jitter_ms < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (run_check) {
+        srand(seed);
+        check_record();
+        check_meter();
+        check_rate(intervals, n_intervals, jitter_ms);
+        printf("%s\n", s_failures ? "FAILED" : "ok");
+        return s_failures ? 1 : 0;
+    }
+
+    bool header_done = false, all_ok = true;
+    if (optind < argc) {
+        for (int i = optind; i < argc; i++) all_ok &= decode_one(argv[i], &header_done);
+    } else {
+        char line[256];
+        while (fgets(line, sizeof(line), stdin)) {
+            if (line[0] == '\n' || line[0] == '#') continue;
+            line[strcspn(line, "\n")] = '\0';
+            all_ok &= decode_one(line, &header_done);
+        }
+    }
+    return all_ok ? 0 : 1;
+}
@@ -0,0 +1,166 @@
+#!/usr/bin/env python3
+"""Stand-in upload server for the Wi-Fi offload protocol (main/upload_proto.h).
+
+Stores PUT /<base>/<device>/<file> uploads under --root, answering
+Content-Range chunks and "bytes */total" queries with 308 + Range, or 201
+once a file is complete. Failures can be injected to exercise the client's
+resume logic:
+
+  --fail-rate        reply 503 without storing the chunk
+  --lose-reply-rate  store the chunk, then reply 503 (lost acknowledgement)
+  --drop-rate        read part of the body, keep it, and close the connection
+  --reject NAME      answer 403 for files whose name contains NAME
+
+Usage: stub_server.py --root /tmp/uploads --port 8080 --seed 1 --fail-rate 0.1
+"""
+
+import argparse
+import os
+import random
+import re
+import signal
+import threading
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+RANGE_RE = re.compile(r"bytes (\d+)-(\d+)/(\d+)$")
+QUERY_RE = re.compile(r"bytes \*/(\d+)$")
+
+
+class State:
+    def __init__(self, args):
+        self.args = args
+        self.rng = random.Random(args.seed)
+        self.lock = threading.Lock()
+        self.counts = {"chunks": 0, "queries": 0, "fail": 0, "lost_reply": 0, "drop": 0, "complete": 0}
+
+    def roll(self, rate):
+        with self.lock:
+            return rate > 0 and self.rng.random() < rate
+
+    def count(self, key):
+        with self.lock:
+            self.counts[key] += 1
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    state = None
+
+    def log_message(self, fmt, *args):
+        if self.state.args.verbose:
+            super().log_message(fmt, *args)
+
+    def reply(self, code, committed=None, close=False):
+        self.send_response(code)
+        if committed:
+            self.send_header("Range", "bytes=0-%d" % (committed - 1))
+        self.send_header("Content-Length", "0")
+        if close:
+            self.send_header("Connection", "close")
+            self.close_connection = True
+        self.end_headers()
+
+    def target(self):
+        parts = [p for p in self.path.split("/") if p]
+        if len(parts) < 2 or any(p in (".", "..") for p in parts):
+            return None
+        return os.path.join(self.state.args.root, parts[-2], parts[-1])
+
+    def do_PUT(self):
+        args = self.state.args
+        path = self.target()
+        length = int(self.headers.get("Content-Length", "0"))
+        crange = self.headers.get("Content-Range", "")
+        if path is None:
+            self.rfile.read(length)
+            return self.reply(400)
+        if args.reject and args.reject in os.path.basename(path):
+            self.rfile.read(length)
+            return self.reply(403)
+
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        part = path + ".part"
+        have = os.path.getsize(part) if os.path.exists(part) else 0
+
+        m = QUERY_RE.match(crange)
+        if m:
+            self.state.count("queries")
+            total = int(m.group(1))
+            if os.path.exists(path) and os.path.getsize(path) == total:
+                return self.reply(201)
+            return self.reply(308, have)
+
+        m = RANGE_RE.match(crange)
+        if not m:
+            self.rfile.read(length)
+            return self.reply(400)
+        first, last, total = map(int, m.groups())
+        if last < first or last >= total or length != last - first + 1:
+            self.rfile.read(length)
+            return self.reply(400)
+
+        if self.state.roll(args.fail_rate):
+            self.state.count("fail")
+            self.rfile.read(length)
+            return self.reply(503)
+
+        if first != have:
+            # Not where we are: the client must query and resume
+            self.rfile.read(length)
+            return self.reply(308, have)
+
+        if self.state.roll(args.drop_rate):
+            self.state.count("drop")
+            keep = self.state.rng.randint(0, length - 1) if length > 1 else 0
+            data = self.rfile.read(keep)
+            with open(part, "ab") as f:
+                f.write(data)
+            self.close_connection = True
+            return
+
+        data = self.rfile.read(length)
+        with open(part, "ab") as f:
+            f.write(data)
+        self.state.count("chunks")
+        have += len(data)
+
+        if have == total:
+            os.replace(part, path)
+            self.state.count("complete")
+            if self.state.roll(args.lose_reply_rate):
+                self.state.count("lost_reply")
+                return self.reply(503)
+            return self.reply(201)
+        if self.state.roll(args.lose_reply_rate):
+            self.state.count("lost_reply")
+            return self.reply(503)
+        return self.reply(308, have)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("--root", required=True, help="directory uploads are stored in")
+    ap.add_argument("--host", default="127.0.0.1")
+    ap.add_argument("--port", type=int, default=8080)
+    ap.add_argument("--seed", type=int, default=None)
+    ap.add_argument("--fail-rate", type=float, default=0.0)
+    ap.add_argument("--lose-reply-rate", type=float, default=0.0)
+    ap.add_argument("--drop-rate", type=float, default=0.0)
+    ap.add_argument("--reject", default=None)
+    ap.add_argument("--verbose", action="store_true")
+    args = ap.parse_args()
+
+    Handler.state = State(args)
+    signal.signal(signal.SIGTERM, lambda *_: (_ for _ in ()).throw(KeyboardInterrupt))
+    server = ThreadingHTTPServer((args.host, args.port), Handler)
+    print("stub upload server on http://%s:%d, storing in %s" % (args.host, args.port, args.root), flush=True)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        print("stats: " + " ".join("%s=%d" % kv for kv in Handler.state.counts.items()), flush=True)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+"""Upload check: upload_cli against stub_server.py with failures injected.
+
+Writes synthetic recordings named as the device names them (r<7 digits>.raw,
+sizes on and off the chunk boundary), starts the stub server on a free local
+port with 503s, lost replies and dropped connections, and runs upload_cli as
+the firmware's offload sessions would: again after a session that gave up,
+until every file is acknowledged. Then checks:
+
+  - every recording is on the server byte for byte, with no .part left over
+  - the catalog lists every recording, and a file the server rejects (403)
+    is neither stored nor listed
+  - the server really injected each kind of failure
+  - a further session finds nothing to upload
+
+Usage: upload_check.py [--seed N] [--rate P] [--cli ./upload_cli]
+Exit status 1 if any check fails.
+"""
+
+import argparse
+import os
+import random
+import re
+import shutil
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+DEVICE = "salestag-check"
+CHUNK = 16384
+SIZES = [CHUNK * 20, CHUNK * 7 + 1234, 1, CHUNK - 1, 300000]
+REJECT = "r0000900"
+
+failures = 0
+
+
+def check(ok, what):
+    global failures
+    if not ok:
+        failures += 1
+        print("  FAIL " + what)
+
+
+def free_port():
+    with socket.socket() as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()[1]
+
+
+def wait_listening(port, proc):
+    for _ in range(100):
+        if proc.poll() is not None:
+            return False
+        try:
+            socket.create_connection(("127.0.0.1", port), 0.1).close()
+            return True
+        except OSError:
+            time.sleep(0.05)
+    return False
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("--seed", type=int, default=1)
+    ap.add_argument("--rate", type=float, default=0.1, help="rate of each injected failure (default 0.1)")
+    ap.add_argument("--cli", default=os.path.join(HERE, "upload_cli"))
+    ap.add_argument("--sessions", type=int, default=10, help="offload sessions before giving up (default 10)")
+    args = ap.parse_args()
+
+    work = tempfile.mkdtemp(prefix="upload_check.")
+    rec_dir = os.path.join(work, "rec")
+    root = os.path.join(work, "server")
+    os.makedirs(rec_dir)
+    rng = random.Random(args.seed)
+    names = []
+    for i, size in enumerate(SIZES):
+        name = "r%07d.raw" % (i + 1)
+        with open(os.path.join(rec_dir, name), "wb") as f:
+            f.write(rng.randbytes(size))
+        names.append(name)
+    with open(os.path.join(rec_dir, REJECT + ".raw"), "wb") as f:
+        f.write(rng.randbytes(5000))
+
+    port = free_port()
+    server = subprocess.Popen(
+        [sys.executable, os.path.join(HERE, "stub_server.py"), "--root", root, "--port", str(port),
+         "--seed", str(args.seed), "--fail-rate", str(args.rate), "--lose-reply-rate", str(args.rate),
+         "--drop-rate", str(args.rate), "--reject", REJECT],
+        stdout=subprocess.PIPE, text=True)
+    try:
+        if not wait_listening(port, server):
+            print("stub server did not start")
+            return 1
+        print("%d recordings, chunk %d, failures at %.2f each, seed %d"
+              % (len(names), CHUNK, args.rate, args.seed))
+        cmd = [args.cli, "--url", "http://127.0.0.1:%d/up" % port, "--dir", rec_dir, "--device", DEVICE,
+               "--chunk", str(CHUNK), "--backoff", "1"]
+        sessions = 0
+        while sessions < args.sessions:
+            sessions += 1
+            run = subprocess.run(cmd, capture_output=True, text=True)
+            m = re.search(r"uploaded (\d+)/(\d+)", run.stdout)
+            print("  session %d: %s" % (sessions, m.group(0) if m else "no summary"))
+            # Done when the rejected file is the only one not acknowledged
+            if m and int(m.group(2)) - int(m.group(1)) == 1:
+                break
+
+        stored = os.path.join(root, DEVICE)
+        for name in names:
+            with open(os.path.join(rec_dir, name), "rb") as a:
+                want = a.read()
+            path = os.path.join(stored, name)
+            got = open(path, "rb").read() if os.path.exists(path) else None
+            check(got == want, "%s differs on the server" % name)
+        leftover = [n for n in os.listdir(stored) if n.endswith(".part")] if os.path.isdir(stored) else []
+        check(not leftover, "partial uploads left: %s" % " ".join(leftover))
+        check(not os.path.exists(os.path.join(stored, REJECT + ".raw")), "rejected file stored")
+
+        with open(os.path.join(rec_dir, "synced.lst")) as f:
+            catalog = f.read()
+        for name in names:
+            check(name in catalog, "%s not in the catalog" % name)
+        check(REJECT not in catalog, "rejected file in the catalog")
+
+        last = subprocess.run(cmd, capture_output=True, text=True)
+        check("uploaded 0/1," in last.stdout, "a further session uploaded again: " + last.stdout.strip())
+    finally:
+        server.terminate()
+        out, _ = server.communicate(timeout=10)
+        shutil.rmtree(work, ignore_errors=True)
+
+    stats = dict((k, int(v)) for k, v in re.findall(r"(\w+)=(\d+)", out.split("stats:")[-1]))
+    print("  server: " + " ".join("%s=%d" % kv for kv in stats.items()))
+    for kind in ("fail", "lost_reply", "drop"):
+        check(stats.get(kind, 0) > 0, "no %s injected" % kind)
+    check(stats.get("complete", 0) == len(names), "server completed %d files, expected %d"
+          % (stats.get("complete", 0), len(names)))
+
+    print("FAILED" if failures else "ok")
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,402 @@
+/**
+ * @file upload_cli.c
+ * @brief Host build of the Wi-Fi offload upload path
+ *
+ * Runs the firmware's upload engine (uploader.c), protocol helpers and
+ * synced-file catalog against a plain-http server over POSIX sockets, with
+ * recordings read from a local directory. Used with stub_server.py to
+ * exercise resume and retry handling without a device.
+ */
+
+#define _GNU_SOURCE
+#include "sync_catalog.h"
+#include "upload_proto.h"
+#include "uploader.h"
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_FILES 256
+
+// ---------------------------------------------------------------------------
+// HTTP/1.1 transport, keep-alive, plain http only
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    int fd;
+    char host[128];
+    char port[8];
+    char rx[4096];
+    size_t rx_len;
+    bool close_after;       // Server said "Connection: close"
+    int timeout_s;
+    const char *device;
+} http_conn_t;
+
+static bool split_url(const char *url, char *host, size_t host_sz, char *port, size_t port_sz,
+                      const char **path) {
+    if (strncmp(url, "http://", 7) != 0) return false;
+    const char *h = url + 7;
+    const char *slash = strchr(h, '/');
+    *path = slash ? slash : "/";
+    size_t hlen = slash ? (size_t)(slash - h) : strlen(h);
+    const char *colon = memchr(h, ':', hlen);
+    size_t name_len = colon ? (size_t)(colon - h) : hlen;
+    if (name_len == 0 || name_len >= host_sz) return false;
+    memcpy(host, h, name_len);
+    host[name_len] = '\0';
+    if (colon) {
+        size_t plen = hlen - name_len - 1;
+        if (plen == 0 || plen >= port_sz) return false;
+        memcpy(port, colon + 1, plen);
+        port[plen] = '\0';
+    } else {
+        snprintf(port, port_sz, "80");
+    }
+    return true;
+}
+
+static int conn_open(http_conn_t *c) {
+    struct addrinfo hints = { .ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM };
+    struct addrinfo *res;
+    if (getaddrinfo(c->host, c->port, &hints, &res) != 0) return -1;
+    int fd = -1;
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        struct timeval tv = { .tv_sec = c->timeout_s };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    c->fd = fd;
+    c->rx_len = 0;
+    c->close_after = false;
+    return fd >= 0 ? 0 : -1;
+}
+
+static void conn_close(http_conn_t *c) {
+    if (c->fd >= 0) close(c->fd);
+    c->fd = -1;
+    c->rx_len = 0;
+}
+
+static int send_all(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int http_begin(void *ctx, const char *url, const char *content_range, uint32_t content_len) {
+    http_conn_t *c = ctx;
+    char host[sizeof(c->host)], port[sizeof(c->port)];
+    const char *path;
+    if (!split_url(url, host, sizeof(host), port, sizeof(port), &path)) return -1;
+    if (c->fd >= 0 && (strcmp(host, c->host) != 0 || strcmp(port, c->port) != 0)) conn_close(c);
+    strcpy(c->host, host);
+    strcpy(c->port, port);
+
+    char hdr[1024];
+    int n = snprintf(hdr, sizeof(hdr),
+                     "PUT %s HTTP/1.1\r\nHost: %s:%s\r\nContent-Length: %u\r\n"
+                     "Content-Range: %s\r\nContent-Type: application/octet-stream\r\n"
+                     "X-SalesTag-Device: %s\r\n\r\n",
+                     path, host, port, (unsigned)content_len, content_range, c->device);
+    if (n < 0 || (size_t)n >= sizeof(hdr)) return -1;
+
+    // A kept-alive connection may have been closed by the server meanwhile: one fresh try
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (c->fd < 0 && conn_open(c) != 0) return -1;
+        if (send_all(c->fd, hdr, (size_t)n) == 0) return 0;
+        conn_close(c);
+    }
+    return -1;
+}
+
+static int http_write(void *ctx, const uint8_t *data, size_t len) {
+    http_conn_t *c = ctx;
+    return c->fd >= 0 ? send_all(c->fd, data, len) : -1;
+}
+
+static int fill(http_conn_t *c) {
+    if (c->rx_len == sizeof(c->rx)) return -1;
+    ssize_t n = recv(c->fd, c->rx + c->rx_len, sizeof(c->rx) - c->rx_len, 0);
+    if (n <= 0) return -1;
+    c->rx_len += (size_t)n;
+    return 0;
+}
+
+static void consume(http_conn_t *c, size_t n) {
+    memmove(c->rx, c->rx + n, c->rx_len - n);
+    c->rx_len -= n;
+}
+
+static int http_finish(void *ctx, int *http_status, char *range, size_t range_sz) {
+    http_conn_t *c = ctx;
+    if (c->fd < 0) return -1;
+    range[0] = '\0';
+
+    char *end;
+    while ((end = memmem(c->rx, c->rx_len, "\r\n\r\n", 4)) == NULL) {
+        if (fill(c) != 0) {
+            conn_close(c);
+            return -1;
+        }
+    }
+    size_t head_len = (size_t)(end - c->rx) + 4;
+    end[2] = '\0';
+
+    if (sscanf(c->rx, "HTTP/1.%*d %d", http_status) != 1) {
+        conn_close(c);
+        return -1;
+    }
+    long body = 0;
+    c->close_after = false;
+    for (char *line = strstr(c->rx, "\r\n"); line && line[2]; line = strstr(line + 2, "\r\n")) {
+        char *l = line + 2;
+        if (strncasecmp(l, "Range:", 6) == 0) {
+            const char *v = l + 6;
+            while (*v == ' ') v++;
+            size_t vlen = strcspn(v, "\r");
+            if (vlen >= range_sz) vlen = range_sz - 1;
+            memcpy(range, v, vlen);
+            range[vlen] = '\0';
+        } else if (strncasecmp(l, "Content-Length:", 15) == 0) {
+            body = strtol(l + 15, NULL, 10);
+        } else if (strncasecmp(l, "Connection:", 11) == 0) {
+            const char *v = l + 11;
+            while (*v == ' ') v++;
+            c->close_after = strncasecmp(v, "close", 5) == 0;
+        }
+    }
+    consume(c, head_len);
+
+    // Drain the body so the connection can carry the next request
+    while (body > 0) {
+        if (c->rx_len == 0 && fill(c) != 0) {
+            conn_close(c);
+            return 0;
+        }
+        size_t n = c->rx_len < (size_t)body ? c->rx_len : (size_t)body;
+        consume(c, n);
+        body -= (long)n;
+    }
+    if (c->close_after) conn_close(c);
+    return 0;
+}
+
+static void http_reset(void *ctx) {
+    conn_close(ctx);
+}
+
+static const upl_transport_t s_http_ops = {
+    .begin = http_begin,
+    .write = http_write,
+    .finish = http_finish,
+    .reset = http_reset,
+};
+
+// ---------------------------------------------------------------------------
+// File source
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    FILE *fp;
+    uint8_t buf[16384];
+} file_src_t;
+
+static int src_open(void *ctx, const char *path, uint32_t *size) {
+    file_src_t *s = ctx;
+    struct stat st;
+    if (stat(path, &st) != 0) return -1;
+    s->fp = fopen(path, "rb");
+    if (!s->fp) return -1;
+    *size = (uint32_t)st.st_size;
+    return 0;
+}
+
+static int src_read(void *ctx, uint32_t offset, size_t max, const uint8_t **data, size_t *len) {
+    file_src_t *s = ctx;
+    if (max > sizeof(s->buf)) max = sizeof(s->buf);
+    if (fseek(s->fp, (long)offset, SEEK_SET) != 0) return -1;
+    *len = fread(s->buf, 1, max, s->fp);
+    *data = s->buf;
+    return *len > 0 ? 0 : -1;
+}
+
+static void src_close(void *ctx) {
+    file_src_t *s = ctx;
+    if (s->fp) fclose(s->fp);
+    s->fp = NULL;
+}
+
+static const upl_source_t s_src_ops = {
+    .open = src_open,
+    .read = src_read,
+    .close = src_close,
+};
+
+// ---------------------------------------------------------------------------
+
+static void sleep_ms(uint32_t ms) {
+    struct timespec ts = { .tv_sec = ms / 1000, .tv_nsec = (long)(ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int cmp_names(const void *a, const void *b) {
+    return strcmp(a, b);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "usage: %s --url http://host:port/base --dir DIR [options]\n"
+            "  --catalog FILE   synced-file catalog (default DIR/synced.lst)\n"
+            "  --device ID      device id in the upload path (default salestag-host)\n"
+            "  --chunk BYTES    chunk size (default 65536)\n"
+            "  --attempts N     transient failures per file before giving up (default 5)\n"
+            "  --backoff MS     first backoff delay (default 50)\n",
+            prog);
+}
+
+int main(int argc, char **argv) {
+    const char *url = NULL, *dir = NULL, *catalog_path = NULL, *device = "salestag-host";
+    upl_config_t cfg = {
+        .chunk_size = 65536,
+        .max_attempts = 5,
+        .backoff_base_ms = 50,
+        .backoff_max_ms = 2000,
+        .sleep_ms = sleep_ms,
+    };
+
+    static const struct option opts[] = {
+        { "url", required_argument, NULL, 'u' },
+        { "dir", required_argument, NULL, 'd' },
+        { "catalog", required_argument, NULL, 'c' },
+        { "device", required_argument, NULL, 'i' },
+        { "chunk", required_argument, NULL, 'k' },
+        { "attempts", required_argument, NULL, 'a' },
+        { "backoff", required_argument, NULL, 'b' },
+        { NULL, 0, NULL, 0 },
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", opts, NULL)) != -1) {
+        switch (opt) {
+        case 'u': url = optarg; break;
+        case 'd': dir = optarg; break;
+        case 'c': catalog_path = optarg; break;
+        case 'i': device = optarg; break;
+        case 'k': cfg.chunk_size = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'a': cfg.max_attempts = (uint8_t)atoi(optarg); break;
+        case 'b': cfg.backoff_base_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+        default: usage(argv[0]); return 2;
+        }
+    }
+    if (!url || !dir || cfg.chunk_size == 0 || cfg.max_attempts == 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    char default_catalog[512];
+    if (!catalog_path) {
+        snprintf(default_catalog, sizeof(default_catalog), "%s/synced.lst", dir);
+        catalog_path = default_catalog;
+    }
+    sync_catalog_t cat;
+    if (sync_catalog_open(&cat, catalog_path) != 0) {
+        fprintf(stderr, "cannot load catalog %s\n", catalog_path);
+        return 1;
+    }
+
+    // Same selection as the firmware: non-empty .raw files not yet acknowledged
+    static char names[MAX_FILES][SYNC_CATALOG_NAME_MAX];
+    int count = 0;
+    DIR *d = opendir(dir);
+    if (!d) {
+        perror(dir);
+        return 1;
+    }
+    struct dirent *e;
+    char path[1024];
+    while (count < MAX_FILES && (e = readdir(d)) != NULL) {
+        size_t len = strlen(e->d_name);
+        if (len < 5 || len >= SYNC_CATALOG_NAME_MAX || strcasecmp(e->d_name + len - 4, ".raw") != 0) continue;
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        if (stat(path, &st) != 0 || st.st_size == 0) continue;
+        if (sync_catalog_is_synced(&cat, e->d_name, (uint32_t)st.st_size)) continue;
+        snprintf(names[count++], SYNC_CATALOG_NAME_MAX, "%s", e->d_name);
+    }
+    closedir(d);
+    qsort(names, (size_t)count, sizeof(names[0]), cmp_names);
+
+    http_conn_t conn = { .fd = -1, .timeout_s = 5, .device = device };
+    static file_src_t src;
+    int uploaded = 0, failed = 0;
+    uint64_t total_bytes = 0;
+    double t_start = now_s();
+
+    for (int i = 0; i < count; i++) {
+        char file_url[1024];
+        if (!upl_build_url(file_url, sizeof(file_url), url, device, names[i])) {
+            fprintf(stderr, "%s: URL too long\n", names[i]);
+            failed++;
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%.*s", dir, SYNC_CATALOG_NAME_MAX - 1, names[i]);
+
+        upl_stats_t st;
+        double t0 = now_s();
+        upl_result_t r = upl_upload_file(&cfg, &s_http_ops, &conn, &s_src_ops, &src, file_url, path, &st);
+        double dt = now_s() - t0;
+        printf("%-24s %-12s sent=%llu chunks=%u retries=%u queries=%u resumed_from=%u %.1f KB/s\n",
+               names[i], upl_result_name(r), (unsigned long long)st.bytes_sent, st.chunks, st.retries,
+               st.queries, st.resumed_from, dt > 0 ? st.bytes_sent / 1024.0 / dt : 0.0);
+        total_bytes += st.bytes_sent;
+
+        if (r == UPL_OK) {
+            struct stat fst;
+            if (stat(path, &fst) == 0 && sync_catalog_mark_synced(&cat, names[i], (uint32_t)fst.st_size) == 0) {
+                uploaded++;
+            } else {
+                fprintf(stderr, "%s: failed to update catalog\n", names[i]);
+                failed++;
+            }
+        } else {
+            failed++;
+            if (r == UPL_RETRY_LATER) break;   // Firmware ends the session here too
+        }
+    }
+
+    conn_close(&conn);
+    sync_catalog_close(&cat);
+    printf("uploaded %d/%d, %llu bytes sent in %.2f s\n", uploaded, count,
+           (unsigned long long)total_bytes, now_s() - t_start);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,184 @@
+#!/usr/bin/env python3
+"""
+SalesTag WAV writer check
+Validates the files wav_gen wrote (main/wav_writer.c) against out/manifest.txt.
+RIFF files are read with Python's wave module as the reference parser; every
+file, RF64 included, also goes through an independent chunk walker that
+checks fmt, ds64, bext (EBU Tech 3285/3306) and every sample.
+"""
+
+import argparse
+import datetime
+import os
+import struct
+import sys
+import wave
+
+DATA_OFFSET = 1024          # wav_writer.h WAV_DATA_OFFSET
+BEXT_FIXED = 602
+ORIGINATOR = "salestag-a1b2c3"
+DESCRIPTION = "wav_gen test signal"
+UTC_VALID_MS = 1577836800000
+SPARSE_ABOVE = 64 << 20     # Larger files have their samples checked in windows
+WINDOW = 1 << 16
+
+
+def sample(k):
+    """wav_gen.c sample()"""
+    v = ((k * 2654435761) & 0xFFFFFFFF) >> 16
+    return v - 0x10000 if v >= 0x8000 else v
+
+
+def expected_bytes(first, count):
+    return struct.pack("<%dh" % count, *(sample(k) for k in range(first, first + count)))
+
+
+class Bad(Exception):
+    pass
+
+
+def need(cond, what):
+    if not cond:
+        raise Bad(what)
+
+
+def text(raw):
+    return raw.split(b"\0", 1)[0].decode("ascii")
+
+
+def walk(f, size):
+    """Chunk list as (id, offset of payload, payload size), sizes resolved through ds64"""
+    head = f.read(12)
+    need(len(head) == 12, "short header")
+    form, riff_size, wave_id = struct.unpack("<4sI4s", head)
+    need(form in (b"RIFF", b"RF64") and wave_id == b"WAVE", "not a WAVE file: %r" % form)
+    rf64 = form == b"RF64"
+    ds64 = None
+    chunks = []
+    pos = 12
+    while pos + 8 <= size:
+        f.seek(pos)
+        cid, csize = struct.unpack("<4sI", f.read(8))
+        if cid == b"ds64":
+            need(rf64 and pos == 12, "ds64 outside an RF64 file's first chunk")
+            ds64 = struct.unpack("<QQQI", f.read(28))
+        if rf64 and csize == 0xFFFFFFFF:
+            need(ds64 is not None, "0xFFFFFFFF size without ds64")
+            need(cid == b"data", "ds64 table entries unsupported (%r)" % cid)
+            csize = ds64[1]
+        chunks.append((cid, pos + 8, csize))
+        if cid == b"data":
+            break
+        pos += 8 + csize + (csize & 1)
+    if rf64:
+        need(riff_size == 0xFFFFFFFF, "RF64 with a 32-bit RIFF size")
+        need(ds64 is not None, "RF64 without ds64")
+        need(ds64[3] == 0, "ds64 table not empty")
+        riff_size = ds64[0]
+    return rf64, riff_size, ds64, chunks
+
+
+def check_bext(b, ent):
+    need(len(b) >= BEXT_FIXED, "bext too short")
+    need(text(b[0:256]) == DESCRIPTION, "bext Description")
+    need(text(b[256:288]) == ORIGINATOR, "bext Originator")
+    need(text(b[288:320]) == ent["name"], "bext OriginatorReference %r" % text(b[288:320]))
+    date, tm = text(b[320:330]), text(b[330:338])
+    time_ref, version = struct.unpack_from("<QH", b, 338)
+    need(version == 1, "bext Version %d" % version)
+    need(b[348:412] == bytes(64) and b[412:602] == bytes(190), "bext UMID/reserved not zero")
+    ms = ent["start_ms"]
+    if ms >= UTC_VALID_MS:
+        t = datetime.datetime.fromtimestamp(ms / 1000, datetime.timezone.utc)
+        need(date == t.strftime("%Y-%m-%d"), "bext OriginationDate %r" % date)
+        need(tm == t.strftime("%H:%M:%S"), "bext OriginationTime %r" % tm)
+        need(time_ref == (ms % 86400000) * ent["rate"] // 1000, "bext TimeReference %d" % time_ref)
+    else:
+        need(date == "" and tm == "" and time_ref == 0, "bext date/time set without a clock")
+    history = b[BEXT_FIXED:].rstrip(b"\0").decode("ascii")
+    mode = "mono" if ent["channels"] == 1 else "multi"
+    need(history == "A=PCM,F=%d,W=16,M=%s,T=SalesTag\r\n" % (ent["rate"], mode), "CodingHistory %r" % history)
+
+
+def check_samples(f, offset, count):
+    if count * 2 <= SPARSE_ABOVE:
+        f.seek(offset)
+        need(f.read(count * 2) == expected_bytes(0, count), "samples differ")
+        return
+    step = count // 64
+    for first in list(range(0, count - WINDOW, step)) + [count - WINDOW]:
+        f.seek(offset + first * 2)
+        need(f.read(WINDOW * 2) == expected_bytes(first, WINDOW), "samples differ near %d" % first)
+
+
+def check_file(path, ent):
+    size = os.path.getsize(path)
+    with open(path, "rb") as f:
+        rf64, riff_size, ds64, chunks = walk(f, size)
+        ids = [c[0] for c in chunks]
+        need(ids[:2] == [b"ds64" if rf64 else b"JUNK", b"fmt "], "chunk order %r" % ids)
+        need(ids[-1] == b"data", "no data chunk")
+        need(b"bext" in ids, "no bext chunk")
+        need(rf64 == ent["rf64"], "RF64 is %s, writer says %s" % (rf64, ent["rf64"]))
+
+        _, off, n = chunks[1]
+        f.seek(off)
+        fmt = struct.unpack("<HHIIHH", f.read(16))
+        align = 2 * ent["channels"]
+        need(n == 16 and fmt == (1, ent["channels"], ent["rate"], ent["rate"] * align, align, 16), "fmt %r" % (fmt,))
+
+        _, off, n = chunks[ids.index(b"bext")]
+        f.seek(off)
+        check_bext(f.read(n), ent)
+
+        _, off, n = chunks[-1]
+        data = ent["samples"] * 2
+        need(off == DATA_OFFSET, "data at %d" % off)
+        need(n == data, "data size %d, expected %d" % (n, data))
+        need(riff_size == off - 8 + n, "RIFF size %d for %d bytes of data" % (riff_size, n))
+        need(size >= off + n, "sizes claim %d bytes past the end of the file" % (off + n - size))
+        if ent["closed"]:
+            need(size == off + n, "%d bytes after the data" % (size - off - n))
+        if rf64:
+            need(ds64[2] == ent["samples"] // ent["channels"], "ds64 sampleCount %d" % ds64[2])
+        check_samples(f, off, ent["samples"])
+
+    if rf64:
+        return
+    # Reference parser: what any ordinary WAV reader makes of the file
+    with wave.open(path, "rb") as w:
+        need(w.getnchannels() == ent["channels"], "wave: channels")
+        need(w.getframerate() == ent["rate"], "wave: rate")
+        need(w.getsampwidth() == 2, "wave: sample width")
+        frames = ent["samples"] // ent["channels"]
+        need(w.getnframes() == frames, "wave: %d frames, expected %d" % (w.getnframes(), frames))
+        if ent["samples"] * 2 <= SPARSE_ABOVE:
+            need(w.readframes(frames) == expected_bytes(0, ent["samples"]), "wave: samples differ")
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    ap.add_argument("dir", nargs="?", default="out")
+    args = ap.parse_args()
+
+    fields = ("name", "channels", "rate", "start_ms", "samples", "written", "patches", "rf64", "closed")
+    failed = 0
+    with open(os.path.join(args.dir, "manifest.txt")) as m:
+        for line in m:
+            ent = dict(zip(fields, line.split()))
+            for k in fields[1:]:
+                ent[k] = int(ent[k])
+            ent["rf64"] = bool(ent["rf64"])
+            ent["closed"] = bool(ent["closed"])
+            try:
+                check_file(os.path.join(args.dir, ent["name"] + ".wav"), ent)
+                print("%-12s ok   %s, %d of %d samples" % (ent["name"], "RF64" if ent["rf64"] else "RIFF",
+                                                          ent["samples"], ent["written"]))
+            except (Bad, wave.Error, EOFError) as e:
+                print("%-12s FAIL %s" % (ent["name"], e))
+                failed += 1
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,183 @@
+/**
+ * @file wav_gen.c
+ * @brief Writes WAV files with the firmware's wav_writer.c for wav_check.py
+ *
+ * Each scenario writes a deterministic sample sequence (wav_check.py
+ * recomputes it) through wav_writer_t the way the storage task does, then
+ * either closes the file or abandons it as a power loss would: nothing
+ * after the last size patch is synced, the buffered tail never reaches the
+ * file. RF64 is reached without writing 4 GB by lowering riff_limit; --big
+ * writes a real one with the default limit.
+ *
+ * out/manifest.txt lists every file with what its header must say:
+ *
+ *   name channels rate start_ms samples written patches rf64 closed
+ *
+ * where samples is the interleaved sample count the sizes must cover and
+ * written is how many were handed to the writer.
+ *
+ *   wav_gen --dir out
+ *   wav_gen --dir out --big
+ */
+
+#define _GNU_SOURCE
+#include "wav_writer.h"
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define CHUNK_MAX  4096
+
+typedef struct {
+    const char *name;
+    uint16_t channels;
+    int64_t start_ms;
+    uint64_t samples;       // Interleaved samples to write
+    uint32_t chunk;         // Samples per write call
+    double patch_s;
+    uint64_t riff_limit;
+    size_t buf_bytes;
+    bool close;             // Otherwise abandoned after the last write
+} scenario_t;
+
+static const scenario_t s_cases[] = {
+    // 10.3 s, written one sample at a time as rec_ctrl.c does
+    { "close", 1, 1760795012345LL, 164800, 1, 1.0, 0, 8192, true },
+    // DMA frame sized writes, stopped by a power loss 7.5 s in
+    { "crash", 1, 1760795012345LL, 120000, 256, 2.0, 0, 8192, false },
+    // Cut before the first patch: a valid, empty WAV
+    { "crash_early", 1, 1760795012345LL, 20000, 256, 2.0, 0, 8192, false },
+    // Clock never set: date, time and time reference stay blank
+    { "noclock", 1, 0, 48000, 160, 1.0, 0, 4096, true },
+    // A second before midnight UTC: the time reference is just under a day of samples
+    { "midnight", 1, 1760831999500LL, 32000, 256, 0, 0, 8192, true },
+    { "stereo", 2, 1760795012345LL, 96002, 512, 1.0, 0, 8192, true },
+    // RIFF size exactly at the limit stays RIFF
+    { "riff_edge", 1, 1760795012345LL, 16000, 256, 0, WAV_DATA_OFFSET - 8 + 32000, 8192, true },
+    // RF64 after 3 s of audio, then closed at 5 s
+    { "rf64", 1, 1760795012345LL, 80000, 256, 1.0, WAV_DATA_OFFSET - 8 + 96000, 8192, true },
+    // RF64 after 3 s, power loss at 6.3 s
+    { "rf64_crash", 1, 1760795012345LL, 100800, 256, 1.0, WAV_DATA_OFFSET - 8 + 96000, 8192, false },
+};
+
+// Interleaved sample k of every file (wav_check.py sample())
+static int16_t sample(uint64_t k) {
+    return (int16_t)(uint16_t)((uint32_t)(k * 2654435761u) >> 16);
+}
+
+static int run(FILE *manifest, const char *dir, const scenario_t *sc) {
+    static uint8_t buf_static[8192] __attribute__((aligned(BLK_WRITER_ALIGN)));
+    uint8_t *buf = sc->buf_bytes <= sizeof(buf_static) ? buf_static : aligned_alloc(BLK_WRITER_ALIGN, sc->buf_bytes);
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s.wav", dir, sc->name);
+
+    wav_config_t cfg = {
+        .sample_rate = WAV_SAMPLE_RATE,
+        .channels = sc->channels,
+        .originator = "salestag-a1b2c3",
+        .reference = sc->name,
+        .description = "wav_gen test signal",
+        .start_utc_ms = sc->start_ms,
+        .patch_bytes = (uint32_t)(sc->patch_s * WAV_SAMPLE_RATE) * sc->channels * WAV_BYTES_PER_SAMPLE,
+        .riff_limit = sc->riff_limit,
+    };
+    wav_writer_t w;
+    if (!buf || wav_writer_open(&w, path, &cfg, buf, sc->buf_bytes) != 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    int16_t chunk[CHUNK_MAX];
+    uint64_t k = 0;
+    while (k < sc->samples) {
+        uint32_t n = sc->chunk;
+        if (n > sc->samples - k) n = (uint32_t)(sc->samples - k);
+        for (uint32_t i = 0; i < n; i++) chunk[i] = sample(k + i);
+        if (wav_writer_write(&w, chunk, n) != 0) {
+            fprintf(stderr, "%s: write at %llu: %s\n", path, (unsigned long long)k, strerror(errno));
+            wav_writer_abandon(&w);
+            return -1;
+        }
+        k += n;
+    }
+
+    uint64_t covered;
+    if (sc->close) {
+        if (wav_writer_close(&w) != 0) {
+            fprintf(stderr, "%s: close: %s\n", path, strerror(errno));
+            return -1;
+        }
+        covered = w.data_bytes;
+    } else {
+        covered = w.patched_bytes;
+        wav_writer_abandon(&w);
+    }
+    if (buf != buf_static) free(buf);
+
+    fprintf(manifest, "%s %u %u %lld %llu %llu %u %d %d\n", sc->name, sc->channels, WAV_SAMPLE_RATE,
+            (long long)sc->start_ms, (unsigned long long)(covered / WAV_BYTES_PER_SAMPLE),
+            (unsigned long long)sc->samples, w.patches, w.rf64, sc->close);
+    printf("%-12s %8.2f %8.2f %7u %7u %7u %5s %s\n", sc->name,
+           (double)sc->samples / sc->channels / WAV_SAMPLE_RATE,
+           (double)covered / WAV_BYTES_PER_SAMPLE / sc->channels / WAV_SAMPLE_RATE,
+           w.patches, w.io.writes, w.io.syncs, w.rf64 ? "yes" : "no", sc->close ? "closed" : "power loss");
+    return 0;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --dir D     output directory (default out)\n"
+            "  --big       also write a 4.3 GB RF64 file with the default RIFF limit\n",
+            argv0);
+}
+
+int main(int argc, char **argv) {
+    const char *dir = "out";
+    bool big = false;
+
+    static const struct option opts[] = {
+        { "dir", required_argument, 0, 'd' },
+        { "big", no_argument, 0, 'b' },
+        { "help", no_argument, 0, 'h' },
+        { 0, 0, 0, 0 },
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "h", opts, NULL)) != -1) {
+        switch (c) {
+        case 'd': dir = optarg; break;
+        case 'b': big = true; break;
+        default: usage(argv[0]); return c == 'h' ? 0 : 2;
+        }
+    }
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "%s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/manifest.txt", dir);
+    FILE *manifest = fopen(path, "w");
+    if (!manifest) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    printf("%-12s %8s %8s %7s %7s %7s %5s %s\n", "file", "audio s", "valid s", "patches", "writes", "syncs",
+           "rf64", "end");
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(s_cases) / sizeof(s_cases[0]); i++) {
+        if (run(manifest, dir, &s_cases[i]) != 0) failed++;
+    }
+    if (big) {
+        // Past UINT32_MAX of RIFF size by 16 MB, patched every minute, 1 MB writes
+        scenario_t sc = { "big", 1, 1760795012345LL, ((uint64_t)UINT32_MAX + (16u << 20)) / 2, CHUNK_MAX,
+                          60.0, 0, 1u << 20, true };
+        if (run(manifest, dir, &sc) != 0) failed++;
+    }
+    fclose(manifest);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,317 @@
+/**
+ * @file xfer_sim.c
+ * @brief Backlog transfer within a deadline over synthetic link traces
+ *
+ * Runs the client library's st_link_t and st_plan() the way st_dockd does
+ * in a transfer window: plan before every fetch with the time left and the
+ * throughput measured so far, take the first recording's choice, feed the
+ * link estimate a sample per second of data and the START-to-data time of
+ * each fetch. The tag side is a model: a fetch of a variant that is not on
+ * the card first waits for the transcode (--xcode-x), every fetch then
+ * waits --overhead-s before data flows at the trace's rate. A fetch still
+ * running when the window closes is lost.
+ *
+ * Link traces, one value per second:
+ *   steady   --peak-kbs with a few percent of noise
+ *   fading   sinusoidal between 20% and 100% of the peak, --fade-s period
+ *   drive    near the peak, with dropouts to nothing and stretches at 30%
+ *
+ * Each trace runs three policies over the same backlog:
+ *   raw        every recording as RAW, oldest first (no planning)
+ *   companion  every recording as the precomputed companion
+ *   plan       st_plan()
+ *
+ *   xfer_sim                                  # 6 h backlog, 10 min window
+ *   xfer_sim --trace drive --hours 6 --companion nb4
+ *
+ * Exit status 1 if the planner loses a fetch to the deadline, or leaves
+ * recordings behind where a fixed policy got them all.
+ */
+
+#define _GNU_SOURCE
+#include "st_client.h"
+#include <getopt.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RAW_RATE     16000
+#define STEP_S       0.1
+#define MAX_FILES    256
+#define MAX_TRACE_S  (24 * 3600)
+
+typedef enum { POL_RAW, POL_COMPANION, POL_PLAN } policy_t;
+
+static const char *const k_policy[] = { "raw", "companion", "plan" };
+static const char *const k_traces[] = { "steady", "fading", "drive" };
+#define TRACES ((int)(sizeof(k_traces) / sizeof(k_traces[0])))
+
+typedef struct {
+    double hours;
+    int files;
+    double window_s;
+    double peak_kbs;
+    double fade_s;
+    double overhead_s;
+    double prior_kbs;
+    double xcode_x;
+    uint8_t companion;
+    unsigned seed;
+    int trace;                      // Index into k_traces, -1 = all
+} sim_opts_t;
+
+typedef struct {
+    int stored;
+    int by_variant[4];
+    double audio_s;
+    double used_s;                  // Until the last stored byte
+    int cut;                        // Fetches the deadline ended
+    double est_kbs;                 // st_link_rate() at the end
+    bool complete;
+} sim_result_t;
+
+static double s_trace[MAX_TRACE_S + 1];   // Bytes per second
+
+static double uniform(void) {
+    return rand() / (double)RAND_MAX;
+}
+
+static void make_trace(const sim_opts_t *o, int kind, int seconds) {
+    const double peak = o->peak_kbs * 1024.0;
+    srand(o->seed);
+    int outage = 0, weak = 0;
+    for (int t = 0; t <= seconds; t++) {
+        switch (kind) {
+        case 0:
+            s_trace[t] = peak * (0.95 + 0.05 * uniform());
+            break;
+        case 1:
+            s_trace[t] = peak * (0.6 + 0.4 * sin(2.0 * M_PI * t / o->fade_s));
+            break;
+        default:
+            // Traffic, bridges, the phone in a pocket: short dropouts, longer weak stretches
+            if (outage == 0 && weak == 0) {
+                double u = uniform();
+                if (u < 1.0 / 45) outage = 3 + rand() % 13;
+                else if (u < 1.0 / 45 + 1.0 / 60) weak = 5 + rand() % 20;
+            }
+            if (outage > 0) {
+                s_trace[t] = 0;
+                outage--;
+            } else if (weak > 0) {
+                s_trace[t] = peak * 0.3;
+                weak--;
+            } else {
+                s_trace[t] = peak * (0.8 + 0.2 * uniform());
+            }
+            break;
+        }
+    }
+}
+
+static double trace_mean(int seconds) {
+    double sum = 0;
+    for (int t = 0; t < seconds; t++) sum += s_trace[t];
+    return sum / seconds;
+}
+
+static void run(const sim_opts_t *o, policy_t pol, sim_result_t *res) {
+    st_plan_file_t files[MAX_FILES];
+    const uint64_t samples = (uint64_t)(o->hours * 3600.0 * RAW_RATE / o->files);
+    st_link_t link;
+    st_link_init(&link, o->prior_kbs * 1024.0, 1.0);
+    memset(res, 0, sizeof(*res));
+
+    double t = 0;
+    double meter_bytes = 0, meter_from = 0;
+    for (int id = 0; id < o->files; id++) {
+        uint8_t v;
+        if (pol == POL_RAW) {
+            v = ST_VARIANT_RAW;
+        } else if (pol == POL_COMPANION) {
+            v = o->companion != ST_VARIANT_NONE ? o->companion : ST_VARIANT_RAW;
+        } else {
+            size_t n = 0;
+            for (int i = id; i < o->files; i++, n++) {
+                files[n] = (st_plan_file_t){
+                    .id = (uint32_t)i,
+                    .samples = samples,
+                    .have = ST_VARIANT_NONE,
+                    .ready = o->companion != ST_VARIANT_NONE ? (uint8_t)(1u << o->companion) : 0,
+                };
+            }
+            st_plan_params_t p = {
+                .budget_s = o->window_s - t,
+                .rate = st_link_rate(&link),
+                .overhead_s = link.overhead_s,
+                .xcode_x = o->xcode_x,
+                .floor = ST_VARIANT_NB2,
+            };
+            st_plan_result_t r;
+            st_plan(&p, files, n, &r);
+            v = files[0].choice;
+            if (v == ST_VARIANT_NONE) continue;
+        }
+
+        // The tag: transcode if needed, then START to first data
+        bool xcode = v != ST_VARIANT_RAW && v != o->companion;
+        if (xcode && o->xcode_x <= 0) continue;
+        double wait = o->overhead_s + (xcode ? (double)samples / RAW_RATE / o->xcode_x : 0);
+        double size = (double)st_variant_size(v, samples);
+        t += wait;
+        if (!xcode && t < o->window_s) st_link_overhead(&link, wait);
+        meter_from = t;
+        meter_bytes = 0;
+
+        double left = size;
+        while (left > 0 && t < o->window_s) {
+            double step = STEP_S;
+            double got = s_trace[(int)t] * step;
+            if (got > left) {
+                step *= left / got;
+                got = left;
+            }
+            left -= got;
+            meter_bytes += got;
+            t += step;
+            if (t - meter_from >= 1.0) {
+                st_link_sample(&link, (uint64_t)meter_bytes, t - meter_from);
+                meter_from = t;
+                meter_bytes = 0;
+            }
+        }
+        if (left > 0) {
+            res->cut++;
+            t = o->window_s;
+            break;
+        }
+        if (t - meter_from >= 0.5) st_link_sample(&link, (uint64_t)meter_bytes, t - meter_from);
+        res->stored++;
+        res->by_variant[v]++;
+        res->audio_s += (double)samples / RAW_RATE;
+        res->used_s = t;
+        if (t >= o->window_s) break;
+    }
+    res->complete = res->stored == o->files;
+    res->est_kbs = st_link_rate(&link) / 1024.0;
+}
+
+static int parse_variant(const char *s, uint8_t *out) {
+    for (uint8_t v = ST_VARIANT_RAW; v <= ST_VARIANT_NB2; v++) {
+        if (strcmp(s, st_variant_name(v)) == 0) {
+            *out = v;
+            return 0;
+        }
+    }
+    if (strcmp(s, "none") == 0) {
+        *out = ST_VARIANT_NONE;
+        return 0;
+    }
+    return -1;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --hours H           backlog (default 6)\n"
+            "  --files N           recordings it is split into (default 12)\n"
+            "  --window-s T        time until the deadline (default 600)\n"
+            "  --trace NAME        steady, fading or drive (default all three)\n"
+            "  --peak-kbs R        link throughput at its best (default 160)\n"
+            "  --fade-s T          fading period (default 90)\n"
+            "  --overhead-s T      START to first data (default 0.5)\n"
+            "  --prior-kbs R       estimate before the first sample (default 40)\n"
+            "  --companion V       precomputed variant: wb4, nb4, nb2 or none (default nb2)\n"
+            "  --xcode-x X         on-demand transcode, audio seconds per second (default 10, 0 = none)\n"
+            "  --seed N            (default 1)\n",
+            argv0);
+}
+
+int main(int argc, char **argv) {
+    sim_opts_t o = {
+        .hours = 6.0, .files = 12, .window_s = 600.0, .peak_kbs = 160.0, .fade_s = 90.0, .overhead_s = 0.5,
+        .prior_kbs = 40.0, .xcode_x = 10.0, .companion = ST_VARIANT_NB2, .seed = 1, .trace = -1,
+    };
+
+    static const struct option opts[] = {
+        { "hours", required_argument, 0, 'H' },
+        { "files", required_argument, 0, 'f' },
+        { "window-s", required_argument, 0, 'w' },
+        { "trace", required_argument, 0, 't' },
+        { "peak-kbs", required_argument, 0, 'p' },
+        { "fade-s", required_argument, 0, 'F' },
+        { "overhead-s", required_argument, 0, 'o' },
+        { "prior-kbs", required_argument, 0, 'P' },
+        { "companion", required_argument, 0, 'c' },
+        { "xcode-x", required_argument, 0, 'x' },
+        { "seed", required_argument, 0, 'S' },
+        { "help", no_argument, 0, 'h' },
+        { 0, 0, 0, 0 },
+    };
+    int c;
+    while ((c = getopt_long(argc, argv, "h", opts, NULL)) != -1) {
+        switch (c) {
+        case 'H': o.hours = atof(optarg); break;
+        case 'f': o.files = atoi(optarg); break;
+        case 'w': o.window_s = atof(optarg); break;
+        case 't':
+            o.trace = -2;
+            for (int i = 0; i < TRACES; i++) {
+                if (strcmp(optarg, k_traces[i]) == 0) o.trace = i;
+            }
+            if (o.trace == -2) {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'p': o.peak_kbs = atof(optarg); break;
+        case 'F': o.fade_s = atof(optarg); break;
+        case 'o': o.overhead_s = atof(optarg); break;
+        case 'P': o.prior_kbs = atof(optarg); break;
+        case 'c':
+            if (parse_variant(optarg, &o.companion) != 0) {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'x': o.xcode_x = atof(optarg); break;
+        case 'S': o.seed = (unsigned)strtoul(optarg, NULL, 0); break;
+        default: usage(argv[0]); return c == 'h' ? 0 : 2;
+        }
+    }
+    if (o.hours <= 0 || o.files < 1 || o.files > MAX_FILES || o.window_s <= 0 || o.window_s > MAX_TRACE_S ||
+        o.peak_kbs <= 0 || o.fade_s <= 0 || o.overhead_s < 0 || o.prior_kbs <= 0 || o.xcode_x < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    printf("%.1f h backlog in %d recording(s), %.0f s window, %.0f KB/s peak, companion %s, transcode %.0fx\n",
+           o.hours, o.files, o.window_s, o.peak_kbs, st_variant_name(o.companion), o.xcode_x);
+    printf("%-7s %8s %-10s %7s %5s %5s %5s %5s %8s %7s %4s %8s %s\n", "trace", "mean KB/s", "policy", "stored",
+           "raw", "wb4", "nb4", "nb2", "audio h", "used s", "cut", "est KB/s", "");
+    int failed = 0;
+    for (int k = 0; k < TRACES; k++) {
+        if (o.trace >= 0 && k != o.trace) continue;
+        make_trace(&o, k, (int)ceil(o.window_s));
+        double mean = trace_mean((int)ceil(o.window_s)) / 1024.0;
+        sim_result_t r[3];
+        for (policy_t pol = POL_RAW; pol <= POL_PLAN; pol++) {
+            run(&o, pol, &r[pol]);
+            bool bad = false;
+            if (pol == POL_PLAN) {
+                bad = r[pol].cut > 0 || (r[POL_RAW].complete && !r[pol].complete) ||
+                      (r[POL_COMPANION].complete && !r[pol].complete);
+                failed += bad;
+            }
+            printf("%-7s %8.1f %-10s %3d/%-3d %5d %5d %5d %5d %8.2f %7.1f %4d %8.1f %s%s\n", k_traces[k], mean,
+                   k_policy[pol], r[pol].stored, o.files, r[pol].by_variant[ST_VARIANT_RAW],
+                   r[pol].by_variant[ST_VARIANT_WB4], r[pol].by_variant[ST_VARIANT_NB4],
+                   r[pol].by_variant[ST_VARIANT_NB2], r[pol].audio_s / 3600.0, r[pol].used_s, r[pol].cut,
+                   r[pol].est_kbs, r[pol].complete ? "complete" : "", bad ? "  FAIL" : "");
+        }
+        fflush(stdout);
+    }
+    return failed ? 1 : 0;
+}
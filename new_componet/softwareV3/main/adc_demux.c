@@ -0,0 +1,47 @@
+/**
+ * @file adc_demux.c
+ * @brief ADC scan frame demultiplexer (see adc_demux.h)
+ */
+
+#include "adc_demux.h"
+
+#define RESULT_DATA(w)    ((uint16_t)((w) & 0xFFF))
+#define RESULT_CHANNEL(w) ((uint8_t)(((w) >> 13) & 0xF))
+#define RESULT_UNIT(w)    ((uint8_t)(((w) >> 17) & 0x1))
+
+void adc_demux_init(adc_demux_t *d, uint8_t mic_ch, uint8_t aux_ch) {
+    d->mic_ch = mic_ch;
+    d->aux_ch = aux_ch;
+    d->aux_sum = 0;
+    d->aux_count = 0;
+    d->stray = 0;
+}
+
+size_t adc_demux_split(adc_demux_t *d, const uint8_t *buf, size_t len, uint16_t *mic, size_t mic_max) {
+    size_t n = 0;
+    for (size_t i = 0; i + ADC_DEMUX_RESULT_BYTES <= len; i += ADC_DEMUX_RESULT_BYTES) {
+        uint32_t w = (uint32_t)buf[i] | ((uint32_t)buf[i + 1] << 8) |
+                     ((uint32_t)buf[i + 2] << 16) | ((uint32_t)buf[i + 3] << 24);
+        uint8_t ch = RESULT_CHANNEL(w);
+        if (RESULT_UNIT(w) != 0) {
+            d->stray++;
+        } else if (ch == d->mic_ch && n < mic_max) {
+            mic[n++] = RESULT_DATA(w);
+        } else if (ch == d->aux_ch) {
+            d->aux_sum += RESULT_DATA(w);
+            d->aux_count++;
+        } else {
+            d->stray++;
+        }
+    }
+    return n;
+}
+
+bool adc_demux_take_aux(adc_demux_t *d, uint32_t *sum, uint32_t *count) {
+    if (d->aux_count == 0) return false;
+    *sum = d->aux_sum;
+    *count = d->aux_count;
+    d->aux_sum = 0;
+    d->aux_count = 0;
+    return true;
+}
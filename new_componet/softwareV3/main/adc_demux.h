@@ -0,0 +1,58 @@
+/**
+ * @file adc_demux.h
+ * @brief Split ADC continuous-mode DMA frames into microphone and auxiliary samples
+ *
+ * The audio scan pattern repeats the microphone channel and gives one slot
+ * to an auxiliary channel (battery divider). Every DMA result carries its
+ * channel number, so frames are split by channel rather than by position;
+ * a result that matches neither channel is counted and dropped. Pure C.
+ *
+ * Result layout (ESP32-S3, ADC_DIGI_OUTPUT_FORMAT_TYPE2, little-endian):
+ *   bits 0-11 data, bit 12 reserved, bits 13-16 channel, bit 17 unit
+ */
+
+#ifndef ADC_DEMUX_H
+#define ADC_DEMUX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ADC_DEMUX_RESULT_BYTES 4
+#define ADC_DEMUX_NO_CHANNEL   0xFF
+
+typedef struct {
+    uint8_t mic_ch;
+    uint8_t aux_ch;         // ADC_DEMUX_NO_CHANNEL when the pattern has no aux slot
+    uint32_t aux_sum;       // Raw aux samples since the last adc_demux_take_aux()
+    uint32_t aux_count;
+    uint32_t stray;         // Results from neither channel (other unit, bad channel)
+} adc_demux_t;
+
+void adc_demux_init(adc_demux_t *d, uint8_t mic_ch, uint8_t aux_ch);
+
+/**
+ * @brief Split one DMA frame
+ * @param buf     Conversion results as read from the driver
+ * @param len     Bytes in buf (a trailing partial result is ignored)
+ * @param mic     Receives the microphone samples in order
+ * @param mic_max Capacity of mic; further microphone results are counted as stray
+ * @return Number of microphone samples written
+ */
+size_t adc_demux_split(adc_demux_t *d, const uint8_t *buf, size_t len, uint16_t *mic, size_t mic_max);
+
+/**
+ * @brief Collect the aux samples gathered so far and reset the accumulator
+ * @return false if there were none
+ */
+bool adc_demux_take_aux(adc_demux_t *d, uint32_t *sum, uint32_t *count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ADC_DEMUX_H
@@ -0,0 +1,60 @@
+/**
+ * @file adv_state.c
+ * @brief Advertising manufacturer data (see adv_state.h)
+ */
+
+#include "adv_state.h"
+#include <string.h>
+
+#define ADV_COMPANY_LO 0xFF
+#define ADV_COMPANY_HI 0xFF
+#define ADV_MAGIC      'S'
+
+static void put16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    put16(p, (uint16_t)v);
+    put16(p + 2, (uint16_t)(v >> 16));
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+size_t adv_state_encode(const adv_state_t *s, uint8_t *out, size_t cap) {
+    if (cap < ADV_STATE_LEN) return 0;
+    out[0] = ADV_COMPANY_LO;
+    out[1] = ADV_COMPANY_HI;
+    out[2] = ADV_MAGIC;
+    out[3] = s->battery_pct;
+    out[4] = ADV_STATE_VERSION;
+    out[5] = s->flags;
+    put16(out + 6, s->pending_count);
+    put32(out + 8, s->pending_kb);
+    put32(out + 12, s->first_pending_id);
+    put32(out + 16, s->latest_id);
+    return ADV_STATE_LEN;
+}
+
+bool adv_state_decode(const uint8_t *mfg, size_t len, adv_state_t *out) {
+    memset(out, 0, sizeof(*out));
+    if (len < ADV_STATE_LEGACY_LEN || mfg[0] != ADV_COMPANY_LO || mfg[1] != ADV_COMPANY_HI || mfg[2] != ADV_MAGIC) {
+        return false;
+    }
+    out->battery_pct = mfg[3];
+    if (len < ADV_STATE_LEN || mfg[4] < ADV_STATE_VERSION) {
+        // Battery-only tag: its sync state is unknown
+        out->flags = ADV_STATE_F_SYNC_UNKNOWN;
+        return true;
+    }
+    out->version = mfg[4];
+    out->flags = mfg[5];
+    out->pending_count = (uint16_t)(mfg[6] | (mfg[7] << 8));
+    out->pending_kb = get32(mfg + 8);
+    out->first_pending_id = get32(mfg + 12);
+    out->latest_id = get32(mfg + 16);
+    return true;
+}
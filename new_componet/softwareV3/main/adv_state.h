@@ -0,0 +1,67 @@
+/**
+ * @file adv_state.h
+ * @brief Sync state in the advertising manufacturer data
+ *
+ * A dock (host/dock) or scanner decides which tags to connect to, and in
+ * what order, from the advertisement alone:
+ *
+ *   [0xFF 0xFF] company ID (unassigned/testing)
+ *   ['S']       SalesTag
+ *   [battery]   state of charge 0-100, 0xFF unknown
+ *   [version]   ADV_STATE_VERSION
+ *   [flags]     ADV_STATE_F_*
+ *   [u16 LE]    recordings not yet acknowledged (SYNC_ACK or Wi-Fi upload)
+ *   [u32 LE]    their size in KB, rounded up
+ *   [u32 LE]    lowest un-synced recording ID (REC_ID_NONE if none)
+ *   [u32 LE]    newest recording ID
+ *
+ * The first four bytes are the battery-only layout older scanners read.
+ * Pure C: the emulator, the dock and the client library build the same file.
+ */
+
+#ifndef ADV_STATE_H
+#define ADV_STATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define ADV_STATE_VERSION        1
+#define ADV_STATE_LEN            20
+#define ADV_STATE_LEGACY_LEN     4       // Company, 'S', battery
+#define ADV_STATE_BATTERY_UNKNOWN 0xFF
+
+#define ADV_STATE_F_NO_CARD      0x01    // Card missing or unmounted: nothing to fetch
+#define ADV_STATE_F_SYNC_UNKNOWN 0x02    // Catalog not read yet, counts are zero
+
+typedef struct {
+    uint8_t version;                // 0 for the legacy layout (battery only)
+    uint8_t battery_pct;
+    uint8_t flags;
+    uint16_t pending_count;
+    uint32_t pending_kb;
+    uint32_t first_pending_id;
+    uint32_t latest_id;
+} adv_state_t;
+
+/**
+ * @brief Write the manufacturer data
+ * @return ADV_STATE_LEN, or 0 if cap is too small
+ */
+size_t adv_state_encode(const adv_state_t *s, uint8_t *out, size_t cap);
+
+/**
+ * @brief Read manufacturer data from an advertisement
+ * @return false if it is not a SalesTag's
+ */
+bool adv_state_decode(const uint8_t *mfg, size_t len, adv_state_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ADV_STATE_H
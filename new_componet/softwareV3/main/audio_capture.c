@@ -37,15 +37,28 @@
  * SIGNAL CHAIN:
  * MAX9814 Mic → AGC → DC Bias → ADC → DC Filter → Calibration → Noise Gate → Dynamic AGC → 16-bit Audio
  *
+ * The conditioning steps are capture_chain.c, built with its coefficients folded
+ * in, or read at run time with CONFIG_SALESTAG_CAPTURE_GENERIC (development).
+ *
  * Author: Professional Audio Implementation
  * Standards: AES/EBU Audio Engineering Guidelines
  */
 
 #include "audio_capture.h"
+#include "adc_demux.h"
+#include "rate_est.h"
+#include "resampler.h"
+#include "mem_plan.h"
+#include "sdkconfig.h"
+#if CONFIG_SALESTAG_BATTERY_MONITOR
+#include "battery_monitor.h"
+#endif
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "esp_adc/adc_continuous.h"
 #include "esp_adc/adc_cali.h"
 #include "esp_adc/adc_cali_scheme.h"
@@ -54,26 +67,42 @@
 // Hardware configuration - single MAX9814 microphone amplifier
 #define MIC_ADC_CHANNEL ADC_CHANNEL_3  // GPIO 9 (ADC1_CH3) - Single MIC
 
-// MAX9814 specifications and optimal settings for single mic
-#define MAX9814_OUTPUT_VOLTAGE 2.0f    // 2Vpp output (configurable)
-#define MAX9814_DC_OFFSET 1.25f        // ~1.25V DC bias (typical)
-#define ADC_REFERENCE_VOLTAGE 3.3f     // ESP32 ADC reference
-#define ADC_BITS 4096.0f               // 12-bit ADC range (0-4095)
-
-// Calculate optimal scaling for MAX9814 output
-// MAX9814 output range: ~0.25V to ~2.25V (around 1.25V DC bias)
-// ADC input range: 0-3.3V maps to 0-4095
-// Effective AC signal range: ~0.25V to ~2.25V = ~2Vpp
-#define MAX9814_SCALE_FACTOR (32767.0f / (MAX9814_OUTPUT_VOLTAGE / 2.0f * ADC_BITS / ADC_REFERENCE_VOLTAGE))
+// MAX9814 bias, swing and scaling, and the conditioning chain: capture_chain.h
 
 // ADC configuration constants - OPTIMIZED FOR SINGLE MIC
 #define ADC_SAMPLE_FREQ_HZ       16000  // Target 16kHz sampling rate
 #define ADC_CHANNELS_COUNT       1      // Mono - single microphone
 #define AUDIO_BUFFER_FRAMES      512
+#define AUDIO_OUT_FRAMES         RESAMPLER_MAX_OUT(AUDIO_BUFFER_FRAMES)  // After resampling
+#define ADC_MID_CODE             2048
+#if CONFIG_SALESTAG_RESAMPLE_EXACT
+#define CAPTURE_RESAMPLED        true
+#else
+#define CAPTURE_RESAMPLED        false
+#endif
 #define ADC_CONV_MODE            ADC_CONV_SINGLE_UNIT_1
 #define ADC_OUTPUT_TYPE          ADC_DIGI_OUTPUT_FORMAT_TYPE2
 #define ADC_UNIT                 ADC_UNIT_1
 
+// Scan pattern: the microphone in every slot, or all but the last slot when the
+// battery divider shares the scan. The conversion rate is raised so the
+// microphone still gets exactly ADC_SAMPLE_FREQ_HZ.
+#if CONFIG_SALESTAG_BATTERY_MONITOR
+#define BATT_ADC_CHANNEL         ((adc_channel_t)CONFIG_SALESTAG_BATTERY_ADC_CHANNEL)
+#define ADC_SCAN_SLOTS           17     // 16 mic + 1 battery: battery sampled at 1 kHz
+#define ADC_SCAN_MIC_SLOTS       (ADC_SCAN_SLOTS - 1)
+#define ADC_DEMUX_AUX_CHANNEL    BATT_ADC_CHANNEL
+#else
+#define ADC_SCAN_SLOTS           1
+#define ADC_SCAN_MIC_SLOTS       1
+#define ADC_DEMUX_AUX_CHANNEL    ADC_DEMUX_NO_CHANNEL
+#endif
+#define ADC_SCAN_FREQ_HZ         (ADC_SAMPLE_FREQ_HZ * ADC_SCAN_SLOTS / ADC_SCAN_MIC_SLOTS)
+#define ADC_FRAME_PATTERNS       (256 / ADC_SCAN_MIC_SLOTS)  // 256 mic samples (16 ms) per DMA frame
+#define ADC_FRAME_BYTES          (ADC_FRAME_PATTERNS * ADC_SCAN_SLOTS * SOC_ADC_DIGI_RESULT_BYTES)
+#define ADC_READ_TIMEOUT_MS      100
+#define CAPTURE_STOP_TIMEOUT_MS  (ADC_READ_TIMEOUT_MS * 5)
+
 // MAX9814 Gain Configuration (based on datasheet)
 // GAIN pin states:
 // - GAIN = VDD (3.3V): 40dB gain (recommended for most applications)
@@ -89,231 +118,180 @@ static audio_capture_callback_t s_cb = NULL;
 static void *s_cb_ctx = NULL;
 static raw_adc_callback_t s_raw_adc_cb = NULL;
 static void *s_raw_adc_cb_ctx = NULL;
-static TaskHandle_t s_capture_task = NULL;
+static TaskHandle_t s_capture_task = NULL;   // Created on first start, then parked between captures
+static SemaphoreHandle_t s_task_done = NULL;  // Given by the capture task when a capture has ended
 static adc_continuous_handle_t s_adc_handle = NULL;
 static adc_cali_handle_t s_adc_cali_mic = NULL;
 static int s_rate = 16000;
 static int s_ch = 1;  // Mono
 static volatile bool s_running = false;
+static volatile bool s_halted = false;       // audio_capture_halt() stopped the ADC
 static volatile bool s_adc_initialized = false;
 
 // Audio buffer (mono)
-static int16_t s_audio_frame_buffer[AUDIO_BUFFER_FRAMES]; // 1 channel
-
-// DC blocking filter state (professional audio practice)
-static float s_dc_blocker_x1 = 0.0f;  // Previous input
-static float s_dc_blocker_y1 = 0.0f;  // Previous output
-static const float DC_BLOCKER_R = 0.995f; // Filter coefficient (high-pass)
-
-// Professional audio processing state
-static float s_noise_floor = 1000.0f;      // Adaptive noise floor
-static float s_signal_level = 0.0f;        // RMS signal level
-static float s_gain_multiplier = 1.0f;     // Dynamic gain adjustment
-static uint32_t s_sample_count = 0;        // Sample counter for calibration
-static bool s_calibrated = false;          // Calibration status
-
-// Noise gate parameters (professional audio practice)
-static const float NOISE_GATE_THRESHOLD = 500.0f;  // Noise gate threshold
-static const float NOISE_GATE_RATIO = 0.1f;        // Noise gate compression ratio
-static const float SIGNAL_SMOOTHING = 0.95f;       // RMS smoothing factor
-
-// Calibration parameters
-static const uint32_t CALIBRATION_SAMPLES = 16000; // 1 second at 16kHz
-static float s_calibration_sum = 0.0f;
-static float s_calibration_count = 0.0f;
+static int16_t s_audio_frame_buffer[AUDIO_OUT_FRAMES]; // 1 channel
+
+// Measured microphone rate; kept across captures, the dividers do not change
+static rate_est_t s_rate_est;
+static volatile uint32_t s_rate_mhz = 0;
+
+#if CONFIG_SALESTAG_RESAMPLE_EXACT
+static resampler_t s_resampler;
+static int16_t s_rs_in[AUDIO_BUFFER_FRAMES];
+static int16_t s_rs_out[AUDIO_OUT_FRAMES];
+static uint16_t s_mic_exact[AUDIO_OUT_FRAMES];
+#endif
+
+// Conditioning chain state: DC blocker, calibration, AGC, RMS level
+static capture_chain_t s_chain;
+#if CONFIG_SALESTAG_CAPTURE_GENERIC
+static capture_chain_params_t s_chain_params = CAPTURE_CHAIN_PARAMS_DEFAULT;
+#endif
+static bool s_preset_valid = false;        // Restored calibration for the next start
+static float s_preset_noise_floor = 0.0f;
+static float s_preset_gain = 1.0f;
 
 // ADC conversion buffer (uint8_t for continuous mode)
-static uint8_t s_adc_buffer[4];  // Must match conv_frame_size
+static uint8_t s_adc_buffer[ADC_FRAME_BYTES];  // Must match conv_frame_size
+static uint16_t s_mic_raw[AUDIO_BUFFER_FRAMES];
+static adc_demux_t s_demux;
 
 // Forward declarations
 static bool adc_calibration_init(adc_unit_t unit, adc_channel_t channel, adc_atten_t atten, adc_cali_handle_t *out_handle);
 static void adc_calibration_deinit(adc_cali_handle_t handle);
 static bool IRAM_ATTR s_conv_done_cb(adc_continuous_handle_t handle, const adc_continuous_evt_data_t *edata, void *user_data);
 
-// Professional audio processing functions
-static float apply_noise_gate(float signal, float threshold, float ratio);
-static void update_signal_level(float sample);
-static void perform_calibration(float raw_voltage);
-static float apply_dynamic_gain(float signal);
-
-//==============================================================================
-// PROFESSIONAL AUDIO PROCESSING IMPLEMENTATIONS
-//==============================================================================
-
-/**
- * @brief Apply noise gate to suppress low-level noise
- * @param signal Input signal amplitude
- * @param threshold Noise gate threshold
- * @param ratio Compression ratio below threshold
- * @return Processed signal with noise gate applied
- */
-static float apply_noise_gate(float signal, float threshold, float ratio) {
-    float abs_signal = fabsf(signal);
-
-    if (abs_signal < threshold) {
-        // Below threshold - apply compression
-        return signal * ratio;
-    } else {
-        // Above threshold - pass through
-        return signal;
+// Conditioning chain for one block of microphone samples
+void audio_capture_condition_block(const uint16_t *raw, int16_t *out, size_t n) {
+    bool was_calibrated = s_chain.calibrated;
+    uint32_t clipped = s_chain.clip_count;
+#if CONFIG_SALESTAG_CAPTURE_GENERIC
+    capture_chain_run_generic(&s_chain, &s_chain_params, raw, out, n);
+#else
+    capture_chain_run(&s_chain, raw, out, n);
+#endif
+    if (s_chain.clip_count != clipped) {
+        ESP_LOGD(TAG_CAP, "⚠️ %lu samples clipped", (unsigned long)(s_chain.clip_count - clipped));
+    }
+    if (!was_calibrated && s_chain.calibrated) {
+        ESP_LOGI(TAG_CAP, "🎵 Audio calibration complete:");
+        ESP_LOGI(TAG_CAP, "  - Noise floor: %.3fV", s_chain.noise_floor);
+        ESP_LOGI(TAG_CAP, "  - Initial gain: %.2fx", s_chain.gain);
+        ESP_LOGI(TAG_CAP, "  - Ready for professional audio capture!");
     }
 }
 
-/**
- * @brief Update RMS signal level for dynamic processing
- * @param sample Current audio sample
- */
-static void update_signal_level(float sample) {
-    // Calculate RMS using exponential smoothing
-    float squared_sample = sample * sample;
-    s_signal_level = SIGNAL_SMOOTHING * s_signal_level + (1.0f - SIGNAL_SMOOTHING) * squared_sample;
-}
-
-/**
- * @brief Perform automatic calibration of noise floor and gain
- * @param raw_voltage Raw ADC voltage reading
- */
-static void perform_calibration(float raw_voltage) {
-    if (!s_calibrated && s_sample_count < CALIBRATION_SAMPLES) {
-        // Collect samples for calibration
-        s_calibration_sum += fabsf(raw_voltage - MAX9814_DC_OFFSET);
-        s_calibration_count += 1.0f;
-        s_sample_count++;
-
-        // Complete calibration after collecting enough samples
-        if (s_sample_count >= CALIBRATION_SAMPLES) {
-            s_noise_floor = s_calibration_sum / s_calibration_count;
-            s_calibrated = true;
-
-            // Set initial gain based on measured noise floor
-            if (s_noise_floor > 0.1f) {
-                s_gain_multiplier = 1.0f / s_noise_floor; // Normalize to noise floor
-                if (s_gain_multiplier > 3.0f) s_gain_multiplier = 3.0f; // Cap at 3x
-            }
-
-            ESP_LOGI(TAG_CAP, "🎵 Audio calibration complete:");
-            ESP_LOGI(TAG_CAP, "  - Noise floor: %.3fV", s_noise_floor);
-            ESP_LOGI(TAG_CAP, "  - Initial gain: %.2fx", s_gain_multiplier);
-            ESP_LOGI(TAG_CAP, "  - Ready for professional audio capture!");
-        }
-    }
+#if CONFIG_SALESTAG_CAPTURE_GENERIC
+void audio_capture_set_chain_params(const capture_chain_params_t *params) {
+    s_chain_params = *params;
 }
+#endif
 
-/**
- * @brief Apply dynamic gain adjustment based on signal level
- * @param signal Input signal
- * @return Signal with dynamic gain applied
- */
-static float apply_dynamic_gain(float signal) {
-    if (!s_calibrated) {
-        return signal; // No adjustment until calibrated
+#if CONFIG_SALESTAG_RESAMPLE_EXACT
+// s_mic_raw to exactly ADC_SAMPLE_FREQ_HZ in s_mic_exact; codes are scaled up for the filter's precision
+static size_t resample_block(size_t n) {
+    const uint32_t nominal_mhz = ADC_SAMPLE_FREQ_HZ * 1000u;
+    for (size_t i = 0; i < n; i++) {
+        s_rs_in[i] = (int16_t)(((int32_t)s_mic_raw[i] - ADC_MID_CODE) * 8);
     }
-
-    // Calculate current signal strength relative to noise floor
-    float signal_strength = fabsf(signal);
-    float relative_level = signal_strength / s_noise_floor;
-
-    // Dynamic gain adjustment based on signal level
-    if (relative_level < 2.0f) {
-        // Low signal - boost gain slightly
-        s_gain_multiplier = fminf(s_gain_multiplier * 1.001f, 3.0f);
-    } else if (relative_level > 10.0f) {
-        // High signal - reduce gain to prevent clipping
-        s_gain_multiplier = fmaxf(s_gain_multiplier * 0.999f, 0.5f);
+    // Every block, so the output count keeps being pulled onto the exact clock
+    resampler_set_rate(&s_resampler, s_rate_mhz ? s_rate_mhz : nominal_mhz, nominal_mhz);
+    size_t out = resampler_process(&s_resampler, s_rs_in, n, s_rs_out);
+    for (size_t i = 0; i < out; i++) {
+        int32_t v = ((s_rs_out[i] + 4) >> 3) + ADC_MID_CODE;
+        s_mic_exact[i] = (uint16_t)(v < 0 ? 0 : v > 4095 ? 4095 : v);
     }
-
-    return signal * s_gain_multiplier;
+    return out;
 }
+#endif
 
-// ADC continuous sampling task - MUCH HIGHER RATE
-static void audio_capture_task(void *pvParameters) {
+// One capture, from adc_continuous_start() until s_running drops
+static void capture_run(void) {
     ESP_LOGI(TAG_CAP, "Audio capture task started (continuous mode)");
     
-    uint32_t sample_count = 0;
+    uint32_t bytes_read = 0;
     esp_err_t ret;
-    
-    while (s_running) {
-        // Start ADC conversion
-        ret = adc_continuous_start(s_adc_handle);
-        if (ret != ESP_OK) {
-            ESP_LOGE(TAG_CAP, "Failed to start ADC conversion: %s", esp_err_to_name(ret));
-            vTaskDelay(pdMS_TO_TICKS(10));
-            continue;
-        }
-        
-        // Wait for conversion data
-        ret = adc_continuous_read(s_adc_handle, s_adc_buffer, SOC_ADC_DIGI_DATA_BYTES_PER_CONV, &sample_count, portMAX_DELAY);
-        if (ret == ESP_OK && sample_count > 0) {
-            // Process each sample
-            for (int i = 0; i < sample_count; i++) {
-                uint32_t raw_adc = s_adc_buffer[i];
-                
-                // Call raw ADC callback if registered
-                if (s_raw_adc_cb) {
-                    s_raw_adc_cb((uint16_t)raw_adc, s_raw_adc_cb_ctx);
-                }
-                
-                //==============================================================================
-                // PROFESSIONAL MAX9814 AUDIO PROCESSING CHAIN
-                //==============================================================================
-
-                // Convert ADC reading to voltage
-                float adc_voltage = (float)raw_adc * ADC_REFERENCE_VOLTAGE / ADC_BITS;
-
-                // Step 1: Automatic calibration (first second of operation)
-                perform_calibration(adc_voltage);
-
-                // Step 2: Apply DC blocking filter (professional audio practice)
-                // y[n] = x[n] - x[n-1] + R * y[n-1] (high-pass filter)
-                float filtered_voltage = adc_voltage - s_dc_blocker_x1 + DC_BLOCKER_R * s_dc_blocker_y1;
-
-                // Update filter state
-                s_dc_blocker_x1 = adc_voltage;
-                s_dc_blocker_y1 = filtered_voltage;
 
-                // Step 3: Remove DC bias and prepare AC signal
-                float ac_signal = filtered_voltage - MAX9814_DC_OFFSET;
-
-                // Step 4: Apply dynamic gain adjustment (professional AGC)
-                ac_signal = apply_dynamic_gain(ac_signal);
-
-                // Step 5: Apply noise gate to suppress low-level noise
-                ac_signal = apply_noise_gate(ac_signal, NOISE_GATE_THRESHOLD, NOISE_GATE_RATIO);
+    // Keep the scan running for the whole capture: restarting it per read would
+    // reset the pattern and drop samples between reads
+    ret = adc_continuous_start(s_adc_handle);
+    bool started = ret == ESP_OK;
+    if (!started) {
+        ESP_LOGE(TAG_CAP, "Failed to start ADC conversion: %s", esp_err_to_name(ret));
+        s_running = false;
+    }
+    adc_demux_init(&s_demux, MIC_ADC_CHANNEL, ADC_DEMUX_AUX_CHANNEL);
+    rate_est_init(&s_rate_est, ADC_SAMPLE_FREQ_HZ);
+#if CONFIG_SALESTAG_RESAMPLE_EXACT
+    resampler_reset(&s_resampler);
+#endif
 
-                // Step 6: Scale to 16-bit range with professional headroom
-                float scaled_float = ac_signal * MAX9814_SCALE_FACTOR;
+    while (s_running) {
+        // Wait for conversion data
+        ret = adc_continuous_read(s_adc_handle, s_adc_buffer, sizeof(s_adc_buffer), &bytes_read, ADC_READ_TIMEOUT_MS);
+        int64_t read_us = esp_timer_get_time();
+        size_t sample_count = 0;
+        if (ret == ESP_OK && bytes_read > 0) {
+            // Separate the microphone stream from the battery slot by channel tag
+            sample_count = adc_demux_split(&s_demux, s_adc_buffer, bytes_read, s_mic_raw, AUDIO_BUFFER_FRAMES);
+#if CONFIG_SALESTAG_BATTERY_MONITOR
+            uint32_t batt_sum, batt_count;
+            if (adc_demux_take_aux(&s_demux, &batt_sum, &batt_count)) {
+                battery_monitor_feed_scan(batt_sum, batt_count);
+            }
+#endif
+        }
+        if (sample_count > 0) {
+            if (rate_est_feed(&s_rate_est, (uint32_t)sample_count, read_us)) {
+                s_rate_mhz = rate_est_mhz(&s_rate_est);
+            }
+            const uint16_t *mic = s_mic_raw;
+#if CONFIG_SALESTAG_RESAMPLE_EXACT
+            sample_count = resample_block(sample_count);
+            mic = s_mic_exact;
+#endif
 
-                // Step 7: Intelligent clipping with headroom management
-                const float CLIP_THRESHOLD = 29490.0f; // 90% of 16-bit range
-                if (scaled_float > CLIP_THRESHOLD) {
-                    scaled_float = CLIP_THRESHOLD;
-                    ESP_LOGD(TAG_CAP, "⚠️ Signal clipped (high)");
-                } else if (scaled_float < -CLIP_THRESHOLD) {
-                    scaled_float = -CLIP_THRESHOLD;
-                    ESP_LOGD(TAG_CAP, "⚠️ Signal clipped (low)");
+            // Call raw ADC callback if registered
+            if (s_raw_adc_cb) {
+                for (size_t i = 0; i < sample_count; i++) {
+                    s_raw_adc_cb(mic[i], s_raw_adc_cb_ctx);
                 }
+            }
 
-                // Step 8: Update RMS signal level for monitoring
-                update_signal_level(scaled_float);
+            audio_capture_condition_block(mic, s_audio_frame_buffer, sample_count);
 
-                int16_t sample = (int16_t)scaled_float;
-                
-                // Store mono sample
-                s_audio_frame_buffer[i] = sample;
-            }
-            
             // Call audio callback with processed samples
-            if (s_cb && sample_count > 0) {
+            if (s_cb) {
                 s_cb(s_audio_frame_buffer, sample_count, s_cb_ctx);
             }
         }
-        
-        // Stop conversion for next cycle
+    }
+
+    if (rate_est_mhz(&s_rate_est)) {
+        ESP_LOGI(TAG_CAP, "Measured microphone rate %lu.%03lu Hz (%+.3f ppm)%s",
+                 (unsigned long)(s_rate_mhz / 1000), (unsigned long)(s_rate_mhz % 1000),
+                 rate_est_ppb(&s_rate_est) / 1000.0f, CAPTURE_RESAMPLED ? ", resampled to nominal" : "");
+    }
+
+    if (started && !s_halted) {
         adc_continuous_stop(s_adc_handle);
     }
-    
+    if (s_demux.stray) {
+        ESP_LOGW(TAG_CAP, "%lu ADC results from unexpected channels dropped", (unsigned long)s_demux.stray);
+    }
+
     ESP_LOGI(TAG_CAP, "Audio capture task ended");
-    vTaskDelete(NULL);
+}
+
+// ADC continuous sampling task - MUCH HIGHER RATE. Its stack and TCB are
+// static (mem_plan), so it is never deleted: it waits for the next start instead
+static void audio_capture_task(void *pvParameters) {
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        capture_run();
+        // No sample callback runs after this
+        xSemaphoreGive(s_task_done);
+    }
 }
 
 // ADC conversion done callback (IRAM for performance)
@@ -335,22 +313,16 @@ esp_err_t audio_capture_init(int sample_rate, int channels) {
     s_ch = channels;
     
     // Reset audio processing state (professional practice)
-    s_dc_blocker_x1 = 0.0f;
-    s_dc_blocker_y1 = 0.0f;
-
-    // Reset professional audio processing state
-    s_noise_floor = 1000.0f;
-    s_signal_level = 0.0f;
-    s_gain_multiplier = 1.0f;
-    s_sample_count = 0;
-    s_calibrated = false;
-    s_calibration_sum = 0.0f;
-    s_calibration_count = 0.0f;
+    capture_chain_reset(&s_chain);
+
+#if CONFIG_SALESTAG_RESAMPLE_EXACT
+    resampler_init(&s_resampler);
+#endif
 
     // Initialize ADC continuous mode
     adc_continuous_handle_cfg_t adc_config = {
-        .max_store_buf_size = 1024,
-        .conv_frame_size = SOC_ADC_DIGI_DATA_BYTES_PER_CONV,  // Use correct frame size
+        .max_store_buf_size = ADC_FRAME_BYTES * 4,
+        .conv_frame_size = ADC_FRAME_BYTES,
     };
     
     esp_err_t ret = adc_continuous_new_handle(&adc_config, &s_adc_handle);
@@ -360,17 +332,23 @@ esp_err_t audio_capture_init(int sample_rate, int channels) {
     }
     
     // Configure ADC channels
-    adc_digi_pattern_config_t adc_pattern = {
-        .atten = ADC_ATTEN_DB_12,
-        .channel = MIC_ADC_CHANNEL,
-        .unit = ADC_UNIT,
-        .bit_width = SOC_ADC_DIGI_MAX_BITWIDTH,
-    };
-    
+    adc_digi_pattern_config_t adc_pattern[ADC_SCAN_SLOTS];
+    for (int i = 0; i < ADC_SCAN_SLOTS; i++) {
+        adc_pattern[i] = (adc_digi_pattern_config_t){
+            .atten = ADC_ATTEN_DB_12,
+            .channel = MIC_ADC_CHANNEL,
+            .unit = ADC_UNIT,
+            .bit_width = SOC_ADC_DIGI_MAX_BITWIDTH,
+        };
+    }
+#if CONFIG_SALESTAG_BATTERY_MONITOR
+    adc_pattern[ADC_SCAN_SLOTS - 1].channel = BATT_ADC_CHANNEL;
+#endif
+
     adc_continuous_config_t dig_cfg = {
-        .pattern_num = 1,
-        .adc_pattern = &adc_pattern,
-        .sample_freq_hz = ADC_SAMPLE_FREQ_HZ,
+        .pattern_num = ADC_SCAN_SLOTS,
+        .adc_pattern = adc_pattern,
+        .sample_freq_hz = ADC_SCAN_FREQ_HZ,
         .conv_mode = ADC_CONV_MODE,
         .format = ADC_OUTPUT_TYPE,
     };
@@ -400,6 +378,10 @@ esp_err_t audio_capture_init(int sample_rate, int channels) {
     ESP_LOGI(TAG_CAP, "  Mode: ADC continuous with DMA");
     ESP_LOGI(TAG_CAP, "  Sample rate: %d Hz (TARGET ACHIEVED!)", s_rate);
     ESP_LOGI(TAG_CAP, "  Channels: %d (MIC: GPIO9)", s_ch);
+#if CONFIG_SALESTAG_BATTERY_MONITOR
+    ESP_LOGI(TAG_CAP, "  Battery: 1 of %d scan slots (ADC1 ch%d), scan %d Hz",
+             ADC_SCAN_SLOTS, BATT_ADC_CHANNEL, ADC_SCAN_FREQ_HZ);
+#endif
     ESP_LOGI(TAG_CAP, "  Buffer size: %d frames", AUDIO_BUFFER_FRAMES);
     ESP_LOGI(TAG_CAP, "  MAX9814 Gain: %.0fdB, AGC: %s", MAX9814_GAIN_DB,
              MAX9814_AGC_ENABLED ? "Enabled" : "Disabled");
@@ -419,38 +401,37 @@ esp_err_t audio_capture_start(void) {
         return ESP_OK;
     }
     
+    if (!s_task_done) {
+        s_task_done = xSemaphoreCreateBinary();
+        if (!s_task_done) return ESP_ERR_NO_MEM;
+    }
+
     ESP_LOGI(TAG_CAP, "Starting audio capture task");
     
     s_running = true;
 
-    // Reset audio processing filters for clean start (professional practice)
-    s_dc_blocker_x1 = 0.0f;
-    s_dc_blocker_y1 = 0.0f;
-
-    // Reset professional audio processing state for fresh calibration
-    s_noise_floor = 1000.0f;
-    s_signal_level = 0.0f;
-    s_gain_multiplier = 1.0f;
-    s_sample_count = 0;
-    s_calibrated = false;
-    s_calibration_sum = 0.0f;
-    s_calibration_count = 0.0f;
+    // Reset the filters and calibration for a clean start (professional practice),
+    // or take a calibration restored after deep sleep: usable from the first sample
+    if (s_preset_valid) {
+        capture_chain_preset(&s_chain, s_preset_noise_floor, s_preset_gain);
+        s_preset_valid = false;
+        ESP_LOGI(TAG_CAP, "Using saved calibration: noise floor %.3fV, gain %.2fx", s_chain.noise_floor, s_chain.gain);
+    } else {
+        capture_chain_reset(&s_chain);
+    }
 
     // Create capture task with moderate priority (safe for system stability)
-    BaseType_t ret = xTaskCreate(
-        audio_capture_task,
-        "audio_capture",
-        4096,
-        NULL,
-        5, // Moderate priority - won't interfere with system tasks (USB, etc.)
-        &s_capture_task
-    );
-    
-    if (ret != pdPASS) {
-        ESP_LOGE(TAG_CAP, "Failed to create audio capture task");
-        s_running = false;
-        return ESP_ERR_NO_MEM;
+    if (!s_capture_task) {
+        s_capture_task = mem_plan_task("capture", audio_capture_task, "audio_capture",
+                                       MEM_STACK_CAPTURE, NULL,
+                                       5); // Moderate priority - won't interfere with system tasks (USB, etc.)
+        if (!s_capture_task) {
+            ESP_LOGE(TAG_CAP, "Failed to create audio capture task");
+            s_running = false;
+            return ESP_ERR_NO_MEM;
+        }
     }
+    xTaskNotifyGive(s_capture_task);
     
     ESP_LOGI(TAG_CAP, "Audio capture started successfully");
     return ESP_OK;
@@ -466,17 +447,26 @@ esp_err_t audio_capture_stop(void) {
     
     s_running = false;
     
-    // Wait for task to finish
+    // The task sees s_running within one read timeout and signals before parking
     if (s_capture_task) {
-        // Task will delete itself, just wait a bit
-        vTaskDelay(pdMS_TO_TICKS(100));
-        s_capture_task = NULL;
+        if (xSemaphoreTake(s_task_done, pdMS_TO_TICKS(CAPTURE_STOP_TIMEOUT_MS)) != pdTRUE) {
+            ESP_LOGE(TAG_CAP, "Capture task did not exit");
+            return ESP_ERR_TIMEOUT;
+        }
     }
     
     ESP_LOGI(TAG_CAP, "Audio capture stopped");
     return ESP_OK;
 }
 
+void audio_capture_halt(void) {
+    if (!s_running || s_halted) return;
+    s_halted = true;
+    s_running = false;
+    // A read in progress returns without data and the capture loop ends; the device restarts next
+    adc_continuous_stop(s_adc_handle);
+}
+
 void audio_capture_deinit(void) {
     ESP_LOGI(TAG_CAP, "Deinitializing audio capture");
     
@@ -500,6 +490,27 @@ void audio_capture_deinit(void) {
     ESP_LOGI(TAG_CAP, "Audio capture deinitialized");
 }
 
+bool audio_capture_get_rate(uint32_t *rate_mhz, bool *resampled) {
+    uint32_t mhz = s_rate_mhz;
+    if (mhz == 0) return false;
+    *rate_mhz = mhz;
+    *resampled = CAPTURE_RESAMPLED;
+    return true;
+}
+
+bool audio_capture_get_calibration(float *noise_floor, float *gain) {
+    if (!s_chain.calibrated) return false;
+    *noise_floor = s_chain.noise_floor;
+    *gain = s_chain.gain;
+    return true;
+}
+
+void audio_capture_set_calibration(float noise_floor, float gain) {
+    s_preset_noise_floor = noise_floor;
+    s_preset_gain = gain;
+    s_preset_valid = true;
+}
+
 void audio_capture_set_callback(audio_capture_callback_t cb, void *user_ctx) {
     s_cb = cb;
     s_cb_ctx = user_ctx;
@@ -518,6 +529,10 @@ esp_err_t audio_capture_read_raw_adc(uint16_t *mic_adc) {
         return ESP_ERR_INVALID_STATE;
     }
     
+    if (s_running) {
+        return ESP_ERR_INVALID_STATE;  // The capture task owns the scan
+    }
+
     // For continuous mode, we need to start a conversion and read
     esp_err_t ret = adc_continuous_start(s_adc_handle);
     if (ret != ESP_OK) {
@@ -525,14 +540,17 @@ esp_err_t audio_capture_read_raw_adc(uint16_t *mic_adc) {
         return ret;
     }
     
-    uint32_t sample_count = 0;
-    ret = adc_continuous_read(s_adc_handle, s_adc_buffer, sizeof(s_adc_buffer), &sample_count, portMAX_DELAY);
+    uint32_t bytes_read = 0;
+    ret = adc_continuous_read(s_adc_handle, s_adc_buffer, sizeof(s_adc_buffer), &bytes_read, ADC_READ_TIMEOUT_MS);
     
     // Stop conversion
     adc_continuous_stop(s_adc_handle);
     
-    if (ret == ESP_OK && sample_count > 0) {
-        if (mic_adc) *mic_adc = (uint16_t)s_adc_buffer[0];
+    adc_demux_t demux;
+    uint16_t sample;
+    adc_demux_init(&demux, MIC_ADC_CHANNEL, ADC_DEMUX_NO_CHANNEL);
+    if (ret == ESP_OK && adc_demux_split(&demux, s_adc_buffer, bytes_read, &sample, 1) == 1) {
+        if (mic_adc) *mic_adc = sample;
         return ESP_OK;
     } else {
         ESP_LOGE(TAG_CAP, "ADC read failed: %s", esp_err_to_name(ret));
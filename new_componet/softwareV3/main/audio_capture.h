@@ -1,7 +1,9 @@
 #pragma once
 #include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include "esp_err.h"
+#include "capture_chain.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -16,9 +18,31 @@ esp_err_t audio_capture_init(int sample_rate_hz, int channels);
 void audio_capture_set_callback(audio_capture_callback_t cb, void *user_ctx);
 void audio_capture_set_raw_adc_callback(raw_adc_callback_t cb, void *user_ctx);
 esp_err_t audio_capture_start(void);
+// Returns once the capture task has exited: no callback runs after it
 esp_err_t audio_capture_stop(void);
+// Power fail: stop the ADC DMA now, without waiting for the capture task; nothing restarts it
+void audio_capture_halt(void);
 void audio_capture_deinit(void);
 
+// Noise-floor calibration from the last recording; false until one completed
+bool audio_capture_get_calibration(float *noise_floor, float *gain);
+// Use a saved calibration for the next start instead of re-measuring for 1 s
+void audio_capture_set_calibration(float noise_floor, float gain);
+
+// Microphone sample rate measured against esp_timer (rate_est.h), in milli-Hz;
+// false until a capture has run a few seconds. resampled: the samples delivered
+// were corrected to exactly the nominal rate (CONFIG_SALESTAG_RESAMPLE_EXACT)
+bool audio_capture_get_rate(uint32_t *rate_mhz, bool *resampled);
+
+// Conditioning chain (DC block, AGC, noise gate, scaling) for one block of raw
+// microphone samples; used by the capture task and the IRAM benchmark, and
+// shares its filter state with the capture (reset by audio_capture_start)
+void audio_capture_condition_block(const uint16_t *raw, int16_t *out, size_t n);
+
+// CONFIG_SALESTAG_CAPTURE_GENERIC only: parameters for the conditioning chain,
+// from the next block on (the default build has them folded in)
+void audio_capture_set_chain_params(const capture_chain_params_t *params);
+
 // Direct ADC reading functions (single mic)
 esp_err_t audio_capture_read_raw_adc(uint16_t *mic_adc);
 
@@ -0,0 +1,147 @@
+/**
+ * @file battery_monitor.c
+ * @brief Battery monitor task (see battery_monitor.h)
+ */
+
+#include "sdkconfig.h"
+
+#if CONFIG_SALESTAG_BATTERY_MONITOR
+
+#include "battery_monitor.h"
+#include "battery_soc.h"
+#include "esp_adc/adc_cali.h"
+#include "esp_adc/adc_cali_scheme.h"
+#include "esp_adc/adc_oneshot.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+static const char *TAG = "battery";
+
+#define BATT_PERIOD_MS        5000
+#define BATT_ONESHOT_SAMPLES  8
+#define BATT_LOG_STEP_PCT     5
+
+static adc_oneshot_unit_handle_t s_oneshot = NULL;
+static adc_cali_handle_t s_cali = NULL;
+static TaskHandle_t s_task = NULL;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t s_scan_sum;
+static uint32_t s_scan_count;
+static battery_status_t s_status;
+static batt_soc_t s_soc;
+
+void battery_monitor_feed_scan(uint32_t raw_sum, uint32_t count) {
+    taskENTER_CRITICAL(&s_lock);
+    s_scan_sum += raw_sum;
+    s_scan_count += count;
+    taskEXIT_CRITICAL(&s_lock);
+}
+
+void battery_monitor_get(battery_status_t *out) {
+    taskENTER_CRITICAL(&s_lock);
+    *out = s_status;
+    taskEXIT_CRITICAL(&s_lock);
+}
+
+// Average raw reading for the last period: scan slot if capture ran, oneshot otherwise
+static bool take_raw(uint32_t *raw, bool *from_scan) {
+    taskENTER_CRITICAL(&s_lock);
+    uint32_t sum = s_scan_sum, count = s_scan_count;
+    s_scan_sum = 0;
+    s_scan_count = 0;
+    taskEXIT_CRITICAL(&s_lock);
+
+    if (count > 0) {
+        *raw = (sum + count / 2) / count;
+        *from_scan = true;
+        return true;
+    }
+
+    // Fails with ESP_ERR_TIMEOUT if continuous mode owns ADC1 right now; try again next period
+    sum = 0;
+    count = 0;
+    for (int i = 0; i < BATT_ONESHOT_SAMPLES; i++) {
+        int v;
+        if (adc_oneshot_read(s_oneshot, (adc_channel_t)CONFIG_SALESTAG_BATTERY_ADC_CHANNEL, &v) == ESP_OK) {
+            sum += (uint32_t)v;
+            count++;
+        }
+    }
+    if (count == 0) return false;
+    *raw = (sum + count / 2) / count;
+    *from_scan = false;
+    return true;
+}
+
+static void battery_task(void *arg) {
+    int64_t last_us = 0;
+    uint8_t logged_pct = 0xFF;
+
+    for (;;) {
+        uint32_t raw;
+        bool from_scan;
+        int pin_mv;
+        if (take_raw(&raw, &from_scan) && adc_cali_raw_to_voltage(s_cali, (int)raw, &pin_mv) == ESP_OK) {
+            uint16_t cell_mv = (uint16_t)(pin_mv * CONFIG_SALESTAG_BATTERY_DIVIDER_X100 / 100);
+            int64_t now = esp_timer_get_time();
+            uint32_t dt_ms = last_us ? (uint32_t)((now - last_us) / 1000) : 0;
+            last_us = now;
+            uint8_t pct = batt_soc_update(&s_soc, cell_mv, dt_ms);
+
+            taskENTER_CRITICAL(&s_lock);
+            s_status.cell_mv = (uint16_t)(s_soc.mv + 0.5f);
+            s_status.pct = pct;
+            s_status.valid = true;
+            taskEXIT_CRITICAL(&s_lock);
+
+            if (logged_pct == 0xFF || pct + BATT_LOG_STEP_PCT <= logged_pct || pct >= logged_pct + BATT_LOG_STEP_PCT) {
+                ESP_LOGI(TAG, "Battery %u%% (%u mV, %s)", pct, s_status.cell_mv, from_scan ? "scan" : "oneshot");
+                logged_pct = pct;
+            }
+        }
+        vTaskDelay(pdMS_TO_TICKS(BATT_PERIOD_MS));
+    }
+}
+
+esp_err_t battery_monitor_init(void) {
+    if (s_task) return ESP_ERR_INVALID_STATE;
+
+    adc_oneshot_unit_init_cfg_t unit_cfg = { .unit_id = ADC_UNIT_1 };
+    esp_err_t ret = adc_oneshot_new_unit(&unit_cfg, &s_oneshot);
+    if (ret != ESP_OK) return ret;
+
+    adc_oneshot_chan_cfg_t chan_cfg = { .atten = ADC_ATTEN_DB_12, .bitwidth = ADC_BITWIDTH_12 };
+    ret = adc_oneshot_config_channel(s_oneshot, (adc_channel_t)CONFIG_SALESTAG_BATTERY_ADC_CHANNEL, &chan_cfg);
+    if (ret == ESP_OK) {
+        adc_cali_curve_fitting_config_t cali_cfg = {
+            .unit_id = ADC_UNIT_1,
+            .chan = (adc_channel_t)CONFIG_SALESTAG_BATTERY_ADC_CHANNEL,
+            .atten = ADC_ATTEN_DB_12,
+            .bitwidth = ADC_BITWIDTH_12,
+        };
+        ret = adc_cali_create_scheme_curve_fitting(&cali_cfg, &s_cali);
+    }
+    if (ret != ESP_OK) {
+        adc_oneshot_del_unit(s_oneshot);
+        s_oneshot = NULL;
+        return ret;
+    }
+
+    batt_soc_init(&s_soc);
+    if (xTaskCreate(battery_task, "battery", 3072, NULL, 2, &s_task) != pdPASS) {
+        s_task = NULL;
+        adc_cali_delete_scheme_curve_fitting(s_cali);
+        adc_oneshot_del_unit(s_oneshot);
+        s_cali = NULL;
+        s_oneshot = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Battery monitor on ADC1 channel %d, divider x%d.%02d",
+             CONFIG_SALESTAG_BATTERY_ADC_CHANNEL, CONFIG_SALESTAG_BATTERY_DIVIDER_X100 / 100,
+             CONFIG_SALESTAG_BATTERY_DIVIDER_X100 % 100);
+    return ESP_OK;
+}
+
+#endif // CONFIG_SALESTAG_BATTERY_MONITOR
@@ -0,0 +1,49 @@
+/**
+ * @file battery_monitor.h
+ * @brief Battery voltage and state of charge
+ *
+ * While audio capture runs, the battery divider has one slot in the ADC
+ * continuous scan (see audio_capture.c) and its samples are separated from
+ * the microphone stream by adc_demux, so measuring never interrupts audio.
+ * While capture is stopped, the monitor task takes oneshot readings
+ * instead. Voltages are filtered and converted to a charge percentage by
+ * battery_soc.
+ */
+
+#ifndef BATTERY_MONITOR_H
+#define BATTERY_MONITOR_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint16_t cell_mv;       // Filtered cell voltage
+    uint8_t pct;            // State of charge, 0-100
+    bool valid;             // False until the first measurement
+} battery_status_t;
+
+/**
+ * @brief Create the calibration and oneshot handles and start the monitor task
+ */
+esp_err_t battery_monitor_init(void);
+
+/**
+ * @brief Hand over raw battery samples taken from the audio scan
+ *
+ * Called from the capture task with the sum and count of the battery-slot
+ * results of one or more DMA frames.
+ */
+void battery_monitor_feed_scan(uint32_t raw_sum, uint32_t count);
+
+void battery_monitor_get(battery_status_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BATTERY_MONITOR_H
@@ -0,0 +1,61 @@
+/**
+ * @file battery_soc.c
+ * @brief Battery state-of-charge estimate (see battery_soc.h)
+ */
+
+#include "battery_soc.h"
+#include <stddef.h>
+
+// Typical 1S LiPo at light load (C/5 or less), highest voltage first
+static const struct {
+    uint16_t mv;
+    uint8_t pct;
+} s_curve[] = {
+    { 4200, 100 }, { 4150, 95 }, { 4110, 90 }, { 4080, 85 }, { 4020, 80 },
+    { 3980, 75 },  { 3950, 70 }, { 3910, 65 }, { 3870, 60 }, { 3850, 55 },
+    { 3840, 50 },  { 3820, 45 }, { 3800, 40 }, { 3790, 35 }, { 3770, 30 },
+    { 3750, 25 },  { 3730, 20 }, { 3710, 15 }, { 3690, 10 }, { 3610, 5 },
+    { 3300, 0 },
+};
+#define CURVE_POINTS (sizeof(s_curve) / sizeof(s_curve[0]))
+
+void batt_soc_init(batt_soc_t *s) {
+    s->mv = 0.0f;
+    s->pct = 0;
+    s->pct_mv = 0.0f;
+    s->primed = false;
+}
+
+uint8_t batt_soc_from_mv(uint16_t cell_mv) {
+    if (cell_mv >= s_curve[0].mv) return 100;
+    for (size_t i = 1; i < CURVE_POINTS; i++) {
+        if (cell_mv >= s_curve[i].mv) {
+            uint32_t span_mv = s_curve[i - 1].mv - s_curve[i].mv;
+            uint32_t span_pct = s_curve[i - 1].pct - s_curve[i].pct;
+            uint32_t above = cell_mv - s_curve[i].mv;
+            return (uint8_t)(s_curve[i].pct + (above * span_pct + span_mv / 2) / span_mv);
+        }
+    }
+    return 0;
+}
+
+uint8_t batt_soc_update(batt_soc_t *s, uint16_t cell_mv, uint32_t dt_ms) {
+    if (!s->primed) {
+        s->mv = cell_mv;
+        s->pct = batt_soc_from_mv(cell_mv);
+        s->pct_mv = s->mv;
+        s->primed = true;
+        return s->pct;
+    }
+
+    // First-order low-pass; alpha = dt / (tau + dt) keeps it stable for any interval
+    float alpha = (float)dt_ms / (float)(BATT_SOC_TAU_MS + dt_ms);
+    s->mv += alpha * ((float)cell_mv - s->mv);
+
+    uint8_t pct = batt_soc_from_mv((uint16_t)(s->mv + 0.5f));
+    if (pct < s->pct || (pct > s->pct && s->mv >= s->pct_mv + BATT_SOC_RISE_MV)) {
+        s->pct = pct;
+        s->pct_mv = s->mv;
+    }
+    return s->pct;
+}
@@ -0,0 +1,51 @@
+/**
+ * @file battery_soc.h
+ * @brief Battery voltage filtering and state-of-charge estimate
+ *
+ * Single-cell Li-ion/LiPo. Cell voltage is low-pass filtered (load steps
+ * such as starting a recording or Wi-Fi upload would otherwise make the
+ * percentage jump) and mapped to a charge percentage through a piecewise
+ * linear discharge curve. The reported percentage only rises once the
+ * filtered voltage is BATT_SOC_RISE_MV above where it last changed, so
+ * neither noise nor the end of a load step makes it flicker or climb back;
+ * a charger does. Pure C.
+ */
+
+#ifndef BATTERY_SOC_H
+#define BATTERY_SOC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BATT_SOC_TAU_MS  300000  // Filter time constant: a 10 s, 150 mV upload sag moves it ~5 mV
+#define BATT_SOC_RISE_MV 10      // Rise needed before the reported percentage goes up
+
+typedef struct {
+    float mv;               // Filtered cell voltage
+    uint8_t pct;            // Reported state of charge
+    float pct_mv;           // Filtered voltage when pct last changed
+    bool primed;            // First sample seeds the filter
+} batt_soc_t;
+
+void batt_soc_init(batt_soc_t *s);
+
+/**
+ * @brief Charge percentage for a resting cell voltage (discharge-curve lookup)
+ */
+uint8_t batt_soc_from_mv(uint16_t cell_mv);
+
+/**
+ * @brief Feed a cell voltage measured dt_ms after the previous one
+ * @return Reported state of charge, 0-100
+ */
+uint8_t batt_soc_update(batt_soc_t *s, uint16_t cell_mv, uint32_t dt_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BATTERY_SOC_H
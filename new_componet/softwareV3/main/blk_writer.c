@@ -0,0 +1,61 @@
+/**
+ * @file blk_writer.c
+ * @brief Aligned buffered appends (see blk_writer.h)
+ */
+
+#include "blk_writer.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+int blk_writer_init(blk_writer_t *b, int fd, uint64_t offset, uint8_t *buf, size_t size) {
+    memset(b, 0, sizeof(*b));
+    if (offset % BLK_WRITER_ALIGN || size == 0 || size % BLK_WRITER_ALIGN) return -1;
+    b->fd = fd;
+    b->buf = buf;
+    b->size = size;
+    b->base = offset;
+    return 0;
+}
+
+// One write of buf[0 .. len) at base; a short write is an error (full card)
+static int write_at_base(blk_writer_t *b, size_t len) {
+    b->writes++;
+    ssize_t n = pwrite(b->fd, b->buf, len, (off_t)b->base);
+    if (n != (ssize_t)len) {
+        if (n >= 0) errno = ENOSPC;
+        return -1;
+    }
+    b->syncs++;
+    return fsync(b->fd);
+}
+
+// Write a full buffer and move on; it stays full (and is retried) if the write fails
+static int drain(blk_writer_t *b) {
+    if (write_at_base(b, b->size) != 0) return -1;
+    b->base += b->size;
+    b->fill = 0;
+    return 0;
+}
+
+size_t blk_writer_append(blk_writer_t *b, const void *data, size_t len) {
+    const uint8_t *p = data;
+    size_t taken = 0;
+    while (taken < len) {
+        if (b->fill == b->size && drain(b) != 0) return taken;
+        size_t n = b->size - b->fill;
+        if (n > len - taken) n = len - taken;
+        memcpy(b->buf + b->fill, p + taken, n);
+        b->fill += n;
+        taken += n;
+    }
+    // Written as soon as it fills; if that fails the data is still held
+    if (b->fill == b->size) drain(b);
+    return taken;
+}
+
+int blk_writer_flush(blk_writer_t *b) {
+    if (b->fill == b->size) return drain(b);
+    if (b->fill == 0) return 0;
+    return write_at_base(b, b->fill);
+}
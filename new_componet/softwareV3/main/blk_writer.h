@@ -0,0 +1,71 @@
+/**
+ * @file blk_writer.h
+ * @brief Buffered appends that reach the file as whole, aligned blocks
+ *
+ * FatFs writes whole sectors at a sector-aligned file offset straight from
+ * the caller's buffer (one multi-block command). Anything else goes through
+ * its one-sector window, with a read-modify-write at every unaligned edge.
+ * blk_writer_t collects appended bytes in a caller-provided buffer (a
+ * multiple of BLK_WRITER_ALIGN, word aligned and DMA capable on the target)
+ * and writes it when full, at an offset that is a multiple of its size from
+ * where the writer started. Every full buffer is synced as it is written,
+ * as raw_audio_storage.c syncs its buffers, so what was written survives a
+ * power loss.
+ *
+ * blk_writer_flush() writes the partial tail at the same place but keeps
+ * it buffered: the next write starts from the same aligned offset and
+ * replaces it. No write ever starts off a block boundary.
+ *
+ * Pure C over a POSIX file descriptor.
+ */
+
+#ifndef BLK_WRITER_H
+#define BLK_WRITER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BLK_WRITER_ALIGN  512   // SD sector
+
+typedef struct {
+    int fd;
+    uint8_t *buf;
+    size_t size;
+    size_t fill;
+    uint64_t base;              // File offset of buf[0]
+    uint32_t writes;            // write() calls, full and partial
+    uint32_t syncs;
+} blk_writer_t;
+
+/**
+ * @brief Append at offset (a multiple of BLK_WRITER_ALIGN) of fd
+ * @param size Multiple of BLK_WRITER_ALIGN
+ * @return 0, or -1 if the offset or size is not aligned
+ */
+int blk_writer_init(blk_writer_t *b, int fd, uint64_t offset, uint8_t *buf, size_t size);
+
+/**
+ * @brief Buffer data, writing and syncing each buffer as it fills
+ * @return Bytes taken: len, or fewer if a full buffer could not be written
+ *         (errno set; the buffer is kept and written by the next call)
+ */
+size_t blk_writer_append(blk_writer_t *b, const void *data, size_t len);
+
+// Write what is buffered (a partial tail stays buffered) and sync; 0 or -1 with errno
+int blk_writer_flush(blk_writer_t *b);
+
+// Offset of the next appended byte
+static inline uint64_t blk_writer_offset(const blk_writer_t *b) {
+    return b->base + b->fill;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BLK_WRITER_H
@@ -0,0 +1,120 @@
+/**
+ * @file capture_chain.c
+ * @brief Microphone conditioning chain (see capture_chain.h)
+ */
+
+#include "capture_chain.h"
+#include <math.h>
+#include <string.h>
+
+#define CHAIN_INLINE static inline __attribute__((always_inline))
+
+static const capture_chain_params_t s_fixed = CAPTURE_CHAIN_PARAMS_DEFAULT;
+
+void capture_chain_reset(capture_chain_t *c) {
+    memset(c, 0, sizeof(*c));
+    c->noise_floor = 1000.0f;
+    c->gain = 1.0f;
+}
+
+void capture_chain_preset(capture_chain_t *c, float noise_floor, float gain) {
+    capture_chain_reset(c);
+    c->noise_floor = noise_floor;
+    c->gain = gain;
+    c->calibrated = true;
+}
+
+// One calibration sample: the absolute deviation from the bias
+CHAIN_INLINE void accumulate(capture_chain_t *c, const capture_chain_params_t *p, float volts) {
+    c->cal_sum += fabsf(volts - p->dc_offset);
+    c->cal_count += 1.0f;
+    c->sample_count++;
+}
+
+CHAIN_INLINE void calibrate(capture_chain_t *c, const capture_chain_params_t *p, float volts) {
+    if (c->calibrated || c->sample_count >= p->cal_samples) return;
+    accumulate(c, p, volts);
+    if (c->sample_count >= p->cal_samples) {
+        c->noise_floor = c->cal_sum / c->cal_count;
+        c->calibrated = true;
+        // Initial gain normalizes to the noise floor
+        if (c->noise_floor > 0.1f) {
+            c->gain = 1.0f / c->noise_floor;
+            if (c->gain > p->gain_max) c->gain = p->gain_max;
+        }
+    }
+}
+
+/*
+ * How much of the calibration a step has to handle:
+ * - CHAIN_CHECKED: all of it, tested on every sample (the generic chain, and
+ *   the sample that completes calibration in the specialized one)
+ * - CHAIN_CALIBRATING: known to be calibrating and not on the last sample,
+ *   so the sample is only accumulated and the AGC is skipped
+ * - CHAIN_CALIBRATED: known to be calibrated, no calibration at all
+ */
+typedef enum {
+    CHAIN_CHECKED,
+    CHAIN_CALIBRATING,
+    CHAIN_CALIBRATED,
+} chain_phase_t;
+
+/*
+ * One sample. Inlined into both entry points, so with constant p and phase
+ * the compiler folds away whatever the phase rules out.
+ */
+CHAIN_INLINE int16_t step(capture_chain_t *c, const capture_chain_params_t *p, uint16_t raw, chain_phase_t phase) {
+    float volts = (float)raw * p->vref / p->adc_codes;
+    if (phase == CHAIN_CHECKED) {
+        calibrate(c, p, volts);
+    } else if (phase == CHAIN_CALIBRATING) {
+        accumulate(c, p, volts);
+    }
+
+    // y[n] = x[n] - x[n-1] + R * y[n-1]
+    float filtered = volts - c->dc_x1 + p->dc_r * c->dc_y1;
+    c->dc_x1 = volts;
+    c->dc_y1 = filtered;
+    float ac = filtered - p->dc_offset;
+
+    if (phase == CHAIN_CALIBRATED || (phase == CHAIN_CHECKED && c->calibrated)) {
+        float relative = fabsf(ac) / c->noise_floor;
+        if (relative < p->agc_low) {
+            c->gain = fminf(c->gain * p->gain_up, p->gain_max);
+        } else if (relative > p->agc_high) {
+            c->gain = fmaxf(c->gain * p->gain_down, p->gain_min);
+        }
+        ac = ac * c->gain;
+    }
+
+    if (fabsf(ac) < p->gate_threshold) ac = ac * p->gate_ratio;
+
+    float scaled = ac * p->scale;
+    if (scaled > p->clip) {
+        scaled = p->clip;
+        c->clip_count++;
+    } else if (scaled < -p->clip) {
+        scaled = -p->clip;
+        c->clip_count++;
+    }
+    c->signal_level = p->smoothing * c->signal_level + (1.0f - p->smoothing) * (scaled * scaled);
+    return (int16_t)scaled;
+}
+
+void capture_chain_run(capture_chain_t *c, const uint16_t *raw, int16_t *out, size_t n) {
+    size_t i = 0;
+    if (!c->calibrated) {
+        // The first second of a capture: every sample but the last of the
+        // calibration only accumulates, and the last one completes it
+        size_t left = c->sample_count < s_fixed.cal_samples ? s_fixed.cal_samples - c->sample_count : 0;
+        size_t m = left > n ? n : (left ? left - 1 : 0);
+        for (; i < m; i++) out[i] = step(c, &s_fixed, raw[i], CHAIN_CALIBRATING);
+        for (; i < n && !c->calibrated; i++) out[i] = step(c, &s_fixed, raw[i], CHAIN_CHECKED);
+    }
+    for (; i < n; i++) out[i] = step(c, &s_fixed, raw[i], CHAIN_CALIBRATED);
+}
+
+void capture_chain_run_generic(capture_chain_t *c, const capture_chain_params_t *p,
+                               const uint16_t *raw, int16_t *out, size_t n) {
+    for (size_t i = 0; i < n; i++) out[i] = step(c, p, raw[i], CHAIN_CHECKED);
+}
@@ -0,0 +1,103 @@
+/**
+ * @file capture_chain.h
+ * @brief Microphone conditioning chain, specialized at compile time or generic
+ *
+ * Raw 12-bit MAX9814 codes to 16-bit audio, per sample:
+ *   volts -> calibration (first second: noise floor, initial gain)
+ *   -> DC blocking high-pass -> bias removal -> dynamic gain (once calibrated)
+ *   -> noise gate -> scaling -> clipping at 90% -> RMS tracking
+ *
+ * The chain is written once, as an always-inline step, and compiled twice:
+ *   - capture_chain_run(): the parameters are CAPTURE_CHAIN_PARAMS_DEFAULT,
+ *     so the coefficients fold into the code, and the block runs the
+ *     calibration steps only until calibration completes and then a loop
+ *     with no calibration checks at all
+ *   - capture_chain_run_generic(): parameters read from a struct every
+ *     sample and every check made every sample, so they can be tuned at
+ *     run time (CONFIG_SALESTAG_CAPTURE_GENERIC, for development)
+ * Given the default parameters both produce the same samples, bit for bit;
+ * host/chainbench checks that and counts cycles per block for each.
+ *
+ * Pure C, no logging: the capture logs from the state after each block
+ * (calibration done, clip_count).
+ */
+
+#ifndef CAPTURE_CHAIN_H
+#define CAPTURE_CHAIN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// MAX9814: ~1.25 V bias, ~2 Vpp around it, read by a 12-bit ADC against 3.3 V
+#define CAPTURE_CHAIN_VREF          3.3f
+#define CAPTURE_CHAIN_ADC_CODES     4096.0f
+#define CAPTURE_CHAIN_DC_OFFSET     1.25f
+#define CAPTURE_CHAIN_OUTPUT_VPP    2.0f
+#define CAPTURE_CHAIN_SCALE         (32767.0f / (CAPTURE_CHAIN_OUTPUT_VPP / 2.0f * CAPTURE_CHAIN_ADC_CODES / CAPTURE_CHAIN_VREF))
+#define CAPTURE_CHAIN_CLIP          29490.0f    // 90% of the 16-bit range
+#define CAPTURE_CHAIN_CAL_SAMPLES   16000       // 1 s at 16 kHz
+
+#define CAPTURE_CHAIN_PARAMS_DEFAULT {                                          \
+    .vref = CAPTURE_CHAIN_VREF, .adc_codes = CAPTURE_CHAIN_ADC_CODES,           \
+    .dc_offset = CAPTURE_CHAIN_DC_OFFSET, .dc_r = 0.995f,                       \
+    .gate_threshold = 500.0f, .gate_ratio = 0.1f, .smoothing = 0.95f,           \
+    .scale = CAPTURE_CHAIN_SCALE, .clip = CAPTURE_CHAIN_CLIP,                   \
+    .gain_max = 3.0f, .gain_min = 0.5f, .gain_up = 1.001f, .gain_down = 0.999f, \
+    .agc_low = 2.0f, .agc_high = 10.0f, .cal_samples = CAPTURE_CHAIN_CAL_SAMPLES, \
+}
+
+typedef struct {
+    float vref;
+    float adc_codes;
+    float dc_offset;            // V
+    float dc_r;                 // DC blocker pole
+    float gate_threshold;
+    float gate_ratio;           // Applied below the threshold
+    float smoothing;            // RMS tracker
+    float scale;                // V to 16-bit
+    float clip;
+    float gain_max;
+    float gain_min;
+    float gain_up;              // Per sample, signal below agc_low x noise floor
+    float gain_down;            // Per sample, signal above agc_high x noise floor
+    float agc_low;
+    float agc_high;
+    uint32_t cal_samples;
+} capture_chain_params_t;
+
+typedef struct {
+    float dc_x1;                // DC blocker: previous input and output
+    float dc_y1;
+    float noise_floor;          // V
+    float signal_level;         // Smoothed square of the output
+    float gain;
+    float cal_sum;
+    float cal_count;
+    uint32_t sample_count;      // Calibration samples taken
+    bool calibrated;
+    uint32_t clip_count;        // Samples clipped since the reset
+} capture_chain_t;
+
+// Fresh calibration from the next sample
+void capture_chain_reset(capture_chain_t *c);
+
+// Calibrated from the first sample (a calibration saved across deep sleep)
+void capture_chain_preset(capture_chain_t *c, float noise_floor, float gain);
+
+// Specialized: CAPTURE_CHAIN_PARAMS_DEFAULT folded in
+void capture_chain_run(capture_chain_t *c, const uint16_t *raw, int16_t *out, size_t n);
+
+// Generic: any parameters, checked per sample
+void capture_chain_run_generic(capture_chain_t *c, const capture_chain_params_t *p,
+                               const uint16_t *raw, int16_t *out, size_t n);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CAPTURE_CHAIN_H
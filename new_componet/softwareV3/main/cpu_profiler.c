@@ -0,0 +1,218 @@
+/**
+ * @file cpu_profiler.c
+ * @brief Sampling CPU profiler (see cpu_profiler.h)
+ */
+
+#include "sdkconfig.h"
+
+#if CONFIG_SALESTAG_PROFILER
+
+#include "cpu_profiler.h"
+#include "prof_hist.h"
+#include "sd_storage.h"
+#include "driver/gptimer.h"
+#include "esp_app_desc.h"
+#include "esp_attr.h"
+#include "esp_cpu_utils.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "xtensa_context.h"
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <unistd.h>
+
+static const char *TAG = "cpu_prof";
+
+#define PROF_TIMER_RESOLUTION_HZ 1000000
+#define PROF_MAX_WINDOW_MS       (10 * 60 * 1000)
+#define PROF_TMP_SUFFIX          "~"
+
+static prof_hist_t s_hist[portNUM_PROCESSORS];
+static gptimer_handle_t s_timers[portNUM_PROCESSORS];
+static prof_entry_t *s_entries = NULL;
+static atomic_bool s_running = false;
+static uint32_t s_window_ms;
+static cpu_profiler_done_fn_t s_done_fn;
+static SemaphoreHandle_t s_setup_done;
+static esp_err_t s_setup_err[portNUM_PROCESSORS];
+
+static bool IRAM_ATTR on_sample(gptimer_handle_t timer, const gptimer_alarm_event_data_t *edata, void *user_ctx) {
+    prof_hist_t *h = (prof_hist_t *)user_ctx;
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+
+    // Level-1 interrupt entry stores the interrupted task's exception frame
+    // in its TCB's pxTopOfStack, the first word of the TCB
+    const XtExcFrame *frame = *(XtExcFrame *const *)task;
+    uint32_t caller = frame->a0 ? esp_cpu_process_stack_pc(frame->a0) : 0;
+
+    prof_hist_add(h, frame->pc, caller, prof_hist_task(h, task, pcTaskGetName(task)));
+    return false;
+}
+
+// The timer interrupt is allocated on the core that registers the callback
+static void timer_setup_task(void *arg) {
+    int core = (int)(intptr_t)arg;
+    gptimer_handle_t timer = NULL;
+    const gptimer_config_t cfg = {
+        .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+        .direction = GPTIMER_COUNT_UP,
+        .resolution_hz = PROF_TIMER_RESOLUTION_HZ,
+    };
+    const gptimer_event_callbacks_t cbs = { .on_alarm = on_sample };
+    const gptimer_alarm_config_t alarm = {
+        .alarm_count = PROF_TIMER_RESOLUTION_HZ / CONFIG_SALESTAG_PROFILER_HZ,
+        .reload_count = 0,
+        .flags.auto_reload_on_alarm = true,
+    };
+
+    esp_err_t ret = gptimer_new_timer(&cfg, &timer);
+    if (ret == ESP_OK) ret = gptimer_register_event_callbacks(timer, &cbs, &s_hist[core]);
+    if (ret == ESP_OK) ret = gptimer_set_alarm_action(timer, &alarm);
+    if (ret == ESP_OK) ret = gptimer_enable(timer);
+    if (ret != ESP_OK && timer) {
+        gptimer_del_timer(timer);
+        timer = NULL;
+    }
+    s_timers[core] = timer;
+    s_setup_err[core] = ret;
+    xSemaphoreGive(s_setup_done);
+    vTaskDelete(NULL);
+}
+
+static void timers_release(void) {
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        if (!s_timers[i]) continue;
+        gptimer_disable(s_timers[i]);
+        gptimer_del_timer(s_timers[i]);
+        s_timers[i] = NULL;
+    }
+}
+
+static void emit_log(void *ctx, const char *line) {
+    ESP_LOGI(TAG, "%s", line);
+}
+
+static void emit_file(void *ctx, const char *line) {
+    FILE *f = (FILE *)ctx;
+    fputs(line, f);
+    fputc('\n', f);
+}
+
+static esp_err_t write_report(const prof_meta_t *meta) {
+    const char *path = SD_REC_DIR "/" CPU_PROFILER_FILE;
+    const char *tmp_path = SD_REC_DIR "/" CPU_PROFILER_FILE PROF_TMP_SUFFIX;
+
+    prof_report(s_hist, portNUM_PROCESSORS, meta, emit_log, NULL);
+
+    FILE *f = fopen(tmp_path, "w");
+    if (!f) {
+        ESP_LOGW(TAG, "Failed to create %s (errno: %d)", tmp_path, errno);
+        return ESP_FAIL;
+    }
+    prof_report(s_hist, portNUM_PROCESSORS, meta, emit_file, f);
+    bool ok = !ferror(f);
+    ok = (fclose(f) == 0) && ok;
+
+    // FATFS rename does not replace an existing file
+    unlink(path);
+    if (!ok || rename(tmp_path, path) != 0) {
+        ESP_LOGW(TAG, "Failed to write %s (errno: %d)", path, errno);
+        unlink(tmp_path);
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Report saved to %s", path);
+    return ESP_OK;
+}
+
+static void profiler_task(void *arg) {
+    esp_err_t ret = ESP_OK;
+
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        s_setup_err[i] = ESP_ERR_NO_MEM;
+        if (xTaskCreatePinnedToCore(timer_setup_task, "prof_setup", 3072, (void *)(intptr_t)i, 5, NULL, i) == pdPASS) {
+            xSemaphoreTake(s_setup_done, portMAX_DELAY);
+        }
+    }
+    for (int i = 0; i < portNUM_PROCESSORS && ret == ESP_OK; i++) {
+        ret = s_setup_err[i];
+    }
+
+    if (ret == ESP_OK) {
+        ESP_LOGI(TAG, "Sampling %d cores at %d Hz for %lu ms", portNUM_PROCESSORS,
+                 CONFIG_SALESTAG_PROFILER_HZ, (unsigned long)s_window_ms);
+        for (int i = 0; i < portNUM_PROCESSORS; i++) {
+            gptimer_start(s_timers[i]);
+        }
+        vTaskDelay(pdMS_TO_TICKS(s_window_ms));
+        // Stop sampling before the tables are read
+        for (int i = 0; i < portNUM_PROCESSORS; i++) {
+            gptimer_stop(s_timers[i]);
+        }
+    } else {
+        ESP_LOGE(TAG, "Timer setup failed: %s", esp_err_to_name(ret));
+    }
+    timers_release();
+
+    if (ret == ESP_OK) {
+        char elf_sha[17];
+        esp_app_get_elf_sha256(elf_sha, sizeof(elf_sha));
+        const prof_meta_t meta = {
+            .hz = CONFIG_SALESTAG_PROFILER_HZ,
+            .window_ms = s_window_ms,
+            .elf_sha = elf_sha,
+        };
+        ret = write_report(&meta);
+    }
+
+    heap_caps_free(s_entries);
+    s_entries = NULL;
+    cpu_profiler_done_fn_t done_fn = s_done_fn;
+    atomic_store(&s_running, false);
+    if (done_fn) done_fn(ret);
+    vTaskDelete(NULL);
+}
+
+esp_err_t cpu_profiler_start(uint32_t window_ms, cpu_profiler_done_fn_t done_fn) {
+    if (window_ms == 0 || window_ms > PROF_MAX_WINDOW_MS) return ESP_ERR_INVALID_ARG;
+
+    bool expected = false;
+    if (!atomic_compare_exchange_strong(&s_running, &expected, true)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (!s_setup_done) s_setup_done = xSemaphoreCreateCounting(portNUM_PROCESSORS, 0);
+    // Tables are only held for the duration of a window
+    s_entries = heap_caps_calloc((size_t)portNUM_PROCESSORS * CONFIG_SALESTAG_PROFILER_SLOTS,
+                                 sizeof(prof_entry_t), MALLOC_CAP_INTERNAL);
+    if (!s_setup_done || !s_entries) {
+        ESP_LOGE(TAG, "Out of memory for %d sample slots", CONFIG_SALESTAG_PROFILER_SLOTS);
+        heap_caps_free(s_entries);
+        s_entries = NULL;
+        atomic_store(&s_running, false);
+        return ESP_ERR_NO_MEM;
+    }
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        prof_hist_init(&s_hist[i], s_entries + (size_t)i * CONFIG_SALESTAG_PROFILER_SLOTS,
+                       CONFIG_SALESTAG_PROFILER_SLOTS);
+    }
+
+    s_window_ms = window_ms;
+    s_done_fn = done_fn;
+    if (xTaskCreate(profiler_task, "cpu_prof", 4096, NULL, 3, NULL) != pdPASS) {
+        heap_caps_free(s_entries);
+        s_entries = NULL;
+        atomic_store(&s_running, false);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+bool cpu_profiler_running(void) {
+    return atomic_load(&s_running);
+}
+
+#endif // CONFIG_SALESTAG_PROFILER
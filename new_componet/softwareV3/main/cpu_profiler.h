@@ -0,0 +1,49 @@
+/**
+ * @file cpu_profiler.h
+ * @brief Statistical sampling CPU profiler
+ *
+ * A general-purpose timer per core interrupts at CONFIG_SALESTAG_PROFILER_HZ
+ * and counts the interrupted PC, its caller and the running task in that
+ * core's prof_hist_t. At the end of the window the report is logged over
+ * UART and written to SD_REC_DIR/profile.prf, which clients download with
+ * START_WITH_FILENAME like any recording. host/profiler/prof_fold.py
+ * symbolizes it against the application ELF.
+ *
+ * Time spent in other interrupt handlers and with interrupts masked is not
+ * sampled directly; it is attributed to the code that runs when they end.
+ */
+
+#ifndef CPU_PROFILER_H
+#define CPU_PROFILER_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CPU_PROFILER_FILE "profile.prf"
+
+// Called from the profiler task once the report is written (or failed)
+typedef void (*cpu_profiler_done_fn_t)(esp_err_t result);
+
+/**
+ * @brief Profile both cores for a window; returns immediately
+ * @param window_ms Window length (1 ms .. 10 min)
+ * @param done_fn Completion callback; may be NULL
+ * @return ESP_ERR_INVALID_STATE if a window is already running
+ */
+esp_err_t cpu_profiler_start(uint32_t window_ms, cpu_profiler_done_fn_t done_fn);
+
+/**
+ * @brief True while a profiling window is open or its report is being written
+ */
+bool cpu_profiler_running(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CPU_PROFILER_H
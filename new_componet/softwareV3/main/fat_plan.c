@@ -0,0 +1,89 @@
+/**
+ * @file fat_plan.c
+ * @brief FAT32 layout planning (see fat_plan.h)
+ */
+
+#include "fat_plan.h"
+
+#define FAT_PLAN_MIN_RESERVED  32   // Boot sector, FSINFO and the backup boot sector
+
+static bool layout(uint64_t sectors, uint32_t sector_size, uint32_t spc, uint32_t align,
+                   fat_plan_t *out) {
+    uint32_t per_fat_sector = sector_size / 4;
+    if (sectors <= FAT_PLAN_MIN_RESERVED) return false;
+    uint64_t clusters = (sectors - FAT_PLAN_MIN_RESERVED) / spc;
+    uint64_t fat = 0;
+    uint64_t data = 0;
+
+    // The FAT size depends on the cluster count and vice versa; a few rounds settle it.
+    // Alignment padding goes into the reserved area, as f_mkfs does.
+    for (int round = 0; round < 3; round++) {
+        fat = (clusters + 2 + per_fat_sector - 1) / per_fat_sector;
+        data = (FAT_PLAN_MIN_RESERVED + 2 * fat + align - 1) / align * align;
+        if (data >= sectors) return false;
+        clusters = (sectors - data) / spc;
+    }
+    if (clusters < FAT_PLAN_FAT32_MIN_CLUSTERS || clusters > FAT_PLAN_FAT32_MAX_CLUSTERS) return false;
+
+    out->cluster_bytes = spc * sector_size;
+    out->align_sectors = align;
+    out->fat_sectors = (uint32_t)fat;
+    out->data_start = (uint32_t)data;
+    out->reserved_sectors = (uint32_t)(data - 2 * fat);
+    out->clusters = (uint32_t)clusters;
+    return true;
+}
+
+bool fat_plan(uint64_t sectors, uint32_t sector_size, uint32_t au_kb, uint32_t cluster_kb,
+              fat_plan_t *out) {
+    if (sector_size < 512 || sectors == 0) return false;
+    if (cluster_kb == 0) cluster_kb = FAT_PLAN_DEFAULT_CLUSTER_KB;
+    if (cluster_kb > FAT_PLAN_MAX_CLUSTER_KB) cluster_kb = FAT_PLAN_MAX_CLUSTER_KB;
+    if (au_kb == 0) au_kb = FAT_PLAN_DEFAULT_AU_KB;
+
+    uint64_t align = (uint64_t)au_kb * 1024 / sector_size;
+    if (align == 0) align = 1;
+    if (align > FAT_PLAN_MAX_ALIGN_SECTORS) align = FAT_PLAN_MAX_ALIGN_SECTORS;
+
+    // Halve the cluster until the card holds enough of them to be FAT32
+    for (uint32_t kb = cluster_kb; kb >= FAT_PLAN_MIN_CLUSTER_KB; kb /= 2) {
+        uint32_t spc = kb * 1024 / sector_size;
+        if (spc == 0) break;
+        // Small cards: don't spend more than 1/16 of the card on alignment
+        uint32_t a = (uint32_t)align;
+        while (a > spc && (uint64_t)a * 16 > sectors) a /= 2;
+        if (layout(sectors, sector_size, spc, a, out)) return true;
+    }
+    return false;
+}
+
+uint64_t fat_plan_meta_writes(const fat_plan_t *p, uint32_t sector_size, uint64_t bytes,
+                              uint32_t sync_bytes) {
+    if (sync_bytes == 0) sync_bytes = p->cluster_bytes;
+    uint32_t per_fat_sector = sector_size / 4;
+    uint64_t writes = 0;
+    uint64_t clusters_synced = 0;
+
+    for (uint64_t done = 0; done < bytes;) {
+        done += sync_bytes;
+        if (done > bytes) done = bytes;
+        uint64_t clusters = (done + p->cluster_bytes - 1) / p->cluster_bytes;
+        if (clusters > clusters_synced) {
+            // Entries from the old tail to the new one, in both FAT copies, plus FSINFO
+            uint64_t first = clusters_synced ? clusters_synced - 1 : 0;
+            uint64_t sectors = (clusters - 1) / per_fat_sector - first / per_fat_sector + 1;
+            writes += 2 * sectors + 1;
+            clusters_synced = clusters;
+        }
+        writes++;   // Directory entry (size)
+    }
+    return writes;
+}
+
+uint64_t fat_plan_seek_reads(const fat_plan_t *p, uint32_t sector_size, uint64_t offset) {
+    uint64_t hops = offset / p->cluster_bytes;
+    if (hops == 0) return 0;
+    uint32_t per_fat_sector = sector_size / 4;
+    // A contiguous chain: each FAT sector read serves per_fat_sector hops
+    return (hops + per_fat_sector - 1) / per_fat_sector;
+}
@@ -0,0 +1,68 @@
+/**
+ * @file fat_plan.h
+ * @brief FAT32 layout for a recording card: cluster size and alignment
+ *
+ * Recordings are long sequential files, so the card is formatted with big
+ * clusters (short FAT chains, few FAT sector updates per synced buffer)
+ * and with the data area starting on an erase-block (allocation unit)
+ * boundary, so clusters never straddle two erase blocks. The plan is what
+ * FatFs f_mkfs() is given; the counts let the host bench compare layouts.
+ * Pure C.
+ */
+
+#ifndef FAT_PLAN_H
+#define FAT_PLAN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FAT_PLAN_DEFAULT_CLUSTER_KB  32
+#define FAT_PLAN_MAX_CLUSTER_KB      64     // FAT32 limit with 512-byte sectors
+#define FAT_PLAN_MIN_CLUSTER_KB      4
+#define FAT_PLAN_DEFAULT_AU_KB       4096   // SDHC/SDXC allocation unit when the card doesn't say
+#define FAT_PLAN_MAX_ALIGN_SECTORS   32768  // 16 MB: larger AUs only waste space before the data area
+#define FAT_PLAN_FAT32_MIN_CLUSTERS  65525u
+#define FAT_PLAN_FAT32_MAX_CLUSTERS  0x0FFFFFF5u
+
+typedef struct {
+    uint32_t cluster_bytes;
+    uint32_t align_sectors;     // Data area alignment (f_mkfs MKFS_PARM.align)
+    uint32_t reserved_sectors;  // Before the first FAT
+    uint32_t fat_sectors;       // Per FAT copy
+    uint32_t data_start;        // First data sector (multiple of align_sectors)
+    uint32_t clusters;
+} fat_plan_t;
+
+/**
+ * @brief Plan a two-FAT FAT32 volume covering the whole card
+ * @param sectors Card size in sectors
+ * @param sector_size Bytes per sector (512 on SD cards)
+ * @param au_kb Erase block / allocation unit from the card (0 = unknown)
+ * @param cluster_kb Wanted cluster size (0 = FAT_PLAN_DEFAULT_CLUSTER_KB); made
+ *                   smaller if the card is too small for that many FAT32 clusters
+ * @return false if no FAT32 layout fits (card far too small)
+ */
+bool fat_plan(uint64_t sectors, uint32_t sector_size, uint32_t au_kb, uint32_t cluster_kb,
+              fat_plan_t *out);
+
+/**
+ * @brief FAT sectors that change while a file grows by bytes, synced every sync_bytes
+ *
+ * Each sync rewrites the FAT sector holding the chain's tail if a cluster
+ * was added since the last sync (both FAT copies), plus the directory entry.
+ */
+uint64_t fat_plan_meta_writes(const fat_plan_t *p, uint32_t sector_size, uint64_t bytes,
+                              uint32_t sync_bytes);
+
+// FAT sectors read to follow a chain from the start of a file to byte offset
+uint64_t fat_plan_seek_reads(const fat_plan_t *p, uint32_t sector_size, uint64_t offset);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FAT_PLAN_H
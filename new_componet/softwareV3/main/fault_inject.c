@@ -0,0 +1,235 @@
+/**
+ * @file fault_inject.c
+ * @brief Deterministic fault injection (see fault_inject.h)
+ */
+
+#include "fault_inject.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *const s_point_names[FI_POINT_COUNT] = {
+    [FI_SD_WRITE]           = "sd_write",
+    [FI_SD_READ]            = "sd_read",
+    [FI_SD_LATENCY]         = "sd_latency",
+    [FI_MBUF_ALLOC]         = "mbuf_alloc",
+    [FI_NOTIFY_ECONTROLLER] = "notify_econtroller",
+    [FI_NOTIFY_EBUSY]       = "notify_ebusy",
+    [FI_NOTIFY_TX_LOST]     = "notify_tx_lost",
+    [FI_DISCONNECT]         = "disconnect",
+    [FI_ADC_OVERFLOW]       = "adc_overflow",
+    [FI_SD_POWER_CYCLE]     = "sd_power_cycle",
+    [FI_SD_REMOUNT]         = "sd_remount",
+};
+
+static uint32_t rng_next(fi_ctx_t *c) {
+    // xorshift32
+    uint32_t x = c->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    c->rng = x;
+    return x;
+}
+
+static uint32_t clock_ms(const fi_ctx_t *c) {
+    return c->now_ms ? c->now_ms() : 0;
+}
+
+void fi_init(fi_ctx_t *c, uint32_t seed, fi_clock_ms_fn_t now_ms) {
+    memset(c, 0, sizeof(*c));
+    c->rng = seed ? seed : 0x2545F491U;
+    c->now_ms = now_ms;
+}
+
+void fi_set_rule(fi_ctx_t *c, fi_point_t p, const fi_rule_t *rule) {
+    if ((unsigned)p >= FI_POINT_COUNT) return;
+    c->rules[p] = *rule;
+    if (c->rules[p].burst == 0) c->rules[p].burst = 1;
+    c->burst_left[p] = 0;
+    c->at_fired[p] = false;
+    c->armed = true;
+}
+
+const char *fi_point_name(fi_point_t p) {
+    return (unsigned)p < FI_POINT_COUNT ? s_point_names[p] : "?";
+}
+
+static int point_by_name(const char *name, size_t len) {
+    for (int i = 0; i < FI_POINT_COUNT; i++) {
+        if (strlen(s_point_names[i]) == len && strncmp(s_point_names[i], name, len) == 0) return i;
+    }
+    return -1;
+}
+
+// Parse "key=value" options of one rule; returns false on unknown keys
+static bool parse_options(const char *opts, fi_rule_t *r) {
+    char buf[128];
+    size_t len = strlen(opts);
+    if (len >= sizeof(buf)) return false;
+    memcpy(buf, opts, len + 1);
+
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(tok, '=');
+        if (!eq) return false;
+        *eq = '\0';
+        const char *val = eq + 1;
+        char *end = NULL;
+
+        if (strcmp(tok, "p") == 0) {
+            double p = strtod(val, &end);
+            if (p < 0.0 || p > 1.0) return false;
+            r->prob_ppm = (uint32_t)(p * 1e6 + 0.5);
+        } else if (strcmp(tok, "at") == 0) {
+            r->at = (uint32_t)strtoul(val, &end, 0);
+        } else if (strcmp(tok, "every") == 0) {
+            r->every = (uint32_t)strtoul(val, &end, 0);
+        } else if (strcmp(tok, "burst") == 0) {
+            r->burst = (uint16_t)strtoul(val, &end, 0);
+        } else if (strcmp(tok, "ms") == 0) {
+            r->latency_ms = (uint16_t)strtoul(val, &end, 0);
+        } else if (strcmp(tok, "max") == 0) {
+            r->max_triggers = (uint32_t)strtoul(val, &end, 0);
+        } else {
+            return false;
+        }
+        if (end == val || (end && *end != '\0')) return false;
+    }
+    return true;
+}
+
+int fi_load(fi_ctx_t *c, const char *spec) {
+    fi_rule_t rules[FI_POINT_COUNT];
+    bool set[FI_POINT_COUNT] = { false };
+    int count = 0;
+
+    // Validate the whole scenario before applying any of it
+    const char *p = spec;
+    while (p && *p) {
+        const char *end = strchr(p, ';');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        if (len > 0) {
+            const char *colon = memchr(p, ':', len);
+            size_t name_len = colon ? (size_t)(colon - p) : len;
+            int idx = point_by_name(p, name_len);
+            if (idx < 0) return -1;
+
+            fi_rule_t r = { 0 };
+            if (colon) {
+                char opts[128];
+                size_t opt_len = len - name_len - 1;
+                if (opt_len >= sizeof(opts)) return -1;
+                memcpy(opts, colon + 1, opt_len);
+                opts[opt_len] = '\0';
+                if (!parse_options(opts, &r)) return -1;
+            } else {
+                r.every = 1;  // Bare name: fail every call
+            }
+            rules[idx] = r;
+            if (!set[idx]) count++;
+            set[idx] = true;
+        }
+        p = end ? end + 1 : NULL;
+    }
+
+    for (int i = 0; i < FI_POINT_COUNT; i++) {
+        if (set[i]) fi_set_rule(c, (fi_point_t)i, &rules[i]);
+    }
+    return count;
+}
+
+bool fi_hit(fi_ctx_t *c, fi_point_t p, uint32_t pos) {
+    if (!c->armed || (unsigned)p >= FI_POINT_COUNT) return false;
+    const fi_rule_t *r = &c->rules[p];
+    fi_stats_t *st = &c->stats[p];
+    st->calls++;
+
+    if (c->burst_left[p] > 0) {
+        c->burst_left[p]--;
+        st->hits++;
+        return true;
+    }
+    if (r->max_triggers && st->triggers >= r->max_triggers) return false;
+
+    bool fire = false;
+    if (r->at && !c->at_fired[p] && pos >= r->at) {
+        c->at_fired[p] = true;
+        fire = true;
+    }
+    if (r->every && (st->calls % r->every) == 0) fire = true;
+    // Always draw so the sequence of one point doesn't depend on the other rules' outcomes
+    if (r->prob_ppm && (rng_next(c) % 1000000U) < r->prob_ppm) fire = true;
+
+    if (!fire) return false;
+    st->triggers++;
+    st->hits++;
+    c->burst_left[p] = (uint16_t)(r->burst > 0 ? r->burst - 1 : 0);
+    return true;
+}
+
+uint32_t fi_latency_ms(const fi_ctx_t *c, fi_point_t p) {
+    return (unsigned)p < FI_POINT_COUNT ? c->rules[p].latency_ms : 0;
+}
+
+void fi_failed(fi_ctx_t *c, fi_point_t p) {
+    if ((unsigned)p >= FI_POINT_COUNT) return;
+    c->stats[p].failures++;
+    if (!c->failing[p]) {
+        c->failing[p] = true;
+        c->fail_since_ms[p] = clock_ms(c);
+    }
+}
+
+void fi_ok(fi_ctx_t *c, fi_point_t p) {
+    if ((unsigned)p >= FI_POINT_COUNT || !c->failing[p]) return;
+    uint32_t dt = clock_ms(c) - c->fail_since_ms[p];
+    fi_stats_t *st = &c->stats[p];
+    c->failing[p] = false;
+    st->recoveries++;
+    st->recovery_ms_total += dt;
+    if (dt > st->recovery_ms_max) st->recovery_ms_max = dt;
+}
+
+void fi_lost(fi_ctx_t *c, fi_point_t p, uint32_t bytes) {
+    if ((unsigned)p >= FI_POINT_COUNT) return;
+    c->stats[p].lost_bytes += bytes;
+}
+
+void fi_stats_accumulate(fi_ctx_t *dst, const fi_ctx_t *src) {
+    for (int i = 0; i < FI_POINT_COUNT; i++) {
+        fi_stats_t *d = &dst->stats[i];
+        const fi_stats_t *s = &src->stats[i];
+        d->calls += s->calls;
+        d->hits += s->hits;
+        d->triggers += s->triggers;
+        d->failures += s->failures;
+        d->recoveries += s->recoveries;
+        d->recovery_ms_total += s->recovery_ms_total;
+        if (s->recovery_ms_max > d->recovery_ms_max) d->recovery_ms_max = s->recovery_ms_max;
+        d->lost_bytes += s->lost_bytes;
+    }
+}
+
+size_t fi_report(const fi_ctx_t *c, char *buf, size_t buf_sz) {
+    size_t off = 0;
+    if (buf_sz == 0) return 0;
+    buf[0] = '\0';
+
+    for (int i = 0; i < FI_POINT_COUNT; i++) {
+        const fi_stats_t *s = &c->stats[i];
+        if (s->hits == 0 && s->failures == 0 && s->lost_bytes == 0) continue;
+        unsigned avg = s->recoveries ? (unsigned)(s->recovery_ms_total / s->recoveries) : 0;
+        int n = snprintf(buf + off, buf_sz - off,
+                         "%-18s injected=%lu/%lu failures=%lu recovered=%lu avg=%ums max=%lums lost=%lluB\n",
+                         s_point_names[i], (unsigned long)s->hits, (unsigned long)s->calls,
+                         (unsigned long)s->failures, (unsigned long)s->recoveries, avg,
+                         (unsigned long)s->recovery_ms_max, (unsigned long long)s->lost_bytes);
+        if (n < 0 || (size_t)n >= buf_sz - off) {
+            buf[off] = '\0';
+            break;
+        }
+        off += (size_t)n;
+    }
+    return off;
+}
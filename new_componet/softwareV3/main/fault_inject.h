@@ -0,0 +1,151 @@
+/**
+ * @file fault_inject.h
+ * @brief Deterministic fault injection for SD, BLE and ADC error paths
+ *
+ * Each injection point has a rule (probability, trigger offset, period,
+ * burst length) evaluated with a seeded PRNG, so a scenario string plus a
+ * seed reproduces the same failure sequence run after run. Call sites also
+ * report when the path recovers, giving recovery time and data loss per
+ * point. Pure C - the same code runs on target (CONFIG_SALESTAG_FAULT_INJECT)
+ * and in the host emulator.
+ *
+ * Scenario syntax, rules separated by ';', options by ',':
+ *   "sd_write:p=0.01,burst=3;disconnect:at=65536;sd_latency:p=0.002,ms=250"
+ *   p=<probability>  at=<position>  every=<n>  burst=<n>  ms=<stall>  max=<triggers>
+ */
+
+#ifndef FAULT_INJECT_H
+#define FAULT_INJECT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    FI_SD_WRITE = 0,        // write() of recording data fails
+    FI_SD_READ,             // fread() in the transfer worker fails
+    FI_SD_LATENCY,          // SD access stalls for the rule's ms
+    FI_MBUF_ALLOC,          // ble_hs_mbuf_from_flat() returns NULL
+    FI_NOTIFY_ECONTROLLER,  // Notification rejected with BLE_HS_ECONTROLLER
+    FI_NOTIFY_EBUSY,        // Notification rejected with BLE_HS_EBUSY
+    FI_NOTIFY_TX_LOST,      // NOTIFY_TX completion never arrives (credit leak)
+    FI_DISCONNECT,          // Link drops at a transfer offset
+    FI_ADC_OVERFLOW,        // Sample lost between ADC and the storage queue
+    FI_SD_POWER_CYCLE,      // Power-cycle the card while idle
+    FI_SD_REMOUNT,          // Remount after a power cycle fails
+    FI_POINT_COUNT
+} fi_point_t;
+
+typedef struct {
+    uint32_t prob_ppm;      // Per-call probability, parts per million
+    uint32_t at;            // Trigger once when pos >= at (0 = off)
+    uint32_t every;         // Trigger on every Nth call (0 = off)
+    uint16_t burst;         // Consecutive failures per trigger (>= 1)
+    uint16_t latency_ms;    // Stall for FI_SD_LATENCY
+    uint32_t max_triggers;  // Stop after this many triggers (0 = unlimited)
+} fi_rule_t;
+
+typedef struct {
+    uint32_t calls;             // Times the point was evaluated
+    uint32_t hits;              // Failures injected
+    uint32_t triggers;          // Rule firings (a burst counts once)
+    uint32_t failures;          // Failures seen by the path, injected or real
+    uint32_t recoveries;        // Failure episodes that ended in success
+    uint32_t recovery_ms_total;
+    uint32_t recovery_ms_max;
+    uint64_t lost_bytes;        // Data the path gave up on
+} fi_stats_t;
+
+typedef uint32_t (*fi_clock_ms_fn_t)(void);
+
+typedef struct {
+    uint32_t rng;
+    fi_clock_ms_fn_t now_ms;
+    bool armed;                             // Any rule loaded
+    fi_rule_t rules[FI_POINT_COUNT];
+    fi_stats_t stats[FI_POINT_COUNT];
+    uint16_t burst_left[FI_POINT_COUNT];
+    bool at_fired[FI_POINT_COUNT];
+    bool failing[FI_POINT_COUNT];           // In a failure episode
+    uint32_t fail_since_ms[FI_POINT_COUNT];
+} fi_ctx_t;
+
+/**
+ * @brief Reset rules and statistics
+ * @param seed PRNG seed (0 is replaced by a fixed non-zero value)
+ * @param now_ms Millisecond clock used for recovery times
+ */
+void fi_init(fi_ctx_t *c, uint32_t seed, fi_clock_ms_fn_t now_ms);
+
+/**
+ * @brief Add the rules of a scenario string
+ * @return Number of rules loaded, or -1 on a syntax error (nothing loaded)
+ */
+int fi_load(fi_ctx_t *c, const char *spec);
+
+void fi_set_rule(fi_ctx_t *c, fi_point_t p, const fi_rule_t *rule);
+
+/**
+ * @brief Should this call of the point fail?
+ * @param pos Position for at= rules (byte offset, sample count, ...)
+ */
+bool fi_hit(fi_ctx_t *c, fi_point_t p, uint32_t pos);
+
+uint32_t fi_latency_ms(const fi_ctx_t *c, fi_point_t p);
+
+/**
+ * @brief The path failed (injected or real); starts a recovery episode
+ */
+void fi_failed(fi_ctx_t *c, fi_point_t p);
+
+/**
+ * @brief The path succeeded; closes an open recovery episode
+ */
+void fi_ok(fi_ctx_t *c, fi_point_t p);
+
+/**
+ * @brief The path dropped data it could not recover
+ */
+void fi_lost(fi_ctx_t *c, fi_point_t p, uint32_t bytes);
+
+const char *fi_point_name(fi_point_t p);
+
+/**
+ * @brief Add another context's statistics into dst (fleet totals)
+ */
+void fi_stats_accumulate(fi_ctx_t *dst, const fi_ctx_t *src);
+
+/**
+ * @brief Format one line per active point into buf
+ * @return Length written (excluding NUL)
+ */
+size_t fi_report(const fi_ctx_t *c, char *buf, size_t buf_sz);
+
+#if defined(CONFIG_SALESTAG_FAULT_INJECT)
+// Firmware-wide context, owned by main.c
+extern fi_ctx_t g_fault_inject;
+#define FI_HIT(p, pos)      fi_hit(&g_fault_inject, (p), (pos))
+#define FI_FAILED(p)        fi_failed(&g_fault_inject, (p))
+#define FI_OK(p)            fi_ok(&g_fault_inject, (p))
+#define FI_LOST(p, bytes)   fi_lost(&g_fault_inject, (p), (bytes))
+#define FI_LATENCY_MS(p)    fi_latency_ms(&g_fault_inject, (p))
+#else
+#define FI_HIT(p, pos)      (false)
+#define FI_FAILED(p)        do { } while (0)
+#define FI_OK(p)            do { } while (0)
+#define FI_LOST(p, bytes)   do { (void)(bytes); } while (0)
+#define FI_LATENCY_MS(p)    (0u)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FAULT_INJECT_H
@@ -0,0 +1,290 @@
+/**
+ * @file ft_fec.c
+ * @brief Cauchy Reed-Solomon erasure code for file transfer blocks (see ft_fec.h)
+ */
+
+#include "ft_fec.h"
+#include <string.h>
+
+#define GF_POLY 0x11D   // x^8 + x^4 + x^3 + x^2 + 1, generator 2
+
+static uint8_t s_exp[512];
+static uint8_t s_log[256];
+static uint8_t s_coef[FT_FEC_MAX_R][FT_FEC_MAX_K];
+static bool s_ready;
+
+static uint8_t gf_mul(uint8_t a, uint8_t b) {
+    if (!a || !b) return 0;
+    return s_exp[s_log[a] + s_log[b]];
+}
+
+static uint8_t gf_inv(uint8_t a) {
+    return s_exp[255 - s_log[a]];
+}
+
+void ft_fec_init(void) {
+    if (s_ready) return;
+    uint16_t x = 1;
+    for (int i = 0; i < 255; i++) {
+        s_exp[i] = (uint8_t)x;
+        s_log[x] = (uint8_t)i;
+        x <<= 1;
+        if (x & 0x100) x ^= GF_POLY;
+    }
+    for (int i = 255; i < 512; i++) s_exp[i] = s_exp[i - 255];
+    for (int j = 0; j < FT_FEC_MAX_R; j++) {
+        for (int i = 0; i < FT_FEC_MAX_K; i++) {
+            s_coef[j][i] = gf_inv((uint8_t)(j ^ (FT_FEC_MAX_R + i)));
+        }
+    }
+    s_ready = true;
+}
+
+uint8_t ft_fec_coef(uint8_t j, uint8_t i) {
+    return s_coef[j][i];
+}
+
+void ft_fec_mul_add(uint8_t *dst, const uint8_t *src, uint8_t c, size_t n) {
+    if (c == 0) return;
+    size_t i = 0;
+    if (c == 1) {
+        for (; i + 4 <= n; i += 4) {
+            uint32_t a, b;
+            memcpy(&a, dst + i, 4);
+            memcpy(&b, src + i, 4);
+            a ^= b;
+            memcpy(dst + i, &a, 4);
+        }
+        for (; i < n; i++) dst[i] ^= src[i];
+        return;
+    }
+
+    // Multiplication by c is linear, so two 16-entry tables (low and high
+    // nibble) cover every byte; cheaper to build per symbol than a 256-entry row
+    uint8_t pow2[8], lo[16], hi[16];
+    pow2[0] = c;
+    for (int b = 1; b < 8; b++) {
+        pow2[b] = (uint8_t)((pow2[b - 1] << 1) ^ ((pow2[b - 1] & 0x80) ? (GF_POLY & 0xFF) : 0));
+    }
+    lo[0] = hi[0] = 0;
+    for (int v = 1; v < 16; v++) {
+        int low = v & -v;
+        int bit = __builtin_ctz(low);
+        lo[v] = lo[v ^ low] ^ pow2[bit];
+        hi[v] = hi[v ^ low] ^ pow2[bit + 4];
+    }
+    for (; i < n; i++) dst[i] ^= lo[src[i] & 0x0F] ^ hi[src[i] >> 4];
+}
+
+static inline void put16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static inline uint16_t get16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+void ft_fec_hdr_encode(uint8_t *p, const ft_fec_hdr_t *h) {
+    put16(p, h->block);
+    p[2] = h->esi;
+    p[3] = h->k;
+    put16(p + 4, h->t);
+    put16(p + 6, h->bytes);
+}
+
+bool ft_fec_hdr_decode(const uint8_t *p, ft_fec_hdr_t *h) {
+    h->block = get16(p);
+    h->esi = p[2];
+    h->k = p[3];
+    h->t = get16(p + 4);
+    h->bytes = get16(p + 6);
+    if (h->t == 0 || h->bytes == 0 || h->k == 0 || h->k > FT_FEC_MAX_K) return false;
+    return (uint32_t)h->bytes <= (uint32_t)h->k * h->t && h->esi < ft_fec_block_k(h) + FT_FEC_MAX_R;
+}
+
+//==============================================================================
+// Encoder
+//==============================================================================
+
+static uint32_t block_start(const ft_fec_enc_t *enc) {
+    return (uint32_t)enc->block * enc->k * enc->t;
+}
+
+static uint16_t block_bytes(const ft_fec_enc_t *enc) {
+    uint32_t left = enc->size - block_start(enc);
+    uint32_t full = (uint32_t)enc->k * enc->t;
+    return (uint16_t)(left < full ? left : full);
+}
+
+static void next_block(ft_fec_enc_t *enc) {
+    enc->block++;
+    enc->absorbed = 0;
+    enc->repaired = 0;
+    memset(enc->parity, 0, (size_t)enc->r * enc->t);
+}
+
+void ft_fec_enc_init(ft_fec_enc_t *enc, uint32_t size, uint16_t t, uint8_t k, uint8_t r, uint8_t *parity) {
+    ft_fec_init();
+    *enc = (ft_fec_enc_t){ .size = size, .t = t, .k = k, .r = r, .parity = parity };
+    memset(parity, 0, (size_t)r * t);
+}
+
+bool ft_fec_enc_next(const ft_fec_enc_t *enc, ft_fec_hdr_t *hdr, uint32_t *offset, uint16_t *len) {
+    uint16_t bytes = block_bytes(enc);
+    uint8_t kb = (uint8_t)((bytes + enc->t - 1) / enc->t);
+    hdr->block = enc->block;
+    hdr->k = enc->k;
+    hdr->t = enc->t;
+    hdr->bytes = bytes;
+    if (enc->absorbed < kb) {
+        uint32_t done = (uint32_t)enc->absorbed * enc->t;
+        hdr->esi = enc->absorbed;
+        *offset = block_start(enc) + done;
+        *len = (uint16_t)(bytes - done < enc->t ? bytes - done : enc->t);
+        return false;
+    }
+    hdr->esi = (uint8_t)(kb + enc->repaired);
+    *len = enc->t;
+    return true;
+}
+
+void ft_fec_enc_absorb(ft_fec_enc_t *enc, const uint8_t *data, uint16_t len) {
+    for (uint8_t j = 0; j < enc->r; j++) {
+        ft_fec_mul_add(enc->parity + (size_t)j * enc->t, data, s_coef[j][enc->absorbed], len);
+    }
+    enc->absorbed++;
+    if (enc->r == 0 && (uint32_t)enc->absorbed * enc->t >= block_bytes(enc)) next_block(enc);
+}
+
+void ft_fec_enc_take_repair(ft_fec_enc_t *enc, uint8_t *out) {
+    memcpy(out, enc->parity + (size_t)enc->repaired * enc->t, enc->t);
+    if (++enc->repaired == enc->r) next_block(enc);
+}
+
+bool ft_fec_enc_done(const ft_fec_enc_t *enc) {
+    return block_start(enc) >= enc->size;
+}
+
+uint32_t ft_fec_enc_total(const ft_fec_enc_t *enc) {
+    uint32_t per_block = (uint32_t)enc->k * enc->t;
+    uint32_t blocks = (enc->size + per_block - 1) / per_block;
+    uint32_t sources = (enc->size + enc->t - 1) / enc->t;
+    return sources + blocks * enc->r;
+}
+
+//==============================================================================
+// Decoder
+//==============================================================================
+
+void ft_fec_dec_init(ft_fec_dec_t *dec, uint8_t *src, uint8_t *rep, uint16_t t_max) {
+    ft_fec_init();
+    *dec = (ft_fec_dec_t){ .src = src, .rep = rep, .t_max = t_max };
+}
+
+bool ft_fec_dec_begin(ft_fec_dec_t *dec, const ft_fec_hdr_t *hdr) {
+    dec->active = false;
+    if (hdr->t > dec->t_max) return false;
+    dec->hdr = *hdr;
+    dec->k = ft_fec_block_k(hdr);
+    dec->have = 0;
+    dec->nrep = 0;
+    dec->active = true;
+    return true;
+}
+
+bool ft_fec_dec_add(ft_fec_dec_t *dec, const ft_fec_hdr_t *hdr, const uint8_t *data, size_t len) {
+    if (!dec->active || hdr->block != dec->hdr.block || hdr->k != dec->hdr.k ||
+        hdr->t != dec->hdr.t || hdr->bytes != dec->hdr.bytes || len > hdr->t) {
+        return false;
+    }
+    uint16_t t = hdr->t;
+    if (hdr->esi < dec->k) {
+        if (!(dec->have & (1u << hdr->esi))) {
+            uint8_t *dst = dec->src + (size_t)hdr->esi * t;
+            memcpy(dst, data, len);
+            memset(dst + len, 0, t - len);
+            dec->have |= 1u << hdr->esi;
+        }
+    } else {
+        uint8_t j = (uint8_t)(hdr->esi - dec->k);
+        bool dup = false;
+        for (uint8_t a = 0; a < dec->nrep; a++) dup |= dec->rep_j[a] == j;
+        if (!dup && dec->nrep < FT_FEC_MAX_R && j < FT_FEC_MAX_R && len == t) {
+            memcpy(dec->rep + (size_t)dec->nrep * t, data, t);
+            dec->rep_j[dec->nrep++] = j;
+        }
+    }
+    return ft_fec_dec_missing(dec) <= dec->nrep;
+}
+
+uint8_t ft_fec_dec_missing(const ft_fec_dec_t *dec) {
+    uint32_t all = dec->k >= 32 ? 0xFFFFFFFFu : (1u << dec->k) - 1;
+    return (uint8_t)__builtin_popcount(all & ~dec->have);
+}
+
+// Gauss-Jordan inverse of an n x n matrix in place
+static bool gf_invert(uint8_t m[FT_FEC_MAX_R][FT_FEC_MAX_R], uint8_t inv[FT_FEC_MAX_R][FT_FEC_MAX_R], int n) {
+    for (int r = 0; r < n; r++) {
+        for (int c = 0; c < n; c++) inv[r][c] = r == c;
+    }
+    for (int c = 0; c < n; c++) {
+        int p = c;
+        while (p < n && m[p][c] == 0) p++;
+        if (p == n) return false;
+        if (p != c) {
+            for (int x = 0; x < n; x++) {
+                uint8_t t = m[p][x]; m[p][x] = m[c][x]; m[c][x] = t;
+                t = inv[p][x]; inv[p][x] = inv[c][x]; inv[c][x] = t;
+            }
+        }
+        uint8_t s = gf_inv(m[c][c]);
+        for (int x = 0; x < n; x++) {
+            m[c][x] = gf_mul(m[c][x], s);
+            inv[c][x] = gf_mul(inv[c][x], s);
+        }
+        for (int r = 0; r < n; r++) {
+            uint8_t f = m[r][c];
+            if (r == c || f == 0) continue;
+            for (int x = 0; x < n; x++) {
+                m[r][x] ^= gf_mul(f, m[c][x]);
+                inv[r][x] ^= gf_mul(f, inv[c][x]);
+            }
+        }
+    }
+    return true;
+}
+
+bool ft_fec_dec_solve(ft_fec_dec_t *dec) {
+    if (!dec->active) return false;
+    uint8_t lost[FT_FEC_MAX_R];
+    uint8_t e = 0;
+    for (uint8_t i = 0; i < dec->k; i++) {
+        if (dec->have & (1u << i)) continue;
+        if (e == dec->nrep || e == FT_FEC_MAX_R) return false;
+        lost[e++] = i;
+    }
+    if (e == 0) return true;
+    uint16_t t = dec->hdr.t;
+
+    // Strip the known sources from the first e repairs: what is left is M * lost
+    uint8_t m[FT_FEC_MAX_R][FT_FEC_MAX_R], inv[FT_FEC_MAX_R][FT_FEC_MAX_R];
+    for (uint8_t a = 0; a < e; a++) {
+        uint8_t *s = dec->rep + (size_t)a * t;
+        uint8_t j = dec->rep_j[a];
+        for (uint8_t i = 0; i < dec->k; i++) {
+            if (dec->have & (1u << i)) ft_fec_mul_add(s, dec->src + (size_t)i * t, s_coef[j][i], t);
+        }
+        for (uint8_t b = 0; b < e; b++) m[a][b] = s_coef[j][lost[b]];
+    }
+    if (!gf_invert(m, inv, e)) return false;
+
+    for (uint8_t b = 0; b < e; b++) {
+        uint8_t *dst = dec->src + (size_t)lost[b] * t;
+        memset(dst, 0, t);
+        for (uint8_t a = 0; a < e; a++) ft_fec_mul_add(dst, dec->rep + (size_t)a * t, inv[b][a], t);
+        dec->have |= 1u << lost[b];
+    }
+    dec->nrep = 0;  // Repairs were consumed
+    return true;
+}
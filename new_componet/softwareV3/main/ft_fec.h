@@ -0,0 +1,177 @@
+/**
+ * @file ft_fec.h
+ * @brief Forward error correction for file transfer notifications
+ *
+ * Optional transfer mode (FILE_TRANSFER_CMD_SET_FEC) for links where
+ * notifications are lost and a round trip per retransmission is too slow.
+ * The file is cut into blocks of k source symbols, one notification each;
+ * after a block's source symbols the tag sends r repair symbols. A
+ * receiver rebuilds the block from any k of its k + r symbols, with no
+ * feedback.
+ *
+ * The code is a systematic Reed-Solomon erasure code over GF(2^8) with a
+ * Cauchy parity matrix: repair j of a block is the sum over sources i of
+ * 1 / (j ^ (FT_FEC_MAX_R + i)) times source i. Every square submatrix of a
+ * Cauchy matrix is invertible, so any k symbols are enough. Coefficients
+ * do not depend on k or r, and the encoder absorbs each source symbol as
+ * it is read instead of keeping the block.
+ *
+ * FEC notifications set FT_PKT_FLAG_FEC in the data header's flag byte and
+ * carry an FT_FEC_HEADER_SIZE header before the symbol:
+ *
+ *   block u16 LE   block number
+ *   esi   u8       symbol in the block: < kb source, >= kb repair (kb + j)
+ *   k     u8       source symbols in a full block
+ *   t     u16 LE   symbol size; every symbol but a block's last source has t bytes
+ *   bytes u16 LE   source bytes in this block, kb = ceil(bytes / t)
+ *
+ * Source symbol esi of block b starts at file offset (b * k + esi) * t.
+ *
+ * Pure C, no ESP-IDF dependencies: host tools and receivers build the same file.
+ */
+
+#ifndef FT_FEC_H
+#define FT_FEC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FT_PKT_FLAG_EOF      0x01    // Last notification of the transfer
+#define FT_PKT_FLAG_FEC      0x02    // FT_FEC_HEADER_SIZE header follows the data header
+
+#define FT_FEC_HEADER_SIZE   8
+#define FT_FEC_MAX_K         32      // Source symbols per block
+#define FT_FEC_MAX_R         16      // Repair symbols per block
+
+typedef struct {
+    uint16_t block;
+    uint8_t esi;
+    uint8_t k;
+    uint16_t t;
+    uint16_t bytes;
+} ft_fec_hdr_t;
+
+void ft_fec_hdr_encode(uint8_t *p, const ft_fec_hdr_t *h);
+
+/**
+ * @brief Read an FEC header
+ * @return false if it is inconsistent (zero sizes, more than k sources, esi out of range)
+ */
+bool ft_fec_hdr_decode(const uint8_t *p, ft_fec_hdr_t *h);
+
+// Source symbols in this block (fewer than k only in the last one)
+static inline uint8_t ft_fec_block_k(const ft_fec_hdr_t *h) {
+    return (uint8_t)((h->bytes + h->t - 1) / h->t);
+}
+
+// File offset of the block's first byte
+static inline uint32_t ft_fec_block_offset(const ft_fec_hdr_t *h) {
+    return (uint32_t)h->block * h->k * h->t;
+}
+
+/**
+ * @brief Build the GF(2^8) tables (idempotent, called by the init functions)
+ */
+void ft_fec_init(void);
+
+/**
+ * @brief dst ^= c * src over n bytes, the only per-byte operation of the code
+ */
+void ft_fec_mul_add(uint8_t *dst, const uint8_t *src, uint8_t c, size_t n);
+
+// Coefficient of source i in repair j
+uint8_t ft_fec_coef(uint8_t j, uint8_t i);
+
+//==============================================================================
+// Encoder
+//==============================================================================
+
+typedef struct {
+    uint32_t size;          // File bytes
+    uint16_t t;             // Symbol size
+    uint8_t k;              // Source symbols per full block
+    uint8_t r;              // Repair symbols per block
+    uint8_t *parity;        // r * t bytes
+    uint16_t block;         // Current block
+    uint8_t absorbed;       // Source symbols of the current block taken so far
+    uint8_t repaired;       // Repair symbols of the current block handed out
+} ft_fec_enc_t;
+
+/**
+ * @param parity Caller buffer of at least r * t bytes
+ */
+void ft_fec_enc_init(ft_fec_enc_t *enc, uint32_t size, uint16_t t, uint8_t k, uint8_t r, uint8_t *parity);
+
+/**
+ * @brief Describe the next notification: the next source symbol or a pending repair
+ * @param offset File offset to read the source from (unchanged for repairs)
+ * @param len    Bytes to read (source) or send (repair)
+ * @return true for a repair symbol, false for a source symbol
+ */
+bool ft_fec_enc_next(const ft_fec_enc_t *enc, ft_fec_hdr_t *hdr, uint32_t *offset, uint16_t *len);
+
+// Add the source symbol ft_fec_enc_next() described
+void ft_fec_enc_absorb(ft_fec_enc_t *enc, const uint8_t *data, uint16_t len);
+
+// Copy out the repair symbol ft_fec_enc_next() described and move on
+void ft_fec_enc_take_repair(ft_fec_enc_t *enc, uint8_t *out);
+
+// Nothing left to send
+bool ft_fec_enc_done(const ft_fec_enc_t *enc);
+
+// Notifications a transfer of size bytes takes (progress and sizing)
+uint32_t ft_fec_enc_total(const ft_fec_enc_t *enc);
+
+//==============================================================================
+// Decoder (one block at a time)
+//==============================================================================
+
+typedef struct {
+    ft_fec_hdr_t hdr;           // Of the block being collected
+    bool active;
+    uint8_t k;
+    uint32_t have;              // Bit i: source i present
+    uint8_t nrep;
+    uint8_t rep_j[FT_FEC_MAX_R];
+    uint8_t *src;               // FT_FEC_MAX_K * t bytes
+    uint8_t *rep;               // FT_FEC_MAX_R * t bytes
+    uint16_t t_max;
+} ft_fec_dec_t;
+
+/**
+ * @param src, rep Caller buffers of FT_FEC_MAX_K and FT_FEC_MAX_R symbols of t_max bytes
+ */
+void ft_fec_dec_init(ft_fec_dec_t *dec, uint8_t *src, uint8_t *rep, uint16_t t_max);
+
+/**
+ * @brief Start collecting a block (drops whatever the previous one had)
+ */
+bool ft_fec_dec_begin(ft_fec_dec_t *dec, const ft_fec_hdr_t *hdr);
+
+/**
+ * @brief Add a symbol of the current block
+ * @return true once the block can be rebuilt
+ */
+bool ft_fec_dec_add(ft_fec_dec_t *dec, const ft_fec_hdr_t *hdr, const uint8_t *data, size_t len);
+
+// Source symbols still missing
+uint8_t ft_fec_dec_missing(const ft_fec_dec_t *dec);
+
+/**
+ * @brief Rebuild the missing source symbols
+ *
+ * On success the block's hdr.bytes bytes are contiguous at dec->src.
+ * @return false if fewer than k symbols arrived
+ */
+bool ft_fec_dec_solve(ft_fec_dec_t *dec);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FT_FEC_H
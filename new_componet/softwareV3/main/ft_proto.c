@@ -0,0 +1,235 @@
+/**
+ * @file ft_proto.c
+ * @brief SalesTag GATT file transfer protocol helpers (see ft_proto.h)
+ */
+
+#include "ft_proto.h"
+#include "ft_fec.h"
+#include "ft_pull.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+static bool has_ext(const char *name, size_t len, const char *ext) {
+    size_t n = strlen(ext);
+    return len >= n && strcasecmp(name + len - n, ext) == 0;
+}
+
+ft_parse_result_t ft_ctrl_parse(const uint8_t *buf, size_t len, ft_ctrl_req_t *out) {
+    memset(out, 0, sizeof(*out));
+    if (len < 1) return FT_PARSE_BAD_LEN;
+    out->cmd = buf[0];
+
+    switch (out->cmd) {
+    case FILE_TRANSFER_CMD_START:
+    case FILE_TRANSFER_CMD_LIST_FILES:
+    case FILE_TRANSFER_CMD_PAUSE:
+    case FILE_TRANSFER_CMD_RESUME:
+    case FILE_TRANSFER_CMD_STOP:
+        // No additional data allowed
+        return len == 1 ? FT_PARSE_OK : FT_PARSE_BAD_LEN;
+
+    case FILE_TRANSFER_CMD_SELECT_FILE:
+        if (len != 2) return FT_PARSE_BAD_LEN;
+        out->index = buf[1];
+        return FT_PARSE_OK;
+
+    case FILE_TRANSFER_CMD_PROFILE:
+        if (len != 2) return FT_PARSE_BAD_LEN;
+        out->seconds = buf[1];
+        return out->seconds > 0 ? FT_PARSE_OK : FT_PARSE_BAD_CMD;
+
+    case FILE_TRANSFER_CMD_START_BY_ID:
+        if (len != 5 && len != 6) return FT_PARSE_BAD_LEN;
+        out->rec_id = (uint32_t)buf[1] | ((uint32_t)buf[2] << 8) |
+                      ((uint32_t)buf[3] << 16) | ((uint32_t)buf[4] << 24);
+        out->variant = len == 6 ? buf[5] : FT_VARIANT_RAW;
+        return out->rec_id != 0 && out->variant <= FT_VARIANT_MAX ? FT_PARSE_OK : FT_PARSE_BAD_CMD;
+
+    case FILE_TRANSFER_CMD_SYNC_ACK:
+        if (len != 9) return FT_PARSE_BAD_LEN;
+        out->rec_id = (uint32_t)buf[1] | ((uint32_t)buf[2] << 8) |
+                      ((uint32_t)buf[3] << 16) | ((uint32_t)buf[4] << 24);
+        out->crc32c = (uint32_t)buf[5] | ((uint32_t)buf[6] << 8) |
+                      ((uint32_t)buf[7] << 16) | ((uint32_t)buf[8] << 24);
+        return out->rec_id != 0 ? FT_PARSE_OK : FT_PARSE_BAD_CMD;
+
+    case FILE_TRANSFER_CMD_PULL:
+        if (len != 7) return FT_PARSE_BAD_LEN;
+        out->rec_id = (uint32_t)buf[1] | ((uint32_t)buf[2] << 8) |
+                      ((uint32_t)buf[3] << 16) | ((uint32_t)buf[4] << 24);
+        out->variant = buf[5];
+        out->pull_block = buf[6];
+        if (out->rec_id == 0 || out->variant > FT_VARIANT_MAX ||
+            out->pull_block > FT_PKT_MAX - FILE_TRANSFER_HEADER_SIZE - FT_PULL_HEADER_SIZE) {
+            return FT_PARSE_BAD_CMD;
+        }
+        return FT_PARSE_OK;
+
+    case FILE_TRANSFER_CMD_READ_BLOCKS:
+        if (len != 6) return FT_PARSE_BAD_LEN;
+        out->block = (uint32_t)buf[1] | ((uint32_t)buf[2] << 8) |
+                     ((uint32_t)buf[3] << 16) | ((uint32_t)buf[4] << 24);
+        out->count = buf[5];
+        return out->count >= 1 && out->count <= FT_PULL_MAX_COUNT ? FT_PARSE_OK : FT_PARSE_BAD_CMD;
+
+    case FILE_TRANSFER_CMD_FORMAT:
+        if (len != 5) return FT_PARSE_BAD_LEN;
+        // Erasing the card takes the confirmation bytes, not just the opcode
+        if (memcmp(buf + 1, "FMT", 3) != 0) return FT_PARSE_BAD_CMD;
+        out->cluster_kb = buf[4];
+        if (out->cluster_kb != 0 && (out->cluster_kb < 4 || out->cluster_kb > 64 ||
+                                     (out->cluster_kb & (out->cluster_kb - 1)))) {
+            return FT_PARSE_BAD_CMD;
+        }
+        return FT_PARSE_OK;
+
+    case FILE_TRANSFER_CMD_SET_FEC:
+        if (len != 3) return FT_PARSE_BAD_LEN;
+        out->fec_k = buf[1];
+        out->fec_r = buf[2];
+        if (out->fec_k < 1 || out->fec_k > FT_FEC_MAX_K || out->fec_r > FT_FEC_MAX_R) {
+            return FT_PARSE_BAD_CMD;
+        }
+        return FT_PARSE_OK;
+
+    case FILE_TRANSFER_CMD_START_WITH_FILENAME: {
+        size_t name_len = len - 1;
+        if (name_len < 1 || name_len > FT_MAX_FILENAME) return FT_PARSE_BAD_LEN;
+        memcpy(out->filename, buf + 1, name_len);
+        out->filename[name_len] = '\0';
+        // An embedded NUL would hide the rest of the name from validation
+        if (strlen(out->filename) != name_len || !ft_valid_filename(out->filename)) {
+            return FT_PARSE_BAD_NAME;
+        }
+        return FT_PARSE_OK;
+    }
+
+    default:
+        return FT_PARSE_BAD_CMD;
+    }
+}
+
+// Filename validation function for basic security
+bool ft_valid_filename(const char *filename) {
+    if (!filename || filename[0] == '\0') {
+        return false;
+    }
+
+    size_t len = strlen(filename);
+
+    // Check length constraints
+    if (len > FT_MAX_FILENAME) {
+        return false;
+    }
+
+    // Allow only alphanumeric characters, dots, underscores, and hyphens
+    // This is a basic security measure to prevent path traversal attacks
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)filename[i];
+        if (!isalnum(c) && c != '.' && c != '_' && c != '-') {
+            return false;
+        }
+    }
+
+    // Check for obvious path traversal attempts
+    if (strstr(filename, "..") != NULL) {
+        return false;
+    }
+
+    return true;
+}
+
+bool ft_resolve_path(const char *rec_dir, const char *filename, char *out, size_t out_sz) {
+    size_t len = strlen(filename);
+    int n;
+    if (has_ext(filename, len, ".raw") || has_ext(filename, len, ".spc") || has_ext(filename, len, ".prf")) {
+        // Filename already includes .raw/.spc/.prf extension
+        n = snprintf(out, out_sz, "%s/%s", rec_dir, filename);
+    } else {
+        // Add .raw extension
+        n = snprintf(out, out_sz, "%s/%s.raw", rec_dir, filename);
+    }
+    return n > 0 && (size_t)n < out_sz;
+}
+
+size_t ft_payload_budget(uint16_t mtu) {
+    int budget = (int)(mtu ? mtu : 23) - 3 - FILE_TRANSFER_HEADER_SIZE;
+    if (budget < 1) budget = 1;
+    if (budget > (FT_PKT_MAX - FILE_TRANSFER_HEADER_SIZE)) {
+        budget = FT_PKT_MAX - FILE_TRANSFER_HEADER_SIZE;
+    }
+    return (size_t)budget;
+}
+
+void ft_pkt_header_encode(uint8_t *pkt, uint16_t seq, uint16_t len, bool eof) {
+    // header little endian
+    pkt[0] = (uint8_t)(seq & 0xFF);
+    pkt[1] = (uint8_t)((seq >> 8) & 0xFF);
+    pkt[2] = (uint8_t)(len & 0xFF);
+    pkt[3] = (uint8_t)((len >> 8) & 0xFF);
+    pkt[4] = eof ? FT_PKT_FLAG_EOF : 0x00;
+}
+
+void ft_pkt_header_set_fec(uint8_t *pkt) {
+    pkt[4] |= FT_PKT_FLAG_FEC;
+}
+
+void ft_pkt_header_set_pull(uint8_t *pkt) {
+    pkt[4] |= FT_PKT_FLAG_PULL;
+}
+
+bool ft_pkt_header_decode(const uint8_t *pkt, size_t pkt_len, ft_pkt_header_t *out) {
+    if (pkt_len < FILE_TRANSFER_HEADER_SIZE) return false;
+    out->seq = (uint16_t)(pkt[0] | (pkt[1] << 8));
+    out->len = (uint16_t)(pkt[2] | (pkt[3] << 8));
+    out->eof = (pkt[4] & FT_PKT_FLAG_EOF) != 0;
+    out->fec = (pkt[4] & FT_PKT_FLAG_FEC) != 0;
+    out->pull = (pkt[4] & FT_PKT_FLAG_PULL) != 0;
+    return (size_t)out->len + FILE_TRANSFER_HEADER_SIZE <= pkt_len;
+}
+
+uint32_t ft_mbuf_backoff_ms(int tries) {
+    // Exponential backoff: 10ms, 20ms, 40ms, 80ms, then capped at 100ms
+    if (tries < 1) tries = 1;
+    if (tries > 5) return 100;
+    uint32_t delay_ms = 10u << (tries - 1);
+    return delay_ms > 100 ? 100 : delay_ms;
+}
+
+const char *ft_status_name(uint8_t code) {
+    switch (code) {
+    case STAT_STARTED:               return "STARTED";
+    case STAT_COMPLETE:              return "COMPLETE";
+    case STAT_STOPPED_BY_HOST:       return "STOPPED_BY_HOST";
+    case STAT_FILE_OPEN_FAIL:        return "FILE_OPEN_FAIL";
+    case STAT_NOTIFY_FAIL:           return "NOTIFY_FAIL";
+    case STAT_FILE_READ_FAIL:        return "FILE_READ_FAIL";
+    case STAT_BAD_CMD:               return "BAD_CMD";
+    case STAT_ALREADY_RUNNING:       return "ALREADY_RUNNING";
+    case STAT_BUSY:                  return "BUSY";
+    case STAT_NO_CONN:               return "NO_CONN";
+    case STAT_PAUSED:                return "PAUSED";
+    case STAT_SUBSCRIPTION_REQUIRED: return "SUBSCRIPTION_REQUIRED";
+    case STAT_NO_FILE:               return "NO_FILE";
+    case STAT_LIST_READY:            return "LIST_READY";
+    case STAT_FILE_SELECTED:         return "FILE_SELECTED";
+    case STAT_INVALID_INDEX:         return "INVALID_INDEX";
+    case STAT_PROFILE_STARTED:       return "PROFILE_STARTED";
+    case STAT_PROFILE_READY:         return "PROFILE_READY";
+    case STAT_PROFILE_FAIL:          return "PROFILE_FAIL";
+    case STAT_FORMAT_STARTED:        return "FORMAT_STARTED";
+    case STAT_FORMAT_DONE:           return "FORMAT_DONE";
+    case STAT_FORMAT_FAIL:           return "FORMAT_FAIL";
+    case STAT_FEC_SET:               return "FEC_SET";
+    case STAT_FEC_UNAVAILABLE:       return "FEC_UNAVAILABLE";
+    case STAT_SYNC_ACKED:            return "SYNC_ACKED";
+    case STAT_SYNC_MISMATCH:         return "SYNC_MISMATCH";
+    case STAT_TRANSCODING:           return "TRANSCODING";
+    case STAT_VARIANT_FAIL:          return "VARIANT_FAIL";
+    case STAT_PULL_READY:            return "PULL_READY";
+    case STAT_PULL_OVERRUN:          return "PULL_OVERRUN";
+    default:                         return "UNKNOWN";
+    }
+}
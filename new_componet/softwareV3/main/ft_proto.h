@@ -0,0 +1,304 @@
+/**
+ * @file ft_proto.h
+ * @brief SalesTag GATT file transfer protocol definitions
+ *
+ * UUIDs, command/status codes and the pure encode/decode helpers shared by
+ * the firmware (main.c) and host tools such as the device emulator. Pure C -
+ * no NimBLE, FreeRTOS or ESP-IDF dependencies.
+ */
+
+#ifndef FT_PROTO_H
+#define FT_PROTO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Custom UUID definitions for SalesTag Audio Service
+#define BLE_UUID_SALESTAG_AUDIO_SVC    0x1234
+#define BLE_UUID_SALESTAG_RECORD_CTRL  0x1235
+#define BLE_UUID_SALESTAG_STATUS       0x1236
+#define BLE_UUID_SALESTAG_FILE_COUNT   0x1237
+
+// Custom UUID definitions for SalesTag File Transfer Service
+#define BLE_UUID_SALESTAG_FILE_SVC         0x1240
+#define BLE_UUID_SALESTAG_FILE_CTRL        0x1241  // Write: Commands (START, START_WITH_FILENAME, PAUSE, RESUME, STOP, LIST_FILES, SELECT_FILE)
+#define BLE_UUID_SALESTAG_FILE_DATA        0x1242  // Notify: File data chunks
+#define BLE_UUID_SALESTAG_FILE_STATUS      0x1243  // Notify: Transfer status
+#define BLE_UUID_SALESTAG_FILE_LIST        0x1244  // Read: List available .raw filenames (legacy)
+#define BLE_UUID_SALESTAG_AUTO_SELECT_LIST 0x1245  // Read: Auto-selection file list (returns latest file)
+
+// File transfer command definitions (updated for auto-selection)
+//
+// MOBILE APP USAGE:
+//
+// 1. FILE_TRANSFER_CMD_START (0x01) - Start transfer with auto-selected latest file
+//    Data: [0x01]
+//    Use: When you want the ESP32 to automatically choose the latest .raw file
+//
+// 2. FILE_TRANSFER_CMD_START_WITH_FILENAME (0x07) - Start transfer with specific filename
+//    Data: [0x07][filename_string]
+//    Use: When you want to download a specific file
+//    Example: [0x07]['r','0','0','1','.','r','a','w'] for "r001.raw"
+//    Notes:
+//    - Filename should not include path (just the base filename)
+//    - .raw extension is optional (will be added if missing)
+//    - Use the .spc extension to fetch the low-bitrate speech copy of a recording
+//      (created in the background when CONFIG_SALESTAG_SPEECH_TRANSCODE is enabled)
+//    - Only alphanumeric, dots, underscores, and hyphens allowed
+//    - Maximum 255 characters
+//    - Path traversal characters (.., /, \) are blocked for security
+//
+// 3. FILE_TRANSFER_CMD_LIST_FILES (0x05) - Get list of available files for auto-selection
+//    Data: [0x05]
+//    Use: Request list of available .raw files (returns latest file first)
+//    Response: Auto-selection list via UUID 0x1245 characteristic
+//
+// 4. FILE_TRANSFER_CMD_SELECT_FILE (0x04) - Select specific file from auto-selection list
+//    Data: [0x04][index_byte]
+//    Use: Select file by index from the auto-selection list
+//    Example: [0x04][0x00] to select the first (latest) file
+//
+// 5. FILE_TRANSFER_CMD_PROFILE (0x08) - Profile CPU usage for a window (CONFIG_SALESTAG_PROFILER)
+//    Data: [0x08][seconds]
+//    Use: Sample both cores for 1-255 seconds; STAT_PROFILE_STARTED, then
+//    STAT_PROFILE_READY once "profile.prf" can be fetched with START_WITH_FILENAME
+//    (symbolize it with host/profiler/prof_fold.py)
+//
+// 6. FILE_TRANSFER_CMD_START_BY_ID (0x09) - Start transfer of a recording by its ID
+//    Data: [0x09][id u32 LE] or [0x09][id u32 LE][variant]
+//    Use: Recordings are named r<7-digit ID>.raw (main/rec_id.h); IDs only grow,
+//    survive reboots and are never reused, so an app can remember what it fetched
+//    Example: [0x09][0x2A][0x00][0x00][0x00] for "r0000042.raw"
+//    variant (FT_VARIANT_*) asks for a smaller encoding of the same recording:
+//    the background .spc companion if it has that codec, otherwise the worker
+//    transcodes the recording first (STAT_TRANSCODING, then STAT_STARTED).
+//    The .raw file stays on the card either way, so a later sync can fetch it
+//    in full; SYNC_ACK still refers to the .raw file
+//    Response: STAT_NO_FILE if no recording has that ID, STAT_VARIANT_FAIL if
+//    the variant could not be produced
+//
+// 7. FILE_TRANSFER_CMD_FORMAT (0x0A) - Reformat the card for recording (erases everything)
+//    Data: [0x0A]['F']['M']['T'][cluster_kb]
+//    Use: FAT32 with cluster_kb clusters (4-64, 0 = 32) and the data area aligned to
+//    the card's erase block (main/fat_plan.h); the "FMT" bytes are the confirmation
+//    Response: STAT_FORMAT_STARTED, then STAT_FORMAT_DONE or STAT_FORMAT_FAIL;
+//    STAT_BUSY while recording, transferring or uploading
+//
+// 8. FILE_TRANSFER_CMD_SET_FEC (0x0B) - Forward error correction for the next transfers
+//    Data: [0x0B][k][r]
+//    Use: Blocks of k source notifications (1-32) each followed by r repair
+//    notifications (0-16, 0 = off) until the connection drops (main/ft_fec.h);
+//    a receiver rebuilds a block from any k of its k + r notifications
+//    Response: STAT_FEC_SET; STAT_FEC_UNAVAILABLE if the build has no FEC
+//    (CONFIG_SALESTAG_FEC), STAT_BUSY during a transfer
+//
+// 9. FILE_TRANSFER_CMD_SYNC_ACK (0x0C) - A dock has stored recording <id>
+//    Data: [0x0C][id u32 LE][crc32c u32 LE]
+//    Use: crc32c is crc32c_calculate() of the whole file as the dock read it back
+//    from its own storage; the tag checks it against the card and then counts the
+//    recording as synced (main/sync_state.h), in the advertisement and for the
+//    Wi-Fi offload. The check runs on the transfer worker, so a dock can send it
+//    together with the next START_BY_ID
+//    Response: STAT_SYNC_ACKED; STAT_SYNC_MISMATCH if the CRC differs (fetch again),
+//    STAT_NO_FILE, STAT_BUSY while recording or during a Wi-Fi upload
+//
+// 10. FILE_TRANSFER_CMD_PULL (0x0D) - Open recording <id> for receiver-driven reads
+//    Data: [0x0D][id u32 LE][variant][block]
+//    Use: Like START_BY_ID, but nothing is sent until asked for (main/ft_pull.h).
+//    block is the payload per notification, 0 for the largest the MTU allows.
+//    The session ends with STOP, the connection or FT_PULL_IDLE_MS without a request
+//    Response: STAT_PULL_READY, then the size notification; the START_BY_ID
+//    errors, STAT_BAD_CMD if block does not fit the MTU
+//
+// 11. FILE_TRANSFER_CMD_READ_BLOCKS (0x0E) - Send blocks of the open pull session
+//    Data: [0x0E][block u32 LE][count]
+//    Use: count (1-64) notifications from block number <block> on, in any
+//    order and as often as needed; up to FT_PULL_QUEUE requests wait on the tag
+//    Response: the notifications; STAT_PULL_OVERRUN if the queue was full (the
+//    request is dropped), STAT_BAD_CMD outside a pull session
+//
+// WORKFLOW RECOMMENDATION:
+// 1. Send LIST_FILES command (0x05) to get available files
+// 2. Send SELECT_FILE command (0x04) with index to choose file
+// 3. Or send START command (0x01) for immediate auto-selection of latest file
+// 4. Or send START_WITH_FILENAME command (0x07) with known filename
+// 5. Or send START_BY_ID command (0x09) for the next ID after the last one fetched
+// 6. Docks fetch the IDs the advertisement lists as un-synced (main/adv_state.h)
+//    and confirm each with SYNC_ACK (0x0C)
+// 7. With less link time than the backlog needs, ask START_BY_ID for speech
+//    variants (host/client st_plan()) and leave those recordings un-acked, so
+//    the full .raw file is fetched on a later, longer sync
+// 8. Receivers that know their own buffering use PULL (0x0D) and READ_BLOCKS
+//    (0x0E) instead of START_BY_ID and set the pace themselves
+//
+#define FILE_TRANSFER_CMD_START                   0x01
+#define FILE_TRANSFER_CMD_PAUSE                   0x02
+#define FILE_TRANSFER_CMD_RESUME                  0x03
+#define FILE_TRANSFER_CMD_SELECT_FILE             0x04  // Select file by index from auto-selection list
+#define FILE_TRANSFER_CMD_LIST_FILES              0x05  // Get auto-selection file list
+#define FILE_TRANSFER_CMD_STOP                    0x06  // Moved to avoid conflict
+#define FILE_TRANSFER_CMD_START_WITH_FILENAME     0x07  // Moved to avoid conflict
+#define FILE_TRANSFER_CMD_PROFILE                 0x08  // Run a CPU profiling window
+#define FILE_TRANSFER_CMD_START_BY_ID             0x09  // Start transfer of recording <id>
+#define FILE_TRANSFER_CMD_FORMAT                  0x0A  // Reformat the card (confirmed)
+#define FILE_TRANSFER_CMD_SET_FEC                 0x0B  // Repair notifications per block
+#define FILE_TRANSFER_CMD_SYNC_ACK                0x0C  // Dock verified and stored recording <id>
+#define FILE_TRANSFER_CMD_PULL                    0x0D  // Open recording <id> for READ_BLOCKS
+#define FILE_TRANSFER_CMD_READ_BLOCKS             0x0E  // Send <count> blocks from <block>
+
+
+// File transfer status codes (updated to 1-byte values)
+#define STAT_STARTED                   0x01
+#define STAT_COMPLETE                  0x02
+#define STAT_STOPPED_BY_HOST           0x03
+#define STAT_FILE_OPEN_FAIL            0x10
+#define STAT_NOTIFY_FAIL               0x11
+#define STAT_BAD_CMD                   0x20
+#define STAT_ALREADY_RUNNING           0x21
+#define STAT_PAUSED                    0x30
+#define STAT_SUBSCRIPTION_REQUIRED     0x40
+#define STAT_NO_FILE                   0x50
+#define STAT_BUSY                      0x22
+#define STAT_NO_CONN                   0x23
+#define STAT_FILE_READ_FAIL            0x13
+#define STAT_LIST_READY                0x60  // Auto-selection file list ready
+#define STAT_FILE_SELECTED             0x61  // File selected from auto-selection list
+#define STAT_INVALID_INDEX             0x62  // Invalid file index in SELECT_FILE command
+#define STAT_PROFILE_STARTED           0x70  // Profiling window open
+#define STAT_PROFILE_READY             0x71  // Profile report saved as profile.prf
+#define STAT_PROFILE_FAIL              0x72  // Profiler busy, disabled or report not written
+#define STAT_FORMAT_STARTED            0x80  // Card is being reformatted
+#define STAT_FORMAT_DONE               0x81  // Card reformatted and remounted
+#define STAT_FORMAT_FAIL               0x82  // Format or remount failed
+#define STAT_FEC_SET                   0x90  // FEC setting accepted for the next transfers
+#define STAT_FEC_UNAVAILABLE           0x91  // Build without FEC transfer mode
+#define STAT_SYNC_ACKED                0xA0  // Recording counted as synced
+#define STAT_SYNC_MISMATCH             0xA1  // Dock's CRC differs from the card's; not synced
+#define STAT_TRANSCODING               0xB0  // START_BY_ID variant is being encoded; STARTED follows
+#define STAT_VARIANT_FAIL              0xB1  // START_BY_ID variant could not be produced
+#define STAT_PULL_READY                0xC0  // Pull session open; READ_BLOCKS accepted
+#define STAT_PULL_OVERRUN              0xC1  // READ_BLOCKS dropped, FT_PULL_QUEUE already waiting
+
+// START_BY_ID variants: the recording as stored, or a speech_codec_mode_t
+#define FT_VARIANT_RAW                 0
+#define FT_VARIANT_MAX                 3     // SPEECH_CODEC_NB2
+
+// File transfer packet header size (5 bytes)
+#define FILE_TRANSFER_HEADER_SIZE 5
+
+// Largest data notification we build (header + payload)
+#define FT_PKT_MAX 200
+
+// Bounded retries for mbuf allocation and controller backpressure per chunk
+#define FT_MAX_RETRIES 8
+
+// Credit wait per attempt, and consecutive timeouts after which outstanding
+// credits are presumed lost (missed NOTIFY_TX) and reclaimed
+#define FT_CREDIT_WAIT_MS          200
+#define FT_CREDIT_RECLAIM_TIMEOUTS 5
+
+// Longest filename accepted by START_WITH_FILENAME
+#define FT_MAX_FILENAME 255
+
+// Result of parsing a FILE_CTRL write
+typedef enum {
+    FT_PARSE_OK = 0,
+    FT_PARSE_BAD_LEN,       // Known command, wrong payload length (ATT error)
+    FT_PARSE_BAD_CMD,       // Unknown command byte (reported via STAT_BAD_CMD)
+    FT_PARSE_BAD_NAME,      // START_WITH_FILENAME with a rejected filename (STAT_BAD_CMD)
+} ft_parse_result_t;
+
+typedef struct {
+    uint8_t cmd;                            // FILE_TRANSFER_CMD_*
+    uint8_t index;                          // SELECT_FILE index
+    uint8_t seconds;                        // PROFILE window
+    uint32_t rec_id;                        // START_BY_ID, SYNC_ACK recording ID
+    uint8_t variant;                        // START_BY_ID encoding (FT_VARIANT_RAW if omitted)
+    uint32_t crc32c;                        // SYNC_ACK CRC of the dock's copy
+    uint8_t cluster_kb;                     // FORMAT cluster size (0 = default)
+    uint8_t fec_k;                          // SET_FEC source notifications per block
+    uint8_t fec_r;                          // SET_FEC repair notifications per block (0 = off)
+    uint8_t pull_block;                     // PULL payload per notification (0 = largest)
+    uint32_t block;                         // READ_BLOCKS first block
+    uint8_t count;                          // READ_BLOCKS blocks
+    char filename[FT_MAX_FILENAME + 1];     // START_WITH_FILENAME name (NUL terminated)
+} ft_ctrl_req_t;
+
+// Data notification header: seq (u16 LE), payload length (u16 LE), flags
+// (bit 0 eof, bit 1 FEC header follows, see ft_fec.h; bit 2 pull header
+// follows, see ft_pull.h)
+typedef struct {
+    uint16_t seq;
+    uint16_t len;
+    bool eof;
+    bool fec;
+    bool pull;
+} ft_pkt_header_t;
+
+/**
+ * @brief Parse a FILE_CTRL characteristic write
+ * @param buf Written bytes (command byte first)
+ * @param len Number of bytes written
+ * @param out Parsed request; cmd is valid for every result except FT_PARSE_BAD_LEN on len 0
+ */
+ft_parse_result_t ft_ctrl_parse(const uint8_t *buf, size_t len, ft_ctrl_req_t *out);
+
+/**
+ * @brief Filename check for START_WITH_FILENAME (no paths, [A-Za-z0-9._-] only)
+ */
+bool ft_valid_filename(const char *filename);
+
+/**
+ * @brief Build the on-card path for a requested filename
+ *
+ * Names ending in .raw, .spc or .prf are used as-is, anything else gets .raw appended.
+ * @return true if the path fit in out
+ */
+bool ft_resolve_path(const char *rec_dir, const char *filename, char *out, size_t out_sz);
+
+/**
+ * @brief Payload bytes per data notification for an ATT MTU
+ */
+size_t ft_payload_budget(uint16_t mtu);
+
+/**
+ * @brief Write the 5-byte data notification header
+ */
+void ft_pkt_header_encode(uint8_t *pkt, uint16_t seq, uint16_t len, bool eof);
+
+/**
+ * @brief Mark an encoded data header as carrying an FEC symbol (ft_fec.h)
+ */
+void ft_pkt_header_set_fec(uint8_t *pkt);
+
+/**
+ * @brief Mark an encoded data header as answering READ_BLOCKS (ft_pull.h)
+ */
+void ft_pkt_header_set_pull(uint8_t *pkt);
+
+/**
+ * @brief Read a data notification header
+ * @return false if the notification is shorter than its header claims
+ */
+bool ft_pkt_header_decode(const uint8_t *pkt, size_t pkt_len, ft_pkt_header_t *out);
+
+/**
+ * @brief Backoff before retry number tries (1-based) after an mbuf allocation failure
+ */
+uint32_t ft_mbuf_backoff_ms(int tries);
+
+/**
+ * @brief Human-readable name of a STAT_* code (for logs and host tools)
+ */
+const char *ft_status_name(uint8_t code);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FT_PROTO_H
@@ -0,0 +1,141 @@
+/**
+ * @file ft_pull.c
+ * @brief Pull session request queue and read-ahead cache (see ft_pull.h)
+ */
+
+#include "ft_pull.h"
+#include "ft_proto.h"
+#include <string.h>
+
+#define FT_PULL_PKT_HEADER (FILE_TRANSFER_HEADER_SIZE + FT_PULL_HEADER_SIZE)
+
+void ft_pull_hdr_encode(uint8_t *p, uint32_t offset) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(offset >> (8 * i));
+}
+
+uint32_t ft_pull_hdr_decode(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+uint16_t ft_pull_block_max(uint16_t mtu) {
+    return (uint16_t)(ft_payload_budget(mtu) - FT_PULL_HEADER_SIZE);
+}
+
+void ft_pull_open(ft_pull_t *p, uint32_t size, uint16_t block, uint8_t *cache, ft_pull_read_fn read, void *ctx) {
+    memset(p, 0, sizeof(*p));
+    p->size = size;
+    p->block = block;
+    p->cache = cache;
+    p->read = read;
+    p->ctx = ctx;
+    p->announce = true;
+}
+
+bool ft_pull_request(ft_pull_t *p, uint32_t block, uint8_t count) {
+    if (count == 0) return true;
+    if (p->queued == FT_PULL_QUEUE) {
+        p->stats.overruns++;
+        return false;
+    }
+    ft_pull_req_t *r = &p->queue[(p->head + p->queued) % FT_PULL_QUEUE];
+    r->block = block;
+    r->count = count;
+    p->queued++;
+    p->stats.requests++;
+    return true;
+}
+
+static void pop(ft_pull_t *p) {
+    p->head = (uint8_t)((p->head + 1) % FT_PULL_QUEUE);
+    p->queued--;
+}
+
+// Line holding offset, read from the file on a miss; NULL if the read failed
+static const ft_pull_line_t *line_for(ft_pull_t *p, uint32_t offset, bool *miss) {
+    uint32_t base = offset - offset % FT_PULL_LINE_BYTES;
+    int victim = 0;
+    for (int i = 0; i < FT_PULL_LINES; i++) {
+        ft_pull_line_t *l = &p->lines[i];
+        if (l->len && l->base == base) {
+            l->used = ++p->clock;
+            return l;
+        }
+        if (!p->lines[victim].len) continue;
+        if (!l->len || l->used < p->lines[victim].used) victim = i;
+    }
+    ft_pull_line_t *l = &p->lines[victim];
+    uint32_t want = p->size - base < FT_PULL_LINE_BYTES ? p->size - base : FT_PULL_LINE_BYTES;
+    l->len = 0;
+    int n = p->read(p->ctx, base, p->cache + victim * FT_PULL_LINE_BYTES, want);
+    if (n != (int)want) return NULL;
+    l->base = base;
+    l->len = want;
+    l->used = ++p->clock;
+    *miss = true;
+    return l;
+}
+
+// Copy [offset, offset + len) through the cache; a block may straddle two lines
+static bool cache_read(ft_pull_t *p, uint32_t offset, uint8_t *out, size_t len) {
+    bool miss = false;
+    while (len > 0) {
+        const ft_pull_line_t *l = line_for(p, offset, &miss);
+        if (!l) return false;
+        uint32_t at = offset - l->base;
+        size_t n = l->len - at < len ? l->len - at : len;
+        memcpy(out, p->cache + (l - p->lines) * FT_PULL_LINE_BYTES + at, n);
+        out += n;
+        offset += (uint32_t)n;
+        len -= n;
+    }
+    if (miss) {
+        p->stats.misses++;
+    } else {
+        p->stats.hits++;
+    }
+    return true;
+}
+
+static int size_notification(const ft_pull_t *p, uint8_t *pkt, uint16_t seq) {
+    ft_pkt_header_encode(pkt, seq, FT_PULL_HEADER_SIZE, true);
+    ft_pkt_header_set_pull(pkt);
+    ft_pull_hdr_encode(pkt + FILE_TRANSFER_HEADER_SIZE, p->size);
+    return FT_PULL_PKT_HEADER;
+}
+
+uint32_t ft_pull_next_offset(const ft_pull_t *p) {
+    if (p->announce || p->queued == 0) return p->size;
+    uint64_t off = (uint64_t)p->queue[p->head].block * p->block;
+    return off < p->size ? (uint32_t)off : p->size;
+}
+
+int ft_pull_next(ft_pull_t *p, uint8_t *pkt, uint16_t seq) {
+    if (p->announce) {
+        p->announce = false;
+        return size_notification(p, pkt, seq);
+    }
+    if (p->queued == 0) return 0;
+
+    ft_pull_req_t *r = &p->queue[p->head];
+    uint64_t off = (uint64_t)r->block * p->block;
+    if (off >= p->size) {
+        // Past the end: the size, once, for the whole request
+        pop(p);
+        return size_notification(p, pkt, seq);
+    }
+
+    uint32_t n = p->size - (uint32_t)off < p->block ? p->size - (uint32_t)off : p->block;
+    if (!cache_read(p, (uint32_t)off, pkt + FT_PULL_PKT_HEADER, n)) {
+        pop(p);
+        return -1;
+    }
+    bool eof = off + n >= p->size;
+    ft_pkt_header_encode(pkt, seq, (uint16_t)(FT_PULL_HEADER_SIZE + n), eof);
+    ft_pkt_header_set_pull(pkt);
+    ft_pull_hdr_encode(pkt + FILE_TRANSFER_HEADER_SIZE, (uint32_t)off);
+    p->stats.blocks++;
+
+    r->block++;
+    if (--r->count == 0 || eof) pop(p);
+    return (int)(FT_PULL_PKT_HEADER + n);
+}
@@ -0,0 +1,129 @@
+/**
+ * @file ft_pull.h
+ * @brief Receiver-driven file transfer: READ_BLOCKS answered from a read-ahead cache
+ *
+ * In a push transfer the tag sets the pace from its notification credits
+ * and a fixed delay, without knowing how much the phone's stack buffers or
+ * how fast the app drains it. In a pull session (FILE_TRANSFER_CMD_PULL)
+ * the receiver asks for blocks with FILE_TRANSFER_CMD_READ_BLOCKS, keeps as
+ * many requests in flight as it can take, and the tag only answers. Any
+ * order is fine, so a receiver skips the ranges it already holds and asks
+ * again for the blocks it lost.
+ *
+ * Block b is bytes [b * block, (b + 1) * block) of the file, with block the
+ * size chosen in PULL. Each block is one notification with FT_PKT_FLAG_PULL
+ * set and an FT_PULL_HEADER_SIZE header after the data header:
+ *
+ *   offset u32 LE   file offset of the payload
+ *
+ * The notification holding the file's last byte also has FT_PKT_FLAG_EOF.
+ * Right after STAT_PULL_READY, and for a request starting past the end, the
+ * tag sends an empty FT_PKT_FLAG_EOF notification at offset = file size, so
+ * a receiver learns the size from whichever of them arrives.
+ *
+ * The tag queues FT_PULL_QUEUE requests (the next one is answered with
+ * STAT_PULL_OVERRUN and dropped) and serves them in order through
+ * FT_PULL_LINES cache lines of FT_PULL_LINE_BYTES: a miss reads a whole
+ * aligned line, so in-order requests cost one card read per line and a
+ * re-request of a recent block none.
+ *
+ * Pure C, no ESP-IDF dependencies: the firmware and the emulator build the same file.
+ */
+
+#ifndef FT_PULL_H
+#define FT_PULL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define FT_PKT_FLAG_PULL     0x04    // FT_PULL_HEADER_SIZE header follows the data header
+
+#define FT_PULL_HEADER_SIZE  4
+#define FT_PULL_MAX_COUNT    64      // Blocks per READ_BLOCKS
+#define FT_PULL_QUEUE        8       // READ_BLOCKS waiting on the tag
+#define FT_PULL_LINE_BYTES   4096
+#define FT_PULL_LINES        2
+#define FT_PULL_CACHE_BYTES  (FT_PULL_LINES * FT_PULL_LINE_BYTES)
+#define FT_PULL_IDLE_MS      10000   // Session ends after this long without a request
+
+// Read len bytes at offset; returns bytes read (fewer only at the end of the file) or -1
+typedef int (*ft_pull_read_fn)(void *ctx, uint32_t offset, uint8_t *buf, size_t len);
+
+typedef struct {
+    uint32_t block;
+    uint8_t count;
+} ft_pull_req_t;
+
+typedef struct {
+    uint32_t base;      // File offset, a multiple of FT_PULL_LINE_BYTES
+    uint32_t len;       // Valid bytes (0 = empty)
+    uint32_t used;      // Last use, for replacement
+} ft_pull_line_t;
+
+typedef struct {
+    uint32_t requests;
+    uint32_t overruns;  // Requests refused with a full queue
+    uint32_t blocks;
+    uint32_t hits;      // Blocks served without a card read
+    uint32_t misses;
+} ft_pull_stats_t;
+
+typedef struct {
+    ft_pull_read_fn read;
+    void *ctx;
+    uint32_t size;
+    uint16_t block;
+    uint8_t *cache;     // FT_PULL_CACHE_BYTES
+    ft_pull_line_t lines[FT_PULL_LINES];
+    uint32_t clock;
+    ft_pull_req_t queue[FT_PULL_QUEUE];
+    uint8_t head;
+    uint8_t queued;
+    bool announce;      // Size notification still to send
+    ft_pull_stats_t stats;
+} ft_pull_t;
+
+/**
+ * @brief Largest block for an ATT MTU: one notification with both headers
+ */
+uint16_t ft_pull_block_max(uint16_t mtu);
+
+/**
+ * @brief Start a session over a file of size bytes; queues the size notification
+ */
+void ft_pull_open(ft_pull_t *p, uint32_t size, uint16_t block, uint8_t *cache, ft_pull_read_fn read, void *ctx);
+
+/**
+ * @brief Queue READ_BLOCKS(block, count)
+ * @return false if the queue is full (counted as an overrun)
+ */
+bool ft_pull_request(ft_pull_t *p, uint32_t block, uint8_t count);
+
+static inline bool ft_pull_pending(const ft_pull_t *p) {
+    return p->announce || p->queued > 0;
+}
+
+/**
+ * @brief Build the next notification, data header included, into pkt (FT_PKT_MAX bytes)
+ * @return Its length; 0 if nothing is pending; -1 if the read failed (that request is dropped)
+ */
+int ft_pull_next(ft_pull_t *p, uint8_t *pkt, uint16_t seq);
+
+/**
+ * @brief File offset of the notification ft_pull_next() builds next (for logs and fault injection)
+ */
+uint32_t ft_pull_next_offset(const ft_pull_t *p);
+
+void ft_pull_hdr_encode(uint8_t *p, uint32_t offset);
+uint32_t ft_pull_hdr_decode(const uint8_t *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FT_PULL_H
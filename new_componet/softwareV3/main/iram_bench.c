@@ -0,0 +1,213 @@
+/**
+ * @file iram_bench.c
+ * @brief Hot path cycle counts, warm and cold cache (see iram_bench.h)
+ */
+
+#include "sdkconfig.h"
+
+#if CONFIG_SALESTAG_IRAM_BENCH
+
+#include "iram_bench.h"
+#include "adc_demux.h"
+#include "audio_capture.h"
+#include "capture_chain.h"
+#include "resampler.h"
+#include "spill_ring.h"
+#include "crc32c.h"
+#include "ft_proto.h"
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "esp_memory_utils.h"
+#include "esp32s3/rom/cache.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <string.h>
+
+static const char *TAG = "iram_bench";
+
+#define IRB_BLOCK        512     // Samples per ADC read in the capture task
+#define IRB_AUX_EVERY    16      // Aux (battery) slot in the synthetic scan pattern
+#define IRB_MIC_CH       3
+#define IRB_AUX_CH       8
+#define IRB_MTU          247
+#define IRB_WARMUP       40      // Blocks; also lets the conditioning finish calibrating
+#define IRB_REPS         32
+
+#if CONFIG_SALESTAG_IRAM_HOT
+#define IRB_PLACEMENT    "iram"
+#else
+#define IRB_PLACEMENT    "flash"
+#endif
+
+static uint8_t s_frame[(IRB_BLOCK + IRB_BLOCK / IRB_AUX_EVERY) * ADC_DEMUX_RESULT_BYTES];
+static uint16_t s_raw[IRB_BLOCK];
+static int16_t s_pcm[IRB_BLOCK];
+static uint16_t s_ring_buf[IRB_BLOCK];
+static uint8_t s_pkt[IRB_MTU];
+static int16_t s_rs_out[RESAMPLER_MAX_OUT(IRB_BLOCK)];
+static resampler_t s_rs;
+static capture_chain_t s_chain_fixed;
+static capture_chain_t s_chain_generic;
+static capture_chain_params_t s_chain_params = CAPTURE_CHAIN_PARAMS_DEFAULT;
+static adc_demux_t s_demux;
+static spill_ring_t s_ring;
+static volatile uint32_t s_sink;    // Keeps results live
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+typedef struct {
+    const char *name;
+    void (*run)(void);
+    const void *text;       // Function whose placement is reported
+} irb_stage_t;
+
+typedef struct {
+    uint32_t min;
+    uint64_t sum;
+} irb_stat_t;
+
+static void stage_demux(void) {
+    s_sink += adc_demux_split(&s_demux, s_frame, sizeof(s_frame), s_raw, IRB_BLOCK);
+    uint32_t sum, count;
+    adc_demux_take_aux(&s_demux, &sum, &count);
+}
+
+static void stage_condition(void) {
+    audio_capture_condition_block(s_raw, s_pcm, IRB_BLOCK);
+}
+
+// Both builds of the chain on their own state, whichever the capture uses
+static void stage_chain_fixed(void) {
+    capture_chain_run(&s_chain_fixed, s_raw, s_pcm, IRB_BLOCK);
+}
+
+static void stage_chain_generic(void) {
+    capture_chain_run_generic(&s_chain_generic, &s_chain_params, s_raw, s_pcm, IRB_BLOCK);
+}
+
+static void stage_resample(void) {
+    // A divider 200 ppm fast, as CONFIG_SALESTAG_RESAMPLE_EXACT corrects it
+    resampler_set_rate(&s_rs, 16003200, 16000000);
+    s_sink += resampler_process(&s_rs, s_pcm, IRB_BLOCK, s_rs_out);
+}
+
+static void stage_spill(void) {
+    for (uint32_t i = 0; i < IRB_BLOCK; i++) spill_ring_push(&s_ring, s_raw[i], i);
+    uint16_t v;
+    uint32_t ts;
+    while (spill_ring_pop(&s_ring, &v, &ts)) s_sink += v;
+}
+
+static void stage_crc(void) {
+    s_sink += crc32c_update(0, (const uint8_t *)s_pcm, sizeof(s_pcm));
+}
+
+static void stage_packet(void) {
+    const uint8_t *src = (const uint8_t *)s_pcm;
+    size_t budget = ft_payload_budget(IRB_MTU);
+    uint16_t seq = 0;
+    for (size_t off = 0; off < sizeof(s_pcm); off += budget) {
+        size_t n = sizeof(s_pcm) - off < budget ? sizeof(s_pcm) - off : budget;
+        ft_pkt_header_encode(s_pkt, seq++, (uint16_t)n, off + n == sizeof(s_pcm));
+        memcpy(s_pkt + FILE_TRANSFER_HEADER_SIZE, src + off, n);
+        s_sink += s_pkt[FILE_TRANSFER_HEADER_SIZE];
+    }
+}
+
+static const irb_stage_t s_stages[] = {
+    { "demux",     stage_demux,     (const void *)adc_demux_split },
+    { "condition", stage_condition, (const void *)audio_capture_condition_block },
+    { "chain_fixed", stage_chain_fixed, (const void *)capture_chain_run },
+    { "chain_generic", stage_chain_generic, (const void *)capture_chain_run_generic },
+    { "resample",  stage_resample,  (const void *)resampler_process },
+    { "spill",     stage_spill,     (const void *)spill_ring_push },
+    { "crc",       stage_crc,       (const void *)crc32c_update },
+    { "packet",    stage_packet,    (const void *)ft_pkt_header_encode },
+};
+
+// Interleaved mic/aux results in the ESP32-S3 TYPE2 layout, a slow sine on the mic
+static void build_frame(void) {
+    size_t pos = 0;
+    for (uint32_t i = 0; i < IRB_BLOCK; i++) {
+        if (i % IRB_AUX_EVERY == 0) {
+            uint32_t r = 2900u | ((uint32_t)IRB_AUX_CH << 13);
+            memcpy(&s_frame[pos], &r, sizeof(r));
+            pos += ADC_DEMUX_RESULT_BYTES;
+        }
+        uint32_t mic = 2048u + (uint32_t)((i * 37u) % 400u) - 200u;
+        uint32_t r = (mic & 0xFFFu) | ((uint32_t)IRB_MIC_CH << 13);
+        memcpy(&s_frame[pos], &r, sizeof(r));
+        pos += ADC_DEMUX_RESULT_BYTES;
+    }
+}
+
+static void evict_caches(void) {
+    Cache_Invalidate_ICache_All();
+#if !CONFIG_SPIRAM
+    // Without PSRAM the data cache only holds flash contents, so nothing dirty is lost
+    Cache_Invalidate_DCache_All();
+#endif
+}
+
+static uint32_t time_once(void (*run)(void), bool cold) {
+    taskENTER_CRITICAL(&s_lock);
+    if (cold) evict_caches();
+    uint32_t t0 = esp_cpu_get_cycle_count();
+    run();
+    uint32_t dt = esp_cpu_get_cycle_count() - t0;
+    taskEXIT_CRITICAL(&s_lock);
+    return dt;
+}
+
+static void stat_add(irb_stat_t *s, uint32_t v) {
+    if (v < s->min) s->min = v;
+    s->sum += v;
+}
+
+esp_err_t iram_bench_run(void) {
+    build_frame();
+    adc_demux_init(&s_demux, IRB_MIC_CH, IRB_AUX_CH);
+    spill_ring_init(&s_ring, s_ring_buf, IRB_BLOCK, 16000);
+    crc32c_init();
+    resampler_init(&s_rs);
+
+    // Above everything else so only interrupts on the other core get in
+    UBaseType_t prio = uxTaskPriorityGet(NULL);
+    vTaskPrioritySet(NULL, configMAX_PRIORITIES - 1);
+
+    // Fill the raw block and run the conditioning through its calibration
+    // (which logs) before anything is timed
+    stage_demux();
+    capture_chain_reset(&s_chain_fixed);
+    capture_chain_reset(&s_chain_generic);
+    for (int i = 0; i < IRB_WARMUP; i++) {
+        stage_condition();
+        stage_chain_fixed();
+        stage_chain_generic();
+    }
+
+    ESP_LOGI(TAG, "IRB v1 placement=%s cpu_mhz=%d block=%d reps=%d",
+             IRB_PLACEMENT, CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+             IRB_BLOCK, IRB_REPS);
+    for (size_t i = 0; i < sizeof(s_stages) / sizeof(s_stages[0]); i++) {
+        const irb_stage_t *st = &s_stages[i];
+        irb_stat_t warm = { .min = UINT32_MAX }, cold = { .min = UINT32_MAX };
+        st->run();
+        for (int r = 0; r < IRB_REPS; r++) {
+            stat_add(&warm, time_once(st->run, false));
+            stat_add(&cold, time_once(st->run, true));
+        }
+        uint32_t warm_avg = (uint32_t)(warm.sum / IRB_REPS);
+        uint32_t cold_avg = (uint32_t)(cold.sum / IRB_REPS);
+        ESP_LOGI(TAG, "IRB %s text=%s warm=%lu/%lu cold=%lu/%lu miss=%ld", st->name,
+                 esp_ptr_in_iram(st->text) ? "iram" : "flash",
+                 (unsigned long)warm.min, (unsigned long)warm_avg,
+                 (unsigned long)cold.min, (unsigned long)cold_avg,
+                 (long)cold_avg - (long)warm_avg);
+    }
+    ESP_LOGI(TAG, "IRB end");
+
+    vTaskPrioritySet(NULL, prio);
+    return ESP_OK;
+}
+
+#endif // CONFIG_SALESTAG_IRAM_BENCH
@@ -0,0 +1,43 @@
+/**
+ * @file iram_bench.h
+ * @brief Boot-time cycle counts for the recording and transfer hot paths
+ *
+ * Times each stage on one 512-sample block: ADC frame split, conditioning
+ * chain (as the capture runs it, then the specialized and generic builds of
+ * capture_chain.h side by side), resampler, spill ring round trip, CRC32C and packet headers for a
+ * 247-byte MTU. Each stage runs warm (back to back) and cold (instruction and, when
+ * there is no PSRAM, data cache invalidated right before), with interrupts
+ * masked on this core. cold - warm is what the cache misses cost; with the
+ * hot paths in IRAM (CONFIG_SALESTAG_IRAM_HOT, linker.lf) it should shrink
+ * to the data misses. Build once with and once without the placement to
+ * compare. The ESP32-S3 caches sit outside the core's performance monitor,
+ * so misses are only visible as cycles.
+ *
+ * Report lines:
+ *   IRB v1 placement=<iram|flash> cpu_mhz=<n> block=<samples> reps=<n>
+ *   IRB <stage> text=<iram|flash> warm=<min>/<avg> cold=<min>/<avg> miss=<cycles>
+ *   IRB end
+ */
+
+#ifndef IRAM_BENCH_H
+#define IRAM_BENCH_H
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Run the benchmark and log the report (blocks for well under a second)
+ *
+ * Must run before capture starts: it drives the capture's conditioning
+ * chain, whose state audio_capture_start() resets.
+ */
+esp_err_t iram_bench_run(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IRAM_BENCH_H
@@ -0,0 +1,173 @@
+/**
+ * @file live_telem.c
+ * @brief Live telemetry record, level meter and update rate limit (see live_telem.h)
+ */
+
+#include "live_telem.h"
+#include <string.h>
+#include <math.h>
+
+#define TELEM_COMPANY_LO 0xFF
+#define TELEM_COMPANY_HI 0xFF
+#define TELEM_MAGIC      'T'
+
+#define FULL_SCALE_SQ    1073741824.0   // 32768^2
+#define SPEECH_RATIO     8              // 9 dB over the noise floor
+#define SPEECH_FLOOR_SQ  1074           // -60 dBFS
+#define NOISE_RISE_SHIFT 7              // Floor creeps up 1/128 per block: ~1 dB/s at 32 ms blocks
+
+static void put16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static uint16_t get16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+size_t live_telem_encode(const live_telem_t *t, uint8_t *out, size_t cap) {
+    if (cap < LIVE_TELEM_LEN) return 0;
+    out[0] = TELEM_COMPANY_LO;
+    out[1] = TELEM_COMPANY_HI;
+    out[2] = TELEM_MAGIC;
+    out[3] = LIVE_TELEM_VERSION;
+    out[4] = t->seq;
+    out[5] = t->state;
+    out[6] = t->flags;
+    out[7] = t->rms;
+    out[8] = t->peak;
+    out[9] = t->speech_pct;
+    out[10] = t->battery_pct;
+    put16(out + 11, t->rec_s);
+    put16(out + 13, t->free_min);
+    put16(out + 15, t->pending);
+    return LIVE_TELEM_LEN;
+}
+
+bool live_telem_decode(const uint8_t *mfg, size_t len, live_telem_t *out) {
+    memset(out, 0, sizeof(*out));
+    if (len < LIVE_TELEM_HDR_LEN || mfg[0] != TELEM_COMPANY_LO || mfg[1] != TELEM_COMPANY_HI ||
+        mfg[2] != TELEM_MAGIC || mfg[3] < LIVE_TELEM_VERSION) {
+        return false;
+    }
+    out->version = mfg[3];
+    if (len < LIVE_TELEM_LEN) return true;      // Header only: points at a periodic train
+    // Later versions append fields
+    out->seq = mfg[4];
+    out->state = mfg[5];
+    out->flags = mfg[6];
+    out->rms = mfg[7];
+    out->peak = mfg[8];
+    out->speech_pct = mfg[9];
+    out->battery_pct = mfg[10];
+    out->rec_s = get16(mfg + 11);
+    out->free_min = get16(mfg + 13);
+    out->pending = get16(mfg + 15);
+    return true;
+}
+
+uint32_t live_telem_block_power(const int16_t *pcm, size_t n, uint32_t *peak) {
+    uint64_t sum = 0;
+    uint32_t max = 0;
+    for (size_t i = 0; i < n; i++) {
+        int32_t v = pcm[i];
+        uint32_t a = (uint32_t)(v < 0 ? -v : v);
+        if (a > max) max = a;
+        sum += (uint64_t)(v * v);
+    }
+    *peak = max;
+    return n ? (uint32_t)(sum / n) : 0;
+}
+
+void live_telem_meter_init(live_telem_meter_t *m) {
+    memset(m, 0, sizeof(*m));
+}
+
+void live_telem_meter_add(live_telem_meter_t *m, uint32_t mean_sq, uint32_t peak, size_t n) {
+    if (n == 0) return;
+    bool speech = m->noise && (uint64_t)mean_sq > (uint64_t)m->noise * SPEECH_RATIO && mean_sq > SPEECH_FLOOR_SQ;
+    if (m->noise == 0 || mean_sq < m->noise) {
+        m->noise = mean_sq ? mean_sq : 1;
+    } else {
+        m->noise += (m->noise >> NOISE_RISE_SHIFT) + 1;
+    }
+
+    m->sum_sq += (uint64_t)mean_sq * n;
+    m->samples += (uint32_t)n;
+    if (peak > m->peak) m->peak = peak;
+    if (m->blocks < UINT16_MAX) {
+        m->blocks++;
+        m->speech_blocks += speech;
+    }
+}
+
+uint8_t live_telem_db_code(uint64_t mean_sq) {
+    if (mean_sq == 0) return 254;
+    double code = -20.0 * log10((double)mean_sq / FULL_SCALE_SQ);   // -dBFS x2
+    if (code <= 0) return 0;
+    return code >= 254 ? 254 : (uint8_t)(code + 0.5);
+}
+
+void live_telem_meter_take(live_telem_meter_t *m, live_telem_t *t) {
+    t->flags &= (uint8_t)~LIVE_TELEM_F_CLIPPING;
+    if (m->samples == 0) {
+        t->rms = LIVE_TELEM_NO_AUDIO;
+        t->peak = LIVE_TELEM_NO_AUDIO;
+        t->speech_pct = 0;
+    } else {
+        t->rms = live_telem_db_code(m->sum_sq / m->samples);
+        t->peak = live_telem_db_code((uint64_t)m->peak * m->peak);
+        t->speech_pct = (uint8_t)(m->speech_blocks * 100u / m->blocks);
+        if (m->peak >= LIVE_TELEM_CLIP) t->flags |= LIVE_TELEM_F_CLIPPING;
+    }
+    live_telem_meter_restart(m);
+}
+
+void live_telem_meter_restart(live_telem_meter_t *m) {
+    m->sum_sq = 0;
+    m->samples = 0;
+    m->peak = 0;
+    m->blocks = 0;
+    m->speech_blocks = 0;
+}
+
+void live_telem_rate_init(live_telem_rate_t *r, uint32_t interval_ms, uint32_t heartbeat_ms) {
+    memset(r, 0, sizeof(*r));
+    r->interval_ms = interval_ms;
+    r->heartbeat_ms = heartbeat_ms;
+}
+
+static bool moved(uint8_t a, uint8_t b, uint8_t step) {
+    return (a > b ? a - b : b - a) >= step;
+}
+
+static bool level_moved(uint8_t a, uint8_t b) {
+    if ((a == LIVE_TELEM_NO_AUDIO) != (b == LIVE_TELEM_NO_AUDIO)) return true;
+    return moved(a, b, LIVE_TELEM_LEVEL_STEP);
+}
+
+// What a manager looking at the fleet would see change: while recording the
+// clock moves every second, so updates follow the interval; free space rides
+// on the heartbeat
+static bool changed(const live_telem_t *a, const live_telem_t *b) {
+    return a->state != b->state || a->flags != b->flags || a->battery_pct != b->battery_pct ||
+           a->pending != b->pending || a->rec_s != b->rec_s || level_moved(a->rms, b->rms) || level_moved(a->peak, b->peak) ||
+           moved(a->speech_pct, b->speech_pct, LIVE_TELEM_SPEECH_STEP);
+}
+
+bool live_telem_rate_due(const live_telem_rate_t *r, const live_telem_t *next, uint32_t now_ms) {
+    if (!r->sent) return true;
+    uint32_t since = now_ms - r->last_ms;
+    if (since < LIVE_TELEM_MIN_GAP(r->interval_ms)) return false;
+    // A quarter interval early still counts, so tick jitter does not push a heartbeat a whole tick late
+    if (since + r->interval_ms / 4 >= r->heartbeat_ms) return true;
+    return changed(&r->last, next);
+}
+
+void live_telem_rate_sent(live_telem_rate_t *r, live_telem_t *next, uint32_t now_ms) {
+    next->version = LIVE_TELEM_VERSION;
+    next->seq = r->sent ? (uint8_t)(r->last.seq + 1) : 0;
+    r->last = *next;
+    r->last_ms = now_ms;
+    r->sent = true;
+}
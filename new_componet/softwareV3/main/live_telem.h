@@ -0,0 +1,143 @@
+/**
+ * @file live_telem.h
+ * @brief Live telemetry record for connectionless advertising
+ *
+ * A manager's scanner follows every tag in a showroom without connecting:
+ * recording state, audio level, speech activity, battery and card, at 1-2 Hz
+ * (telem_adv.c puts the record in an extended or periodic advertisement).
+ *
+ *   [0xFF 0xFF] company ID (unassigned/testing)
+ *   ['T']       SalesTag telemetry (the sync state of adv_state.h is 'S')
+ *   [version]   LIVE_TELEM_VERSION
+ *   [seq]       advances with every update: a repeat is not a new reading
+ *   [state]     rec_state_t (rec_fsm.h)
+ *   [flags]     LIVE_TELEM_F_*
+ *   [rms]       level over the update window, -dBFS in 0.5 dB steps,
+ *               LIVE_TELEM_NO_AUDIO when not capturing
+ *   [peak]      the same for the largest sample
+ *   [speech]    share of 32 ms blocks with speech in the window, 0-100
+ *   [battery]   state of charge 0-100, 0xFF unknown
+ *   [u16 LE]    seconds into the current recording
+ *   [u16 LE]    minutes of RAW recording the card still has room for
+ *   [u16 LE]    recordings not yet synced (adv_state.h)
+ *
+ * The meter takes the conditioned capture blocks: live_telem_block_power()
+ * is the per-block work, done outside any lock, and live_telem_meter_add()
+ * the few updates that are shared with the reader. Speech is a block 9 dB
+ * above a noise floor, and above -60 dBFS; the floor follows the quietest
+ * blocks down at once and creeps up by about 1 dB/s.
+ *
+ * The rate limiter decides when the advertised record changes: at most one
+ * update per LIVE_TELEM_MIN_GAP of the interval, a new one when something
+ * a manager would notice changed (while recording, the clock does every
+ * second), and a heartbeat otherwise so a scanner can tell a tag that went
+ * quiet from one that went away.
+ *
+ * Pure C: host/telem builds the same file.
+ */
+
+#ifndef LIVE_TELEM_H
+#define LIVE_TELEM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LIVE_TELEM_VERSION      1
+#define LIVE_TELEM_LEN          17
+#define LIVE_TELEM_HDR_LEN      4       // Company, 'T', version: enough to recognise a train
+#define LIVE_TELEM_NO_AUDIO     0xFF
+#define LIVE_TELEM_BATTERY_UNKNOWN 0xFF
+
+#define LIVE_TELEM_F_NO_CARD    0x01    // Card missing or unmounted
+#define LIVE_TELEM_F_CARD_WEAK  0x02    // Card health degraded or failing (sd_health.h)
+#define LIVE_TELEM_F_CLIPPING   0x04    // A sample reached the conditioning's clip level
+#define LIVE_TELEM_F_DROPPING   0x08    // Samples dropped on the way to the card
+#define LIVE_TELEM_F_BATT_LOW   0x10
+
+#define LIVE_TELEM_CLIP         29490   // audio_capture.c clips conditioned samples here
+#define LIVE_TELEM_LEVEL_STEP   6       // Level change worth an update: 3 dB
+#define LIVE_TELEM_SPEECH_STEP  20      // Speech share change worth an update
+#define LIVE_TELEM_MIN_GAP(interval_ms) ((interval_ms) / 2)
+
+typedef struct {
+    uint8_t version;
+    uint8_t seq;
+    uint8_t state;
+    uint8_t flags;
+    uint8_t rms;
+    uint8_t peak;
+    uint8_t speech_pct;
+    uint8_t battery_pct;
+    uint16_t rec_s;
+    uint16_t free_min;
+    uint16_t pending;
+} live_telem_t;
+
+typedef struct {
+    uint64_t sum_sq;            // Window: since the last live_telem_meter_take()
+    uint32_t samples;
+    uint32_t peak;
+    uint16_t blocks;
+    uint16_t speech_blocks;
+    uint32_t noise;             // Mean square of the noise floor; kept across windows
+} live_telem_meter_t;
+
+typedef struct {
+    uint32_t interval_ms;
+    uint32_t heartbeat_ms;
+    uint32_t last_ms;
+    bool sent;
+    live_telem_t last;          // As last published
+} live_telem_rate_t;
+
+size_t live_telem_encode(const live_telem_t *t, uint8_t *out, size_t cap);
+
+/**
+ * @brief Read manufacturer data from an advertisement
+ * @return false if it is not a SalesTag telemetry record; a header-only
+ *         record (periodic mode's extended set) decodes with version set and
+ *         everything else zero
+ */
+bool live_telem_decode(const uint8_t *mfg, size_t len, live_telem_t *out);
+
+// Mean square and largest magnitude of one block of conditioned samples
+uint32_t live_telem_block_power(const int16_t *pcm, size_t n, uint32_t *peak);
+
+void live_telem_meter_init(live_telem_meter_t *m);
+
+// Account one block (the results of live_telem_block_power)
+void live_telem_meter_add(live_telem_meter_t *m, uint32_t mean_sq, uint32_t peak, size_t n);
+
+// Fill rms, peak, speech_pct and LIVE_TELEM_F_CLIPPING from the window, and start a new one
+void live_telem_meter_take(live_telem_meter_t *m, live_telem_t *t);
+
+// Start a new window, keeping the noise floor (take() on a copy, restart() on the shared meter)
+void live_telem_meter_restart(live_telem_meter_t *m);
+
+// -dBFS in 0.5 dB steps for a mean square or squared peak (0 -> 254)
+uint8_t live_telem_db_code(uint64_t mean_sq);
+
+void live_telem_rate_init(live_telem_rate_t *r, uint32_t interval_ms, uint32_t heartbeat_ms);
+
+/**
+ * @brief Whether next should replace the advertised record now
+ *
+ * Call once per interval, and whenever an event (a recording starting or
+ * stopping) should show sooner; a change refused for being too soon is
+ * still a change at the next call.
+ */
+bool live_telem_rate_due(const live_telem_rate_t *r, const live_telem_t *next, uint32_t now_ms);
+
+// next is being published: stamps its sequence number
+void live_telem_rate_sent(live_telem_rate_t *r, live_telem_t *next, uint32_t now_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LIVE_TELEM_H
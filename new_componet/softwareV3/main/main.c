@@ -8,7 +8,25 @@
 #include "ui.h"
 #include "sd_storage.h"
 #include "audio_capture.h"
+#include "battery_monitor.h"
 #include "raw_audio_storage.h"
+#include "rec_ctrl.h"
+#include "rec_catalog.h"
+#include "power_fail.h"
+#include "sync_state.h"
+#include "adv_state.h"
+#include "speech_transcode.h"
+#include "wifi_offload.h"
+#include "xfer_credit.h"
+#include "ft_proto.h"
+#include "ft_fec.h"
+#include "ft_pull.h"
+#include "fault_inject.h"
+#include "cpu_profiler.h"
+#include "power_mgr.h"
+#include "telem_adv.h"
+#include "mem_plan.h"
+#include "iram_bench.h"
 #include "nvs_flash.h"
 
 // NimBLE includes
@@ -38,7 +56,6 @@
 #include <stdbool.h>  // for bool
 #include <stdio.h>    // for FILE, snprintf
 #include <time.h>     // for time_t
-#include <ctype.h>    // for isalnum
 
 // Set to 1 for deep debug, 0 for normal operation
 #define FILE_XFER_VERBOSE 1
@@ -54,23 +71,6 @@ static const char *TAG = "salestag-sd";
 #define SD_MAX_PATH 256
 #endif
 
-#define FT_PKT_MAX 200
-#define FT_MAX_RETRIES 8
-
-// Custom UUID definitions for SalesTag Audio Service
-#define BLE_UUID_SALESTAG_AUDIO_SVC    0x1234
-#define BLE_UUID_SALESTAG_RECORD_CTRL  0x1235
-#define BLE_UUID_SALESTAG_STATUS       0x1236
-#define BLE_UUID_SALESTAG_FILE_COUNT   0x1237
-
-// Custom UUID definitions for SalesTag File Transfer Service
-#define BLE_UUID_SALESTAG_FILE_SVC         0x1240
-#define BLE_UUID_SALESTAG_FILE_CTRL        0x1241  // Write: Commands (START, START_WITH_FILENAME, PAUSE, RESUME, STOP, LIST_FILES, SELECT_FILE)
-#define BLE_UUID_SALESTAG_FILE_DATA        0x1242  // Notify: File data chunks
-#define BLE_UUID_SALESTAG_FILE_STATUS      0x1243  // Notify: Transfer status
-#define BLE_UUID_SALESTAG_FILE_LIST        0x1244  // Read: List available .raw filenames (legacy)
-#define BLE_UUID_SALESTAG_AUTO_SELECT_LIST 0x1245  // Read: Auto-selection file list (returns latest file)
-
 // UUID objects
 static const ble_uuid16_t UUID_AUDIO_SVC   = BLE_UUID16_INIT(BLE_UUID_SALESTAG_AUDIO_SVC);
 static const ble_uuid16_t UUID_RECORD_CTRL = BLE_UUID16_INIT(BLE_UUID_SALESTAG_RECORD_CTRL);
@@ -84,71 +84,6 @@ static const ble_uuid16_t UUID_FILE_STATUS         = BLE_UUID16_INIT(BLE_UUID_SA
 static const ble_uuid16_t UUID_FILE_LIST           = BLE_UUID16_INIT(BLE_UUID_SALESTAG_FILE_LIST);
 static const ble_uuid16_t UUID_AUTO_SELECT_LIST    = BLE_UUID16_INIT(BLE_UUID_SALESTAG_AUTO_SELECT_LIST);
 
-// File transfer command definitions (updated for auto-selection)
-//
-// MOBILE APP USAGE:
-//
-// 1. FILE_TRANSFER_CMD_START (0x01) - Start transfer with auto-selected latest file
-//    Data: [0x01]
-//    Use: When you want the ESP32 to automatically choose the latest .raw file
-//
-// 2. FILE_TRANSFER_CMD_START_WITH_FILENAME (0x07) - Start transfer with specific filename
-//    Data: [0x07][filename_string]
-//    Use: When you want to download a specific file
-//    Example: [0x07]['r','0','0','1','.','r','a','w'] for "r001.raw"
-//    Notes:
-//    - Filename should not include path (just the base filename)
-//    - .raw extension is optional (will be added if missing)
-//    - Only alphanumeric, dots, underscores, and hyphens allowed
-//    - Maximum 255 characters
-//    - Path traversal characters (.., /, \) are blocked for security
-//
-// 3. FILE_TRANSFER_CMD_LIST_FILES (0x05) - Get list of available files for auto-selection
-//    Data: [0x05]
-//    Use: Request list of available .raw files (returns latest file first)
-//    Response: Auto-selection list via UUID 0x1245 characteristic
-//
-// 4. FILE_TRANSFER_CMD_SELECT_FILE (0x04) - Select specific file from auto-selection list
-//    Data: [0x04][index_byte]
-//    Use: Select file by index from the auto-selection list
-//    Example: [0x04][0x00] to select the first (latest) file
-//
-// WORKFLOW RECOMMENDATION:
-// 1. Send LIST_FILES command (0x05) to get available files
-// 2. Send SELECT_FILE command (0x04) with index to choose file
-// 3. Or send START command (0x01) for immediate auto-selection of latest file
-// 4. Or send START_WITH_FILENAME command (0x07) with known filename
-//
-#define FILE_TRANSFER_CMD_START                   0x01
-#define FILE_TRANSFER_CMD_PAUSE                   0x02
-#define FILE_TRANSFER_CMD_RESUME                  0x03
-#define FILE_TRANSFER_CMD_SELECT_FILE             0x04  // Select file by index from auto-selection list
-#define FILE_TRANSFER_CMD_LIST_FILES              0x05  // Get auto-selection file list
-#define FILE_TRANSFER_CMD_STOP                    0x06  // Moved to avoid conflict
-#define FILE_TRANSFER_CMD_START_WITH_FILENAME     0x07  // Moved to avoid conflict
-
-
-// File transfer status codes (updated to 1-byte values)
-#define STAT_STARTED                   0x01
-#define STAT_COMPLETE                  0x02
-#define STAT_STOPPED_BY_HOST           0x03
-#define STAT_FILE_OPEN_FAIL            0x10
-#define STAT_NOTIFY_FAIL               0x11
-#define STAT_BAD_CMD                   0x20
-#define STAT_ALREADY_RUNNING           0x21
-#define STAT_PAUSED                    0x30
-#define STAT_SUBSCRIPTION_REQUIRED     0x40
-#define STAT_NO_FILE                   0x50
-#define STAT_BUSY                      0x22
-#define STAT_NO_CONN                   0x23
-#define STAT_FILE_READ_FAIL            0x13
-#define STAT_LIST_READY                0x60  // Auto-selection file list ready
-#define STAT_FILE_SELECTED             0x61  // File selected from auto-selection list
-#define STAT_INVALID_INDEX             0x62  // Invalid file index in SELECT_FILE command
-
-// File transfer packet header size (5 bytes)
-#define FILE_TRANSFER_HEADER_SIZE 5
-
 // File transfer status notification (now 1 byte)
 // Status codes are now sent as single bytes
 
@@ -181,13 +116,19 @@ static int file_transfer_pause(void);
 static int file_transfer_resume(void);
 static void send_status(uint8_t code);
 static inline bool notifies_ready(void);
+static void credits_configure(void);
+#ifdef BLE_GAP_EVENT_EATT
+static void eatt_chan_update(uint16_t cid, bool up);
+#endif
+static void return_data_credit(void);
 static void update_payload_len(uint16_t mtu);
 
 // Forward declarations for functions called before definition
-static bool is_valid_filename(const char *filename);
 static int list_available_raw_files(struct os_mbuf *om);
 static int list_auto_select_files(struct os_mbuf *om);
-static int file_transfer_start_with_filename(const char *requested_filename);
+static int file_transfer_start_with_filename(const char *requested_filename, uint8_t variant);
+static int file_transfer_start_by_id(uint32_t rec_id, uint8_t variant);
+static int file_transfer_pull(uint32_t rec_id, uint8_t variant, uint8_t block);
 static int file_transfer_list_files(void);
 static int file_transfer_select_file(uint8_t file_index);
 
@@ -199,8 +140,7 @@ static int gatt_svr_chr_access(uint16_t conn_handle, uint16_t attr_handle,
 static int s_recording_count = 0;
 static bool s_audio_capture_enabled = false;
 
-// File transfer subscription tracking
-static volatile bool s_is_recording = false;  // Made volatile for multi-task access
+// Selected file for transfers; a finished recording becomes the selection
 static char s_current_raw_file[128] = {0};
 
 // Connection and characteristic handles
@@ -210,6 +150,7 @@ uint16_t s_file_transfer_status_handle = 0;
 
 // State
 volatile bool s_file_transfer_active = false;
+static volatile bool s_formatting = false;  // Card being reformatted; every card user stays off
 volatile bool s_file_transfer_paused = false;
 
 // Progress
@@ -221,6 +162,18 @@ uint16_t s_seq = 0;
 // File
 FILE *s_file_transfer_fp = NULL;
 
+#if CONFIG_SALESTAG_FEC
+// FEC mode set by FILE_TRANSFER_CMD_SET_FEC; r == 0 sends plain chunks
+static uint8_t s_fec_k = 0;
+static uint8_t s_fec_r = 0;
+static uint8_t *s_fec_parity = NULL;   // FT_FEC_MAX_R symbols, from the memory plan
+static ft_fec_enc_t s_fec;
+#endif
+
+// Pull session (FILE_TRANSFER_CMD_PULL), run by the worker
+static ft_pull_t s_pull;
+static uint8_t *s_pull_cache = NULL;   // FT_PULL_CACHE_BYTES, from the memory plan
+
 // Subscription tracking (GAP SUBSCRIBE approach)
 static volatile uint8_t s_cccd_mask = 0; // bit0 = Data, bit1 = Status
 
@@ -229,17 +182,68 @@ static uint16_t s_mtu = 23;
 static size_t s_payload_max = 20; // mtu - 3
 
 // File transfer command queue for worker task
-typedef enum { FT_CMD_START, FT_CMD_STOP } ft_cmd_t;
+typedef enum { FT_CMD_START, FT_CMD_STOP, FT_CMD_SYNC_ACK, FT_CMD_PULL, FT_CMD_READ_BLOCKS } ft_cmd_t;
 
 typedef struct {
     ft_cmd_t type;
+    uint32_t rec_id;        // SYNC_ACK
+    uint32_t crc32c;        // SYNC_ACK
+    uint8_t variant;        // START, PULL: FT_VARIANT_* of s_current_raw_file
+    uint8_t pull_block;     // PULL: payload per notification (0 = largest)
+    uint32_t block;         // READ_BLOCKS
+    uint8_t count;          // READ_BLOCKS
 } ft_msg_t;
 
 static QueueHandle_t s_ft_q = NULL;
 
 // Credit-based pacing for BLE notifications
+// The credit window is s_credits; s_notify_sem wakes the worker when a NOTIFY_TX
+// completion hands a credit back while it is waiting for one.
 static SemaphoreHandle_t s_notify_sem = NULL;
-static const int kMaxInFlight = 3;  // Reduced from 4 to be more conservative with mbuf usage
+static const int kCreditsPerBearer = 3;  // Reduced from 4 to be more conservative with mbuf usage
+static xfer_credit_t s_credits;
+static portMUX_TYPE s_credit_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint16_t s_eatt_cids[XFER_MAX_BEARERS];  // CIDs of the EATT channels up on this connection
+static uint8_t s_eatt_chans_up = 0;
+static bool s_credits_stale = false;  // Channels changed during a transfer: resize at the next start
+
+#if CONFIG_SALESTAG_FAULT_INJECT
+fi_ctx_t g_fault_inject;
+
+static uint32_t fault_inject_clock_ms(void) {
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+static void fault_inject_log_report(void) {
+    static char report[FI_POINT_COUNT * 112];
+    if (fi_report(&g_fault_inject, report, sizeof(report)) == 0) return;
+    ESP_LOGI(TAG, "=== Fault injection ===\n%s", report);
+}
+#endif
+
+#if CONFIG_SALESTAG_PROFILER
+static void profiler_done(esp_err_t result) {
+    send_status(result == ESP_OK ? STAT_PROFILE_READY : STAT_PROFILE_FAIL);
+}
+#endif
+
+#ifdef CONFIG_BT_NIMBLE_EATT_CHAN_NUM
+#define XFER_EATT_CHANS CONFIG_BT_NIMBLE_EATT_CHAN_NUM
+#else
+#define XFER_EATT_CHANS 0
+#endif
+
+#ifdef CONFIG_SALESTAG_MULTI_NOTIFY
+#define XFER_MULTI_NOTIFY 1
+#else
+#define XFER_MULTI_NOTIFY 0
+#endif
+
+#ifdef CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM
+#define XFER_COC_MAX CONFIG_BT_NIMBLE_L2CAP_COC_MAX_NUM
+#else
+#define XFER_COC_MAX 0
+#endif
 
 // GATT characteristic arrays (sentinel-terminated)
 static const struct ble_gatt_chr_def audio_chrs[] = {
@@ -280,221 +284,287 @@ static void gatt_preflight(void)
 // Removed unused gatt_validate function
 
 
-// ADC sample queue for decoupling real-time sampling from file I/O
-static QueueHandle_t s_adc_sample_queue = NULL;
-
-// Raw ADC callback function - now lightweight (just queues samples)
-static void raw_adc_callback(uint16_t mic_adc, void *user_ctx) {
-    (void)user_ctx;  // Unused
+#if CONFIG_SALESTAG_SPEECH_TRANSCODE || CONFIG_SALESTAG_WIFI_OFFLOAD || CONFIG_SALESTAG_DEEP_SLEEP
+// Set once the device has decided to sleep; background card users stop
+static volatile bool s_power_down = false;
+#endif
 
-    // Just queue the sample - no heavy I/O operations!
-    // Use regular task context queue functions (not ISR versions)
-    if (s_adc_sample_queue) {
-        xQueueSend(s_adc_sample_queue, &mic_adc, 0);  // Don't block if queue is full
-    }
+#if CONFIG_SALESTAG_SPEECH_TRANSCODE
+// Background transcoding must never compete with recording or a live transfer for the card
+static bool speech_transcode_busy(void) {
+#if CONFIG_SALESTAG_WIFI_OFFLOAD
+    if (wifi_offload_active()) return true;
+#endif
+    return rec_ctrl_is_recording() || s_file_transfer_active || s_formatting || s_power_down;
 }
+#endif
 
-// Storage task for handling file I/O safely
-static void storage_task(void *pvParameters) {
-    (void)pvParameters;
+#if CONFIG_SALESTAG_WIFI_OFFLOAD
+// Uploads stop between chunks once the user records or a phone starts a transfer
+static bool wifi_offload_busy(void) {
+    return rec_ctrl_is_recording() || s_file_transfer_active || s_formatting || s_power_down;
+}
+#endif
 
-    ESP_LOGI(TAG, "Storage task started");
+// An on-demand variant transcode (START_BY_ID) gives up for recording, a lost link or sleep
+static bool variant_busy(void) {
+    if (rec_ctrl_is_recording() || s_file_transfer_conn_handle == 0) return true;
+#if CONFIG_SALESTAG_SPEECH_TRANSCODE || CONFIG_SALESTAG_WIFI_OFFLOAD || CONFIG_SALESTAG_DEEP_SLEEP
+    return s_power_down;
+#else
+    return false;
+#endif
+}
 
-    uint16_t mic_sample;
-    uint32_t sample_counter = 0; // For professional logging intervals
+#if CONFIG_SALESTAG_DEEP_SLEEP
+static bool s_fast_wake = false;
+static int64_t s_wake_connect_us = 0;   // Set on a fast wake until the first connection
+static rtc_state_t s_last_peer;         // Only the peer_* fields are used
+
+// Awake while recording, connected or doing background work on the card
+static bool power_mgr_busy(void) {
+    if (rec_ctrl_is_recording() || s_file_transfer_active || s_file_transfer_conn_handle != 0) return true;
+    if (s_formatting) return true;
+#if CONFIG_SALESTAG_SPEECH_TRANSCODE
+    if (speech_transcode_active()) return true;
+#endif
+#if CONFIG_SALESTAG_WIFI_OFFLOAD
+    if (wifi_offload_active()) return true;
+#endif
+    return false;
+}
 
-    while (1) {
-        // Wait for samples from the queue with a reasonable timeout
-        if (xQueueReceive(s_adc_sample_queue, &mic_sample, pdMS_TO_TICKS(100))) {
-            sample_counter++;
+static void power_mgr_prepare(rtc_state_t *state) {
+    // Stop background card users and give them a moment to finish their step
+    s_power_down = true;
+    for (int i = 0; i < 20; i++) {
+        bool active = false;
+#if CONFIG_SALESTAG_SPEECH_TRANSCODE
+        active |= speech_transcode_active();
+#endif
+#if CONFIG_SALESTAG_WIFI_OFFLOAD
+        active |= wifi_offload_active();
+#endif
+        if (!active) break;
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
 
-            // Professional audio status logging (every 8000 samples = 0.5 sec at 16kHz)
-            if (sample_counter % 8000 == 0) {
-                ESP_LOGI(TAG, "🎵 Audio Processing Status - Samples processed: %lu", sample_counter);
-                ESP_LOGI(TAG, "  Recording: %s, Queue depth: %d",
-                         s_is_recording ? "ACTIVE" : "STANDBY",
-                         uxQueueMessagesWaiting(s_adc_sample_queue));
-            }
+    state->recording_count = s_recording_count;
+    const char *name = strrchr(s_current_raw_file, '/');
+    strlcpy(state->selected_file, name ? name + 1 : "", sizeof(state->selected_file));
+    float noise_floor, gain;
+    state->calibrated = audio_capture_get_calibration(&noise_floor, &gain) ? 1 : 0;
+    state->noise_floor = state->calibrated ? noise_floor : 0.0f;
+    state->gain = state->calibrated ? gain : 1.0f;
+    state->peer_valid = s_last_peer.peer_valid;
+    state->peer_addr_type = s_last_peer.peer_addr_type;
+    memcpy(state->peer_addr, s_last_peer.peer_addr, sizeof(state->peer_addr));
+
+    ble_stop_advertising();
+#if CONFIG_SALESTAG_TELEMETRY
+    telem_adv_stop();
+#endif
+    if (sd_storage_is_available()) {
+        sd_storage_deinit();
+    }
+}
 
-            // Only do file I/O when recording is active
-            if (s_is_recording) {
-                esp_err_t ret = raw_audio_storage_add_sample(mic_sample);
-                if (ret != ESP_OK) {
-                    ESP_LOGW(TAG, "Failed to add raw audio sample: %s", esp_err_to_name(ret));
-                    // Add a small delay to prevent rapid error logging
-                    vTaskDelay(pdMS_TO_TICKS(10));
-                }
-            }
-            // If not recording, just consume and discard samples to drain the queue
-        }
-        // Else: timeout occurred, continue loop to check recording status
+// Fast wake: take back what the device knew before sleeping
+static void power_mgr_restore(const rtc_state_t *state) {
+    s_recording_count = state->recording_count;
+    s_last_peer.peer_valid = state->peer_valid;
+    s_last_peer.peer_addr_type = state->peer_addr_type;
+    memcpy(s_last_peer.peer_addr, state->peer_addr, sizeof(s_last_peer.peer_addr));
+    if (state->calibrated) {
+        audio_capture_set_calibration(state->noise_floor, state->gain);
     }
+    if (state->selected_file[0] && sd_storage_is_available()) {
+        struct stat st;
+        snprintf(s_current_raw_file, sizeof(s_current_raw_file), "%s/%s", SD_REC_DIR, state->selected_file);
+        if (stat(s_current_raw_file, &st) != 0) s_current_raw_file[0] = '\0';
+    }
+    s_wake_connect_us = esp_timer_get_time();
+    ESP_LOGI(TAG, "Fast wake: %d recordings, selected \"%s\", calibration %s",
+             s_recording_count, state->selected_file, state->calibrated ? "restored" : "none");
 }
+#endif
 
+// Recording controller hooks (rec_ctrl.h)
+static bool rec_next_path(char *path, size_t len) {
+    uint32_t id;
+    esp_err_t err = rec_catalog_next(&id, path, len);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "No recording ID: %s", esp_err_to_name(err));
+        return false;
+    }
+    s_recording_count++;
+    return true;
+}
 
+// No recording, transfer or background job has a file open on the card
+static bool card_idle_except_format(void) {
+    if (rec_ctrl_is_recording() || s_file_transfer_active) return false;
+#if CONFIG_SALESTAG_SPEECH_TRANSCODE
+    if (speech_transcode_active()) return false;
+#endif
+#if CONFIG_SALESTAG_WIFI_OFFLOAD
+    if (wifi_offload_active()) return false;
+#endif
+    return true;
+}
 
-// Button callback function - Toggle Recording (Option A)
-static void button_callback(bool pressed, uint32_t timestamp_ms, void *ctx) {
-    (void)ctx;  // Unused
-    
-    ESP_LOGI(TAG, "=== BUTTON CALLBACK === Button %s at %u ms", pressed ? "PRESSED" : "RELEASED", (unsigned)timestamp_ms);
-    
-    // LED shows RECORDING state, not button state
-    // (LED will be controlled by recording logic below)
-    
+// Nothing else is using the card, so a health probe would only cost idle time
+static bool card_idle(void) {
+    return !s_formatting && card_idle_except_format();
+}
 
-    
-    // When button is pressed, handle recording
-    if (pressed && sd_storage_is_available()) {
-        // Prevent recording from starting during file transfer
-        if (s_file_transfer_active) {
-            ESP_LOGW(TAG, "Recording blocked - file transfer in progress");
-            return;
-        }
+// Recording must not start while a phone is reading the card or it is being formatted
+static bool rec_start_blocked(void) {
+    return s_file_transfer_active || s_formatting;
+}
 
-        s_recording_count++;
+static void format_task(void *arg) {
+    uint32_t cluster_kb = (uint32_t)(uintptr_t)arg;
+    send_status(STAT_FORMAT_STARTED);
+    esp_err_t ret = sd_storage_format(cluster_kb);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Format failed: %s", esp_err_to_name(ret));
+    } else {
+        sync_state_init();  // Nothing left to sync
+    }
+    s_formatting = false;
+    send_status(ret == ESP_OK ? STAT_FORMAT_DONE : STAT_FORMAT_FAIL);
+    vTaskDelete(NULL);
+}
 
-        // Check if this is a long press (for power cycling)
-        static uint32_t button_press_start = 0;
-        uint32_t current_time = esp_timer_get_time() / 1000; // Convert to milliseconds
+// FORMAT command: the card is wiped in the background while everything else stays off it
+static int file_transfer_format(uint8_t cluster_kb) {
+    if (s_formatting) {
+        send_status(STAT_BUSY);
+        return 0;
+    }
+    // Flag first so a recording can't start between the check and the format
+    s_formatting = true;
+    if (!card_idle_except_format()) {
+        s_formatting = false;
+        send_status(STAT_BUSY);
+        return 0;
+    }
+    if (xTaskCreate(format_task, "sd_format", 4096, (void *)(uintptr_t)cluster_kb, 3, NULL) != pdPASS) {
+        s_formatting = false;
+        send_status(STAT_FORMAT_FAIL);
+    }
+    return 0;
+}
 
-        if (button_press_start == 0) {
-            button_press_start = current_time;
-        }
+// Advertising interferes with the microphone; it is off for the whole recording.
+// The telemetry set stays on (one short packet per interval) and shows the change.
+static void rec_radio_quiet(bool quiet) {
+    if (quiet) {
+        ble_stop_advertising();
+    } else {
+        ble_start_advertising_if_not_recording();
+    }
+#if CONFIG_SALESTAG_TELEMETRY
+    telem_adv_kick();
+#endif
+}
 
-        // If button has been held for more than 3 seconds, trigger power cycling (DISABLED - causes crashes)
-        if ((current_time - button_press_start) > 3000) {
-            ESP_LOGI(TAG, "Long button press detected - SD card power cycle DISABLED (causes crashes)");
-            // TODO: Fix race condition in sd_storage_power_cycle()
-            // esp_err_t power_cycle_ret = sd_storage_power_cycle();
-            // if (power_cycle_ret == ESP_OK) {
-            //     ESP_LOGI(TAG, "Manual SD card power cycle successful");
-            //     // Reset button press timer
-            //     button_press_start = 0;
-            //     return; // Don't proceed with normal recording
-            // } else {
-            //     ESP_LOGE(TAG, "Manual SD card power cycle failed: %s", esp_err_to_name(power_cycle_ret));
-            // }
-        }
+static void rec_finalized(const char *path) {
+    strlcpy(s_current_raw_file, path, sizeof(s_current_raw_file));
+    const char *name = strrchr(path, '/');
+    uint32_t id = rec_id_parse(name ? name + 1 : path);
+    rec_catalog_finalized(id);
+    struct stat st;
+    if (stat(path, &st) == 0) sync_state_added(id, (uint32_t)st.st_size);
+}
 
-        // === TOGGLE RECORDING LOGIC (Option A) ===
-        if (s_audio_capture_enabled) {
-            if (!s_is_recording) {
-                // START RECORDING
-                s_recording_count++;
-                const char *rec_dir = "/sdcard/rec";
-                snprintf(s_current_raw_file, sizeof(s_current_raw_file), "%s/ble_r%03d.raw", rec_dir, s_recording_count);
-                
-                ESP_LOGI(TAG, "🎤 Starting audio recording: %s", s_current_raw_file);
-                
-                // Stop BLE advertising to prevent interference
-                ble_stop_advertising();
-                
-                esp_err_t ret = raw_audio_storage_start_recording(s_current_raw_file);
-                
-                if (ret == ESP_OK) {
-                    ret = audio_capture_start();  // Actually start ADC sampling!
-                    if (ret == ESP_OK) {
-                        s_is_recording = true;
-                        ui_set_led(true);  // LED ON = Recording
-                        ESP_LOGI(TAG, "✅ Recording started successfully");
-                        return; // Skip file creation logic below
-                    } else {
-                        ESP_LOGE(TAG, "❌ Failed to start audio capture: %s", esp_err_to_name(ret));
-                        raw_audio_storage_stop_recording(); // Clean up file
-                        // Restart BLE advertising since recording failed
-                        ble_start_advertising_if_not_recording();
-                    }
-                } else {
-                    ESP_LOGE(TAG, "❌ Failed to start recording storage: %s", esp_err_to_name(ret));
-                    // Restart BLE advertising since recording failed
-                    ble_start_advertising_if_not_recording();
-                }
-            } else {
-                // STOP RECORDING
-                ESP_LOGI(TAG, "⏹️ Stopping audio recording...");
-                audio_capture_stop();  // Stop ADC sampling first
-                esp_err_t ret = raw_audio_storage_stop_recording();
-                
-                if (ret == ESP_OK) {
-                    s_is_recording = false;
-                    ui_set_led(false); // LED OFF = Not recording
-                    ESP_LOGI(TAG, "✅ Recording stopped: %s", s_current_raw_file);
-                    
-                    // Restart BLE advertising now that recording is finished
-                    ble_start_advertising_if_not_recording();
-                    
-                    return; // Skip file creation logic below
-                } else {
-                    ESP_LOGE(TAG, "❌ Failed to stop recording: %s", esp_err_to_name(ret));
-                }
-            }
-        }
+// Button callback: presses go to the recording controller, which owns the LED while it runs
+static void button_callback(bool pressed, uint32_t timestamp_ms, void *ctx) {
+    (void)ctx;  // Unused
+    
+    ESP_LOGI(TAG, "=== BUTTON CALLBACK === Button %s at %u ms", pressed ? "PRESSED" : "RELEASED", (unsigned)timestamp_ms);
+#if CONFIG_SALESTAG_DEEP_SLEEP
+    power_mgr_note_activity();
+#endif
+    if (!pressed) return;
 
-        if (s_audio_capture_enabled && !s_is_recording) {
-            // Start raw audio recording - store ADC samples directly
-            const char *rec_dir = "/sdcard/rec";
-            snprintf(s_current_raw_file, sizeof(s_current_raw_file), "%s/r%03d.raw", rec_dir, s_recording_count);
-            
-            // Stop BLE advertising to prevent interference
-            ble_stop_advertising();
-            
-            esp_err_t ret = raw_audio_storage_start_recording(s_current_raw_file);
-            if (ret == ESP_OK) {
-                ret = audio_capture_start();
-                if (ret == ESP_OK) {
-                    s_is_recording = true;
-                    ESP_LOGI(TAG, "Started raw audio recording: %s", s_current_raw_file);
-                } else {
-                    ESP_LOGE(TAG, "Failed to start audio capture: %s", esp_err_to_name(ret));
-                    raw_audio_storage_stop_recording();
-                    s_current_raw_file[0] = '\0';
-                    // Restart BLE advertising since recording failed
-                    ble_start_advertising_if_not_recording();
-                }
-            } else {
-                ESP_LOGE(TAG, "Failed to start raw audio storage: %s", esp_err_to_name(ret));
-                s_current_raw_file[0] = '\0';
-                // Restart BLE advertising since recording failed
-                ble_start_advertising_if_not_recording();
-            }
-        } else if (s_is_recording) {
-            // Stop raw audio recording
-            audio_capture_stop();
-            raw_audio_storage_stop_recording();
-            s_is_recording = false;
-            ESP_LOGI(TAG, "Stopped raw audio recording: %s", s_current_raw_file);
-            s_current_raw_file[0] = '\0';
-            
-            // Restart BLE advertising now that recording is finished
-            ble_start_advertising_if_not_recording();
+    if (sd_storage_is_available() && s_audio_capture_enabled) {
+        esp_err_t ret = rec_ctrl_button();
+        if (ret != ESP_OK) {
+            ESP_LOGW(TAG, "Button press dropped: %s", esp_err_to_name(ret));
         }
-    } else if (pressed && !sd_storage_is_available()) {
+    } else if (!sd_storage_is_available()) {
         // SD card not available - simple LED toggle mode
         static bool led_state = false;
         led_state = !led_state; // Toggle LED state
         ui_set_led(led_state);
         ESP_LOGI(TAG, "💡 LED toggled %s (SD card not available)", led_state ? "ON" : "OFF");
-    } else if (!pressed) {
-        // Button released - reset long press timer handled in press logic
-        ESP_LOGD(TAG, "Button released - reset long press timer");
-        
-        // Only update LED to reflect recording state when SD card is available
-        // When SD card unavailable, leave LED in toggle state set by button press
-        if (sd_storage_is_available()) {
-            ui_set_led(s_is_recording);
-        }
     }
 }
 
 // Define the advertising data and parameters
 static const uint8_t ble_addr_type = 0;
 
+#if CONFIG_BT_NIMBLE_EXT_ADV
+// With extended advertising built in, NimBLE takes no legacy advertising
+// calls: the connectable advertisement is instance 0 with legacy PDUs, so
+// every scanner still sees it (telem_adv.c is instance 1)
+#define BLE_ADV_INSTANCE 0
+
+static int ble_ext_set_fields(const struct ble_hs_adv_fields *fields, bool rsp)
+{
+    struct os_mbuf *buf = os_msys_get_pkthdr(BLE_HS_ADV_MAX_SZ, 0);
+    if (!buf) return BLE_HS_ENOMEM;
+    int rc = ble_hs_adv_set_fields_mbuf(fields, buf);
+    if (rc != 0) {
+        os_mbuf_free_chain(buf);
+        return rc;
+    }
+    return rsp ? ble_gap_ext_adv_rsp_set_data(BLE_ADV_INSTANCE, buf)
+               : ble_gap_ext_adv_set_data(BLE_ADV_INSTANCE, buf);
+}
+
+static int ble_ext_adv_start(const struct ble_hs_adv_fields *fields,
+                             const struct ble_hs_adv_fields *rsp_fields)
+{
+    struct ble_gap_ext_adv_params params;
+    memset(&params, 0, sizeof(params));
+    params.legacy_pdu = 1;
+    params.connectable = 1;
+    params.scannable = 1;
+    params.own_addr_type = ble_addr_type;
+    params.primary_phy = BLE_HCI_LE_PHY_1M;
+    params.secondary_phy = BLE_HCI_LE_PHY_1M;
+    params.channel_map = 0x07;
+    params.sid = BLE_ADV_INSTANCE;
+    params.tx_power = 127;
+    params.itvl_min = BLE_GAP_ADV_FAST_INTERVAL1_MIN;
+    params.itvl_max = BLE_GAP_ADV_FAST_INTERVAL1_MAX;
+
+    // Busy: the instance is already advertising
+    int rc = ble_gap_ext_adv_configure(BLE_ADV_INSTANCE, &params, NULL, ble_gap_event_handler, NULL);
+    if (rc == BLE_HS_EBUSY) return 0;
+    if (rc != 0) return rc;
+    rc = ble_ext_set_fields(fields, false);
+    if (rc != 0) return rc;
+    if (ble_ext_set_fields(rsp_fields, true) != 0) {
+        ESP_LOGW(TAG, "Failed to set scan response data");
+    }
+    rc = ble_gap_ext_adv_start(BLE_ADV_INSTANCE, 0, 0);
+    return rc == BLE_HS_EALREADY ? 0 : rc;
+}
+#endif
+
 // BLE advertising control functions
 static void ble_stop_advertising(void)
 {
     ESP_LOGI(TAG, "Stopping BLE advertising to prevent audio interference");
+#if CONFIG_BT_NIMBLE_EXT_ADV
+    int rc = ble_gap_ext_adv_stop(BLE_ADV_INSTANCE);
+#else
     int rc = ble_gap_adv_stop();
+#endif
     if (rc != 0) {
         ESP_LOGW(TAG, "Failed to stop advertising: %d", rc);
     } else {
@@ -504,8 +574,9 @@ static void ble_stop_advertising(void)
 
 static void ble_start_advertising_if_not_recording(void)
 {
-    ESP_LOGI(TAG, "ble_start_advertising_if_not_recording: recording=%d", s_is_recording);
-    if (!s_is_recording) {
+    bool recording = rec_ctrl_is_recording();
+    ESP_LOGI(TAG, "ble_start_advertising_if_not_recording: recording=%d", recording);
+    if (!recording) {
         ESP_LOGI(TAG, "Starting BLE advertising (not currently recording)");
         ble_app_advertise();
     } else {
@@ -525,13 +596,44 @@ static void ble_app_advertise(void)
     // Set advertising flags - use only general discoverable
     fields.flags = BLE_HS_ADV_F_DISC_GEN;
 
-    // Set the device name in the advertising packet
+    // The name goes in the scan response only: flags and the sync state fill
+    // the 31-byte advertisement
     const char *name = "ESP32-S3-Mini-BLE";
-    fields.name = (uint8_t *)name;
-    fields.name_len = strlen(name);
-    fields.name_is_complete = 1;
 
-    ESP_LOGI(TAG, "Setting advertising data - name: '%s' (len: %d)", name, fields.name_len);
+    // Manufacturer data: battery and what is waiting to be synced (adv_state.h),
+    // so scanners and docks can choose without connecting. Refreshed whenever
+    // advertising restarts.
+    adv_state_t adv = { .battery_pct = ADV_STATE_BATTERY_UNKNOWN };
+#if CONFIG_SALESTAG_BATTERY_MONITOR
+    battery_status_t batt;
+    battery_monitor_get(&batt);
+    if (batt.valid) adv.battery_pct = batt.pct;
+#endif
+    sync_state_get(&adv);
+    static uint8_t mfg_data[ADV_STATE_LEN];
+    fields.mfg_data = mfg_data;
+    fields.mfg_data_len = adv_state_encode(&adv, mfg_data, sizeof(mfg_data));
+
+    ESP_LOGI(TAG, "Setting advertising data - %u un-synced (%lu KB), battery %u",
+             adv.pending_count, (unsigned long)adv.pending_kb, adv.battery_pct);
+
+    // Scan response data (optional, but helps with discovery)
+    struct ble_hs_adv_fields scan_rsp_fields;
+    memset(&scan_rsp_fields, 0, sizeof(scan_rsp_fields));
+    scan_rsp_fields.name = (uint8_t *)name;
+    scan_rsp_fields.name_len = strlen(name);
+    scan_rsp_fields.name_is_complete = 1;
+
+#if CONFIG_BT_NIMBLE_EXT_ADV
+    (void)adv_params;
+    rc = ble_ext_adv_start(&fields, &scan_rsp_fields);
+    if (rc != 0) {
+        ESP_LOGE(TAG, "Failed to start advertising: %d", rc);
+        return;
+    }
+    ESP_LOGI(TAG, "Advertising started successfully (instance %d)", BLE_ADV_INSTANCE);
+    return;
+#endif
 
     // Set the advertising data
     rc = ble_gap_adv_set_fields(&fields);
@@ -540,13 +642,6 @@ static void ble_app_advertise(void)
         return;
     }
 
-    // Set scan response data (optional, but helps with discovery)
-    struct ble_hs_adv_fields scan_rsp_fields;
-    memset(&scan_rsp_fields, 0, sizeof(scan_rsp_fields));
-    scan_rsp_fields.name = (uint8_t *)name;
-    scan_rsp_fields.name_len = strlen(name);
-    scan_rsp_fields.name_is_complete = 1;
-    
     rc = ble_gap_adv_rsp_set_fields(&scan_rsp_fields);
     if (rc != 0) {
         ESP_LOGW(TAG, "Failed to set scan response data: %d", rc);
@@ -582,6 +677,9 @@ static void ble_app_on_sync(void)
 {
     ESP_LOGI(TAG, "BLE Host Stack is synchronized.");
     ble_start_advertising_if_not_recording();
+#if CONFIG_SALESTAG_TELEMETRY
+    telem_adv_start();
+#endif
 }
 
 static void gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg) {
@@ -630,10 +728,27 @@ static void ble_app_on_connect(struct ble_gap_event *event, void *arg)
              desc.peer_ota_addr.val[3], desc.peer_ota_addr.val[2],
              desc.peer_ota_addr.val[1], desc.peer_ota_addr.val[0]);
     
+#if CONFIG_SALESTAG_DEEP_SLEEP
+    if (event->connect.status == 0) {
+        if (s_wake_connect_us && s_last_peer.peer_valid &&
+            memcmp(s_last_peer.peer_addr, desc.peer_ota_addr.val, sizeof(s_last_peer.peer_addr)) == 0) {
+            ESP_LOGI(TAG, "Previous central reconnected %lld ms after wake",
+                     (long long)((esp_timer_get_time() - s_wake_connect_us) / 1000));
+        }
+        s_wake_connect_us = 0;
+        s_last_peer.peer_valid = 1;
+        s_last_peer.peer_addr_type = desc.peer_ota_addr.type;
+        memcpy(s_last_peer.peer_addr, desc.peer_ota_addr.val, sizeof(s_last_peer.peer_addr));
+    }
+#endif
+
     // Store connection handle for file transfer notifications (only on successful connect)
     if (event->connect.status == 0) {
         s_file_transfer_conn_handle = event->connect.conn_handle;
         ESP_LOGI(TAG, "File transfer connection handle stored: %d", s_file_transfer_conn_handle);
+        // Start on legacy ATT; upgraded as EATT channels come up
+        s_eatt_chans_up = 0;
+        credits_configure();
     } else {
         s_file_transfer_conn_handle = 0;
     }
@@ -657,9 +772,16 @@ static void ble_app_on_disconnect(struct ble_gap_event *event, void *arg)
     s_bytes_sent = 0;
     s_seq = 0;
     s_file_transfer_offset = 0;
+#if CONFIG_SALESTAG_FEC
+    s_fec_r = 0;  // FEC is per connection
+#endif
     
     // Clear subscription mask
     s_cccd_mask = 0;
+
+    // Back to the legacy bearer's window with all credits free
+    s_eatt_chans_up = 0;
+    credits_configure();
     
     // Restart advertising after disconnect (only if not recording)
     ble_start_advertising_if_not_recording();
@@ -716,11 +838,11 @@ static int ble_gap_event_handler(struct ble_gap_event *event, void *arg)
     case BLE_GAP_EVENT_NOTIFY_TX: {
         // Return a credit for successful DATA notifies
         if (event->notify_tx.attr_handle == s_file_transfer_data_handle) {
-            if (event->notify_tx.status == 0 && s_notify_sem) {
-                BaseType_t xHigher = pdFALSE;
-                xSemaphoreGiveFromISR(s_notify_sem, &xHigher);
+            if (FI_HIT(FI_NOTIFY_TX_LOST, 0)) {
+                ESP_LOGW(TAG, "Injected lost NOTIFY_TX - credit not returned");
+            } else if (event->notify_tx.status == 0) {
+                return_data_credit();
                 ESP_LOGI(TAG, "Credit returned: TX complete for data handle");
-                portYIELD_FROM_ISR(xHigher);
             }
         }
 #if FILE_XFER_VERBOSE
@@ -733,6 +855,13 @@ static int ble_gap_event_handler(struct ble_gap_event *event, void *arg)
     case BLE_GAP_EVENT_CONN_UPDATE:
         ESP_LOGI(TAG, "Connection parameters updated");
         break;
+
+#ifdef BLE_GAP_EVENT_EATT
+    case BLE_GAP_EVENT_EATT:
+        // Status 0: a channel connected; otherwise it was released or failed to connect
+        eatt_chan_update(event->eatt.cid, event->eatt.status == 0);
+        break;
+#endif
         
     case BLE_GAP_EVENT_CONN_UPDATE_REQ:
         ESP_LOGI(TAG, "Connection update request received");
@@ -775,7 +904,7 @@ static int gatt_svr_chr_access(uint16_t conn_handle, uint16_t attr_handle,
     case BLE_UUID_SALESTAG_RECORD_CTRL:
         if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR) {
             // Return current recording state (read-only now - writes disabled)
-            uint8_t recording_state = s_is_recording ? 1 : 0;
+            uint8_t recording_state = rec_ctrl_is_recording() ? 1 : 0;
             rc = os_mbuf_append(ctxt->om, &recording_state, sizeof(recording_state));
             ESP_LOGI(TAG, "Record control read: state=%d (use physical button to control)", recording_state);
             return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
@@ -804,22 +933,35 @@ static int gatt_svr_chr_access(uint16_t conn_handle, uint16_t attr_handle,
         
     case BLE_UUID_SALESTAG_STATUS:
         if (ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR) {
-            // Return device status information
-            struct {
-                uint8_t audio_enabled;
-                uint8_t sd_available;
-                uint8_t recording;
-                uint32_t total_files;
-            } status = {
-                .audio_enabled = s_audio_capture_enabled ? 1 : 0,
-                .sd_available = sd_storage_is_available() ? 1 : 0,
-                .recording = s_is_recording ? 1 : 0,
-                .total_files = s_recording_count
+            // Return device status information: 11 bytes, little-endian
+            //   0 audio_enabled, 1 sd_available, 2 recording, 3 reserved (0),
+            //   4-7 total_files, 8-9 battery_mv (0 = not measured),
+            //   10 battery_pct (0xFF = not measured)
+            // Bytes 0-7 are the original status, so older clients keep working
+            uint16_t battery_mv = 0;
+            uint8_t battery_pct = 0xFF;
+#if CONFIG_SALESTAG_BATTERY_MONITOR
+            battery_status_t batt;
+            battery_monitor_get(&batt);
+            if (batt.valid) {
+                battery_mv = batt.cell_mv;
+                battery_pct = batt.pct;
+            }
+#endif
+            uint32_t files = s_recording_count;
+            uint8_t status[11] = {
+                s_audio_capture_enabled ? 1 : 0,
+                sd_storage_is_available() ? 1 : 0,
+                rec_ctrl_is_recording() ? 1 : 0,
+                0,
+                (uint8_t)files, (uint8_t)(files >> 8), (uint8_t)(files >> 16), (uint8_t)(files >> 24),
+                (uint8_t)battery_mv, (uint8_t)(battery_mv >> 8),
+                battery_pct,
             };
             
-            rc = os_mbuf_append(ctxt->om, &status, sizeof(status));
-            ESP_LOGI(TAG, "Status read: audio=%d, sd=%d, recording=%d, files=%u", 
-                     status.audio_enabled, status.sd_available, status.recording, (unsigned)status.total_files);
+            rc = os_mbuf_append(ctxt->om, status, sizeof(status));
+            ESP_LOGI(TAG, "Status read: audio=%d, sd=%d, recording=%d, files=%u, battery=%u%%", 
+                     status[0], status[1], status[2], (unsigned)files, battery_pct);
             return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
         }
         break;
@@ -855,109 +997,116 @@ static int gatt_svr_chr_access(uint16_t conn_handle, uint16_t attr_handle,
     case BLE_UUID_SALESTAG_FILE_CTRL:
         if (ctxt->op == BLE_GATT_ACCESS_OP_WRITE_CHR) {
             // Handle file transfer control commands - variable length based on command
-            if (ctxt->om->om_len < 1) {
-                ESP_LOGW(TAG, "Invalid file control write length: %d (minimum 1)", ctxt->om->om_len);
+            uint16_t om_len = OS_MBUF_PKTLEN(ctxt->om);
+            uint8_t buf[1 + FT_MAX_FILENAME];
+            if (om_len < 1 || om_len > sizeof(buf)) {
+                ESP_LOGW(TAG, "Invalid file control write length: %d", om_len);
                 return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
             }
 
-            uint8_t cmd;
-            rc = ble_hs_mbuf_to_flat(ctxt->om, &cmd, sizeof(cmd), NULL);
+            rc = ble_hs_mbuf_to_flat(ctxt->om, buf, sizeof(buf), NULL);
             if (rc != 0) {
                 return BLE_ATT_ERR_UNLIKELY;
             }
 
-            ESP_LOGI(TAG, "File control write: cmd=0x%02x, len=%d", cmd, ctxt->om->om_len);
+            ft_ctrl_req_t req;
+            ft_parse_result_t pr = ft_ctrl_parse(buf, om_len, &req);
+            ESP_LOGI(TAG, "File control write: cmd=0x%02x, len=%d", req.cmd, om_len);
+
+            if (pr == FT_PARSE_BAD_LEN) {
+                ESP_LOGW(TAG, "Bad payload length %d for command 0x%02x", om_len, req.cmd);
+                return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+            }
+            if (pr == FT_PARSE_BAD_CMD) {
+                ESP_LOGW(TAG, "Unknown file transfer command: 0x%02x", req.cmd);
+                send_status(STAT_BAD_CMD);
+                return 0; // Return success, error communicated via status
+            }
+            if (pr == FT_PARSE_BAD_NAME) {
+                ESP_LOGW(TAG, "Invalid filename requested (len=%d)", om_len - 1);
+                send_status(STAT_BAD_CMD);
+                return 0;
+            }
 
-            switch (cmd) {
+            switch (req.cmd) {
             case FILE_TRANSFER_CMD_START:
-                if (ctxt->om->om_len != 1) {
-                    ESP_LOGW(TAG, "START command should have no additional data (len=%d)", ctxt->om->om_len);
-                    return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
-                }
                 return file_transfer_start();
 
-            case FILE_TRANSFER_CMD_SELECT_FILE: {
-                if (ctxt->om->om_len != 2) {
-                    ESP_LOGW(TAG, "SELECT_FILE command needs 1-byte index (len=%d)", ctxt->om->om_len);
-                    return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
-                }
-
-                uint8_t file_index;
-                // Extract the file index from the second byte (skip command byte)
-                uint8_t *data_ptr = ctxt->om->om_data + 1; // Skip command byte
-                file_index = *data_ptr;
-
-                ESP_LOGI(TAG, "SELECT_FILE: index=%d", file_index);
-                return file_transfer_select_file(file_index);
-            }
+            case FILE_TRANSFER_CMD_SELECT_FILE:
+                ESP_LOGI(TAG, "SELECT_FILE: index=%d", req.index);
+                return file_transfer_select_file(req.index);
 
             case FILE_TRANSFER_CMD_LIST_FILES:
-                if (ctxt->om->om_len != 1) {
-                    ESP_LOGW(TAG, "LIST_FILES command should have no additional data (len=%d)", ctxt->om->om_len);
-                    return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
-                }
                 return file_transfer_list_files();
 
-            case FILE_TRANSFER_CMD_START_WITH_FILENAME: {
-                if (ctxt->om->om_len < 2) {
-                    ESP_LOGW(TAG, "START_WITH_FILENAME command needs filename data (len=%d)", ctxt->om->om_len);
-                    return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
-                }
-
-                // Extract filename from the remaining data
-                size_t filename_len = ctxt->om->om_len - 1;
-                char requested_filename[SD_MAX_PATH] = {0};
+            case FILE_TRANSFER_CMD_START_WITH_FILENAME:
+                ESP_LOGI(TAG, "START_WITH_FILENAME: '%s'", req.filename);
+                return file_transfer_start_with_filename(req.filename, FT_VARIANT_RAW);
 
-                if (filename_len >= sizeof(requested_filename)) {
-                    ESP_LOGW(TAG, "Filename too long: %d bytes", filename_len);
-                    return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
-                }
+            case FILE_TRANSFER_CMD_START_BY_ID:
+                ESP_LOGI(TAG, "START_BY_ID: %lu variant %u", (unsigned long)req.rec_id, req.variant);
+                return file_transfer_start_by_id(req.rec_id, req.variant);
 
-                // Copy filename data (skip the command byte by using offset)
-                uint8_t *data_ptr = ctxt->om->om_data + 1; // Skip command byte
-                memcpy(requested_filename, data_ptr, filename_len);
+            case FILE_TRANSFER_CMD_PULL:
+                ESP_LOGI(TAG, "PULL: %lu variant %u block %u", (unsigned long)req.rec_id, req.variant,
+                         req.pull_block);
+                return file_transfer_pull(req.rec_id, req.variant, req.pull_block);
 
-                // Ensure null termination
-                requested_filename[filename_len] = '\0';
-
-                ESP_LOGI(TAG, "START_WITH_FILENAME: '%s'", requested_filename);
-
-                // Validate filename (basic security check)
-                if (!is_valid_filename(requested_filename)) {
-                    ESP_LOGW(TAG, "Invalid filename requested: '%s'", requested_filename);
-                    send_status(STAT_BAD_CMD);
-                    return 0;
-                }
-
-                // Start transfer with specific filename
-                return file_transfer_start_with_filename(requested_filename);
+            case FILE_TRANSFER_CMD_READ_BLOCKS: {
+                // Served by the worker's pull session; logged there, not per request
+                ft_msg_t m = { .type = FT_CMD_READ_BLOCKS, .block = req.block, .count = req.count };
+                if (s_ft_q && xQueueSend(s_ft_q, &m, 0) != pdTRUE) send_status(STAT_PULL_OVERRUN);
+                return 0;
             }
 
+            case FILE_TRANSFER_CMD_FORMAT:
+                ESP_LOGW(TAG, "FORMAT: %u KB clusters", req.cluster_kb);
+                return file_transfer_format(req.cluster_kb);
+
             case FILE_TRANSFER_CMD_PAUSE:
-                if (ctxt->om->om_len != 1) {
-                    ESP_LOGW(TAG, "PAUSE command should have no additional data (len=%d)", ctxt->om->om_len);
-                    return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
-                }
                 return file_transfer_pause();
 
             case FILE_TRANSFER_CMD_RESUME:
-                if (ctxt->om->om_len != 1) {
-                    ESP_LOGW(TAG, "RESUME command should have no additional data (len=%d)", ctxt->om->om_len);
-                    return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
-                }
                 return file_transfer_resume();
 
             case FILE_TRANSFER_CMD_STOP:
-                if (ctxt->om->om_len != 1) {
-                    ESP_LOGW(TAG, "STOP command should have no additional data (len=%d)", ctxt->om->om_len);
-                    return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
-                }
                 return file_transfer_stop();
 
-            default:
-                ESP_LOGW(TAG, "Unknown file transfer command: 0x%02x", cmd);
-                send_status(STAT_BAD_CMD);
-                return 0; // Return success, error communicated via status
+            case FILE_TRANSFER_CMD_PROFILE:
+#if CONFIG_SALESTAG_PROFILER
+                ESP_LOGI(TAG, "PROFILE: %u s window", req.seconds);
+                send_status(cpu_profiler_start(req.seconds * 1000U, profiler_done) == ESP_OK
+                            ? STAT_PROFILE_STARTED : STAT_PROFILE_FAIL);
+#else
+                ESP_LOGW(TAG, "PROFILE: profiler not enabled in this build");
+                send_status(STAT_PROFILE_FAIL);
+#endif
+                return 0;
+
+            case FILE_TRANSFER_CMD_SET_FEC:
+#if CONFIG_SALESTAG_FEC
+                if (s_file_transfer_active) {
+                    ESP_LOGW(TAG, "SET_FEC: refused during a transfer");
+                    send_status(STAT_BUSY);
+                    return 0;
+                }
+                s_fec_k = req.fec_k;
+                s_fec_r = req.fec_r;
+                ESP_LOGI(TAG, "SET_FEC: k=%u r=%u", s_fec_k, s_fec_r);
+                send_status(STAT_FEC_SET);
+#else
+                ESP_LOGW(TAG, "SET_FEC: FEC not enabled in this build");
+                send_status(STAT_FEC_UNAVAILABLE);
+#endif
+                return 0;
+
+            case FILE_TRANSFER_CMD_SYNC_ACK: {
+                // The CRC check reads the whole file: the worker does it between transfers
+                ESP_LOGI(TAG, "SYNC_ACK: %lu crc=0x%08lx", (unsigned long)req.rec_id, (unsigned long)req.crc32c);
+                ft_msg_t m = { .type = FT_CMD_SYNC_ACK, .rec_id = req.rec_id, .crc32c = req.crc32c };
+                if (s_ft_q) xQueueSend(s_ft_q, &m, 0);  // non-blocking
+                return 0;
+            }
             }
         }
         break;
@@ -984,34 +1133,12 @@ static int gatt_svr_chr_access(uint16_t conn_handle, uint16_t attr_handle,
 
 // File transfer helper functions implementation
 
-// Filename validation function for basic security
-static bool is_valid_filename(const char *filename) {
-    if (!filename || filename[0] == '\0') {
-        return false;
-    }
-
-    size_t len = strlen(filename);
-
-    // Check length constraints
-    if (len > 255 || len < 1) {
-        return false;
-    }
-
-    // Allow only alphanumeric characters, dots, underscores, and hyphens
-    // This is a basic security measure to prevent path traversal attacks
-    for (size_t i = 0; i < len; i++) {
-        char c = filename[i];
-        if (!isalnum(c) && c != '.' && c != '_' && c != '-') {
-            return false;
-        }
-    }
-
-    // Check for obvious path traversal attempts
-    if (strstr(filename, "..") != NULL || strstr(filename, "/") != NULL || strstr(filename, "\\") != NULL) {
-        return false;
-    }
-
-    return true;
+// Newest-first order: recording IDs first (highest wins), then older names by mtime
+static bool rec_file_newer(const char *a, time_t a_mtime, const char *b, time_t b_mtime) {
+    uint32_t a_id = rec_id_parse(a);
+    uint32_t b_id = rec_id_parse(b);
+    if (a_id != REC_ID_NONE || b_id != REC_ID_NONE) return a_id > b_id;
+    return a_mtime > b_mtime;
 }
 
 // List available .raw files for BLE reading
@@ -1026,8 +1153,8 @@ static int list_available_raw_files(struct os_mbuf *om) {
     return (rc == 0) ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
 }
 
-// File transfer start with specific filename
-static int file_transfer_start_with_filename(const char *requested_filename) {
+// Check a transfer request for a named file and hand it to the worker
+static int file_transfer_request(const char *requested_filename, const ft_msg_t *m) {
     if (s_file_transfer_active) {
         ESP_LOGW(TAG, "File transfer already active");
         send_status(STAT_ALREADY_RUNNING);
@@ -1035,12 +1162,19 @@ static int file_transfer_start_with_filename(const char *requested_filename) {
     }
 
     // Prevent file transfer from starting during recording
-    if (s_is_recording) {
+    if (rec_ctrl_is_recording()) {
         ESP_LOGW(TAG, "File transfer blocked - recording in progress");
         send_status(STAT_BUSY);
         return 0;
     }
 
+    // The card may be mid-mkfs or remounting
+    if (s_formatting) {
+        ESP_LOGW(TAG, "File transfer blocked - card being formatted");
+        send_status(STAT_BUSY);
+        return 0;
+    }
+
     // Check if both DATA and STATUS characteristics are subscribed
     if (!notifies_ready()) {
         send_status(STAT_SUBSCRIPTION_REQUIRED);
@@ -1056,13 +1190,9 @@ static int file_transfer_start_with_filename(const char *requested_filename) {
 
     // Construct full path for requested filename
     char full_path[SD_MAX_PATH] = {0};
-    const char *rec_dir = "/sdcard/rec";
-    if (strstr(requested_filename, ".raw")) {
-        // Filename already includes .raw extension
-        snprintf(full_path, sizeof(full_path), "%s/%s", rec_dir, requested_filename);
-    } else {
-        // Add .raw extension
-        snprintf(full_path, sizeof(full_path), "%s/%s.raw", rec_dir, requested_filename);
+    if (!ft_resolve_path(SD_REC_DIR, requested_filename, full_path, sizeof(full_path))) {
+        send_status(STAT_BAD_CMD);
+        return 0;
     }
 
     ESP_LOGI(TAG, "Requested filename: '%s' -> full path: '%s'", requested_filename, full_path);
@@ -1096,12 +1226,38 @@ static int file_transfer_start_with_filename(const char *requested_filename) {
     ESP_LOGI(TAG, "Set transfer filename to: %s", s_current_raw_file);
 
     // Enqueue the start command to worker task
-    ft_msg_t m = { .type = FT_CMD_START };
-    if (s_ft_q) xQueueSend(s_ft_q, &m, 0);  // non-blocking
+    if (s_ft_q) xQueueSend(s_ft_q, m, 0);  // non-blocking
 
     return 0; // success
 }
 
+// File transfer start with specific filename
+static int file_transfer_start_with_filename(const char *requested_filename, uint8_t variant) {
+    ft_msg_t m = { .type = FT_CMD_START, .variant = variant };
+    return file_transfer_request(requested_filename, &m);
+}
+
+// Recording IDs map straight to file names; no directory scan
+static int file_transfer_start_by_id(uint32_t rec_id, uint8_t variant) {
+    char name[REC_ID_NAME_LEN];
+    if (!rec_id_format(rec_id, name, sizeof(name))) {
+        send_status(STAT_BAD_CMD);
+        return 0;
+    }
+    return file_transfer_start_with_filename(name, variant);
+}
+
+// Same checks as START_BY_ID; the worker then answers READ_BLOCKS instead of pushing
+static int file_transfer_pull(uint32_t rec_id, uint8_t variant, uint8_t block) {
+    char name[REC_ID_NAME_LEN];
+    if (!rec_id_format(rec_id, name, sizeof(name))) {
+        send_status(STAT_BAD_CMD);
+        return 0;
+    }
+    ft_msg_t m = { .type = FT_CMD_PULL, .variant = variant, .pull_block = block };
+    return file_transfer_request(name, &m);
+}
+
 static int file_transfer_start(void)
 {
     if (s_file_transfer_active) {
@@ -1111,12 +1267,19 @@ static int file_transfer_start(void)
     }
 
     // Prevent file transfer from starting during recording
-    if (s_is_recording) {
+    if (rec_ctrl_is_recording()) {
         ESP_LOGW(TAG, "File transfer blocked - recording in progress");
         send_status(STAT_BUSY);
         return 0;
     }
 
+    // The card may be mid-mkfs or remounting
+    if (s_formatting) {
+        ESP_LOGW(TAG, "File transfer blocked - card being formatted");
+        send_status(STAT_BUSY);
+        return 0;
+    }
+
     // Check if both DATA and STATUS characteristics are subscribed
     if (!notifies_ready()) {
         send_status(STAT_SUBSCRIPTION_REQUIRED);
@@ -1173,15 +1336,16 @@ static int file_transfer_resume(void)
     return 0;
 }
 
-// Static buffer to avoid stack overflow in auto-selection function
-static char s_auto_select_buffer[1024] = {0};
+// AUTO_SELECT_LIST path and response buffers, from the memory plan (start_file_xfer_task)
+#define AUTO_SELECT_NAME_MAX 128
+#define AUTO_SELECT_RSP_MAX  (sizeof("LATEST:::\n") + AUTO_SELECT_NAME_MAX + 2 * 10)
+static char *s_auto_select_path = NULL;     // SD_MAX_PATH bytes
+static char *s_auto_select_rsp = NULL;      // AUTO_SELECT_RSP_MAX bytes
 
 // Auto-selection file list - returns latest file info for auto-selection
 static int list_auto_select_files(struct os_mbuf *om) {
     ESP_LOGI(TAG, "Auto-selection file list request received");
-
-    // Use static buffer to avoid stack overflow
-    memset(s_auto_select_buffer, 0, sizeof(s_auto_select_buffer));
+    if (!s_auto_select_path || !s_auto_select_rsp) return BLE_ATT_ERR_INSUFFICIENT_RES;
 
     // Check if SD card is available
     if (!sd_storage_is_available()) {
@@ -1201,9 +1365,10 @@ static int list_auto_select_files(struct os_mbuf *om) {
     }
 
     struct dirent *entry;
-    char latest_file[128] = {0};  // Reduced size
+    char latest_file[AUTO_SELECT_NAME_MAX] = {0};
     time_t latest_time = 0;
     uint32_t file_count = 0;
+    bool have_latest = false;
 
     // Scan directory for .raw files and find the latest one
     while ((entry = readdir(dir)) != NULL) {
@@ -1212,11 +1377,10 @@ static int list_auto_select_files(struct os_mbuf *om) {
         char *ext = strrchr(entry->d_name, '.');
         if (!ext || strcmp(ext, ".raw") != 0) continue;
 
-        // Use static buffer for full path
-        char *full_path = s_auto_select_buffer;
-        size_t path_len = snprintf(full_path, sizeof(s_auto_select_buffer), "%s/%s", rec_dir, entry->d_name);
+        char *full_path = s_auto_select_path;
+        size_t path_len = snprintf(full_path, SD_MAX_PATH, "%s/%s", rec_dir, entry->d_name);
 
-        if (path_len >= sizeof(s_auto_select_buffer)) {
+        if (path_len >= SD_MAX_PATH) {
             ESP_LOGW(TAG, "Path too long, skipping: %s", entry->d_name);
             continue;
         }
@@ -1224,7 +1388,8 @@ static int list_auto_select_files(struct os_mbuf *om) {
         struct stat st;
         if (stat(full_path, &st) == 0 && S_ISREG(st.st_mode)) {
             file_count++;
-            if (st.st_mtime > latest_time) {
+            if (!have_latest || rec_file_newer(entry->d_name, st.st_mtime, latest_file, latest_time)) {
+                have_latest = true;
                 latest_time = st.st_mtime;
                 strncpy(latest_file, entry->d_name, sizeof(latest_file) - 1);
                 latest_file[sizeof(latest_file) - 1] = '\0';
@@ -1239,20 +1404,19 @@ static int list_auto_select_files(struct os_mbuf *om) {
         return (rc == 0) ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
     }
 
-    // Get file size for the latest file using static buffer
-    char *full_path = s_auto_select_buffer;
-    snprintf(full_path, sizeof(s_auto_select_buffer), "%s/%s", rec_dir, latest_file);
+    // Get file size for the latest file
+    char *full_path = s_auto_select_path;
+    snprintf(full_path, SD_MAX_PATH, "%s/%s", rec_dir, latest_file);
     struct stat st;
     uint32_t file_size = 0;
     if (stat(full_path, &st) == 0) {
         file_size = st.st_size;
     }
 
-    // Format response using static buffer
-    char *response = s_auto_select_buffer + 256;  // Use different part of buffer
-    int len = snprintf(response, sizeof(s_auto_select_buffer) - 256, "LATEST:%s:%lu:%lu\n", latest_file, (unsigned long)file_size, (unsigned long)file_count);
+    char *response = s_auto_select_rsp;
+    int len = snprintf(response, AUTO_SELECT_RSP_MAX, "LATEST:%s:%lu:%lu\n", latest_file, (unsigned long)file_size, (unsigned long)file_count);
 
-    if (len >= (int)(sizeof(s_auto_select_buffer) - 256)) {
+    if (len >= (int)AUTO_SELECT_RSP_MAX) {
         const char *msg = "Response too long\n";
         int rc = os_mbuf_append(om, msg, strlen(msg));
         return (rc == 0) ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
@@ -1273,6 +1437,18 @@ static int file_transfer_list_files(void) {
     return 0;
 }
 
+// SELECT_FILE addresses the newest recordings by index; the list is kept in
+// the arena so a selection never touches the heap
+#define FT_SELECT_MAX       64
+#define FT_SELECT_NAME_MAX  64      // Firmware names are well under this
+
+typedef struct {
+    char name[FT_SELECT_MAX][FT_SELECT_NAME_MAX];
+    time_t mtime[FT_SELECT_MAX];
+} ft_select_list_t;
+
+static ft_select_list_t *s_select = NULL;
+
 // SELECT_FILE command - select file by index from auto-selection list
 static int file_transfer_select_file(uint8_t file_index) {
     ESP_LOGI(TAG, "SELECT_FILE command received, index: %d", file_index);
@@ -1284,12 +1460,19 @@ static int file_transfer_select_file(uint8_t file_index) {
     }
 
     // Prevent file transfer from starting during recording
-    if (s_is_recording) {
+    if (rec_ctrl_is_recording()) {
         ESP_LOGW(TAG, "File transfer blocked - recording in progress");
         send_status(STAT_BUSY);
         return 0;
     }
 
+    // The card may be mid-mkfs or remounting
+    if (s_formatting) {
+        ESP_LOGW(TAG, "File transfer blocked - card being formatted");
+        send_status(STAT_BUSY);
+        return 0;
+    }
+
     // Check if both DATA and STATUS characteristics are subscribed
     if (!notifies_ready()) {
         send_status(STAT_SUBSCRIPTION_REQUIRED);
@@ -1312,84 +1495,66 @@ static int file_transfer_select_file(uint8_t file_index) {
     }
 
     struct dirent *entry;
-    char *raw_files[256]; // Support up to 256 files
+    ft_select_list_t *sel = s_select;
     uint32_t file_count = 0;
-    time_t *file_times = calloc(256, sizeof(time_t));
+    uint32_t kept = 0;
 
-    if (!file_times) {
-        closedir(dir);
-        send_status(STAT_FILE_OPEN_FAIL);
-        return 0;
-    }
-
-    // Collect all .raw files with their modification times
-    while ((entry = readdir(dir)) != NULL && file_count < 256) {
+    // Keep the newest FT_SELECT_MAX .raw files, newest first, as they are found
+    while ((entry = readdir(dir)) != NULL) {
         if (entry->d_type != DT_REG) continue;
 
         char *ext = strrchr(entry->d_name, '.');
         if (!ext || strcmp(ext, ".raw") != 0) continue;
+        if (strlen(entry->d_name) >= FT_SELECT_NAME_MAX) {
+            ESP_LOGW(TAG, "Name too long to select, skipping: %s", entry->d_name);
+            continue;
+        }
 
         char full_path[SD_MAX_PATH];
         snprintf(full_path, sizeof(full_path), "%s/%s", rec_dir, entry->d_name);
 
         struct stat st;
-        if (stat(full_path, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
-            raw_files[file_count] = strdup(entry->d_name);
-            file_times[file_count] = st.st_mtime;
-            file_count++;
+        if (stat(full_path, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) continue;
+        file_count++;
+
+        uint32_t pos = kept;
+        while (pos > 0 && rec_file_newer(entry->d_name, st.st_mtime, sel->name[pos - 1], sel->mtime[pos - 1])) {
+            pos--;
         }
+        if (pos >= FT_SELECT_MAX) continue;
+        // Shift the older ones down, dropping the oldest when the list is full
+        uint32_t last = kept < FT_SELECT_MAX ? kept : FT_SELECT_MAX - 1;
+        memmove(sel->name[pos + 1], sel->name[pos], (last - pos) * FT_SELECT_NAME_MAX);
+        memmove(&sel->mtime[pos + 1], &sel->mtime[pos], (last - pos) * sizeof(time_t));
+        strcpy(sel->name[pos], entry->d_name);
+        sel->mtime[pos] = st.st_mtime;
+        if (kept < FT_SELECT_MAX) kept++;
     }
     closedir(dir);
 
     if (file_count == 0) {
-        free(file_times);
         ESP_LOGW(TAG, "No .raw files found for selection");
         send_status(STAT_NO_FILE);
         return 0;
     }
 
-    // Sort files by modification time (newest first)
-    for (uint32_t i = 0; i < file_count - 1; i++) {
-        for (uint32_t j = i + 1; j < file_count; j++) {
-            if (file_times[j] > file_times[i]) {
-                // Swap times
-                time_t temp_time = file_times[i];
-                file_times[i] = file_times[j];
-                file_times[j] = temp_time;
-                // Swap filenames
-                char *temp_name = raw_files[i];
-                raw_files[i] = raw_files[j];
-                raw_files[j] = temp_name;
-            }
-        }
-    }
-
     // Check if index is valid
-    if (file_index >= file_count) {
-        ESP_LOGW(TAG, "Invalid file index: %d (max: %lu)", file_index, (unsigned long)(file_count - 1));
-        for (uint32_t i = 0; i < file_count; i++) {
-            free(raw_files[i]);
-        }
-        free(file_times);
+    if (file_index >= kept) {
+        ESP_LOGW(TAG, "Invalid file index: %d (max: %lu of %lu files)", file_index,
+                 (unsigned long)(kept - 1), (unsigned long)file_count);
         send_status(STAT_INVALID_INDEX);
         return 0;
     }
 
     // Construct full path for selected file
     char full_path[SD_MAX_PATH];
-    snprintf(full_path, sizeof(full_path), "%s/%s", rec_dir, raw_files[file_index]);
+    snprintf(full_path, sizeof(full_path), "%s/%s", rec_dir, sel->name[file_index]);
 
     // Set the selected filename for transfer
     strncpy(s_current_raw_file, full_path, sizeof(s_current_raw_file) - 1);
     s_current_raw_file[sizeof(s_current_raw_file) - 1] = '\0';
 
-    ESP_LOGI(TAG, "Selected file %d: %s -> %s", file_index, raw_files[file_index], s_current_raw_file);
-
-    // Clean up
-    for (uint32_t i = 0; i < file_count; i++) {
-        free(raw_files[i]);
-    }
-    free(file_times);
+    ESP_LOGI(TAG, "Selected file %d: %s -> %s", file_index, sel->name[file_index], s_current_raw_file);
 
     // Send success status
     send_status(STAT_FILE_SELECTED);
@@ -1423,6 +1588,7 @@ static void update_payload_len(uint16_t mtu)
 static void send_status(uint8_t code) {
     uint8_t b[1] = { code };
     if (!s_file_transfer_conn_handle || !s_file_transfer_status_handle) return;
+    // Not credit-gated: status must get out while the window is full of file data
     struct os_mbuf *om = ble_hs_mbuf_from_flat(b, sizeof(b));
     if (om) ble_gatts_notify_custom(s_file_transfer_conn_handle, s_file_transfer_status_handle, om);
 }
@@ -1431,15 +1597,71 @@ static inline bool notifies_ready(void) {
     return (s_cccd_mask & 0x03) == 0x03; 
 }
 
+// (Re)size the credit window for the bearers of the current connection
+static void credits_configure(void)
+{
+    uint8_t n = xfer_credit_bearers(XFER_EATT_CHANS < s_eatt_chans_up ? XFER_EATT_CHANS : s_eatt_chans_up,
+                                    XFER_COC_MAX, s_eatt_chans_up > 0);
+    portENTER_CRITICAL(&s_credit_lock);
+    xfer_credit_init(&s_credits, n, kCreditsPerBearer);
+    portEXIT_CRITICAL(&s_credit_lock);
+    s_credits_stale = false;
+    ESP_LOGI(TAG, "ATT bearers: %u (%s), credit window: %u, multi-notify: %s",
+             n, n > 1 ? "EATT" : "legacy", s_credits.window,
+             XFER_MULTI_NOTIFY ? "yes" : "no");
+}
+
+#ifdef BLE_GAP_EVENT_EATT
+// Each EATT channel carries notifications in parallel, so the window follows
+// the channels that are up. A transfer keeps its window until it next resets
+// its credits (its start, or reclaiming lost completions).
+static void eatt_chan_update(uint16_t cid, bool up)
+{
+    int i = 0;
+    while (i < s_eatt_chans_up && s_eatt_cids[i] != cid) i++;
+    if (up && i == s_eatt_chans_up && s_eatt_chans_up < XFER_MAX_BEARERS) {
+        s_eatt_cids[s_eatt_chans_up++] = cid;
+    } else if (!up && i < s_eatt_chans_up) {
+        s_eatt_cids[i] = s_eatt_cids[--s_eatt_chans_up];
+    } else {
+        return;
+    }
+    if (s_file_transfer_active) {
+        s_credits_stale = true;
+    } else {
+        credits_configure();
+    }
+}
+#endif
+
+static bool take_data_credit(void)
+{
+    portENTER_CRITICAL(&s_credit_lock);
+    bool ok = xfer_credit_take(&s_credits);
+    portEXIT_CRITICAL(&s_credit_lock);
+    return ok;
+}
+
+static void return_data_credit(void)
+{
+    portENTER_CRITICAL(&s_credit_lock);
+    bool wake = xfer_credit_give(&s_credits);
+    portEXIT_CRITICAL(&s_credit_lock);
+    if (wake && s_notify_sem) xSemaphoreGive(s_notify_sem);
+}
+
+static void reset_data_credits(void)
+{
+    if (s_credits_stale) credits_configure();
+    portENTER_CRITICAL(&s_credit_lock);
+    xfer_credit_reset(&s_credits);
+    portEXIT_CRITICAL(&s_credit_lock);
+    if (s_notify_sem) xQueueReset(s_notify_sem);
+}
+
 static inline size_t payload_budget(uint16_t conn_handle) {
     int mtu = ble_att_mtu(conn_handle);
-    if (mtu <= 0) mtu = 23;
-    int budget = mtu - 3 - FILE_TRANSFER_HEADER_SIZE;
-    if (budget < 1) budget = 1;
-    if (budget > (FT_PKT_MAX - FILE_TRANSFER_HEADER_SIZE)) {
-        budget = FT_PKT_MAX - FILE_TRANSFER_HEADER_SIZE;
-    }
-    return (size_t)budget;
+    return ft_payload_budget(mtu > 0 ? (uint16_t)mtu : 23);
 }
 
 static bool handles_valid(void) {
@@ -1448,6 +1670,12 @@ static bool handles_valid(void) {
 }
 
 static esp_err_t find_latest_raw(char out_path[], size_t out_sz) {
+    // Recordings with IDs are found without listing the directory
+    uint32_t latest_id = rec_catalog_latest();
+    if (latest_id != REC_ID_NONE && rec_catalog_path(latest_id, out_path, out_sz) == ESP_OK) {
+        return ESP_OK;
+    }
+
     const char *rec_dir = "/sdcard/rec";
     DIR *dir = opendir(rec_dir);
     if (!dir) return ESP_FAIL;
@@ -1456,6 +1684,7 @@ static esp_err_t find_latest_raw(char out_path[], size_t out_sz) {
     struct stat st;
     time_t best_mtime = 0;
     char best[SD_MAX_PATH] = {0};
+    const char *best_name = "";
 
     while ((ent = readdir(dir)) != NULL) {
         const char *name = ent->d_name;
@@ -1468,9 +1697,10 @@ static esp_err_t find_latest_raw(char out_path[], size_t out_sz) {
         if (n <= 0 || n >= (int)sizeof(full)) continue;
 
         if (stat(full, &st) == 0 && S_ISREG(st.st_mode)) {
-            if (st.st_mtime > best_mtime) {
+            if (!best[0] || rec_file_newer(name, st.st_mtime, best_name, best_mtime)) {
                 best_mtime = st.st_mtime;
                 strncpy(best, full, sizeof(best) - 1);
+                best_name = strrchr(best, '/') + 1;
             }
         }
     }
@@ -1481,6 +1711,284 @@ static esp_err_t find_latest_raw(char out_path[], size_t out_sz) {
     return ESP_OK;
 }
 
+// The file a START or PULL names: the selection or the latest recording, as the
+// variant asked for; false once the failure has been reported
+static bool xfer_choose_path(uint8_t variant, char *path, size_t path_sz)
+{
+    if (s_current_raw_file[0] != '\0') {
+        strlcpy(path, s_current_raw_file, path_sz);
+    } else if (find_latest_raw(path, path_sz) != ESP_OK) {
+        ESP_LOGE(TAG, "Worker: no .raw file found");
+        send_status(STAT_NO_FILE);
+        return false;
+    }
+
+    // A smaller encoding of the recording: from the card, or made now
+    if (variant != FT_VARIANT_RAW) {
+        speech_codec_mode_t mode = (speech_codec_mode_t)variant;
+        char variant_path[SD_MAX_PATH];
+        if (!speech_transcode_variant_ready(path, mode, variant_path, sizeof(variant_path))) {
+            ESP_LOGI(TAG, "Worker: transcoding %s to %s", path, speech_codec_mode_name(mode));
+            send_status(STAT_TRANSCODING);
+        }
+        esp_err_t vr = speech_transcode_variant(path, mode, variant_busy, variant_path, sizeof(variant_path));
+        if (vr != ESP_OK) {
+            ESP_LOGW(TAG, "Worker: no %s variant of %s (%s)", speech_codec_mode_name(mode), path,
+                     esp_err_to_name(vr));
+            send_status(STAT_VARIANT_FAIL);
+            return false;
+        }
+        strlcpy(path, variant_path, path_sz);
+    }
+    return true;
+}
+
+// Wait for a credit so the data in flight stays within the window;
+// false after FT_CREDIT_WAIT_MS without one, so the caller can check for a stop
+static bool wait_data_credit(int *timeouts)
+{
+    if (take_data_credit()) {
+        // Also closes an episode that ended with a reclaim
+        FI_OK(FI_NOTIFY_TX_LOST);
+        *timeouts = 0;
+        return true;
+    }
+    ESP_LOGI(TAG, "Worker: Waiting for credit...");
+    // Use a finite wait to allow stop/abort responsiveness. The semaphore is
+    // given only for a credit returned while waiting, so the take after it
+    // fails only when a wait timed out just before that credit came back.
+    if (xSemaphoreTake(s_notify_sem, pdMS_TO_TICKS(FT_CREDIT_WAIT_MS)) == pdTRUE) {
+        if (take_data_credit()) {
+            FI_OK(FI_NOTIFY_TX_LOST);
+            *timeouts = 0;
+            return true;
+        }
+    } else {
+        // Timed out waiting for credit: treat as backpressure
+        ESP_LOGW(TAG, "Worker: Timed out waiting for credit - backpressure!");
+        FI_FAILED(FI_NOTIFY_TX_LOST);
+        if (++*timeouts >= FT_CREDIT_RECLAIM_TIMEOUTS) {
+            // No NOTIFY_TX for a full second: the completions were lost, not delayed
+            ESP_LOGW(TAG, "Worker: Reclaiming %u lost credits", xfer_credit_inflight(&s_credits));
+            reset_data_credits();
+            *timeouts = 0;
+        }
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    return false;
+}
+
+// Send one data notification on a credit already taken, with bounded retries on
+// allocation and controller backpressure. On failure the credit is returned and
+// STAT_NOTIFY_FAIL sent. With complete set (the final chunk), STAT_COMPLETE goes
+// in the same PDU where multi-notify is available and *batched is set.
+static bool notify_data(const uint8_t *pkt, size_t len, bool complete, uint32_t remain, bool *batched)
+{
+    *batched = false;
+#if !XFER_MULTI_NOTIFY
+    (void)complete;
+#endif
+    int tries = 0;
+    for (;;) {
+        struct os_mbuf *om = FI_HIT(FI_MBUF_ALLOC, s_file_transfer_offset) ? NULL
+                             : ble_hs_mbuf_from_flat(pkt, (uint16_t)len);
+        if (!om) {
+            FI_FAILED(FI_MBUF_ALLOC);
+            // transient mbuf starvation – back off and retry with exponential backoff
+            if (++tries < FT_MAX_RETRIES) {
+                uint32_t delay_ms = ft_mbuf_backoff_ms(tries);
+                ESP_LOGW(TAG, "Worker: mbuf alloc failed, retry %d/%d after %lu ms", tries, FT_MAX_RETRIES, (unsigned long)delay_ms);
+                vTaskDelay(pdMS_TO_TICKS(delay_ms));
+                continue;
+            }
+            ESP_LOGE(TAG, "Worker: mbuf alloc failed after %d tries", tries);
+            FI_LOST(FI_MBUF_ALLOC, remain);
+            send_status(STAT_NOTIFY_FAIL);
+            // Return the credit we took
+            return_data_credit();
+            ESP_LOGI(TAG, "Credit returned: mbuf alloc failed");
+            return false;
+        }
+
+        int rc;
+#if XFER_MULTI_NOTIFY
+        if (complete && s_file_transfer_status_handle) {
+            // Final chunk and STAT_COMPLETE go out in one Multiple Handle Value Notification
+            uint8_t done = STAT_COMPLETE;
+            struct ble_gatt_notif tuples[2] = {
+                { .handle = s_file_transfer_data_handle,   .value = om },
+                { .handle = s_file_transfer_status_handle, .value = ble_hs_mbuf_from_flat(&done, 1) },
+            };
+            if (tuples[1].value) {
+                rc = ble_gatts_notify_multiple_custom(s_file_transfer_conn_handle, 2, tuples);
+                if (rc == 0) {
+                    *batched = true;
+                    // NimBLE reports a NOTIFY_TX for each handle of the batch; the data
+                    // handle's returns this credit like any other data notification
+                    return true;
+                }
+                ESP_LOGW(TAG, "Worker: multi-notify failed rc=%d, falling back", rc);
+                om = ble_hs_mbuf_from_flat(pkt, (uint16_t)len);
+                if (!om) continue;
+            }
+        }
+#endif
+        if (FI_HIT(FI_NOTIFY_ECONTROLLER, s_file_transfer_offset)) {
+            rc = BLE_HS_ECONTROLLER;
+        } else if (FI_HIT(FI_NOTIFY_EBUSY, s_file_transfer_offset)) {
+            rc = BLE_HS_EBUSY;
+        } else {
+            rc = ble_gatts_notify_custom(s_file_transfer_conn_handle,
+                                         s_file_transfer_data_handle, om);
+        }
+        if (rc == 0) {
+            // Success: credit will be returned in BLE_GAP_EVENT_NOTIFY_TX
+            FI_OK(FI_MBUF_ALLOC);
+            FI_OK(FI_NOTIFY_ECONTROLLER);
+            FI_OK(FI_NOTIFY_EBUSY);
+            return true;
+        }
+
+        // on error we still own 'om'
+        os_mbuf_free_chain(om);
+        fi_point_t fi_point = (rc == BLE_HS_ECONTROLLER) ? FI_NOTIFY_ECONTROLLER : FI_NOTIFY_EBUSY;
+        FI_FAILED(fi_point);
+
+        // controller/backpressure → brief backoff and retry
+        if (rc == BLE_HS_ECONTROLLER || rc == BLE_HS_ENOMEM || rc == BLE_HS_EBUSY) {
+            if (++tries < FT_MAX_RETRIES) {
+                vTaskDelay(pdMS_TO_TICKS(8));
+                continue;
+            }
+        }
+
+        ESP_LOGE(TAG, "Worker: notify failed rc=%d after %d tries", rc, tries);
+        FI_LOST(fi_point, remain);
+        send_status(STAT_NOTIFY_FAIL);
+        // Return the credit we took
+        return_data_credit();
+        ESP_LOGI(TAG, "Credit returned: notify failed rc=%d", rc);
+        return false;
+    }
+}
+
+static void inject_disconnect(void)
+{
+    if (FI_HIT(FI_DISCONNECT, s_file_transfer_offset)) {
+        ESP_LOGW(TAG, "Worker: injected disconnect at %" PRIu32, s_file_transfer_offset);
+        FI_FAILED(FI_DISCONNECT);
+        FI_LOST(FI_DISCONNECT, s_file_transfer_size - s_file_transfer_offset);
+        ble_gap_terminate(s_file_transfer_conn_handle, BLE_ERR_REM_USER_CONN_TERM);
+    }
+}
+
+static int pull_read(void *ctx, uint32_t offset, uint8_t *buf, size_t len)
+{
+    FILE *fp = ctx;
+    if (FI_HIT(FI_SD_LATENCY, offset)) {
+        vTaskDelay(pdMS_TO_TICKS(FI_LATENCY_MS(FI_SD_LATENCY)));
+    }
+    if (FI_HIT(FI_SD_READ, offset) || fseek(fp, (long)offset, SEEK_SET) != 0) return -1;
+    return (int)fread(buf, 1, len, fp);
+}
+
+// Pull session (ft_pull.h): READ_BLOCKS are answered as fast as credits allow,
+// until STOP, the link drops or the receiver stops asking
+static void pull_session(const ft_msg_t *start)
+{
+    uint16_t block_max = (uint16_t)(payload_budget(s_file_transfer_conn_handle) - FT_PULL_HEADER_SIZE);
+    uint16_t block = start->pull_block ? start->pull_block : block_max;
+    if (block > block_max) {
+        ESP_LOGW(TAG, "Worker: pull block %u exceeds %u for this MTU", block, block_max);
+        send_status(STAT_BAD_CMD);
+        return;
+    }
+
+    char path[SD_MAX_PATH] = {0};
+    if (!xfer_choose_path(start->variant, path, sizeof(path))) return;
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        ESP_LOGE(TAG, "Worker: fopen failed %s errno=%d", path, errno);
+        send_status(STAT_FILE_OPEN_FAIL);
+        return;
+    }
+    // The card is read in whole cache lines
+    setvbuf(fp, NULL, _IONBF, 0);
+    struct stat st;
+    if (fstat(fileno(fp), &st) != 0 || st.st_size == 0) {
+        fclose(fp);
+        send_status(STAT_NO_FILE);
+        return;
+    }
+
+    ft_pull_open(&s_pull, (uint32_t)st.st_size, block, s_pull_cache, pull_read, fp);
+    s_file_transfer_size   = (uint32_t)st.st_size;
+    s_file_transfer_offset = 0;
+    s_bytes_sent           = 0;
+    s_seq                  = 0;
+    s_file_transfer_active = true;
+    s_file_transfer_paused = false;
+    reset_data_credits();
+    ESP_LOGI(TAG, "Worker: pull %s size=%" PRIu32 " block=%u", path, s_file_transfer_size, block);
+    send_status(STAT_PULL_READY);
+
+    uint8_t pkt[FT_PKT_MAX];
+    int credit_timeouts = 0;
+    int64_t start_us = esp_timer_get_time();
+    int64_t last_req_us = start_us;
+    bool ended = false;         // STOP or idle: the receiver gets STAT_STOPPED_BY_HOST
+    while (s_file_transfer_active && s_file_transfer_conn_handle && !ended) {
+        // New requests first; with nothing to send, wait for one
+        ft_msg_t m;
+        TickType_t wait = ft_pull_pending(&s_pull) ? 0 : pdMS_TO_TICKS(FT_CREDIT_WAIT_MS);
+        while (!ended && xQueueReceive(s_ft_q, &m, wait) == pdTRUE) {
+            wait = 0;
+            if (m.type == FT_CMD_READ_BLOCKS) {
+                last_req_us = esp_timer_get_time();
+                if (!ft_pull_request(&s_pull, m.block, m.count)) send_status(STAT_PULL_OVERRUN);
+            } else if (m.type == FT_CMD_STOP) {
+                ended = true;
+            } else {
+                send_status(STAT_BUSY);
+            }
+        }
+        if (ended) break;
+        if (!ft_pull_pending(&s_pull)) {
+            if (esp_timer_get_time() - last_req_us > FT_PULL_IDLE_MS * 1000LL) {
+                ESP_LOGW(TAG, "Worker: pull idle for %d ms, closing", FT_PULL_IDLE_MS);
+                ended = true;
+            }
+            continue;
+        }
+
+        if (!wait_data_credit(&credit_timeouts)) continue;
+        s_file_transfer_offset = ft_pull_next_offset(&s_pull);
+        int len = ft_pull_next(&s_pull, pkt, s_seq);
+        if (len <= 0) {
+            return_data_credit();
+            if (len == 0) continue;
+            ESP_LOGE(TAG, "Worker: pull read error at %" PRIu32, s_file_transfer_offset);
+            FI_FAILED(FI_SD_READ);
+            send_status(STAT_FILE_READ_FAIL);
+            break;
+        }
+        bool batched;
+        if (!notify_data(pkt, (size_t)len, false, s_file_transfer_size - s_file_transfer_offset, &batched)) break;
+        s_bytes_sent += (uint32_t)len - FILE_TRANSFER_HEADER_SIZE - FT_PULL_HEADER_SIZE;
+        s_seq++;
+        inject_disconnect();
+    }
+
+    fclose(fp);
+    s_file_transfer_active = false;
+    int64_t elapsed_ms = (esp_timer_get_time() - start_us) / 1000;
+    ESP_LOGI(TAG, "Worker: pull closed, %" PRIu32 " bytes in %lld ms, %lu requests (%lu overrun), "
+             "cache %lu hit / %lu miss", s_bytes_sent, (long long)elapsed_ms,
+             (unsigned long)s_pull.stats.requests, (unsigned long)s_pull.stats.overruns,
+             (unsigned long)s_pull.stats.hits, (unsigned long)s_pull.stats.misses);
+    if (ended) send_status(STAT_STOPPED_BY_HOST);
+}
+
 // File transfer worker task
 static void file_xfer_task(void *arg)
 {
@@ -1489,12 +1997,31 @@ static void file_xfer_task(void *arg)
     for (;;) {
         if (!xQueueReceive(s_ft_q, &msg, portMAX_DELAY)) continue;
 
-        if (msg.type == FT_CMD_START) {
+        if (msg.type == FT_CMD_PULL) {
+            if (s_file_transfer_active || s_formatting) {
+                send_status(STAT_BUSY);
+            } else if (!handles_valid()) {
+                send_status(STAT_NO_CONN);
+            } else {
+                pull_session(&msg);
+            }
+        }
+        else if (msg.type == FT_CMD_READ_BLOCKS) {
+            // A session that ended (idle, STOP) leaves the receiver's requests behind
+            ESP_LOGW(TAG, "Worker: READ_BLOCKS outside a pull session");
+            send_status(STAT_BAD_CMD);
+        }
+        else if (msg.type == FT_CMD_START) {
             if (s_file_transfer_active) {
                 ESP_LOGW(TAG, "Worker: START ignored, transfer already active");
                 send_status(STAT_BUSY);
                 continue;
             }
+            if (s_formatting) {
+                ESP_LOGW(TAG, "Worker: START ignored, card being formatted");
+                send_status(STAT_BUSY);
+                continue;
+            }
             if (!handles_valid()) {
                 ESP_LOGE(TAG, "Worker: invalid BLE handles");
                 send_status(STAT_NO_CONN);
@@ -1503,15 +2030,7 @@ static void file_xfer_task(void *arg)
 
             // choose file
             char path[SD_MAX_PATH] = {0};
-            if (s_current_raw_file[0] != '\0') {
-                strncpy(path, s_current_raw_file, sizeof(path) - 1);
-            } else {
-                if (find_latest_raw(path, sizeof(path)) != ESP_OK) {
-                    ESP_LOGE(TAG, "Worker: no .raw file found");
-                    send_status(STAT_NO_FILE);
-                    continue;
-                }
-            }
+            if (!xfer_choose_path(msg.variant, path, sizeof(path))) continue;
 
             FILE *fp = fopen(path, "rb");
             if (!fp) {
@@ -1533,6 +2052,10 @@ static void file_xfer_task(void *arg)
             s_file_transfer_active = true;
             s_file_transfer_paused = false;
             s_file_transfer_fp     = fp;
+            bool status_batched    = false;  // STAT_COMPLETE already sent with the final chunk
+            int credit_timeouts    = 0;
+            int64_t xfer_start_us  = esp_timer_get_time();
+            reset_data_credits();
 
             // Guard against zero-size files
             if (s_file_transfer_size == 0) { 
@@ -1547,6 +2070,25 @@ static void file_xfer_task(void *arg)
             uint8_t pkt[FT_PKT_MAX];
             const size_t hdr = FILE_TRANSFER_HEADER_SIZE;
 
+            // With FEC every notification carries a symbol of fixed size t; repairs
+            // follow each block's sources and the last repair ends the transfer
+            bool fec = false;
+#if CONFIG_SALESTAG_FEC
+            if (s_fec_r > 0) {
+                uint16_t t = (uint16_t)(payload_budget(s_file_transfer_conn_handle) - FT_FEC_HEADER_SIZE);
+                uint32_t per_block = (uint32_t)s_fec_k * t;
+                if ((s_file_transfer_size + per_block - 1) / per_block > UINT16_MAX + 1u) {
+                    // Block numbers are 16 bits on the air
+                    ESP_LOGW(TAG, "Worker: file too large for FEC k=%u, sending plain", s_fec_k);
+                } else {
+                    ft_fec_enc_init(&s_fec, s_file_transfer_size, t, s_fec_k, s_fec_r, s_fec_parity);
+                    fec = true;
+                    ESP_LOGI(TAG, "Worker: FEC k=%u r=%u t=%u, %" PRIu32 " notifications",
+                             s_fec_k, s_fec_r, t, ft_fec_enc_total(&s_fec));
+                }
+            }
+#endif
+
             while (s_file_transfer_active && !s_file_transfer_paused) {
                 // Connection check before each notify
                 if (!s_file_transfer_conn_handle) { 
@@ -1555,106 +2097,74 @@ static void file_xfer_task(void *arg)
                 }
 
                 uint32_t remain = s_file_transfer_size - s_file_transfer_offset;
-                if (remain == 0) break;
+                if (remain == 0 && !fec) break;
+
+                if (!wait_data_credit(&credit_timeouts)) continue;
 
                 size_t budget = payload_budget(s_file_transfer_conn_handle);
                 size_t to_read = remain < budget ? remain : budget;
+                uint8_t *body = pkt + hdr;      // File bytes or FEC symbol
+                size_t extra = 0;               // FEC header before the symbol
+                bool repair = false;
+#if CONFIG_SALESTAG_FEC
+                ft_fec_hdr_t fh;
+                if (fec) {
+                    uint32_t sym_offset;
+                    uint16_t sym_len;
+                    repair = ft_fec_enc_next(&s_fec, &fh, &sym_offset, &sym_len);
+                    extra = FT_FEC_HEADER_SIZE;
+                    body += extra;
+                    to_read = sym_len;
+                }
+#endif
 
-                size_t n = fread(pkt + hdr, 1, to_read, fp);
-                if (n == 0) {
+                size_t n;
+                if (repair) {
+#if CONFIG_SALESTAG_FEC
+                    ft_fec_enc_take_repair(&s_fec, body);
+#endif
+                    n = to_read;
+                } else {
+                    if (FI_HIT(FI_SD_LATENCY, s_file_transfer_offset)) {
+                        vTaskDelay(pdMS_TO_TICKS(FI_LATENCY_MS(FI_SD_LATENCY)));
+                    }
+                    n = FI_HIT(FI_SD_READ, s_file_transfer_offset) ? 0 : fread(body, 1, to_read, fp);
+                }
+                if (n == 0 || (fec && n != to_read)) {
+                    return_data_credit();
                     if (feof(fp)) break;
                     ESP_LOGE(TAG, "Worker: fread error at %" PRIu32, s_file_transfer_offset);
+                    FI_FAILED(FI_SD_READ);
+                    FI_LOST(FI_SD_READ, remain);
                     send_status(STAT_FILE_READ_FAIL);
                     break;
                 }
 
                 bool eof = (s_file_transfer_offset + n >= s_file_transfer_size);
-
-                // header little endian
-                pkt[0] = (uint8_t)(s_seq & 0xFF);
-                pkt[1] = (uint8_t)((s_seq >> 8) & 0xFF);
-                pkt[2] = (uint8_t)(n & 0xFF);
-                pkt[3] = (uint8_t)((n >> 8) & 0xFF);
-                pkt[4] = eof ? 0x01 : 0x00;
-
-                // Wait for a credit so we never exceed kMaxInFlight in-flight notifies
-                if (s_notify_sem) {
-                    ESP_LOGI(TAG, "Worker: Waiting for credit...");
-                    // Use a finite wait to allow stop/abort responsiveness
-                    if (xSemaphoreTake(s_notify_sem, pdMS_TO_TICKS(200)) != pdTRUE) {
-                        // Timed out waiting for credit: treat as backpressure
-                        ESP_LOGW(TAG, "Worker: Timed out waiting for credit - backpressure!");
-                        vTaskDelay(pdMS_TO_TICKS(10));
-                        continue;
-                    }
-                    ESP_LOGI(TAG, "Worker: Got credit, proceeding with send");
+                size_t len = extra + n;         // Notification payload after the data header
+#if CONFIG_SALESTAG_FEC
+                if (fec) {
+                    if (!repair) ft_fec_enc_absorb(&s_fec, body, (uint16_t)n);
+                    eof = ft_fec_enc_done(&s_fec);
+                    ft_fec_hdr_encode(pkt + hdr, &fh);
                 }
+#endif
 
-                bool credit_taken = true;
-
-                // bounded retries on allocation + controller backpressure
-                int tries = 0;
-                for (;;) {
-                    struct os_mbuf *om = ble_hs_mbuf_from_flat(pkt, (uint16_t)(hdr + n));
-                    if (!om) {
-                        // transient mbuf starvation – back off and retry with exponential backoff
-                        if (++tries < FT_MAX_RETRIES) {
-                            // Use exponential backoff: 10ms, 20ms, 40ms, 80ms, 160ms
-                            uint32_t delay_ms = 10 * (1 << (tries - 1));
-                            if (delay_ms > 100) delay_ms = 100; // Cap at 100ms
-                            ESP_LOGW(TAG, "Worker: mbuf alloc failed, retry %d/%d after %lu ms", tries, FT_MAX_RETRIES, (unsigned long)delay_ms);
-                            vTaskDelay(pdMS_TO_TICKS(delay_ms));
-                            continue;
-                        }
-                        ESP_LOGE(TAG, "Worker: mbuf alloc failed after %d tries", tries);
-                        send_status(STAT_NOTIFY_FAIL);
-                        // Return the credit we took
-                        if (credit_taken && s_notify_sem) {
-                            xSemaphoreGive(s_notify_sem);
-                            ESP_LOGI(TAG, "Credit returned: mbuf alloc failed");
-                        }
-                        credit_taken = false;
-                        break; // give up on this chunk / end transfer below
-                    }
-
-                    int rc = ble_gatts_notify_custom(s_file_transfer_conn_handle,
-                                                     s_file_transfer_data_handle, om);
-                    if (rc == 0) {
-                        // Success: credit will be returned in BLE_GAP_EVENT_NOTIFY_TX
-                        break;
-                    }
-
-                    // on error we still own 'om'
-                    os_mbuf_free_chain(om);
-
-                    // controller/backpressure → brief backoff and retry
-                    if (rc == BLE_HS_ECONTROLLER || rc == BLE_HS_ENOMEM || rc == BLE_HS_EBUSY) {
-                        if (++tries < FT_MAX_RETRIES) {
-                            vTaskDelay(pdMS_TO_TICKS(8));
-                            continue;
-                        }
-                    }
-
-                    ESP_LOGE(TAG, "Worker: notify failed rc=%d after %d tries", rc, tries);
-                    send_status(STAT_NOTIFY_FAIL);
-                    // Return the credit we took
-                    if (credit_taken && s_notify_sem) {
-                        xSemaphoreGive(s_notify_sem);
-                        ESP_LOGI(TAG, "Credit returned: notify failed rc=%d", rc);
-                    }
-                    credit_taken = false;
-                    break;
-                }
+                ft_pkt_header_encode(pkt, s_seq, (uint16_t)len, eof);
+                if (fec) ft_pkt_header_set_fec(pkt);
 
-                if (tries >= FT_MAX_RETRIES) {
-                    // abort the transfer cleanly
+                if (!notify_data(pkt, hdr + len, eof, remain, &status_batched)) {
+                    // abort the transfer cleanly rather than skipping the chunk
                     s_file_transfer_active = false;
                     break;
                 }
 
-                s_file_transfer_offset += (uint32_t)n;
-                s_bytes_sent           += (uint32_t)n;
+                if (!repair) {
+                    s_file_transfer_offset += (uint32_t)n;
+                    s_bytes_sent           += (uint32_t)n;
+                }
                 s_seq++;
+                inject_disconnect();
 
                 if (eof) break;
                 vTaskDelay(pdMS_TO_TICKS(4));   // gentle pacing
@@ -1663,11 +2173,17 @@ static void file_xfer_task(void *arg)
             fclose(fp);
             s_file_transfer_fp     = NULL;
             bool completed         = (s_file_transfer_offset == s_file_transfer_size);
+#if CONFIG_SALESTAG_FEC
+            if (fec) completed = completed && ft_fec_enc_done(&s_fec);
+#endif
             s_file_transfer_active = false;
 
             if (completed) {
-                ESP_LOGI(TAG, "Worker: complete bytes=%" PRIu32, s_bytes_sent);
-                send_status(STAT_COMPLETE);
+                int64_t elapsed_ms = (esp_timer_get_time() - xfer_start_us) / 1000;
+                ESP_LOGI(TAG, "Worker: complete bytes=%" PRIu32 " in %lld ms (%.1f KB/s)", s_bytes_sent,
+                         (long long)elapsed_ms, elapsed_ms > 0 ? s_bytes_sent / 1.024 / elapsed_ms : 0.0);
+                FI_OK(FI_DISCONNECT);
+                if (!status_batched) send_status(STAT_COMPLETE);
             } else if (!s_file_transfer_paused) {
                 // treat as host stop or error
                 send_status(STAT_STOPPED_BY_HOST);
@@ -1683,18 +2199,48 @@ static void file_xfer_task(void *arg)
             }
             send_status(STAT_STOPPED_BY_HOST);
         }
+        else if (msg.type == FT_CMD_SYNC_ACK) {
+            bool busy = rec_ctrl_is_recording() || s_formatting;
+#if CONFIG_SALESTAG_WIFI_OFFLOAD
+            busy = busy || wifi_offload_active();
+#endif
+            if (busy) {
+                send_status(STAT_BUSY);
+                continue;
+            }
+            esp_err_t err = sync_state_ack(msg.rec_id, msg.crc32c);
+            send_status(err == ESP_OK               ? STAT_SYNC_ACKED
+                        : err == ESP_ERR_INVALID_CRC ? STAT_SYNC_MISMATCH
+                        : err == ESP_ERR_NOT_FOUND   ? STAT_NO_FILE
+                                                     : STAT_FILE_READ_FAIL);
+        }
     }
 }
 
 static void start_file_xfer_task(void)
 {
-    s_ft_q = xQueueCreate(8, sizeof(ft_msg_t));
+    s_ft_q = mem_plan_queue("ble_xfer", "commands", 8, sizeof(ft_msg_t));
     configASSERT(s_ft_q);
-    s_notify_sem = xSemaphoreCreateCounting(kMaxInFlight, kMaxInFlight);
+    s_select = mem_plan_alloc("ble_xfer", "select", sizeof(*s_select), MEM_REGION_INTERNAL);
+    configASSERT(s_select);
+    // AUTO_SELECT_LIST reads run on the NimBLE host task; only the CPU touches them
+    s_auto_select_path = mem_plan_alloc("ble_xfer", "auto_path", SD_MAX_PATH, MEM_REGION_LARGE);
+    s_auto_select_rsp = mem_plan_alloc("ble_xfer", "auto_rsp", AUTO_SELECT_RSP_MAX, MEM_REGION_LARGE);
+    configASSERT(s_auto_select_path && s_auto_select_rsp);
+#if CONFIG_SALESTAG_FEC
+    s_fec_parity = mem_plan_alloc("ble_xfer", "fec", FT_FEC_MAX_R * (FT_PKT_MAX - FILE_TRANSFER_HEADER_SIZE - FT_FEC_HEADER_SIZE),
+                                  MEM_REGION_INTERNAL);
+    configASSERT(s_fec_parity);
+#endif
+    // Only the CPU touches the pull cache, so it can live outside the arena
+    s_pull_cache = mem_plan_alloc("ble_xfer", "pull", FT_PULL_CACHE_BYTES, MEM_REGION_LARGE);
+    configASSERT(s_pull_cache);
+    // Wakes the worker blocked on a credit; the credits themselves live in s_credits
+    s_notify_sem = xSemaphoreCreateBinary();
     configASSERT(s_notify_sem);
-    ESP_LOGI(TAG, "Credit semaphore created with %d credits", kMaxInFlight);
-    BaseType_t ok = xTaskCreate(file_xfer_task, "file_xfer", 8192, NULL, 5, NULL);
-    configASSERT(ok == pdPASS);
+    credits_configure();
+    TaskHandle_t task = mem_plan_task("ble_xfer", file_xfer_task, "file_xfer", MEM_STACK_FILE_XFER, NULL, 5);
+    configASSERT(task);
     ESP_LOGI(TAG, "File transfer worker task started");
 }
 
@@ -1706,7 +2252,62 @@ static void nimble_host_task(void *param)
     nimble_port_freertos_deinit();
 }
 
+#if CONFIG_SALESTAG_BOOT_FORMAT
+#define BOOT_FORMAT_HOLD_MS     5000
+#define BOOT_FORMAT_CONFIRM_MS  5000
+#define BOOT_FORMAT_POLL_MS     50
+#define BOOT_FORMAT_SETTLE_MS   200     // Release bounce must not read as the confirming press
+
+static bool boot_button_down(void) {
+    return gpio_get_level(BTN_GPIO) == 0;
+}
+
+// Wait for the button to be down (or up), flashing the LED meanwhile if asked
+static bool boot_wait_button(bool down, uint32_t timeout_ms, bool flash) {
+    for (uint32_t t = 0; t < timeout_ms; t += BOOT_FORMAT_POLL_MS) {
+        if (boot_button_down() == down) return true;
+        if (flash) ui_set_led((t / 100) % 2);
+        vTaskDelay(pdMS_TO_TICKS(BOOT_FORMAT_POLL_MS));
+    }
+    return false;
+}
+
+// Button held through boot: the LED flashes, and one more press formats the card
+static void boot_format_check(void) {
+    if (!boot_button_down()) return;
+    ESP_LOGW(TAG, "Button held at boot - keep holding %d s to format the SD card", BOOT_FORMAT_HOLD_MS / 1000);
+    if (boot_wait_button(false, BOOT_FORMAT_HOLD_MS, false)) return;
+
+    ESP_LOGW(TAG, "Release, then press again within %d s to ERASE the SD card", BOOT_FORMAT_CONFIRM_MS / 1000);
+    bool confirmed = boot_wait_button(false, BOOT_FORMAT_CONFIRM_MS, true);
+    if (confirmed) {
+        vTaskDelay(pdMS_TO_TICKS(BOOT_FORMAT_SETTLE_MS));
+        confirmed = boot_wait_button(true, BOOT_FORMAT_CONFIRM_MS, true);
+    }
+    if (!confirmed) {
+        ui_set_led(false);
+        ESP_LOGI(TAG, "Format not confirmed - card left as it is");
+        return;
+    }
+
+    ui_set_led(true);
+    esp_err_t ret = sd_storage_format(0);
+    ui_set_led(false);
+    if (ret == ESP_OK) {
+        ESP_LOGI(TAG, "SD card formatted for recording");
+    } else {
+        ESP_LOGE(TAG, "SD card format failed: %s", esp_err_to_name(ret));
+    }
+    // Let go before the button starts controlling recordings
+    boot_wait_button(false, UINT32_MAX, false);
+}
+#endif
+
 void app_main(void) {
+#if CONFIG_SALESTAG_DEEP_SLEEP
+    const rtc_state_t *retained = power_mgr_boot();
+    s_fast_wake = retained != NULL;
+#endif
     ESP_LOGI(TAG, "=== SalesTag SD Storage Test with BLE ===");
     ESP_LOGI(TAG, "BOOT: Testing UI module + SD card storage + BLE...");
     
@@ -1720,6 +2321,17 @@ void app_main(void) {
     }
     ESP_ERROR_CHECK(nvs_ret);
     ESP_LOGI(TAG, "NVS flash initialized successfully");
+
+#if CONFIG_SALESTAG_FAULT_INJECT
+    fi_init(&g_fault_inject, CONFIG_SALESTAG_FAULT_SEED, fault_inject_clock_ms);
+    int fi_rules = fi_load(&g_fault_inject, CONFIG_SALESTAG_FAULT_SCENARIO);
+    if (fi_rules < 0) {
+        ESP_LOGE(TAG, "Invalid fault scenario \"%s\" - injection disabled", CONFIG_SALESTAG_FAULT_SCENARIO);
+    } else {
+        ESP_LOGW(TAG, "FAULT INJECTION ACTIVE: %d rule(s), seed %d: %s", fi_rules,
+                 CONFIG_SALESTAG_FAULT_SEED, CONFIG_SALESTAG_FAULT_SCENARIO);
+    }
+#endif
     
     // Initialize NimBLE host stack
     ESP_LOGI(TAG, "Initializing NimBLE host stack...");
@@ -1793,6 +2405,21 @@ start_file_xfer_task();
         }
     }
     
+#if CONFIG_SALESTAG_DEEP_SLEEP
+    if (s_fast_wake) {
+        power_mgr_restore(retained);
+    }
+#endif
+
+#if CONFIG_SALESTAG_BOOT_FORMAT
+#if CONFIG_SALESTAG_DEEP_SLEEP
+    if (!s_fast_wake)
+#endif
+    {
+        boot_format_check();
+    }
+#endif
+
     ESP_LOGI(TAG, "Continuing with UI setup...");
 
     
@@ -1801,8 +2428,8 @@ start_file_xfer_task();
     ESP_LOGI(TAG, "Button callback registered");
     
     // Start with LED OFF (not recording initially)
-    ui_set_led(s_is_recording);  // Will be false initially
-    ESP_LOGI(TAG, "LED initialized to reflect recording state: %s", s_is_recording ? "ON" : "OFF");
+    ui_set_led(false);
+    ESP_LOGI(TAG, "LED initialized to reflect recording state: OFF");
     
     ESP_LOGI(TAG, "=== UI System Ready ===");
     ESP_LOGI(TAG, "Button and LED functionality confirmed working");
@@ -1817,6 +2444,27 @@ start_file_xfer_task();
         ESP_LOGI(TAG, "  Microphone: GPIO9 (MIC)");
         ESP_LOGI(TAG, "  Sample Rate: 16kHz (HIGH QUALITY!)");
         ESP_LOGI(TAG, "  Audio Format: Mono, 16-bit");
+
+#if CONFIG_SALESTAG_IRAM_BENCH
+        // Before the recording controller can start a capture
+        iram_bench_run();
+#endif
+
+#if CONFIG_SALESTAG_BATTERY_MONITOR
+        // After audio_capture_init: the battery shares ADC1 with the microphone scan
+        esp_err_t batt_ret = battery_monitor_init();
+        if (batt_ret != ESP_OK) {
+            ESP_LOGW(TAG, "Battery monitor not started: %s", esp_err_to_name(batt_ret));
+        }
+#endif
+
+#if CONFIG_SALESTAG_TELEMETRY
+        // After the battery monitor: the first record carries its reading
+        esp_err_t telem_ret = telem_adv_init();
+        if (telem_ret != ESP_OK) {
+            ESP_LOGW(TAG, "Live telemetry not started: %s", esp_err_to_name(telem_ret));
+        }
+#endif
         
         // Initialize raw audio storage system
         ESP_LOGI(TAG, "Initializing raw audio storage system...");
@@ -1824,35 +2472,41 @@ start_file_xfer_task();
         if (raw_ret == ESP_OK) {
             ESP_LOGI(TAG, "Raw audio storage initialized successfully");
 
-            // Initialize ADC sample queue for decoupling real-time sampling from file I/O
-            ESP_LOGI(TAG, "Creating ADC sample queue...");
-            s_adc_sample_queue = xQueueCreate(2048, sizeof(uint16_t)); // Buffer for ~0.13 seconds of samples
-            if (!s_adc_sample_queue) {
-                ESP_LOGE(TAG, "Failed to create ADC sample queue");
-                return;
+            // Button presses, file I/O and capture are sequenced by the recording controller
+            const rec_ctrl_hooks_t rec_hooks = {
+                .next_path = rec_next_path,
+                .start_blocked = rec_start_blocked,
+                .radio_quiet = rec_radio_quiet,
+                .finalized = rec_finalized,
+            };
+            esp_err_t rec_ret = rec_catalog_init();
+            // Before anything reads the card's recordings: one cut off by a reset gets its final header
+            if (rec_ret == ESP_OK && power_fail_recover() != ESP_OK) {
+                ESP_LOGW(TAG, "Latest recording left unfinished");
             }
-
-            // Create storage task for safe file I/O operations
-            ESP_LOGI(TAG, "Creating storage task...");
-            BaseType_t task_ret = xTaskCreate(
-                storage_task,
-                "audio_storage",
-                4096,  // Same stack size as audio capture task
-                NULL,
-                4,     // Lower priority than audio capture (5) but higher than idle
-                NULL
-            );
-
-            if (task_ret != pdPASS) {
-                ESP_LOGE(TAG, "Failed to create storage task");
+            if (rec_ret == ESP_OK) rec_ret = rec_ctrl_start(&rec_hooks);
+            if (rec_ret == ESP_OK && sync_state_init() != ESP_OK) {
+                ESP_LOGW(TAG, "Sync state unknown: docks will see no un-synced recordings");
+            }
+            if (rec_ret != ESP_OK) {
+                ESP_LOGE(TAG, "Recording controller not started: %s", esp_err_to_name(rec_ret));
                 return;
             }
 
-            ESP_LOGI(TAG, "Storage task created successfully");
+#if CONFIG_SALESTAG_SPEECH_TRANSCODE
+            esp_err_t xcode_ret = speech_transcode_start((speech_codec_mode_t)CONFIG_SALESTAG_SPEECH_CODEC_MODE,
+                                                         speech_transcode_busy);
+            if (xcode_ret != ESP_OK) {
+                ESP_LOGW(TAG, "Speech transcoder not started: %s", esp_err_to_name(xcode_ret));
+            }
+#endif
 
-            // Register raw ADC callback for queue-based storage
-            audio_capture_set_raw_adc_callback(raw_adc_callback, NULL);
-            ESP_LOGI(TAG, "Raw ADC callback registered - queue-based ADC storage enabled");
+#if CONFIG_SALESTAG_WIFI_OFFLOAD
+            esp_err_t offload_ret = wifi_offload_start(wifi_offload_busy);
+            if (offload_ret != ESP_OK) {
+                ESP_LOGW(TAG, "Wi-Fi offload not started: %s", esp_err_to_name(offload_ret));
+            }
+#endif
         } else {
             ESP_LOGE(TAG, "Failed to initialize raw audio storage: %s", esp_err_to_name(raw_ret));
         }
@@ -1870,7 +2524,10 @@ start_file_xfer_task();
         };
         gpio_config(&btn_config);
         
-        // Wait for GPIO to stabilize and check level
+        // Wait for GPIO to stabilize and check level (the line was held up through sleep on a fast wake)
+#if CONFIG_SALESTAG_DEEP_SLEEP
+        if (!s_fast_wake)
+#endif
         vTaskDelay(pdMS_TO_TICKS(100));
         int gpio_level = gpio_get_level(BTN_GPIO);
         ESP_LOGI(TAG, "GPIO[%d] level post-reassert: %d", BTN_GPIO, gpio_level);
@@ -1885,16 +2542,26 @@ start_file_xfer_task();
         s_audio_capture_enabled = false;
     }
     
+#if CONFIG_SALESTAG_DEEP_SLEEP
+    esp_err_t pm_ret = power_mgr_start(BTN_GPIO, power_mgr_busy, power_mgr_prepare);
+    if (pm_ret != ESP_OK) {
+        ESP_LOGW(TAG, "Idle deep sleep not enabled: %s", esp_err_to_name(pm_ret));
+    }
+    if (s_fast_wake) {
+        ESP_LOGI(TAG, "=== Ready %lld ms after wake ===", (long long)(esp_timer_get_time() / 1000));
+    }
+#endif
+
     ESP_LOGI(TAG, "=== System Ready ===");
+    // Everything the steady state needs is in place by now
+    mem_plan_report();
     ESP_LOGI(TAG, "Button Functions:");
     if (sd_storage_is_available()) {
         if (s_audio_capture_enabled) {
             ESP_LOGI(TAG, "  📱 Short press: Toggle audio recording ON/OFF");
             ESP_LOGI(TAG, "  💡 LED ON = Recording, LED OFF = Stopped");
-            ESP_LOGI(TAG, "  🔄 Long press (3s): SD card power cycle");
         } else {
             ESP_LOGI(TAG, "  💡 Short press: Toggle LED ON/OFF (audio disabled)");
-            ESP_LOGI(TAG, "  🔄 Long press (3s): SD card power cycle");
         }
     } else {
         ESP_LOGI(TAG, "  💡 Press button to turn LED ON/OFF");
@@ -1913,44 +2580,39 @@ start_file_xfer_task();
         vTaskDelay(pdMS_TO_TICKS(1000));
         ESP_LOGD(TAG, "Main loop heartbeat");
         
-        // Periodically test SD card availability and show PSRAM stats
-        static int heartbeat_count = 0;
-        heartbeat_count++;
-        if (heartbeat_count % 10 == 0) { // Every 10 seconds
-            FILE* heartbeat_test = fopen("/sdcard/hb.txt", "wb");
-            if (heartbeat_test) {
-                fprintf(heartbeat_test, "Heartbeat test at %d seconds\n", heartbeat_count);
-                fclose(heartbeat_test);
-                ESP_LOGI(TAG, "SD card heartbeat test successful");
-            } else {
-                ESP_LOGW(TAG, "SD card heartbeat test failed (errno: %d)", errno);
-            }
-            
-                                        // Show raw audio storage statistics
+        // Card health comes from the recording writes; the tick only reads
+        static int tick_count = 0;
+        tick_count++;
+        sd_storage_health_tick(card_idle());
+        if (tick_count % 10 == 0) { // Every 10 seconds
             uint32_t samples_written, file_size_bytes;
             if (raw_audio_storage_get_stats(&samples_written, &file_size_bytes) == ESP_OK) {
                 ESP_LOGI(TAG, "Raw Audio Stats - Samples: %u, File Size: %u bytes", (unsigned)samples_written, (unsigned)file_size_bytes);
             }
-            
 
-            
-            // List SD card contents every 60 seconds (less frequent)
-            if (heartbeat_count % 60 == 0) {
-                ESP_LOGI(TAG, "=== SD Card Contents ===");
-                DIR* dir = opendir("/sdcard");
-                if (dir) {
-                    struct dirent* entry;
-                    while ((entry = readdir(dir)) != NULL) {
-                        if (strstr(entry->d_name, ".raw") || strstr(entry->d_name, ".txt")) {
-                            ESP_LOGI(TAG, "File: %s", entry->d_name);
-                        }
-                    }
-                    closedir(dir);
-                } else {
-                    ESP_LOGW(TAG, "Failed to open /sdcard directory");
+#if CONFIG_SALESTAG_FAULT_INJECT
+            // The power-cycle path is only safe with no file open on the card
+            if (!rec_ctrl_is_recording() && !s_file_transfer_active &&
+                FI_HIT(FI_SD_POWER_CYCLE, (uint32_t)tick_count)) {
+                ESP_LOGW(TAG, "Injected SD power cycle");
+                FI_FAILED(FI_SD_POWER_CYCLE);
+                if (sd_storage_power_cycle() == ESP_OK) {
+                    FI_OK(FI_SD_POWER_CYCLE);
                 }
-                ESP_LOGI(TAG, "=== End SD Card Contents ===");
-                
+            }
+#endif
+
+            if (tick_count % 60 == 0) {
+#if CONFIG_SALESTAG_FAULT_INJECT
+                fault_inject_log_report();
+#endif
+                if (sd_storage_is_available()) {
+                    char health[SD_HEALTH_REPORT_LEN];
+                    sd_storage_health_report(health, sizeof(health));
+                    ESP_LOGI(TAG, "%s", health);
+                }
+                mem_plan_report();
+
                 // BLE status
                 ESP_LOGI(TAG, "=== BLE Status ===");
                 ESP_LOGI(TAG, "Status: Active");
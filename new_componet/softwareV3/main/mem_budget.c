@@ -0,0 +1,99 @@
+/**
+ * @file mem_budget.c
+ * @brief Boot-time arena and memory budget table (see mem_budget.h)
+ */
+
+#include "mem_budget.h"
+#include <stdio.h>
+#include <string.h>
+
+void mem_budget_init(mem_budget_t *b, void *arena, size_t size) {
+    memset(b, 0, sizeof(*b));
+    // Start on an aligned address so every carve-out is aligned
+    uintptr_t p = (uintptr_t)arena;
+    uintptr_t aligned = (p + MEM_BUDGET_ALIGN - 1) & ~(uintptr_t)(MEM_BUDGET_ALIGN - 1);
+    if (arena && size > aligned - p) {
+        b->base = (uint8_t *)aligned;
+        b->size = size - (aligned - p);
+    }
+}
+
+mem_entry_t *mem_budget_note(mem_budget_t *b, const char *subsys, const char *name,
+                             mem_kind_t kind, size_t bytes) {
+    if (b->count >= MEM_BUDGET_MAX_ENTRIES) return NULL;
+    mem_entry_t *e = &b->entries[b->count++];
+    e->subsys = subsys;
+    e->name = name;
+    e->kind = kind;
+    e->bytes = (uint32_t)bytes;
+    e->peak = MEM_BUDGET_PEAK_UNKNOWN;
+    e->handle = NULL;
+    return e;
+}
+
+void *mem_budget_take(mem_budget_t *b, const char *subsys, const char *name, mem_kind_t kind,
+                      size_t bytes) {
+    size_t rounded = (bytes + MEM_BUDGET_ALIGN - 1) & ~(size_t)(MEM_BUDGET_ALIGN - 1);
+    if (!b->base || rounded > b->size - b->used || b->count >= MEM_BUDGET_MAX_ENTRIES) {
+        b->refused++;
+        return NULL;
+    }
+    void *p = b->base + b->used;
+    b->used += rounded;
+    mem_budget_note(b, subsys, name, kind, bytes);
+    return p;
+}
+
+const char *mem_kind_name(mem_kind_t kind) {
+    switch (kind) {
+    case MEM_KIND_STACK: return "stack";
+    case MEM_KIND_QUEUE: return "queue";
+    case MEM_KIND_BUF:   return "buf";
+    case MEM_KIND_LARGE: return "large";
+    }
+    return "?";
+}
+
+size_t mem_budget_report(const mem_budget_t *b, mem_emit_fn_t emit, void *ctx) {
+    char line[128];
+    size_t lines = 0;
+
+    snprintf(line, sizeof(line), "MEM v1 arena=%lu/%lu entries=%u refused=%lu",
+             (unsigned long)b->used, (unsigned long)b->size, (unsigned)b->count,
+             (unsigned long)b->refused);
+    emit(ctx, line);
+    lines++;
+
+    for (unsigned i = 0; i < b->count; i++) {
+        const mem_entry_t *e = &b->entries[i];
+        char peak[16];
+        if (e->peak == MEM_BUDGET_PEAK_UNKNOWN) {
+            snprintf(peak, sizeof(peak), "-");
+        } else {
+            snprintf(peak, sizeof(peak), "%lu", (unsigned long)e->peak);
+        }
+        snprintf(line, sizeof(line), "MEM %s %s %s %lu peak=%s", e->subsys, e->name,
+                 mem_kind_name(e->kind), (unsigned long)e->bytes, peak);
+        emit(ctx, line);
+        lines++;
+    }
+
+    // Per-subsystem totals, in order of first appearance
+    for (unsigned i = 0; i < b->count; i++) {
+        bool seen = false;
+        for (unsigned j = 0; j < i && !seen; j++) {
+            seen = strcmp(b->entries[j].subsys, b->entries[i].subsys) == 0;
+        }
+        if (seen) continue;
+        uint32_t total = 0;
+        for (unsigned j = i; j < b->count; j++) {
+            if (strcmp(b->entries[j].subsys, b->entries[i].subsys) == 0) total += b->entries[j].bytes;
+        }
+        snprintf(line, sizeof(line), "MEM total %s %lu", b->entries[i].subsys, (unsigned long)total);
+        emit(ctx, line);
+        lines++;
+    }
+
+    emit(ctx, "MEM end");
+    return lines + 1;
+}
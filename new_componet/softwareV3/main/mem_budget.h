@@ -0,0 +1,90 @@
+/**
+ * @file mem_budget.h
+ * @brief Boot-time arena and per-subsystem memory budget table
+ *
+ * Everything the recording and transfer paths need - task stacks and
+ * control blocks, queue storage, working buffers - is carved out of a
+ * fixed arena while the device boots and never returned, so the steady
+ * state has nothing left to allocate. Each carve-out is recorded against
+ * its subsystem with its declared size; stacks additionally get their
+ * measured peak, filled in by the caller when a report is built. Pure C.
+ *
+ * Report lines:
+ *   MEM v1 arena=<used>/<size> entries=<n> refused=<n>
+ *   MEM <subsystem> <name> <stack|queue|buf|large> <bytes> peak=<bytes|->
+ *   MEM total <subsystem> <bytes>
+ *   MEM end
+ */
+
+#ifndef MEM_BUDGET_H
+#define MEM_BUDGET_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MEM_BUDGET_MAX_ENTRIES  24
+#define MEM_BUDGET_ALIGN        16      // Arena alignment (DMA and stack friendly)
+#define MEM_BUDGET_PEAK_UNKNOWN UINT32_MAX
+
+typedef enum {
+    MEM_KIND_STACK = 0,     // Task stack (and its control block)
+    MEM_KIND_QUEUE,         // Queue storage
+    MEM_KIND_BUF,           // Buffer in the arena
+    MEM_KIND_LARGE,         // Buffer outside the arena (PSRAM when the build has it)
+} mem_kind_t;
+
+typedef struct {
+    const char *subsys;
+    const char *name;
+    mem_kind_t kind;
+    uint32_t bytes;
+    uint32_t peak;          // Measured use, MEM_BUDGET_PEAK_UNKNOWN if not measurable
+    const void *handle;     // Task handle for stacks (caller's use)
+} mem_entry_t;
+
+typedef struct {
+    uint8_t *base;
+    size_t size;
+    size_t used;
+    mem_entry_t entries[MEM_BUDGET_MAX_ENTRIES];
+    uint8_t count;
+    uint32_t refused;       // Carve-outs that did not fit
+} mem_budget_t;
+
+// Receives one NUL-terminated report line without trailing newline
+typedef void (*mem_emit_fn_t)(void *ctx, const char *line);
+
+void mem_budget_init(mem_budget_t *b, void *arena, size_t size);
+
+/**
+ * @brief Carve an aligned block out of the arena and record it
+ * @return NULL (counted in refused) if it does not fit
+ */
+void *mem_budget_take(mem_budget_t *b, const char *subsys, const char *name, mem_kind_t kind,
+                      size_t bytes);
+
+/**
+ * @brief Record memory that lives outside the arena
+ * @return The new entry, or NULL when the table is full
+ */
+mem_entry_t *mem_budget_note(mem_budget_t *b, const char *subsys, const char *name,
+                             mem_kind_t kind, size_t bytes);
+
+const char *mem_kind_name(mem_kind_t kind);
+
+/**
+ * @brief Emit the report
+ * @return Number of lines emitted
+ */
+size_t mem_budget_report(const mem_budget_t *b, mem_emit_fn_t emit, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MEM_BUDGET_H
@@ -0,0 +1,109 @@
+/**
+ * @file mem_plan.c
+ * @brief Static task, queue and buffer allocation from the boot arena (see mem_plan.h)
+ */
+
+#include "mem_plan.h"
+#include "mem_budget.h"
+#include "sdkconfig.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+
+static const char *TAG = "mem_plan";
+
+// Internal RAM, so stacks and DMA buffers are valid here
+static uint8_t s_arena[CONFIG_SALESTAG_MEM_ARENA_KB * 1024] __attribute__((aligned(MEM_BUDGET_ALIGN)));
+static mem_budget_t s_budget;
+static bool s_ready = false;
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+
+#define TCB_BYTES  ((sizeof(StaticTask_t) + MEM_BUDGET_ALIGN - 1) & ~(size_t)(MEM_BUDGET_ALIGN - 1))
+#define QCB_BYTES  ((sizeof(StaticQueue_t) + MEM_BUDGET_ALIGN - 1) & ~(size_t)(MEM_BUDGET_ALIGN - 1))
+
+static void *take(const char *subsys, const char *name, mem_kind_t kind, size_t bytes,
+                  mem_entry_t **entry) {
+    taskENTER_CRITICAL(&s_lock);
+    if (!s_ready) {
+        mem_budget_init(&s_budget, s_arena, sizeof(s_arena));
+        s_ready = true;
+    }
+    void *p = mem_budget_take(&s_budget, subsys, name, kind, bytes);
+    if (p && entry) *entry = &s_budget.entries[s_budget.count - 1];
+    taskEXIT_CRITICAL(&s_lock);
+    if (!p) {
+        ESP_LOGE(TAG, "%s/%s: %u bytes do not fit the %d KB arena (%u used)", subsys, name,
+                 (unsigned)bytes, CONFIG_SALESTAG_MEM_ARENA_KB, (unsigned)s_budget.used);
+    }
+    return p;
+}
+
+TaskHandle_t mem_plan_task(const char *subsys, TaskFunction_t fn, const char *name,
+                           uint32_t stack_bytes, void *arg, UBaseType_t prio) {
+    // One carve-out for both, so the entry's size is what the task costs
+    mem_entry_t *e;
+    uint8_t *mem = take(subsys, name, MEM_KIND_STACK, TCB_BYTES + stack_bytes, &e);
+    if (!mem) return NULL;
+
+    // ESP-IDF stack depths are in bytes (StackType_t is uint8_t)
+    TaskHandle_t h = xTaskCreateStatic(fn, name, stack_bytes, arg, prio,
+                                       (StackType_t *)(mem + TCB_BYTES), (StaticTask_t *)mem);
+    e->handle = h;
+    return h;
+}
+
+QueueHandle_t mem_plan_queue(const char *subsys, const char *name, UBaseType_t len,
+                             UBaseType_t item_size) {
+    uint8_t *mem = take(subsys, name, MEM_KIND_QUEUE, QCB_BYTES + (size_t)len * item_size, NULL);
+    if (!mem) return NULL;
+    return xQueueCreateStatic(len, item_size, mem + QCB_BYTES, (StaticQueue_t *)mem);
+}
+
+void *mem_plan_alloc(const char *subsys, const char *name, size_t bytes, mem_region_t region) {
+    if (region == MEM_REGION_INTERNAL) {
+        return take(subsys, name, MEM_KIND_BUF, bytes, NULL);
+    }
+
+    void *p = NULL;
+#if CONFIG_SPIRAM
+    p = heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+#endif
+    if (!p) p = heap_caps_malloc(bytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (!p) {
+        ESP_LOGE(TAG, "%s/%s: no memory for %u bytes", subsys, name, (unsigned)bytes);
+        return NULL;
+    }
+    taskENTER_CRITICAL(&s_lock);
+    mem_budget_note(&s_budget, subsys, name, MEM_KIND_LARGE, bytes);
+    taskEXIT_CRITICAL(&s_lock);
+    return p;
+}
+
+static void emit_line(void *ctx, const char *line) {
+    (void)ctx;
+    ESP_LOGI(TAG, "%s", line);
+}
+
+void mem_plan_report(void) {
+    // Entries only ever get appended at boot, and the tasks are never deleted
+    for (unsigned i = 0; i < s_budget.count; i++) {
+        mem_entry_t *e = &s_budget.entries[i];
+        if (e->kind != MEM_KIND_STACK || !e->handle) continue;
+        // Entry bytes include the TCB; the high-water mark is bytes of stack never touched
+        UBaseType_t unused = uxTaskGetStackHighWaterMark((TaskHandle_t)e->handle);
+        e->peak = (uint32_t)(e->bytes - TCB_BYTES - unused);
+    }
+
+    mem_budget_report(&s_budget, emit_line, NULL);
+
+    multi_heap_info_t info;
+    heap_caps_get_info(&info, MALLOC_CAP_INTERNAL);
+    ESP_LOGI(TAG, "MEM heap internal free=%u min=%u blocks=%u",
+             (unsigned)info.total_free_bytes, (unsigned)info.minimum_free_bytes,
+             (unsigned)info.allocated_blocks);
+#if CONFIG_SPIRAM
+    heap_caps_get_info(&info, MALLOC_CAP_SPIRAM);
+    ESP_LOGI(TAG, "MEM heap psram free=%u min=%u blocks=%u",
+             (unsigned)info.total_free_bytes, (unsigned)info.minimum_free_bytes,
+             (unsigned)info.allocated_blocks);
+#endif
+}
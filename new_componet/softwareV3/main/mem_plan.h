@@ -0,0 +1,68 @@
+/**
+ * @file mem_plan.h
+ * @brief Declared memory plan: static tasks, queues and buffers per subsystem
+ *
+ * The stack of every long-lived task is declared here, next to the others,
+ * and comes with its control block from one internal-RAM arena
+ * (CONFIG_SALESTAG_MEM_ARENA_KB) via mem_budget.h, as do queue storage and
+ * fixed working buffers. Large buffers that are never touched by DMA go to
+ * PSRAM when the build enables it, internal RAM otherwise, and are
+ * allocated once. All of it is set up at boot; recording and transfer then
+ * run without heap allocations. mem_plan_report() logs each entry with its
+ * measured stack peak and the heap low-water marks.
+ */
+
+#ifndef MEM_PLAN_H
+#define MEM_PLAN_H
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Task stacks (bytes)
+#define MEM_STACK_CAPTURE       4096    // ADC read and conditioning
+#define MEM_STACK_STORAGE       4096    // Recording writes, spill drain
+#define MEM_STACK_REC_CTRL      4096    // Recording state machine
+#define MEM_STACK_SD_RECOVERY   4096    // Card power cycle and remount
+#define MEM_STACK_FILE_XFER     8192    // BLE transfer worker (FATFS reads, LFN on stack)
+#define MEM_STACK_UI            3072    // Button polling
+#define MEM_STACK_POWER_FAIL    2560    // Brownout: wait for the journal, restart
+#define MEM_STACK_TELEM         3072    // Live telemetry record, advertising data updates
+
+typedef enum {
+    MEM_REGION_INTERNAL = 0,    // Arena (internal RAM, DMA capable)
+    MEM_REGION_LARGE,           // PSRAM if available, else internal heap; CPU access only
+} mem_region_t;
+
+/**
+ * @brief Create a task whose stack and control block come from the arena
+ * @return The task, or NULL if the arena is exhausted or creation failed
+ */
+TaskHandle_t mem_plan_task(const char *subsys, TaskFunction_t fn, const char *name,
+                           uint32_t stack_bytes, void *arg, UBaseType_t prio);
+
+// Queue with arena storage; NULL if it does not fit
+QueueHandle_t mem_plan_queue(const char *subsys, const char *name, UBaseType_t len,
+                             UBaseType_t item_size);
+
+/**
+ * @brief Fixed buffer for the life of the device
+ * @return NULL if it does not fit (never freed; boot-time use only)
+ */
+void *mem_plan_alloc(const char *subsys, const char *name, size_t bytes, mem_region_t region);
+
+// Log the plan with measured stack peaks and heap low-water marks
+void mem_plan_report(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MEM_PLAN_H
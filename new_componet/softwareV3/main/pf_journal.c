@@ -0,0 +1,204 @@
+/**
+ * @file pf_journal.c
+ * @brief Power-fail journal record and boot-time RAW repair (see pf_journal.h)
+ */
+
+#include "pf_journal.h"
+#include "crc32c.h"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define STAMP_CHUNK 64      // Queued values expanded per write
+
+static inline void put16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static inline void put32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static inline uint16_t get16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t get32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+size_t pf_journal_build(uint8_t *staging, const pf_journal_info_t *info, const uint16_t *queued,
+                        const uint8_t *records) {
+    uint8_t *values = staging + PF_JOURNAL_HDR_BYTES;
+    for (uint16_t i = 0; i < info->queued; i++) {
+        uint16_t v = queued[i];     // May alias values[2 * i]
+        put16(values + 2 * i, v);
+    }
+    size_t len = pf_journal_records_at(info->queued);
+    memset(values + 2 * info->queued, 0, len - PF_JOURNAL_HDR_BYTES - 2u * info->queued);
+
+    uint32_t crc = crc32c_update(0, values, 2u * info->queued);
+    crc = crc32c_update(crc, records, (size_t)PF_RAW_SAMPLE_BYTES * info->records);
+
+    uint8_t *h = staging;
+    memset(h, 0, PF_JOURNAL_HDR_BYTES);
+    put32(h + 0, PF_JOURNAL_MAGIC);
+    put16(h + 4, PF_JOURNAL_VERSION);
+    put16(h + 6, PF_JOURNAL_HDR_BYTES);
+    put32(h + 8, info->committed);
+    put16(h + 12, info->records);
+    put16(h + 14, info->queued);
+    put32(h + 16, info->next_seq);
+    put32(h + 20, info->trip_ms);
+    put32(h + 24, info->rate_mhz);
+    put32(h + 28, info->rate_flags);
+    memcpy(h + 32, info->name, strnlen(info->name, PF_JOURNAL_NAME_LEN - 1));
+    put32(h + 56, crc);
+    put32(h + 60, crc32c_update(0, h, 60));
+    return len;
+}
+
+bool pf_journal_parse(const uint8_t *buf, size_t len, pf_journal_info_t *info) {
+    memset(info, 0, sizeof(*info));
+    if (len < PF_JOURNAL_HDR_BYTES) return false;
+    if (get32(buf) != PF_JOURNAL_MAGIC || get16(buf + 4) != PF_JOURNAL_VERSION ||
+        get16(buf + 6) != PF_JOURNAL_HDR_BYTES || get32(buf + 60) != crc32c_update(0, buf, 60)) {
+        return false;
+    }
+    info->committed = get32(buf + 8);
+    info->records = get16(buf + 12);
+    info->queued = get16(buf + 14);
+    info->next_seq = get32(buf + 16);
+    info->trip_ms = get32(buf + 20);
+    info->rate_mhz = get32(buf + 24);
+    info->rate_flags = get32(buf + 28);
+    memcpy(info->name, buf + 32, PF_JOURNAL_NAME_LEN - 1);
+    if (info->queued > PF_JOURNAL_MAX_QUEUED || info->records > PF_JOURNAL_MAX_RECORDS) return false;
+
+    size_t at = pf_journal_records_at(info->queued);
+    size_t rec_len = (size_t)PF_RAW_SAMPLE_BYTES * info->records;
+    if (at + rec_len > len) return false;
+    uint32_t crc = crc32c_update(0, buf + PF_JOURNAL_HDR_BYTES, 2u * info->queued);
+    crc = crc32c_update(crc, buf + at, rec_len);
+    return crc == get32(buf + 56);
+}
+
+static uint16_t sanitize(uint16_t v) {
+    if (v == 0xFFFF) return 2048;   // As raw_audio_storage: neutral sample
+    return v > 4095 ? 4095 : v;
+}
+
+static bool write_at(int fd, uint32_t off, const uint8_t *buf, size_t len) {
+    return lseek(fd, (off_t)off, SEEK_SET) == (off_t)off && write(fd, buf, len) == (ssize_t)len;
+}
+
+// Timestamp of the sample ending at off, or fallback if there is none
+static uint32_t last_ts(int fd, uint32_t off, uint32_t fallback) {
+    uint8_t s[PF_RAW_SAMPLE_BYTES];
+    if (off < PF_RAW_HEADER_BYTES + PF_RAW_SAMPLE_BYTES) return fallback;
+    if (lseek(fd, (off_t)(off - PF_RAW_SAMPLE_BYTES), SEEK_SET) < 0 || read(fd, s, sizeof(s)) != (ssize_t)sizeof(s)) {
+        return fallback;
+    }
+    return get32(s + 2);
+}
+
+// Stamp the queued values and append them at off: spaced at the nominal rate, the last one at the trip
+static bool stamp_queued(int fd, uint32_t off, const uint8_t *values, const pf_journal_info_t *info, uint32_t prev_ts) {
+    uint8_t buf[STAMP_CHUNK * PF_RAW_SAMPLE_BYTES];
+    uint16_t n = info->queued;
+    for (uint16_t i = 0; i < n;) {
+        size_t k = 0;
+        for (; k < STAMP_CHUNK && i < n; k++, i++) {
+            uint32_t back_ms = (uint32_t)(((uint64_t)(n - 1 - i) * 1000) / PF_RAW_RATE);
+            uint32_t ts = info->trip_ms - back_ms;
+            if ((int32_t)(ts - prev_ts) < 0) ts = prev_ts;
+            prev_ts = ts;
+            uint8_t *s = buf + k * PF_RAW_SAMPLE_BYTES;
+            put16(s, sanitize(get16(values + 2 * i)));
+            put32(s + 2, ts);
+            put32(s + 6, info->next_seq + i);
+        }
+        if (!write_at(fd, off, buf, k * PF_RAW_SAMPLE_BYTES)) return false;
+        off += (uint32_t)(k * PF_RAW_SAMPLE_BYTES);
+    }
+    return true;
+}
+
+int pf_recover(const char *raw_path, const uint8_t *journal, size_t journal_len, pf_recover_result_t *res) {
+    memset(res, 0, sizeof(*res));
+    int fd = open(raw_path, O_RDWR);
+    if (fd < 0) return -1;
+
+    int ret = -1;
+    uint8_t hdr[PF_RAW_HEADER_BYTES];
+    off_t size;
+    if (read(fd, hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr) || get32(hdr) != PF_RAW_MAGIC) {
+        ret = 0;    // Not a RAW file, or not even its header made it
+        goto out;
+    }
+    uint32_t flags = get32(hdr + 28);
+    if (!(flags & PF_RAW_F_OPEN)) {
+        ret = 0;
+        goto out;
+    }
+    if ((size = lseek(fd, 0, SEEK_END)) < 0) goto out;
+
+    uint32_t samples = ((uint32_t)size - PF_RAW_HEADER_BYTES) / PF_RAW_SAMPLE_BYTES;
+    uint32_t end = PF_RAW_HEADER_BYTES + samples * PF_RAW_SAMPLE_BYTES;
+    res->trimmed_bytes = (uint32_t)size - end;
+
+    const char *name = strrchr(raw_path, '/');
+    name = name ? name + 1 : raw_path;
+    pf_journal_info_t info;
+    res->journal = journal && pf_journal_parse(journal, journal_len, &info) && strcmp(info.name, name) == 0 &&
+                   info.committed >= PF_RAW_HEADER_BYTES &&
+                   (info.committed - PF_RAW_HEADER_BYTES) % PF_RAW_SAMPLE_BYTES == 0;
+
+    uint32_t at = end;
+    if (res->journal) {
+        // Past the commit point the card holds at most the start of the buffer the
+        // journal has whole; short of it, the card lost a sync and the tail follows the gap
+        if (info.committed <= end) {
+            at = info.committed;
+        } else {
+            res->gap = (info.committed - end) / PF_RAW_SAMPLE_BYTES;
+        }
+    }
+    res->kept = (at - PF_RAW_HEADER_BYTES) / PF_RAW_SAMPLE_BYTES;
+    if (at != (uint32_t)size && ftruncate(fd, (off_t)at) != 0) goto out;
+
+    uint32_t end_ts = last_ts(fd, at, get32(hdr + 16));
+    uint32_t rate_mhz = get32(hdr + 24);
+    if (res->journal) {
+        uint32_t rec_len = (uint32_t)info.records * PF_RAW_SAMPLE_BYTES;
+        const uint8_t *rec = journal + pf_journal_records_at(info.queued);
+        if (rec_len && !write_at(fd, at, rec, rec_len)) goto out;
+        at += rec_len;
+        if (rec_len) end_ts = get32(rec + rec_len - PF_RAW_SAMPLE_BYTES + 2);
+        if (info.queued) {
+            if (!stamp_queued(fd, at, journal + PF_JOURNAL_HDR_BYTES, &info, end_ts)) goto out;
+            at += (uint32_t)info.queued * PF_RAW_SAMPLE_BYTES;
+            end_ts = last_ts(fd, at, end_ts);
+        }
+        res->added = info.records + info.queued;
+        rate_mhz = info.rate_mhz;
+        flags = info.rate_flags;
+    }
+    res->total = res->kept + res->added;
+
+    // The header the stop would have written
+    put32(hdr + 12, res->total);
+    put32(hdr + 20, end_ts);
+    put32(hdr + 24, rate_mhz);
+    put32(hdr + 28, (flags & ~PF_RAW_F_OPEN) | PF_RAW_F_RECOVERED);
+    if (!write_at(fd, 0, hdr, sizeof(hdr)) || fsync(fd) != 0) goto out;
+    ret = 1;
+
+out:;
+    int err = errno;
+    close(fd);
+    errno = err;
+    return ret;
+}
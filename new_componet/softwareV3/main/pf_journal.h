@@ -0,0 +1,121 @@
+/**
+ * @file pf_journal.h
+ * @brief Power-fail journal: the unsynced tail of a recording in one pre-planned write
+ *
+ * A RAW recording is committed one 512-sample buffer at a time, each write
+ * followed by an fsync that also rewrites FAT and directory sectors. When
+ * the brownout detector trips there is no time for that: what sits in RAM
+ * (the storage buffer, already in file format, and raw ADC values still on
+ * the sample queue) goes into a journal file instead. The file is
+ * preallocated and smaller than a cluster, so it is contiguous on the card;
+ * the record starts at offset 0 and is padded to whole sectors, so FATFS
+ * sends it straight to the card without touching the FAT or the directory.
+ *
+ * Layout (little endian):
+ *
+ *   0   header, PF_JOURNAL_HDR_BYTES (pf_journal_info_t, payload and header CRC32C)
+ *   64  queued ADC values, u16 each, padded to a sector
+ *   R   buffered records, 10 bytes each (raw_audio_sample_t), padded to a sector
+ *
+ * R = pf_journal_records_at(queued). The header is written first; if power
+ * goes before the records are on the card the payload CRC fails and the
+ * journal is ignored.
+ *
+ * A RAW file is created with RAW_AUDIO_F_OPEN in its header and only the
+ * final header clears it, so at boot an open file is one whose recording
+ * never closed. pf_recover() truncates it to whole samples, appends the
+ * journal's tail if the journal belongs to it, and writes the header the
+ * stop would have written, with RAW_AUDIO_F_RECOVERED.
+ *
+ * Pure C, no ESP-IDF dependencies: the firmware and host/pfsim build the same file.
+ */
+
+#ifndef PF_JOURNAL_H
+#define PF_JOURNAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PF_JOURNAL_MAGIC        0x314A4650u     // "PFJ1"
+#define PF_JOURNAL_VERSION      1
+#define PF_JOURNAL_SECTOR       512
+#define PF_JOURNAL_HDR_BYTES    64
+#define PF_JOURNAL_NAME_LEN     24
+#define PF_JOURNAL_MAX_QUEUED   1024            // ADC values taken off the queue (64 ms)
+#define PF_JOURNAL_MAX_RECORDS  512             // RAW_AUDIO_BUFFER_SIZE
+
+// main/raw_audio_storage.h
+#define PF_RAW_HEADER_BYTES     32
+#define PF_RAW_SAMPLE_BYTES     10
+#define PF_RAW_MAGIC            0x52415741u     // "RAWA"
+#define PF_RAW_RATE             16000
+#define PF_RAW_F_OPEN           0x00000002u
+#define PF_RAW_F_RECOVERED      0x00000004u
+
+#define PF_JOURNAL_SPAN(bytes)  (((bytes) + PF_JOURNAL_SECTOR - 1) / PF_JOURNAL_SECTOR * PF_JOURNAL_SECTOR)
+// Header and queued values: the caller's staging buffer
+#define PF_JOURNAL_STAGING_BYTES PF_JOURNAL_SPAN(PF_JOURNAL_HDR_BYTES + 2 * PF_JOURNAL_MAX_QUEUED)
+#define PF_JOURNAL_MAX_BYTES    (PF_JOURNAL_STAGING_BYTES + PF_JOURNAL_SPAN(PF_RAW_SAMPLE_BYTES * PF_JOURNAL_MAX_RECORDS))
+#define PF_JOURNAL_FILE_BYTES   8192            // Preallocated; within one of the 32 KB clusters cards are formatted with
+
+typedef struct {
+    uint32_t committed;     // RAW file offset the records belong at: header and synced samples before it
+    uint16_t records;       // Buffered samples, in file format
+    uint16_t queued;        // ADC values behind them, not yet stamped
+    uint32_t next_seq;      // sample_count of the first queued value
+    uint32_t trip_ms;       // Brownout time (esp_timer ms): the last queued value's timestamp
+    uint32_t rate_mhz;      // For the final header, as raw_audio_storage_set_rate()
+    uint32_t rate_flags;
+    char name[PF_JOURNAL_NAME_LEN];  // RAW file name, without the directory
+} pf_journal_info_t;
+
+typedef struct {
+    bool journal;           // The journal belonged to this file and was applied
+    uint32_t kept;          // Samples the card already had
+    uint32_t added;         // Samples from the journal
+    uint32_t gap;           // Committed samples the card no longer had (the journal went after them)
+    uint32_t total;
+    uint32_t trimmed_bytes; // Partial sample cut from the end
+} pf_recover_result_t;
+
+static inline uint32_t pf_journal_records_at(uint16_t queued) {
+    return PF_JOURNAL_SPAN(PF_JOURNAL_HDR_BYTES + 2u * queued);
+}
+
+/**
+ * @brief Build the header and queued values into staging (PF_JOURNAL_STAGING_BYTES)
+ *
+ * queued may point into staging at PF_JOURNAL_HDR_BYTES: values are encoded in
+ * place. records are only read for the CRC; the caller writes them itself, from
+ * a buffer of at least PF_JOURNAL_SPAN(records * 10) bytes, at
+ * pf_journal_records_at(queued).
+ * @return Bytes of staging to write at offset 0 (whole sectors)
+ */
+size_t pf_journal_build(uint8_t *staging, const pf_journal_info_t *info, const uint16_t *queued,
+                        const uint8_t *records);
+
+/**
+ * @brief Check a journal read from offset 0
+ * @return true if it is complete and intact; info is filled in
+ */
+bool pf_journal_parse(const uint8_t *buf, size_t len, pf_journal_info_t *info);
+
+/**
+ * @brief Finish an open RAW file, with the journal's tail if it belongs to it
+ *
+ * journal may be NULL or invalid: the file is then finished with what the
+ * card has. Safe to repeat: a file without RAW_AUDIO_F_OPEN is left alone.
+ * @return 1 if the file was finished, 0 if it was not open, -1 on an I/O error (errno set)
+ */
+int pf_recover(const char *raw_path, const uint8_t *journal, size_t journal_len, pf_recover_result_t *res);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PF_JOURNAL_H
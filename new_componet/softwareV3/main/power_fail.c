@@ -0,0 +1,287 @@
+/**
+ * @file power_fail.c
+ * @brief Brownout journal and boot-time recording repair (see power_fail.h)
+ */
+
+#include "power_fail.h"
+#include "pf_journal.h"
+#include "raw_audio_storage.h"
+#include "rec_catalog.h"
+#include "sd_storage.h"
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#if CONFIG_SALESTAG_POWER_FAIL
+#include "audio_capture.h"
+#include "rec_ctrl.h"
+#include "mem_plan.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_private/system_internal.h"
+#include "esp_private/rtc_ctrl.h"
+#include "hal/brownout_hal.h"
+#include "hal/brownout_ll.h"
+#include "soc/rtc_cntl_reg.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#endif
+
+static const char *TAG = "power_fail";
+
+esp_err_t power_fail_recover(void) {
+    uint32_t id = rec_catalog_latest();
+    char path[128];
+    if (id == REC_ID_NONE || rec_catalog_path(id, path, sizeof(path)) != ESP_OK) return ESP_OK;
+
+    // Boot only: the plan's buffers are for the recording itself
+    uint8_t *buf = malloc(PF_JOURNAL_MAX_BYTES);
+    if (!buf) return ESP_ERR_NO_MEM;
+    if (!sd_storage_lock(UINT32_MAX)) {
+        free(buf);
+        return ESP_ERR_TIMEOUT;
+    }
+
+    size_t len = 0;
+    int fd = open(POWER_FAIL_JOURNAL_PATH, O_RDONLY);
+    if (fd >= 0) {
+        ssize_t n = read(fd, buf, PF_JOURNAL_MAX_BYTES);
+        len = n > 0 ? (size_t)n : 0;
+        close(fd);
+    }
+    pf_journal_info_t info;
+    bool journal = pf_journal_parse(buf, len, &info);
+
+    esp_err_t ret = ESP_OK;
+    pf_recover_result_t r;
+    int done = pf_recover(path, journal ? buf : NULL, len, &r);
+    if (done < 0) {
+        ESP_LOGE(TAG, "Finishing %s failed (errno: %d)", path, errno);
+        ret = ESP_FAIL;
+    } else if (done > 0) {
+        ESP_LOGW(TAG, "Finished %s after a power loss: %lu samples on the card, %lu from the journal, "
+                 "%lu lost before it, %lu bytes of a partial sample cut", path, (unsigned long)r.kept,
+                 (unsigned long)r.added, (unsigned long)r.gap, (unsigned long)r.trimmed_bytes);
+    }
+
+    // Used or stale: the RAW file is synced first, so a loss here only repeats a finished repair
+    if (journal && done >= 0) {
+        memset(buf, 0, PF_JOURNAL_SECTOR);
+        fd = open(POWER_FAIL_JOURNAL_PATH, O_WRONLY);
+        if (fd < 0 || write(fd, buf, PF_JOURNAL_SECTOR) != PF_JOURNAL_SECTOR || fsync(fd) != 0) {
+            ESP_LOGW(TAG, "Journal not cleared (errno: %d)", errno);
+        }
+        if (fd >= 0) close(fd);
+    }
+    sd_storage_unlock();
+    free(buf);
+    return ret;
+}
+
+#if CONFIG_SALESTAG_POWER_FAIL
+
+#define PF_NOTE_MAGIC   0x45544F4Eu     // "NOTE"
+
+typedef enum {
+    PF_RESULT_NONE = 1,     // No recording open for writing
+    PF_RESULT_WRITTEN,
+    PF_RESULT_FAILED,
+} pf_result_t;
+
+// Survives the software reset, not a real power loss: the trip that did not cut power is logged at boot
+typedef struct {
+    uint32_t magic;
+    uint32_t result;
+    uint32_t trip_to_done_us;
+    uint32_t write_us;
+    uint32_t samples;
+} pf_note_t;
+
+static RTC_NOINIT_ATTR pf_note_t s_note;
+
+static TaskHandle_t s_task = NULL;
+static uint8_t *s_staging = NULL;        // PF_JOURNAL_STAGING_BYTES, internal RAM: written by DMA
+static int s_fd = -1;                    // Storage task only
+static char s_name[PF_JOURNAL_NAME_LEN];
+static volatile int64_t s_trip_us;
+
+static void log_last_trip(void) {
+    if (s_note.magic != PF_NOTE_MAGIC) return;
+    s_note.magic = 0;
+    if (s_note.result == PF_RESULT_WRITTEN) {
+        ESP_LOGW(TAG, "Last brownout: %lu samples journaled %lu us after the trip (write %lu us)",
+                 (unsigned long)s_note.samples, (unsigned long)s_note.trip_to_done_us,
+                 (unsigned long)s_note.write_us);
+    } else {
+        ESP_LOGW(TAG, "Last brownout: %s", s_note.result == PF_RESULT_NONE ? "no recording open"
+                 : s_note.result == PF_RESULT_FAILED ? "journal write failed" : "no journal in time");
+    }
+}
+
+static void IRAM_ATTR brownout_isr(void *arg) {
+    (void)arg;
+    brownout_ll_intr_clear();
+    brownout_ll_intr_enable(false);     // Once: the supply stays low from here on
+    s_trip_us = esp_timer_get_time();
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(s_task, &woken);
+    if (woken) portYIELD_FROM_ISR();
+}
+
+static void power_fail_task(void *arg) {
+    (void)arg;
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    audio_capture_halt();
+    s_note.magic = PF_NOTE_MAGIC;
+    s_note.result = 0;
+    s_note.samples = 0;
+    uint32_t result = 0;
+    TickType_t wait = pdMS_TO_TICKS(CONFIG_SALESTAG_POWER_FAIL_WAIT_MS);
+    TickType_t t0 = xTaskGetTickCount();
+    if (rec_ctrl_power_fail(CONFIG_SALESTAG_POWER_FAIL_WAIT_MS)) {
+        TickType_t spent = xTaskGetTickCount() - t0;
+        xTaskNotifyWait(0, UINT32_MAX, &result, spent < wait ? wait - spent : 0);
+    }
+    s_note.result = result;
+
+    esp_reset_reason_set_hint(ESP_RST_BROWNOUT);
+    esp_restart();
+}
+
+// Open the journal, creating it at its full size on a card that has none
+static int journal_open(void) {
+    struct stat st;
+    int fd = open(POWER_FAIL_JOURNAL_PATH, O_RDWR);
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size >= PF_JOURNAL_FILE_BYTES) return fd;
+    if (fd >= 0) close(fd);
+
+    fd = open(POWER_FAIL_JOURNAL_PATH, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+    memset(s_staging, 0, PF_JOURNAL_STAGING_BYTES);
+    for (uint32_t off = 0; off < PF_JOURNAL_FILE_BYTES; off += PF_JOURNAL_STAGING_BYTES) {
+        size_t n = PF_JOURNAL_FILE_BYTES - off < PF_JOURNAL_STAGING_BYTES ? PF_JOURNAL_FILE_BYTES - off
+                                                                          : PF_JOURNAL_STAGING_BYTES;
+        if (write(fd, s_staging, n) != (ssize_t)n) goto fail;
+    }
+    if (fsync(fd) == 0) {
+        ESP_LOGI(TAG, "Journal %s created", POWER_FAIL_JOURNAL_PATH);
+        return fd;
+    }
+fail:
+    close(fd);
+    return -1;
+}
+
+esp_err_t power_fail_arm(const char *raw_path) {
+    if (!s_staging) return ESP_ERR_INVALID_STATE;
+    power_fail_disarm();
+    const char *name = strrchr(raw_path, '/');
+    name = name ? name + 1 : raw_path;
+    if (strlen(name) >= sizeof(s_name)) return ESP_ERR_INVALID_ARG;
+
+    if (!sd_storage_lock(UINT32_MAX)) return ESP_ERR_TIMEOUT;
+    int fd = journal_open();
+    sd_storage_unlock();
+    if (fd < 0) {
+        ESP_LOGW(TAG, "No power-fail journal for %s (errno: %d)", name, errno);
+        return ESP_FAIL;
+    }
+    strcpy(s_name, name);
+    s_fd = fd;
+    return ESP_OK;
+}
+
+void power_fail_disarm(void) {
+    if (s_fd < 0) return;
+    // Only the flush writes through it, and a reset follows that
+    close(s_fd);
+    s_fd = -1;
+}
+
+uint16_t *power_fail_queue_buf(size_t *cap) {
+    *cap = s_staging ? PF_JOURNAL_MAX_QUEUED : 0;
+    return s_staging ? (uint16_t *)(s_staging + PF_JOURNAL_HDR_BYTES) : NULL;
+}
+
+static bool journal_write(const raw_audio_tail_t *tail, uint16_t queued) {
+    pf_journal_info_t info = {
+        .committed = tail->committed,
+        .records = (uint16_t)tail->count,
+        .queued = queued,
+        .next_seq = tail->next_seq,
+        .trip_ms = (uint32_t)(s_trip_us / 1000),
+    };
+    bool resampled;
+    if (audio_capture_get_rate(&info.rate_mhz, &resampled)) {
+        info.rate_flags = resampled ? RAW_AUDIO_F_RESAMPLED : 0;
+    }
+    memcpy(info.name, s_name, sizeof(info.name));
+
+    const uint8_t *records = (const uint8_t *)tail->records;
+    size_t len = pf_journal_build(s_staging, &info, (const uint16_t *)(s_staging + PF_JOURNAL_HDR_BYTES), records);
+    // Whole sectors from the buffer: the padding is whatever it held, outside the CRC
+    size_t rec_len = PF_JOURNAL_SPAN(tail->count * sizeof(raw_audio_sample_t));
+
+    if (!sd_storage_lock(CONFIG_SALESTAG_POWER_FAIL_WAIT_MS)) return false;
+    bool ok = lseek(s_fd, 0, SEEK_SET) == 0 && write(s_fd, s_staging, len) == (ssize_t)len &&
+              (rec_len == 0 || write(s_fd, records, rec_len) == (ssize_t)rec_len);
+    sd_storage_unlock();
+    return ok;
+}
+
+void power_fail_journal(uint16_t queued) {
+    int64_t t0 = esp_timer_get_time();
+    raw_audio_tail_t tail;
+    pf_result_t result = PF_RESULT_NONE;
+    if (s_fd >= 0 && raw_audio_storage_tail(&tail)) {
+        result = journal_write(&tail, queued) ? PF_RESULT_WRITTEN : PF_RESULT_FAILED;
+        s_note.samples = tail.count + queued;
+    }
+    int64_t t1 = esp_timer_get_time();
+    s_note.write_us = (uint32_t)(t1 - t0);
+    s_note.trip_to_done_us = (uint32_t)(t1 - s_trip_us);
+    xTaskNotify(s_task, result, eSetValueWithOverwrite);
+}
+
+esp_err_t power_fail_init(void) {
+    if (s_task) return ESP_OK;
+    log_last_trip();
+
+    s_staging = mem_plan_alloc("power_fail", "journal", PF_JOURNAL_STAGING_BYTES, MEM_REGION_INTERNAL);
+    if (!s_staging) return ESP_ERR_NO_MEM;
+    s_task = mem_plan_task("power_fail", power_fail_task, "power_fail", MEM_STACK_POWER_FAIL, NULL,
+                           configMAX_PRIORITIES - 1);
+    if (!s_task) return ESP_ERR_NO_MEM;
+
+    // IDF has left the detector resetting the chip at once (ESP_SYSTEM_BROWNOUT_INTR is off).
+    // Keep the flash powered, since the flush runs from it; the radio can go
+    brownout_hal_config_t cfg = {
+        .threshold = CONFIG_ESP_BROWNOUT_DET_LVL,
+        .enabled = true,
+        .reset_enabled = false,
+        .flash_power_down = false,
+        .rf_power_down = true,
+    };
+    brownout_hal_config(&cfg);
+    brownout_ll_intr_clear();
+    esp_err_t ret = rtc_isr_register(brownout_isr, NULL, RTC_CNTL_BROWN_OUT_INT_ENA_M, RTC_INTR_FLAG_IRAM);
+    if (ret != ESP_OK) {
+        // Back to the reset IDF configured
+        cfg.reset_enabled = true;
+        brownout_hal_config(&cfg);
+        return ret;
+    }
+    brownout_ll_intr_enable(true);
+    ESP_LOGI(TAG, "Brownout journal armed (level %d, %d ms to write it)", CONFIG_ESP_BROWNOUT_DET_LVL,
+             CONFIG_SALESTAG_POWER_FAIL_WAIT_MS);
+    return ESP_OK;
+}
+
+#endif // CONFIG_SALESTAG_POWER_FAIL
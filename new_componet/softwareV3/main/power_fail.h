@@ -0,0 +1,62 @@
+/**
+ * @file power_fail.h
+ * @brief Brownout handling: journal the unsynced end of a recording, then reset
+ *
+ * With CONFIG_SALESTAG_POWER_FAIL the brownout detector interrupts instead
+ * of resetting the chip. Its handler wakes a top-priority task, which halts
+ * the ADC and puts a flush marker at the front of the sample queue. The
+ * storage task takes it between two samples, never inside a card write,
+ * and writes its buffer and whatever is still queued to the preallocated
+ * journal (pf_journal.h) in two whole-sector writes. The task then resets
+ * the chip, the journal written or not, after at most
+ * CONFIG_SALESTAG_POWER_FAIL_WAIT_MS.
+ *
+ * At boot power_fail_recover() finishes the latest recording if its header
+ * is still open, with the journal's tail when the journal belongs to it.
+ * That part is always built: it also finishes recordings ended by a panic
+ * or a watchdog, from what the card has.
+ *
+ * host/pfsim models the hold-up time against the flush and checks the recovery.
+ */
+
+#ifndef POWER_FAIL_H
+#define POWER_FAIL_H
+
+#include "esp_err.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define POWER_FAIL_JOURNAL_PATH "/sdcard/pfjournal.bin"
+
+/**
+ * @brief Finish the latest recording if it never closed (call after rec_catalog_init)
+ * @return ESP_OK if there was nothing to do or it was finished
+ */
+esp_err_t power_fail_recover(void);
+
+/**
+ * @brief Allocate the journal buffer and task, and take over the brownout interrupt
+ */
+esp_err_t power_fail_init(void);
+
+// Storage task: a recording is open for writing at raw_path (its first buffer may be pending)
+esp_err_t power_fail_arm(const char *raw_path);
+
+// Storage task: the recording closed or its card is going away
+void power_fail_disarm(void);
+
+// Storage task, on the flush marker: where the queued ADC values go, at most *cap of them
+uint16_t *power_fail_queue_buf(size_t *cap);
+
+// Storage task, on the flush marker: write the journal if armed and tell the power-fail task
+void power_fail_journal(uint16_t queued);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // POWER_FAIL_H
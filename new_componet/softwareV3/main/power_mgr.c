@@ -0,0 +1,131 @@
+/**
+ * @file power_mgr.c
+ * @brief Idle deep sleep and RTC state retention (see power_mgr.h)
+ */
+
+#include "sdkconfig.h"
+
+#if CONFIG_SALESTAG_DEEP_SLEEP
+
+#include "power_mgr.h"
+#include "driver/gpio.h"
+#include "driver/rtc_io.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <sys/time.h>
+
+static const char *TAG = "power";
+
+#define IDLE_POLL_MS           1000
+#define BUTTON_RELEASE_WAIT_S  5     // Sleep is put off while the button is held
+
+// Survives deep sleep; validated by CRC, so the cold-boot contents don't matter
+static RTC_DATA_ATTR rtc_state_t s_rtc;
+
+static bool s_woke_by_timer = false;
+static int s_button_gpio = -1;
+static power_mgr_busy_fn_t s_busy_fn;
+static power_mgr_prepare_fn_t s_prepare_fn;
+static volatile int64_t s_last_activity_us;
+static TaskHandle_t s_task;
+
+// System time is kept by the RTC timer through deep sleep
+static uint64_t wall_ms(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000 + (uint64_t)tv.tv_usec / 1000;
+}
+
+const rtc_state_t *power_mgr_boot(void) {
+    esp_sleep_wakeup_cause_t cause = esp_sleep_get_wakeup_cause();
+    s_woke_by_timer = cause == ESP_SLEEP_WAKEUP_TIMER;
+
+    if (cause == ESP_SLEEP_WAKEUP_UNDEFINED || !rtc_state_valid(&s_rtc)) {
+        if (cause != ESP_SLEEP_WAKEUP_UNDEFINED) {
+            ESP_LOGW(TAG, "Woke from deep sleep but retained state is invalid - full init");
+        }
+        rtc_state_reset(&s_rtc);
+        return NULL;
+    }
+
+    rtc_state_on_wake(&s_rtc, wall_ms());
+    float hours = rtc_state_project_hours(&s_rtc, CONFIG_SALESTAG_BATTERY_CAPACITY_MAH,
+                                          CONFIG_SALESTAG_AWAKE_CURRENT_MA,
+                                          CONFIG_SALESTAG_SLEEP_CURRENT_UA / 1000.0f);
+    ESP_LOGI(TAG, "Wake #%lu (%s): awake %.1f%% of %llu s measured, projected %.0f h per charge",
+             (unsigned long)s_rtc.wake_count, cause == ESP_SLEEP_WAKEUP_EXT0 ? "button" : s_woke_by_timer ? "timer" : "other",
+             rtc_state_duty(&s_rtc) * 100.0f,
+             (unsigned long long)((s_rtc.awake_ms + s_rtc.asleep_ms) / 1000), hours);
+    return &s_rtc;
+}
+
+void power_mgr_note_activity(void) {
+    s_last_activity_us = esp_timer_get_time();
+}
+
+static void enter_deep_sleep(void) {
+    if (s_prepare_fn) s_prepare_fn(&s_rtc);
+    rtc_state_on_sleep(&s_rtc, wall_ms(), (uint64_t)(esp_timer_get_time() / 1000));
+
+    // Keep the button's pull-up alive in the RTC domain so the line idles high
+    rtc_gpio_pullup_en(s_button_gpio);
+    rtc_gpio_pulldown_dis(s_button_gpio);
+    esp_sleep_enable_ext0_wakeup(s_button_gpio, 0);
+#if CONFIG_SALESTAG_WAKE_TIMER_MIN > 0
+    esp_sleep_enable_timer_wakeup((uint64_t)CONFIG_SALESTAG_WAKE_TIMER_MIN * 60 * 1000000ULL);
+#endif
+
+    ESP_LOGI(TAG, "Entering deep sleep (%lu so far, awake %.1f%%)",
+             (unsigned long)s_rtc.sleeps, rtc_state_duty(&s_rtc) * 100.0f);
+    esp_deep_sleep_start();
+}
+
+static void idle_task(void *arg) {
+    // A timer wake only has to let background work run, so it sleeps again sooner
+    int64_t idle_limit_us = s_woke_by_timer ? (int64_t)CONFIG_SALESTAG_TIMER_WAKE_IDLE_S * 1000000LL
+                                            : (int64_t)CONFIG_SALESTAG_IDLE_SLEEP_MIN * 60 * 1000000LL;
+    power_mgr_note_activity();
+
+    for (;;) {
+        vTaskDelay(pdMS_TO_TICKS(IDLE_POLL_MS));
+        if (s_busy_fn && s_busy_fn()) {
+            power_mgr_note_activity();
+            idle_limit_us = (int64_t)CONFIG_SALESTAG_IDLE_SLEEP_MIN * 60 * 1000000LL;
+            continue;
+        }
+        if (esp_timer_get_time() - s_last_activity_us < idle_limit_us) continue;
+
+        // Sleeping with the button held would wake immediately
+        int held = 0;
+        while (gpio_get_level(s_button_gpio) == 0 && held++ < BUTTON_RELEASE_WAIT_S) {
+            vTaskDelay(pdMS_TO_TICKS(1000));
+        }
+        if (gpio_get_level(s_button_gpio) == 0) {
+            power_mgr_note_activity();
+            continue;
+        }
+        enter_deep_sleep();
+    }
+}
+
+esp_err_t power_mgr_start(int button_gpio, power_mgr_busy_fn_t busy_fn, power_mgr_prepare_fn_t prepare_fn) {
+    if (s_task) return ESP_ERR_INVALID_STATE;
+    if (!rtc_gpio_is_valid_gpio(button_gpio)) return ESP_ERR_INVALID_ARG;
+
+    s_button_gpio = button_gpio;
+    s_busy_fn = busy_fn;
+    s_prepare_fn = prepare_fn;
+    if (xTaskCreate(idle_task, "power_idle", 3072, NULL, 1, &s_task) != pdPASS) {
+        s_task = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Deep sleep after %d min idle, wake on GPIO%d%s", CONFIG_SALESTAG_IDLE_SLEEP_MIN, button_gpio,
+             CONFIG_SALESTAG_WAKE_TIMER_MIN > 0 ? " or timer" : "");
+    return ESP_OK;
+}
+
+#endif // CONFIG_SALESTAG_DEEP_SLEEP
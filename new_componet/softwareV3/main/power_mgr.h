@@ -0,0 +1,54 @@
+/**
+ * @file power_mgr.h
+ * @brief Deep sleep between sessions
+ *
+ * After CONFIG_SALESTAG_IDLE_SLEEP_MIN minutes with nothing to do (no
+ * recording, connection or background upload), the device saves its
+ * working state to RTC memory (rtc_state.h) and enters deep sleep. The
+ * button (ext0, active low) wakes it, as does an optional timer. On a
+ * deep-sleep wake with intact state, app_main takes the fast path: it
+ * restores the state instead of rediscovering it and skips the boot-time
+ * diagnostics, so the device is ready to record well under a second after
+ * the press.
+ */
+
+#ifndef POWER_MGR_H
+#define POWER_MGR_H
+
+#include "esp_err.h"
+#include "rtc_state.h"
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// True while the device must stay awake
+typedef bool (*power_mgr_busy_fn_t)(void);
+
+// Called just before sleeping: store application state and quiesce (unmount, stop radio)
+typedef void (*power_mgr_prepare_fn_t)(rtc_state_t *state);
+
+/**
+ * @brief Check the wake cause and RTC state; call first thing in app_main
+ * @return The retained state on a deep-sleep wake, NULL on a cold boot
+ *         (or if the state failed its CRC)
+ */
+const rtc_state_t *power_mgr_boot(void);
+
+/**
+ * @brief Start the idle monitor
+ * @param button_gpio RTC-capable GPIO, pressed = low
+ */
+esp_err_t power_mgr_start(int button_gpio, power_mgr_busy_fn_t busy_fn, power_mgr_prepare_fn_t prepare_fn);
+
+/**
+ * @brief Restart the idle countdown (user interaction)
+ */
+void power_mgr_note_activity(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // POWER_MGR_H
@@ -0,0 +1,108 @@
+/**
+ * @file prof_hist.c
+ * @brief Sampling profiler histogram and report (see prof_hist.h)
+ */
+
+#include "prof_hist.h"
+#include <stdio.h>
+#include <string.h>
+
+void prof_hist_init(prof_hist_t *h, prof_entry_t *storage, uint32_t capacity) {
+    memset(h, 0, sizeof(*h));
+    if (!storage || capacity == 0) return;
+    uint32_t cap = 1;
+    while (cap * 2 <= capacity) cap *= 2;
+    memset(storage, 0, (size_t)cap * sizeof(*storage));
+    h->entries = storage;
+    h->mask = cap - 1;
+}
+
+uint16_t prof_hist_task(prof_hist_t *h, const void *handle, const char *name) {
+    for (uint16_t i = 0; i < h->num_tasks; i++) {
+        if (h->tasks[i].handle == handle) return i;
+    }
+    if (h->num_tasks >= PROF_MAX_TASKS) return PROF_TASK_OTHER;
+
+    prof_task_t *t = &h->tasks[h->num_tasks];
+    t->handle = handle;
+    // Names become path elements of folded stacks: no separators or blanks
+    size_t i = 0;
+    for (; name && name[i] && i < PROF_TASK_NAME_LEN - 1; i++) {
+        char c = name[i];
+        t->name[i] = (c == ' ' || c == ';' || c == '\t') ? '_' : c;
+    }
+    if (i == 0) t->name[i++] = '?';
+    t->name[i] = '\0';
+    return h->num_tasks++;
+}
+
+static uint32_t slot_of(uint32_t pc, uint32_t caller, uint16_t task) {
+    uint32_t x = pc ^ (caller * 0x9E3779B1u) ^ ((uint32_t)task << 24);
+    x ^= x >> 15;
+    x *= 0x2C1B3C6Du;
+    x ^= x >> 12;
+    return x;
+}
+
+void prof_hist_add(prof_hist_t *h, uint32_t pc, uint32_t caller, uint16_t task) {
+    h->samples++;
+    if (!h->entries) {
+        h->dropped++;
+        return;
+    }
+    uint32_t slot = slot_of(pc, caller, task);
+    for (uint32_t probe = 0; probe < PROF_PROBE_LIMIT && probe <= h->mask; probe++) {
+        prof_entry_t *e = &h->entries[(slot + probe) & h->mask];
+        if (!e->used) {
+            e->pc = pc;
+            e->caller = caller;
+            e->task = task;
+            e->count = 1;
+            e->used = 1;
+            h->used++;
+            return;
+        }
+        if (e->pc == pc && e->caller == caller && e->task == task) {
+            e->count++;
+            return;
+        }
+    }
+    h->dropped++;
+}
+
+static const char *task_name(const prof_hist_t *h, uint16_t task) {
+    return task < h->num_tasks ? h->tasks[task].name : "other";
+}
+
+size_t prof_report(const prof_hist_t *hists, uint8_t cores, const prof_meta_t *meta,
+                   prof_emit_fn_t emit, void *ctx) {
+    char line[96];
+    size_t lines = 0;
+
+    snprintf(line, sizeof(line), "PROF v1 hz=%lu window_ms=%lu cores=%u elf=%.16s",
+             (unsigned long)meta->hz, (unsigned long)meta->window_ms, (unsigned)cores,
+             meta->elf_sha ? meta->elf_sha : "-");
+    emit(ctx, line);
+    lines++;
+
+    for (uint8_t c = 0; c < cores; c++) {
+        const prof_hist_t *h = &hists[c];
+        snprintf(line, sizeof(line), "PROF core %u samples=%lu dropped=%lu tasks=%u", (unsigned)c,
+                 (unsigned long)h->samples, (unsigned long)h->dropped, (unsigned)h->num_tasks);
+        emit(ctx, line);
+        lines++;
+
+        for (uint32_t i = 0; h->entries && i <= h->mask; i++) {
+            const prof_entry_t *e = &h->entries[i];
+            if (!e->used) continue;
+            snprintf(line, sizeof(line), "PROF s %u %s 0x%08lx 0x%08lx %lu", (unsigned)c,
+                     task_name(h, e->task), (unsigned long)e->pc, (unsigned long)e->caller,
+                     (unsigned long)e->count);
+            emit(ctx, line);
+            lines++;
+        }
+    }
+
+    emit(ctx, "PROF end");
+    return lines + 1;
+}
@@ -0,0 +1,94 @@
+/**
+ * @file prof_hist.h
+ * @brief Sample histogram and report format of the sampling CPU profiler
+ *
+ * One histogram per core counts (task, pc, caller) samples in a fixed
+ * open-addressing table. Each table has a single writer - the profiler
+ * timer interrupt of its core - so adding a sample takes no lock; the report
+ * is built after the timers are stopped. Pure C, shared with the host tools
+ * that generate synthetic reports.
+ *
+ * Report lines (host/profiler/prof_fold.py turns them into folded stacks):
+ *   PROF v1 hz=<rate> window_ms=<ms> cores=<n> elf=<sha256 prefix>
+ *   PROF core <core> samples=<n> dropped=<n> tasks=<n>
+ *   PROF s <core> <task> 0x<pc> 0x<caller> <count>
+ *   PROF end
+ */
+
+#ifndef PROF_HIST_H
+#define PROF_HIST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PROF_MAX_TASKS      32
+#define PROF_TASK_NAME_LEN  16
+#define PROF_TASK_OTHER     PROF_MAX_TASKS  // Tasks beyond the task table
+#define PROF_PROBE_LIMIT    16              // Slots probed before a sample is dropped
+
+typedef struct {
+    uint32_t pc;            // Interrupted program counter
+    uint32_t caller;        // Return address of the interrupted function
+    uint16_t task;          // Index into prof_hist_t.tasks
+    uint16_t used;
+    uint32_t count;
+} prof_entry_t;
+
+typedef struct {
+    const void *handle;
+    char name[PROF_TASK_NAME_LEN];
+} prof_task_t;
+
+typedef struct {
+    prof_entry_t *entries;
+    uint32_t mask;          // Capacity - 1 (capacity is a power of two)
+    uint32_t used;
+    uint32_t samples;
+    uint32_t dropped;       // Table full around the sample's slot
+    prof_task_t tasks[PROF_MAX_TASKS];
+    uint16_t num_tasks;
+} prof_hist_t;
+
+typedef struct {
+    uint32_t hz;
+    uint32_t window_ms;
+    const char *elf_sha;    // Build identifier checked by the symbolizer (may be NULL)
+} prof_meta_t;
+
+// Receives one NUL-terminated report line without trailing newline
+typedef void (*prof_emit_fn_t)(void *ctx, const char *line);
+
+/**
+ * @brief Bind a histogram to its table
+ * @param capacity Number of entries, rounded down to a power of two
+ */
+void prof_hist_init(prof_hist_t *h, prof_entry_t *storage, uint32_t capacity);
+
+/**
+ * @brief Task index for a task handle, registering the name on first sight
+ * @return Index, or PROF_TASK_OTHER when the task table is full
+ */
+uint16_t prof_hist_task(prof_hist_t *h, const void *handle, const char *name);
+
+/**
+ * @brief Count one sample (interrupt context, single writer per histogram)
+ */
+void prof_hist_add(prof_hist_t *h, uint32_t pc, uint32_t caller, uint16_t task);
+
+/**
+ * @brief Emit the report for a set of per-core histograms
+ * @return Number of lines emitted
+ */
+size_t prof_report(const prof_hist_t *hists, uint8_t cores, const prof_meta_t *meta,
+                   prof_emit_fn_t emit, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PROF_HIST_H
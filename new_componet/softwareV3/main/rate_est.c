@@ -0,0 +1,77 @@
+/**
+ * @file rate_est.c
+ * @brief Sample rate measurement (see rate_est.h)
+ */
+
+#include "rate_est.h"
+#include <string.h>
+
+void rate_est_init(rate_est_t *e, uint32_t nominal_hz) {
+    memset(e, 0, sizeof(*e));
+    e->nominal_mhz = nominal_hz * 1000u;
+}
+
+// Time of sample n on a clock that runs at rate_mhz, in microseconds
+static int64_t sample_us(uint64_t n, uint32_t rate_mhz) {
+    return (int64_t)(n * 1000000000ull / rate_mhz);
+}
+
+// Samples per second in milli-Hz over dn samples and dt microseconds, without overflowing
+static uint32_t slope_mhz(uint64_t dn, uint64_t dt_us) {
+    uint64_t whole = dn * 1000000ull / dt_us;
+    uint64_t rem = dn * 1000000ull % dt_us;
+    return (uint32_t)(whole * 1000ull + (rem * 1000ull + dt_us / 2) / dt_us);
+}
+
+static bool close_window(rate_est_t *e) {
+    if (!e->have_anchor) {
+        e->anchor = e->best;
+        e->have_anchor = true;
+        return false;
+    }
+    if (e->best.t_us - e->anchor.t_us < RATE_EST_MIN_SPAN_US) return false;
+
+    uint32_t mhz = slope_mhz(e->best.samples - e->anchor.samples, (uint64_t)(e->best.t_us - e->anchor.t_us));
+    uint32_t limit = (uint32_t)((uint64_t)e->nominal_mhz * RATE_EST_MAX_PPM / 1000000u);
+    if (mhz > e->nominal_mhz + limit || mhz + limit < e->nominal_mhz) {
+        e->rejected++;
+        return false;
+    }
+    bool changed = mhz != e->rate_mhz;
+    e->rate_mhz = mhz;
+    return changed;
+}
+
+bool rate_est_feed(rate_est_t *e, uint32_t samples, int64_t t_us) {
+    if (samples == 0) return false;
+    if (e->samples == 0 && e->t_start_us == 0) {
+        e->t_start_us = t_us;
+        e->window_end_us = t_us + RATE_EST_SETTLE_US;
+    }
+    e->samples += samples;
+    if (t_us < e->t_start_us + RATE_EST_SETTLE_US) return false;
+
+    bool changed = false;
+    if (t_us >= e->window_end_us) {
+        if (e->have_best) changed = close_window(e);
+        e->have_best = false;
+        e->window_end_us += RATE_EST_WINDOW_US;
+        // After a long gap (stalled task) start the window at this frame
+        if (e->window_end_us <= t_us) e->window_end_us = t_us + RATE_EST_WINDOW_US;
+    }
+
+    // Lag against the best rate known so far; the smallest is the least delayed read
+    uint32_t ref = e->rate_mhz ? e->rate_mhz : e->nominal_mhz;
+    rate_est_point_t p = { .samples = e->samples, .t_us = t_us };
+    if (!e->have_best || t_us - sample_us(p.samples, ref) < e->best.t_us - sample_us(e->best.samples, ref)) {
+        e->best = p;
+        e->have_best = true;
+    }
+    return changed;
+}
+
+int32_t rate_est_ppb(const rate_est_t *e) {
+    if (e->rate_mhz == 0) return 0;
+    int64_t diff = (int64_t)e->rate_mhz - (int64_t)e->nominal_mhz;
+    return (int32_t)(diff * 1000000000ll / (int64_t)e->nominal_mhz);
+}
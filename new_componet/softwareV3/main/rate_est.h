@@ -0,0 +1,71 @@
+/**
+ * @file rate_est.h
+ * @brief Effective ADC sample rate, measured against esp_timer
+ *
+ * The ADC's continuous mode derives its conversion clock through integer
+ * dividers, so "16000 Hz" is really some nearby rate. The capture task
+ * feeds the sample count of every DMA frame with the esp_timer time it was
+ * read; the rate is the slope between two of those points a long way
+ * apart, so after an hour it is good to a fraction of a ppm.
+ *
+ * A frame is read some time after its last sample was converted (task
+ * scheduling, frames queued in the driver), never before. Each window of
+ * RATE_EST_WINDOW_US therefore keeps only its earliest-arriving frame, the
+ * one with the least lag relative to the current estimate, and the slope
+ * is taken between the first window's and the latest window's. Pure C.
+ */
+
+#ifndef RATE_EST_H
+#define RATE_EST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RATE_EST_WINDOW_US    1000000   // One point kept per window
+#define RATE_EST_SETTLE_US    1000000   // Ignored after a start (driver and pool warm-up)
+#define RATE_EST_MIN_SPAN_US  4000000   // First estimate after this much between points
+#define RATE_EST_MAX_PPM      20000     // Further off is a measurement fault, not a divider
+
+typedef struct {
+    uint64_t samples;       // Sample index after the last frame
+    int64_t t_us;
+} rate_est_point_t;
+
+typedef struct {
+    uint32_t nominal_mhz;
+    uint32_t rate_mhz;      // Current estimate in milli-Hz, 0 until the span is long enough
+    uint64_t samples;       // Samples fed so far
+    int64_t t_start_us;     // First frame
+    int64_t window_end_us;
+    bool have_best;
+    rate_est_point_t best;  // Earliest-arriving frame of the current window
+    bool have_anchor;
+    rate_est_point_t anchor;
+    uint32_t rejected;      // Estimates outside RATE_EST_MAX_PPM
+} rate_est_t;
+
+void rate_est_init(rate_est_t *e, uint32_t nominal_hz);
+
+/**
+ * @brief Account one frame of samples, read at t_us
+ * @return true when the estimate changed
+ */
+bool rate_est_feed(rate_est_t *e, uint32_t samples, int64_t t_us);
+
+// Estimate in milli-Hz, 0 until the first one
+static inline uint32_t rate_est_mhz(const rate_est_t *e) {
+    return e->rate_mhz;
+}
+
+// Deviation from nominal in parts per billion (0 until the first estimate)
+int32_t rate_est_ppb(const rate_est_t *e);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RATE_EST_H
@@ -1,16 +1,26 @@
 #include "raw_audio_storage.h"
+#include "pf_journal.h"
+#include "fault_inject.h"
+#include "sd_storage.h"
+#include "sdkconfig.h"
 #include "esp_log.h"
 #include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include <stdio.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <stdatomic.h>
 
 static const char* TAG = "raw_audio_storage";
 
+_Static_assert(RAW_AUDIO_F_OPEN == PF_RAW_F_OPEN && RAW_AUDIO_F_RECOVERED == PF_RAW_F_RECOVERED,
+               "pf_journal.h mirrors the RAW flags");
+_Static_assert(RAW_AUDIO_BUFFER_SIZE == PF_JOURNAL_MAX_RECORDS, "the journal holds one whole buffer");
+
 // ADC corruption counters (atomic for thread safety)
 static atomic_uint_fast32_t g_adc_oob_count = 0;
 static atomic_uint_fast32_t g_adc_ffff_count = 0;
@@ -21,12 +31,17 @@ static int s_current_fd = -1;  // File descriptor instead of FILE*
 static bool s_is_recording = false;
 static uint32_t s_samples_written = 0;
 static uint32_t s_start_timestamp = 0;
-static uint32_t s_file_size_bytes = 0;
+static uint32_t s_file_size_bytes = 0;    // Committed: written and synced to the card
+static char s_path[128];
+static bool s_suspended = false;          // File closed while the card is recovered
 static raw_audio_header_t s_file_header;
+static uint32_t s_rate_mhz = 0;           // For the final header (raw_audio_storage_set_rate)
+static uint32_t s_rate_flags = 0;
 
-// Sample buffer for efficient writing
-static raw_audio_sample_t s_sample_buffer[RAW_AUDIO_BUFFER_SIZE];
+// Sample buffer for efficient writing; word aligned so the power-fail journal can DMA it to the card
+static raw_audio_sample_t s_sample_buffer[RAW_AUDIO_BUFFER_SIZE] __attribute__((aligned(4)));
 static uint32_t s_buffer_index = 0;
+static uint32_t s_samples_dropped = 0;  // Samples lost while a full buffer could not be written
 
 // Helper functions
 static inline void put_u32_le(uint8_t *p, uint32_t v) {
@@ -36,30 +51,38 @@ static inline void put_u32_le(uint8_t *p, uint32_t v) {
     p[3] = (uint8_t)(v >> 24);
 }
 
-static inline uint16_t sanitize_adc(uint16_t v) {
+// Out of the per-sample path: the capture already masks codes to 12 bits.
+// Counted always; logged per sample only in development builds
+// (CONFIG_SALESTAG_CAPTURE_GENERIC), the totals are logged at deinit
+static uint16_t __attribute__((noinline, cold)) sanitize_adc_bad(uint16_t v) {
     if (v == 0xFFFF) {
         atomic_fetch_add(&g_adc_ffff_count, 1);
+#if CONFIG_SALESTAG_CAPTURE_GENERIC
         ESP_LOGW(TAG, "⚠️ 0xFFFF corruption detected, using neutral sample");
+#endif
         return 2048; // neutral sample
     }
-    if (v > 4095) {
-        atomic_fetch_add(&g_adc_oob_count, 1);
-        ESP_LOGW(TAG, "⚠️ ADC out of range: %d, clamping to 4095", v);
-        return 4095;
-    }
-    return v;
+    atomic_fetch_add(&g_adc_oob_count, 1);
+#if CONFIG_SALESTAG_CAPTURE_GENERIC
+    ESP_LOGW(TAG, "⚠️ ADC out of range: %d, clamping to 4095", v);
+#endif
+    return 4095;
 }
 
-static void raw_header_fill(uint8_t *buf, uint32_t total, uint32_t start_ms, uint32_t end_ms) {
+static inline uint16_t sanitize_adc(uint16_t v) {
+    return __builtin_expect(v > 4095, 0) ? sanitize_adc_bad(v) : v;
+}
+
+static void raw_header_fill(uint8_t *buf, uint32_t total, uint32_t start_ms, uint32_t end_ms,
+                            uint32_t rate_mhz, uint32_t flags) {
     put_u32_le(buf + 0,  0x52415741);  // "RAWA"
     put_u32_le(buf + 4,  1);           // version
     put_u32_le(buf + 8,  16000);       // sample_rate
     put_u32_le(buf + 12, total);       // total_samples
     put_u32_le(buf + 16, start_ms);    // start_timestamp
     put_u32_le(buf + 20, end_ms);      // end_timestamp
-    for (int i = 0; i < 4; i++) {
-        put_u32_le(buf + 24 + 4*i, 0); // reserved
-    }
+    put_u32_le(buf + 24, rate_mhz);    // measured_rate_mhz
+    put_u32_le(buf + 28, flags);       // flags
 }
 
 esp_err_t raw_audio_storage_init(void) {
@@ -99,13 +122,18 @@ esp_err_t raw_audio_storage_start_recording(const char* filename) {
     }
     
     ESP_LOGI(TAG, "Starting raw audio recording: %s", filename);
-    
+    if (strlen(filename) >= sizeof(s_path)) return ESP_ERR_INVALID_ARG;
+    if (!sd_storage_lock(UINT32_MAX)) return ESP_ERR_TIMEOUT;
+
     // Open file for writing using low-level API
     s_current_fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
     if (s_current_fd < 0) {
         ESP_LOGE(TAG, "Failed to open file for recording: %s (errno: %d)", filename, errno);
+        sd_storage_unlock();
         return ESP_FAIL;
     }
+    strcpy(s_path, filename);
+    s_suspended = false;
     
     // Initialize recording state
     s_is_recording = true;
@@ -113,19 +141,25 @@ esp_err_t raw_audio_storage_start_recording(const char* filename) {
     s_start_timestamp = esp_timer_get_time() / 1000; // Convert to milliseconds
     s_buffer_index = 0;
     s_file_size_bytes = 0;
+    s_samples_dropped = 0;
+    s_rate_mhz = 0;
+    s_rate_flags = 0;
     
     // Write file header using explicit little-endian format
     uint8_t header_buf[32];
-    raw_header_fill(header_buf, 0, s_start_timestamp, 0);  // total_samples=0, end_timestamp=0 for now
+    raw_header_fill(header_buf, 0, s_start_timestamp, 0, 0, RAW_AUDIO_F_OPEN);  // Totals and rate are filled in at stop
     
+    // Synced so the file exists on the card even if it has to be remounted
     ssize_t header_written = write(s_current_fd, header_buf, 32);
-    if (header_written != 32) {
+    if (header_written != 32 || fsync(s_current_fd) != 0) {
         ESP_LOGE(TAG, "Failed to write file header (errno: %d)", errno);
         close(s_current_fd);
         s_current_fd = -1;
         s_is_recording = false;
+        sd_storage_unlock();
         return ESP_FAIL;
     }
+    sd_storage_unlock();
     
     // Verify header was written correctly
     ESP_LOGI(TAG, "Header written: magic bytes should be 41 57 41 52");
@@ -138,20 +172,27 @@ esp_err_t raw_audio_storage_start_recording(const char* filename) {
 }
 
 esp_err_t raw_audio_storage_stop_recording(void) {
+    if (s_is_recording && s_suspended) {
+        // The card never came back; what was committed stays, its header still open for the boot repair
+        ESP_LOGW(TAG, "Abandoning suspended recording %s (%lu samples committed)",
+                 s_path, (unsigned long)s_samples_written);
+        s_is_recording = false;
+        s_suspended = false;
+        s_buffer_index = 0;
+        return ESP_ERR_INVALID_STATE;
+    }
     if (!s_is_recording || s_current_fd < 0) {
         ESP_LOGW(TAG, "Not currently recording");
         return ESP_OK;
     }
 
     ESP_LOGI(TAG, "Stopping raw audio recording");
+    sd_storage_lock(UINT32_MAX);
 
-    // CRITICAL: Set recording flag to false FIRST to stop storage task
+    // Called by the storage task after the last queued sample (rec_ctrl.c), so nothing is in flight
     s_is_recording = false;
 
-    // Give storage task a moment to finish processing any queued samples
-    vTaskDelay(pdMS_TO_TICKS(50));
-
-    // Now safely flush any remaining samples in buffer
+    // Flush any remaining samples in buffer
     if (s_buffer_index > 0) {
         ESP_LOGI(TAG, "Flushing %lu samples from buffer", s_buffer_index);
         ssize_t bytes_written = write(s_current_fd, s_sample_buffer, s_buffer_index * sizeof(raw_audio_sample_t));
@@ -167,7 +208,7 @@ esp_err_t raw_audio_storage_stop_recording(void) {
     // Update file header with final statistics using explicit little-endian format
     uint32_t end_timestamp = esp_timer_get_time() / 1000;
     uint8_t final_header[32];
-    raw_header_fill(final_header, s_samples_written, s_start_timestamp, end_timestamp);
+    raw_header_fill(final_header, s_samples_written, s_start_timestamp, end_timestamp, s_rate_mhz, s_rate_flags);
     
     // Seek back to beginning and rewrite header
     if (lseek(s_current_fd, 0, SEEK_SET) == 0) {
@@ -175,8 +216,9 @@ esp_err_t raw_audio_storage_stop_recording(void) {
         if (header_written != 32) {
             ESP_LOGW(TAG, "Failed to update file header (errno: %d)", errno);
         } else {
-            ESP_LOGI(TAG, "Final header updated: %lu samples, %lu->%lu ms", 
-                     s_samples_written, s_start_timestamp, end_timestamp);
+            ESP_LOGI(TAG, "Final header updated: %lu samples, %lu->%lu ms, measured %lu.%03lu Hz%s",
+                     s_samples_written, s_start_timestamp, end_timestamp, (unsigned long)(s_rate_mhz / 1000),
+                     (unsigned long)(s_rate_mhz % 1000), (s_rate_flags & RAW_AUDIO_F_RESAMPLED) ? " (resampled)" : "");
         }
     } else {
         ESP_LOGW(TAG, "Failed to seek to file beginning for header update (errno: %d)", errno);
@@ -186,21 +228,78 @@ esp_err_t raw_audio_storage_stop_recording(void) {
     close(s_current_fd);
     s_current_fd = -1;
     s_is_recording = false;
+    sd_storage_unlock();
     
     ESP_LOGI(TAG, "Raw audio recording stopped - %lu samples written, %lu bytes total", 
              s_samples_written, s_file_size_bytes);
+    if (s_samples_dropped > 0) {
+        ESP_LOGW(TAG, "%lu samples dropped after SD write failures", s_samples_dropped);
+    }
+    return ESP_OK;
+}
+
+// Write and sync the sample buffer; on failure the buffer is kept for the next attempt
+static esp_err_t flush_sample_buffer(void) {
+    size_t len = s_buffer_index * sizeof(raw_audio_sample_t);
+    if (!sd_storage_lock(UINT32_MAX)) return ESP_ERR_TIMEOUT;
+
+    if (FI_HIT(FI_SD_LATENCY, s_file_size_bytes)) {
+        vTaskDelay(pdMS_TO_TICKS(FI_LATENCY_MS(FI_SD_LATENCY)));
+    }
+
+    int64_t t0 = esp_timer_get_time();
+    ssize_t bytes_written;
+    if (FI_HIT(FI_SD_WRITE, s_file_size_bytes)) {
+        bytes_written = -1;
+        errno = EIO;
+    } else {
+        bytes_written = write(s_current_fd, s_sample_buffer, len);
+        // Only synced data counts as committed: it is what a remount will find
+        if (bytes_written == (ssize_t)len && fsync(s_current_fd) != 0) {
+            bytes_written = -1;
+        }
+    }
+    sd_storage_note_write(len, (uint32_t)(esp_timer_get_time() - t0), bytes_written == (ssize_t)len);
+
+    if (bytes_written != (ssize_t)len) {
+        ESP_LOGW(TAG, "Failed to write all samples (%zd/%lu) (errno: %d)", bytes_written, (unsigned long)len, errno);
+        // Rewind a partial write so the retry doesn't duplicate its bytes
+        if (bytes_written > 0) {
+            lseek(s_current_fd, (off_t)s_file_size_bytes, SEEK_SET);
+        }
+        FI_FAILED(FI_SD_WRITE);
+        sd_storage_unlock();
+        return ESP_FAIL;
+    }
+    FI_OK(FI_SD_WRITE);
+    // Before the unlock: a lock holder sees either the full buffer or its committed bytes
+    s_samples_written += s_buffer_index;
+    s_file_size_bytes += bytes_written;
+    s_buffer_index = 0;
+    sd_storage_unlock();
     return ESP_OK;
 }
 
 esp_err_t raw_audio_storage_add_sample(uint16_t mic_adc) {
+    return raw_audio_storage_add_sample_at(mic_adc, esp_timer_get_time() / 1000);
+}
+
+esp_err_t raw_audio_storage_add_sample_at(uint16_t mic_adc, uint32_t timestamp_ms) {
     if (!s_is_recording || s_current_fd < 0) {
         return ESP_ERR_INVALID_STATE;
     }
+
+    // A previous write failed and the buffer is still full: retry before accepting more
+    if (s_buffer_index >= RAW_AUDIO_BUFFER_SIZE && flush_sample_buffer() != ESP_OK) {
+        s_samples_dropped++;
+        FI_LOST(FI_SD_WRITE, sizeof(raw_audio_sample_t));
+        return ESP_FAIL;
+    }
     
     // Create sample with sanitized ADC value
     raw_audio_sample_t sample;
     sample.mic_sample = sanitize_adc(mic_adc);  // Clamps and counts corruption
-    sample.timestamp_ms = esp_timer_get_time() / 1000;
+    sample.timestamp_ms = timestamp_ms;
     sample.sample_count = atomic_fetch_add(&g_sample_seq, 1);
     
     // Add to buffer
@@ -209,16 +308,10 @@ esp_err_t raw_audio_storage_add_sample(uint16_t mic_adc) {
     
     // If buffer is full, write to file
     if (s_buffer_index >= RAW_AUDIO_BUFFER_SIZE) {
-        ssize_t bytes_written = write(s_current_fd, s_sample_buffer, s_buffer_index * sizeof(raw_audio_sample_t));
-        if (bytes_written != (ssize_t)(s_buffer_index * sizeof(raw_audio_sample_t))) {
-            ESP_LOGW(TAG, "Failed to write all samples (%zd/%lu) (errno: %d)", bytes_written, s_buffer_index * sizeof(raw_audio_sample_t), errno);
+        if (flush_sample_buffer() != ESP_OK) {
             return ESP_FAIL;
         }
 
-        s_samples_written += s_buffer_index;
-        s_file_size_bytes += bytes_written;
-        s_buffer_index = 0;
-
         // Log progress every 1000 samples
         if (s_samples_written % 1000 == 0) {
             ESP_LOGI(TAG, "Raw audio progress: %lu samples written", s_samples_written);
@@ -228,6 +321,74 @@ esp_err_t raw_audio_storage_add_sample(uint16_t mic_adc) {
     return ESP_OK;
 }
 
+esp_err_t raw_audio_storage_suspend(void) {
+    if (!s_is_recording || s_suspended) return ESP_ERR_INVALID_STATE;
+    // Errors are expected here: the card is what failed
+    if (s_current_fd >= 0) close(s_current_fd);
+    s_current_fd = -1;
+    s_suspended = true;
+    ESP_LOGW(TAG, "Recording suspended at %lu committed bytes (%lu samples buffered)",
+             (unsigned long)s_file_size_bytes, (unsigned long)s_buffer_index);
+    return ESP_OK;
+}
+
+esp_err_t raw_audio_storage_resume(void) {
+    if (!s_is_recording || !s_suspended) return ESP_ERR_INVALID_STATE;
+    if (!sd_storage_lock(UINT32_MAX)) return ESP_ERR_TIMEOUT;
+
+    esp_err_t ret = ESP_FAIL;
+    int fd = open(s_path, O_WRONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        ESP_LOGE(TAG, "Reopening %s failed (errno: %d)", s_path, errno);
+        goto out;
+    }
+
+    // Anything past the last sync may be half-written; the card may also have lost a sync
+    if ((uint32_t)st.st_size < s_file_size_bytes) {
+        uint32_t samples = st.st_size > 32 ? ((uint32_t)st.st_size - 32) / sizeof(raw_audio_sample_t) : 0;
+        ESP_LOGW(TAG, "Card kept %ld of %lu committed bytes; %lu samples lost",
+                 (long)st.st_size, (unsigned long)s_file_size_bytes,
+                 (unsigned long)(s_samples_written - samples));
+        s_samples_dropped += s_samples_written - samples;
+        s_samples_written = samples;
+        s_file_size_bytes = 32 + samples * sizeof(raw_audio_sample_t);
+    }
+    if (ftruncate(fd, s_file_size_bytes) != 0 || lseek(fd, s_file_size_bytes, SEEK_SET) < 0) {
+        ESP_LOGE(TAG, "Rewinding %s to %lu failed (errno: %d)", s_path,
+                 (unsigned long)s_file_size_bytes, errno);
+        goto out;
+    }
+
+    s_current_fd = fd;
+    fd = -1;
+    s_suspended = false;
+    ESP_LOGI(TAG, "Recording resumed at %lu bytes", (unsigned long)s_file_size_bytes);
+
+    // The buffer that failed goes out first
+    ret = s_buffer_index > 0 ? flush_sample_buffer() : ESP_OK;
+
+out:
+    if (fd >= 0) close(fd);
+    sd_storage_unlock();
+    return ret;
+}
+
+bool raw_audio_storage_tail(raw_audio_tail_t *out) {
+    if (!s_is_recording || s_suspended || s_current_fd < 0) return false;
+    out->records = s_sample_buffer;
+    out->count = s_buffer_index;
+    out->committed = s_file_size_bytes;
+    out->next_seq = atomic_load(&g_sample_seq);
+    out->path = s_path;
+    return true;
+}
+
+void raw_audio_storage_set_rate(uint32_t measured_rate_mhz, uint32_t flags) {
+    s_rate_mhz = measured_rate_mhz;
+    s_rate_flags = flags;
+}
+
 bool raw_audio_storage_is_recording(void) {
     return s_is_recording;
 }
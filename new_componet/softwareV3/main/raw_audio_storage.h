@@ -23,7 +23,8 @@ typedef struct __attribute__((packed)) {
     uint32_t total_samples;    // Total number of samples in file
     uint32_t start_timestamp;  // Start timestamp in milliseconds
     uint32_t end_timestamp;    // End timestamp in milliseconds
-    uint32_t reserved[4];      // Reserved for future use
+    uint32_t measured_rate_mhz; // ADC rate measured against esp_timer, milli-Hz (0 = not measured)
+    uint32_t flags;            // RAW_AUDIO_F_*; both were reserved (zero) in older files
 } raw_audio_header_t;
 
 // Static assert to ensure header packing integrity
@@ -35,6 +36,23 @@ _Static_assert(sizeof(raw_audio_header_t) == 32, "RAW header must be 32 bytes fo
 #define RAW_AUDIO_SAMPLE_RATE 16000  // Updated to 16kHz for high quality
 #define RAW_AUDIO_BUFFER_SIZE 512  // Number of samples to buffer before writing
 
+// Samples were resampled from measured_rate_mhz to exactly sample_rate; without
+// it they are at measured_rate_mhz and sample_rate is only nominal
+#define RAW_AUDIO_F_RESAMPLED 0x00000001u
+// Set from the first header on and cleared by the final one: the recording never
+// closed. Boot repair (pf_journal.h) finishes such a file and sets RECOVERED
+#define RAW_AUDIO_F_OPEN      0x00000002u
+#define RAW_AUDIO_F_RECOVERED 0x00000004u
+
+// Unsynced end of the open recording, for the power-fail journal
+typedef struct {
+    const raw_audio_sample_t *records;  // Buffered samples, RAW_AUDIO_BUFFER_SIZE * 10 bytes readable
+    uint32_t count;
+    uint32_t committed;                 // File offset the buffer belongs at
+    uint32_t next_seq;                  // sample_count the next sample would get
+    const char *path;
+} raw_audio_tail_t;
+
 // Initialize raw audio storage
 esp_err_t raw_audio_storage_init(void);
 
@@ -47,6 +65,22 @@ esp_err_t raw_audio_storage_stop_recording(void);
 // Add a raw audio sample to the current recording (single mic)
 esp_err_t raw_audio_storage_add_sample(uint16_t mic_adc);
 
+// Same, with the time the sample was captured (samples replayed after a card recovery)
+esp_err_t raw_audio_storage_add_sample_at(uint16_t mic_adc, uint32_t timestamp_ms);
+
+// Close the file after a write error, keeping the recording's state and unwritten buffer
+esp_err_t raw_audio_storage_suspend(void);
+
+// Reopen after the card is back: truncate to the last synced offset and write the kept buffer
+esp_err_t raw_audio_storage_resume(void);
+
+// What a power loss now would cost; false unless a file is open for writing.
+// Call from the storage task: the buffer is only stable between samples
+bool raw_audio_storage_tail(raw_audio_tail_t *out);
+
+// Measured sample rate and RAW_AUDIO_F_* for the current file's final header
+void raw_audio_storage_set_rate(uint32_t measured_rate_mhz, uint32_t flags);
+
 // Check if currently recording
 bool raw_audio_storage_is_recording(void);
 
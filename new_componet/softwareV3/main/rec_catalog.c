@@ -0,0 +1,146 @@
+/**
+ * @file rec_catalog.c
+ * @brief NVS-backed recording ID allocator (see rec_catalog.h)
+ */
+
+#include "rec_catalog.h"
+#include "sd_storage.h"
+#include "esp_log.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+static const char *TAG = "rec_catalog";
+
+#define REC_NVS_NAMESPACE  "salestag"
+#define REC_NVS_KEY_END    "rec_id_end"
+#define REC_LATEST_PROBE   (REC_ID_BATCH * 2)  // IDs probed around the allocator before a directory scan
+
+static rec_id_alloc_t s_alloc;
+static uint32_t s_latest = REC_ID_NONE;
+static SemaphoreHandle_t s_lock = NULL;
+
+static bool id_path(uint32_t id, char *path, size_t path_sz) {
+    char name[REC_ID_NAME_LEN];
+    if (!rec_id_format(id, name, sizeof(name))) return false;
+    int n = snprintf(path, path_sz, "%s/%s", SD_REC_DIR, name);
+    return n > 0 && (size_t)n < path_sz;
+}
+
+static bool id_exists(uint32_t id) {
+    char path[64];
+    struct stat st;
+    return id_path(id, path, sizeof(path)) && stat(path, &st) == 0;
+}
+
+static bool store_persist(void *ctx, uint32_t end) {
+    (void)ctx;
+    nvs_handle_t h;
+    esp_err_t err = nvs_open(REC_NVS_NAMESPACE, NVS_READWRITE, &h);
+    if (err == ESP_OK) {
+        err = nvs_set_u32(h, REC_NVS_KEY_END, end);
+        if (err == ESP_OK) err = nvs_commit(h);
+        nvs_close(h);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Persisting ID reservation failed: %s", esp_err_to_name(err));
+    }
+    return err == ESP_OK;
+}
+
+static bool store_exists(void *ctx, uint32_t id) {
+    (void)ctx;
+    return id_exists(id);
+}
+
+// Allocation logs the IDs it skips
+static bool store_taken(void *ctx, uint32_t id) {
+    (void)ctx;
+    if (!id_exists(id)) return false;
+    ESP_LOGW(TAG, "Recording ID %lu already on the card, skipping", (unsigned long)id);
+    return true;
+}
+
+// Fallback only: NVS erased, or the latest recording far below the allocator
+static uint32_t store_highest(void *ctx) {
+    (void)ctx;
+    DIR *dir = opendir(SD_REC_DIR);
+    if (!dir) return REC_ID_NONE;
+    uint32_t highest = REC_ID_NONE;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        uint32_t id = rec_id_parse(entry->d_name);
+        if (id > highest) highest = id;
+    }
+    closedir(dir);
+    ESP_LOGI(TAG, "Scanned for recording IDs: highest %lu", (unsigned long)highest);
+    return highest;
+}
+
+static const rec_id_store_t s_alloc_store = { .persist = store_persist, .exists = store_taken, .highest = store_highest };
+static const rec_id_store_t s_probe_store = { .persist = store_persist, .exists = store_exists, .highest = store_highest };
+
+esp_err_t rec_catalog_init(void) {
+    if (!s_lock) {
+        s_lock = xSemaphoreCreateMutex();
+        if (!s_lock) return ESP_ERR_NO_MEM;
+    }
+
+    uint32_t end = 0;
+    nvs_handle_t h;
+    esp_err_t err = nvs_open(REC_NVS_NAMESPACE, NVS_READONLY, &h);
+    if (err == ESP_OK) {
+        err = nvs_get_u32(h, REC_NVS_KEY_END, &end);
+        nvs_close(h);
+    }
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGW(TAG, "Reading ID reservation failed: %s", esp_err_to_name(err));
+    }
+
+    rec_id_boot(&s_alloc, end);
+    rec_id_resume(&s_alloc, &s_probe_store, REC_LATEST_PROBE);
+    s_latest = REC_ID_NONE;
+    ESP_LOGI(TAG, "Next recording ID %lu", (unsigned long)s_alloc.next);
+    return ESP_OK;
+}
+
+esp_err_t rec_catalog_next(uint32_t *id, char *path, size_t path_sz) {
+    esp_err_t ret = ESP_OK;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    uint32_t candidate = rec_id_next(&s_alloc, &s_alloc_store);
+    if (candidate == REC_ID_NONE) {
+        ret = ESP_ERR_NO_MEM;
+    } else if (!id_path(candidate, path, path_sz)) {
+        ret = ESP_ERR_INVALID_SIZE;
+    } else {
+        *id = candidate;
+    }
+    xSemaphoreGive(s_lock);
+    return ret;
+}
+
+esp_err_t rec_catalog_path(uint32_t id, char *path, size_t path_sz) {
+    if (!id_path(id, path, path_sz)) return ESP_ERR_INVALID_ARG;
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) return ESP_ERR_NOT_FOUND;
+    return ESP_OK;
+}
+
+void rec_catalog_finalized(uint32_t id) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (id > s_latest) s_latest = id;
+    xSemaphoreGive(s_lock);
+}
+
+uint32_t rec_catalog_latest(void) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_latest == REC_ID_NONE) {
+        s_latest = rec_id_latest(&s_alloc, &s_probe_store, REC_LATEST_PROBE);
+    }
+    uint32_t latest = s_latest;
+    xSemaphoreGive(s_lock);
+    return latest;
+}
@@ -0,0 +1,55 @@
+/**
+ * @file rec_catalog.h
+ * @brief Persistent recording IDs (rec_id.h) backed by NVS, and ID -> file lookup
+ *
+ * The reservation end is the only thing written to flash, once per
+ * REC_ID_BATCH recordings. Before an ID is used its file name is checked
+ * on the card, so even with NVS erased an existing recording is never
+ * truncated: taken IDs are skipped. At boot, recordings above the persisted
+ * end are skipped past too (the directory is scanned when NVS has nothing),
+ * so IDs keep increasing. host/recid checks this across resets.
+ */
+
+#ifndef REC_CATALOG_H
+#define REC_CATALOG_H
+
+#include "esp_err.h"
+#include "rec_id.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Load the reservation from NVS (call after nvs_flash_init)
+ */
+esp_err_t rec_catalog_init(void);
+
+/**
+ * @brief Allocate the ID and on-card path for a new recording
+ * @return ESP_ERR_NO_MEM when the ID space is used up, ESP_ERR_INVALID_SIZE if path is too small
+ */
+esp_err_t rec_catalog_next(uint32_t *id, char *path, size_t path_sz);
+
+/**
+ * @brief Path of recording id
+ * @return ESP_ERR_NOT_FOUND if no such file is on the card
+ */
+esp_err_t rec_catalog_path(uint32_t id, char *path, size_t path_sz);
+
+// Recording id was closed cleanly and is now the latest
+void rec_catalog_finalized(uint32_t id);
+
+/**
+ * @brief Newest recording on the card: IDs probed down from the allocator, else a directory scan
+ * @return REC_ID_NONE if no recording has an ID (older names need a scan)
+ */
+uint32_t rec_catalog_latest(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // REC_CATALOG_H
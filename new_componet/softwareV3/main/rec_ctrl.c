@@ -0,0 +1,573 @@
+/**
+ * @file rec_ctrl.c
+ * @brief Recording controller and storage tasks (see rec_ctrl.h)
+ */
+
+#include "rec_ctrl.h"
+#include "audio_capture.h"
+#include "raw_audio_storage.h"
+#include "sd_storage.h"
+#include "sd_recovery.h"
+#include "rec_store.h"
+#include "power_fail.h"
+#include "mem_plan.h"
+#include "sdkconfig.h"
+#include "fault_inject.h"
+#include "ui.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include <string.h>
+#if CONFIG_SALESTAG_WAV_COPY
+#include "wav_writer.h"
+#include "speech_codec.h"
+#include "esp_mac.h"
+#include <errno.h>
+#include <stdio.h>
+#include <sys/time.h>
+#endif
+
+static const char *TAG = "rec_ctrl";
+
+#define REC_SAMPLE_QUEUE_LEN   2048   // ~0.13 s at 16 kHz
+#define REC_EVENT_QUEUE_LEN    16
+#define REC_EVENT_RESERVE      4      // Slots presses can never take
+#define REC_OPEN_TIMEOUT_MS    1000
+#define REC_ERROR_BACKOFF_MS   2000
+#define REC_WRITE_GIVE_UP      50     // Consecutive failed writes before the recording is ended
+#define REC_MAX_RECOVERIES     3      // Card recoveries per recording before it is given up
+#define REC_SERVICE_MS         10     // Queue wait between recovery steps
+#define REC_WAV_BUF_BYTES      8192   // WAV copy write size (16 sectors, 0.25 s)
+
+// In-band markers on the sample queue; ADC results are 12-bit, so no sample looks like these
+#define REC_MARK_FLUSH  0xFFFDu     // Power fail: journal what is buffered and stop (sent to the front)
+#define REC_MARK_OPEN   0xFFFEu
+#define REC_MARK_CLOSE  0xFFFFu
+
+typedef struct {
+    rec_event_t ev;
+    esp_err_t err;
+    int64_t t_us;       // When the event happened (press time for REC_EV_BUTTON)
+} rec_msg_t;
+
+static rec_ctrl_hooks_t s_hooks;
+static QueueHandle_t s_events = NULL;
+static QueueHandle_t s_samples = NULL;
+static TaskHandle_t s_storage_task = NULL;
+static rec_fsm_t s_fsm;                          // Controller task only
+static volatile rec_state_t s_state = REC_IDLE;  // Copy for other tasks
+static char s_path[128];                         // Written before REC_MARK_OPEN is queued
+
+static volatile uint32_t s_overflows = 0;
+static rec_ctrl_stats_t s_stats;
+static portMUX_TYPE s_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static int64_t s_start_press_us;
+static int64_t s_stop_press_us;
+static TickType_t s_retry_at;
+
+static void post(rec_event_t ev, esp_err_t err) {
+    rec_msg_t msg = { .ev = ev, .err = err, .t_us = esp_timer_get_time() };
+    if (xQueueSend(s_events, &msg, portMAX_DELAY) != pdTRUE) {
+        ESP_LOGE(TAG, "Event %s lost", rec_fsm_event_name(ev));
+    }
+}
+
+static void note_latency(uint32_t *last, uint32_t *max, int64_t since_us) {
+    uint32_t us = (uint32_t)(esp_timer_get_time() - since_us);
+    taskENTER_CRITICAL(&s_stats_lock);
+    *last = us;
+    if (us > *max) *max = us;
+    taskEXIT_CRITICAL(&s_stats_lock);
+}
+
+// Runs in the capture task: queue only, never block
+static void raw_adc_callback(uint16_t mic_adc, void *user_ctx) {
+    (void)user_ctx;
+    if (FI_HIT(FI_ADC_OVERFLOW, 0) || xQueueSend(s_samples, &mic_adc, 0) != pdTRUE) {
+        s_overflows++;
+        if (s_state == REC_RECORDING) {
+            FI_FAILED(FI_ADC_OVERFLOW);
+            FI_LOST(FI_ADC_OVERFLOW, sizeof(raw_audio_sample_t));
+        }
+    } else {
+        FI_OK(FI_ADC_OVERFLOW);
+    }
+}
+
+// Storage task state; queue order is file order in every mode
+static rec_store_t s_store;                 // Storage task only
+static uint32_t s_write_failures;
+
+#if CONFIG_SALESTAG_WAV_COPY
+// WAV copy of the open recording: same samples as the RAW file, PCM as the RAW decoders make it
+static wav_writer_t s_wav;                  // Storage task only
+static uint8_t *s_wav_buf;
+static char s_device_id[20];
+
+static void wav_open(void) {
+    char path[sizeof(s_path)];
+    size_t len = strlen(s_path);
+    if (!s_wav_buf || len < 4) return;
+    memcpy(path, s_path, len - 4);
+    strcpy(path + len - 4, ".wav");
+    const char *name = strrchr(s_path, '/');
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    wav_config_t cfg = {
+        .sample_rate = WAV_SAMPLE_RATE,
+        .channels = WAV_CHANNELS,
+        .originator = s_device_id,
+        .reference = name ? name + 1 : s_path,
+        .description = "SalesTag recording",
+        .start_utc_ms = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000,
+        .patch_bytes = CONFIG_SALESTAG_WAV_PATCH_S * WAV_BYTE_RATE,
+    };
+    if (wav_writer_open(&s_wav, path, &cfg, s_wav_buf, REC_WAV_BUF_BYTES) != 0) {
+        ESP_LOGW(TAG, "No WAV copy %s: errno %d", path, errno);
+    }
+}
+
+static void wav_sample(uint16_t v) {
+    if (!wav_writer_is_open(&s_wav)) return;
+    int16_t pcm = speech_codec_adc_to_pcm(v);
+    if (wav_writer_write(&s_wav, &pcm, 1) != 0) {
+        ESP_LOGW(TAG, "WAV copy stopped at %llu bytes: errno %d", (unsigned long long)s_wav.patched_bytes, errno);
+        wav_writer_abandon(&s_wav);
+    }
+}
+
+// The card is going away: the copy keeps what its last patch covers, the RAW file carries on
+static void wav_abandon(void) {
+    if (!wav_writer_is_open(&s_wav)) return;
+    ESP_LOGW(TAG, "WAV copy ends at %llu bytes", (unsigned long long)s_wav.patched_bytes);
+    wav_writer_abandon(&s_wav);
+}
+
+static void wav_close(void) {
+    if (!wav_writer_is_open(&s_wav)) return;
+    if (wav_writer_close(&s_wav) != 0) {
+        ESP_LOGW(TAG, "WAV copy incomplete: errno %d", errno);
+    }
+}
+#else
+static inline void wav_open(void) {}
+static inline void wav_sample(uint16_t v) { (void)v; }
+static inline void wav_abandon(void) {}
+static inline void wav_close(void) {}
+#endif
+
+static bool store_write(void *ctx, uint16_t v, uint32_t ts_ms) {
+    (void)ctx;
+    wav_sample(v);
+    esp_err_t ret = raw_audio_storage_add_sample_at(v, ts_ms);
+    if (ret != ESP_OK) ESP_LOGW(TAG, "Failed to add raw audio sample: %s", esp_err_to_name(ret));
+    return ret == ESP_OK;
+}
+
+#if CONFIG_SALESTAG_SD_RECOVERY
+static void store_suspend(void *ctx) {
+    (void)ctx;
+    wav_abandon();
+#if CONFIG_SALESTAG_POWER_FAIL
+    power_fail_disarm();
+#endif
+    raw_audio_storage_suspend();
+    sd_storage_note_retry();
+}
+
+static bool store_recover(void *ctx) {
+    (void)ctx;
+    return sd_recovery_begin() == ESP_OK;
+}
+
+static rec_store_card_t store_card(void *ctx) {
+    (void)ctx;
+    sd_recovery_state_t st = sd_recovery_state();
+    if (st == SD_RECOVERY_RUNNING) return REC_STORE_CARD_AWAY;
+    sd_recovery_ack();
+    return st == SD_RECOVERY_DONE ? REC_STORE_CARD_BACK : REC_STORE_CARD_GONE;
+}
+
+static bool store_resume(void *ctx) {
+    (void)ctx;
+    if (raw_audio_storage_resume() != ESP_OK) return false;
+    ESP_LOGI(TAG, "Card back, writing %lu spilled samples", (unsigned long)spill_ring_count(sd_recovery_spill()));
+    return true;
+}
+
+static void store_drained(void *ctx) {
+    (void)ctx;
+    const spill_ring_t *spill = sd_recovery_spill();
+    ESP_LOGI(TAG, "Spill drained (peak %lu samples, %lu lost)", (unsigned long)spill->peak, (unsigned long)spill->lost);
+#if CONFIG_SALESTAG_POWER_FAIL
+    // Not while draining: the journal has no place for the spill ring
+    power_fail_arm(s_path);
+#endif
+}
+
+static void store_lost(void *ctx, rec_store_lost_t why) {
+    (void)ctx;
+    static const esp_err_t kErr[] = {
+        [REC_STORE_GAVE_UP] = ESP_ERR_INVALID_RESPONSE,
+        [REC_STORE_NO_RECOVERY] = ESP_ERR_INVALID_STATE,
+        [REC_STORE_NO_CARD] = ESP_ERR_NOT_FOUND,
+    };
+    ESP_LOGE(TAG, "Recording lost its card; spilled samples discarded");
+    post(REC_EV_WRITE_FAILED, kErr[why]);
+}
+
+static const rec_store_ops_t s_store_ops = {
+    .write = store_write,
+    .suspend = store_suspend,
+    .recover = store_recover,
+    .card = store_card,
+    .resume = store_resume,
+    .drained = store_drained,
+    .lost = store_lost,
+};
+#else
+static const rec_store_ops_t s_store_ops = {
+    .write = store_write,
+};
+#endif
+
+static void store_sample(uint16_t v) {
+    if (rec_store_sample(&s_store, v, (uint32_t)(esp_timer_get_time() / 1000))) {
+        s_write_failures = 0;
+        return;
+    }
+#if CONFIG_SALESTAG_SD_RECOVERY
+    // Spill ring full
+    FI_LOST(FI_SD_WRITE, sizeof(raw_audio_sample_t));
+#else
+    if (++s_write_failures == REC_WRITE_GIVE_UP) {
+        post(REC_EV_WRITE_FAILED, ESP_FAIL);
+    }
+    // Retries happen on the next sample; don't spin on a failing card
+    vTaskDelay(pdMS_TO_TICKS(10));
+#endif
+}
+
+static void store_close(void) {
+#if CONFIG_SALESTAG_SD_RECOVERY
+    // Capture has stopped, so this only has to finish what is already spilled
+    while (rec_store_recovering(&s_store)) {
+        if (s_store.mode == REC_STORE_RECOVERING) sd_recovery_wait(UINT32_MAX);
+        rec_store_service(&s_store);
+    }
+#endif
+    uint32_t rate_mhz;
+    bool resampled;
+    if (s_store.mode != REC_STORE_IDLE && audio_capture_get_rate(&rate_mhz, &resampled)) {
+        // Capture has stopped: this includes the whole recording's measurement
+        raw_audio_storage_set_rate(rate_mhz, resampled ? RAW_AUDIO_F_RESAMPLED : 0);
+    }
+    esp_err_t err = s_store.mode == REC_STORE_IDLE ? ESP_OK : raw_audio_storage_stop_recording();
+#if CONFIG_SALESTAG_POWER_FAIL
+    power_fail_disarm();
+#endif
+    wav_close();
+    rec_store_close(&s_store);
+    post(err == ESP_OK ? REC_EV_FINALIZED : REC_EV_FINALIZE_FAILED, err);
+}
+
+#if CONFIG_SALESTAG_POWER_FAIL
+// Between two samples, so no card write is in progress: the buffer and the rest of the queue go to the journal
+static void store_power_fail(void) {
+    size_t cap;
+    uint16_t *vals = power_fail_queue_buf(&cap);
+    uint16_t n = 0;
+    uint16_t v;
+    // Up to the close marker, if the stop was already queued; the capture has halted
+    while (s_store.mode == REC_STORE_WRITING && n < cap && xQueueReceive(s_samples, &v, 0) == pdTRUE && v < REC_MARK_FLUSH) {
+        vals[n++] = v;
+    }
+    power_fail_journal(n);
+    // The power-fail task resets the chip; nothing touches the card again
+    for (;;) vTaskSuspend(NULL);
+}
+#endif
+
+static void store_item(uint16_t v) {
+    static uint32_t sample_counter = 0;
+
+#if CONFIG_SALESTAG_POWER_FAIL
+    if (v == REC_MARK_FLUSH) {
+        store_power_fail();
+        return;
+    }
+#endif
+    if (v == REC_MARK_OPEN) {
+        esp_err_t err = raw_audio_storage_start_recording(s_path);
+        if (err == ESP_OK) rec_store_open(&s_store);
+        s_write_failures = 0;
+        if (err == ESP_OK) wav_open();
+#if CONFIG_SALESTAG_POWER_FAIL
+        if (err == ESP_OK) power_fail_arm(s_path);
+#endif
+        post(err == ESP_OK ? REC_EV_FILE_OPENED : REC_EV_START_FAILED, err);
+        return;
+    }
+    if (v == REC_MARK_CLOSE) {
+        // Every sample captured before the stop was ahead of this marker
+        store_close();
+        return;
+    }
+
+    sample_counter++;
+    // Status every 8000 samples = 0.5 sec at 16kHz
+    if (sample_counter % 8000 == 0) {
+        ESP_LOGI(TAG, "Samples processed: %lu, recording: %s, queue depth: %u, overflows: %lu",
+                 (unsigned long)sample_counter, s_store.mode == REC_STORE_IDLE ? "STANDBY" : "ACTIVE",
+                 (unsigned)uxQueueMessagesWaiting(s_samples), (unsigned long)s_overflows);
+    }
+    store_sample(v);
+}
+
+// The only task that touches the recording file
+static void storage_task(void *arg) {
+    (void)arg;
+    uint16_t v;
+
+    ESP_LOGI(TAG, "Storage task started");
+
+    while (1) {
+        bool recovering = rec_store_recovering(&s_store);
+        TickType_t wait = recovering ? pdMS_TO_TICKS(REC_SERVICE_MS) : portMAX_DELAY;
+        if (xQueueReceive(s_samples, &v, wait) == pdTRUE) {
+            store_item(v);
+            if (!recovering) continue;
+            // While the card is away the queue is emptied into the spill ring before any card work
+            while (xQueueReceive(s_samples, &v, 0) == pdTRUE) {
+                store_item(v);
+            }
+        }
+#if CONFIG_SALESTAG_SD_RECOVERY
+        if (rec_store_recovering(&s_store)) {
+            rec_store_service(&s_store);
+        }
+#endif
+    }
+}
+
+static void run_actions(uint32_t act, const rec_msg_t *msg) {
+    bool pressed = msg->ev == REC_EV_BUTTON;
+
+    if (act & REC_ACT_LED_ON) {
+        ui_set_led(true);
+        s_start_press_us = msg->t_us;
+        note_latency(&s_stats.led_us_last, &s_stats.led_us_max, msg->t_us);
+    }
+    if (act & REC_ACT_RADIO_QUIET) {
+        s_hooks.radio_quiet(true);
+    }
+    if (act & REC_ACT_OPEN_FILE) {
+        uint16_t mark = REC_MARK_OPEN;
+        if (!s_hooks.next_path(s_path, sizeof(s_path))) {
+            s_path[0] = '\0';
+            post(REC_EV_START_FAILED, ESP_ERR_NOT_FOUND);
+        } else if (xQueueSend(s_samples, &mark, pdMS_TO_TICKS(REC_OPEN_TIMEOUT_MS)) != pdTRUE) {
+            post(REC_EV_START_FAILED, ESP_ERR_TIMEOUT);
+        } else {
+            ESP_LOGI(TAG, "Starting recording: %s", s_path);
+        }
+    }
+    if (act & REC_ACT_START_CAPTURE) {
+        esp_err_t err = audio_capture_start();
+        post(err == ESP_OK ? REC_EV_CAPTURE_STARTED : REC_EV_START_FAILED, err);
+    }
+    if (act & REC_ACT_LED_OFF) {
+        ui_set_led(false);
+        s_stop_press_us = msg->t_us;
+        if (pressed) {
+            note_latency(&s_stats.led_us_last, &s_stats.led_us_max, msg->t_us);
+        }
+    }
+    if (act & REC_ACT_STOP_CAPTURE) {
+        audio_capture_stop();
+    }
+    if (act & REC_ACT_DRAIN_CLOSE) {
+        // Capture is stopped, so the queue only shrinks and this wait is bounded by the card
+        uint16_t mark = REC_MARK_CLOSE;
+        xQueueSend(s_samples, &mark, portMAX_DELAY);
+    }
+    if (act & REC_ACT_RADIO_RESUME) {
+        s_hooks.radio_quiet(false);
+    }
+    if (act & REC_ACT_PUBLISH) {
+        if (s_hooks.finalized) s_hooks.finalized(s_path);
+    }
+    if (act & REC_ACT_BACKOFF) {
+        s_retry_at = xTaskGetTickCount() + pdMS_TO_TICKS(REC_ERROR_BACKOFF_MS);
+    }
+    if (act & REC_ACT_REJECT) {
+        ESP_LOGW(TAG, "Press ignored while %s%s", rec_fsm_state_name(s_fsm.state),
+                 s_fsm.state == REC_ARMED ? " (file transfer in progress)" : "");
+    }
+}
+
+static void handle(const rec_msg_t *msg) {
+    rec_state_t from = s_fsm.state;
+    bool allowed = !(s_hooks.start_blocked && s_hooks.start_blocked());
+    uint32_t act = rec_fsm_step(&s_fsm, msg->ev, allowed);
+    s_state = s_fsm.state;
+
+    if (msg->err != ESP_OK) {
+        ESP_LOGW(TAG, "%s: %s", rec_fsm_event_name(msg->ev), esp_err_to_name(msg->err));
+    }
+    if (from != s_fsm.state) {
+        ESP_LOGI(TAG, "%s -> %s (%s)", rec_fsm_state_name(from), rec_fsm_state_name(s_fsm.state),
+                 rec_fsm_event_name(msg->ev));
+    }
+
+    run_actions(act, msg);
+
+    if (from == s_fsm.state) return;
+    if (s_fsm.state == REC_RECORDING) {
+        note_latency(&s_stats.start_us_last, &s_stats.start_us_max, s_start_press_us);
+        taskENTER_CRITICAL(&s_stats_lock);
+        s_stats.starts++;
+        taskEXIT_CRITICAL(&s_stats_lock);
+        ESP_LOGI(TAG, "Recording %lu us after the press (LED %lu us)",
+                 (unsigned long)s_stats.start_us_last, (unsigned long)s_stats.led_us_last);
+    } else if (from == REC_FINALIZING) {
+        note_latency(&s_stats.finalize_us_last, &s_stats.finalize_us_max, s_stop_press_us);
+        taskENTER_CRITICAL(&s_stats_lock);
+        if (s_fsm.state == REC_ERROR) s_stats.failures++;
+        else s_stats.stops++;
+        taskEXIT_CRITICAL(&s_stats_lock);
+        ESP_LOGI(TAG, "%s finalized %lu us after the stop", s_path,
+                 (unsigned long)s_stats.finalize_us_last);
+    }
+}
+
+// The card can come and go; the machine learns about it before acting on a press
+static void sync_readiness(void) {
+    bool ready = sd_storage_is_available();
+    if (s_fsm.state == REC_IDLE && ready) {
+        rec_msg_t msg = { .ev = REC_EV_READY, .err = ESP_OK, .t_us = esp_timer_get_time() };
+        handle(&msg);
+    } else if (s_fsm.state == REC_ARMED && !ready) {
+        rec_msg_t msg = { .ev = REC_EV_NOT_READY, .err = ESP_OK, .t_us = esp_timer_get_time() };
+        handle(&msg);
+    }
+}
+
+static void ctrl_task(void *arg) {
+    (void)arg;
+    rec_msg_t msg;
+
+    sync_readiness();
+    while (1) {
+        TickType_t wait = portMAX_DELAY;
+        if (s_fsm.state == REC_ERROR) {
+            TickType_t now = xTaskGetTickCount();
+            wait = (int32_t)(s_retry_at - now) > 0 ? s_retry_at - now : 0;
+        }
+
+        if (xQueueReceive(s_events, &msg, wait) != pdTRUE) {
+            // Backoff elapsed: retry if the card is still there
+            msg.ev = sd_storage_is_available() ? REC_EV_READY : REC_EV_NOT_READY;
+            msg.err = ESP_OK;
+            msg.t_us = esp_timer_get_time();
+        } else if (msg.ev == REC_EV_BUTTON) {
+            sync_readiness();
+        }
+        handle(&msg);
+    }
+}
+
+esp_err_t rec_ctrl_start(const rec_ctrl_hooks_t *hooks) {
+    if (s_events) return ESP_ERR_INVALID_STATE;
+    if (!hooks || !hooks->next_path || !hooks->radio_quiet) return ESP_ERR_INVALID_ARG;
+
+    s_hooks = *hooks;
+    rec_fsm_init(&s_fsm);
+    memset(&s_stats, 0, sizeof(s_stats));
+
+    s_samples = mem_plan_queue("rec", "samples", REC_SAMPLE_QUEUE_LEN, sizeof(uint16_t));
+    s_events = mem_plan_queue("rec", "events", REC_EVENT_QUEUE_LEN, sizeof(rec_msg_t));
+    if (!s_samples || !s_events) {
+        ESP_LOGE(TAG, "Failed to create queues");
+        return ESP_ERR_NO_MEM;
+    }
+
+#if CONFIG_SALESTAG_WAV_COPY
+    s_wav_buf = mem_plan_alloc("rec", "wav", REC_WAV_BUF_BYTES, MEM_REGION_INTERNAL);
+    if (!s_wav_buf) {
+        ESP_LOGW(TAG, "WAV copy unavailable");
+    }
+    uint8_t mac[6];
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    snprintf(s_device_id, sizeof(s_device_id), "salestag-%02x%02x%02x", mac[3], mac[4], mac[5]);
+#endif
+
+#if CONFIG_SALESTAG_SD_RECOVERY
+    esp_err_t rec_err = sd_recovery_init();
+    if (rec_err != ESP_OK) {
+        ESP_LOGW(TAG, "SD recovery unavailable: %s", esp_err_to_name(rec_err));
+    }
+    // Without the recovery task sd_recovery_begin() fails, which ends the recording as before
+    rec_store_init(&s_store, sd_recovery_spill(), &s_store_ops, REC_MAX_RECOVERIES, RAW_AUDIO_BUFFER_SIZE);
+#else
+    rec_store_init(&s_store, NULL, &s_store_ops, 0, 0);
+#endif
+#if CONFIG_SALESTAG_POWER_FAIL
+    esp_err_t pf_err = power_fail_init();
+    if (pf_err != ESP_OK) {
+        ESP_LOGW(TAG, "Brownout journal unavailable: %s", esp_err_to_name(pf_err));
+    }
+#endif
+
+    // Below capture (5) so writes never delay sampling
+    s_storage_task = mem_plan_task("rec", storage_task, "audio_storage", MEM_STACK_STORAGE, NULL, 4);
+    if (!s_storage_task) {
+        ESP_LOGE(TAG, "Failed to create storage task");
+        return ESP_ERR_NO_MEM;
+    }
+    // Above capture so a press is answered within one scheduler tick
+    if (!mem_plan_task("rec", ctrl_task, "rec_ctrl", MEM_STACK_REC_CTRL, NULL, 6)) {
+        ESP_LOGE(TAG, "Failed to create controller task");
+        return ESP_ERR_NO_MEM;
+    }
+
+    audio_capture_set_raw_adc_callback(raw_adc_callback, NULL);
+    ESP_LOGI(TAG, "Recording controller started");
+    return ESP_OK;
+}
+
+esp_err_t rec_ctrl_button(void) {
+    if (!s_events) return ESP_ERR_INVALID_STATE;
+    // Leave room for the results the controller and storage task post to themselves
+    if (uxQueueSpacesAvailable(s_events) <= REC_EVENT_RESERVE) return ESP_FAIL;
+    rec_msg_t msg = { .ev = REC_EV_BUTTON, .err = ESP_OK, .t_us = esp_timer_get_time() };
+    return xQueueSend(s_events, &msg, 0) == pdTRUE ? ESP_OK : ESP_FAIL;
+}
+
+#if CONFIG_SALESTAG_POWER_FAIL
+bool rec_ctrl_power_fail(uint32_t timeout_ms) {
+    if (!s_samples || !s_storage_task) return false;
+    // Capture has halted, so from here the storage task only empties the queue up to the marker
+    vTaskPrioritySet(s_storage_task, configMAX_PRIORITIES - 2);
+    uint16_t mark = REC_MARK_FLUSH;
+    return xQueueSendToFront(s_samples, &mark, pdMS_TO_TICKS(timeout_ms)) == pdTRUE;
+}
+#endif
+
+rec_state_t rec_ctrl_state(void) {
+    return s_state;
+}
+
+bool rec_ctrl_is_recording(void) {
+    return rec_fsm_busy(s_state);
+}
+
+void rec_ctrl_get_stats(rec_ctrl_stats_t *out) {
+    taskENTER_CRITICAL(&s_stats_lock);
+    *out = s_stats;
+    taskEXIT_CRITICAL(&s_stats_lock);
+    out->overflows = s_overflows;
+}
@@ -0,0 +1,82 @@
+/**
+ * @file rec_ctrl.h
+ * @brief Recording controller: one task owns the recording state machine
+ *
+ * Button presses, storage results and capture results are all events on
+ * the controller's queue (rec_fsm.h); nothing else starts or stops a
+ * recording. Samples reach the card through an ordered queue shared with
+ * open/close markers, so a stop is complete exactly when the storage task
+ * reaches the close marker — every sample captured before the stop is in
+ * the file, with no fixed sleeps on the way.
+ */
+
+#ifndef REC_CTRL_H
+#define REC_CTRL_H
+
+#include "esp_err.h"
+#include "rec_fsm.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    bool (*next_path)(char *path, size_t len);  // Name for the next recording; false fails the start
+    bool (*start_blocked)(void);                // Another user owns the card (may be NULL)
+    void (*radio_quiet)(bool quiet);            // Stop/resume advertising around a recording
+    void (*finalized)(const char *path);        // A recording was closed cleanly (may be NULL)
+} rec_ctrl_hooks_t;
+
+// Latencies in microseconds, measured from the press as seen by the button callback
+typedef struct {
+    uint32_t starts;
+    uint32_t stops;
+    uint32_t failures;
+    uint32_t overflows;          // Samples dropped because the queue was full
+    uint32_t led_us_last;        // Press -> LED changed
+    uint32_t led_us_max;
+    uint32_t start_us_last;      // Press -> file open and ADC running
+    uint32_t start_us_max;
+    uint32_t finalize_us_last;   // Stop press -> last sample written and file closed
+    uint32_t finalize_us_max;
+} rec_ctrl_stats_t;
+
+/**
+ * @brief Create the sample queue, storage task and controller task
+ *
+ * Registers the raw ADC callback; call after audio_capture_init() and
+ * raw_audio_storage_init(). Hooks are copied.
+ */
+esp_err_t rec_ctrl_start(const rec_ctrl_hooks_t *hooks);
+
+/**
+ * @brief Post a button press (never blocks)
+ * @return ESP_ERR_INVALID_STATE before rec_ctrl_start(), ESP_FAIL if the queue is full
+ */
+esp_err_t rec_ctrl_button(void);
+
+rec_state_t rec_ctrl_state(void);
+
+// True while a recording owns the card and ADC (STARTING..FINALIZING)
+bool rec_ctrl_is_recording(void);
+
+void rec_ctrl_get_stats(rec_ctrl_stats_t *out);
+
+/**
+ * @brief Power fail (power_fail.c): have the storage task journal its buffer and the queue, then stop
+ *
+ * Raises the storage task's priority and puts a flush marker at the front of
+ * the sample queue; the storage task takes it after the sample or write in
+ * hand and answers with power_fail_journal().
+ * @return false if the marker could not be queued within timeout_ms
+ */
+bool rec_ctrl_power_fail(uint32_t timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // REC_CTRL_H
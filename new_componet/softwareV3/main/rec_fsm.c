@@ -0,0 +1,152 @@
+/**
+ * @file rec_fsm.c
+ * @brief Recording state machine transitions (see rec_fsm.h)
+ */
+
+#include "rec_fsm.h"
+#include <stddef.h>
+
+#define STARTED_FILE    (1u << 0)
+#define STARTED_CAPTURE (1u << 1)
+#define STARTED_ALL     (STARTED_FILE | STARTED_CAPTURE)
+
+#define ACT_STOP   (REC_ACT_LED_OFF | REC_ACT_STOP_CAPTURE | REC_ACT_DRAIN_CLOSE)
+
+void rec_fsm_init(rec_fsm_t *f) {
+    f->state = REC_IDLE;
+    f->started = 0;
+    f->stop_pending = false;
+    f->failed = false;
+}
+
+static uint32_t begin_finalize(rec_fsm_t *f, bool failed) {
+    f->state = REC_FINALIZING;
+    f->failed = failed;
+    return ACT_STOP;
+}
+
+static uint32_t step_starting(rec_fsm_t *f, rec_event_t ev) {
+    switch (ev) {
+    case REC_EV_FILE_OPENED:
+        f->started |= STARTED_FILE;
+        break;
+    case REC_EV_CAPTURE_STARTED:
+        f->started |= STARTED_CAPTURE;
+        break;
+    case REC_EV_BUTTON:
+        // The LED answers the press now; the stop itself waits for the start to settle
+        if (f->stop_pending) return REC_ACT_REJECT;
+        f->stop_pending = true;
+        return REC_ACT_LED_OFF;
+    case REC_EV_START_FAILED:
+    case REC_EV_WRITE_FAILED:
+    case REC_EV_NOT_READY:
+        // Whatever half did start is undone by the normal stop path
+        return begin_finalize(f, true);
+    default:
+        return 0;
+    }
+
+    if (f->started != STARTED_ALL) return 0;
+    if (f->stop_pending) {
+        return begin_finalize(f, false) & ~REC_ACT_LED_OFF;
+    }
+    f->state = REC_RECORDING;
+    return 0;
+}
+
+uint32_t rec_fsm_step(rec_fsm_t *f, rec_event_t ev, bool start_allowed) {
+    switch (f->state) {
+    case REC_IDLE:
+        if (ev == REC_EV_READY) {
+            f->state = REC_ARMED;
+            return 0;
+        }
+        return ev == REC_EV_BUTTON ? REC_ACT_REJECT : 0;
+
+    case REC_ARMED:
+        if (ev == REC_EV_NOT_READY) {
+            f->state = REC_IDLE;
+            return 0;
+        }
+        if (ev != REC_EV_BUTTON) return 0;
+        if (!start_allowed) return REC_ACT_REJECT;
+        f->state = REC_STARTING;
+        f->started = 0;
+        f->stop_pending = false;
+        f->failed = false;
+        return REC_ACT_LED_ON | REC_ACT_RADIO_QUIET | REC_ACT_OPEN_FILE | REC_ACT_START_CAPTURE;
+
+    case REC_STARTING:
+        return step_starting(f, ev);
+
+    case REC_RECORDING:
+        switch (ev) {
+        case REC_EV_BUTTON:
+            return begin_finalize(f, false);
+        case REC_EV_WRITE_FAILED:
+        case REC_EV_NOT_READY:
+            return begin_finalize(f, true);
+        default:
+            return 0;
+        }
+
+    case REC_FINALIZING:
+        switch (ev) {
+        case REC_EV_FINALIZED:
+            if (f->failed) {
+                f->state = REC_ERROR;
+                return REC_ACT_RADIO_RESUME | REC_ACT_BACKOFF;
+            }
+            f->state = REC_ARMED;
+            return REC_ACT_RADIO_RESUME | REC_ACT_PUBLISH;
+        case REC_EV_FINALIZE_FAILED:
+            f->state = REC_ERROR;
+            return REC_ACT_RADIO_RESUME | REC_ACT_BACKOFF;
+        case REC_EV_WRITE_FAILED:
+        case REC_EV_NOT_READY:
+            f->failed = true;
+            return 0;
+        case REC_EV_BUTTON:
+            return REC_ACT_REJECT;
+        default:
+            return 0;
+        }
+
+    case REC_ERROR:
+        switch (ev) {
+        case REC_EV_READY:
+            f->state = REC_ARMED;
+            return 0;
+        case REC_EV_NOT_READY:
+            f->state = REC_IDLE;
+            return 0;
+        case REC_EV_BUTTON:
+            return REC_ACT_REJECT;
+        default:
+            return 0;
+        }
+
+    default:
+        return 0;
+    }
+}
+
+bool rec_fsm_busy(rec_state_t s) {
+    return s == REC_STARTING || s == REC_RECORDING || s == REC_FINALIZING;
+}
+
+const char *rec_fsm_state_name(rec_state_t s) {
+    static const char *const names[REC_STATE_COUNT] = {
+        "IDLE", "ARMED", "STARTING", "RECORDING", "FINALIZING", "ERROR",
+    };
+    return (unsigned)s < REC_STATE_COUNT ? names[s] : "?";
+}
+
+const char *rec_fsm_event_name(rec_event_t ev) {
+    static const char *const names[REC_EV_COUNT] = {
+        "READY", "NOT_READY", "BUTTON", "FILE_OPENED", "CAPTURE_STARTED",
+        "START_FAILED", "WRITE_FAILED", "FINALIZED", "FINALIZE_FAILED",
+    };
+    return (unsigned)ev < REC_EV_COUNT ? names[ev] : "?";
+}
@@ -0,0 +1,93 @@
+/**
+ * @file rec_fsm.h
+ * @brief Recording state machine: states, events and the actions each transition asks for
+ *
+ *   IDLE ──READY──▶ ARMED ──BUTTON──▶ STARTING ──FILE_OPENED + CAPTURE_STARTED──▶ RECORDING
+ *     ▲               ▲                   │ START_FAILED                              │ BUTTON,
+ *     │ NOT_READY     │ FINALIZED         ▼                                           │ WRITE_FAILED
+ *   ERROR ◀──failed── FINALIZING ◀────────┴───────────────────────────────────────────┘
+ *
+ * Start is pipelined: the file is opened by the storage task while the ADC
+ * is already running, so neither waits for the other and the first samples
+ * queue up behind the open. Stop always goes through FINALIZING, which ends
+ * when the storage task has written everything captured before the stop.
+ *
+ * A press while STARTING is remembered and turns into a stop as soon as the
+ * start completes. Events that make no sense in the current state are
+ * ignored. Pure C: the controller (rec_ctrl.c) feeds events in and executes
+ * the returned actions.
+ */
+
+#ifndef REC_FSM_H
+#define REC_FSM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    REC_IDLE = 0,       // Card or capture not usable
+    REC_ARMED,          // Ready; a press starts a recording
+    REC_STARTING,       // File open and capture start in flight
+    REC_RECORDING,
+    REC_FINALIZING,     // Capture stopped, storage draining and closing the file
+    REC_ERROR,          // Last recording failed; waits for a retry
+    REC_STATE_COUNT
+} rec_state_t;
+
+typedef enum {
+    REC_EV_READY = 0,       // Card mounted and capture initialised
+    REC_EV_NOT_READY,
+    REC_EV_BUTTON,
+    REC_EV_FILE_OPENED,
+    REC_EV_CAPTURE_STARTED,
+    REC_EV_START_FAILED,
+    REC_EV_WRITE_FAILED,    // Storage gave up on the card mid-recording
+    REC_EV_FINALIZED,       // Everything before the stop is on the card and the file is closed
+    REC_EV_FINALIZE_FAILED,
+    REC_EV_COUNT
+} rec_event_t;
+
+// Actions, executed by the controller in ascending bit order
+#define REC_ACT_LED_ON        (1u << 0)
+#define REC_ACT_RADIO_QUIET   (1u << 1)   // Stop advertising while recording
+#define REC_ACT_OPEN_FILE     (1u << 2)   // Queue the open ahead of the first sample
+#define REC_ACT_START_CAPTURE (1u << 3)
+#define REC_ACT_LED_OFF       (1u << 4)
+#define REC_ACT_STOP_CAPTURE  (1u << 5)   // Returns once no more samples can be queued
+#define REC_ACT_DRAIN_CLOSE   (1u << 6)   // Queue the close behind the last sample
+#define REC_ACT_RADIO_RESUME  (1u << 7)
+#define REC_ACT_PUBLISH       (1u << 8)   // The finished file becomes the selected one
+#define REC_ACT_BACKOFF       (1u << 9)   // Re-check readiness after a delay
+#define REC_ACT_REJECT        (1u << 10)  // Press ignored (busy or not ready)
+
+typedef struct {
+    rec_state_t state;
+    uint8_t started;        // REC_EV_FILE_OPENED / REC_EV_CAPTURE_STARTED seen while STARTING
+    bool stop_pending;      // Pressed again before the start completed
+    bool failed;            // This recording ends in ERROR
+} rec_fsm_t;
+
+void rec_fsm_init(rec_fsm_t *f);
+
+/**
+ * @brief Apply one event
+ * @param start_allowed False while something else owns the card (file transfer)
+ * @return REC_ACT_* bits for the controller; f->state is already the new state
+ */
+uint32_t rec_fsm_step(rec_fsm_t *f, rec_event_t ev, bool start_allowed);
+
+// True from STARTING through FINALIZING: the card and ADC belong to the recording
+bool rec_fsm_busy(rec_state_t s);
+
+const char *rec_fsm_state_name(rec_state_t s);
+const char *rec_fsm_event_name(rec_event_t ev);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // REC_FSM_H
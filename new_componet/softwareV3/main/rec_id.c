@@ -0,0 +1,91 @@
+/**
+ * @file rec_id.c
+ * @brief Recording ID allocation and naming (see rec_id.h)
+ */
+
+#include "rec_id.h"
+#include <stdio.h>
+#include <string.h>
+
+#define REC_ID_DIGITS 7
+
+void rec_id_boot(rec_id_alloc_t *a, uint32_t persisted_end) {
+    // IDs up to the persisted end may have been used before the reboot
+    a->next = persisted_end > 0 ? persisted_end : 1;
+    a->reserved_end = a->next;
+}
+
+bool rec_id_need_reserve(const rec_id_alloc_t *a, uint32_t *end) {
+    if (a->next < a->reserved_end) return false;
+    uint32_t e = a->next + REC_ID_BATCH;
+    *end = e > REC_ID_MAX + 1 ? REC_ID_MAX + 1 : e;
+    return true;
+}
+
+void rec_id_reserved(rec_id_alloc_t *a, uint32_t end) {
+    if (end > a->reserved_end) a->reserved_end = end;
+}
+
+uint32_t rec_id_take(rec_id_alloc_t *a) {
+    if (a->next >= a->reserved_end || a->next > REC_ID_MAX) return REC_ID_NONE;
+    return a->next++;
+}
+
+void rec_id_skip_past(rec_id_alloc_t *a, uint32_t id) {
+    if (id >= a->next) a->next = id + 1;
+}
+
+void rec_id_resume(rec_id_alloc_t *a, const rec_id_store_t *store, uint32_t probe) {
+    if (a->next <= 1) {
+        uint32_t highest = store->highest(store->ctx);
+        if (highest != REC_ID_NONE) rec_id_skip_past(a, highest);
+        return;
+    }
+    for (uint32_t id = a->next, misses = 0; id <= REC_ID_MAX && misses < probe; id++) {
+        if (store->exists(store->ctx, id)) {
+            rec_id_skip_past(a, id);
+            misses = 0;
+        } else {
+            misses++;
+        }
+    }
+}
+
+uint32_t rec_id_next(rec_id_alloc_t *a, const rec_id_store_t *store) {
+    for (;;) {
+        uint32_t end;
+        if (rec_id_need_reserve(a, &end)) {
+            // Still safe if this fails: a file from a reused ID is found and skipped below
+            store->persist(store->ctx, end);
+            rec_id_reserved(a, end);
+        }
+        uint32_t id = rec_id_take(a);
+        if (id == REC_ID_NONE || !store->exists(store->ctx, id)) return id;
+    }
+}
+
+uint32_t rec_id_latest(const rec_id_alloc_t *a, const rec_id_store_t *store, uint32_t probe) {
+    // After a reboot the last recording sits somewhere below the allocator
+    for (uint32_t id = a->next - 1, n = 0; id > REC_ID_NONE && n < probe; id--, n++) {
+        if (store->exists(store->ctx, id)) return id;
+    }
+    return store->highest(store->ctx);
+}
+
+bool rec_id_format(uint32_t id, char *out, size_t out_sz) {
+    if (id == REC_ID_NONE || id > REC_ID_MAX || out_sz < REC_ID_NAME_LEN) return false;
+    snprintf(out, out_sz, "r%0*lu.raw", REC_ID_DIGITS, (unsigned long)id);
+    return true;
+}
+
+uint32_t rec_id_parse(const char *name) {
+    if (strlen(name) != REC_ID_NAME_LEN - 1 || name[0] != 'r') return REC_ID_NONE;
+    if (strcmp(name + 1 + REC_ID_DIGITS, ".raw") != 0) return REC_ID_NONE;
+
+    uint32_t id = 0;
+    for (int i = 1; i <= REC_ID_DIGITS; i++) {
+        if (name[i] < '0' || name[i] > '9') return REC_ID_NONE;
+        id = id * 10 + (uint32_t)(name[i] - '0');
+    }
+    return id;
+}
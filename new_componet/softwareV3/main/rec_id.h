@@ -0,0 +1,119 @@
+/**
+ * @file rec_id.h
+ * @brief Monotonic recording IDs and the file names derived from them
+ *
+ * Every recording gets an ID that is never handed out twice, across
+ * reboots and power loss. IDs are reserved in batches: before the first ID
+ * of a batch is used, the end of the batch is persisted, so a reboot
+ * resumes after the last persisted end and at most one flash write is
+ * made per REC_ID_BATCH recordings. A reboot skips the rest of the
+ * current batch, so IDs have gaps but never repeat.
+ *
+ * rec_id_next() is the whole allocation: it persists a reservation when
+ * one is needed, takes the next ID and skips IDs whose file is already on
+ * the card (NVS erased, or a reservation that failed to persist). At boot
+ * rec_id_resume() moves past recordings the persisted end does not cover.
+ * The store behind them is a set of callbacks, NVS and the card in
+ * rec_catalog.c; a directory scan is only the fallback.
+ *
+ * File names are "r" + seven zero-padded digits + ".raw" (8.3-safe), so
+ * they sort by ID and a recording can be found from its ID without
+ * scanning the directory. Pure C.
+ */
+
+#ifndef REC_ID_H
+#define REC_ID_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define REC_ID_BATCH    16
+#define REC_ID_MAX      9999999u   // Seven digits
+#define REC_ID_NONE     0u
+#define REC_ID_NAME_LEN 13         // "r0000001.raw" + NUL
+
+typedef struct {
+    uint32_t next;          // Next ID to hand out
+    uint32_t reserved_end;  // First ID not covered by the persisted reservation
+} rec_id_alloc_t;
+
+// Where the reservation is persisted and recordings are found
+typedef struct {
+    bool (*persist)(void *ctx, uint32_t end);   // False if not durably written
+    bool (*exists)(void *ctx, uint32_t id);     // A file for id is on the card
+    uint32_t (*highest)(void *ctx);             // Directory scan: highest ID on the card, REC_ID_NONE if none
+    void *ctx;
+} rec_id_store_t;
+
+/**
+ * @brief Resume after boot
+ * @param persisted_end Last value persisted by the store (0 if none)
+ */
+void rec_id_boot(rec_id_alloc_t *a, uint32_t persisted_end);
+
+/**
+ * @brief Does the next rec_id_take() need a new reservation persisted first?
+ * @param end Set to the value to persist when true
+ */
+bool rec_id_need_reserve(const rec_id_alloc_t *a, uint32_t *end);
+
+// The store has durably written end (from rec_id_need_reserve)
+void rec_id_reserved(rec_id_alloc_t *a, uint32_t end);
+
+/**
+ * @brief Hand out the next ID
+ * @return REC_ID_NONE if no reservation covers it or the ID space is used up
+ */
+uint32_t rec_id_take(rec_id_alloc_t *a);
+
+// Never hand out ID id or anything below it (an existing file was found there)
+void rec_id_skip_past(rec_id_alloc_t *a, uint32_t id);
+
+/**
+ * @brief After rec_id_boot(): move past recordings the persisted end does not cover
+ *
+ * With nothing persisted (NVS erased) the directory scan decides. Otherwise
+ * IDs from a->next up are probed until probe of them in a row have no file,
+ * which finds the recordings of reservations that failed to persist.
+ */
+void rec_id_resume(rec_id_alloc_t *a, const rec_id_store_t *store, uint32_t probe);
+
+/**
+ * @brief Allocate the ID of a new recording: reserve, take, skip IDs on the card
+ *
+ * A reservation that fails to persist is used anyway; after a reboot the
+ * IDs it covered are found on the card and skipped.
+ * @return REC_ID_NONE when the ID space is used up
+ */
+uint32_t rec_id_next(rec_id_alloc_t *a, const rec_id_store_t *store);
+
+/**
+ * @brief Newest recording, probing down from the allocator
+ * @param probe IDs checked below a->next before falling back to the directory scan
+ *        (resets between reserving an ID and creating its file leave longer gaps)
+ * @return REC_ID_NONE if there is no recording with an ID
+ */
+uint32_t rec_id_latest(const rec_id_alloc_t *a, const rec_id_store_t *store, uint32_t probe);
+
+/**
+ * @brief File name for an ID ("r0000042.raw")
+ * @return false if id is out of range or out is too small
+ */
+bool rec_id_format(uint32_t id, char *out, size_t out_sz);
+
+/**
+ * @brief ID of a file name written by rec_id_format()
+ * @return REC_ID_NONE for anything else (older naming schemes included)
+ */
+uint32_t rec_id_parse(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // REC_ID_H
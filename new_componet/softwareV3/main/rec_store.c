@@ -0,0 +1,105 @@
+/**
+ * @file rec_store.c
+ * @brief Recording write path across card recoveries (see rec_store.h)
+ */
+
+#include "rec_store.h"
+#include <stddef.h>
+
+void rec_store_init(rec_store_t *s, spill_ring_t *spill, const rec_store_ops_t *ops,
+                    uint32_t max_recoveries, uint32_t drain_batch) {
+    s->mode = REC_STORE_IDLE;
+    s->recoveries = 0;
+    s->max_recoveries = max_recoveries;
+    s->drain_batch = drain_batch ? drain_batch : 1;
+    s->spill = spill;
+    s->ops = ops;
+}
+
+void rec_store_open(rec_store_t *s) {
+    s->mode = REC_STORE_WRITING;
+    s->recoveries = 0;
+}
+
+void rec_store_close(rec_store_t *s) {
+    s->mode = REC_STORE_IDLE;
+}
+
+static void store_lost(rec_store_t *s, rec_store_lost_t why) {
+    if (s->spill) spill_ring_clear(s->spill);
+    s->mode = REC_STORE_LOST;
+    s->ops->lost(s->ops->ctx, why);
+}
+
+static void begin_recovery(rec_store_t *s) {
+    if (++s->recoveries > s->max_recoveries) {
+        store_lost(s, REC_STORE_GAVE_UP);
+        return;
+    }
+    s->ops->suspend(s->ops->ctx);
+    if (!s->ops->recover(s->ops->ctx)) {
+        store_lost(s, REC_STORE_NO_RECOVERY);
+        return;
+    }
+    s->mode = REC_STORE_RECOVERING;
+}
+
+bool rec_store_sample(rec_store_t *s, uint16_t v, uint32_t now_ms) {
+    switch (s->mode) {
+    case REC_STORE_WRITING:
+        break;
+    case REC_STORE_RECOVERING:
+    case REC_STORE_DRAINING:
+        return spill_ring_push(s->spill, v, now_ms);
+    default:
+        // Between recordings the queue is just drained
+        return true;
+    }
+
+    if (s->ops->write(s->ops->ctx, v, now_ms)) return true;
+    if (!s->ops->recover || !s->spill) return false;
+    // The sample is in the file's buffer, which survives the suspend
+    begin_recovery(s);
+    return true;
+}
+
+void rec_store_service(rec_store_t *s) {
+    if (s->mode == REC_STORE_RECOVERING) {
+        rec_store_card_t card = s->ops->card(s->ops->ctx);
+        if (card == REC_STORE_CARD_AWAY) return;
+        if (card != REC_STORE_CARD_BACK) {
+            store_lost(s, REC_STORE_NO_CARD);
+            return;
+        }
+        if (!s->ops->resume(s->ops->ctx)) {
+            begin_recovery(s);
+            return;
+        }
+        s->mode = REC_STORE_DRAINING;
+    }
+
+    if (s->mode != REC_STORE_DRAINING) return;
+    uint16_t v;
+    uint32_t ts;
+    for (uint32_t i = 0; i < s->drain_batch && spill_ring_pop(s->spill, &v, &ts); i++) {
+        if (!s->ops->write(s->ops->ctx, v, ts)) {
+            begin_recovery(s);
+            return;
+        }
+    }
+    if (spill_ring_count(s->spill) == 0) {
+        s->mode = REC_STORE_WRITING;
+        if (s->ops->drained) s->ops->drained(s->ops->ctx);
+    }
+}
+
+const char *rec_store_mode_name(rec_store_mode_t mode) {
+    switch (mode) {
+    case REC_STORE_IDLE:       return "IDLE";
+    case REC_STORE_WRITING:    return "WRITING";
+    case REC_STORE_RECOVERING: return "RECOVERING";
+    case REC_STORE_DRAINING:   return "DRAINING";
+    case REC_STORE_LOST:       return "LOST";
+    }
+    return "?";
+}
@@ -0,0 +1,109 @@
+/**
+ * @file rec_store.h
+ * @brief Storage task's write path for one recording, across SD card recoveries
+ *
+ * Samples come off the capture queue in order and go to the recording
+ * file. When a write fails, the file is suspended (its unwritten buffer is
+ * kept) and a card recovery is started; samples then go to the spill ring.
+ * Once the card is back the file is resumed, which writes the kept buffer
+ * first, and rec_store_service() drains the spill ring ahead of new
+ * samples, which keep going to the ring until it is empty. Queue order is
+ * file order throughout, so nothing is written twice or out of order.
+ * A recording gives up after max_recoveries, or when the card does not
+ * come back; the spill is discarded then.
+ *
+ * The card, the file and the recovery task are callbacks (rec_ctrl.c on
+ * target), so host tools can drive this with faults. Pure C.
+ */
+
+#ifndef REC_STORE_H
+#define REC_STORE_H
+
+#include "spill_ring.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    REC_STORE_IDLE = 0,     // No file open, samples discarded
+    REC_STORE_WRITING,
+    REC_STORE_RECOVERING,   // Card being power-cycled, samples go to the spill ring
+    REC_STORE_DRAINING,     // Card back, spill ring written ahead of new samples
+    REC_STORE_LOST,         // Card did not come back; discard until the close
+} rec_store_mode_t;
+
+typedef enum {
+    REC_STORE_CARD_AWAY = 0,    // Recovery still running
+    REC_STORE_CARD_BACK,        // Remounted and writable
+    REC_STORE_CARD_GONE,        // Recovery gave up
+} rec_store_card_t;
+
+typedef enum {
+    REC_STORE_GAVE_UP = 0,      // More than max_recoveries in this recording
+    REC_STORE_NO_RECOVERY,      // A recovery could not be started
+    REC_STORE_NO_CARD,          // The card did not come back
+} rec_store_lost_t;
+
+typedef struct {
+    // Add a sample to the file; false if a card write failed (the sample is then in the kept buffer)
+    bool (*write)(void *ctx, uint16_t v, uint32_t ts_ms);
+    // Close the file, keeping its unwritten buffer
+    void (*suspend)(void *ctx);
+    // Start the card recovery; false if it could not be started. NULL: no recovery, write failures are the caller's
+    bool (*recover)(void *ctx);
+    // Result of the recovery; a finished result is consumed
+    rec_store_card_t (*card)(void *ctx);
+    // Reopen the file at its committed size and write the kept buffer; false if that fails
+    bool (*resume)(void *ctx);
+    // Spill written, back to plain writing (may be NULL)
+    void (*drained)(void *ctx);
+    // Recording given up; the spill was discarded
+    void (*lost)(void *ctx, rec_store_lost_t why);
+    void *ctx;
+} rec_store_ops_t;
+
+typedef struct {
+    rec_store_mode_t mode;
+    uint32_t recoveries;        // In the current recording
+    uint32_t max_recoveries;
+    uint32_t drain_batch;       // Spilled samples written per rec_store_service()
+    spill_ring_t *spill;        // NULL without recovery
+    const rec_store_ops_t *ops;
+} rec_store_t;
+
+void rec_store_init(rec_store_t *s, spill_ring_t *spill, const rec_store_ops_t *ops,
+                    uint32_t max_recoveries, uint32_t drain_batch);
+
+// The file was opened: start writing
+void rec_store_open(rec_store_t *s);
+
+// The file was closed or given up on (the spill must be drained first)
+void rec_store_close(rec_store_t *s);
+
+/**
+ * @brief Store the next sample off the queue
+ * @param now_ms Arrival time, for a sample that is written or spilled
+ * @return false if a write failed with no recovery (ops->recover NULL) or the spill ring was full
+ */
+bool rec_store_sample(rec_store_t *s, uint16_t v, uint32_t now_ms);
+
+/**
+ * @brief Move recovery forward: collect its result, then write up to drain_batch spilled samples
+ */
+void rec_store_service(rec_store_t *s);
+
+// Recovering or draining: rec_store_service() has work
+static inline bool rec_store_recovering(const rec_store_t *s) {
+    return s->mode == REC_STORE_RECOVERING || s->mode == REC_STORE_DRAINING;
+}
+
+const char *rec_store_mode_name(rec_store_mode_t mode);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // REC_STORE_H
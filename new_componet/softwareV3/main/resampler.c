@@ -0,0 +1,144 @@
+/**
+ * @file resampler.c
+ * @brief Polyphase asynchronous resampler (see resampler.h)
+ */
+
+#include "resampler.h"
+#include <math.h>
+#include <string.h>
+
+#define ONE_Q32        (1ull << 32)
+#define PHASE_BITS     5            // log2(RESAMPLER_PHASES)
+#define KAISER_BETA    6.0f         // About 60 dB stopband with 16 taps
+
+_Static_assert((1 << PHASE_BITS) == RESAMPLER_PHASES, "PHASE_BITS must match RESAMPLER_PHASES");
+_Static_assert(RESAMPLER_TAPS % 2 == 0, "the window centre is between two taps");
+
+// Zeroth-order modified Bessel function, power series
+static float bessel_i0(float x) {
+    float sum = 1.0f, term = 1.0f;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2.0f * k)) * (x / (2.0f * k));
+        sum += term;
+        if (term < sum * 1e-9f) break;
+    }
+    return sum;
+}
+
+/*
+ * Phase p is the filter for an output p/PHASES of a sample after the window
+ * centre. Tap j sits j - TAPS/2 + 1 samples from the centre, so its distance
+ * to the output is d = j - TAPS/2 + 1 - p/PHASES, within (-TAPS/2, TAPS/2].
+ * The extra phase PHASES equals phase 0 one sample later; it is only used as
+ * the upper end of the interpolation.
+ */
+static void build_table(resampler_t *r) {
+    const float half = RESAMPLER_TAPS / 2;
+    const float i0_beta = bessel_i0(KAISER_BETA);
+    for (int p = 0; p <= RESAMPLER_PHASES; p++) {
+        float h[RESAMPLER_TAPS];
+        float sum = 0.0f;
+        for (int j = 0; j < RESAMPLER_TAPS; j++) {
+            float d = (float)(j - RESAMPLER_TAPS / 2 + 1) - (float)p / RESAMPLER_PHASES;
+            float x = 2.0f * RESAMPLER_CUTOFF * d;
+            float sinc = fabsf(x) < 1e-6f ? 1.0f : sinf((float)M_PI * x) / ((float)M_PI * x);
+            float w = 1.0f - (d / half) * (d / half);
+            float kaiser = w > 0.0f ? bessel_i0(KAISER_BETA * sqrtf(w)) / i0_beta : 0.0f;
+            h[j] = sinc * kaiser;
+            sum += h[j];
+        }
+        // Unity gain at DC in every phase, exactly after rounding
+        int32_t total = 0;
+        int big = 0;
+        for (int j = 0; j < RESAMPLER_TAPS; j++) {
+            r->coef[p][j] = (int16_t)lrintf(h[j] / sum * 32768.0f);
+            total += r->coef[p][j];
+            if (fabsf(h[j]) > fabsf(h[big])) big = j;
+        }
+        r->coef[p][big] = (int16_t)(r->coef[p][big] + (32768 - total));
+    }
+}
+
+void resampler_init(resampler_t *r) {
+    memset(r, 0, sizeof(*r));
+    build_table(r);
+    r->step = ONE_Q32;
+    resampler_reset(r);
+}
+
+void resampler_reset(resampler_t *r) {
+    memset(r->hist, 0, sizeof(r->hist));
+    r->head = 0;
+    r->phase = 0;
+    r->in_total = 0;
+    r->out_total = 0;
+    r->slew_ppm = 0;
+}
+
+void resampler_set_rate(resampler_t *r, uint32_t in_mhz, uint32_t out_mhz) {
+    if (in_mhz == 0 || out_mhz == 0) return;
+    uint64_t lo = (uint64_t)out_mhz * (1000000u - RESAMPLER_MAX_PPM) / 1000000u;
+    uint64_t hi = (uint64_t)out_mhz * (1000000u + RESAMPLER_MAX_PPM) / 1000000u;
+    if (in_mhz < lo) in_mhz = (uint32_t)lo;
+    if (in_mhz > hi) in_mhz = (uint32_t)hi;
+    r->in_mhz = in_mhz;
+    r->out_mhz = out_mhz;
+
+    // Outputs the stream should have by now at this ratio, against what it has
+    uint64_t want = r->in_total * out_mhz / in_mhz;
+    int64_t behind = (int64_t)want - (int64_t)r->out_total;
+    int64_t dist = behind < 0 ? -behind : behind;
+    int64_t slew = 0;
+    if (dist > RESAMPLER_DEADBAND || (r->slew_ppm != 0 && dist > 1)) {
+        slew = behind * 1000000 / ((int64_t)RESAMPLER_SLEW_S * out_mhz / 1000);
+        // Proportional alone would fade out just above the stop threshold
+        if (slew == 0) slew = behind > 0 ? 1 : -1;
+    }
+    if (slew > RESAMPLER_SLEW_PPM) slew = RESAMPLER_SLEW_PPM;
+    if (slew < -RESAMPLER_SLEW_PPM) slew = -RESAMPLER_SLEW_PPM;
+    r->slew_ppm = (int32_t)slew;
+
+    // Fewer input samples per output produces more outputs
+    uint64_t step = ((uint64_t)in_mhz << 32) / out_mhz;
+    r->step = (uint64_t)((int64_t)step - (int64_t)step / 1000000 * slew);
+}
+
+static int16_t filter(const resampler_t *r, const int16_t *x, uint32_t frac) {
+    uint32_t p = frac >> (32 - PHASE_BITS);
+    int32_t w = (int32_t)((frac >> (32 - PHASE_BITS - 15)) & 0x7FFF);  // Q15 between phases p and p+1
+    const int16_t *a = r->coef[p];
+    const int16_t *b = r->coef[p + 1];
+    int32_t acc = 1 << 14;
+    for (int j = 0; j < RESAMPLER_TAPS; j++) {
+        int32_t c = a[j] + (((b[j] - a[j]) * w) >> 15);
+        acc += x[j] * c;
+    }
+    acc >>= 15;
+    if (acc > INT16_MAX) return INT16_MAX;
+    if (acc < INT16_MIN) return INT16_MIN;
+    return (int16_t)acc;
+}
+
+size_t resampler_process(resampler_t *r, const int16_t *in, size_t n, int16_t *out) {
+    size_t o = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (r->in_total == 0) {
+            // Start from the first sample's level rather than a step up from zero
+            for (int j = 0; j < 2 * RESAMPLER_TAPS; j++) r->hist[j] = in[0];
+        }
+        r->hist[r->head] = in[i];
+        r->hist[r->head + RESAMPLER_TAPS] = in[i];
+        r->head = (r->head + 1) % RESAMPLER_TAPS;
+        r->in_total++;
+
+        // hist[head .. head + TAPS) is the window, oldest first
+        const int16_t *x = &r->hist[r->head];
+        while (r->phase < ONE_Q32) {
+            out[o++] = filter(r, x, (uint32_t)r->phase);
+            r->phase += r->step;
+        }
+        r->phase -= ONE_Q32;
+    }
+    r->out_total += o;
+    return o;
+}
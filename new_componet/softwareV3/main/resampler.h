@@ -0,0 +1,82 @@
+/**
+ * @file resampler.h
+ * @brief Fixed-point asynchronous resampler for small rate corrections
+ *
+ * Converts a stream sampled at a measured rate (rate_est.h) to the exact
+ * nominal rate. Each output is a RESAMPLER_TAPS-tap Kaiser-windowed sinc
+ * evaluated at its fractional input position: the position selects two of
+ * RESAMPLER_PHASES precomputed Q15 phases and the coefficients are
+ * interpolated between them. The position advances by a Q32 step, so the
+ * ratio is exact to 2^-32 and no error accumulates from rounding it.
+ *
+ * resampler_set_rate() is meant to be called as the estimate improves.
+ * Besides the new ratio it pulls the output count back to where the new
+ * estimate says it should be: after an hour the output has as many samples
+ * as the hour has at the nominal rate, even though the first seconds ran
+ * before any estimate existed. Errors within RESAMPLER_DEADBAND samples are
+ * left alone, so the ratio does not flutter by a sample's worth of ppm.
+ *
+ * Pure C; the table is built once by resampler_init() (floating point), the
+ * filter itself is integer only.
+ */
+
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RESAMPLER_TAPS        16
+#define RESAMPLER_PHASES      32
+#define RESAMPLER_CUTOFF      0.45f     // Passband edge, fraction of the output rate
+#define RESAMPLER_MAX_PPM     15000     // Ratio clamp: a measured ADC rate is within 1.5%
+#define RESAMPLER_SLEW_PPM    500       // Largest correction while catching up on the count
+#define RESAMPLER_SLEW_S      2         // Count error is removed over about this long
+#define RESAMPLER_DEADBAND    4         // Count error (samples) left alone; corrections stop at 1
+
+// Outputs produced from n inputs, at most (ratio clamp plus the slew)
+#define RESAMPLER_MAX_OUT(n)  ((n) + (n) / 64 + 2)
+
+typedef struct {
+    int16_t coef[RESAMPLER_PHASES + 1][RESAMPLER_TAPS];  // Q15, each phase sums to 1.0
+    int16_t hist[2 * RESAMPLER_TAPS];   // Input history, written twice so a window never wraps
+    uint32_t head;
+    uint64_t step;          // Input samples per output sample, Q32
+    uint64_t phase;         // Position of the next output past the window centre, Q32
+    uint64_t in_total;      // Since resampler_reset()
+    uint64_t out_total;
+    uint32_t in_mhz;        // Last rate pair given to resampler_set_rate()
+    uint32_t out_mhz;
+    int32_t slew_ppm;       // Current count correction, for logs
+} resampler_t;
+
+// Build the filter table; ratio 1:1 and an empty history
+void resampler_init(resampler_t *r);
+
+// Forget the history and counts (new stream); keeps the table and ratio
+void resampler_reset(resampler_t *r);
+
+/**
+ * @brief Resample from in_mhz to out_mhz (milli-Hz), correcting the count
+ *
+ * Call again whenever the input rate estimate changes, and periodically
+ * while a count correction is in progress (once per block is fine).
+ */
+void resampler_set_rate(resampler_t *r, uint32_t in_mhz, uint32_t out_mhz);
+
+/**
+ * @brief Consume n input samples
+ * @param out Room for RESAMPLER_MAX_OUT(n) samples
+ * @return Samples written to out
+ */
+size_t resampler_process(resampler_t *r, const int16_t *in, size_t n, int16_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RESAMPLER_H
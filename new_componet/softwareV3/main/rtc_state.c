@@ -0,0 +1,59 @@
+/**
+ * @file rtc_state.c
+ * @brief Deep-sleep retained state (see rtc_state.h)
+ */
+
+#include "rtc_state.h"
+#include "crc32c.h"
+#include <stddef.h>
+#include <string.h>
+
+static uint32_t state_crc(const rtc_state_t *s) {
+    return crc32c_calculate((const uint8_t *)s, offsetof(rtc_state_t, crc));
+}
+
+void rtc_state_reset(rtc_state_t *s) {
+    memset(s, 0, sizeof(*s));
+    s->magic = RTC_STATE_MAGIC;
+    s->version = RTC_STATE_VERSION;
+    s->size = sizeof(*s);
+    rtc_state_seal(s);
+}
+
+bool rtc_state_valid(const rtc_state_t *s) {
+    return s->magic == RTC_STATE_MAGIC && s->version == RTC_STATE_VERSION &&
+           s->size == sizeof(*s) && s->crc == state_crc(s);
+}
+
+void rtc_state_seal(rtc_state_t *s) {
+    s->crc = state_crc(s);
+}
+
+void rtc_state_on_wake(rtc_state_t *s, uint64_t now_ms) {
+    // A clock that went backwards (time was set while asleep) adds nothing
+    if (s->sleep_entered_ms && now_ms > s->sleep_entered_ms) {
+        s->asleep_ms += now_ms - s->sleep_entered_ms;
+    }
+    s->sleep_entered_ms = 0;
+    s->wake_count++;
+    rtc_state_seal(s);
+}
+
+void rtc_state_on_sleep(rtc_state_t *s, uint64_t now_ms, uint64_t awake_ms) {
+    s->awake_ms += awake_ms;
+    s->sleep_entered_ms = now_ms;
+    s->sleeps++;
+    rtc_state_seal(s);
+}
+
+float rtc_state_duty(const rtc_state_t *s) {
+    uint64_t total = s->awake_ms + s->asleep_ms;
+    return total ? (float)s->awake_ms / (float)total : 0.0f;
+}
+
+float rtc_state_project_hours(const rtc_state_t *s, float capacity_mah, float awake_ma, float sleep_ma) {
+    if (s->awake_ms + s->asleep_ms == 0) return 0.0f;
+    float duty = rtc_state_duty(s);
+    float avg_ma = duty * awake_ma + (1.0f - duty) * sleep_ma;
+    return avg_ma > 0.0f ? capacity_mah / avg_ma : 0.0f;
+}
@@ -0,0 +1,96 @@
+/**
+ * @file rtc_state.h
+ * @brief State kept in RTC memory across deep sleep
+ *
+ * The block survives deep sleep but not a power loss or a reset that clears
+ * RTC memory, so it is sealed with a CRC and checked on wake; any mismatch
+ * (cold boot, layout change, corruption) means a full initialization. It
+ * also accumulates awake/asleep time for the battery-life projection. Pure
+ * C; power_mgr.c places the instance in RTC memory.
+ */
+
+#ifndef RTC_STATE_H
+#define RTC_STATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RTC_STATE_MAGIC    0x53435452  // "RTCS"
+#define RTC_STATE_VERSION  1
+#define RTC_STATE_NAME_MAX 64
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;              // sizeof(rtc_state_t) when sealed
+
+    uint32_t wake_count;        // Deep-sleep wakes since the last cold boot
+    int32_t recording_count;
+    char selected_file[RTC_STATE_NAME_MAX];  // Transfer cursor ("" = none)
+
+    // Audio calibration from the last recording
+    float noise_floor;
+    float gain;
+    uint8_t calibrated;
+
+    // Last connected central, to report wake-to-reconnect time
+    uint8_t peer_valid;
+    uint8_t peer_addr_type;
+    uint8_t peer_addr[6];
+
+    // Duty-cycle accounting
+    uint64_t awake_ms;
+    uint64_t asleep_ms;
+    uint64_t sleep_entered_ms;  // Wall clock when the current sleep began
+    uint32_t sleeps;
+
+    uint32_t crc;               // CRC32C of everything above
+} rtc_state_t;
+
+/**
+ * @brief Clear to a fresh, sealed state (cold boot)
+ */
+void rtc_state_reset(rtc_state_t *s);
+
+/**
+ * @brief True if the block was sealed by this firmware layout and is intact
+ */
+bool rtc_state_valid(const rtc_state_t *s);
+
+/**
+ * @brief Recompute the CRC after changing fields
+ */
+void rtc_state_seal(rtc_state_t *s);
+
+/**
+ * @brief Account for the sleep that just ended
+ * @param now_ms Wall clock at wake (RTC-backed, so it runs during sleep)
+ */
+void rtc_state_on_wake(rtc_state_t *s, uint64_t now_ms);
+
+/**
+ * @brief Account for awake time and mark the start of a sleep
+ * @param awake_ms Time awake since boot or wake
+ */
+void rtc_state_on_sleep(rtc_state_t *s, uint64_t now_ms, uint64_t awake_ms);
+
+/**
+ * @brief Fraction of time awake so far (0 when nothing measured)
+ */
+float rtc_state_duty(const rtc_state_t *s);
+
+/**
+ * @brief Projected runtime from a full battery at the measured duty cycle
+ * @return Hours, or 0 if there is no measurement yet
+ */
+float rtc_state_project_hours(const rtc_state_t *s, float capacity_mah, float awake_ma, float sleep_ma);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RTC_STATE_H
@@ -0,0 +1,163 @@
+/**
+ * @file sd_health.c
+ * @brief Passive SD card health (see sd_health.h)
+ */
+
+#include "sd_health.h"
+#include <stdio.h>
+#include <string.h>
+
+#define BUCKET0_US  128u
+
+static unsigned bucket_of(uint32_t us) {
+    unsigned i = 0;
+    while (i < SD_HEALTH_BUCKETS - 1 && us >= (BUCKET0_US << i)) i++;
+    return i;
+}
+
+void sd_health_init(sd_health_t *h) {
+    memset(h, 0, sizeof(*h));
+}
+
+void sd_health_write(sd_health_t *h, uint32_t bytes, uint32_t lat_us, bool ok, uint32_t now_ms) {
+    h->hist[bucket_of(lat_us)]++;
+    h->writes++;
+    if (lat_us > h->max_us) h->max_us = lat_us;
+    h->last_io_ms = now_ms;
+    if (ok) {
+        h->bytes += bytes;
+        h->consec_errors = 0;
+    } else {
+        h->errors++;
+        h->consec_errors++;
+    }
+}
+
+void sd_health_retry(sd_health_t *h) {
+    h->retries++;
+}
+
+void sd_health_probe(sd_health_t *h, uint32_t lat_us, bool ok, uint32_t now_ms) {
+    h->probes++;
+    h->last_io_ms = now_ms;
+    h->probe_failed = !ok;
+    if (ok) {
+        h->probe_us = lat_us;
+    } else {
+        h->probe_fails++;
+    }
+}
+
+void sd_health_free(sd_health_t *h, uint64_t free_bytes, uint32_t now_ms) {
+    unsigned slot = (h->trend_head + h->trend_count) % SD_HEALTH_TREND_LEN;
+    h->trend[slot].t_ms = now_ms;
+    h->trend[slot].free_bytes = free_bytes;
+    if (h->trend_count < SD_HEALTH_TREND_LEN) {
+        h->trend_count++;
+    } else {
+        h->trend_head = (h->trend_head + 1) % SD_HEALTH_TREND_LEN;
+    }
+}
+
+bool sd_health_probe_due(const sd_health_t *h, uint32_t interval_ms, uint32_t now_ms) {
+    if (h->writes == 0 && h->probes == 0) return true;
+    return now_ms - h->last_io_ms >= interval_ms;
+}
+
+uint32_t sd_health_percentile(const sd_health_t *h, uint32_t pct) {
+    if (h->writes == 0) return 0;
+    if (pct > 100) pct = 100;
+    uint32_t rank = (uint32_t)(((uint64_t)h->writes * pct + 99) / 100);
+    if (rank == 0) rank = 1;
+
+    uint32_t below = 0;
+    for (unsigned i = 0; i < SD_HEALTH_BUCKETS; i++) {
+        uint32_t n = h->hist[i];
+        if (below + n < rank) {
+            below += n;
+            continue;
+        }
+        uint32_t lo = i == 0 ? 0 : BUCKET0_US << (i - 1);
+        uint32_t hi = i == SD_HEALTH_BUCKETS - 1 ? h->max_us : BUCKET0_US << i;
+        if (hi > h->max_us) hi = h->max_us;
+        if (hi < lo) return h->max_us;
+        return lo + (uint32_t)((uint64_t)(hi - lo) * (rank - below) / n);
+    }
+    return h->max_us;
+}
+
+int64_t sd_health_use_per_hour(const sd_health_t *h) {
+    if (h->trend_count < 2) return 0;
+    const sd_health_free_t *first = &h->trend[h->trend_head];
+    const sd_health_free_t *last = &h->trend[(h->trend_head + h->trend_count - 1) % SD_HEALTH_TREND_LEN];
+    uint32_t dt_ms = last->t_ms - first->t_ms;
+    if (dt_ms == 0) return 0;
+    int64_t used = (int64_t)first->free_bytes - (int64_t)last->free_bytes;
+    return used * 3600000 / (int64_t)dt_ms;
+}
+
+int32_t sd_health_hours_to_full(const sd_health_t *h) {
+    int64_t per_hour = sd_health_use_per_hour(h);
+    if (per_hour <= 0) return -1;
+    uint64_t free_bytes = h->trend[(h->trend_head + h->trend_count - 1) % SD_HEALTH_TREND_LEN].free_bytes;
+    uint64_t hours = free_bytes / (uint64_t)per_hour;
+    return hours > INT32_MAX ? INT32_MAX : (int32_t)hours;
+}
+
+sd_health_grade_t sd_health_grade(const sd_health_t *h, uint64_t total_bytes,
+                                  const sd_health_limits_t *limits) {
+    if (h->consec_errors >= SD_HEALTH_FAILING_RUN || h->probe_failed) return SD_HEALTH_FAILING;
+    if (h->errors || h->retries || h->probe_fails) return SD_HEALTH_DEGRADED;
+    if (limits->slow_us && sd_health_percentile(h, 99) > limits->slow_us) return SD_HEALTH_DEGRADED;
+
+    if (h->trend_count && total_bytes) {
+        uint64_t free_bytes = h->trend[(h->trend_head + h->trend_count - 1) % SD_HEALTH_TREND_LEN].free_bytes;
+        if (free_bytes * 100 < total_bytes * limits->low_free_pct) return SD_HEALTH_DEGRADED;
+    }
+    int32_t full_h = sd_health_hours_to_full(h);
+    if (full_h >= 0 && (uint32_t)full_h < limits->full_hours) return SD_HEALTH_DEGRADED;
+    return SD_HEALTH_OK;
+}
+
+const char *sd_health_grade_name(sd_health_grade_t g) {
+    switch (g) {
+    case SD_HEALTH_OK:       return "ok";
+    case SD_HEALTH_DEGRADED: return "degraded";
+    case SD_HEALTH_FAILING:  return "failing";
+    }
+    return "?";
+}
+
+size_t sd_health_report(const sd_health_t *h, uint64_t total_bytes,
+                        const sd_health_limits_t *limits, char *buf, size_t len) {
+    if (len == 0) return 0;
+    uint64_t free_kb = h->trend_count
+        ? h->trend[(h->trend_head + h->trend_count - 1) % SD_HEALTH_TREND_LEN].free_bytes / 1024 : 0;
+    int32_t full_h = sd_health_hours_to_full(h);
+    char full[12];
+    if (full_h < 0) {
+        snprintf(full, sizeof(full), "-");
+    } else {
+        snprintf(full, sizeof(full), "%ld", (long)full_h);
+    }
+
+    int n = snprintf(buf, len,
+                     "SDH v1 grade=%s writes=%lu kb=%llu err=%lu consec=%lu retry=%lu "
+                     "p50=%lu p95=%lu p99=%lu max=%lu probes=%lu probe_fail=%lu probe_us=%lu "
+                     "free_kb=%llu use_kbph=%lld full_h=%s",
+                     sd_health_grade_name(sd_health_grade(h, total_bytes, limits)),
+                     (unsigned long)h->writes, (unsigned long long)(h->bytes / 1024),
+                     (unsigned long)h->errors, (unsigned long)h->consec_errors,
+                     (unsigned long)h->retries,
+                     (unsigned long)sd_health_percentile(h, 50),
+                     (unsigned long)sd_health_percentile(h, 95),
+                     (unsigned long)sd_health_percentile(h, 99),
+                     (unsigned long)h->max_us, (unsigned long)h->probes,
+                     (unsigned long)h->probe_fails, (unsigned long)h->probe_us,
+                     (unsigned long long)free_kb, (long long)(sd_health_use_per_hour(h) / 1024), full);
+    if (n < 0) {
+        buf[0] = '\0';
+        return 0;
+    }
+    return (size_t)n < len ? (size_t)n : len - 1;
+}
@@ -0,0 +1,125 @@
+/**
+ * @file sd_health.h
+ * @brief Passive SD card health from the recording write stream
+ *
+ * Card health is taken from I/O the device does anyway: the latency of
+ * every write+sync of the recording buffer goes into a log2 histogram,
+ * failures and recoveries are counted, and the free-space figure FATFS
+ * already caches is sampled into a short trend. A read-only probe (one
+ * sector read) is only due when the card has been idle long enough that
+ * the passive figures are stale, so nothing is written to the card just to
+ * check it. Pure C; the firmware copy lives in sd_storage.
+ *
+ * Report line:
+ *   SDH v1 grade=<ok|degraded|failing> writes=<n> kb=<n> err=<n> consec=<n>
+ *       retry=<n> p50=<us> p95=<us> p99=<us> max=<us> probes=<n>
+ *       probe_fail=<n> probe_us=<us> free_kb=<n> use_kbph=<n> full_h=<n|->
+ */
+
+#ifndef SD_HEALTH_H
+#define SD_HEALTH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SD_HEALTH_BUCKETS       16      // Bucket i holds latencies below 128 us << i; last is open-ended
+#define SD_HEALTH_TREND_LEN     16      // Free-space samples kept for the trend
+#define SD_HEALTH_FAILING_RUN   3       // Consecutive write failures that mean the card is failing
+#define SD_HEALTH_REPORT_LEN    256     // Enough for the longest report line
+
+typedef enum {
+    SD_HEALTH_OK = 0,
+    SD_HEALTH_DEGRADED,     // Slow, recovered write or probe errors, or nearly full
+    SD_HEALTH_FAILING,      // Failing writes or probe right now
+} sd_health_grade_t;
+
+typedef struct {
+    uint32_t t_ms;
+    uint64_t free_bytes;
+} sd_health_free_t;
+
+typedef struct {
+    uint32_t hist[SD_HEALTH_BUCKETS];
+    uint32_t writes;
+    uint64_t bytes;
+    uint32_t errors;
+    uint32_t consec_errors;
+    uint32_t retries;           // Card recoveries (power cycle + remount)
+    uint32_t max_us;
+    uint32_t last_io_ms;        // Last write or probe, for probe scheduling
+    uint32_t probes;
+    uint32_t probe_fails;
+    uint32_t probe_us;          // Latency of the last successful probe
+    bool probe_failed;          // Last probe failed
+    sd_health_free_t trend[SD_HEALTH_TREND_LEN];
+    uint8_t trend_head;         // Oldest sample
+    uint8_t trend_count;
+} sd_health_t;
+
+typedef struct {
+    uint32_t slow_us;           // p99 above this is degraded
+    uint32_t low_free_pct;      // Free space below this percentage of total is degraded
+    uint32_t full_hours;        // Projected full within this many hours is degraded
+} sd_health_limits_t;
+
+void sd_health_init(sd_health_t *h);
+
+// One write+sync of recording data (ok=false for a failed write)
+void sd_health_write(sd_health_t *h, uint32_t bytes, uint32_t lat_us, bool ok, uint32_t now_ms);
+
+// The card was power-cycled and remounted to get a recording going again
+void sd_health_retry(sd_health_t *h);
+
+void sd_health_probe(sd_health_t *h, uint32_t lat_us, bool ok, uint32_t now_ms);
+
+// Sample free space; the oldest sample is dropped once the trend is full
+void sd_health_free(sd_health_t *h, uint64_t free_bytes, uint32_t now_ms);
+
+/**
+ * @brief Whether an idle probe is due
+ *
+ * True when neither a write nor a probe has been seen for interval_ms.
+ */
+bool sd_health_probe_due(const sd_health_t *h, uint32_t interval_ms, uint32_t now_ms);
+
+/**
+ * @brief Write latency percentile, interpolated within its log2 bucket
+ * @param pct 0..100
+ * @return Microseconds, 0 with no writes
+ */
+uint32_t sd_health_percentile(const sd_health_t *h, uint32_t pct);
+
+/**
+ * @brief Free space consumption over the trend window
+ * @return Bytes per hour (negative when space was freed), 0 with fewer than two samples
+ */
+int64_t sd_health_use_per_hour(const sd_health_t *h);
+
+/**
+ * @brief Hours until the card is full at the current trend
+ * @return -1 when space is not being used up
+ */
+int32_t sd_health_hours_to_full(const sd_health_t *h);
+
+sd_health_grade_t sd_health_grade(const sd_health_t *h, uint64_t total_bytes,
+                                  const sd_health_limits_t *limits);
+
+const char *sd_health_grade_name(sd_health_grade_t g);
+
+/**
+ * @brief Format the report line
+ * @return Length written (excluding NUL), truncated to len - 1
+ */
+size_t sd_health_report(const sd_health_t *h, uint64_t total_bytes,
+                        const sd_health_limits_t *limits, char *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SD_HEALTH_H
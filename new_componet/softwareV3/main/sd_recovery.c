@@ -0,0 +1,112 @@
+/**
+ * @file sd_recovery.c
+ * @brief SD card recovery task and spill ring (see sd_recovery.h)
+ */
+
+#include "sdkconfig.h"
+
+#if CONFIG_SALESTAG_SD_RECOVERY
+
+#include "sd_recovery.h"
+#include "sd_storage.h"
+#include "raw_audio_storage.h"
+#include "mem_plan.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+static const char *TAG = "sd_recovery";
+
+#define SD_RECOVERY_ATTEMPTS   3
+#define SD_RECOVERY_RETRY_MS   500
+
+static spill_ring_t s_spill;
+static TaskHandle_t s_task = NULL;
+static SemaphoreHandle_t s_done = NULL;
+static volatile sd_recovery_state_t s_state = SD_RECOVERY_IDLE;
+
+static void recovery_task(void *arg) {
+    (void)arg;
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        int64_t start_us = esp_timer_get_time();
+        sd_recovery_state_t result = SD_RECOVERY_FAILED;
+        for (int attempt = 1; attempt <= SD_RECOVERY_ATTEMPTS; attempt++) {
+            ESP_LOGW(TAG, "Power-cycling card, attempt %d/%d (%lu samples spilled)",
+                     attempt, SD_RECOVERY_ATTEMPTS, (unsigned long)spill_ring_count(&s_spill));
+            if (sd_storage_power_cycle() == ESP_OK) {
+                result = SD_RECOVERY_DONE;
+                break;
+            }
+            vTaskDelay(pdMS_TO_TICKS(SD_RECOVERY_RETRY_MS));
+        }
+
+        ESP_LOGI(TAG, "Card %s after %lld ms", result == SD_RECOVERY_DONE ? "recovered" : "lost",
+                 (long long)((esp_timer_get_time() - start_us) / 1000));
+        s_state = result;
+        xSemaphoreGive(s_done);
+    }
+}
+
+esp_err_t sd_recovery_init(void) {
+    if (s_task) return ESP_OK;
+
+    uint32_t cap = CONFIG_SALESTAG_SD_SPILL_KB * 1024 / sizeof(uint16_t);
+    // CPU access only, so PSRAM when the build has it
+    uint16_t *buf = mem_plan_alloc("sd_recovery", "spill", cap * sizeof(uint16_t), MEM_REGION_LARGE);
+    if (!buf) {
+        ESP_LOGE(TAG, "No memory for a %d KB spill buffer", CONFIG_SALESTAG_SD_SPILL_KB);
+        return ESP_ERR_NO_MEM;
+    }
+    spill_ring_init(&s_spill, buf, cap, RAW_AUDIO_SAMPLE_RATE);
+
+    s_done = xSemaphoreCreateBinary();
+    if (!s_done) return ESP_ERR_NO_MEM;
+    // Below the storage task: the card work must not starve sample intake
+    s_task = mem_plan_task("sd_recovery", recovery_task, "sd_recovery", MEM_STACK_SD_RECOVERY, NULL, 3);
+    if (!s_task) {
+        ESP_LOGE(TAG, "Failed to create recovery task");
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "Spill buffer: %lu samples (%.1f s)", (unsigned long)cap,
+             (double)cap / RAW_AUDIO_SAMPLE_RATE);
+    return ESP_OK;
+}
+
+esp_err_t sd_recovery_begin(void) {
+    if (!s_task) return ESP_ERR_INVALID_STATE;
+    if (s_state == SD_RECOVERY_RUNNING) return ESP_ERR_INVALID_STATE;
+    xSemaphoreTake(s_done, 0);
+    s_state = SD_RECOVERY_RUNNING;
+    xTaskNotifyGive(s_task);
+    return ESP_OK;
+}
+
+sd_recovery_state_t sd_recovery_state(void) {
+    return s_state;
+}
+
+sd_recovery_state_t sd_recovery_wait(uint32_t timeout_ms) {
+    if (s_state == SD_RECOVERY_RUNNING) {
+        TickType_t ticks = timeout_ms == UINT32_MAX ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+        if (xSemaphoreTake(s_done, ticks) == pdTRUE) {
+            // Leave the token for anyone else polling the same result
+            xSemaphoreGive(s_done);
+        }
+    }
+    return s_state;
+}
+
+void sd_recovery_ack(void) {
+    if (s_state != SD_RECOVERY_RUNNING) s_state = SD_RECOVERY_IDLE;
+}
+
+spill_ring_t *sd_recovery_spill(void) {
+    return &s_spill;
+}
+
+#endif // CONFIG_SALESTAG_SD_RECOVERY
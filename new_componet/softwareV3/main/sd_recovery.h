@@ -0,0 +1,61 @@
+/**
+ * @file sd_recovery.h
+ * @brief Background SD card recovery while a recording keeps capturing
+ *
+ * When a recording write fails, the storage task suspends the file
+ * (raw_audio_storage_suspend) and calls sd_recovery_begin(). A recovery
+ * task then power-cycles and remounts the card while holding the card lock
+ * (sd_storage_lock), retrying a few times. Meanwhile the storage task keeps
+ * taking samples off the capture queue into the spill ring, which is
+ * allocated once at init (PSRAM when the build has it), then resumes the
+ * file at its last synced offset and drains the ring ahead of new samples.
+ */
+
+#ifndef SD_RECOVERY_H
+#define SD_RECOVERY_H
+
+#include "esp_err.h"
+#include "spill_ring.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    SD_RECOVERY_IDLE = 0,
+    SD_RECOVERY_RUNNING,
+    SD_RECOVERY_DONE,       // Card remounted and writable
+    SD_RECOVERY_FAILED,     // Gave up after SD_RECOVERY_ATTEMPTS power cycles
+} sd_recovery_state_t;
+
+/**
+ * @brief Allocate the spill ring and start the recovery task
+ */
+esp_err_t sd_recovery_init(void);
+
+/**
+ * @brief Start recovering the card in the background
+ * @return ESP_ERR_INVALID_STATE if a recovery is already running
+ */
+esp_err_t sd_recovery_begin(void);
+
+sd_recovery_state_t sd_recovery_state(void);
+
+/**
+ * @brief Block until the running recovery finishes
+ * @return The resulting state (still RUNNING on timeout)
+ */
+sd_recovery_state_t sd_recovery_wait(uint32_t timeout_ms);
+
+// Result consumed: back to IDLE
+void sd_recovery_ack(void);
+
+// Samples held while the card is away; storage task only
+spill_ring_t *sd_recovery_spill(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SD_RECOVERY_H
@@ -2,14 +2,24 @@
 #include "esp_log.h"
 #include "esp_vfs_fat.h"
 #include "sdmmc_cmd.h"
+#include "diskio_sdmmc.h"
+#include "ff.h"
+#include "fat_plan.h"
+#include "mem_plan.h"
 #include "driver/sdmmc_host.h"
 #include "driver/sdspi_host.h"
 #include "driver/gpio.h"
 #include "driver/spi_master.h"
 #include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "sdkconfig.h"
+#include "fault_inject.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include <dirent.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 #include <strings.h>   // for strcasecmp
 #include <time.h>
@@ -17,12 +27,22 @@
 
 static const char *TAG = "sd_storage";
 
+#define SD_HEALTH_FREE_MS   60000   // Free-space trend sample period
+#define SD_MKFS_WORK_BYTES  (16 * 1024) // f_mkfs writes the empty FATs in chunks of this
+
 // Global state
 static sdmmc_card_t *s_card = NULL;
 static bool s_mounted = false;
 static sd_status_t s_status = SD_STATUS_UNMOUNTED;
 static uint64_t s_total_bytes = 0;
 static uint64_t s_free_bytes = 0;
+static SemaphoreHandle_t s_card_lock = NULL;  // Held across remounts and by file writers
+
+static sd_health_t s_health;
+static portMUX_TYPE s_health_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t s_last_free_ms;
+static uint8_t *s_probe_buf = NULL;             // One sector from the arena (DMA capable)
+static bool s_format_on_mount = false;          // Let the driver put a volume on an unmountable card
 
 // Internal function declarations
 static esp_err_t sd_spi_init(void);
@@ -32,6 +52,12 @@ static esp_err_t sd_unmount_fatfs(void);
 
 esp_err_t sd_storage_init(void) {
     ESP_LOGI(TAG, "Initializing SD card storage");
+
+    if (!s_card_lock) {
+        s_card_lock = xSemaphoreCreateRecursiveMutex();
+        if (!s_card_lock) return ESP_ERR_NO_MEM;
+        sd_health_init(&s_health);
+    }
     
     // Initialize SPI bus for SD card
     esp_err_t ret = sd_spi_init();
@@ -69,7 +95,8 @@ esp_err_t sd_storage_init(void) {
 
 esp_err_t sd_storage_deinit(void) {
     ESP_LOGI(TAG, "Deinitializing SD card storage");
-    
+
+    sd_storage_lock(UINT32_MAX);
     if (s_mounted) {
         sd_unmount_fatfs();
         s_mounted = false;
@@ -79,10 +106,105 @@ esp_err_t sd_storage_deinit(void) {
     s_status = SD_STATUS_UNMOUNTED;
     s_total_bytes = 0;
     s_free_bytes = 0;
+    sd_storage_unlock();
     
     return ESP_OK;
 }
 
+bool sd_storage_lock(uint32_t timeout_ms) {
+    if (!s_card_lock) return true;  // Before init nothing can race
+    TickType_t ticks = timeout_ms == UINT32_MAX ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+    return xSemaphoreTakeRecursive(s_card_lock, ticks) == pdTRUE;
+}
+
+void sd_storage_unlock(void) {
+    if (s_card_lock) xSemaphoreGiveRecursive(s_card_lock);
+}
+
+static uint32_t now_ms(void) {
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+void sd_storage_note_write(uint32_t bytes, uint32_t lat_us, bool ok) {
+    uint32_t t = now_ms();
+    taskENTER_CRITICAL(&s_health_lock);
+    sd_health_write(&s_health, bytes, lat_us, ok, t);
+    taskEXIT_CRITICAL(&s_health_lock);
+}
+
+void sd_storage_note_retry(void) {
+    taskENTER_CRITICAL(&s_health_lock);
+    sd_health_retry(&s_health);
+    taskEXIT_CRITICAL(&s_health_lock);
+}
+
+void sd_storage_get_health(sd_health_t *out) {
+    taskENTER_CRITICAL(&s_health_lock);
+    *out = s_health;
+    taskEXIT_CRITICAL(&s_health_lock);
+}
+
+static const sd_health_limits_t s_limits = {
+    .slow_us = CONFIG_SALESTAG_SD_SLOW_MS * 1000u,
+    .low_free_pct = 5,
+    .full_hours = 24,
+};
+
+size_t sd_storage_health_report(char *buf, size_t len) {
+    sd_health_t h;
+    sd_storage_get_health(&h);
+    return sd_health_report(&h, s_total_bytes, &s_limits, buf, len);
+}
+
+sd_health_grade_t sd_storage_health_grade(void) {
+    sd_health_t h;
+    sd_storage_get_health(&h);
+    return sd_health_grade(&h, s_total_bytes, &s_limits);
+}
+
+// Reads only: FATFS keeps the free cluster count, and the probe reads one sector
+void sd_storage_health_tick(bool idle) {
+    if (!s_mounted || !s_card) return;
+    uint32_t t = now_ms();
+    bool free_due = t - s_last_free_ms >= SD_HEALTH_FREE_MS || s_last_free_ms == 0;
+
+    sd_health_t h;
+    sd_storage_get_health(&h);
+    bool probe_due = idle && sd_health_probe_due(&h, CONFIG_SALESTAG_SD_PROBE_S * 1000u, t);
+    if (!free_due && !probe_due) return;
+    // Whoever holds the card is doing real I/O, which is health data already
+    if (!sd_storage_lock(0)) return;
+
+    if (free_due) {
+        uint64_t total = 0, free_bytes = 0;
+        if (esp_vfs_fat_info(SD_MOUNT_POINT, &total, &free_bytes) == ESP_OK) {
+            s_free_bytes = free_bytes;
+            taskENTER_CRITICAL(&s_health_lock);
+            sd_health_free(&s_health, free_bytes, t);
+            taskEXIT_CRITICAL(&s_health_lock);
+        }
+        s_last_free_ms = t;
+    }
+
+    if (probe_due) {
+        if (!s_probe_buf) {
+            s_probe_buf = mem_plan_alloc("sd", "probe", s_card->csd.sector_size, MEM_REGION_INTERNAL);
+        }
+        if (s_probe_buf) {
+            int64_t t0 = esp_timer_get_time();
+            esp_err_t ret = sdmmc_read_sectors(s_card, s_probe_buf, 0, 1);
+            uint32_t lat_us = (uint32_t)(esp_timer_get_time() - t0);
+            if (ret != ESP_OK) {
+                ESP_LOGW(TAG, "Health probe failed: %s", esp_err_to_name(ret));
+            }
+            taskENTER_CRITICAL(&s_health_lock);
+            sd_health_probe(&s_health, lat_us, ret == ESP_OK, t);
+            taskEXIT_CRITICAL(&s_health_lock);
+        }
+    }
+    sd_storage_unlock();
+}
+
 esp_err_t sd_storage_get_info(sd_info_t *info) {
     if (!info) {
         return ESP_ERR_INVALID_ARG;
@@ -197,7 +319,7 @@ static esp_err_t sd_mount_fatfs(void) {
     esp_vfs_fat_mount_config_t mount_config = {
         .max_files = 5,
         .allocation_unit_size = 512,  // EXACT same as working minimal test
-        .format_if_mount_failed = false,
+        .format_if_mount_failed = s_format_on_mount,
         .disk_status_check_enable = false,
     };
     
@@ -296,7 +418,17 @@ static esp_err_t sd_unmount_fatfs(void) {
     return ESP_OK;
 }
 
+static esp_err_t power_cycle_locked(void);
+
 esp_err_t sd_storage_power_cycle(void) {
+    // Writers block on the lock instead of touching a half-mounted card
+    sd_storage_lock(UINT32_MAX);
+    esp_err_t ret = power_cycle_locked();
+    sd_storage_unlock();
+    return ret;
+}
+
+static esp_err_t power_cycle_locked(void) {
     ESP_LOGI(TAG, "=== SD Card Power Cycle ===");
     
     // Step 1: Unmount if currently mounted
@@ -328,12 +460,14 @@ esp_err_t sd_storage_power_cycle(void) {
     
     // Step 5: Remount SD card
     ESP_LOGI(TAG, "Remounting SD card...");
-    ret = sd_mount_fatfs();
+    ret = FI_HIT(FI_SD_REMOUNT, 0) ? ESP_FAIL : sd_mount_fatfs();
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to remount SD card: %s", esp_err_to_name(ret));
+        FI_FAILED(FI_SD_REMOUNT);
         s_status = SD_STATUS_ERROR;
         return ret;
     }
+    FI_OK(FI_SD_REMOUNT);
     
     s_status = SD_STATUS_MOUNTED;
     s_mounted = true;
@@ -461,3 +595,61 @@ esp_err_t sd_dump_contents(const char *directory_path)
     sd_dump_all();
     return ESP_OK;
 }
+
+static esp_err_t format_locked(uint32_t cluster_kb) {
+    // An unformatted card doesn't mount; a driver-formatted volume gets it to f_mkfs
+    if (!s_mounted || !s_card) {
+        s_format_on_mount = true;
+        esp_err_t ret = power_cycle_locked();
+        s_format_on_mount = false;
+        if (ret != ESP_OK && !s_card) return ret;
+    }
+
+    uint64_t sectors = s_card->csd.capacity;
+    uint32_t sector_size = s_card->csd.sector_size;
+    uint32_t au_kb = s_card->ssr.alloc_unit_kb;
+    fat_plan_t plan;
+    MKFS_PARM opt = { .fmt = FM_ANY };
+    if (fat_plan(sectors, sector_size, au_kb, cluster_kb, &plan)) {
+        opt.fmt = FM_FAT32;
+        opt.n_fat = 2;
+        opt.align = plan.align_sectors;
+        opt.au_size = plan.cluster_bytes;
+        ESP_LOGI(TAG, "Format: %llu sectors, AU %lu KB%s -> %lu KB clusters, data at sector %lu, %lu clusters",
+                 (unsigned long long)sectors, (unsigned long)(au_kb ? au_kb : FAT_PLAN_DEFAULT_AU_KB),
+                 au_kb ? "" : " (assumed)", (unsigned long)(plan.cluster_bytes / 1024),
+                 (unsigned long)plan.data_start, (unsigned long)plan.clusters);
+    } else {
+        ESP_LOGW(TAG, "Format: card too small for FAT32, letting FatFs choose");
+    }
+
+    void *work = heap_caps_malloc(SD_MKFS_WORK_BYTES, MALLOC_CAP_DMA);
+    if (!work) return ESP_ERR_NO_MEM;
+    BYTE pdrv = ff_diskio_get_pdrv_card(s_card);
+    char drv[3] = { (char)('0' + pdrv), ':', 0 };
+    int64_t t0 = esp_timer_get_time();
+    FRESULT fr = f_mkfs(drv, &opt, work, SD_MKFS_WORK_BYTES);
+    free(work);
+    if (fr != FR_OK) {
+        ESP_LOGE(TAG, "f_mkfs failed (%d)", fr);
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Card formatted in %lld ms", (long long)((esp_timer_get_time() - t0) / 1000));
+
+    // Remount from scratch so nothing cached from the old volume survives
+    esp_err_t ret = power_cycle_locked();
+    if (ret != ESP_OK) return ret;
+
+    taskENTER_CRITICAL(&s_health_lock);
+    sd_health_init(&s_health);
+    taskEXIT_CRITICAL(&s_health_lock);
+    s_last_free_ms = 0;
+    return sd_storage_create_rec_dir();
+}
+
+esp_err_t sd_storage_format(uint32_t cluster_kb) {
+    sd_storage_lock(UINT32_MAX);
+    esp_err_t ret = format_locked(cluster_kb);
+    sd_storage_unlock();
+    return ret;
+}
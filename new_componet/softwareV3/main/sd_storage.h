@@ -2,6 +2,8 @@
 #include "esp_err.h"
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
+#include "sd_health.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -58,9 +60,40 @@ const char* sd_storage_get_rec_path(void);
 // Graceful fallback when SD card unavailable
 esp_err_t sd_storage_fallback_to_internal(void);
 
-// Power cycle the SD card to reset its state
+// Power cycle the SD card to reset its state (holds the card lock throughout)
 esp_err_t sd_storage_power_cycle(void);
 
+/**
+ * @brief Reformat the card for recording (erases everything)
+ *
+ * FAT32 with cluster_kb clusters (0 = default) and the data area aligned to
+ * the card's allocation unit (fat_plan.h), then remount and recreate the
+ * recording directory. A card that doesn't mount is formatted too. Holds the
+ * card lock throughout; callers keep other card users stopped.
+ */
+esp_err_t sd_storage_format(uint32_t cluster_kb);
+
+// Card ownership: taken by anything that must not see the card unmounted under it
+// (recording writes, power cycles). Recursive; UINT32_MAX waits forever.
+bool sd_storage_lock(uint32_t timeout_ms);
+void sd_storage_unlock(void);
+
+// Health (sd_health.h): fed by the recording writes and recoveries
+void sd_storage_note_write(uint32_t bytes, uint32_t lat_us, bool ok);
+void sd_storage_note_retry(void);
+
+// Periodic health upkeep: samples free space and, when idle and the passive
+// figures are stale, runs a read-only one-sector probe. Never blocks on the card.
+void sd_storage_health_tick(bool idle);
+
+void sd_storage_get_health(sd_health_t *out);
+
+// Health report line (see sd_health.h); returns its length
+size_t sd_storage_health_report(char *buf, size_t len);
+
+// Grade of the health report, for the live telemetry
+sd_health_grade_t sd_storage_health_grade(void);
+
 // Test write access with retry logic
 esp_err_t sd_storage_test_write_access(void);
 
@@ -0,0 +1,252 @@
+/**
+ * @file speech_codec.c
+ * @brief Fixed-point ADPCM speech codec (see speech_codec.h for modes)
+ */
+
+#include "speech_codec.h"
+#include <string.h>
+
+// IMA ADPCM step size table
+static const int16_t s_step_table[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31,
+    34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143,
+    157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658,
+    724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024,
+    3327, 3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+    15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+// IMA ADPCM index adjustment for 4-bit codes (magnitude part only)
+static const int8_t s_index_table_4bit[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+// Index adjustment for 2-bit codes (1 magnitude bit)
+static const int8_t s_index_table_2bit[2] = { -1, 2 };
+
+// Half-band low-pass (Hamming windowed sinc), Q15, unity DC gain
+static const int16_t s_decim_coeffs[SPEECH_DECIM_TAPS] = {
+    -172, 0, 761, 0, -2494, 0, 10083, 16412, 10083, 0, -2494, 0, 761, 0, -172
+};
+
+static inline int16_t clamp_s16(int32_t v) {
+    if (v > 32767) return 32767;
+    if (v < -32768) return -32768;
+    return (int16_t)v;
+}
+
+static inline int8_t clamp_index(int v) {
+    if (v < 0) return 0;
+    if (v > 88) return 88;
+    return (int8_t)v;
+}
+
+static uint8_t adpcm_encode_4bit(speech_adpcm_state_t *st, int16_t sample) {
+    int step = s_step_table[st->step_index];
+    int diff = (int)sample - st->predictor;
+    uint8_t code = 0;
+
+    if (diff < 0) {
+        code = 8;
+        diff = -diff;
+    }
+
+    // Successive approximation of diff / step in 3 bits
+    int diffq = step >> 3;
+    if (diff >= step) { code |= 4; diff -= step; diffq += step; }
+    step >>= 1;
+    if (diff >= step) { code |= 2; diff -= step; diffq += step; }
+    step >>= 1;
+    if (diff >= step) { code |= 1; diffq += step; }
+
+    st->predictor = clamp_s16((code & 8) ? st->predictor - diffq : st->predictor + diffq);
+    st->step_index = clamp_index(st->step_index + s_index_table_4bit[code & 7]);
+    return code;
+}
+
+static int16_t adpcm_decode_4bit(speech_adpcm_state_t *st, uint8_t code) {
+    int step = s_step_table[st->step_index];
+    int diffq = step >> 3;
+    if (code & 4) diffq += step;
+    if (code & 2) diffq += step >> 1;
+    if (code & 1) diffq += step >> 2;
+
+    st->predictor = clamp_s16((code & 8) ? st->predictor - diffq : st->predictor + diffq);
+    st->step_index = clamp_index(st->step_index + s_index_table_4bit[code & 7]);
+    return st->predictor;
+}
+
+// 2-bit ADPCM: sign + one magnitude bit, reconstruction at 0.5 and 1.5 steps
+static uint8_t adpcm_encode_2bit(speech_adpcm_state_t *st, int16_t sample) {
+    int step = s_step_table[st->step_index];
+    int diff = (int)sample - st->predictor;
+    uint8_t code = 0;
+
+    if (diff < 0) {
+        code = 2;
+        diff = -diff;
+    }
+    if (diff >= step) code |= 1;
+
+    int diffq = (step >> 1) + ((code & 1) ? step : 0);
+    st->predictor = clamp_s16((code & 2) ? st->predictor - diffq : st->predictor + diffq);
+    st->step_index = clamp_index(st->step_index + s_index_table_2bit[code & 1]);
+    return code;
+}
+
+static int16_t adpcm_decode_2bit(speech_adpcm_state_t *st, uint8_t code) {
+    int step = s_step_table[st->step_index];
+    int diffq = (step >> 1) + ((code & 1) ? step : 0);
+    st->predictor = clamp_s16((code & 2) ? st->predictor - diffq : st->predictor + diffq);
+    st->step_index = clamp_index(st->step_index + s_index_table_2bit[code & 1]);
+    return st->predictor;
+}
+
+// Decimate 320 samples at 16 kHz to 160 samples at 8 kHz
+static void decimate_frame(speech_encoder_t *enc, const int16_t *in, int16_t *out) {
+    const int hist = SPEECH_DECIM_TAPS - 1;
+    int16_t work[SPEECH_DECIM_TAPS - 1 + SPEECH_FRAME_SAMPLES_IN];
+
+    memcpy(work, enc->decim_hist, sizeof(enc->decim_hist));
+    memcpy(work + hist, in, SPEECH_FRAME_SAMPLES_IN * sizeof(int16_t));
+
+    for (int o = 0; o < SPEECH_FRAME_SAMPLES_IN / 2; o++) {
+        const int16_t *x = &work[2 * o + 1];
+        int32_t acc = 0;
+        // Odd taps (other than the centre) are zero in a half-band filter
+        for (int k = 0; k < SPEECH_DECIM_TAPS; k += 2) {
+            acc += (int32_t)s_decim_coeffs[k] * x[k];
+        }
+        acc += (int32_t)s_decim_coeffs[SPEECH_DECIM_TAPS / 2] * x[SPEECH_DECIM_TAPS / 2];
+        out[o] = clamp_s16((acc + (1 << 14)) >> 15);
+    }
+
+    memcpy(enc->decim_hist, work + SPEECH_FRAME_SAMPLES_IN, sizeof(enc->decim_hist));
+}
+
+bool speech_codec_mode_valid(int mode) {
+    return mode == SPEECH_CODEC_WB4 || mode == SPEECH_CODEC_NB4 || mode == SPEECH_CODEC_NB2;
+}
+
+uint32_t speech_codec_sample_rate(speech_codec_mode_t mode) {
+    return mode == SPEECH_CODEC_WB4 ? 16000 : 8000;
+}
+
+static size_t frame_samples_out(speech_codec_mode_t mode) {
+    return mode == SPEECH_CODEC_WB4 ? SPEECH_FRAME_SAMPLES_IN : SPEECH_FRAME_SAMPLES_IN / 2;
+}
+
+static unsigned bits_per_sample(speech_codec_mode_t mode) {
+    return mode == SPEECH_CODEC_NB2 ? 2 : 4;
+}
+
+size_t speech_codec_frame_bytes(speech_codec_mode_t mode) {
+    return SPEECH_FRAME_HDR_BYTES + (frame_samples_out(mode) * bits_per_sample(mode)) / 8;
+}
+
+uint32_t speech_codec_bitrate(speech_codec_mode_t mode) {
+    return (uint32_t)speech_codec_frame_bytes(mode) * 8 * (1000 / SPEECH_FRAME_MS);
+}
+
+const char *speech_codec_mode_name(speech_codec_mode_t mode) {
+    switch (mode) {
+    case SPEECH_CODEC_WB4: return "WB4";
+    case SPEECH_CODEC_NB4: return "NB4";
+    case SPEECH_CODEC_NB2: return "NB2";
+    default:               return "?";
+    }
+}
+
+void speech_encoder_init(speech_encoder_t *enc, speech_codec_mode_t mode) {
+    memset(enc, 0, sizeof(*enc));
+    enc->mode = mode;
+}
+
+size_t speech_encoder_encode_frame(speech_encoder_t *enc, const int16_t *pcm, uint8_t *out) {
+    int16_t narrow[SPEECH_FRAME_SAMPLES_IN / 2];
+    const int16_t *src = pcm;
+    size_t n = frame_samples_out(enc->mode);
+
+    if (enc->mode != SPEECH_CODEC_WB4) {
+        decimate_frame(enc, pcm, narrow);
+        src = narrow;
+    }
+
+    // Frame header carries the state at frame start so frames decode independently
+    out[0] = (uint8_t)enc->adpcm.predictor;
+    out[1] = (uint8_t)((uint16_t)enc->adpcm.predictor >> 8);
+    out[2] = (uint8_t)enc->adpcm.step_index;
+    out[3] = (uint8_t)enc->mode;
+
+    uint8_t *p = out + SPEECH_FRAME_HDR_BYTES;
+    if (enc->mode == SPEECH_CODEC_NB2) {
+        for (size_t i = 0; i < n; i += 4) {
+            uint8_t b = 0;
+            for (size_t j = 0; j < 4; j++) {
+                b |= (uint8_t)(adpcm_encode_2bit(&enc->adpcm, src[i + j]) << (2 * j));
+            }
+            *p++ = b;
+        }
+    } else {
+        for (size_t i = 0; i < n; i += 2) {
+            uint8_t lo = adpcm_encode_4bit(&enc->adpcm, src[i]);
+            uint8_t hi = adpcm_encode_4bit(&enc->adpcm, src[i + 1]);
+            *p++ = (uint8_t)(lo | (hi << 4));
+        }
+    }
+
+    return (size_t)(p - out);
+}
+
+void speech_decoder_init(speech_decoder_t *dec, speech_codec_mode_t mode) {
+    memset(dec, 0, sizeof(*dec));
+    dec->mode = mode;
+}
+
+size_t speech_decoder_decode_frame(speech_decoder_t *dec, const uint8_t *in, size_t in_len, int16_t *pcm) {
+    if (in_len != speech_codec_frame_bytes(dec->mode) || in[3] != (uint8_t)dec->mode || in[2] > 88) {
+        return 0;
+    }
+
+    dec->adpcm.predictor = (int16_t)((uint16_t)in[0] | ((uint16_t)in[1] << 8));
+    dec->adpcm.step_index = (int8_t)in[2];
+
+    size_t n = frame_samples_out(dec->mode);
+    const uint8_t *p = in + SPEECH_FRAME_HDR_BYTES;
+    if (dec->mode == SPEECH_CODEC_NB2) {
+        for (size_t i = 0; i < n; i += 4, p++) {
+            for (size_t j = 0; j < 4; j++) {
+                pcm[i + j] = adpcm_decode_2bit(&dec->adpcm, (*p >> (2 * j)) & 0x03);
+            }
+        }
+    } else {
+        for (size_t i = 0; i < n; i += 2, p++) {
+            pcm[i] = adpcm_decode_4bit(&dec->adpcm, *p & 0x0F);
+            pcm[i + 1] = adpcm_decode_4bit(&dec->adpcm, *p >> 4);
+        }
+    }
+    return n;
+}
+
+static inline void put_u16_le(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static inline void put_u32_le(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+void speech_file_header_fill(uint8_t out[32], speech_codec_mode_t mode, uint32_t total_frames,
+                             uint32_t source_samples, uint32_t start_ms, uint32_t end_ms) {
+    put_u32_le(out + 0,  SPEECH_FILE_MAGIC);
+    put_u32_le(out + 4,  SPEECH_FILE_VERSION);
+    put_u16_le(out + 8,  (uint16_t)mode);
+    put_u16_le(out + 10, SPEECH_FRAME_MS);
+    put_u32_le(out + 12, speech_codec_sample_rate(mode));
+    put_u32_le(out + 16, total_frames);
+    put_u32_le(out + 20, source_samples);
+    put_u32_le(out + 24, start_ms);
+    put_u32_le(out + 28, end_ms);
+}
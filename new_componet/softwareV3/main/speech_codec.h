@@ -0,0 +1,146 @@
+/**
+ * @file speech_codec.h
+ * @brief Low-bitrate speech encoding for bandwidth-constrained sync
+ *
+ * Fixed-point ADPCM speech encoder/decoder used to shrink RAW v1 recordings
+ * (160 KB/s) before they are sent over BLE. No ESP-IDF dependencies so the
+ * same code can be built on the host.
+ *
+ * Modes (20 ms frames, 4-byte frame header included in the bitrate):
+ *   WB4 - 16 kHz, 4-bit IMA ADPCM  (~66 kbps,  ~20x smaller than RAW v1)
+ *   NB4 -  8 kHz, 4-bit IMA ADPCM  (~34 kbps,  ~38x smaller than RAW v1)
+ *   NB2 -  8 kHz, 2-bit ADPCM      (~18 kbps,  ~73x smaller than RAW v1)
+ */
+
+#ifndef SPEECH_CODEC_H
+#define SPEECH_CODEC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Encoded file header - PACKED, little-endian, same size as the RAW v1 header
+typedef struct __attribute__((packed)) {
+    uint32_t magic_number;     // 0x48435053 = "SPCH"
+    uint32_t version;          // Speech file format version
+    uint16_t codec;            // speech_codec_mode_t
+    uint16_t frame_ms;         // Frame duration in milliseconds
+    uint32_t sample_rate;      // Encoded sample rate (Hz)
+    uint32_t total_frames;     // Number of encoded frames in file
+    uint32_t source_samples;   // Number of 16 kHz samples in the source recording
+    uint32_t start_timestamp;  // Copied from the RAW v1 header
+    uint32_t end_timestamp;    // Copied from the RAW v1 header
+} speech_file_header_t;
+
+_Static_assert(sizeof(speech_file_header_t) == 32, "Speech header must be 32 bytes");
+
+#define SPEECH_FILE_MAGIC        0x48435053  // "SPCH" in ASCII
+#define SPEECH_FILE_VERSION      1
+#define SPEECH_INPUT_RATE        16000
+#define SPEECH_FRAME_MS          20
+#define SPEECH_FRAME_SAMPLES_IN  (SPEECH_INPUT_RATE * SPEECH_FRAME_MS / 1000)  // 320
+#define SPEECH_FRAME_HDR_BYTES   4
+#define SPEECH_FRAME_MAX_BYTES   (SPEECH_FRAME_HDR_BYTES + SPEECH_FRAME_SAMPLES_IN / 2)
+
+typedef enum {
+    SPEECH_CODEC_WB4 = 1,
+    SPEECH_CODEC_NB4 = 2,
+    SPEECH_CODEC_NB2 = 3,
+} speech_codec_mode_t;
+
+// Half-band decimator length (16 kHz -> 8 kHz)
+#define SPEECH_DECIM_TAPS 15
+
+typedef struct {
+    int16_t predictor;
+    int8_t step_index;
+} speech_adpcm_state_t;
+
+typedef struct {
+    speech_codec_mode_t mode;
+    speech_adpcm_state_t adpcm;
+    int16_t decim_hist[SPEECH_DECIM_TAPS - 1];
+} speech_encoder_t;
+
+typedef struct {
+    speech_codec_mode_t mode;
+    speech_adpcm_state_t adpcm;
+} speech_decoder_t;
+
+/**
+ * @brief Check that a mode value is supported
+ */
+bool speech_codec_mode_valid(int mode);
+
+/**
+ * @brief Encoded sample rate for a mode (16000 or 8000)
+ */
+uint32_t speech_codec_sample_rate(speech_codec_mode_t mode);
+
+/**
+ * @brief Encoded bytes per 20 ms frame, including the frame header
+ */
+size_t speech_codec_frame_bytes(speech_codec_mode_t mode);
+
+/**
+ * @brief Nominal bitrate of a mode in bits per second
+ */
+uint32_t speech_codec_bitrate(speech_codec_mode_t mode);
+
+/**
+ * @brief Human-readable mode name for logs
+ */
+const char *speech_codec_mode_name(speech_codec_mode_t mode);
+
+/**
+ * @brief Reset an encoder for a new stream
+ */
+void speech_encoder_init(speech_encoder_t *enc, speech_codec_mode_t mode);
+
+/**
+ * @brief Encode one 20 ms frame of 16 kHz PCM
+ * @param enc Encoder state
+ * @param pcm SPEECH_FRAME_SAMPLES_IN samples at 16 kHz
+ * @param out Output buffer, at least speech_codec_frame_bytes(mode) bytes
+ * @return Number of bytes written
+ */
+size_t speech_encoder_encode_frame(speech_encoder_t *enc, const int16_t *pcm, uint8_t *out);
+
+/**
+ * @brief Reset a decoder for a new stream
+ */
+void speech_decoder_init(speech_decoder_t *dec, speech_codec_mode_t mode);
+
+/**
+ * @brief Decode one frame produced by speech_encoder_encode_frame()
+ * @param dec Decoder state
+ * @param in Encoded frame
+ * @param in_len Length of encoded frame
+ * @param pcm Output samples at speech_codec_sample_rate(mode)
+ * @return Number of samples decoded, 0 on malformed input
+ */
+size_t speech_decoder_decode_frame(speech_decoder_t *dec, const uint8_t *in, size_t in_len, int16_t *pcm);
+
+/**
+ * @brief Fill a speech file header
+ */
+void speech_file_header_fill(uint8_t out[32], speech_codec_mode_t mode, uint32_t total_frames,
+                             uint32_t source_samples, uint32_t start_ms, uint32_t end_ms);
+
+/**
+ * @brief Convert a 12-bit RAW v1 ADC sample to signed 16-bit PCM
+ */
+static inline int16_t speech_codec_adc_to_pcm(uint16_t adc) {
+    if (adc > 4095) adc = 4095;
+    return (int16_t)(((int32_t)adc - 2048) * 16);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SPEECH_CODEC_H
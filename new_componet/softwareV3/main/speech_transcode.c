@@ -0,0 +1,314 @@
+#include "speech_transcode.h"
+#include "sd_storage.h"
+#include "raw_audio_storage.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char *TAG = "speech_xcode";
+
+#define TRANSCODE_SCAN_INTERVAL_MS 30000
+#define TRANSCODE_TMP_EXT ".sp~"
+
+static speech_codec_mode_t s_mode = SPEECH_CODEC_NB2;
+static speech_transcode_busy_fn_t s_busy_fn = NULL;
+static TaskHandle_t s_task = NULL;
+static volatile bool s_working = false;
+static char s_last_failed[SD_MAX_PATH];  // Skipped on later scans so one bad file can't stall the backlog
+
+// The work buffers below are shared: the background task and an on-demand
+// variant take turns. The lock exists once the background task does.
+static SemaphoreHandle_t s_lock = NULL;
+static volatile bool s_demand = false;      // A transfer waits for the lock: background yields
+
+// Last on-demand copy, reused when a transfer asks for it again
+static char s_variant_src[SD_MAX_PATH];
+
+// Static work buffers - keeps the task stack small
+static uint8_t s_raw_buf[SPEECH_FRAME_SAMPLES_IN * sizeof(raw_audio_sample_t)];
+static int16_t s_pcm_buf[SPEECH_FRAME_SAMPLES_IN];
+static uint8_t s_enc_buf[SPEECH_FRAME_MAX_BYTES];
+static speech_encoder_t s_encoder;
+
+static inline uint32_t get_u32_le(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline bool is_busy(void) {
+    return s_demand || (s_busy_fn && s_busy_fn());
+}
+
+bool speech_transcode_companion_path(const char *raw_path, char *out, size_t out_sz) {
+    size_t len = strlen(raw_path);
+    if (len < 4 || strcasecmp(raw_path + len - 4, ".raw") != 0) return false;
+    int n = snprintf(out, out_sz, "%.*s%s", (int)(len - 4), raw_path, SPEECH_FILE_EXT);
+    return n > 0 && n < (int)out_sz;
+}
+
+// busy() is polled every 50 frames; NULL runs to the end
+static esp_err_t transcode(const char *raw_path, const char *out_path, speech_codec_mode_t mode,
+                           bool (*busy)(void)) {
+    char tmp_path[SD_MAX_PATH];
+    int n = snprintf(tmp_path, sizeof(tmp_path), "%s%s", out_path, TRANSCODE_TMP_EXT);
+    if (n <= 0 || n >= (int)sizeof(tmp_path)) return ESP_ERR_INVALID_ARG;
+
+    FILE *in = fopen(raw_path, "rb");
+    if (!in) {
+        ESP_LOGW(TAG, "Failed to open %s (errno: %d)", raw_path, errno);
+        return ESP_FAIL;
+    }
+
+    uint8_t hdr[32];
+    if (fread(hdr, 1, sizeof(hdr), in) != sizeof(hdr) || get_u32_le(hdr) != RAW_AUDIO_MAGIC_NUMBER) {
+        ESP_LOGW(TAG, "Not a RAW v1 file: %s", raw_path);
+        fclose(in);
+        return ESP_FAIL;
+    }
+    uint32_t start_ms = get_u32_le(hdr + 16);
+    uint32_t end_ms = get_u32_le(hdr + 20);
+
+    FILE *out = fopen(tmp_path, "wb");
+    if (!out) {
+        ESP_LOGW(TAG, "Failed to create %s (errno: %d)", tmp_path, errno);
+        fclose(in);
+        return ESP_FAIL;
+    }
+
+    // Placeholder header, rewritten with final counts below
+    uint8_t out_hdr[32];
+    speech_file_header_fill(out_hdr, mode, 0, 0, start_ms, end_ms);
+    esp_err_t ret = (fwrite(out_hdr, 1, sizeof(out_hdr), out) == sizeof(out_hdr)) ? ESP_OK : ESP_FAIL;
+
+    speech_encoder_init(&s_encoder, mode);
+    uint32_t frames = 0;
+    uint32_t source_samples = 0;
+    int64_t t0 = esp_timer_get_time();
+
+    while (ret == ESP_OK) {
+        size_t got = fread(s_raw_buf, sizeof(raw_audio_sample_t), SPEECH_FRAME_SAMPLES_IN, in);
+        if (got == 0) break;
+
+        for (size_t i = 0; i < got; i++) {
+            const uint8_t *rec = s_raw_buf + i * sizeof(raw_audio_sample_t);
+            s_pcm_buf[i] = speech_codec_adc_to_pcm((uint16_t)(rec[0] | (rec[1] << 8)));
+        }
+        // Pad the final partial frame with silence
+        for (size_t i = got; i < SPEECH_FRAME_SAMPLES_IN; i++) {
+            s_pcm_buf[i] = 0;
+        }
+        source_samples += (uint32_t)got;
+
+        size_t enc_len = speech_encoder_encode_frame(&s_encoder, s_pcm_buf, s_enc_buf);
+        if (fwrite(s_enc_buf, 1, enc_len, out) != enc_len) {
+            ESP_LOGW(TAG, "Write failed after %lu frames (errno: %d)", (unsigned long)frames, errno);
+            ret = ESP_FAIL;
+            break;
+        }
+        frames++;
+
+        // Yield the card to recording/transfer as soon as they need it
+        if ((frames % 50) == 0) {
+            if (busy && busy()) {
+                ESP_LOGI(TAG, "Device busy - abandoning transcode of %s", raw_path);
+                ret = ESP_ERR_INVALID_STATE;
+                break;
+            }
+            vTaskDelay(1);
+        }
+
+        if (got < SPEECH_FRAME_SAMPLES_IN) break;
+    }
+    fclose(in);
+
+    if (ret == ESP_OK) {
+        speech_file_header_fill(out_hdr, mode, frames, source_samples, start_ms, end_ms);
+        if (fseek(out, 0, SEEK_SET) != 0 || fwrite(out_hdr, 1, sizeof(out_hdr), out) != sizeof(out_hdr)) {
+            ESP_LOGW(TAG, "Failed to finalize speech header (errno: %d)", errno);
+            ret = ESP_FAIL;
+        }
+    }
+    fclose(out);
+
+    if (ret != ESP_OK) {
+        unlink(tmp_path);
+        return ret;
+    }
+
+    unlink(out_path);
+    if (rename(tmp_path, out_path) != 0) {
+        ESP_LOGW(TAG, "Failed to rename %s (errno: %d)", tmp_path, errno);
+        unlink(tmp_path);
+        return ESP_FAIL;
+    }
+
+    int64_t elapsed_ms = (esp_timer_get_time() - t0) / 1000;
+    uint32_t audio_ms = source_samples / (SPEECH_INPUT_RATE / 1000);
+    ESP_LOGI(TAG, "🗜️ %s -> %s (%s, %lu frames, %lu ms audio in %lld ms)",
+             raw_path, out_path, speech_codec_mode_name(mode), (unsigned long)frames,
+             (unsigned long)audio_ms, (long long)elapsed_ms);
+    return ESP_OK;
+}
+
+esp_err_t speech_transcode_file(const char *raw_path, const char *out_path, speech_codec_mode_t mode) {
+    if (s_lock) xSemaphoreTake(s_lock, portMAX_DELAY);
+    esp_err_t ret = transcode(raw_path, out_path, mode, is_busy);
+    if (s_lock) xSemaphoreGive(s_lock);
+    return ret;
+}
+
+// What a speech file records about its source. FAT mtimes are no use here:
+// without an RTC every file is stamped with the same boot-relative time.
+typedef struct {
+    uint32_t samples;
+    uint32_t start_ms;
+    uint32_t end_ms;
+} source_key_t;
+
+// The key of a recording: whole samples after the header and its timestamps
+static bool raw_source_key(const char *raw_path, source_key_t *key) {
+    struct stat st;
+    if (stat(raw_path, &st) != 0 || st.st_size < 32) return false;
+    uint8_t hdr[32];
+    FILE *f = fopen(raw_path, "rb");
+    if (!f) return false;
+    size_t got = fread(hdr, 1, sizeof(hdr), f);
+    fclose(f);
+    if (got != sizeof(hdr) || get_u32_le(hdr) != RAW_AUDIO_MAGIC_NUMBER) return false;
+    key->samples = (uint32_t)((st.st_size - 32) / sizeof(raw_audio_sample_t));
+    key->start_ms = get_u32_le(hdr + 16);
+    key->end_ms = get_u32_le(hdr + 20);
+    return true;
+}
+
+// True if path is a speech file in this codec made from the recording with this key.
+// A recording finished by power-fail recovery or rewritten under the same name changes it.
+static bool speech_file_matches(const char *path, speech_codec_mode_t mode, const source_key_t *key) {
+    uint8_t hdr[sizeof(speech_file_header_t)];
+    FILE *f = fopen(path, "rb");
+    if (!f) return false;
+    size_t got = fread(hdr, 1, sizeof(hdr), f);
+    fclose(f);
+    if (got != sizeof(hdr) || get_u32_le(hdr) != SPEECH_FILE_MAGIC) return false;
+    return (hdr[8] | (hdr[9] << 8)) == (int)mode && get_u32_le(hdr + 20) == key->samples &&
+           get_u32_le(hdr + 24) == key->start_ms && get_u32_le(hdr + 28) == key->end_ms;
+}
+
+bool speech_transcode_variant_ready(const char *raw_path, speech_codec_mode_t mode, char *out, size_t out_sz) {
+    source_key_t key;
+    if (!raw_source_key(raw_path, &key)) return false;
+
+    // The background companion, if it was made from this recording as it is now, in this codec
+    if (speech_transcode_companion_path(raw_path, out, out_sz) && speech_file_matches(out, mode, &key)) {
+        return true;
+    }
+    // The last on-demand copy, likewise
+    if (strcmp(s_variant_src, raw_path) == 0 && speech_file_matches(SPEECH_VARIANT_PATH, mode, &key)) {
+        int n = snprintf(out, out_sz, "%s", SPEECH_VARIANT_PATH);
+        return n > 0 && n < (int)out_sz;
+    }
+    return false;
+}
+
+esp_err_t speech_transcode_variant(const char *raw_path, speech_codec_mode_t mode, bool (*busy)(void),
+                                   char *out, size_t out_sz) {
+    if (!speech_codec_mode_valid(mode)) return ESP_ERR_INVALID_ARG;
+    if (speech_transcode_variant_ready(raw_path, mode, out, out_sz)) return ESP_OK;
+    int n = snprintf(out, out_sz, "%s", SPEECH_VARIANT_PATH);
+    if (n <= 0 || n >= (int)out_sz) return ESP_ERR_INVALID_ARG;
+
+    // The background task gives the buffers up within 50 frames
+    s_demand = true;
+    if (s_lock) xSemaphoreTake(s_lock, portMAX_DELAY);
+    s_variant_src[0] = '\0';
+    esp_err_t ret = transcode(raw_path, SPEECH_VARIANT_PATH, mode, busy);
+    if (ret == ESP_OK) {
+        strlcpy(s_variant_src, raw_path, sizeof(s_variant_src));
+    }
+    if (s_lock) xSemaphoreGive(s_lock);
+    s_demand = false;
+    return ret;
+}
+
+// Transcode the first .raw file without an up-to-date companion; returns true if one was converted
+static bool transcode_next_pending(void) {
+    DIR *dir = opendir(SD_REC_DIR);
+    if (!dir) return false;
+
+    char raw_path[SD_MAX_PATH];
+    char spc_path[SD_MAX_PATH];
+    bool found = false;
+    struct dirent *ent;
+
+    while (!found && (ent = readdir(dir)) != NULL) {
+        size_t len = strlen(ent->d_name);
+        if (len < 4 || strcasecmp(ent->d_name + len - 4, ".raw") != 0) continue;
+
+        int n = snprintf(raw_path, sizeof(raw_path), "%s/%s", SD_REC_DIR, ent->d_name);
+        if (n <= 0 || n >= (int)sizeof(raw_path)) continue;
+        if (!speech_transcode_companion_path(raw_path, spc_path, sizeof(spc_path))) continue;
+
+        source_key_t key;
+        if (!raw_source_key(raw_path, &key) || key.samples == 0) continue;
+        if (speech_file_matches(spc_path, s_mode, &key)) continue;
+        if (strcmp(raw_path, s_last_failed) == 0) continue;
+        found = true;
+    }
+    closedir(dir);
+
+    if (!found) return false;
+
+    esp_err_t ret = speech_transcode_file(raw_path, spc_path, s_mode);
+    if (ret == ESP_FAIL) {
+        strncpy(s_last_failed, raw_path, sizeof(s_last_failed) - 1);
+    }
+    return ret == ESP_OK;
+}
+
+static void speech_transcode_task(void *arg) {
+    (void)arg;
+    ESP_LOGI(TAG, "Speech transcode task started (%s, %lu bps)",
+             speech_codec_mode_name(s_mode), (unsigned long)speech_codec_bitrate(s_mode));
+
+    while (true) {
+        vTaskDelay(pdMS_TO_TICKS(TRANSCODE_SCAN_INTERVAL_MS));
+        if (is_busy() || !sd_storage_is_available()) continue;
+
+        // Work through the backlog while idle
+        s_working = true;
+        while (!is_busy() && sd_storage_is_available() && transcode_next_pending()) {
+            vTaskDelay(pdMS_TO_TICKS(10));
+        }
+        s_working = false;
+    }
+}
+
+esp_err_t speech_transcode_start(speech_codec_mode_t mode, speech_transcode_busy_fn_t busy_fn) {
+    if (s_task) return ESP_OK;
+    if (!speech_codec_mode_valid(mode)) return ESP_ERR_INVALID_ARG;
+
+    s_mode = mode;
+    s_busy_fn = busy_fn;
+    s_lock = xSemaphoreCreateMutex();
+    if (!s_lock) return ESP_ERR_NO_MEM;
+
+    BaseType_t ok = xTaskCreate(speech_transcode_task, "speech_xcode", 4096, NULL, 2, &s_task);
+    if (ok != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create transcode task");
+        s_task = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+bool speech_transcode_active(void) {
+    return s_working;
+}
@@ -0,0 +1,86 @@
+/**
+ * @file speech_transcode.h
+ * @brief Background RAW v1 -> speech codec transcoder
+ *
+ * When the device is idle, finished .raw recordings are transcoded to a
+ * companion .spc file (speech_codec.h format) that clients can fetch instead
+ * of the full-rate RAW file.
+ *
+ * A transfer can also ask for a recording in another codec than the
+ * companion's (START_BY_ID with a variant, ft_proto.h). That copy is made
+ * on demand into SPEECH_VARIANT_PATH, one at a time, and kept until a
+ * different one is needed so a retried transfer does not pay for it twice.
+ */
+
+#ifndef SPEECH_TRANSCODE_H
+#define SPEECH_TRANSCODE_H
+
+#include "esp_err.h"
+#include "speech_codec.h"
+#include "sd_storage.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SPEECH_FILE_EXT ".spc"
+#define SPEECH_VARIANT_PATH SD_REC_DIR "/variant.spc"   // No variant.raw, so never taken for a companion
+
+// Returns true while the device is busy (recording, transferring); transcoding yields
+typedef bool (*speech_transcode_busy_fn_t)(void);
+
+/**
+ * @brief Start the background transcode task
+ * @param mode Codec used for new .spc files
+ * @param busy_fn Callback polled between frames; may be NULL
+ */
+esp_err_t speech_transcode_start(speech_codec_mode_t mode, speech_transcode_busy_fn_t busy_fn);
+
+/**
+ * @brief True while the background task is scanning or converting files
+ */
+bool speech_transcode_active(void);
+
+/**
+ * @brief Transcode a single RAW v1 file synchronously
+ * @param raw_path Source .raw path
+ * @param out_path Destination .spc path
+ * @param mode Codec mode
+ * @return ESP_OK, ESP_ERR_INVALID_STATE if aborted because busy, ESP_FAIL on I/O error
+ */
+esp_err_t speech_transcode_file(const char *raw_path, const char *out_path, speech_codec_mode_t mode);
+
+/**
+ * @brief Is a speech copy of raw_path in this mode already on the card?
+ *
+ * A copy counts only if its header matches the recording as it is now:
+ * source sample count and start/end timestamps (not file times).
+ * @param out Its path when true
+ */
+bool speech_transcode_variant_ready(const char *raw_path, speech_codec_mode_t mode, char *out, size_t out_sz);
+
+/**
+ * @brief Speech copy of raw_path in this mode, transcoded now if it is not on the card
+ *
+ * The background task yields while this waits and runs. Blocks for as long
+ * as the transcode takes (the whole recording is read).
+ * @param busy Polled between frames; true abandons the transcode (may be NULL)
+ * @param out Path of the copy on ESP_OK
+ * @return ESP_OK, ESP_ERR_INVALID_STATE if abandoned, ESP_FAIL on I/O error
+ */
+esp_err_t speech_transcode_variant(const char *raw_path, speech_codec_mode_t mode, bool (*busy)(void),
+                                   char *out, size_t out_sz);
+
+/**
+ * @brief Build the .spc companion path for a .raw path
+ * @return true if the result fit in out
+ */
+bool speech_transcode_companion_path(const char *raw_path, char *out, size_t out_sz);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SPEECH_TRANSCODE_H
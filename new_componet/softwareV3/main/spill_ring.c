@@ -0,0 +1,65 @@
+/**
+ * @file spill_ring.c
+ * @brief RAM spill FIFO for raw samples (see spill_ring.h)
+ */
+
+#include "spill_ring.h"
+
+void spill_ring_init(spill_ring_t *r, uint16_t *buf, uint32_t cap, uint32_t rate_hz) {
+    r->buf = buf;
+    r->cap = cap;
+    r->rate_hz = rate_hz ? rate_hz : 1;
+    r->lost = 0;
+    r->peak = 0;
+    spill_ring_clear(r);
+}
+
+void spill_ring_clear(spill_ring_t *r) {
+    r->head = 0;
+    r->count = 0;
+    r->run_head = 0;
+    r->run_count = 0;
+    r->gap = false;
+}
+
+bool spill_ring_push(spill_ring_t *r, uint16_t sample, uint32_t now_ms) {
+    if (r->count == r->cap) {
+        r->lost++;
+        r->gap = true;
+        return false;
+    }
+    if (r->run_count == 0 || r->gap) {
+        // Timestamps can't be carried across the refused samples: start a new run
+        if (r->run_count == SPILL_RING_RUNS) {
+            r->lost++;
+            return false;
+        }
+        uint32_t idx = (r->run_head + r->run_count) % SPILL_RING_RUNS;
+        r->runs[idx] = (spill_run_t){ .first_ms = now_ms };
+        r->run_count++;
+        r->gap = false;
+    }
+    r->runs[(r->run_head + r->run_count - 1) % SPILL_RING_RUNS].count++;
+    uint32_t tail = r->head + r->count;
+    if (tail >= r->cap) tail -= r->cap;
+    r->buf[tail] = sample;
+    r->count++;
+    if (r->count > r->peak) r->peak = r->count;
+    return true;
+}
+
+bool spill_ring_pop(spill_ring_t *r, uint16_t *sample, uint32_t *ts_ms) {
+    if (r->count == 0) return false;
+    spill_run_t *run = &r->runs[r->run_head];
+    *sample = r->buf[r->head];
+    *ts_ms = run->first_ms + (uint32_t)(((uint64_t)run->popped * 1000u) / r->rate_hz);
+    run->popped++;
+    if (--run->count == 0) {
+        r->run_head = (uint8_t)((r->run_head + 1) % SPILL_RING_RUNS);
+        r->run_count--;
+    }
+    r->head++;
+    if (r->head == r->cap) r->head = 0;
+    r->count--;
+    return true;
+}
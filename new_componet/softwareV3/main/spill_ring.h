@@ -0,0 +1,73 @@
+/**
+ * @file spill_ring.h
+ * @brief FIFO of raw ADC samples held in RAM while the card is unavailable
+ *
+ * Samples are stored as 16-bit values; timestamps are not kept per sample
+ * but rebuilt from the arrival time of the first sample of a run and the
+ * sample rate. A run is samples pushed without a refusal between them: a
+ * full ring refuses new samples, so the next accepted one starts a new run
+ * at its own arrival time. Up to SPILL_RING_RUNS runs are held; past that
+ * pushes are refused until the oldest run is taken. Pure C; the caller
+ * owns the storage.
+ */
+
+#ifndef SPILL_RING_H
+#define SPILL_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SPILL_RING_RUNS 4
+
+typedef struct {
+    uint32_t first_ms;      // Arrival of the run's first sample
+    uint32_t count;         // Samples of the run still queued
+    uint32_t popped;        // Samples taken from the run
+} spill_run_t;
+
+typedef struct {
+    uint16_t *buf;
+    uint32_t cap;
+    uint32_t head;          // Oldest sample
+    uint32_t count;
+    uint32_t rate_hz;
+    spill_run_t runs[SPILL_RING_RUNS];
+    uint8_t run_head;       // Oldest run
+    uint8_t run_count;
+    bool gap;               // A push was refused since the last accepted one
+    uint32_t lost;          // Pushes refused because the ring was full
+    uint32_t peak;          // Highest count seen
+} spill_ring_t;
+
+void spill_ring_init(spill_ring_t *r, uint16_t *buf, uint32_t cap, uint32_t rate_hz);
+
+// Forget all queued samples (counters are kept)
+void spill_ring_clear(spill_ring_t *r);
+
+/**
+ * @brief Queue a sample
+ * @return false if the ring is full (counted in lost)
+ */
+bool spill_ring_push(spill_ring_t *r, uint16_t sample, uint32_t now_ms);
+
+/**
+ * @brief Take the oldest sample
+ * @param ts_ms Reconstructed arrival time
+ * @return false if empty
+ */
+bool spill_ring_pop(spill_ring_t *r, uint16_t *sample, uint32_t *ts_ms);
+
+static inline uint32_t spill_ring_count(const spill_ring_t *r) {
+    return r->count;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SPILL_RING_H
@@ -0,0 +1,87 @@
+/**
+ * @file sync_catalog.c
+ * @brief Acknowledged-upload catalog (see sync_catalog.h)
+ */
+
+#include "sync_catalog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static int remember(sync_catalog_t *cat, const char *name, uint32_t size) {
+    // A re-upload after the file changed replaces the old size
+    for (size_t i = 0; i < cat->count; i++) {
+        if (strcmp(cat->entries[i].name, name) == 0) {
+            cat->entries[i].size = size;
+            return 0;
+        }
+    }
+    if (cat->count == cat->capacity) {
+        size_t cap = cat->capacity ? cat->capacity * 2 : 16;
+        sync_catalog_entry_t *e = realloc(cat->entries, cap * sizeof(*e));
+        if (!e) return -1;
+        cat->entries = e;
+        cat->capacity = cap;
+    }
+    sync_catalog_entry_t *e = &cat->entries[cat->count++];
+    snprintf(e->name, sizeof(e->name), "%s", name);
+    e->size = size;
+    return 0;
+}
+
+int sync_catalog_open(sync_catalog_t *cat, const char *path) {
+    memset(cat, 0, sizeof(*cat));
+    if (strlen(path) >= sizeof(cat->path)) return -1;
+    strcpy(cat->path, path);
+
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+
+    char line[SYNC_CATALOG_NAME_MAX + 16];
+    char name[SYNC_CATALOG_NAME_MAX];
+    unsigned long size;
+    int ret = 0;
+    while (fgets(line, sizeof(line), f)) {
+        // Lines without their newline were cut short by a power loss
+        if (!strchr(line, '\n')) continue;
+        if (sscanf(line, "%63s %lu", name, &size) != 2) continue;
+        if (remember(cat, name, (uint32_t)size) != 0) {
+            ret = -1;
+            break;
+        }
+    }
+    fclose(f);
+    return ret;
+}
+
+void sync_catalog_close(sync_catalog_t *cat) {
+    free(cat->entries);
+    cat->entries = NULL;
+    cat->count = 0;
+    cat->capacity = 0;
+}
+
+bool sync_catalog_is_synced(const sync_catalog_t *cat, const char *name, uint32_t size) {
+    for (size_t i = 0; i < cat->count; i++) {
+        if (strcmp(cat->entries[i].name, name) == 0) return cat->entries[i].size == size;
+    }
+    return false;
+}
+
+int sync_catalog_append(const char *path, const char *name, uint32_t size) {
+    if (strlen(name) >= SYNC_CATALOG_NAME_MAX || strchr(name, ' ')) return -1;
+
+    FILE *f = fopen(path, "a");
+    if (!f) return -1;
+    int ok = fprintf(f, "%s %lu\n", name, (unsigned long)size) > 0;
+    ok = (fflush(f) == 0) && ok;
+    ok = (fsync(fileno(f)) == 0) && ok;
+    ok = (fclose(f) == 0) && ok;
+    return ok ? 0 : -1;
+}
+
+int sync_catalog_mark_synced(sync_catalog_t *cat, const char *name, uint32_t size) {
+    if (sync_catalog_append(cat->path, name, size) != 0) return -1;
+    return remember(cat, name, size);
+}
@@ -0,0 +1,65 @@
+/**
+ * @file sync_catalog.h
+ * @brief Record of recordings the upload server or a dock has acknowledged
+ *
+ * A text file with one "<name> <size>" line per acknowledged upload, only
+ * ever appended to, so a power loss can at worst cut the last line (which
+ * is then ignored and the file uploaded again). A recording whose size no
+ * longer matches its line counts as un-synced. Pure C over stdio.
+ */
+
+#ifndef SYNC_CATALOG_H
+#define SYNC_CATALOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SYNC_CATALOG_NAME_MAX 64
+
+typedef struct {
+    char name[SYNC_CATALOG_NAME_MAX];
+    uint32_t size;
+} sync_catalog_entry_t;
+
+typedef struct {
+    char path[128];
+    sync_catalog_entry_t *entries;
+    size_t count;
+    size_t capacity;
+} sync_catalog_t;
+
+/**
+ * @brief Load the catalog (a missing file is an empty catalog)
+ * @return 0, or -1 if the path is too long or memory ran out
+ */
+int sync_catalog_open(sync_catalog_t *cat, const char *path);
+
+void sync_catalog_close(sync_catalog_t *cat);
+
+/**
+ * @brief Has this file, at this size, been acknowledged?
+ */
+bool sync_catalog_is_synced(const sync_catalog_t *cat, const char *name, uint32_t size);
+
+/**
+ * @brief Record a server acknowledgement (appended and flushed to the card)
+ * @return 0 on success
+ */
+int sync_catalog_mark_synced(sync_catalog_t *cat, const char *name, uint32_t size);
+
+/**
+ * @brief Append an acknowledgement to the file at path without loading it
+ * @return 0 once the line is on the card
+ */
+int sync_catalog_append(const char *path, const char *name, uint32_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SYNC_CATALOG_H
@@ -0,0 +1,214 @@
+/**
+ * @file sync_state.c
+ * @brief Un-synced recording accounting (see sync_state.h)
+ */
+
+#include "sync_state.h"
+#include "sync_catalog.h"
+#include "wifi_offload.h"
+#include "sd_storage.h"
+#include "rec_id.h"
+#include "crc32c.h"
+#include "mem_plan.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static const char *TAG = "sync_state";
+
+#define SYNC_CATALOG_PATH SD_REC_DIR "/" WIFI_OFFLOAD_CATALOG
+#define SYNC_CRC_CHUNK    4096
+
+typedef struct {
+    uint32_t id;
+    uint32_t size;
+} pending_t;
+
+static SemaphoreHandle_t s_lock;
+static pending_t s_pending[SYNC_STATE_MAX_TRACKED];    // Ascending ID
+static size_t s_tracked;
+static uint32_t s_count;        // All un-synced recordings, tracked or not
+static uint64_t s_bytes;
+static uint32_t s_latest;
+static bool s_ready;
+static uint8_t *s_crc_buf;      // SYNC_CRC_CHUNK, from the memory plan
+
+// Caller holds s_lock. When the table is full the highest ID falls out but stays counted
+static void track(uint32_t id, uint32_t size) {
+    s_count++;
+    s_bytes += size;
+    if (id > s_latest) s_latest = id;
+
+    size_t i = s_tracked;
+    if (s_tracked == SYNC_STATE_MAX_TRACKED) {
+        if (id > s_pending[SYNC_STATE_MAX_TRACKED - 1].id) return;
+        i = SYNC_STATE_MAX_TRACKED - 1;
+    } else {
+        s_tracked++;
+    }
+    while (i > 0 && s_pending[i - 1].id > id) {
+        s_pending[i] = s_pending[i - 1];
+        i--;
+    }
+    s_pending[i] = (pending_t){ .id = id, .size = size };
+}
+
+// Caller holds s_lock. Returns true if the table ran empty with untracked recordings left
+static bool untrack(uint32_t id, uint32_t size) {
+    size_t i = 0;
+    while (i < s_tracked && s_pending[i].id != id) i++;
+    if (i < s_tracked) {
+        s_count--;
+        s_bytes -= s_pending[i].size;
+        memmove(&s_pending[i], &s_pending[i + 1], (s_tracked - i - 1) * sizeof(s_pending[0]));
+        s_tracked--;
+    } else if (s_count > s_tracked && (s_tracked == 0 || id > s_pending[s_tracked - 1].id)) {
+        // One of those that did not fit (an ID below the table's last was never pending)
+        s_count--;
+        s_bytes = s_bytes > size ? s_bytes - size : 0;
+    }
+    return s_tracked == 0 && s_count > 0;
+}
+
+// Caller holds s_lock
+static esp_err_t scan(void) {
+    sync_catalog_t cat;
+    if (sync_catalog_open(&cat, SYNC_CATALOG_PATH) != 0) {
+        sync_catalog_close(&cat);
+        return ESP_ERR_NO_MEM;
+    }
+    DIR *dir = opendir(SD_REC_DIR);
+    if (!dir) {
+        sync_catalog_close(&cat);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    s_tracked = 0;
+    s_count = 0;
+    s_bytes = 0;
+    struct dirent *entry;
+    char path[SD_MAX_PATH];
+    while ((entry = readdir(dir)) != NULL) {
+        uint32_t id = rec_id_parse(entry->d_name);
+        if (id == REC_ID_NONE) continue;
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", SD_REC_DIR, entry->d_name);
+        if (stat(path, &st) != 0 || st.st_size == 0) continue;
+        if (id > s_latest) s_latest = id;
+        if (sync_catalog_is_synced(&cat, entry->d_name, (uint32_t)st.st_size)) continue;
+        track(id, (uint32_t)st.st_size);
+    }
+    closedir(dir);
+    sync_catalog_close(&cat);
+    return ESP_OK;
+}
+
+esp_err_t sync_state_init(void) {
+    if (!s_lock) {
+        s_lock = xSemaphoreCreateMutex();
+        if (!s_lock) return ESP_ERR_NO_MEM;
+    }
+    if (!s_crc_buf) {
+        s_crc_buf = mem_plan_alloc("sync", "crc", SYNC_CRC_CHUNK, MEM_REGION_LARGE);
+        if (!s_crc_buf) return ESP_ERR_NO_MEM;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    esp_err_t err = scan();
+    s_ready = (err == ESP_OK);
+    xSemaphoreGive(s_lock);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Scan failed: %s", esp_err_to_name(err));
+        return err;
+    }
+    ESP_LOGI(TAG, "%lu recording(s), %llu KB not synced, latest ID %lu", (unsigned long)s_count,
+             (unsigned long long)(s_bytes + 1023) / 1024, (unsigned long)s_latest);
+    return ESP_OK;
+}
+
+void sync_state_added(uint32_t rec_id, uint32_t size) {
+    if (!s_lock || rec_id == REC_ID_NONE || size == 0) return;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    track(rec_id, size);
+    xSemaphoreGive(s_lock);
+}
+
+void sync_state_synced(const char *name) {
+    uint32_t id = rec_id_parse(name);
+    if (!s_lock || id == REC_ID_NONE) return;
+
+    char path[SD_MAX_PATH];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s", SD_REC_DIR, name);
+    uint32_t size = stat(path, &st) == 0 ? (uint32_t)st.st_size : 0;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (untrack(id, size)) scan();
+    xSemaphoreGive(s_lock);
+}
+
+esp_err_t sync_state_ack(uint32_t rec_id, uint32_t crc32c) {
+    char name[REC_ID_NAME_LEN];
+    char path[SD_MAX_PATH];
+    if (!s_crc_buf || !rec_id_format(rec_id, name, sizeof(name))) return ESP_ERR_NOT_FOUND;
+    snprintf(path, sizeof(path), "%s/%s", SD_REC_DIR, name);
+
+    FILE *f = fopen(path, "rb");
+    if (!f) return ESP_ERR_NOT_FOUND;
+    uint32_t crc = 0xFFFFFFFF;
+    uint32_t size = 0;
+    size_t n;
+    while ((n = fread(s_crc_buf, 1, SYNC_CRC_CHUNK, f)) > 0) {
+        crc = crc32c_update(crc, s_crc_buf, n);
+        size += (uint32_t)n;
+    }
+    bool read_err = ferror(f);
+    fclose(f);
+    if (read_err || size == 0) return read_err ? ESP_FAIL : ESP_ERR_NOT_FOUND;
+
+    if (crc != crc32c) {
+        ESP_LOGW(TAG, "%s: dock CRC 0x%08lx, card 0x%08lx - not synced", name,
+                 (unsigned long)crc32c, (unsigned long)crc);
+        return ESP_ERR_INVALID_CRC;
+    }
+    if (sync_catalog_append(SYNC_CATALOG_PATH, name, size) != 0) {
+        ESP_LOGW(TAG, "%s: catalog write failed", name);
+        return ESP_FAIL;
+    }
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (untrack(rec_id, size)) scan();
+    xSemaphoreGive(s_lock);
+    ESP_LOGI(TAG, "%s synced (%lu B), %lu left", name, (unsigned long)size, (unsigned long)s_count);
+    return ESP_OK;
+}
+
+void sync_state_get(adv_state_t *s) {
+    s->flags = 0;
+    s->pending_count = 0;
+    s->pending_kb = 0;
+    s->first_pending_id = REC_ID_NONE;
+    s->latest_id = REC_ID_NONE;
+    if (!sd_storage_is_available()) {
+        s->flags = ADV_STATE_F_NO_CARD;
+        return;
+    }
+    // Called from the BLE host: never wait behind a rescan
+    if (!s_lock || xSemaphoreTake(s_lock, 0) != pdTRUE) {
+        s->flags = ADV_STATE_F_SYNC_UNKNOWN;
+        return;
+    }
+    if (s_ready) {
+        s->pending_count = s_count > UINT16_MAX ? UINT16_MAX : (uint16_t)s_count;
+        s->pending_kb = (uint32_t)((s_bytes + 1023) / 1024);
+        s->first_pending_id = s_tracked ? s_pending[0].id : REC_ID_NONE;
+        s->latest_id = s_latest;
+    } else {
+        s->flags = ADV_STATE_F_SYNC_UNKNOWN;
+    }
+    xSemaphoreGive(s_lock);
+}
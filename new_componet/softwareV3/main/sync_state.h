@@ -0,0 +1,56 @@
+/**
+ * @file sync_state.h
+ * @brief Which recordings still have to leave the tag, for the advertisement
+ *
+ * A recording is synced once a dock has acknowledged it with a matching
+ * CRC-32C (FILE_TRANSFER_CMD_SYNC_ACK) or the Wi-Fi offload server has
+ * taken it; both append to the same catalog (sync_catalog.h), so neither
+ * path sends a recording the other already delivered.
+ *
+ * The card is scanned once at boot; afterwards finalized recordings and
+ * acknowledgements update the counts, and ble_app_advertise() publishes
+ * them (adv_state.h). Only recordings with an ID (rec_id.h) are counted:
+ * a dock fetches by ID. Older names are left to the Wi-Fi offload.
+ */
+
+#ifndef SYNC_STATE_H
+#define SYNC_STATE_H
+
+#include "esp_err.h"
+#include "adv_state.h"
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SYNC_STATE_MAX_TRACKED 256  // Lowest un-synced IDs kept; more are counted and rescanned for
+
+/**
+ * @brief Scan the card against the catalog (call once the card is mounted)
+ */
+esp_err_t sync_state_init(void);
+
+// A recording was closed cleanly
+void sync_state_added(uint32_t rec_id, uint32_t size);
+
+// The Wi-Fi offload recorded name as synced
+void sync_state_synced(const char *name);
+
+/**
+ * @brief Verify a dock's CRC-32C of recording rec_id and record it as synced
+ *
+ * Reads the whole file; call from the transfer worker, not a BLE callback.
+ * @return ESP_OK once recorded, ESP_ERR_NOT_FOUND if there is no such file,
+ *         ESP_ERR_INVALID_CRC if the file differs, ESP_FAIL if the catalog write failed
+ */
+esp_err_t sync_state_ack(uint32_t rec_id, uint32_t crc32c);
+
+// Fill the sync fields of the advertisement (battery is left as is)
+void sync_state_get(adv_state_t *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SYNC_STATE_H
@@ -0,0 +1,255 @@
+/**
+ * @file telem_adv.c
+ * @brief Live telemetry advertising set (see telem_adv.h)
+ */
+
+#include "telem_adv.h"
+#include "sdkconfig.h"
+
+#if CONFIG_SALESTAG_TELEMETRY
+#include "live_telem.h"
+#include "audio_capture.h"
+#include "battery_monitor.h"
+#include "raw_audio_storage.h"
+#include "rec_ctrl.h"
+#include "sd_storage.h"
+#include "sync_state.h"
+#include "mem_plan.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "host/ble_hs.h"
+#include "os/os_mbuf.h"
+#include <string.h>
+
+#define TELEM_INTERVAL_MS   CONFIG_SALESTAG_TELEMETRY_INTERVAL_MS
+#define TELEM_HEARTBEAT_MS  5000
+#define TELEM_BATT_LOW_PCT  15
+#define TELEM_LEAD_FACTOR   4       // Periodic mode: the extended set only leads scanners to the train
+#define RAW_BYTES_PER_MIN   ((uint64_t)RAW_AUDIO_SAMPLE_RATE * sizeof(raw_audio_sample_t) * 60)
+
+#if CONFIG_SALESTAG_TELEMETRY_PERIODIC
+#define TELEM_PERIODIC 1
+#else
+#define TELEM_PERIODIC 0
+#endif
+
+static const char *TAG = "telem_adv";
+
+static TaskHandle_t s_task = NULL;
+static SemaphoreHandle_t s_lock = NULL;     // The advertising set: start, stop and data
+static portMUX_TYPE s_meter_lock = portMUX_INITIALIZER_UNLOCKED;
+static live_telem_meter_t s_meter;          // Fed by the capture task
+static live_telem_rate_t s_rate;            // Telemetry task, under s_lock
+static bool s_started = false;
+static uint32_t s_overflows;
+
+// Capture task, every block: the sums outside the lock
+static void meter_feed(const int16_t *frames, size_t n, void *ctx) {
+    (void)ctx;
+    uint32_t peak;
+    uint32_t mean_sq = live_telem_block_power(frames, n, &peak);
+    taskENTER_CRITICAL(&s_meter_lock);
+    live_telem_meter_add(&s_meter, mean_sq, peak, n);
+    taskEXIT_CRITICAL(&s_meter_lock);
+}
+
+static uint16_t clamp16(uint64_t v) {
+    return v > UINT16_MAX ? UINT16_MAX : (uint16_t)v;
+}
+
+static void gather(live_telem_t *t) {
+    memset(t, 0, sizeof(*t));
+    live_telem_meter_t window;
+    taskENTER_CRITICAL(&s_meter_lock);
+    window = s_meter;
+    live_telem_meter_restart(&s_meter);
+    taskEXIT_CRITICAL(&s_meter_lock);
+    live_telem_meter_take(&window, t);
+
+    t->state = (uint8_t)rec_ctrl_state();
+    if (rec_ctrl_is_recording()) {
+        uint32_t samples = 0;
+        raw_audio_storage_get_stats(&samples, NULL);
+        t->rec_s = clamp16(samples / RAW_AUDIO_SAMPLE_RATE);
+    }
+    rec_ctrl_stats_t stats;
+    rec_ctrl_get_stats(&stats);
+    if (stats.overflows != s_overflows) t->flags |= LIVE_TELEM_F_DROPPING;
+    s_overflows = stats.overflows;
+
+    t->battery_pct = LIVE_TELEM_BATTERY_UNKNOWN;
+#if CONFIG_SALESTAG_BATTERY_MONITOR
+    battery_status_t batt;
+    battery_monitor_get(&batt);
+    if (batt.valid) {
+        t->battery_pct = batt.pct;
+        if (batt.pct < TELEM_BATT_LOW_PCT) t->flags |= LIVE_TELEM_F_BATT_LOW;
+    }
+#endif
+
+    if (!sd_storage_is_available()) {
+        t->flags |= LIVE_TELEM_F_NO_CARD;
+    } else {
+        // Free space as the health tick last sampled it: no card access here
+        sd_info_t info;
+        sd_storage_get_info(&info);
+        t->free_min = clamp16(info.free_bytes / RAW_BYTES_PER_MIN);
+        if (sd_storage_health_grade() != SD_HEALTH_OK) t->flags |= LIVE_TELEM_F_CARD_WEAK;
+    }
+    adv_state_t adv;
+    sync_state_get(&adv);
+    t->pending = adv.pending_count;
+}
+
+// One manufacturer-data AD structure; NimBLE takes the mbuf in every case
+static int set_data(bool periodic, const uint8_t *mfg, size_t len) {
+    uint8_t ad[2 + LIVE_TELEM_LEN];
+    ad[0] = (uint8_t)(len + 1);
+    ad[1] = BLE_HS_ADV_TYPE_MFG_DATA;
+    memcpy(ad + 2, mfg, len);
+    struct os_mbuf *buf = os_msys_get_pkthdr(sizeof(ad), 0);
+    if (!buf) return BLE_HS_ENOMEM;
+    if (os_mbuf_append(buf, ad, len + 2) != 0) {
+        os_mbuf_free_chain(buf);
+        return BLE_HS_ENOMEM;
+    }
+#if CONFIG_SALESTAG_TELEMETRY_PERIODIC
+    if (periodic) {
+#if MYNEWT_VAL(BLE_PERIODIC_ADV_ENH)
+        struct ble_gap_periodic_adv_set_data_params params = { 0 };
+        return ble_gap_periodic_adv_set_data(TELEM_ADV_INSTANCE, buf, &params);
+#else
+        return ble_gap_periodic_adv_set_data(TELEM_ADV_INSTANCE, buf);
+#endif
+    }
+#endif
+    (void)periodic;
+    return ble_gap_ext_adv_set_data(TELEM_ADV_INSTANCE, buf);
+}
+
+static int publish(const live_telem_t *t) {
+    uint8_t mfg[LIVE_TELEM_LEN];
+    size_t len = live_telem_encode(t, mfg, sizeof(mfg));
+    return set_data(TELEM_PERIODIC, mfg, len);
+}
+
+// Under s_lock
+static int set_start(void) {
+    // Neither connectable nor scannable: each event is one ADV_EXT_IND per
+    // primary channel pointing at one AUX_ADV_IND with the record
+    struct ble_gap_ext_adv_params p;
+    memset(&p, 0, sizeof(p));
+    p.own_addr_type = BLE_OWN_ADDR_PUBLIC;
+    p.primary_phy = BLE_HCI_LE_PHY_1M;
+    p.secondary_phy = BLE_HCI_LE_PHY_1M;    // Phones that scan extended advertising all take 1M
+    p.channel_map = 0x07;
+    p.sid = TELEM_ADV_INSTANCE;
+    p.tx_power = 127;                       // No preference
+    uint32_t lead_ms = TELEM_PERIODIC ? TELEM_INTERVAL_MS * TELEM_LEAD_FACTOR : TELEM_INTERVAL_MS;
+    p.itvl_min = p.itvl_max = lead_ms * 8 / 5;      // 0.625 ms units
+    int rc = ble_gap_ext_adv_configure(TELEM_ADV_INSTANCE, &p, NULL, NULL, NULL);
+    if (rc != 0) return rc;
+
+    live_telem_t t;
+    gather(&t);
+    live_telem_rate_sent(&s_rate, &t, (uint32_t)(esp_timer_get_time() / 1000));
+#if CONFIG_SALESTAG_TELEMETRY_PERIODIC
+    struct ble_gap_periodic_adv_params pp;
+    memset(&pp, 0, sizeof(pp));
+    pp.itvl_min = pp.itvl_max = TELEM_INTERVAL_MS * 4 / 5;     // 1.25 ms units
+    rc = ble_gap_periodic_adv_configure(TELEM_ADV_INSTANCE, &pp);
+    if (rc == 0) rc = publish(&t);
+    if (rc == 0) {
+#if MYNEWT_VAL(BLE_PERIODIC_ADV_ENH)
+        struct ble_gap_periodic_adv_start_params sp = { 0 };
+        rc = ble_gap_periodic_adv_start(TELEM_ADV_INSTANCE, &sp);
+#else
+        rc = ble_gap_periodic_adv_start(TELEM_ADV_INSTANCE);
+#endif
+    }
+    // The extended set carries the header only, so scanners know which train to sync to
+    uint8_t hdr[LIVE_TELEM_LEN];
+    live_telem_encode(&t, hdr, sizeof(hdr));
+    if (rc == 0) rc = set_data(false, hdr, LIVE_TELEM_HDR_LEN);
+#else
+    rc = publish(&t);
+#endif
+    if (rc == 0) rc = ble_gap_ext_adv_start(TELEM_ADV_INSTANCE, 0, 0);
+    return rc;
+}
+
+void telem_adv_start(void) {
+    if (!s_task) return;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (!s_started) {
+        int rc = set_start();
+        s_started = rc == 0;
+        if (rc != 0) {
+            ESP_LOGE(TAG, "Telemetry advertising not started: %d", rc);
+        } else {
+            ESP_LOGI(TAG, "Telemetry advertising every %d ms%s", TELEM_INTERVAL_MS,
+                     TELEM_PERIODIC ? " (periodic)" : "");
+        }
+    }
+    xSemaphoreGive(s_lock);
+}
+
+void telem_adv_stop(void) {
+    if (!s_task) return;
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (s_started) {
+#if CONFIG_SALESTAG_TELEMETRY_PERIODIC
+        ble_gap_periodic_adv_stop(TELEM_ADV_INSTANCE);
+#endif
+        ble_gap_ext_adv_stop(TELEM_ADV_INSTANCE);
+        s_started = false;
+    }
+    xSemaphoreGive(s_lock);
+}
+
+void telem_adv_kick(void) {
+    if (s_task) xTaskNotifyGive(s_task);
+}
+
+static void telem_task(void *arg) {
+    (void)arg;
+    const TickType_t period = pdMS_TO_TICKS(TELEM_INTERVAL_MS);
+    TickType_t next = xTaskGetTickCount() + period;
+    for (;;) {
+        // Once per interval, or sooner when kicked
+        TickType_t now = xTaskGetTickCount();
+        ulTaskNotifyTake(pdTRUE, (TickType_t)(next - now) <= period ? next - now : 0);
+        if ((int32_t)(xTaskGetTickCount() - next) >= 0) next += period;
+
+        live_telem_t t;
+        gather(&t);
+        uint32_t now_ms = (uint32_t)(esp_timer_get_time() / 1000);
+        xSemaphoreTake(s_lock, portMAX_DELAY);
+        if (s_started && live_telem_rate_due(&s_rate, &t, now_ms)) {
+            live_telem_rate_sent(&s_rate, &t, now_ms);
+            int rc = publish(&t);
+            if (rc != 0) ESP_LOGW(TAG, "Telemetry update failed: %d", rc);
+        }
+        xSemaphoreGive(s_lock);
+    }
+}
+
+esp_err_t telem_adv_init(void) {
+    if (s_task) return ESP_OK;
+    live_telem_meter_init(&s_meter);
+    live_telem_rate_init(&s_rate, TELEM_INTERVAL_MS, TELEM_HEARTBEAT_MS);
+    s_lock = xSemaphoreCreateMutex();
+    if (!s_lock) return ESP_ERR_NO_MEM;
+    TaskHandle_t task = mem_plan_task("telem", telem_task, "telem_adv", MEM_STACK_TELEM, NULL, 2);
+    if (!task) return ESP_ERR_NO_MEM;
+    audio_capture_set_callback(meter_feed, NULL);
+    s_task = task;
+    // The host may have synced before this: its on_sync call found no task yet
+    if (ble_hs_synced()) telem_adv_start();
+    return ESP_OK;
+}
+
+#endif // CONFIG_SALESTAG_TELEMETRY
@@ -0,0 +1,45 @@
+/**
+ * @file telem_adv.h
+ * @brief Live telemetry in a second, non-connectable advertising set
+ *
+ * With CONFIG_SALESTAG_TELEMETRY the tag keeps advertising a live_telem.h
+ * record on extended advertising instance 1, next to the connectable
+ * advertisement on instance 0, and through recordings, when instance 0 is
+ * off. A task assembles the record once per
+ * CONFIG_SALESTAG_TELEMETRY_INTERVAL_MS from the capture level meter, the
+ * recording controller, the battery and the card, and the rate limiter
+ * decides whether the controller gets new data. With
+ * CONFIG_SALESTAG_TELEMETRY_PERIODIC the record goes in a periodic train
+ * instead, and the extended set only leads scanners to it.
+ */
+
+#ifndef TELEM_ADV_H
+#define TELEM_ADV_H
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TELEM_ADV_INSTANCE 1
+
+/**
+ * @brief Create the task and hook the level meter into the capture (after audio_capture_init)
+ */
+esp_err_t telem_adv_init(void);
+
+// BLE host synced: configure the advertising set and start it
+void telem_adv_start(void);
+
+// Before sleep: the set stops until the next telem_adv_start()
+void telem_adv_stop(void);
+
+// Something a scanner should see soon changed (a recording started or stopped)
+void telem_adv_kick(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TELEM_ADV_H
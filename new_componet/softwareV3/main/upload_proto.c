@@ -0,0 +1,65 @@
+/**
+ * @file upload_proto.c
+ * @brief Resumable HTTP upload protocol helpers (see upload_proto.h)
+ */
+
+#include "upload_proto.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+upl_rsp_class_t upl_classify(int http_status) {
+    if (http_status == 200 || http_status == 201) return UPL_RSP_COMPLETE;
+    if (http_status == UPL_STATUS_RESUME_INCOMPLETE) return UPL_RSP_PARTIAL;
+    if (http_status == 0 || http_status == 408 || http_status == 429 || http_status >= 500) {
+        return UPL_RSP_TRANSIENT;
+    }
+    return UPL_RSP_REJECTED;
+}
+
+int upl_content_range(char *out, size_t out_sz, uint32_t first, uint32_t last, uint32_t total) {
+    return snprintf(out, out_sz, "bytes %lu-%lu/%lu", (unsigned long)first, (unsigned long)last,
+                    (unsigned long)total);
+}
+
+int upl_query_range(char *out, size_t out_sz, uint32_t total) {
+    return snprintf(out, out_sz, "bytes */%lu", (unsigned long)total);
+}
+
+bool upl_parse_range(const char *range, uint32_t *committed) {
+    *committed = 0;
+    if (!range || range[0] == '\0') return true;
+
+    while (*range == ' ') range++;
+    if (strncasecmp(range, "bytes=", 6) != 0) return false;
+    range += 6;
+
+    char *end = NULL;
+    unsigned long first = strtoul(range, &end, 10);
+    if (end == range || *end != '-' || first != 0) return false;
+    range = end + 1;
+    unsigned long last = strtoul(range, &end, 10);
+    if (end == range || (*end != '\0' && *end != ' ' && *end != '\r')) return false;
+    if (last >= 0xFFFFFFFFUL) return false;
+
+    *committed = (uint32_t)last + 1;
+    return true;
+}
+
+bool upl_build_url(char *out, size_t out_sz, const char *base, const char *device, const char *filename) {
+    size_t base_len = strlen(base);
+    // Tolerate a configured base with a trailing slash
+    while (base_len > 0 && base[base_len - 1] == '/') base_len--;
+    int n = snprintf(out, out_sz, "%.*s/%s/%s", (int)base_len, base, device, filename);
+    return n > 0 && (size_t)n < out_sz;
+}
+
+uint32_t upl_backoff_ms(uint8_t attempt, uint32_t base_ms, uint32_t max_ms) {
+    if (attempt < 1) attempt = 1;
+    uint32_t delay = base_ms;
+    for (uint8_t i = 1; i < attempt && delay < max_ms; i++) {
+        delay *= 2;
+    }
+    return delay > max_ms ? max_ms : delay;
+}
@@ -0,0 +1,75 @@
+/**
+ * @file upload_proto.h
+ * @brief Resumable HTTP upload protocol used by the Wi-Fi offload
+ *
+ * Each recording is PUT to <base>/<device>/<filename> in chunks:
+ *
+ *   PUT ...  Content-Range: bytes <first>-<last>/<total>      chunk body
+ *   PUT ...  Content-Range: "bytes *" "/<total>" (joined)     status query, no body
+ *
+ * The server answers 308 with "Range: bytes=0-<n>" for the bytes it holds
+ * (no Range header = none yet), or 200/201 once the file is complete. The
+ * client always resumes from what the server reports, so a chunk that was
+ * stored but whose reply was lost is not sent twice. Pure C, shared with
+ * the host uploader (host/uploader).
+ */
+
+#ifndef UPLOAD_PROTO_H
+#define UPLOAD_PROTO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define UPL_STATUS_RESUME_INCOMPLETE 308
+
+typedef enum {
+    UPL_RSP_COMPLETE = 0,   // 200/201: server has the whole file
+    UPL_RSP_PARTIAL,        // 308: continue from the reported offset
+    UPL_RSP_TRANSIENT,      // 408/429/5xx or no response: back off and query
+    UPL_RSP_REJECTED,       // Other 4xx: give up on this file
+} upl_rsp_class_t;
+
+/**
+ * @brief Classify an HTTP status (0 = transport error)
+ */
+upl_rsp_class_t upl_classify(int http_status);
+
+/**
+ * @brief Format a Content-Range value for bytes [first, last] of total
+ */
+int upl_content_range(char *out, size_t out_sz, uint32_t first, uint32_t last, uint32_t total);
+
+/**
+ * @brief Format the Content-Range value of a status query
+ */
+int upl_query_range(char *out, size_t out_sz, uint32_t total);
+
+/**
+ * @brief Bytes held by the server according to a 308 Range header
+ * @param range Header value ("bytes=0-<n>"), or NULL/empty if absent
+ * @param committed Set to n + 1, or 0 when absent
+ * @return false if the header is malformed or does not start at 0
+ */
+bool upl_parse_range(const char *range, uint32_t *committed);
+
+/**
+ * @brief Build <base>/<device>/<filename>
+ * @return true if the URL fit in out
+ */
+bool upl_build_url(char *out, size_t out_sz, const char *base, const char *device, const char *filename);
+
+/**
+ * @brief Backoff before retry number attempt (1-based): base * 2^(attempt-1), capped
+ */
+uint32_t upl_backoff_ms(uint8_t attempt, uint32_t base_ms, uint32_t max_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // UPLOAD_PROTO_H
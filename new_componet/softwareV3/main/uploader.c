@@ -0,0 +1,158 @@
+/**
+ * @file uploader.c
+ * @brief Chunked, resumable upload engine (see uploader.h)
+ */
+
+#include "uploader.h"
+#include "upload_proto.h"
+#include <string.h>
+
+// Status query: no body, server replies with what it holds
+static int send_query(const upl_transport_t *http, void *http_ctx, const char *url, uint32_t total,
+                      char *range, size_t range_sz) {
+    char crange[UPL_RANGE_HDR_MAX];
+    int status = 0;
+    upl_query_range(crange, sizeof(crange), total);
+    if (http->begin(http_ctx, url, crange, 0) != 0 ||
+        http->finish(http_ctx, &status, range, range_sz) != 0) {
+        return 0;
+    }
+    return status;
+}
+
+// Send bytes [first, last]; returns false only if the file could not be read
+static bool send_chunk(const upl_transport_t *http, void *http_ctx, const upl_source_t *src, void *src_ctx,
+                       const char *url, uint32_t first, uint32_t last, uint32_t total,
+                       int *status, char *range, size_t range_sz, upl_stats_t *stats) {
+    char crange[UPL_RANGE_HDR_MAX];
+    *status = 0;
+    upl_content_range(crange, sizeof(crange), first, last, total);
+    if (http->begin(http_ctx, url, crange, last - first + 1) != 0) return true;
+
+    for (uint32_t off = first; off <= last;) {
+        const uint8_t *data = NULL;
+        size_t n = 0;
+        if (src->read(src_ctx, off, last - off + 1, &data, &n) != 0 || n == 0) {
+            // The request is half sent; the connection can't be reused
+            http->reset(http_ctx);
+            return false;
+        }
+        if (http->write(http_ctx, data, n) != 0) return true;
+        off += (uint32_t)n;
+        stats->bytes_sent += n;
+    }
+
+    if (http->finish(http_ctx, status, range, range_sz) != 0) *status = 0;
+    return true;
+}
+
+upl_result_t upl_upload_file(const upl_config_t *cfg,
+                             const upl_transport_t *http, void *http_ctx,
+                             const upl_source_t *src, void *src_ctx,
+                             const char *url, const char *path, upl_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+
+    uint32_t size = 0;
+    if (src->open(src_ctx, path, &size) != 0) return UPL_SOURCE_ERROR;
+    if (size == 0) {
+        src->close(src_ctx);
+        return UPL_SOURCE_ERROR;
+    }
+
+    upl_result_t result;
+    uint32_t offset = 0;
+    uint8_t attempts = 0;
+    bool need_query = true;     // Start where an earlier session left off
+    bool resumed = false;
+
+    for (;;) {
+        if (cfg->should_abort && cfg->should_abort()) {
+            result = UPL_ABORTED;
+            break;
+        }
+
+        char range[UPL_RANGE_HDR_MAX] = "";
+        int status;
+        uint32_t last = 0;
+        if (need_query) {
+            stats->queries++;
+            status = send_query(http, http_ctx, url, size, range, sizeof(range));
+        } else {
+            uint32_t len = size - offset < cfg->chunk_size ? size - offset : cfg->chunk_size;
+            last = offset + len - 1;
+            if (!send_chunk(http, http_ctx, src, src_ctx, url, offset, last, size,
+                            &status, range, sizeof(range), stats)) {
+                result = UPL_SOURCE_ERROR;
+                break;
+            }
+        }
+
+        bool progress = false;
+        switch (upl_classify(status)) {
+        case UPL_RSP_COMPLETE:
+            // Trust completion for a query or the final chunk; anything earlier is re-checked
+            if (need_query || last == size - 1) {
+                if (!need_query) stats->chunks++;
+                result = UPL_OK;
+                goto done;
+            }
+            break;
+
+        case UPL_RSP_PARTIAL: {
+            uint32_t committed;
+            if (!upl_parse_range(range, &committed) || committed >= size) break;
+            if (need_query) {
+                if (!resumed) stats->resumed_from = committed;
+                resumed = true;
+                progress = true;
+            } else if (committed > offset) {
+                stats->chunks++;
+                progress = true;
+            }
+            // The server's count wins, even if it went backwards
+            offset = committed;
+            break;
+        }
+
+        case UPL_RSP_REJECTED:
+            result = UPL_REJECTED;
+            goto done;
+
+        case UPL_RSP_TRANSIENT:
+            break;
+        }
+
+        if (progress) {
+            // Only accepted data clears the failure count; a server that answers
+            // queries but fails every chunk must still run out of attempts
+            if (!need_query) attempts = 0;
+            need_query = false;
+            continue;
+        }
+
+        // No progress: back off, then ask the server what it has
+        http->reset(http_ctx);
+        stats->retries++;
+        if (++attempts >= cfg->max_attempts) {
+            result = UPL_RETRY_LATER;
+            break;
+        }
+        if (cfg->sleep_ms) cfg->sleep_ms(upl_backoff_ms(attempts, cfg->backoff_base_ms, cfg->backoff_max_ms));
+        need_query = true;
+    }
+
+done:
+    src->close(src_ctx);
+    return result;
+}
+
+const char *upl_result_name(upl_result_t r) {
+    switch (r) {
+    case UPL_OK:           return "OK";
+    case UPL_RETRY_LATER:  return "RETRY_LATER";
+    case UPL_REJECTED:     return "REJECTED";
+    case UPL_ABORTED:      return "ABORTED";
+    case UPL_SOURCE_ERROR: return "SOURCE_ERROR";
+    default:               return "?";
+    }
+}
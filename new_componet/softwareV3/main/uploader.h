@@ -0,0 +1,82 @@
+/**
+ * @file uploader.h
+ * @brief Chunked, resumable file upload engine (upload_proto.h protocol)
+ *
+ * The engine owns the retry and resume logic only. HTTP and file access are
+ * supplied as operation tables: the firmware plugs in esp_http_client and a
+ * double-buffered SD reader (wifi_offload.c), the host tool plugs in POSIX
+ * sockets and stdio (host/uploader). Pure C.
+ */
+
+#ifndef UPLOADER_H
+#define UPLOADER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define UPL_RANGE_HDR_MAX 48
+
+// One HTTP PUT per call sequence begin -> write* -> finish
+typedef struct {
+    // Send request line and headers; content_range is the Content-Range value
+    int (*begin)(void *ctx, const char *url, const char *content_range, uint32_t content_len);
+    // Send body bytes; returns 0 when all of len was written
+    int (*write)(void *ctx, const uint8_t *data, size_t len);
+    // Read the response; range receives the Range header ("" when absent)
+    int (*finish)(void *ctx, int *http_status, char *range, size_t range_sz);
+    // Drop the connection after an error so the next request starts clean
+    void (*reset)(void *ctx);
+} upl_transport_t;
+
+typedef struct {
+    int (*open)(void *ctx, const char *path, uint32_t *size);
+    // Borrow up to max bytes at offset; the data stays valid until the next call
+    int (*read)(void *ctx, uint32_t offset, size_t max, const uint8_t **data, size_t *len);
+    void (*close)(void *ctx);
+} upl_source_t;
+
+typedef struct {
+    uint32_t chunk_size;        // Bytes per PUT
+    uint8_t max_attempts;       // Consecutive transient failures before giving up for now
+    uint32_t backoff_base_ms;
+    uint32_t backoff_max_ms;
+    void (*sleep_ms)(uint32_t ms);
+    bool (*should_abort)(void); // Polled between chunks; may be NULL
+} upl_config_t;
+
+typedef struct {
+    uint64_t bytes_sent;        // Body bytes written, including resent ones
+    uint32_t chunks;            // Chunks the server accepted
+    uint32_t retries;           // Transient failures
+    uint32_t queries;           // Status queries
+    uint32_t resumed_from;      // Offset the file started at (server already had it)
+} upl_stats_t;
+
+typedef enum {
+    UPL_OK = 0,                 // Server acknowledged the complete file
+    UPL_RETRY_LATER,            // Transient failures exhausted max_attempts
+    UPL_REJECTED,               // Server refused the file (4xx)
+    UPL_ABORTED,                // should_abort() returned true; resumable
+    UPL_SOURCE_ERROR,           // File could not be read
+} upl_result_t;
+
+/**
+ * @brief Upload one file, resuming from whatever the server already holds
+ */
+upl_result_t upl_upload_file(const upl_config_t *cfg,
+                             const upl_transport_t *http, void *http_ctx,
+                             const upl_source_t *src, void *src_ctx,
+                             const char *url, const char *path, upl_stats_t *stats);
+
+const char *upl_result_name(upl_result_t r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // UPLOADER_H
@@ -1,169 +1,211 @@
+/**
+ * @file wav_writer.c
+ * @brief RF64/BWF WAV writer (see wav_writer.h)
+ */
+
 #include "wav_writer.h"
-#include "esp_log.h"
-#include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Header offsets
+#define OFF_RIFF_ID      0
+#define OFF_RIFF_SIZE    4
+#define OFF_DS64_ID      12
+#define OFF_DS64         20     // riffSize u64, dataSize u64, sampleCount u64, tableLength u32
+#define DS64_BYTES       28
+#define OFF_FMT          48
+#define OFF_BEXT         72
+#define OFF_DATA_SIZE    (WAV_DATA_OFFSET - 4)
+
+// bext fields (EBU Tech 3285), from the start of the chunk's payload
+#define BEXT_DESCRIPTION 0
+#define BEXT_ORIGINATOR  256
+#define BEXT_REFERENCE   288
+#define BEXT_DATE        320
+#define BEXT_TIME        330
+#define BEXT_TIME_REF    338
+#define BEXT_VERSION     346
 
-static const char* TAG = "wav_writer";
-
-// Global state
-static FILE* s_current_file = NULL;
-static bool s_is_writing = false;
-static uint32_t s_samples_written = 0;
-static uint32_t s_data_bytes = 0;
-static wav_header_t s_wav_header;
-
-esp_err_t wav_writer_init(void) {
-    ESP_LOGI(TAG, "Initializing WAV writer");
-    
-    // Reset state
-    s_current_file = NULL;
-    s_is_writing = false;
-    s_samples_written = 0;
-    s_data_bytes = 0;
-    
-    ESP_LOGI(TAG, "WAV writer initialized");
-    ESP_LOGI(TAG, "  Format: Mono, 16kHz, 16-bit PCM");
-    ESP_LOGI(TAG, "  Data rate: %d bytes/second", WAV_BYTE_RATE);
-    
-    return ESP_OK;
+_Static_assert(WAV_DATA_OFFSET % BLK_WRITER_ALIGN == 0, "samples must start on a block boundary");
+_Static_assert(OFF_BEXT + 8 + WAV_BEXT_BYTES + WAV_HISTORY_MAX + 8 <= OFF_DATA_SIZE - 4,
+               "header chunks must fit ahead of data");
+
+static void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
 }
 
-esp_err_t wav_writer_start_file(const char* filename) {
-    if (s_is_writing) {
-        ESP_LOGW(TAG, "Already writing, stopping current file first");
-        wav_writer_stop_file();
-    }
-    
-    ESP_LOGI(TAG, "Starting WAV file: %s", filename);
-    
-    // Open file for writing
-    s_current_file = fopen(filename, "wb");
-    if (!s_current_file) {
-        ESP_LOGE(TAG, "Failed to open WAV file: %s (errno: %d)", filename, errno);
-        return ESP_FAIL;
-    }
-    
-    // Initialize WAV header
-    memset(&s_wav_header, 0, sizeof(wav_header_t));
-    
-    // RIFF header
-    memcpy(s_wav_header.riff_header, "RIFF", 4);
-    s_wav_header.wav_size = 0; // Will be updated when stopping
-    memcpy(s_wav_header.wave_header, "WAVE", 4);
-    
-    // Format chunk
-    memcpy(s_wav_header.fmt_header, "fmt ", 4);
-    s_wav_header.fmt_chunk_size = 16;
-    s_wav_header.audio_format = 1; // PCM
-    s_wav_header.num_channels = WAV_CHANNELS; // 1 for mono
-    s_wav_header.sample_rate = WAV_SAMPLE_RATE; // 16000 Hz
-    s_wav_header.byte_rate = WAV_BYTE_RATE;
-    s_wav_header.sample_alignment = WAV_BYTES_PER_FRAME;
-    s_wav_header.bit_depth = WAV_BIT_DEPTH; // 16 bits
-    
-    // Data chunk
-    memcpy(s_wav_header.data_header, "data", 4);
-    s_wav_header.data_bytes = 0; // Will be updated when stopping
-    
-    // Write initial header (will be updated when stopping)
-    size_t header_written = fwrite(&s_wav_header, 1, sizeof(wav_header_t), s_current_file);
-    if (header_written != sizeof(wav_header_t)) {
-        ESP_LOGE(TAG, "Failed to write WAV header");
-        fclose(s_current_file);
-        s_current_file = NULL;
-        return ESP_FAIL;
-    }
-    
-    // Initialize state
-    s_is_writing = true;
-    s_samples_written = 0;
-    s_data_bytes = 0;
-    
-    ESP_LOGI(TAG, "WAV file started successfully");
-    return ESP_OK;
+static void put_u32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = (uint8_t)(v >> (8 * i));
 }
 
-esp_err_t wav_writer_write_audio_data(const int16_t* audio_data, size_t num_samples) {
-    if (!s_is_writing || !s_current_file) {
-        ESP_LOGE(TAG, "Not currently writing WAV file");
-        return ESP_ERR_INVALID_STATE;
-    }
-    
-    // Calculate bytes to write
-    size_t bytes_to_write = num_samples * WAV_BYTES_PER_FRAME;
-    
-    // Write audio data
-    size_t bytes_written = fwrite(audio_data, 1, bytes_to_write, s_current_file);
-    if (bytes_written != bytes_to_write) {
-        ESP_LOGE(TAG, "Failed to write audio data: %zu/%zu bytes", bytes_written, bytes_to_write);
-        return ESP_FAIL;
-    }
-    
-    // Update statistics
-    s_samples_written += num_samples;
-    s_data_bytes += bytes_written;
-    
-    // Log progress every 1000 samples
-    if (s_samples_written % 1000 == 0) {
-        ESP_LOGI(TAG, "WAV progress: %lu samples, %lu bytes", s_samples_written, s_data_bytes);
+static void put_u64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+static void put_id(uint8_t *p, const char *id) {
+    memcpy(p, id, 4);
+}
+
+// Text field: up to n chars, zero-padded, not necessarily terminated
+static void put_text(uint8_t *p, size_t n, const char *s) {
+    if (!s) return;
+    size_t len = strnlen(s, n);
+    memcpy(p, s, len);
+}
+
+static size_t build_bext(uint8_t *b, const wav_config_t *cfg) {
+    put_text(b + BEXT_DESCRIPTION, 256, cfg->description);
+    put_text(b + BEXT_ORIGINATOR, 32, cfg->originator);
+    put_text(b + BEXT_REFERENCE, 32, cfg->reference);
+    if (cfg->start_utc_ms >= WAV_UTC_VALID_MS) {
+        time_t t = (time_t)(cfg->start_utc_ms / 1000);
+        struct tm tm;
+        gmtime_r(&t, &tm);
+        char txt[40];
+        snprintf(txt, sizeof(txt), "%04d-%02d-%02d%02d:%02d:%02d", (tm.tm_year + 1900) % 10000,
+                 tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+        memcpy(b + BEXT_DATE, txt, 18);         // Date and Time are adjacent
+        // Samples since midnight UTC at the first sample
+        uint64_t ms = (uint64_t)(cfg->start_utc_ms % 86400000LL);
+        put_u64(b + BEXT_TIME_REF, ms * cfg->sample_rate / 1000);
     }
-    
-    return ESP_OK;
+    put_u16(b + BEXT_VERSION, 1);
+
+    // Coding history: one line, CR LF terminated; even length keeps the chunk word aligned
+    char *hist = (char *)b + WAV_BEXT_BYTES;
+    int n = snprintf(hist, WAV_HISTORY_MAX, "A=PCM,F=%lu,W=%d,M=%s,T=SalesTag\r\n",
+                     (unsigned long)cfg->sample_rate, WAV_BIT_DEPTH, cfg->channels == 1 ? "mono" : "multi");
+    if (n < 0 || n >= WAV_HISTORY_MAX) n = 0;
+    if (n % 2) hist[n++] = '\0';
+    return WAV_BEXT_BYTES + (size_t)n;
+}
+
+static void build_header(wav_writer_t *w, const wav_config_t *cfg) {
+    uint8_t *h = w->header;
+    memset(h, 0, sizeof(w->header));
+    put_id(h + OFF_RIFF_ID, "RIFF");
+    put_id(h + 8, "WAVE");
+    put_id(h + OFF_DS64_ID, "JUNK");
+    put_u32(h + OFF_DS64_ID + 4, DS64_BYTES);
+
+    put_id(h + OFF_FMT, "fmt ");
+    put_u32(h + OFF_FMT + 4, 16);
+    put_u16(h + OFF_FMT + 8, 1);                // PCM
+    put_u16(h + OFF_FMT + 10, cfg->channels);
+    put_u32(h + OFF_FMT + 12, cfg->sample_rate);
+    put_u32(h + OFF_FMT + 16, cfg->sample_rate * w->block_align);
+    put_u16(h + OFF_FMT + 20, w->block_align);
+    put_u16(h + OFF_FMT + 22, WAV_BIT_DEPTH);
+
+    size_t bext = build_bext(h + OFF_BEXT + 8, cfg);
+    put_id(h + OFF_BEXT, "bext");
+    put_u32(h + OFF_BEXT + 4, (uint32_t)bext);
+
+    // Padding up to the data chunk's header
+    size_t pad = OFF_BEXT + 8 + bext;
+    put_id(h + pad, "JUNK");
+    put_u32(h + pad + 4, (uint32_t)(OFF_DATA_SIZE - 4 - pad - 8));
+    put_id(h + OFF_DATA_SIZE - 4, "data");
 }
 
-esp_err_t wav_writer_stop_file(void) {
-    if (!s_is_writing || !s_current_file) {
-        ESP_LOGW(TAG, "Not currently writing WAV file");
-        return ESP_OK;
+// Sizes for data_bytes of audio; switches to RF64 once RIFF cannot say it
+static void update_sizes(wav_writer_t *w, uint64_t data_bytes) {
+    uint8_t *h = w->header;
+    uint64_t riff = WAV_DATA_OFFSET - 8 + data_bytes;
+    if (!w->rf64 && riff > w->riff_limit) {
+        w->rf64 = true;
+        put_id(h + OFF_RIFF_ID, "RF64");
+        put_id(h + OFF_DS64_ID, "ds64");
     }
-    
-    ESP_LOGI(TAG, "Stopping WAV file");
-    
-    // Update WAV header with final statistics
-    s_wav_header.wav_size = s_data_bytes + sizeof(wav_header_t) - 8;
-    s_wav_header.data_bytes = s_data_bytes;
-    
-    // Seek back to beginning and rewrite header
-    if (fseek(s_current_file, 0, SEEK_SET) == 0) {
-        size_t header_written = fwrite(&s_wav_header, 1, sizeof(wav_header_t), s_current_file);
-        if (header_written != sizeof(wav_header_t)) {
-            ESP_LOGW(TAG, "Failed to update WAV header");
-        }
+    if (w->rf64) {
+        put_u32(h + OFF_RIFF_SIZE, 0xFFFFFFFFu);
+        put_u32(h + OFF_DATA_SIZE, 0xFFFFFFFFu);
+        put_u64(h + OFF_DS64, riff);
+        put_u64(h + OFF_DS64 + 8, data_bytes);
+        put_u64(h + OFF_DS64 + 16, data_bytes / w->block_align);
+        put_u32(h + OFF_DS64 + 24, 0);
     } else {
-        ESP_LOGW(TAG, "Failed to seek to file beginning for header update");
+        put_u32(h + OFF_RIFF_SIZE, (uint32_t)riff);
+        put_u32(h + OFF_DATA_SIZE, (uint32_t)data_bytes);
+    }
+}
+
+static int write_header(wav_writer_t *w) {
+    ssize_t n = pwrite(w->fd, w->header, sizeof(w->header), 0);
+    if (n != (ssize_t)sizeof(w->header)) {
+        if (n >= 0) errno = ENOSPC;
+        return -1;
     }
-    
-    // Close file
-    fclose(s_current_file);
-    s_current_file = NULL;
-    s_is_writing = false;
-    
-    ESP_LOGI(TAG, "WAV file completed: %lu samples, %lu bytes total", 
-             s_samples_written, s_data_bytes);
-    
-    return ESP_OK;
+    return fsync(w->fd);
 }
 
-esp_err_t wav_writer_get_stats(uint32_t* samples_written, uint32_t* file_size_bytes) {
-    if (samples_written) {
-        *samples_written = s_samples_written;
+int wav_writer_open(wav_writer_t *w, const char *path, const wav_config_t *cfg, uint8_t *buf, size_t buf_bytes) {
+    memset(w, 0, sizeof(*w));
+    if (cfg->sample_rate == 0 || cfg->channels == 0 || cfg->channels > 8) {
+        errno = EINVAL;
+        return -1;
+    }
+    w->block_align = (uint16_t)(cfg->channels * WAV_BYTES_PER_SAMPLE);
+    w->riff_limit = cfg->riff_limit ? cfg->riff_limit : UINT32_MAX;
+    w->patch_bytes = cfg->patch_bytes;
+    build_header(w, cfg);
+    update_sizes(w, 0);
+
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w->fd < 0) return -1;
+    if (blk_writer_init(&w->io, w->fd, WAV_DATA_OFFSET, buf, buf_bytes) != 0) {
+        close(w->fd);
+        errno = EINVAL;
+        return -1;
     }
-    if (file_size_bytes) {
-        *file_size_bytes = s_data_bytes + sizeof(wav_header_t);
+    if (write_header(w) != 0) {
+        int e = errno;
+        close(w->fd);
+        errno = e;
+        return -1;
     }
-    return ESP_OK;
+    w->open = true;
+    return 0;
 }
 
-bool wav_writer_is_writing(void) {
-    return s_is_writing;
+int wav_writer_sync(wav_writer_t *w) {
+    if (!w->open) return -1;
+    // Audio first: the sizes never claim more than the card has
+    if (blk_writer_flush(&w->io) != 0) return -1;
+    if (w->data_bytes == w->patched_bytes) return 0;
+    update_sizes(w, w->data_bytes);
+    if (write_header(w) != 0) return -1;
+    w->patched_bytes = w->data_bytes;
+    w->patches++;
+    return 0;
 }
 
-esp_err_t wav_writer_deinit(void) {
-    ESP_LOGI(TAG, "Deinitializing WAV writer");
-    
-    if (s_is_writing) {
-        wav_writer_stop_file();
-    }
-    
-    return ESP_OK;
+int wav_writer_write(wav_writer_t *w, const int16_t *samples, size_t n) {
+    if (!w->open) return -1;
+    // Samples are little-endian in memory on every target this builds for
+    size_t len = n * sizeof(int16_t);
+    size_t taken = blk_writer_append(&w->io, samples, len);
+    w->data_bytes += taken;
+    if (taken != len) return -1;
+    if (w->patch_bytes && w->data_bytes - w->patched_bytes >= w->patch_bytes) return wav_writer_sync(w);
+    return 0;
+}
+
+int wav_writer_close(wav_writer_t *w) {
+    if (!w->open) return -1;
+    int ret = wav_writer_sync(w);
+    if (close(w->fd) != 0) ret = -1;
+    w->open = false;
+    return ret;
+}
+
+void wav_writer_abandon(wav_writer_t *w) {
+    if (!w->open) return;
+    close(w->fd);
+    w->open = false;
 }
@@ -1,33 +1,44 @@
+/**
+ * @file wav_writer.h
+ * @brief 16-bit PCM WAV files for long recordings: RF64 when needed, BWF, crash tolerant
+ *
+ * Layout, all of it written before the first sample:
+ *
+ *   0     "RIFF" size "WAVE"
+ *   12    "JUNK" 28 bytes      becomes "ds64" if the file outgrows RIFF (RF64)
+ *   48    "fmt " 16 bytes      PCM
+ *   72    "bext"               BWF: device, recording name, UTC start, time reference
+ *   ...   "JUNK"               padding
+ *   1016  "data" size          samples from WAV_DATA_OFFSET on
+ *
+ * The samples start on a sector boundary and go through blk_writer.h, so
+ * every data write is whole aligned blocks; the header is kept in memory and
+ * rewritten as its two sectors. Sizes are patched every patch_bytes of
+ * audio (after the audio itself is synced), so a file cut short by a power
+ * loss or a lost card is a valid WAV up to the last patch. When RIFF's
+ * 32-bit size would overflow, the patch turns the file into RF64 (EBU Tech
+ * 3306): "RF64" and "ds64" take the place of "RIFF" and "JUNK", the 32-bit
+ * sizes become 0xFFFFFFFF and the 64-bit ones go into ds64. No data moves.
+ *
+ * A FAT32 file ends at 4 GB - 1 (37 hours of 16 kHz mono) and the write
+ * fails there; RF64 is for exFAT and for files written on a host.
+ *
+ * Pure C over a POSIX file descriptor; no heap.
+ */
+
 #ifndef WAV_WRITER_H
 #define WAV_WRITER_H
 
-#include "esp_err.h"
+#include "blk_writer.h"
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
-// WAV file header structure for mono audio
-typedef struct {
-    // RIFF header
-    char riff_header[4];        // "RIFF"
-    uint32_t wav_size;          // File size - 8
-    char wave_header[4];        // "WAVE"
-    
-    // Format chunk
-    char fmt_header[4];         // "fmt "
-    uint32_t fmt_chunk_size;    // 16 for PCM
-    uint16_t audio_format;      // 1 for PCM
-    uint16_t num_channels;      // 1 for mono (UPDATED from stereo)
-    uint32_t sample_rate;       // 16000 Hz
-    uint32_t byte_rate;         // sample_rate * channels * (bits/8)
-    uint16_t sample_alignment;  // channels * (bits/8)
-    uint16_t bit_depth;         // 16 bits
-    
-    // Data chunk
-    char data_header[4];        // "data"
-    uint32_t data_bytes;        // Number of bytes in data
-} wav_header_t;
-
-// WAV file configuration
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Recording format
 #define WAV_SAMPLE_RATE 16000   // 16kHz sampling rate
 #define WAV_BIT_DEPTH 16        // 16-bit audio
 #define WAV_CHANNELS 1          // Mono (1 channel)
@@ -35,25 +46,64 @@ typedef struct {
 #define WAV_BYTES_PER_FRAME (WAV_CHANNELS * WAV_BYTES_PER_SAMPLE)
 #define WAV_BYTE_RATE (WAV_SAMPLE_RATE * WAV_BYTES_PER_FRAME)
 
-// Initialize WAV writer
-esp_err_t wav_writer_init(void);
+#define WAV_DATA_OFFSET      1024                   // First sample; a multiple of BLK_WRITER_ALIGN
+#define WAV_BEXT_BYTES       602                    // bext without the coding history
+#define WAV_HISTORY_MAX      128                    // bext CodingHistory
+#define WAV_UTC_VALID_MS     1577836800000LL        // 2020-01-01: earlier means the clock was never set
+
+typedef struct {
+    uint32_t sample_rate;
+    uint16_t channels;
+    const char *originator;     // bext Originator: the device (up to 32 chars)
+    const char *reference;      // bext OriginatorReference: the recording (up to 32 chars)
+    const char *description;    // bext Description (up to 256 chars, may be NULL)
+    int64_t start_utc_ms;       // First sample, Unix ms; before WAV_UTC_VALID_MS date and time stay blank
+    uint32_t patch_bytes;       // Audio between size patches (0 = only at close)
+    uint64_t riff_limit;        // Largest RIFF size before switching to RF64 (0 = UINT32_MAX); lower to test
+} wav_config_t;
+
+typedef struct {
+    int fd;
+    blk_writer_t io;
+    uint8_t header[WAV_DATA_OFFSET];
+    uint16_t block_align;
+    uint64_t riff_limit;
+    uint32_t patch_bytes;
+    uint64_t data_bytes;        // Appended so far
+    uint64_t patched_bytes;     // What the header on the card says
+    uint32_t patches;
+    bool rf64;
+    bool open;                  // Zero-initialised: closed
+} wav_writer_t;
+
+/**
+ * @brief Create path and write the header (sizes zero)
+ * @param buf Data buffer for blk_writer.h: a multiple of BLK_WRITER_ALIGN, DMA capable on the target
+ * @return 0, or -1 (errno set; EINVAL for a bad config)
+ */
+int wav_writer_open(wav_writer_t *w, const char *path, const wav_config_t *cfg, uint8_t *buf, size_t buf_bytes);
 
-// Start writing a new WAV file
-esp_err_t wav_writer_start_file(const char* filename);
+/**
+ * @brief Append interleaved samples; patches the sizes every patch_bytes
+ * @return 0, or -1 if the card refused them (data_bytes counts what was taken)
+ */
+int wav_writer_write(wav_writer_t *w, const int16_t *samples, size_t n);
 
-// Write audio data to the current WAV file
-esp_err_t wav_writer_write_audio_data(const int16_t* audio_data, size_t num_samples);
+// Write everything buffered, then the sizes; 0 once both are synced
+int wav_writer_sync(wav_writer_t *w);
 
-// Stop writing and finalize the WAV file
-esp_err_t wav_writer_stop_file(void);
+// Sync and close; 0 if the file is complete
+int wav_writer_close(wav_writer_t *w);
 
-// Get current file statistics
-esp_err_t wav_writer_get_stats(uint32_t* samples_written, uint32_t* file_size_bytes);
+// Close without writing (the card is gone); the file stays as of the last patch
+void wav_writer_abandon(wav_writer_t *w);
 
-// Check if currently writing a file
-bool wav_writer_is_writing(void);
+static inline bool wav_writer_is_open(const wav_writer_t *w) {
+    return w->open;
+}
 
-// Deinitialize WAV writer
-esp_err_t wav_writer_deinit(void);
+#ifdef __cplusplus
+}
+#endif
 
 #endif // WAV_WRITER_H
@@ -0,0 +1,503 @@
+/**
+ * @file wifi_offload.c
+ * @brief Wi-Fi offload task, esp_http_client transport and double-buffered SD source
+ */
+
+#include "sdkconfig.h"
+
+#if CONFIG_SALESTAG_WIFI_OFFLOAD
+
+#include "wifi_offload.h"
+#include "sd_storage.h"
+#include "sync_catalog.h"
+#include "sync_state.h"
+#include "upload_proto.h"
+#include "uploader.h"
+#include "esp_crt_bundle.h"
+#include "esp_event.h"
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_netif.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+static const char *TAG = "wifi_offload";
+
+#define OFFLOAD_FIRST_CHECK_MS   (60 * 1000)
+#define OFFLOAD_CONNECT_MS       15000
+#define OFFLOAD_CONNECT_RETRIES  3
+#define OFFLOAD_MAX_FILES        32        // Per session; the rest go next time
+#define OFFLOAD_READ_BUF         4096      // Each of the two SD read buffers
+#define OFFLOAD_HTTP_TIMEOUT_MS  15000
+
+#define WIFI_CONNECTED_BIT BIT0
+#define WIFI_FAIL_BIT      BIT1
+
+static wifi_offload_busy_fn_t s_busy_fn = NULL;
+static TaskHandle_t s_task = NULL;
+static volatile bool s_active = false;
+static char s_device_id[24];
+
+// ---------------------------------------------------------------------------
+// Wi-Fi station
+// ---------------------------------------------------------------------------
+
+static EventGroupHandle_t s_wifi_events;
+static esp_netif_t *s_netif;
+static esp_event_handler_instance_t s_wifi_handler;
+static esp_event_handler_instance_t s_ip_handler;
+static int s_connect_retries;
+
+static void wifi_event_handler(void *arg, esp_event_base_t base, int32_t id, void *data) {
+    if (base == WIFI_EVENT && id == WIFI_EVENT_STA_START) {
+        esp_wifi_connect();
+    } else if (base == WIFI_EVENT && id == WIFI_EVENT_STA_DISCONNECTED) {
+        xEventGroupClearBits(s_wifi_events, WIFI_CONNECTED_BIT);
+        if (s_connect_retries++ < OFFLOAD_CONNECT_RETRIES) {
+            esp_wifi_connect();
+        } else {
+            xEventGroupSetBits(s_wifi_events, WIFI_FAIL_BIT);
+        }
+    } else if (base == IP_EVENT && id == IP_EVENT_STA_GOT_IP) {
+        s_connect_retries = 0;
+        xEventGroupSetBits(s_wifi_events, WIFI_CONNECTED_BIT);
+    }
+}
+
+static void wifi_down(void) {
+    esp_wifi_disconnect();
+    esp_wifi_stop();
+    esp_wifi_deinit();
+    if (s_wifi_handler) esp_event_handler_instance_unregister(WIFI_EVENT, ESP_EVENT_ANY_ID, s_wifi_handler);
+    if (s_ip_handler) esp_event_handler_instance_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP, s_ip_handler);
+    s_wifi_handler = NULL;
+    s_ip_handler = NULL;
+    if (s_netif) esp_netif_destroy_default_wifi(s_netif);
+    s_netif = NULL;
+}
+
+// Join the configured network; Wi-Fi is only up for the length of a session
+static esp_err_t wifi_up(void) {
+    static bool netif_ready = false;
+    if (!netif_ready) {
+        ESP_ERROR_CHECK(esp_netif_init());
+        esp_err_t ret = esp_event_loop_create_default();
+        if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) return ret;
+        s_wifi_events = xEventGroupCreate();
+        if (!s_wifi_events) return ESP_ERR_NO_MEM;
+        netif_ready = true;
+    }
+
+    xEventGroupClearBits(s_wifi_events, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT);
+    s_connect_retries = 0;
+    s_netif = esp_netif_create_default_wifi_sta();
+
+    wifi_init_config_t init_cfg = WIFI_INIT_CONFIG_DEFAULT();
+    esp_err_t ret = esp_wifi_init(&init_cfg);
+    if (ret != ESP_OK) {
+        esp_netif_destroy_default_wifi(s_netif);
+        s_netif = NULL;
+        return ret;
+    }
+    esp_event_handler_instance_register(WIFI_EVENT, ESP_EVENT_ANY_ID, wifi_event_handler, NULL, &s_wifi_handler);
+    esp_event_handler_instance_register(IP_EVENT, IP_EVENT_STA_GOT_IP, wifi_event_handler, NULL, &s_ip_handler);
+
+    wifi_config_t cfg = { 0 };
+    strlcpy((char *)cfg.sta.ssid, CONFIG_SALESTAG_WIFI_SSID, sizeof(cfg.sta.ssid));
+    strlcpy((char *)cfg.sta.password, CONFIG_SALESTAG_WIFI_PASSWORD, sizeof(cfg.sta.password));
+    cfg.sta.threshold.authmode = CONFIG_SALESTAG_WIFI_PASSWORD[0] ? WIFI_AUTH_WPA2_PSK : WIFI_AUTH_OPEN;
+
+    ret = esp_wifi_set_mode(WIFI_MODE_STA);
+    if (ret == ESP_OK) ret = esp_wifi_set_config(WIFI_IF_STA, &cfg);
+    if (ret == ESP_OK) ret = esp_wifi_start();
+    if (ret != ESP_OK) {
+        wifi_down();
+        return ret;
+    }
+
+    EventBits_t bits = xEventGroupWaitBits(s_wifi_events, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
+                                           pdFALSE, pdFALSE, pdMS_TO_TICKS(OFFLOAD_CONNECT_MS));
+    if (!(bits & WIFI_CONNECTED_BIT)) {
+        wifi_down();
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
+}
+
+// ---------------------------------------------------------------------------
+// HTTP transport (esp_http_client)
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    esp_http_client_handle_t client;
+    char range[UPL_RANGE_HDR_MAX];
+} http_ctx_t;
+
+static esp_err_t http_event_handler(esp_http_client_event_t *evt) {
+    http_ctx_t *h = (http_ctx_t *)evt->user_data;
+    if (evt->event_id == HTTP_EVENT_ON_HEADER && strcasecmp(evt->header_key, "Range") == 0) {
+        strlcpy(h->range, evt->header_value, sizeof(h->range));
+    }
+    return ESP_OK;
+}
+
+static int http_begin(void *ctx, const char *url, const char *content_range, uint32_t content_len) {
+    http_ctx_t *h = (http_ctx_t *)ctx;
+    if (!h->client) {
+        const esp_http_client_config_t cfg = {
+            .url = url,
+            .method = HTTP_METHOD_PUT,
+            .timeout_ms = OFFLOAD_HTTP_TIMEOUT_MS,
+            .event_handler = http_event_handler,
+            .user_data = h,
+            .crt_bundle_attach = esp_crt_bundle_attach,
+            .keep_alive_enable = true,
+#if CONFIG_ESP_TLS_CLIENT_SESSION_TICKETS
+            // Reconnects after an error resume the TLS session instead of a full handshake
+            .save_client_session = true,
+#endif
+        };
+        h->client = esp_http_client_init(&cfg);
+        if (!h->client) return -1;
+        if (CONFIG_SALESTAG_UPLOAD_TOKEN[0]) {
+            esp_http_client_set_header(h->client, "Authorization", "Bearer " CONFIG_SALESTAG_UPLOAD_TOKEN);
+        }
+        esp_http_client_set_header(h->client, "Content-Type", "application/octet-stream");
+        esp_http_client_set_header(h->client, "X-SalesTag-Device", s_device_id);
+    } else if (esp_http_client_set_url(h->client, url) != ESP_OK) {
+        return -1;
+    }
+    // Same host for every request, so the connection is kept between chunks and files
+    esp_http_client_set_method(h->client, HTTP_METHOD_PUT);
+    esp_http_client_set_header(h->client, "Content-Range", content_range);
+    h->range[0] = '\0';
+    return esp_http_client_open(h->client, (int)content_len) == ESP_OK ? 0 : -1;
+}
+
+static int http_write(void *ctx, const uint8_t *data, size_t len) {
+    http_ctx_t *h = (http_ctx_t *)ctx;
+    while (len > 0) {
+        int n = esp_http_client_write(h->client, (const char *)data, (int)len);
+        if (n <= 0) return -1;
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+static int http_finish(void *ctx, int *http_status, char *range, size_t range_sz) {
+    http_ctx_t *h = (http_ctx_t *)ctx;
+    if (esp_http_client_fetch_headers(h->client) < 0) return -1;
+    *http_status = esp_http_client_get_status_code(h->client);
+    esp_http_client_flush_response(h->client, NULL);
+    strlcpy(range, h->range, range_sz);
+    return 0;
+}
+
+static void http_reset(void *ctx) {
+    http_ctx_t *h = (http_ctx_t *)ctx;
+    if (h->client) esp_http_client_close(h->client);
+}
+
+static const upl_transport_t s_http_ops = {
+    .begin = http_begin,
+    .write = http_write,
+    .finish = http_finish,
+    .reset = http_reset,
+};
+
+// ---------------------------------------------------------------------------
+// Double-buffered SD source: the reader task fills one buffer while the
+// other is being sent
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    int8_t idx;         // Buffer to fill, -1 = exit
+    uint32_t offset;
+} read_req_t;
+
+typedef struct {
+    FILE *fp;
+    uint32_t size;
+    uint8_t buf[2][OFFLOAD_READ_BUF];
+    uint32_t buf_off[2];
+    size_t buf_len[2];
+    bool valid[2];
+    bool pending[2];
+    QueueHandle_t req;
+    SemaphoreHandle_t filled[2];
+    TaskHandle_t reader;
+} sd_source_t;
+
+static sd_source_t s_src;
+
+static void reader_task(void *arg) {
+    sd_source_t *s = (sd_source_t *)arg;
+    read_req_t r;
+    for (;;) {
+        xQueueReceive(s->req, &r, portMAX_DELAY);
+        if (r.idx < 0) break;
+        size_t want = s->size - r.offset < OFFLOAD_READ_BUF ? s->size - r.offset : OFFLOAD_READ_BUF;
+        size_t n = 0;
+        if (fseek(s->fp, (long)r.offset, SEEK_SET) == 0) {
+            n = fread(s->buf[r.idx], 1, want, s->fp);
+        }
+        s->buf_len[r.idx] = n;
+        xSemaphoreGive(s->filled[r.idx]);
+    }
+    xSemaphoreGive(s->filled[0]);
+    vTaskDelete(NULL);
+}
+
+static void prefetch(sd_source_t *s, int idx, uint32_t offset) {
+    if (s->pending[idx] || offset >= s->size) return;
+    read_req_t r = { .idx = (int8_t)idx, .offset = offset };
+    s->buf_off[idx] = offset;
+    s->valid[idx] = false;
+    s->pending[idx] = true;
+    xQueueSend(s->req, &r, portMAX_DELAY);
+}
+
+static void wait_filled(sd_source_t *s, int idx) {
+    if (!s->pending[idx]) return;
+    xSemaphoreTake(s->filled[idx], portMAX_DELAY);
+    s->pending[idx] = false;
+    s->valid[idx] = s->buf_len[idx] > 0;
+}
+
+static int src_open(void *ctx, const char *path, uint32_t *size) {
+    sd_source_t *s = (sd_source_t *)ctx;
+    struct stat st;
+    if (stat(path, &st) != 0) return -1;
+    s->fp = fopen(path, "rb");
+    if (!s->fp) return -1;
+    s->size = (uint32_t)st.st_size;
+    s->valid[0] = s->valid[1] = false;
+    *size = s->size;
+    return 0;
+}
+
+static int src_read(void *ctx, uint32_t offset, size_t max, const uint8_t **data, size_t *len) {
+    sd_source_t *s = (sd_source_t *)ctx;
+    int b = -1;
+    for (int i = 0; i < 2 && b < 0; i++) {
+        if (s->pending[i] && s->buf_off[i] == offset) wait_filled(s, i);
+        if (s->valid[i] && offset >= s->buf_off[i] && offset < s->buf_off[i] + s->buf_len[i]) b = i;
+    }
+    if (b < 0) {
+        // Resume point or retry: not what was prefetched
+        wait_filled(s, 0);
+        wait_filled(s, 1);
+        prefetch(s, 0, offset);
+        wait_filled(s, 0);
+        if (!s->valid[0]) return -1;
+        b = 0;
+    }
+
+    size_t avail = s->buf_off[b] + s->buf_len[b] - offset;
+    *data = s->buf[b] + (offset - s->buf_off[b]);
+    *len = avail < max ? avail : max;
+    // Read ahead into the other buffer while this one goes out
+    prefetch(s, 1 - b, s->buf_off[b] + (uint32_t)s->buf_len[b]);
+    return 0;
+}
+
+static void src_close(void *ctx) {
+    sd_source_t *s = (sd_source_t *)ctx;
+    wait_filled(s, 0);
+    wait_filled(s, 1);
+    if (s->fp) fclose(s->fp);
+    s->fp = NULL;
+}
+
+static const upl_source_t s_src_ops = {
+    .open = src_open,
+    .read = src_read,
+    .close = src_close,
+};
+
+static esp_err_t source_init(sd_source_t *s) {
+    memset(s, 0, sizeof(*s));
+    s->req = xQueueCreate(2, sizeof(read_req_t));
+    s->filled[0] = xSemaphoreCreateBinary();
+    s->filled[1] = xSemaphoreCreateBinary();
+    if (!s->req || !s->filled[0] || !s->filled[1] ||
+        xTaskCreate(reader_task, "offload_rd", 3072, s, 4, &s->reader) != pdPASS) {
+        if (s->req) vQueueDelete(s->req);
+        if (s->filled[0]) vSemaphoreDelete(s->filled[0]);
+        if (s->filled[1]) vSemaphoreDelete(s->filled[1]);
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+static void source_deinit(sd_source_t *s) {
+    read_req_t r = { .idx = -1 };
+    xQueueSend(s->req, &r, portMAX_DELAY);
+    xSemaphoreTake(s->filled[0], portMAX_DELAY);
+    vQueueDelete(s->req);
+    vSemaphoreDelete(s->filled[0]);
+    vSemaphoreDelete(s->filled[1]);
+}
+
+// ---------------------------------------------------------------------------
+// Offload session
+// ---------------------------------------------------------------------------
+
+static bool is_busy(void) {
+    return s_busy_fn && s_busy_fn();
+}
+
+static void sleep_ms(uint32_t ms) {
+    vTaskDelay(pdMS_TO_TICKS(ms));
+}
+
+// Un-synced .raw recordings, oldest name first is not guaranteed - FATFS order
+static int collect_pending(const sync_catalog_t *cat, char names[][SYNC_CATALOG_NAME_MAX], int max) {
+    DIR *dir = opendir(SD_REC_DIR);
+    if (!dir) return 0;
+
+    int count = 0;
+    struct dirent *entry;
+    char path[SD_MAX_PATH];
+    while (count < max && (entry = readdir(dir)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len < 5 || len >= SYNC_CATALOG_NAME_MAX || strcasecmp(entry->d_name + len - 4, ".raw") != 0) continue;
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", SD_REC_DIR, entry->d_name);
+        if (stat(path, &st) != 0 || st.st_size == 0) continue;
+        if (sync_catalog_is_synced(cat, entry->d_name, (uint32_t)st.st_size)) continue;
+        strlcpy(names[count++], entry->d_name, SYNC_CATALOG_NAME_MAX);
+    }
+    closedir(dir);
+    return count;
+}
+
+static void run_session(void) {
+    static char names[OFFLOAD_MAX_FILES][SYNC_CATALOG_NAME_MAX];
+    sync_catalog_t cat;
+    if (sync_catalog_open(&cat, SD_REC_DIR "/" WIFI_OFFLOAD_CATALOG) != 0) {
+        ESP_LOGW(TAG, "Failed to load upload catalog");
+        sync_catalog_close(&cat);
+        return;
+    }
+    int pending = collect_pending(&cat, names, OFFLOAD_MAX_FILES);
+    if (pending == 0) {
+        sync_catalog_close(&cat);
+        return;
+    }
+
+    s_active = true;
+    ESP_LOGI(TAG, "%d recording(s) to upload, joining \"%s\"", pending, CONFIG_SALESTAG_WIFI_SSID);
+    esp_err_t ret = wifi_up();
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "Network not available (%s) - retry in %d s", esp_err_to_name(ret),
+                 CONFIG_SALESTAG_OFFLOAD_INTERVAL_S);
+        s_active = false;
+        sync_catalog_close(&cat);
+        return;
+    }
+    if (source_init(&s_src) != ESP_OK) {
+        wifi_down();
+        s_active = false;
+        sync_catalog_close(&cat);
+        return;
+    }
+
+    const upl_config_t cfg = {
+        .chunk_size = CONFIG_SALESTAG_UPLOAD_CHUNK_KB * 1024,
+        .max_attempts = 5,
+        .backoff_base_ms = 500,
+        .backoff_max_ms = 8000,
+        .sleep_ms = sleep_ms,
+        .should_abort = is_busy,
+    };
+    http_ctx_t http = { 0 };
+    char url[256];
+    char path[SD_MAX_PATH];
+    int uploaded = 0;
+
+    for (int i = 0; i < pending && !is_busy(); i++) {
+        if (!upl_build_url(url, sizeof(url), CONFIG_SALESTAG_UPLOAD_URL, s_device_id, names[i])) {
+            ESP_LOGW(TAG, "Upload URL too long for %s", names[i]);
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", SD_REC_DIR, names[i]);
+
+        upl_stats_t st;
+        int64_t t0 = esp_timer_get_time();
+        upl_result_t r = upl_upload_file(&cfg, &s_http_ops, &http, &s_src_ops, &s_src, url, path, &st);
+        int64_t ms = (esp_timer_get_time() - t0) / 1000;
+        ESP_LOGI(TAG, "%s: %s, %llu B in %lld ms (%.1f KB/s), resumed at %lu, %lu retries",
+                 names[i], upl_result_name(r), (unsigned long long)st.bytes_sent, (long long)ms,
+                 ms > 0 ? st.bytes_sent / 1.024 / ms : 0.0, (unsigned long)st.resumed_from,
+                 (unsigned long)st.retries);
+
+        if (r == UPL_OK) {
+            struct stat fst;
+            // Catalog only on the server's acknowledgement of the whole file
+            if (stat(path, &fst) == 0 && sync_catalog_mark_synced(&cat, names[i], (uint32_t)fst.st_size) == 0) {
+                sync_state_synced(names[i]);
+                uploaded++;
+            } else {
+                ESP_LOGW(TAG, "Failed to record %s as synced", names[i]);
+            }
+        } else if (r == UPL_RETRY_LATER || r == UPL_ABORTED) {
+            break;  // Network trouble or device busy: the rest waits for the next session
+        }
+    }
+
+    if (http.client) esp_http_client_cleanup(http.client);
+    source_deinit(&s_src);
+    wifi_down();
+    sync_catalog_close(&cat);
+    s_active = false;
+    ESP_LOGI(TAG, "Session done: %d/%d uploaded", uploaded, pending);
+}
+
+static void offload_task(void *arg) {
+    vTaskDelay(pdMS_TO_TICKS(OFFLOAD_FIRST_CHECK_MS));
+    for (;;) {
+        if (!is_busy() && sd_storage_is_available()) {
+            run_session();
+        }
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_SALESTAG_OFFLOAD_INTERVAL_S * 1000));
+    }
+}
+
+esp_err_t wifi_offload_start(wifi_offload_busy_fn_t busy_fn) {
+    if (s_task) return ESP_ERR_INVALID_STATE;
+    if (CONFIG_SALESTAG_WIFI_SSID[0] == '\0' || CONFIG_SALESTAG_UPLOAD_URL[0] == '\0') {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    uint8_t mac[6];
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    snprintf(s_device_id, sizeof(s_device_id), "salestag-%02x%02x%02x", mac[3], mac[4], mac[5]);
+
+    s_busy_fn = busy_fn;
+    if (xTaskCreate(offload_task, "wifi_offload", 6144, NULL, 2, &s_task) != pdPASS) {
+        s_task = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Wi-Fi offload enabled as %s -> %s", s_device_id, CONFIG_SALESTAG_UPLOAD_URL);
+    return ESP_OK;
+}
+
+bool wifi_offload_active(void) {
+    return s_active;
+}
+
+#endif // CONFIG_SALESTAG_WIFI_OFFLOAD
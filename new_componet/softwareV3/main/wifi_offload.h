@@ -0,0 +1,43 @@
+/**
+ * @file wifi_offload.h
+ * @brief Opportunistic Wi-Fi upload of un-synced recordings
+ *
+ * While the device is idle, a background task checks the card for .raw
+ * recordings the server has not acknowledged (sync_catalog.h). If there are
+ * any, it joins the configured network and uploads them with the resumable
+ * protocol of upload_proto.h, then shuts Wi-Fi down again. Uploads stop
+ * between chunks as soon as the device gets busy and resume from the
+ * server's byte count next time.
+ */
+
+#ifndef WIFI_OFFLOAD_H
+#define WIFI_OFFLOAD_H
+
+#include "esp_err.h"
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WIFI_OFFLOAD_CATALOG "synced.lst"  // In SD_REC_DIR
+
+// Returns true while the device is busy (recording, BLE transfer); offload yields
+typedef bool (*wifi_offload_busy_fn_t)(void);
+
+/**
+ * @brief Start the background offload task
+ * @param busy_fn Polled before a session and between chunks; may be NULL
+ */
+esp_err_t wifi_offload_start(wifi_offload_busy_fn_t busy_fn);
+
+/**
+ * @brief True while an offload session holds Wi-Fi and reads the card
+ */
+bool wifi_offload_active(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // WIFI_OFFLOAD_H
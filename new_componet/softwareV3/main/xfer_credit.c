@@ -0,0 +1,57 @@
+/**
+ * @file xfer_credit.c
+ * @brief Notification credit window for file transfer data
+ *
+ * Window sizing:
+ *  - Legacy ATT (1 bearer): credits_per_bearer.
+ *  - EATT (N channels): N x credits_per_bearer, at most XFER_MAX_INFLIGHT.
+ * Credits are interchangeable, so completions may come back in any order.
+ * Callers serialize take, give and reset (one lock around each call).
+ */
+
+#include "xfer_credit.h"
+#include <string.h>
+
+uint8_t xfer_credit_bearers(int eatt_chans, int coc_max, bool peer_eatt) {
+    if (eatt_chans <= 0 || coc_max <= 0 || !peer_eatt) {
+        return 1;  // Legacy ATT
+    }
+    int chans = eatt_chans < coc_max ? eatt_chans : coc_max;
+    if (chans > XFER_MAX_BEARERS) {
+        chans = XFER_MAX_BEARERS;
+    }
+    return (uint8_t)chans;
+}
+
+void xfer_credit_init(xfer_credit_t *c, uint8_t bearers, uint8_t credits_per_bearer) {
+    memset(c, 0, sizeof(*c));
+    if (bearers < 1) bearers = 1;
+    if (bearers > XFER_MAX_BEARERS) bearers = XFER_MAX_BEARERS;
+    if (credits_per_bearer < 1) credits_per_bearer = 1;
+    unsigned window = (unsigned)credits_per_bearer * bearers;
+    c->window = (uint8_t)(window > XFER_MAX_INFLIGHT ? XFER_MAX_INFLIGHT : window);
+}
+
+bool xfer_credit_take(xfer_credit_t *c) {
+    if (c->inflight >= c->window) {
+        c->waiting = true;
+        return false;
+    }
+    c->waiting = false;
+    c->inflight++;
+    c->taken++;
+    return true;
+}
+
+bool xfer_credit_give(xfer_credit_t *c) {
+    if (c->inflight == 0) return false;
+    c->inflight--;
+    bool wake = c->waiting;
+    c->waiting = false;
+    return wake;
+}
+
+void xfer_credit_reset(xfer_credit_t *c) {
+    c->inflight = 0;
+    c->waiting = false;
+}
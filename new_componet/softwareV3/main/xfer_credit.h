@@ -0,0 +1,84 @@
+/**
+ * @file xfer_credit.h
+ * @brief Notification credit window for file transfer data
+ *
+ * Bounds the data notifications handed to the stack and not yet completed:
+ * the worker takes a credit before each one and gets it back on its
+ * NOTIFY_TX. NimBLE picks the ATT bearer of every notification itself (the
+ * legacy bearer, or a free Enhanced ATT channel), so credits are not tied to
+ * a bearer; the window just grows with the bearers the connection has, since
+ * each can carry notifications at the same time. Status notifications are
+ * not counted.
+ *
+ * The window also records whether the sender is blocked on it, so a returned
+ * credit wakes the sender only when it is waiting: a semaphore given on every
+ * completion fills with tokens nobody asked for, and each one later wakes the
+ * sender with no credit to take. Pure C - no NimBLE or FreeRTOS dependencies.
+ */
+
+#ifndef XFER_CREDIT_H
+#define XFER_CREDIT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define XFER_MAX_BEARERS       4
+#define XFER_MAX_INFLIGHT      32
+
+typedef struct {
+    uint8_t window;         // Data notifications allowed in flight
+    uint8_t inflight;
+    bool waiting;           // A take failed and no credit has come back since
+    uint32_t taken;         // Credits taken since init
+} xfer_credit_t;
+
+/**
+ * @brief Decide how many ATT bearers a connection can use
+ * @param eatt_chans Enhanced ATT channels configured in the stack (0 = EATT disabled)
+ * @param coc_max L2CAP CoC channels available to the stack
+ * @param peer_eatt true if the peer accepted EATT channel setup
+ * @return Number of bearers (>= 1; 1 means legacy ATT)
+ */
+uint8_t xfer_credit_bearers(int eatt_chans, int coc_max, bool peer_eatt);
+
+/**
+ * @brief Initialize the window with every credit free
+ * @param bearers Result of xfer_credit_bearers()
+ * @param credits_per_bearer In-flight notifications allowed per bearer
+ */
+void xfer_credit_init(xfer_credit_t *c, uint8_t bearers, uint8_t credits_per_bearer);
+
+/**
+ * @brief Take a credit for the next data notification
+ * @return false if the window is full; the sender then counts as waiting
+ */
+bool xfer_credit_take(xfer_credit_t *c);
+
+/**
+ * @brief Return a credit (notify TX complete, or a notification not sent)
+ * @return true if the sender is waiting for it and must be woken (once)
+ */
+bool xfer_credit_give(xfer_credit_t *c);
+
+/**
+ * @brief Return every outstanding credit (lost completions, transfer reset);
+ *        the sender no longer counts as waiting
+ */
+void xfer_credit_reset(xfer_credit_t *c);
+
+/**
+ * @brief Data notifications currently in flight
+ */
+static inline uint8_t xfer_credit_inflight(const xfer_credit_t *c) {
+    return c->inflight;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // XFER_CREDIT_H